@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <anvill/Decl.h>
+#include <anvill/Lifters/EntityLifter.h>
+#include <anvill/Lifters/Options.h>
+#include <benchmark/benchmark.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+
+#include <vector>
+
+#include "Utils.h"
+
+namespace anvill {
+namespace {
+
+using SignatureBuilder = llvm::FunctionType *(*) (llvm::LLVMContext &);
+
+// `int (int, char *, long, double, float)`, which fits in the argument
+// registers of the 64-bit architectures.
+static llvm::FunctionType *ScalarSignature(llvm::LLVMContext &context) {
+  auto i32_type = llvm::Type::getInt32Ty(context);
+  return llvm::FunctionType::get(
+      i32_type,
+      {i32_type, llvm::Type::getInt8PtrTy(context),
+       llvm::Type::getInt64Ty(context), llvm::Type::getDoubleTy(context),
+       llvm::Type::getFloatTy(context)},
+      false);
+}
+
+// `long (long, ..., long)` with more arguments than there are argument
+// registers, so that some of them go on the stack.
+static llvm::FunctionType *SpilledSignature(llvm::LLVMContext &context) {
+  auto i64_type = llvm::Type::getInt64Ty(context);
+  std::vector<llvm::Type *> param_types(10u, i64_type);
+  return llvm::FunctionType::get(i64_type, param_types, false);
+}
+
+// `struct pair (struct pair, int)`, where `struct pair` is `{long, long}`.
+static llvm::FunctionType *StructSignature(llvm::LLVMContext &context) {
+  auto i64_type = llvm::Type::getInt64Ty(context);
+  auto pair_type = llvm::StructType::get(context, {i64_type, i64_type});
+  return llvm::FunctionType::get(
+      pair_type, {pair_type, llvm::Type::getInt32Ty(context)}, false);
+}
+
+// Measures the allocation of a function's signature to registers and stack
+// slots by the default calling convention of the architecture.
+static void BM_AllocateSignature(benchmark::State &state, const char *os_name,
+                                 const char *arch_name,
+                                 SignatureBuilder build_signature) {
+  llvm::LLVMContext context;
+  llvm::Module module("signatures", context);
+  auto arch = BuildArch(context, os_name, arch_name);
+
+  // The register information of the architecture is only known once its
+  // semantics have been loaded, which happens inside of the entity lifter.
+  LifterOptions options(arch.get(), module, nullptr);
+  EntityLifter lifter(options, nullptr, nullptr);
+
+  auto func = llvm::Function::Create(build_signature(context),
+                                     llvm::GlobalValue::ExternalLinkage,
+                                     "func", module);
+
+  for (auto _ : state) {
+    auto maybe_decl = FunctionDecl::Create(*func, arch.get());
+    if (!maybe_decl) {
+      llvm::consumeError(maybe_decl.takeError());
+      state.SkipWithError("Unable to allocate the signature");
+      break;
+    }
+    benchmark::DoNotOptimize(maybe_decl->params.data());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+}  // namespace
+
+BENCHMARK_CAPTURE(BM_AllocateSignature, amd64_scalar, "linux", "amd64",
+                  ScalarSignature);
+BENCHMARK_CAPTURE(BM_AllocateSignature, amd64_spilled, "linux", "amd64",
+                  SpilledSignature);
+BENCHMARK_CAPTURE(BM_AllocateSignature, amd64_struct, "linux", "amd64",
+                  StructSignature);
+
+BENCHMARK_CAPTURE(BM_AllocateSignature, x86_scalar, "linux", "x86",
+                  ScalarSignature);
+
+BENCHMARK_CAPTURE(BM_AllocateSignature, aarch64_scalar, "linux", "aarch64",
+                  ScalarSignature);
+BENCHMARK_CAPTURE(BM_AllocateSignature, aarch64_spilled, "linux", "aarch64",
+                  SpilledSignature);
+BENCHMARK_CAPTURE(BM_AllocateSignature, aarch64_struct, "linux", "aarch64",
+                  StructSignature);
+
+BENCHMARK_CAPTURE(BM_AllocateSignature, sparc32_scalar, "linux", "sparc32",
+                  ScalarSignature);
+BENCHMARK_CAPTURE(BM_AllocateSignature, sparc64_scalar, "linux", "sparc64",
+                  ScalarSignature);
+
+}  // namespace anvill
@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <anvill/Analysis/CrossReferenceResolver.h>
+#include <benchmark/benchmark.h>
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+
+namespace anvill {
+namespace {
+
+// Build a function computing a chain of `length` additions, and return the
+// last addition.
+static llvm::Value *BuildChain(llvm::Module &module, int64_t length) {
+  auto &context = module.getContext();
+  auto i64_type = llvm::Type::getInt64Ty(context);
+  auto func_type = llvm::FunctionType::get(i64_type, false);
+  auto func = llvm::Function::Create(
+      func_type, llvm::GlobalValue::ExternalLinkage, "chain", &module);
+  auto block = llvm::BasicBlock::Create(context, "", func);
+  llvm::IRBuilder<> ir(block);
+
+  // The instructions are inserted directly, so that the builder doesn't
+  // constant fold them.
+  auto base = llvm::ConstantInt::get(i64_type, 0x1000);
+  auto one = llvm::ConstantInt::get(i64_type, 1);
+  llvm::Value *val = ir.Insert(llvm::BinaryOperator::CreateAdd(base, one));
+  for (int64_t i = 1; i < length; ++i) {
+    val = ir.Insert(llvm::BinaryOperator::CreateAdd(val, one));
+  }
+  ir.CreateRet(val);
+  return val;
+}
+
+static void BM_ResolveChainCleared(benchmark::State &state) {
+  llvm::LLVMContext context;
+  llvm::Module module("xrefs", context);
+  auto val = BuildChain(module, state.range(0));
+
+  CrossReferenceResolver resolver(module.getDataLayout());
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(resolver.TryResolveReferenceWithClearedCache(val));
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// Resolving through a warm cache should be independent of the chain length.
+static void BM_ResolveChainCached(benchmark::State &state) {
+  llvm::LLVMContext context;
+  llvm::Module module("xrefs", context);
+  auto val = BuildChain(module, state.range(0));
+
+  CrossReferenceResolver resolver(module.getDataLayout());
+  (void) resolver.TryResolveReferenceWithCaching(val);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(resolver.TryResolveReferenceWithCaching(val));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+}  // namespace
+
+BENCHMARK(BM_ResolveChainCleared)->RangeMultiplier(16)->Range(16, 65536);
+BENCHMARK(BM_ResolveChainCached)->RangeMultiplier(16)->Range(16, 65536);
+
+}  // namespace anvill
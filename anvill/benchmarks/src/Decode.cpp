@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <anvill/Lifters/EntityLifter.h>
+#include <anvill/Lifters/Options.h>
+#include <benchmark/benchmark.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <remill/Arch/Instruction.h>
+
+#include <string_view>
+
+#include "Utils.h"
+
+namespace anvill {
+namespace {
+
+// `FunctionLifter::DecodeInstructionInto` is private, and wraps the
+// architecture's decoder with a decode cache, so this measures the uncached
+// decoder that sits underneath it.
+static void BM_DecodeInstruction(benchmark::State &state, const char *os_name,
+                                 const char *arch_name,
+                                 std::string_view bytes) {
+  llvm::LLVMContext context;
+  llvm::Module module("decode", context);
+  auto arch = BuildArch(context, os_name, arch_name);
+
+  // The register information of the architecture is only known once its
+  // semantics have been loaded, which happens inside of the entity lifter.
+  LifterOptions options(arch.get(), module, nullptr);
+  EntityLifter lifter(options, nullptr, nullptr);
+
+  remill::Instruction inst;
+  for (auto _ : state) {
+    inst.Reset();
+    if (!arch->DecodeInstruction(0x1000u, bytes, inst)) {
+      state.SkipWithError("Unable to decode the instruction");
+      break;
+    }
+    benchmark::DoNotOptimize(inst.next_pc);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+}  // namespace
+
+// `mov rax, qword ptr [rdi + 8*rsi + 0x10]`
+BENCHMARK_CAPTURE(BM_DecodeInstruction, amd64, "linux", "amd64",
+                  std::string_view("\x48\x8b\x44\xf7\x10", 5u));
+
+// `add eax, dword ptr [ebx + 4]`
+BENCHMARK_CAPTURE(BM_DecodeInstruction, x86, "linux", "x86",
+                  std::string_view("\x03\x43\x04", 3u));
+
+// `ldr x0, [x1, #8]`
+BENCHMARK_CAPTURE(BM_DecodeInstruction, aarch64, "linux", "aarch64",
+                  std::string_view("\x20\x04\x40\xf9", 4u));
+
+}  // namespace anvill
@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <anvill/Decl.h>
+#include <anvill/Lifters/EntityLifter.h>
+#include <anvill/Lifters/Options.h>
+#include <anvill/Optimize.h>
+#include <anvill/Program.h>
+#include <anvill/Providers/IControlFlowProvider.h>
+#include <anvill/Providers/MemoryProvider.h>
+#include <anvill/Providers/TypeProvider.h>
+#include <benchmark/benchmark.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "Utils.h"
+
+namespace anvill {
+namespace {
+
+static constexpr uint64_t kFuncAddress = 0x1000u;
+
+// A fixed spec: a single `int add(int, int)` function, whose code is `code`.
+struct FixedSpec {
+  const char *os_name;
+  const char *arch_name;
+  std::vector<uint8_t> code;
+};
+
+// Declare the function of `spec` in `program`.
+static bool DeclareSpec(const FixedSpec &spec, const remill::Arch *arch,
+                        llvm::Module &module, Program &program) {
+  auto err = program.MapRange(kFuncAddress, spec.code, false, true);
+  if (err) {
+    llvm::consumeError(std::move(err));
+    return false;
+  }
+
+  auto i32_type = llvm::Type::getInt32Ty(module.getContext());
+  auto func_type =
+      llvm::FunctionType::get(i32_type, {i32_type, i32_type}, false);
+  auto dummy_function = llvm::Function::Create(
+      func_type, llvm::GlobalValue::ExternalLinkage, "dummy", module);
+
+  auto maybe_decl = FunctionDecl::Create(*dummy_function, arch);
+  dummy_function->eraseFromParent();
+  if (!maybe_decl) {
+    llvm::consumeError(maybe_decl.takeError());
+    return false;
+  }
+
+  maybe_decl->address = kFuncAddress;
+  auto maybe_declared = program.DeclareFunction(*maybe_decl);
+  if (!maybe_declared) {
+    llvm::consumeError(maybe_declared.takeError());
+    return false;
+  }
+
+  program.Freeze();
+  return true;
+}
+
+// Lift and optimize `spec` end-to-end, the same way that `decompile-json`
+// would, including loading the semantics into a fresh context.
+static void BM_LiftAndOptimize(benchmark::State &state, FixedSpec spec) {
+  for (auto _ : state) {
+    llvm::LLVMContext context;
+    llvm::Module module("lifted_code", context);
+    auto arch = BuildArch(context, spec.os_name, spec.arch_name);
+
+    Program program;
+    auto memory = MemoryProvider::CreateProgramMemoryProvider(program);
+    auto types = TypeProvider::CreateProgramTypeProvider(context, program);
+    auto ctrl_flow_provider_res = IControlFlowProvider::Create(program);
+    if (!ctrl_flow_provider_res.Succeeded()) {
+      state.SkipWithError("Unable to create the control flow provider");
+      break;
+    }
+
+    LifterOptions options(arch.get(), module,
+                          ctrl_flow_provider_res.TakeValue());
+    EntityLifter lifter(options, memory, types);
+
+    if (!DeclareSpec(spec, arch.get(), module, program)) {
+      state.SkipWithError("Unable to declare the function");
+      break;
+    }
+
+    program.ForEachFunction([&](const FunctionDecl *decl) {
+      (void) lifter.LiftEntity(*decl);
+      return true;
+    });
+
+    if (!OptimizeModule(lifter, arch.get(), program, module, options)) {
+      state.SkipWithError("Unable to optimize the function");
+      break;
+    }
+    benchmark::DoNotOptimize(module.getFunctionList().size());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+}  // namespace
+
+// `lea eax, [rdi + rsi]; ret`
+BENCHMARK_CAPTURE(BM_LiftAndOptimize, amd64,
+                  FixedSpec{"linux", "amd64", {0x8d, 0x04, 0x37, 0xc3}})
+    ->Unit(benchmark::kMillisecond);
+
+// `mov eax, [esp + 4]; add eax, [esp + 8]; ret`
+BENCHMARK_CAPTURE(BM_LiftAndOptimize, x86,
+                  FixedSpec{"linux",
+                            "x86",
+                            {0x8b, 0x44, 0x24, 0x04, 0x03, 0x44, 0x24, 0x08,
+                             0xc3}})
+    ->Unit(benchmark::kMillisecond);
+
+// `add w0, w0, w1; ret`
+BENCHMARK_CAPTURE(BM_LiftAndOptimize, aarch64,
+                  FixedSpec{"linux",
+                            "aarch64",
+                            {0x00, 0x00, 0x01, 0x0b, 0xc0, 0x03, 0x5f, 0xd6}})
+    ->Unit(benchmark::kMillisecond);
+
+}  // namespace anvill
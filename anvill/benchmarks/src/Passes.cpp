@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <anvill/ITransformationErrorManager.h>
+#include <anvill/Lifters/EntityLifter.h>
+#include <anvill/Lifters/Options.h>
+#include <anvill/Transforms.h>
+#include <benchmark/benchmark.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/IR/Module.h>
+
+#include "Utils.h"
+
+namespace anvill {
+namespace {
+
+// Everything that a pass factory might need to create its pass.
+struct PassEnv {
+  const LifterOptions &options;
+  const EntityLifter &lifter;
+  ITransformationErrorManager &error_manager;
+};
+
+using PassFactory = llvm::Pass *(*) (PassEnv &);
+
+// Run the pass produced by `make_pass` on a fresh copy of the canned module
+// `data_name` on each iteration. Only the pass itself is timed.
+static void BM_Pass(benchmark::State &state, const char *data_name,
+                    PassFactory make_pass) {
+  llvm::LLVMContext context;
+  auto arch = BuildArch(context, "linux", "amd64");
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    {
+      auto module = LoadBenchData(context, data_name);
+      LifterOptions options(arch.get(), *module, nullptr);
+      EntityLifter lifter(options, nullptr, nullptr);
+      auto error_manager = ITransformationErrorManager::Create();
+      PassEnv env{options, lifter, *error_manager};
+
+      llvm::legacy::PassManager pm;
+      pm.add(make_pass(env));
+
+      state.ResumeTiming();
+      benchmark::DoNotOptimize(pm.run(*module));
+      state.PauseTiming();
+    }
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+static llvm::Pass *SinkSelections(PassEnv &env) {
+  return CreateSinkSelectionsIntoBranchTargets(env.error_manager);
+}
+
+static llvm::Pass *InstructionFolder(PassEnv &env) {
+  return CreateInstructionFolderPass(env.error_manager);
+}
+
+static llvm::Pass *RecoverStackFrame(PassEnv &env) {
+  return CreateRecoverStackFrameInformation(env.error_manager, env.options);
+}
+
+static llvm::Pass *RecoverAndSplitStackFrame(PassEnv &env) {
+  return CreateRecoverAndSplitStackFrame(env.error_manager, env.options);
+}
+
+static llvm::Pass *SplitStackFrame(PassEnv &env) {
+  return CreateSplitStackFrameAtReturnAddress(env.error_manager);
+}
+
+static llvm::Pass *RecoverEntityUses(PassEnv &env) {
+  return CreateRecoverEntityUseInformation(env.error_manager, env.lifter);
+}
+
+static llvm::Pass *BrightenPointers(PassEnv &) {
+  return CreateBrightenPointerOperations();
+}
+
+static llvm::Pass *ConvertXorToCmp(PassEnv &) {
+  return CreateConvertXorToCmp();
+}
+
+static llvm::Pass *RemoveTrivialPhisAndSelects(PassEnv &) {
+  return CreateRemoveTrivialPhisAndSelects();
+}
+
+static llvm::Pass *Peepholes(PassEnv &) {
+  return CreatePeepholes();
+}
+
+static llvm::Pass *RemoveCompilerBarriers(PassEnv &) {
+  return CreateRemoveCompilerBarriers();
+}
+
+static llvm::Pass *LowerMemoryAccesses(PassEnv &) {
+  return CreateLowerRemillMemoryAccessIntrinsics();
+}
+
+static llvm::Pass *LowerTypeHints(PassEnv &) {
+  return CreateLowerTypeHintIntrinsics();
+}
+
+static llvm::Pass *RemoveUnusedFPClassificationCalls(PassEnv &) {
+  return CreateRemoveUnusedFPClassificationCalls();
+}
+
+static llvm::Pass *LowerUndefinedIntrinsics(PassEnv &) {
+  return CreateLowerRemillUndefinedIntrinsics();
+}
+
+static llvm::Pass *TransformRemillJumps(PassEnv &env) {
+  return CreateTransformRemillJumpIntrinsics(env.lifter);
+}
+
+static llvm::Pass *RemoveRemillFunctionReturns(PassEnv &env) {
+  return CreateRemoveRemillFunctionReturns(env.lifter);
+}
+
+static llvm::Pass *CleanUpRemillIntrinsics(PassEnv &env) {
+  return CreateCleanUpRemillIntrinsics(env.lifter);
+}
+
+}  // namespace
+
+// clang-format off
+BENCHMARK_CAPTURE(BM_Pass, sink_selections_into_branch_targets,
+                  "SinkSelectionsIntoBranchTargets.ll", SinkSelections);
+BENCHMARK_CAPTURE(BM_Pass, instruction_folder,
+                  "InstructionFolderPass.ll", InstructionFolder);
+BENCHMARK_CAPTURE(BM_Pass, recover_stack_frame_information,
+                  "RecoverStackFrameInformation.ll", RecoverStackFrame);
+BENCHMARK_CAPTURE(BM_Pass, recover_and_split_stack_frame,
+                  "RecoverStackFrameInformation.ll", RecoverAndSplitStackFrame);
+BENCHMARK_CAPTURE(BM_Pass, split_stack_frame_at_return_address,
+                  "SplitStackFrameAtReturnAddress.ll", SplitStackFrame);
+BENCHMARK_CAPTURE(BM_Pass, recover_entity_use_information,
+                  "chall2.ll", RecoverEntityUses);
+BENCHMARK_CAPTURE(BM_Pass, brighten_pointer_operations,
+                  "chall2.ll", BrightenPointers);
+BENCHMARK_CAPTURE(BM_Pass, convert_xor_to_cmp,
+                  "xor_conversion.ll", ConvertXorToCmp);
+BENCHMARK_CAPTURE(BM_Pass, remove_trivial_phis_and_selects,
+                  "chall2.ll", RemoveTrivialPhisAndSelects);
+BENCHMARK_CAPTURE(BM_Pass, peepholes, "chall2.ll", Peepholes);
+BENCHMARK_CAPTURE(BM_Pass, remove_compiler_barriers,
+                  "ret0.ll", RemoveCompilerBarriers);
+BENCHMARK_CAPTURE(BM_Pass, lower_remill_memory_access_intrinsics,
+                  "chall2.ll", LowerMemoryAccesses);
+BENCHMARK_CAPTURE(BM_Pass, lower_type_hint_intrinsics,
+                  "test_binja_var_none_type_rt.ll", LowerTypeHints);
+BENCHMARK_CAPTURE(BM_Pass, remove_unused_fp_classification_calls,
+                  "ret0.ll", RemoveUnusedFPClassificationCalls);
+BENCHMARK_CAPTURE(BM_Pass, lower_remill_undefined_intrinsics,
+                  "ret0.ll", LowerUndefinedIntrinsics);
+BENCHMARK_CAPTURE(BM_Pass, transform_remill_jump_intrinsics,
+                  "TransformRemillJumpData0.ll", TransformRemillJumps);
+BENCHMARK_CAPTURE(BM_Pass, remove_remill_function_returns,
+                  "jmp0.ll", RemoveRemillFunctionReturns);
+BENCHMARK_CAPTURE(BM_Pass, clean_up_remill_intrinsics,
+                  "TransformRemillJumpData0.ll", CleanUpRemillIntrinsics);
+// clang-format on
+
+}  // namespace anvill
@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <anvill/Decl.h>
+#include <anvill/Program.h>
+#include <benchmark/benchmark.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/LLVMContext.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace anvill {
+namespace {
+
+static constexpr uint64_t kRangeSize = 4096u;
+
+// Map `num_ranges` page-sized ranges, each one separated by a page-sized gap.
+static void MapRanges(Program &program, int64_t num_ranges) {
+  for (int64_t i = 0; i < num_ranges; ++i) {
+    std::vector<uint8_t> data(kRangeSize, static_cast<uint8_t>(i));
+    auto err = program.MapRange(static_cast<uint64_t>(i) * kRangeSize * 2u,
+                                std::move(data), false, true);
+    if (err) {
+      llvm::consumeError(std::move(err));
+    }
+  }
+  program.Freeze();
+}
+
+static void BM_FindByte(benchmark::State &state) {
+  Program program;
+  MapRanges(program, state.range(0));
+
+  const auto max_address = static_cast<uint64_t>(state.range(0)) * kRangeSize;
+  uint64_t address = 0u;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(program.FindByte(address));
+
+    // Stride through the mapped and unmapped addresses, so that every lookup
+    // lands in a different place.
+    address = (address + 4099u) % (max_address * 2u);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+static void BM_FindBytes(benchmark::State &state) {
+  Program program;
+  MapRanges(program, state.range(0));
+
+  const auto max_address = static_cast<uint64_t>(state.range(0)) * kRangeSize;
+  uint64_t address = 0u;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(program.FindBytes(address, 15u));
+    address = (address + 4099u) % (max_address * 2u);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// Find the variables containing addresses, where the variables are arrays
+// separated by gaps. `state.range(1)` says whether or not the program is
+// frozen with a data layout, and so has the extents of its variables indexed.
+static void BM_FindInVariable(benchmark::State &state) {
+  llvm::LLVMContext context;
+  llvm::DataLayout dl("e-p:64:64");
+  const auto type =
+      llvm::ArrayType::get(llvm::Type::getInt32Ty(context), kRangeSize / 8u);
+
+  Program program;
+  const auto num_vars = static_cast<uint64_t>(state.range(0));
+  for (uint64_t i = 0; i < num_vars; ++i) {
+    GlobalVarDecl decl;
+    decl.address = i * kRangeSize;
+    decl.type = type;
+    if (auto err = program.DeclareVariable(decl)) {
+      llvm::consumeError(std::move(err));
+    }
+  }
+
+  if (state.range(1)) {
+    program.Freeze(dl);
+  } else {
+    program.Freeze();
+  }
+
+  const auto max_address = num_vars * kRangeSize;
+  uint64_t address = 0u;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(program.FindInVariable(address, dl));
+    address = (address + 4099u) % max_address;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+}  // namespace
+
+BENCHMARK(BM_FindByte)->RangeMultiplier(8)->Range(1, 4096);
+BENCHMARK(BM_FindBytes)->RangeMultiplier(8)->Range(1, 4096);
+BENCHMARK(BM_FindInVariable)->ArgsProduct({{1, 64, 4096}, {0, 1}});
+
+}  // namespace anvill
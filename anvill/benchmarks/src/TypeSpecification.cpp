@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <anvill/ITypeSpecification.h>
+#include <benchmark/benchmark.h>
+#include <llvm/IR/LLVMContext.h>
+
+namespace anvill {
+namespace {
+
+// The same context is reused across iterations, so after the first iteration
+// this measures parsing, not the creation of new types.
+static void ParseSpec(benchmark::State &state, const char *spec) {
+  llvm::LLVMContext context;
+  for (auto _ : state) {
+    auto maybe_spec = ITypeSpecification::Create(context, spec);
+    if (!maybe_spec.Succeeded()) {
+      state.SkipWithError("Unable to parse the type specification");
+      break;
+    }
+    benchmark::DoNotOptimize(maybe_spec.TakeValue());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+static void BM_ParseSpecScalar(benchmark::State &state) {
+  ParseSpec(state, "l");
+}
+
+static void BM_ParseSpecPointer(benchmark::State &state) {
+  ParseSpec(state, "**b");
+}
+
+// `__libc_start_main`.
+static void BM_ParseSpecFunction(benchmark::State &state) {
+  ParseSpec(state, "(*(i**b**bi)i**b*(i**b**bi)*(vi)*(vi)*vi)");
+}
+
+static void BM_ParseSpecStruct(benchmark::State &state) {
+  ParseSpec(state, "{i[bx16]*{lh}d}");
+}
+
+}  // namespace
+
+BENCHMARK(BM_ParseSpecScalar);
+BENCHMARK(BM_ParseSpecPointer);
+BENCHMARK(BM_ParseSpecFunction);
+BENCHMARK(BM_ParseSpecStruct);
+
+}  // namespace anvill
@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Utils.h"
+
+#include <llvm/IRReader/IRReader.h>
+#include <llvm/Support/SourceMgr.h>
+#include <remill/Arch/Name.h>
+#include <remill/OS/OS.h>
+
+#include <stdexcept>
+
+namespace anvill {
+
+std::unique_ptr<llvm::Module> LoadBenchData(llvm::LLVMContext &context,
+                                            const std::string &data_name) {
+  auto data_path = std::string(ANVILL_BENCH_DATA_PATH) + "/" + data_name;
+
+  llvm::SMDiagnostic error;
+  auto module = llvm::parseIRFile(data_path, error, context);
+  if (!module) {
+    throw std::runtime_error("Failed to load the benchmark data named " +
+                             data_name + ": " + error.getMessage().str());
+  }
+
+  return module;
+}
+
+remill::Arch::ArchPtr BuildArch(llvm::LLVMContext &context,
+                                const std::string &os_name,
+                                const std::string &arch_name) {
+  auto arch = remill::Arch::Build(&context, remill::GetOSName(os_name),
+                                  remill::GetArchName(arch_name));
+  if (!arch) {
+    throw std::runtime_error("Failed to build the architecture " + arch_name);
+  }
+
+  return arch;
+}
+
+}  // namespace anvill
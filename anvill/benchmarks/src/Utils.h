@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <remill/Arch/Arch.h>
+
+#include <memory>
+#include <string>
+
+namespace anvill {
+
+// Load the canned IR module named `data_name` out of the `anvill_passes`
+// test data.
+std::unique_ptr<llvm::Module> LoadBenchData(llvm::LLVMContext &context,
+                                            const std::string &data_name);
+
+// Build the remill architecture `arch_name` for `os_name`.
+remill::Arch::ArchPtr BuildArch(llvm::LLVMContext &context,
+                                const std::string &os_name,
+                                const std::string &arch_name);
+
+}  // namespace anvill
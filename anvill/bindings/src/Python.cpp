@@ -0,0 +1,279 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <anvill/Decl.h>
+#include <anvill/ITypeSpecification.h>
+#include <anvill/Lifters/EntityLifter.h>
+#include <anvill/Lifters/Options.h>
+#include <anvill/Optimize.h>
+#include <anvill/Program.h>
+#include <anvill/Providers/IControlFlowProvider.h>
+#include <anvill/Providers/MemoryProvider.h>
+#include <anvill/Providers/TypeProvider.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/raw_ostream.h>
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+#include <remill/Arch/Arch.h>
+#include <remill/Arch/Name.h>
+#include <remill/OS/OS.h>
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace py = pybind11;
+
+namespace anvill {
+namespace {
+
+// Raise `err`, if it is an error, as a Python `RuntimeError`.
+static void ThrowIfError(llvm::Error err) {
+  if (err) {
+    throw std::runtime_error(llvm::toString(std::move(err)));
+  }
+}
+
+// Parse the type specification `spec`, in the format of the types of a JSON
+// spec, into an LLVM type.
+static llvm::Type *ParseType(llvm::LLVMContext &context,
+                             const std::string &spec) {
+  auto type_spec_res = ITypeSpecification::Create(context, spec);
+  if (!type_spec_res.Succeeded()) {
+    auto error = type_spec_res.TakeError();
+    throw py::value_error(error.message + " in type specification '" + spec +
+                          "'");
+  }
+  return type_spec_res.TakeValue()->Type();
+}
+
+// Map the name of an optimization level, as Python passes it, to the level.
+static OptimizationLevel ParseOptimizationLevel(const std::string &name) {
+  if (name == "fast") {
+    return OptimizationLevel::kFast;
+  } else if (name == "default") {
+    return OptimizationLevel::kDefault;
+  } else if (name == "thorough") {
+    return OptimizationLevel::kThorough;
+  } else {
+    throw py::value_error("Unknown optimization level '" + name +
+                          "'; expected 'fast', 'default', or 'thorough'");
+  }
+}
+
+// A program, and a lifter for it, for use from Python. Disassembler plugins
+// declare what they know about a binary straight into the program, rather
+// than serializing it into a JSON spec for `anvill-decompile-json` to parse
+// again, and then get back the bitcode of the functions that they lift.
+//
+// The program is frozen by the first lift, after which nothing more can be
+// declared in it.
+class PythonLifter {
+ public:
+  PythonLifter(const std::string &arch_name, const std::string &os_name,
+               const std::string &opt_level)
+      : arch(remill::Arch::Build(&context, remill::GetOSName(os_name),
+                                 remill::GetArchName(arch_name))),
+        pipeline(
+            OptimizationPipeline::Create(ParseOptimizationLevel(opt_level))) {
+    if (!arch) {
+      throw py::value_error("Unsupported architecture '" + arch_name +
+                            "' or operating system '" + os_name + "'");
+    }
+
+    module.reset(new llvm::Module("lifted_code", context));
+
+    auto ctrl_flow_provider_res = IControlFlowProvider::Create(program);
+    if (!ctrl_flow_provider_res.Succeeded()) {
+      throw std::runtime_error("Unable to create the control flow provider");
+    }
+
+    options.reset(new LifterOptions(arch.get(), *module,
+                                    ctrl_flow_provider_res.TakeValue()));
+
+    // This loads the semantics, and only then does remill know about the
+    // registers that declaring functions refers to.
+    lifter.emplace(*options,
+                   MemoryProvider::CreateProgramMemoryProvider(program),
+                   TypeProvider::CreateProgramTypeProvider(context, program));
+  }
+
+  // Map the bytes of `data`, any object supporting the buffer protocol, into
+  // the program at `address`. The bytes aren't copied; instead, the program
+  // holds on to a view of `data`, which keeps `data` alive and unresizable.
+  void MapRange(uint64_t address, py::buffer data, bool is_writeable,
+                bool is_executable) {
+    auto info = std::make_shared<py::buffer_info>(data.request());
+    if (info->itemsize != 1 || info->ndim != 1 || info->strides[0] != 1) {
+      throw py::value_error("Mapped memory must be a contiguous buffer of "
+                            "bytes");
+    }
+
+    const auto bytes = static_cast<const uint8_t *>(info->ptr);
+    const auto size = static_cast<uint64_t>(info->size);
+
+    // The view may be released by whoever drops the last reference to the
+    // program, so it takes the GIL to do so.
+    const auto view = info.get();
+    std::shared_ptr<const void> owner(
+        view, [info = std::move(info)](const void *) mutable {
+          py::gil_scoped_acquire gil;
+          info.reset();
+        });
+    ThrowIfError(program.MapBorrowedRange(address, bytes, size,
+                                          std::move(owner), is_writeable,
+                                          is_executable));
+  }
+
+  // Declare a function at `address` whose type is the function type
+  // specification `type_spec`, and whose parameters and return values are
+  // located according to the calling convention of the architecture.
+  void DeclareFunction(uint64_t address, const std::string &type_spec,
+                       const std::string &name) {
+    auto func_type =
+        llvm::dyn_cast<llvm::FunctionType>(ParseType(context, type_spec));
+    if (!func_type) {
+      throw py::value_error("Type specification '" + type_spec +
+                            "' of a function is not a function type");
+    }
+
+    auto dummy_function = llvm::Function::Create(
+        func_type, llvm::Function::ExternalLinkage, "", module.get());
+    auto maybe_decl = FunctionDecl::Create(*dummy_function, arch.get());
+    dummy_function->eraseFromParent();
+    if (!maybe_decl) {
+      ThrowIfError(maybe_decl.takeError());
+    }
+
+    maybe_decl->address = address;
+    ThrowIfError(program.DeclareFunction(*maybe_decl).takeError());
+    AddName(address, name);
+  }
+
+  // Declare a variable at `address` whose type is `type_spec`.
+  void DeclareVariable(uint64_t address, const std::string &type_spec,
+                       const std::string &name) {
+    GlobalVarDecl decl;
+    decl.address = address;
+    decl.type = ParseType(context, type_spec);
+    ThrowIfError(program.DeclareVariable(decl));
+    AddName(address, name);
+  }
+
+  void AddControlFlowRedirection(uint64_t from, uint64_t to) {
+    program.AddControlFlowRedirection(from, to);
+  }
+
+  bool SetControlFlowTargets(uint64_t source,
+                             std::vector<uint64_t> destinations,
+                             bool complete) {
+    ControlFlowTargetList targets;
+    targets.source = source;
+    targets.destination_list = std::move(destinations);
+    targets.complete = complete;
+    return program.TrySetControlFlowTargets(targets);
+  }
+
+  void AddName(uint64_t address, const std::string &name) {
+    if (!name.empty()) {
+      program.AddNameToAddress(name, address);
+    }
+  }
+
+  // Lift and optimize the function declared at `address`, and return the
+  // bitcode of a module holding it.
+  py::bytes LiftFunction(uint64_t address) {
+    if (!program.IsFrozen()) {
+      program.Freeze(module->getDataLayout());
+    }
+
+    const auto decl = program.FindFunction(address);
+    if (!decl) {
+      throw py::value_error("No function is declared at address " +
+                            std::to_string(address));
+    }
+
+    auto lifted = lifter->LiftAndOptimizeFunction(*decl, pipeline);
+    if (!lifted) {
+      throw std::runtime_error("Unable to lift the function at address " +
+                               std::to_string(address));
+    }
+
+    // The lifted function is the first one defined in its module.
+    for (auto &func : *lifted) {
+      if (!func.isDeclaration()) {
+        program.ForEachNameOfAddress(
+            address, [&](const std::string &name, const FunctionDecl *,
+                         const GlobalVarDecl *) {
+              func.setName(name);
+              return false;
+            });
+        break;
+      }
+    }
+
+    std::string bitcode;
+    llvm::raw_string_ostream os(bitcode);
+    llvm::WriteBitcodeToFile(*lifted, os);
+    os.flush();
+    return py::bytes(bitcode);
+  }
+
+ private:
+  llvm::LLVMContext context;
+  std::unique_ptr<const remill::Arch> arch;
+  OptimizationPipeline pipeline;
+  std::unique_ptr<llvm::Module> module;
+  Program program;
+  std::unique_ptr<LifterOptions> options;
+  std::optional<EntityLifter> lifter;
+};
+
+}  // namespace
+}  // namespace anvill
+
+PYBIND11_MODULE(anvill_native, m) {
+  m.doc() = "Lift code with anvill, without going through a JSON spec.";
+
+  py::class_<anvill::PythonLifter>(m, "Lifter")
+      .def(py::init<const std::string &, const std::string &,
+                    const std::string &>(),
+           py::arg("arch"), py::arg("os"), py::arg("opt_level") = "default")
+      .def("map_range", &anvill::PythonLifter::MapRange, py::arg("address"),
+           py::arg("data"), py::arg("is_writeable") = false,
+           py::arg("is_executable") = false)
+      .def("declare_function", &anvill::PythonLifter::DeclareFunction,
+           py::arg("address"), py::arg("type"), py::arg("name") = "")
+      .def("declare_variable", &anvill::PythonLifter::DeclareVariable,
+           py::arg("address"), py::arg("type"), py::arg("name") = "")
+      .def("add_control_flow_redirection",
+           &anvill::PythonLifter::AddControlFlowRedirection, py::arg("source"),
+           py::arg("destination"))
+      .def("set_control_flow_targets",
+           &anvill::PythonLifter::SetControlFlowTargets, py::arg("source"),
+           py::arg("destinations"), py::arg("complete") = false)
+      .def("add_name", &anvill::PythonLifter::AddName, py::arg("address"),
+           py::arg("name"))
+      .def("lift_function", &anvill::PythonLifter::LiftFunction,
+           py::arg("address"));
+}
@@ -82,8 +82,8 @@ extern const std::string kAnvillSwitchCompleteFunc;
 // The anvill function used to handle incomplete switch cases
 extern const std::string kAnvillSwitchIncompleteFunc;
 
-// The name of the uninterpreted function that implements data provenance
-// tracking.
-extern const std::string kAnvillDataProvenanceFunc;
+// The name of the function attribute given to functions that went over one
+// of their lifting or optimization budgets. Its value says which budget.
+extern const std::string kBudgetExceededAttribute;
 
 }  // namespace anvill
@@ -17,6 +17,8 @@
 
 #pragma once
 
+#include <memory>
+
 namespace llvm {
 class DataLayout;
 class Module;
@@ -41,4 +43,40 @@ bool IsRelatedToStackPointer(llvm::Module *module, llvm::Value *val);
 // be the aliasee of an `llvm::GlobalAlias`.
 bool CanBeAliased(llvm::Value *val);
 
+// Answers the above questions about the values used in a module, and
+// remembers the answers, so that passes asking about every operand of every
+// instruction in a function don't keep walking the same use-def chains and
+// constant expressions. Once a value has been asked about, asking again is a
+// single lookup.
+//
+// The answers are remembered by `llvm::Value` pointer, and so an analysis
+// should only be kept around for as long as the values it was asked about are
+// neither erased nor have their operands changed, e.g. for the analysis phase
+// of a function pass.
+class SymbolicValueAnalysis {
+ public:
+  explicit SymbolicValueAnalysis(llvm::Module *module);
+  ~SymbolicValueAnalysis(void);
+
+  // Returns `true` if it looks like `val` is the program counter.
+  bool IsProgramCounter(llvm::Value *val);
+
+  // Returns `true` if it looks like `val` is the stack counter.
+  bool IsStackPointer(llvm::Value *val);
+
+  // Returns `true` if it looks like `val` is the return address.
+  bool IsReturnAddress(llvm::Value *val);
+
+  // Returns `true` if it looks like `val` is derived from a symbolic stack
+  // pointer representation.
+  bool IsRelatedToStackPointer(llvm::Value *val);
+
+ private:
+  SymbolicValueAnalysis(const SymbolicValueAnalysis &) = delete;
+  SymbolicValueAnalysis &operator=(const SymbolicValueAnalysis &) = delete;
+
+  class Impl;
+  std::unique_ptr<Impl> impl;
+};
+
 }  // namespace anvill
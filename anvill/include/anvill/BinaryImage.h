@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <llvm/Support/Error.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace anvill {
+
+class Program;
+
+// The loadable segments of an executable file, e.g. an ELF binary. This lets
+// a `Program` get its memory straight out of the binary being decompiled,
+// instead of out of the memory ranges of a spec, which are just hex-encoded
+// copies of the same segments.
+//
+// Only ELF files, 32- or 64-bit and of either byte order, are supported.
+class BinaryImage {
+ public:
+
+  // A loadable segment. The first `file_size` bytes of the segment are found
+  // at `file_offset` within the file, and the rest of its `size` bytes are
+  // zero, e.g. for `.bss`.
+  struct Segment {
+    uint64_t address{0};
+    uint64_t size{0};
+    uint64_t file_offset{0};
+    uint64_t file_size{0};
+    bool is_writeable{false};
+    bool is_executable{false};
+  };
+
+  // Read the segments of the executable file at `path`. The returned image
+  // remembers `path`, so that its segments can later be mapped by
+  // `MapMemory`.
+  static llvm::Expected<BinaryImage> Read(const std::string &path);
+
+  // Map the segments of this image into `program`. The file-backed bytes of
+  // each segment are memory-mapped from the file, not copied, and the rest
+  // are mapped as a zero-fill range.
+  llvm::Error MapMemory(Program &program) const;
+
+  // Path to the executable file.
+  const std::string &Path(void) const {
+    return path;
+  }
+
+  std::vector<Segment> segments;
+
+ private:
+  std::string path;
+};
+
+}  // namespace anvill
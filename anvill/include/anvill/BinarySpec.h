@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Error.h>
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace llvm {
+class DataLayout;
+}  // namespace llvm
+namespace anvill {
+
+class Program;
+
+// A compact, binary alternative to the JSON specification format. A binary
+// spec holds the same information as a JSON spec, but its memory ranges are
+// stored as raw bytes instead of as hex strings, and all of its strings (type
+// specifications, register names, symbol names) are interned into a single
+// string table.
+//
+// A binary spec file is laid out as follows, with all integers stored in
+// little-endian byte order:
+//
+//    Header          "ANVLSPEC", u32 version, u32 number of sections
+//    Section table   u32 kind, u32 padding, u64 file offset, u64 size
+//    Sections        The contents of each section in the section table
+//    Memory data     The bytes of each memory range, page-aligned
+//
+// The bytes of memory ranges are never read by `Read`; instead, they are
+// memory-mapped directly into a `Program` by `MapMemory`. Zero-fill ranges
+// have no bytes in the file at all, only a size.
+//
+// Strings in records are `llvm::StringRef`s into storage owned by whatever
+// produced the records, e.g. the string table of a `BinarySpec` returned by
+// `Read`, or a parsed JSON document. An empty string means "not present."
+class BinarySpec {
+ public:
+  enum SectionKind : uint32_t {
+    kStrings = 1,
+    kTarget = 2,
+    kMemory = 3,
+    kFunctions = 4,
+    kVariables = 5,
+    kControlFlowRedirections = 6,
+    kControlFlowTargets = 7,
+    kSymbols = 8,
+  };
+
+  // The location of a value, in a register or in memory.
+  struct Value {
+    llvm::StringRef type;
+    llvm::StringRef reg;
+    llvm::StringRef mem_reg;
+    int64_t mem_offset{0};
+  };
+
+  struct Parameter : public Value {
+    llvm::StringRef name;
+  };
+
+  struct TypedRegister {
+    uint64_t address{0};
+    llvm::StringRef reg;
+    llvm::StringRef type;
+    bool has_value{false};
+    uint64_t value{0};
+  };
+
+  // A function declaration. If `type` is present, then it takes precedence
+  // over the parameters and return values.
+  struct Function {
+    uint64_t address{0};
+    llvm::StringRef type;
+    std::vector<Parameter> params;
+    Value return_address;
+    llvm::StringRef return_stack_pointer;
+    int64_t return_stack_pointer_offset{0};
+    std::vector<Value> returns;
+    bool is_noreturn{false};
+    bool is_variadic{false};
+    uint32_t calling_convention{0};
+    std::vector<TypedRegister> register_info;
+  };
+
+  struct Variable {
+    uint64_t address{0};
+    llvm::StringRef type;
+  };
+
+  // A memory range. When writing a spec, `data` holds the bytes to write.
+  // When reading a spec, `data` is left empty, and the bytes are instead
+  // found at `file_offset` within the spec file.
+  //
+  // A zero-fill range holds `size` zero-valued bytes, which are stored
+  // neither in `data` nor in the spec file.
+  struct Range {
+    uint64_t address{0};
+    uint64_t size{0};
+    uint64_t file_offset{0};
+    bool is_writeable{false};
+    bool is_executable{false};
+    bool is_zero_fill{false};
+    std::vector<uint8_t> data;
+  };
+
+  struct ControlFlowTargets {
+    uint64_t source{0};
+    bool complete{false};
+    std::vector<uint64_t> destinations;
+  };
+
+  struct Symbol {
+    uint64_t address{0};
+    llvm::StringRef name;
+  };
+
+  BinarySpec(void) = default;
+  BinarySpec(BinarySpec &&) noexcept = default;
+  BinarySpec &operator=(BinarySpec &&) noexcept = default;
+
+  // Specs aren't copyable, as the records of a spec returned by `Read` refer to
+  // the spec's own string table.
+  BinarySpec(const BinarySpec &) = delete;
+  BinarySpec &operator=(const BinarySpec &) = delete;
+
+  // Read the binary spec at `path`. The returned spec remembers `path`, so
+  // that its memory can later be mapped by `MapMemory`.
+  static llvm::Expected<BinarySpec> Read(const std::string &path);
+
+  // Write this spec to the file at `path`.
+  llvm::Error Write(const std::string &path) const;
+
+  // Map the memory ranges of a spec returned by `Read` into `program`. The
+  // bytes of the ranges are memory-mapped from the spec file, not copied.
+  llvm::Error MapMemory(Program &program) const;
+
+  // Capture everything that has been built up in `program` as a spec: its
+  // memory, its declarations, its control-flow redirections and targets, and
+  // its names. Types are turned back into type specifications using
+  // `layout`, and registers into their names, so that a snapshot doesn't
+  // depend on any LLVM context. Writing the snapshot and then declaring the
+  // spec returned by `Read` rebuilds an equivalent program, without parsing
+  // a JSON spec again, and with the memory mapped from the spec file.
+  //
+  // The `arch` and `os` of the snapshot are left empty, as a program doesn't
+  // know about them. Undefined bytes aren't captured.
+  static BinarySpec Snapshot(const Program &program,
+                             const llvm::DataLayout &layout);
+
+  std::string arch;
+  std::string os;
+  std::vector<Range> memory;
+  std::vector<Function> functions;
+  std::vector<Variable> variables;
+  std::vector<std::pair<uint64_t, uint64_t>> control_flow_redirections;
+  std::vector<ControlFlowTargets> control_flow_targets;
+  std::vector<Symbol> symbols;
+
+ private:
+
+  // Path to the spec file, if this spec was returned by `Read`.
+  std::string path;
+
+  // Interned strings, referenced by the records of a spec returned by `Read`.
+  std::vector<std::string> strings;
+};
+
+}  // namespace anvill
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <llvm/Support/Error.h>
+
+#include <cstdint>
+#include <memory>
+
+namespace llvm {
+class Function;
+class Module;
+}  // namespace llvm
+namespace anvill {
+
+class CompressedFunctionsImpl;
+
+// Keeps the bodies of functions that are done being lifted, but that aren't
+// needed until the module is optimized, as compressed bitcode in memory. A
+// compressed function is left materializable, rather than as a declaration,
+// and this installs itself as the materializer of the module, so that the
+// body comes back the usual LLVM way: whenever something asks for the
+// function to be materialized, e.g. `OptimizeModule` materializing the whole
+// module.
+//
+// A compressed function refers to other functions and variables by name, so
+// nothing that it refers to should be renamed, replaced, or deleted until it's
+// materialized.
+class CompressedFunctions {
+ public:
+  ~CompressedFunctions(void);
+
+  // Compress functions of `module`.
+  explicit CompressedFunctions(llvm::Module &module);
+
+  // Compress the body of `func`, a function of the module. Returns `false`,
+  // leaving `func` alone, if `func` isn't defined, or if it can't be linked
+  // back into the module by name, e.g. because it refers to something with
+  // local linkage, or if the module already has a different materializer.
+  bool Compress(llvm::Function &func) const;
+
+  // Materialize every function that is still compressed.
+  llvm::Error MaterializeAll(void) const;
+
+  // Returns the number of functions that are compressed right now.
+  uint64_t NumFunctions(void) const;
+
+  // Returns the number of bytes of compressed bitcode held right now, and the
+  // number of bytes that this bitcode would take up uncompressed.
+  uint64_t NumCompressedBytes(void) const;
+  uint64_t NumBitcodeBytes(void) const;
+
+ private:
+  CompressedFunctions(const CompressedFunctions &) = delete;
+  CompressedFunctions &operator=(const CompressedFunctions &) = delete;
+
+  std::shared_ptr<CompressedFunctionsImpl> impl;
+};
+
+}  // namespace anvill
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <cstdint>
+
+namespace anvill {
+
+// Process-wide counters of how often the lifter's caches are hit, and of how
+// often functions go over their budgets. The counters are always kept, and
+// only ever go up, so that tools can sample them at any time, e.g. to export
+// them as metrics, and look at how they change between samples.
+enum class Counter : unsigned {
+
+  // Lookups of the instruction semantics of an architecture/OS pair, and of
+  // those lookups that had to load the semantics from disk.
+  kSemanticsCacheHits,
+  kSemanticsCacheMisses,
+
+  // Lookups of decoded instructions in the decoded instruction caches of the
+  // entity lifters.
+  kDecodeCacheHits,
+  kDecodeCacheMisses,
+
+  // Lookups of function and variable decls in caching type providers (see
+  // `TypeProvider::CreateCachingTypeProvider`).
+  kTypeCacheHits,
+  kTypeCacheMisses,
+
+  // Loads of the optimized bitcode of functions from a `FunctionCache`.
+  kFunctionCacheHits,
+  kFunctionCacheMisses,
+
+  // Functions that went over one of their lifting or optimization budgets
+  // (see `LifterOptions`).
+  kLiftBudgetExceeded,
+  kOptimizeBudgetExceeded,
+
+  // Functions whose bodies were compressed while idle, and then decompressed
+  // again (see `CompressedFunctions`).
+  kFunctionsCompressed,
+  kFunctionsDecompressed,
+
+  // Lookups of pages of memory in paged memory providers (see
+  // `MemoryProvider::CreatePagedMemoryProvider`), where a miss is a lookup
+  // that had to wait for the page to be fetched.
+  kMemoryPageCacheHits,
+  kMemoryPageCacheMisses,
+};
+
+static constexpr unsigned kNumCounters =
+    static_cast<unsigned>(Counter::kMemoryPageCacheMisses) + 1u;
+
+// Adds `amount` to `counter`. This is cheap enough to do on hot paths, from
+// many threads at once.
+void IncrementCounter(Counter counter, uint64_t amount = 1u);
+
+// Returns the value of `counter`.
+uint64_t ReadCounter(Counter counter);
+
+// Returns the name of `counter`, e.g. `decode_cache_hits`.
+const char *CounterName(Counter counter);
+
+}  // namespace anvill
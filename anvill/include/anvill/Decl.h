@@ -17,12 +17,13 @@
 
 #pragma once
 
+#include <llvm/ADT/ArrayRef.h>
 #include <llvm/IR/CallingConv.h>
 
 #include <cstdint>
+#include <memory>
 #include <optional>
 #include <string>
-#include <unordered_map>
 #include <vector>
 
 #if __has_include(<llvm/Support/JSON.h>)
@@ -51,6 +52,7 @@ struct Register;
 namespace anvill {
 
 class Program;
+class SignatureAllocationCache;
 
 // A value, such as a parameter or a return value. Values are resident
 // in one of two locations: either in a register, represented by a non-
@@ -89,6 +91,8 @@ struct ParameterDecl : public ValueDecl {
 // A TypedRegisterDecl stores inferred types and values for a given register
 // Inferred infromation can come from binja, ida, or some other tool
 struct TypedRegisterDecl {
+  // Address of the instruction on entry to which `reg` has `type`.
+  uint64_t address{0};
   const remill::Register *reg;
   llvm::Type *type;
   std::optional<uint64_t> value;
@@ -111,6 +115,27 @@ struct GlobalVarDecl {
   void *owner{nullptr};
 };
 
+// The parts of a function decl that describe how the function is called,
+// rather than which function it is. Many functions of a binary share these,
+// e.g. all `int(int, int)` functions with the same calling convention, so
+// `Program` interns one prototype per distinct combination, and points the
+// decls that it owns at them. Parameter names aren't part of a prototype.
+//
+// Prototypes are compared by identity, so they can key caches of work that only
+// depends on how a function is called, e.g. how its arguments are marshaled.
+struct FunctionPrototype {
+  const remill::Arch *arch{nullptr};
+  llvm::FunctionType *type{nullptr};
+  llvm::CallingConv::ID calling_convention{llvm::CallingConv::C};
+  bool is_noreturn{false};
+  bool is_variadic{false};
+  ValueDecl return_address;
+  const remill::Register *return_stack_pointer{nullptr};
+  int64_t return_stack_pointer_offset{0};
+  std::vector<ValueDecl> params;
+  std::vector<ValueDecl> returns;
+};
+
 // A function decl, as represented at a "near ABI" level. To be specific,
 // not all C, and most C++ decls, as written would be directly translatable
 // to this. This ought nearly represent how LLVM represents a C/C++ function
@@ -157,8 +182,12 @@ struct FunctionDecl {
   //            parameter (number of varargs).
   std::vector<ParameterDecl> params;
 
-  // Map program addresses to remill registers and type information.
-  std::unordered_map<uint64_t, std::vector<TypedRegisterDecl>> reg_info;
+  // Remill registers and type information on entry to instructions in this
+  // function, sorted by instruction address.
+  //
+  // `Program::DeclareFunction` sorts this, so declared functions can be queried
+  // by `RegisterInfoAt`.
+  std::vector<TypedRegisterDecl> reg_info;
 
   // Return values.
   //
@@ -181,10 +210,18 @@ struct FunctionDecl {
   // below the stack pointer on x86/amd64).
   uint64_t num_bytes_in_redzone{0};
 
+  // The interned prototype of this function. Only set for decls owned by a
+  // `Program`, and shared by all of its decls that are called the same way.
+  const FunctionPrototype *prototype{nullptr};
+
   // Declare this function in an LLVM module.
   llvm::Function *DeclareInModule(const std::string &name, llvm::Module &,
                                   bool allow_unowned = false) const;
 
+  // Return the typed registers on entry to the instruction at `inst_address`.
+  // Requires `reg_info` to be sorted.
+  llvm::ArrayRef<TypedRegisterDecl> RegisterInfoAt(uint64_t inst_address) const;
+
   // Create a call to this function with name `name` from within a basic block
   // in a lifted bitcode function. Returns the new value of the memory pointer.
   llvm::Value *CallFromLiftedBlock(const std::string &name,
@@ -207,6 +244,14 @@ struct FunctionDecl {
   static llvm::Expected<FunctionDecl> Create(llvm::Function &func,
                                              const remill::Arch *arch);
 
+  // Create a function declaration from an LLVM function, reusing the
+  // allocation of the parameters and return values of any function with the
+  // same type and calling convention that was previously created with
+  // `cache`.
+  static llvm::Expected<FunctionDecl> Create(llvm::Function &func,
+                                             const remill::Arch *arch,
+                                             SignatureAllocationCache &cache);
+
  private:
   friend class Program;
 
@@ -214,4 +259,29 @@ struct FunctionDecl {
   void *owner{nullptr};
 };
 
+// Remembers how the signatures of functions were allocated to registers and
+// memory by their calling conventions, so that many functions sharing the
+// same type can share the work of allocating their signatures.
+//
+// Allocations refer to the registers of an architecture, and to the types of an
+// LLVM context, so a cache must not outlive the architectures or contexts of
+// the functions given to it. A cache must not be used by multiple threads at
+// once.
+class SignatureAllocationCache {
+ public:
+  SignatureAllocationCache(void);
+  ~SignatureAllocationCache(void);
+
+  class Impl;
+
+ private:
+  friend struct FunctionDecl;
+
+  SignatureAllocationCache(const SignatureAllocationCache &) = delete;
+  SignatureAllocationCache &
+  operator=(const SignatureAllocationCache &) = delete;
+
+  std::unique_ptr<Impl> impl;
+};
+
 }  // namespace anvill
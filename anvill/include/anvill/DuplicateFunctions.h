@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+
+namespace llvm {
+class Function;
+}  // namespace llvm
+namespace remill {
+class Arch;
+}  // namespace remill
+namespace anvill {
+
+class Program;
+
+// Finds the functions of a program whose lifted code would be the same as
+// that of a function at a lower address, so that only one of them, the
+// representative, needs to be lifted and optimized.
+//
+// Two functions are duplicates when they are called the same way (i.e. they
+// share a `FunctionPrototype`), have the same red zone and no per-instruction
+// register information, and the instructions reachable from their entry
+// points have the same bytes at the same offsets. On top of that, the code
+// of a duplicate must be position-independent: no reachable instruction may
+// read the program counter, e.g. through a PC-relative operand, by pushing a
+// return address, or by jumping to code outside of the function's bytes, and
+// no control-flow information in the program may apply to its instructions.
+// Duplicates are then equivalent to their representatives at any address.
+//
+// The bytes of a function are bounded by the next function's address, so
+// branches into other functions disqualify it.
+class DuplicateFunctions {
+ public:
+
+  // Find the duplicate functions of `program`, decoding their code with
+  // `arch`.
+  static DuplicateFunctions Find(const Program &program,
+                                 const remill::Arch *arch);
+
+  // Returns the address of the representative of the function at `address`,
+  // if that function is a duplicate.
+  std::optional<uint64_t> RepresentativeOf(uint64_t address) const;
+
+  // Returns the number of duplicate functions.
+  inline size_t NumDuplicates(void) const {
+    return representatives.size();
+  }
+
+  // Define `func`, the lifted declaration of a duplicate function, as a thunk
+  // that tail-calls `representative`, the lifted function of its
+  // representative. Returns `false`, and leaves `func` alone, if `func` is
+  // already defined, or if the two functions can't share a body, e.g.
+  // because their types differ.
+  static bool DefineAsThunk(llvm::Function &func,
+                            llvm::Function &representative);
+
+ private:
+  DuplicateFunctions(void) = default;
+
+  // Maps the addresses of duplicate functions to those of their
+  // representatives.
+  std::unordered_map<uint64_t, uint64_t> representatives;
+};
+
+}  // namespace anvill
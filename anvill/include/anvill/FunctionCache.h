@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <llvm/Support/Error.h>
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+
+namespace llvm {
+class DataLayout;
+class Function;
+class GlobalValue;
+class LLVMContext;
+class Module;
+}  // namespace llvm
+namespace anvill {
+
+class LifterOptions;
+class OptimizationPipeline;
+class Program;
+struct FunctionDecl;
+struct GlobalVarDecl;
+
+// A persistent, content-addressed cache of lifted and optimized functions.
+// Each entry is a bitcode file, named by its key, that holds the definition
+// of one optimized function and declarations of everything that it uses.
+//
+// A key is a hash of everything that goes into lifting and optimizing a
+// function: the versions of anvill and LLVM, the instruction semantics, the
+// lifter options, the optimization pipeline, the function's declaration, and
+// the bytes of the function along with any control-flow information about
+// them. As the extent of a function isn't known until it's lifted, the bytes
+// of a function are taken to be the executable bytes from its address up to
+// the next function's address.
+//
+// The lifted code of a function also depends on the prototypes of the
+// functions that it calls, and on the types and bytes of the variables that it
+// refers to, but these aren't known until the function is lifted, so they
+// aren't part of its key. Instead, an entry records the prototype hashes of
+// the entities that its function refers to, and is only loaded if they are
+// still the same.
+//
+// Cached functions refer to other entities by the names that the lifters gave
+// them, and lifted code embeds absolute addresses, so an entry only matches the
+// same function at the same address.
+class FunctionCache {
+ public:
+
+  // Returns the address of the entity that `gv` was lifted from, if any.
+  using EntityAddressFunc =
+      std::function<std::optional<uint64_t>(llvm::GlobalValue &gv)>;
+
+  // Returns the prototype hash (see `PrototypeHash`) of the entity at
+  // `address`, or an empty string if there is no entity there.
+  using PrototypeHashFunc = std::function<std::string(uint64_t address)>;
+
+  // Most bytes of a function that are hashed into its key when there is no
+  // next function to bound it.
+  static constexpr uint64_t kMaxFunctionSize = 1u << 20;
+
+  // Open the cache in the directory `dir`, creating the directory if it
+  // doesn't exist.
+  static llvm::Expected<FunctionCache> Open(const std::string &dir);
+
+  // Returns the key of the function described by `decl`, whose bytes in
+  // `program` extend up to, but not including, `end_address`.
+  static std::string Key(const Program &program, const FunctionDecl &decl,
+                         uint64_t end_address, const LifterOptions &options,
+                         const OptimizationPipeline &pipeline);
+
+  // Returns a hash of the declaration `decl`, i.e. of what is used to lift
+  // calls to the function that it describes. The lifted code of a function
+  // depends on the prototypes of the functions that it calls, but these
+  // aren't part of its key.
+  static std::string PrototypeHash(const FunctionDecl &decl,
+                                   const llvm::DataLayout &dl);
+
+  // Returns a hash of the declaration `decl` and of the bytes of the variable
+  // that it describes in `program`, i.e. of what lifted code that refers to
+  // the variable can depend on.
+  static std::string PrototypeHash(const GlobalVarDecl &decl,
+                                   const Program &program,
+                                   const llvm::DataLayout &dl);
+
+  // Load the cached module of `key` into `context`. Returns `nullptr` if
+  // nothing is cached under `key`, or if the prototype of anything that the
+  // cached function refers to, as given by `prototype_of`, has changed since
+  // it was cached.
+  llvm::Expected<std::unique_ptr<llvm::Module>>
+  Load(const std::string &key, llvm::LLVMContext &context,
+       const PrototypeHashFunc &prototype_of) const;
+
+  // Replace the body of `func` with the body of the function defined by
+  // `cached`, a module returned by `Load`, and link the rest of `cached`
+  // into the module of `func`. This fails if anything in `cached` has a
+  // different type than the same-named thing in the module of `func`.
+  static llvm::Error Link(std::unique_ptr<llvm::Module> cached,
+                          llvm::Function &func);
+
+  // Cache the definition of `func` under `key`, along with the prototype
+  // hashes, from `prototype_of`, of the entities that it refers to, which are
+  // found with `address_of`. This fails if `func` refers to anything with
+  // local linkage, as other modules can't refer to it.
+  llvm::Error Store(const std::string &key, const llvm::Function &func,
+                    const EntityAddressFunc &address_of,
+                    const PrototypeHashFunc &prototype_of) const;
+
+ private:
+  explicit FunctionCache(std::string dir_);
+
+  std::string PathOf(const std::string &key) const;
+
+  std::string dir;
+};
+
+}  // namespace anvill
@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <cstddef>
+
+namespace remill {
+class Arch;
+}  // namespace remill
+namespace anvill {
+
+class Program;
+
+// Speculatively recover the targets of the jump tables in the functions of
+// `program`, decoding their code with `arch`, and record them with
+// `Program::TrySetControlFlowTargets`. This must be done before `program` is
+// frozen. Returns the number of indirect jumps given targets.
+//
+// The code reachable from each function's entry point is decoded, and each
+// indirect jump without targets in the spec is matched against the shapes
+// that compilers emit for `switch` statements:
+//
+//    jmp [table + index * ptr_size]          Table of absolute addresses.
+//
+//    mov reg, [table + index * ptr_size]
+//    jmp reg
+//
+//    lea base, [pc + offset]                 Table of 32-bit offsets from
+//    movsxd reg, dword [base + index * 4]    the start of the table, i.e.
+//    add reg, base                           position-independent code.
+//    jmp reg
+//
+// The bounds of a table aren't recovered; instead, entries are read until one
+// doesn't point into the executable code of the function. The recovered
+// targets are thus never marked as complete, and so lifted jumps still fall
+// back on `__remill_jump` for targets that weren't recovered.
+//
+// The bytes of a function are bounded by the next function's address, so jump
+// tables can't lead into other functions.
+size_t SpeculateJumpTableTargets(Program &program, const remill::Arch *arch);
+
+}  // namespace anvill
@@ -20,6 +20,9 @@
 #include <cstdint>
 #include <memory>
 #include <optional>
+#include <string>
+#include <utility>
+#include <vector>
 
 namespace llvm {
 class Constant;
@@ -39,6 +42,7 @@ class EntityLifterImpl;
 class FunctionLifter;
 class LifterOptions;
 class MemoryProvider;
+class OptimizationPipeline;
 class TypeProvider;
 class ValueLifter;
 class ValueLifterImpl;
@@ -61,6 +65,20 @@ class EntityLifter {
   // then return the address of that entity in the binary being lifted.
   std::optional<uint64_t> AddressOfEntity(llvm::Constant *entity) const;
 
+  // Return the lifted function or variable whose extent contains `address`,
+  // along with the offset of `address` into it, or `{nullptr, 0}` if there is
+  // none. The extent of a variable is the allocation size of its type, and
+  // the extent of a function is just its entry point.
+  std::pair<llvm::Constant *, uint64_t>
+  EntityContainingAddress(uint64_t address) const;
+
+  // Tell this entity lifter that `entity`, which lives in the module of the
+  // lifter's options, is the lifted function or variable at `address`. This
+  // is for rebuilding the entity map of a module that was lifted earlier and
+  // then loaded from bitcode, so that passes that need an `EntityLifter` can
+  // be run over it again.
+  void AddEntity(llvm::Constant *entity, uint64_t address) const;
+
   // Return the options being used by this entity lifter.
   const LifterOptions &Options(void) const;
 
@@ -68,23 +86,82 @@ class EntityLifter {
   TypeProvider &TypeProvider(void) const;
 
   // Lift a function and return it. Returns `nullptr` if there was a failure.
+  //
+  // There can be several functions at the same address, one per prototype.
+  // Once a second prototype for an address is declared or lifted, the lifted
+  // instructions of the function are kept, and the remaining versions call
+  // them rather than lifting them again.
   llvm::Function *LiftEntity(const FunctionDecl &decl) const;
 
   // Lift a function and return it. Returns `nullptr` if there was a failure.
   llvm::Function *DeclareEntity(const FunctionDecl &decl) const;
 
+  // Lift a function and return it, and append the addresses of the functions
+  // that its lifted code calls or takes the address of to `referenced_funcs`.
+  llvm::Function *LiftEntity(const FunctionDecl &decl,
+                             std::vector<uint64_t> &referenced_funcs) const;
+
+  // Lift the functions at `roots`, and then, on demand, the functions that
+  // lifted code calls or takes the address of, as they're found. Functions
+  // more than `max_depth` references away from every root are only declared;
+  // a `max_depth` of zero means that there is no limit. Declarations come from
+  // the type provider. Returns the functions that were lifted.
+  std::vector<llvm::Function *>
+  LiftReachableEntities(const std::vector<uint64_t> &roots,
+                        unsigned max_depth = 0u) const;
+
+  // Lift the function described by `decl`, and then optimize it, and only it,
+  // with the function passes of `pipeline` (see `OptimizeFunction`). Returns
+  // a self-contained module holding the optimized function, definitions of
+  // the out-of-line semantics functions that it calls, and declarations of
+  // everything else that it refers to, or `nullptr` if there was a failure.
+  // The function is left as a declaration in the module of this lifter, so
+  // that lifting many functions one at a time doesn't accumulate their
+  // bodies.
+  std::unique_ptr<llvm::Module>
+  LiftAndOptimizeFunction(const FunctionDecl &decl,
+                          const OptimizationPipeline &pipeline) const;
+
+  // Same as above, but using the default optimization pipeline.
+  std::unique_ptr<llvm::Module>
+  LiftAndOptimizeFunction(const FunctionDecl &decl) const;
+
   // Lift a variable and return it. Returns `nullptr` if there was a failure.
   llvm::Constant *LiftEntity(const GlobalVarDecl &decl) const;
 
   // Lift a variable and return it. Returns `nullptr` if there was a failure.
   llvm::Constant *DeclareEntity(const GlobalVarDecl &decl) const;
 
+  // Lift the initializers of the variables whose initializers were deferred
+  // (see `LifterOptions::lazy_data_initializers`), and which are now referred
+  // to by lifted code or by other lifted initializers. This can be called
+  // several times, e.g. again after optimization has introduced new
+  // references. Returns the number of initializers that were lifted.
+  unsigned LiftReferencedData(void) const;
+
+  // Load and cache the instruction semantics of `arch`, so that the first
+  // entity lifter made for an architecture/OS pair like that of `arch`
+  // doesn't have to wait on loading them from disk. The cache is shared by
+  // the whole process, and doesn't depend on the context of `arch`.
+  static void PreloadSemantics(const remill::Arch *arch);
+
+  // Returns the number of bytes of cached instruction semantics, across all
+  // architecture/OS pairs loaded so far.
+  static uint64_t SemanticsCacheBytes(void);
+
+  // Load instruction semantics from the pruned modules that
+  // `anvill-prune-semantics` wrote into `dir`, when there is one for the
+  // architecture, instead of from the full semantics of remill. This must
+  // be called before any semantics are loaded.
+  static void SetPrunedSemanticsDirectory(std::string dir);
+
   EntityLifter(const EntityLifter &) = default;
   EntityLifter(EntityLifter &&) noexcept = default;
   EntityLifter &operator=(const EntityLifter &) = default;
   EntityLifter &operator=(EntityLifter &&) noexcept = default;
 
  private:
+  friend class CrossReferenceResolver;
   friend class DataLifter;
   friend class FunctionLifter;
   friend class ValueLifter;
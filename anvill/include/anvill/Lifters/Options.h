@@ -29,12 +29,16 @@ class Arch;
 }  // namespace remill
 namespace anvill {
 
+class Tracer;
+
 enum class StateStructureInitializationProcedure : char {
 
   // Don't do anything with the `alloca State`.
   kNone,
 
-  // Store an LLVM constant aggregate zero into the `alloca State`.
+  // Zero the `alloca State` with `llvm.memset`. Which bytes are zeroed
+  // depends on `LifterOptions::zero_vector_and_float_state` and
+  // `LifterOptions::initialize_only_live_registers`.
   kZeroes,
 
   // Store an LLVM undefined value to the `alloca State`.
@@ -54,8 +58,20 @@ enum class StateStructureInitializationProcedure : char {
   kGlobalRegisterVariablesAndZeroes,
   kGlobalRegisterVariablesAndUndef,
 
-  // TODO(pag): Add an option to read values using the `llvm.read_register`
-  //            intrinsic.
+  // Should the registers of the `State` structure be initialized by reading
+  // their values using the `llvm.read_register` intrinsic? If so, then the
+  // lifted bitcode takes on the form:
+  //
+  //      state->rax = llvm.read_register.i64(!{!"rax"})
+  //      state->rbx = llvm.read_register.i64(!{!"rbx"})
+  //      ...
+  //
+  // This shows the same unmodelled dependencies as the global variables do,
+  // but without adding a global variable for each register to the module,
+  // and without the loads from memory that the optimizer has to reason
+  // about. Registers whose types aren't integers are read as integers of
+  // the same size.
+  kReadRegister,
 };
 
 enum class StackFrameStructureInitializationProcedure : char {
@@ -77,8 +93,15 @@ enum class StackFrameStructureInitializationProcedure : char {
   // Use symbolic values to initialize each byte in the stack frame. This
   // is useful to track how the stack frame is used and also allows us to
   // generate bitcode that can be compiled while also communicating the
-  // missing/unmodeled input dependencies
+  // missing/unmodeled input dependencies. Stack frames bigger than 4 KiB
+  // are initialized as with kSymbolicBlob
   kSymbolic,
+
+  // Like kSymbolic, but copy the whole stack frame out of a single symbolic
+  // byte array (e.g. `__anvill_stack_blob_64`) shared by all stack frames of
+  // a similar size, rather than loading one symbolic value per byte. This
+  // keeps the initialization of big stack frames small
+  kSymbolicBlob,
 };
 
 // Options that direct the behavior of the code and data lifters.
@@ -102,7 +125,16 @@ class LifterOptions {
         symbolic_register_types(true),
         store_inferred_register_values(true),
         add_breakpoints(false),
-        track_provenance(false) {
+        compact_breakpoints(false),
+        track_provenance(false),
+        discard_value_names(false),
+        lift_from_instruction_templates(false),
+        initialize_only_live_registers(false),
+        zero_vector_and_float_state(true),
+        lift_thunks_as_tail_calls(false),
+        declare_registers_on_demand(false),
+        lazy_data_initializers(false),
+        lower_memory_accesses_to_entities(false) {
     CheckModuleContextMatchesArch();
   }
 
@@ -128,6 +160,57 @@ class LifterOptions {
   // related to original program counters in the binary.
   const char *pc_metadata_name{nullptr};
 
+  // The maximum number of instructions that a semantics function can have
+  // for it to be inlined into lifted functions. Bigger semantics functions,
+  // e.g. some x87 or AVX-512 helpers, are left as out-of-line calls, and are
+  // copied into the target module alongside the lifted functions. A value of
+  // zero means that all semantics functions are inlined.
+  unsigned max_inlined_semantics_size{0u};
+
+  // Per-function budgets, so that one degenerate function (e.g. with a huge
+  // switch table, or obfuscated control flow) can't hold up everything else.
+  // A value of zero means no limit.
+  //
+  // A function that goes over the instruction, block, or time budget while
+  // being lifted is only partially lifted: the code that it didn't get to
+  // is replaced with calls to `__remill_error`. A function that ends up with
+  // more than `max_function_ir_size` LLVM instructions after being lifted, or
+  // that goes over the IR size or time budget while being optimized, is
+  // reduced to a declaration. Either way, the function is given a
+  // `kBudgetExceededAttribute` attribute saying which budget it went over.
+  unsigned max_lifted_instructions{0u};
+  unsigned max_lifted_blocks{0u};
+  unsigned max_lift_time_ms{0u};
+  unsigned max_function_ir_size{0u};
+  unsigned max_optimize_time_ms{0u};
+
+  // The maximum size, in bytes, of a variable whose initializer is lifted.
+  // Bigger variables are left as declarations, so that huge data sections
+  // don't become huge LLVM constants. A value of zero means no limit.
+  unsigned max_data_initializer_size{0u};
+
+  // The number of threads with which to decode the instructions of functions
+  // that are big enough to benefit from it. Once lifting a function has
+  // decoded many instructions, the code that follows them is decoded ahead
+  // of time, in parallel, by linear sweep, and the lifter then uses those
+  // instructions as its recursive descent reaches them. One thread means
+  // that instructions are only decoded as they're reached; zero means one
+  // thread per hardware thread.
+  unsigned num_decode_threads{1u};
+
+  // Optional tracer into which the function lifter and `OptimizeModule`
+  // record how long each lifting phase and each pass take on each function.
+  Tracer *tracer{nullptr};
+
+  // Whether the pass events recorded into `tracer` by `OptimizeModule` also
+  // say which occurrence of the pass in the pipeline ran, and whether it
+  // changed the function, and count the function's blocks and memory
+  // operations before and after the pass. These are the `occurrence`,
+  // `changed`, `blocks_before`, `blocks_after`, `memory_ops_before`, and
+  // `memory_ops_after` counters of the events. Counting walks every
+  // instruction of the function around every pass.
+  bool record_pass_impact{false};
+
   //
   // Stack frame padding is useful to support red zones for ABIs that support
   // them. See https://en.wikipedia.org/wiki/Red_zone_(computing) for more
@@ -173,12 +256,14 @@ class LifterOptions {
   // at a specific address whose type is known, then the lifter performs
   // roughly the following:
   //
-  //      state->reg = __anvill_type_func_<hex address>_<type>(state->reg)
+  //      state->reg = __anvill_type_hint<type>(state->reg)
   //
-  // The `__anvill_type_func_*` functions are basically uninterpreted functions,
+  // The `__anvill_type_hint*` functions are basically uninterpreted functions,
   // similar to Remill intrinsic functions, and serves to communicate the
   // equivalent of a bitcast, but where the cast itself cannot be folded
-  // away by optimizations.
+  // away by optimizations. There is one such function per hinted type, not
+  // per hinted register or address, and so calls to them are lowered by
+  // visiting the uses of a handful of functions.
   //
   // TODO(pag): Convert this into using a global variable approach, like
   //            with `__anvill_pc`. Then it will compose nicely with
@@ -210,10 +295,86 @@ class LifterOptions {
   // prior to that instruction's execution.
   bool add_breakpoints : 1;
 
-  // Enable data provenance gathering via uninterpreted function calls, in a
-  // way that will survive LLVM optimizations.
+  // If breakpoints are added, then have every instruction call the one
+  // `breakpoint` function, passing it the instruction's address, rather than
+  // adding a `breakpoint_NNN` function per instruction. On big binaries, the
+  // per-instruction functions bloat the symbol table by millions of entries,
+  // and make compiling and linking the lifted code slow. Debugger breakpoints
+  // can still stop at one instruction by conditioning on the address.
+  bool compact_breakpoints : 1;
+
+  // Enable data provenance gathering. The values that lifted instructions
+  // write into registers are tagged with metadata naming the instruction and
+  // the register; see `anvill/Provenance.h`. As the PCs of instructions come
+  // from the PC annotations, this requires `pc_metadata_name` to be set.
   bool track_provenance : 1;
 
+  // Should the names of basic blocks and instructions be discarded? This
+  // trades readable IR for lifting and optimization throughput, as names
+  // take up memory and have to be kept unique in each function's symbol
+  // table. The names of functions, global variables, and function arguments
+  // are always kept, as those are the names that matter in the output.
+  //
+  // Names are still created while lifting instruction semantics, as Remill
+  // finds some of its variables by name. They're only discarded from the LLVM
+  // context while optimizing.
+  bool discard_value_names : 1;
+
+  // Should instructions that lift to the same code as an earlier instruction
+  // of the same function be lifted by copying that code? Instructions have
+  // the same lifted code if they have the same semantics function, size, and
+  // operands, e.g. `push rbp`, `nop`, or `ret` at different addresses. This
+  // avoids going through Remill's instruction lifter for each of them.
+  bool lift_from_instruction_templates : 1;
+
+  // If `state_struct_init_procedure` initializes registers from global
+  // register variables or `llvm.read_register`, then should only the
+  // registers that the lifted code may read be initialized? Which registers
+  // are read is found once the semantics of the lifted instructions are
+  // inlined, and the other registers, e.g. most of the vector register file,
+  // are never stored to, which saves the optimizer from having to delete
+  // those stores. If the `State` structure escapes, e.g. into a semantics
+  // function that isn't inlined, then all registers are initialized.
+  bool initialize_only_live_registers : 1;
+
+  // If `state_struct_init_procedure` zeroes the `State` structure, then
+  // should the vector and floating point registers, e.g. the AVX and x87
+  // state on x86, be zeroed too? They make up most of the `State` structure,
+  // and code that doesn't use them is lifted faster without zeroing them.
+  // If `initialize_only_live_registers` is set, then only the bytes that the
+  // lifted code may read are zeroed, regardless of this option.
+  bool zero_vector_and_float_state : 1;
+
+  // Should thunks be lifted as tail calls? A thunk is a function whose entry
+  // is redirected by the control flow provider, or whose first instruction
+  // is a direct jump, or an indirect jump with one known target, to another
+  // function with the same prototype, e.g. a PLT entry. Such a function is
+  // lifted as a direct tail call to the other function, rather than by
+  // lifting its instructions.
+  bool lift_thunks_as_tail_calls : 1;
+
+  // Should each lifted function only get the variables of Remill's
+  // `__remill_basic_block` that aren't registers, rather than a whole clone of
+  // it? The addresses of registers are then computed from the `State`
+  // structure as lifted instructions use them, which leaves out the
+  // hundreds of mostly unused register pointers that every clone has.
+  bool declare_registers_on_demand : 1;
+
+  // Should the initializers of variables only be lifted once something refers
+  // to them? Variables are then first declared without initializers, and
+  // `EntityLifter::LiftReferencedData` lifts the initializers of the ones
+  // that lifted code, or other lifted initializers, refer to. The rest stay
+  // declarations, which optimization is free to delete.
+  bool lazy_data_initializers : 1;
+
+  // Should memory accesses whose addresses resolve to lifted entities, by way
+  // of the cross-reference resolver or of type hints, be lowered into loads
+  // and stores through typed pointers into those entities? Otherwise, every
+  // access is lowered through an `inttoptr` of its address, and it's left to
+  // `RecoverEntityUseInformation` and `BrightenPointerOperations` to recover
+  // the entity and the types.
+  bool lower_memory_accesses_to_entities : 1;
+
  private:
   LifterOptions(void) = delete;
 
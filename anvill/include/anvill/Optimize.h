@@ -18,8 +18,14 @@
 #pragma once
 
 #include <anvill/Lifters/Options.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Error.h>
+
+#include <string>
+#include <vector>
 
 namespace llvm {
+class Function;
 class Module;
 }
 namespace remill {
@@ -31,10 +37,160 @@ namespace anvill {
 class EntityLifter;
 class Program;
 
+// Named optimization levels, trading optimization time against the quality
+// of the optimized code.
+enum class OptimizationLevel {
+
+  // Run only the passes needed to get rid of remill intrinsics and recover
+  // stack frames, plus a few cheap cleanups. Useful for triage.
+  kFast,
+
+  // The standard pipeline.
+  kDefault,
+
+  // The standard pipeline, followed by another round of cleanups over the
+  // recovered stack frames and pointer operations.
+  kThorough,
+};
+
+// The passes that can be part of an `OptimizationPipeline`.
+enum class OptimizationPass {
+
+  // Module passes. These always run before any function passes.
+  kInliner,
+  kGlobalOpt,
+  kGlobalDCE,
+  kStripDeadDebugInfo,
+
+  // LLVM function passes.
+  kDCE,
+  kSinking,
+  kNewGVN,
+  kSCCP,
+  kDSE,
+  kSROA,
+  kEarlyCSE,
+  kBDCE,
+  kSimplifyCFG,
+  kInstCombine,
+
+  // Anvill function passes. The passes that remove or lower intrinsics, other
+  // than `kRemoveCompilerBarriers`, go straight to the calls of the intrinsics
+  // and run once over the whole module, in their place in the pipeline.
+  kSinkSelectionsIntoBranchTargets,
+  kRemoveUnusedFPClassificationCalls,
+  kRemoveDelaySlotIntrinsics,
+  kRemoveErrorIntrinsics,
+  kLowerRemillMemoryAccessIntrinsics,
+  kRemoveCompilerBarriers,
+  kLowerTypeHintIntrinsics,
+  kInstructionFolder,
+  kRecoverEntityUseInformation,
+  kRemoveTrivialPhisAndSelects,
+  kRecoverStackFrameInformation,
+  kSplitStackFrameAtReturnAddress,
+  kRecoverAndSplitStackFrame,
+  kConvertXorToCmp,
+  kBrightenPointerOperations,
+  kTransformRemillJumpIntrinsics,
+  kRemoveRemillFunctionReturns,
+  kLowerRemillUndefinedIntrinsics,
+
+  // Fuses `kTransformRemillJumpIntrinsics`, `kRemoveRemillFunctionReturns`,
+  // and `kLowerRemillUndefinedIntrinsics`.
+  kCleanUpRemillIntrinsics,
+
+  // Runs the rules of `kRemoveTrivialPhisAndSelects`, `kConvertXorToCmp`,
+  // `kRemoveUnusedFPClassificationCalls`, and `kDCE` together, as one
+  // function pass.
+  kPeepholes,
+
+  // Runs once after all other passes, over the whole module, and turns the
+  // lifted functions whose optimized code is the same as that of a function
+  // at a lower address into thunks to that function (see
+  // `MergeEquivalentFunctions`).
+  kMergeFunctions,
+};
+
+// An ordered list of passes to be run by `OptimizeModule`. Module passes run
+// first, then function passes run in the order that they were added. A
+// pipeline has a textual form, which is a comma-separated list of pass names,
+// e.g. `inline,globaldce,sroa,instcombine,recover-entity-use-information`.
+class OptimizationPipeline {
+ public:
+  // Create an empty pipeline.
+  OptimizationPipeline(void) = default;
+
+  // Create the pipeline for the optimization level `level`.
+  static OptimizationPipeline Create(OptimizationLevel level);
+
+  // Parse a textual pipeline description. Module passes must come before any
+  // function pass, and `merge-functions` must come last, as that's the order
+  // in which they run.
+  static llvm::Expected<OptimizationPipeline>
+  Parse(llvm::StringRef description);
+
+  // Returns the name of `pass` in textual pipeline descriptions.
+  static llvm::StringRef PassName(OptimizationPass pass);
+
+  // Add `pass` to the end of the pipeline.
+  OptimizationPipeline &Add(OptimizationPass pass);
+
+  // Remove all instances of `pass` from the pipeline.
+  OptimizationPipeline &Remove(OptimizationPass pass);
+
+  // Set the maximum number of times that the function passes are run. The
+  // first run visits every function. Later runs only revisit the functions
+  // changed by the previous run, and their callers, and stop once nothing
+  // changes. The default of one runs each pass once over each function.
+  OptimizationPipeline &SetMaxIterations(unsigned max_iterations_);
+
+  // Returns the maximum number of times that the function passes are run.
+  inline unsigned MaxIterations(void) const {
+    return max_iterations;
+  }
+
+  // Returns `true` if `pass` is part of the pipeline.
+  bool Contains(OptimizationPass pass) const;
+
+  // Returns the textual description of this pipeline.
+  std::string ToString(void) const;
+
+  // The passes of this pipeline, in order.
+  inline const std::vector<OptimizationPass> &Passes(void) const {
+    return passes;
+  }
+
+ private:
+  std::vector<OptimizationPass> passes;
+  unsigned max_iterations{1u};
+};
+
 // Optimize a module. This can be a module with semantics code, lifted
-// code, etc.
-void OptimizeModule(const EntityLifter &lifter_context,
+// code, etc. Returns `false` if the functions of `module` were split up to be
+// optimized in parallel (see `--optimize_threads`), and some of them couldn't
+// be optimized or brought back into `module`, in which case `module` is left
+// partially optimized, and should be discarded.
+bool OptimizeModule(const EntityLifter &lifter_context,
                     const remill::Arch *arch, const Program &program,
                     llvm::Module &module, const LifterOptions &options);
 
+// Optimize a module using the passes of `pipeline`. Returns `false` on the
+// same failures as the above.
+bool OptimizeModule(const EntityLifter &lifter_context,
+                    const remill::Arch *arch, const Program &program,
+                    llvm::Module &module, const LifterOptions &options,
+                    const OptimizationPipeline &pipeline);
+
+// Optimize only `func`, a function defined in the module of `lifter_context`,
+// using the function passes of `pipeline`. The module passes of `pipeline`,
+// e.g. `kGlobalDCE`, `kGlobalOpt`, and `kMergeFunctions`, are skipped, and
+// the other functions of the module are left alone. The one exception is call
+// site passes: they go straight to the calls of intrinsics, and so also clean
+// up those calls in other functions of the module that have yet to be
+// optimized.
+void OptimizeFunction(const EntityLifter &lifter_context, llvm::Function &func,
+                      const LifterOptions &options,
+                      const OptimizationPipeline &pipeline);
+
 }  // namespace anvill
@@ -24,6 +24,7 @@
 #include <memory>
 #include <optional>
 #include <string_view>
+#include <vector>
 
 // Forward declare
 namespace llvm {
@@ -137,6 +138,16 @@ struct ByteSequence {
     return address;
   }
 
+  // All bytes of a sequence are in the same mapped range, and so they share
+  // the same permissions.
+  inline bool IsWriteable(void) const {
+    return first_data ? IsWriteableImpl() : false;
+  }
+
+  inline bool IsExecutable(void) const {
+    return first_data ? IsExecutableImpl() : false;
+  }
+
   // Convert this byte sequence to a string.
   std::string_view ToString(void) const;
 
@@ -150,16 +161,21 @@ struct ByteSequence {
  private:
   friend class Program;
 
+  bool IsWriteableImpl(void) const;
+  bool IsExecutableImpl(void) const;
+
   explicit inline ByteSequence(uint64_t addr_, Byte::Data *first_data_,
-                               Byte::Meta *first_meta_, size_t size_)
+                               Byte::Meta *meta_, size_t size_)
       : address(addr_),
         first_data(first_data_),
-        first_meta(first_meta_),
+        meta(meta_),
         size(size_) {}
 
   uint64_t address{0};
   Byte::Data *first_data{nullptr};
-  Byte::Meta *first_meta{nullptr};  // Inclusive.
+
+  // Metadata of the mapped range containing this sequence.
+  Byte::Meta *meta{nullptr};
   size_t size{0};
 };
 
@@ -215,6 +231,100 @@ class Program {
   // of the mapped bytes.
   llvm::Error MapRange(const ByteRange &range);
 
+  // Map the bytes of `data` into the program at `address`. This is like
+  // `MapRange`, except that the program takes ownership of `data` rather than
+  // copying it.
+  llvm::Error MapRange(uint64_t address, std::vector<uint8_t> data,
+                       bool is_writeable, bool is_executable);
+
+  // Map the `size` bytes at `data` into the program at `address`, without
+  // copying them. The program holds on to `owner` for as long as it refers
+  // to the bytes, e.g. a buffer of a scripting language that must outlive
+  // the mapping. The bytes must not change while they are mapped. The same
+  // overlap and alignment rules as `MapRange` apply.
+  llvm::Error MapBorrowedRange(uint64_t address, const uint8_t *data,
+                               uint64_t size, std::shared_ptr<const void> owner,
+                               bool is_writeable, bool is_executable);
+
+  // Map `size` bytes of the file at `path`, starting at `file_offset` within
+  // the file, into the program at `address`.
+  //
+  // Unlike `MapRange`, the bytes are not copied; instead, the file is
+  // memory-mapped read-only, and the mapping lives as long as the program.
+  // The same overlap and alignment rules as `MapRange` apply.
+  llvm::Error MapFile(const std::string &path, uint64_t file_offset,
+                      uint64_t address, uint64_t size, bool is_writeable,
+                      bool is_executable);
+
+  // Map `size` zero-valued bytes into the program at `address`, e.g. for a
+  // `.bss` section.
+  //
+  // No storage is allocated for the bytes; instead, they are backed by
+  // untouched, read-only anonymous pages, which all share the operating
+  // system's zero page. The same overlap and alignment rules as `MapRange`
+  // apply.
+  llvm::Error MapZeroRange(uint64_t address, uint64_t size, bool is_writeable,
+                           bool is_executable);
+
+  // Freeze this program. This finalizes all of the program's indexes, e.g.
+  // by sorting its functions and variables, and by resolving its control-flow
+  // redirections and targets into sorted tables. Once frozen, a program can't
+  // be changed: declaring functions or variables, mapping memory, and adding
+  // names, redirections, or targets all fail. In exchange, all lookups into
+  // a frozen program are read-only, and so are safe to perform concurrently
+  // from many threads without any locking.
+  void Freeze(void);
+
+  // Freeze this program, and also index the extents of its variables, as
+  // sized by `layout`. This makes `FindInVariable` a single binary search
+  // when it is given an equivalent data layout.
+  void Freeze(const llvm::DataLayout &layout);
+
+  // Returns `true` if this program has been frozen.
+  bool IsFrozen(void) const;
+
+  // Should function declarations be trusted to be well-formed? Trusted
+  // declarations skip the checks of their parameters, return values, return
+  // address, and return stack pointer in `DeclareFunction`. This is meant
+  // for specs produced by a pipeline that has already validated them, e.g.
+  // specs re-serialized from a program into which they were declared.
+  void TrustDecls(bool trusted = true);
+
+  // Approximate numbers of bytes used by the parts of a program. Container
+  // overheads are estimated, so these are meant for accounting, not for
+  // exact sizes.
+  struct MemoryUsage {
+
+    // Bytes of memory ranges that were copied into the program.
+    uint64_t owned_data_bytes{0};
+
+    // Bytes of memory ranges that are mapped from files, or borrowed from
+    // their owners. File mappings are backed by the page cache, and so can be
+    // paged out rather than swapped out.
+    uint64_t mapped_data_bytes{0};
+
+    // Bytes of zero-fill memory ranges. These are reserved, but are never
+    // touched, and so take up no physical memory.
+    uint64_t zero_fill_bytes{0};
+
+    // Per-range metadata, e.g. the addresses of function and variable heads.
+    uint64_t metadata_bytes{0};
+
+    // Function and variable declarations, including their parameters, return
+    // values, and register information.
+    uint64_t decl_bytes{0};
+
+    // Interned names, and the indexes between names and addresses.
+    uint64_t name_bytes{0};
+
+    // Everything else: the indexes of declarations, redirections, and
+    // control-flow targets.
+    uint64_t index_bytes{0};
+  };
+
+  // Returns the approximate memory usage of this program.
+  MemoryUsage GetMemoryUsage(void) const;
+
   // Declare a function in this view. This takes in a function
   // declaration that will act as a sort of "template" for the
   // declaration that we will make and will be owned by `Program`.
@@ -256,12 +366,20 @@ class Program {
       std::function<bool(const FunctionDecl *)> callback) const;
 
   // Returns a possible control flow redirection for the given address
-  // or the input address itself if nothing is found
+  // or the input address itself if nothing is found. Chains of redirections,
+  // e.g. thunks to thunks, are followed to their final destinations.
   bool TryGetControlFlowRedirection(std::uint64_t &destination,
                                     std::uint64_t address) const;
 
-  // Adds a new control flow redirection entry
-  void AddControlFlowRedirection(std::uint64_t from, std::uint64_t to);
+  // Adds a new control flow redirection entry. Returns `false` if this
+  // program is frozen.
+  bool AddControlFlowRedirection(std::uint64_t from, std::uint64_t to);
+
+  // Call `callback` on each control flow redirection, in no particular order,
+  // until `callback` returns `false`. The redirections of a frozen program
+  // lead to their final destinations.
+  void ForEachControlFlowRedirection(
+      std::function<bool(std::uint64_t from, std::uint64_t to)> callback) const;
 
   // Returns a list of targets reachable from the given address
   std::optional<ControlFlowTargetList>
@@ -271,8 +389,16 @@ class Program {
   // specified source address already has an existing target list
   bool TrySetControlFlowTargets(const ControlFlowTargetList &target_list);
 
-  // Add a name to an address.
-  void AddNameToAddress(const std::string &name, uint64_t address) const;
+  // Call `callback` on each list of control flow targets, in no particular
+  // order, until `callback` returns `false`.
+  void ForEachControlFlowTargets(
+      std::function<bool(const ControlFlowTargetList &)> callback) const;
+
+  // Add a name to an address. Names are interned, so an address can have
+  // many names, and a name can have many addresses, without duplicating
+  // the names. Returns `false` if this program is frozen, or if `name` is
+  // empty or `address` is zero.
+  bool AddNameToAddress(const std::string &name, uint64_t address) const;
 
   // Apply a function `cb` to each name of the address `address`.
   void ForEachNameOfAddress(
@@ -342,6 +468,44 @@ class Program {
   // Find the next byte.
   Byte FindNextByte(Byte byte) const;
 
+  // Find the sequence of up to `size` bytes that directly follows `bytes`.
+  // This is either the rest of the mapped range of `bytes`, or the start of
+  // an adjacent mapped range, and so a run of contiguous bytes can be walked
+  // one sequence at a time, rather than one byte at a time:
+  //
+  //    uint64_t num_bytes = 0;
+  //    for (auto seq = program.FindBytes(ea, size); seq;
+  //         seq = program.FindNextBytes(seq, size - num_bytes)) {
+  //      num_bytes += seq.Size();
+  //      ... seq.ToString() ...
+  //    }
+  //
+  // Returns an invalid sequence if the next byte isn't mapped, or if `size`
+  // is zero.
+  ByteSequence FindNextBytes(const ByteSequence &bytes, size_t size) const;
+
+  // Scan `words`, a run of `pointer_size`-byte integers in the byte order
+  // given by `is_little_endian`, for values that could be pointers into this
+  // program, i.e. that are the addresses of mapped bytes, or of executable
+  // bytes if `executable_only` is `true`. Returns a bitmap with one bit per
+  // word, where bit `i % 64` of element `i / 64` is set if the `i`th word is
+  // a candidate pointer. Trailing bytes that don't make up a whole word are
+  // ignored.
+  //
+  // This is much faster than looking up each word on its own, as the words are
+  // compared against the bounds of all mapped ranges at once.
+  std::vector<uint64_t>
+  FindPointerCandidates(std::string_view words, unsigned pointer_size,
+                        bool is_little_endian,
+                        bool executable_only = false) const;
+
+  // Call `callback` on the bytes of each mapped range, in order of their
+  // addresses, until `callback` returns `false`. `is_zero_fill` is `true` for
+  // ranges mapped by `MapZeroRange`.
+  void ForEachMappedRange(
+      std::function<bool(const ByteSequence &bytes, bool is_zero_fill)>
+          callback) const;
+
   // Find a sequence of bytes within the same mapped range starting at
   // `address` and including as many bytes fall within the range up to
   // but not including `address+size`.
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Error.h>
+
+#include <cstdint>
+#include <optional>
+
+namespace llvm {
+class ConstantInt;
+class Function;
+class Instruction;
+class MDNode;
+class Metadata;
+class Module;
+}  // namespace llvm
+namespace anvill {
+
+// Data provenance relates the values computed by lifted code back to the
+// machine code instructions, and registers, that produced them. When
+// `LifterOptions::track_provenance` is enabled, the lifter attaches a
+// provenance record to each instruction whose value is written into a
+// register by a machine code instruction. A record is a metadata node of the
+// form:
+//
+//      !{i64 <pc>, !"<register name>"}
+//
+// and it's attached to instructions as `kProvenanceMetadataName` metadata.
+// Being metadata, records don't get in the way of optimizations; instead,
+// they disappear along with the instructions that hold them. Anvill's own
+// passes carry metadata over to the instructions that they replace others
+// with.
+//
+// Each lifted function also holds a side table, attached to it as
+// `kProvenanceMetadataName` metadata, that lists every record that was
+// attached to one of its instructions when it was lifted. Comparing the side
+// tables with what's still attached tells how much provenance survived.
+extern const char kProvenanceMetadataName[];
+
+struct ProvenanceRecord {
+
+  // Address of the machine code instruction that wrote the value.
+  uint64_t pc{0};
+
+  // Name of the register into which the value was written.
+  llvm::StringRef reg;
+};
+
+// How much provenance survived in a module.
+struct ProvenanceStats {
+
+  // Number of records in the side tables of all functions.
+  unsigned num_records{0u};
+
+  // Number of records that are still attached to at least one instruction.
+  unsigned num_surviving_records{0u};
+
+  // Number of instructions that have a provenance record attached.
+  unsigned num_tagged_instructions{0u};
+};
+
+// Returns the provenance record node for a write of `reg` by the instruction
+// at `pc`. Record nodes are uniqued, so every write of the same register by
+// the same instruction shares one node.
+llvm::MDNode *GetProvenanceNode(llvm::ConstantInt *pc, llvm::StringRef reg);
+
+// Returns the provenance record attached to `inst`, if any.
+std::optional<ProvenanceRecord> GetProvenance(const llvm::Instruction &inst);
+
+// Set the side table of `func` to the record nodes in `records`.
+void SetProvenanceTable(llvm::Function &func,
+                        llvm::ArrayRef<llvm::Metadata *> records);
+
+// Validate the provenance in `module`. Every record attached to an
+// instruction must be well-formed, and must be listed in the side table of
+// some function of `module`; records get copied from one function into
+// another by inlining. Returns what survived if the provenance is valid.
+llvm::Expected<ProvenanceStats> VerifyProvenance(const llvm::Module &module);
+
+}  // namespace anvill
@@ -34,6 +34,12 @@ class IControlFlowProvider {
   using Ptr = std::unique_ptr<IControlFlowProvider>;
 
   static Result<Ptr, ControlFlowProviderError> Create(const Program &program);
+
+  // Creates a control-flow provider that remembers the answers of `inner`,
+  // including addresses without redirections or targets, so that `inner` is
+  // asked about each address at most once. The returned provider can be used
+  // by multiple threads at once if `inner` can.
+  static Result<Ptr, ControlFlowProviderError> CreateCaching(Ptr inner);
   virtual ~IControlFlowProvider(void) = default;
 
   // Returns a possible redirection for the given target
@@ -19,7 +19,10 @@
 
 #include <cstdint>
 #include <memory>
+#include <string>
+#include <string_view>
 #include <tuple>
+#include <vector>
 
 namespace anvill {
 
@@ -45,6 +48,34 @@ enum class ByteAvailability : uint8_t {
   kAvailable
 };
 
+// A page of memory, as fetched by a `PageSource`. Every byte of the page
+// shares the same availability and permissions.
+struct MemoryPage {
+  ByteAvailability availability{ByteAvailability::kUnknown};
+  BytePermission permission{BytePermission::kUnknown};
+
+  // Values of the bytes of the page. This is empty if the bytes aren't
+  // available, and may be shorter than a page, in which case the bytes past
+  // its end are treated as unknown.
+  std::string bytes;
+};
+
+// Fetches fixed-size pages of memory from somewhere that is slow to get at,
+// e.g. an image of a binary in remote object storage. Used by paged memory
+// providers (see `MemoryProvider::CreatePagedMemoryProvider`), which cache
+// the fetched pages.
+class PageSource {
+ public:
+  virtual ~PageSource(void);
+
+  // Fetch the pages starting at each of `page_addresses`, in one round trip
+  // if possible, into the corresponding elements of `pages`, which is sized
+  // to match. This is called from one thread at a time, though not always
+  // from the same one.
+  virtual void FetchPages(const std::vector<uint64_t> &page_addresses,
+                          std::vector<MemoryPage> &pages) = 0;
+};
+
 // Provides bytes of memory from some source.
 class MemoryProvider {
  public:
@@ -75,6 +106,25 @@ class MemoryProvider {
   virtual std::tuple<uint8_t, ByteAvailability, BytePermission>
   Query(uint64_t address) = 0;
 
+  // Query for the values of a contiguous run of up to `size` bytes starting
+  // at `address`, and append them to `bytes`. Every byte in the run shares the
+  // availability and permissions of the byte at `address`, which are returned
+  // along with the length of the run. The run is empty if the byte at
+  // `address` is not available. This is safe to call concurrently if `Query`
+  // is.
+  //
+  // A short run does not imply that the bytes following it are unavailable;
+  // callers wanting more bytes should query again starting at the end of the
+  // run.
+  virtual std::tuple<size_t, ByteAvailability, BytePermission>
+  QueryRange(uint64_t address, size_t size, std::string &bytes);
+
+  // Hint that the `size` bytes starting at `address` are likely to be queried
+  // soon, e.g. because a block of code starting there is waiting to be
+  // decoded. Providers whose bytes are slow to get at can start getting them
+  // in the background. The default implementation does nothing.
+  virtual void Prefetch(uint64_t address, size_t size);
+
   // Sources bytes from an `anvill::Program`.
   static std::shared_ptr<MemoryProvider>
   CreateProgramMemoryProvider(const Program &program);
@@ -82,6 +132,17 @@ class MemoryProvider {
   // Creates a memory provider that gives access to no memory.
   static std::shared_ptr<MemoryProvider> CreateNullMemoryProvider(void);
 
+  // Sources bytes from the pages of `source`, each `page_size` bytes long,
+  // where `page_size` is a power of two. Up to `max_cached_pages` of the most
+  // recently used pages are kept around. Pages are fetched by a background
+  // thread when `Prefetch` is hinted, and on demand otherwise, in batches of
+  // up to `max_batch_size` pages.
+  static std::shared_ptr<MemoryProvider>
+  CreatePagedMemoryProvider(std::shared_ptr<PageSource> source,
+                            uint64_t page_size = 4096u,
+                            size_t max_cached_pages = 4096u,
+                            size_t max_batch_size = 16u);
+
  protected:
   MemoryProvider(void) = default;
 
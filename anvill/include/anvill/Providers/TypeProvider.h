@@ -42,10 +42,22 @@ class TypeProvider {
 
   // Try to return the type of a function starting at address `address`. This
   // type is the prototype of the function.
-  virtual std::optional<FunctionDecl> TryGetFunctionType(uint64_t address) = 0;
+  //
+  // Decls can be big, e.g. when they have lots of typed register information,
+  // so they are handed out by shared handle instead of by copy. The returned
+  // decl must not be changed.
+  virtual std::shared_ptr<const FunctionDecl>
+  TryGetFunctionType(uint64_t address) = 0;
 
-  // Try to return the variable at given address or containing the address
-  virtual std::optional<GlobalVarDecl>
+  // Returns `true` if a function starts at address `address`, i.e. if
+  // `TryGetFunctionType` would return a decl for it. Lifters ask this about
+  // every control-flow target, so providers should answer it without
+  // building the decl. The default implementation asks `TryGetFunctionType`.
+  virtual bool IsFunctionHead(uint64_t address);
+
+  // Try to return the variable at given address or containing the address.
+  // Like function decls, the returned decl must not be changed.
+  virtual std::shared_ptr<const GlobalVarDecl>
   TryGetVariableType(uint64_t address, const llvm::DataLayout &layout) = 0;
 
   // Try to get the type of the register named `reg_name` on entry to the
@@ -66,6 +78,14 @@ class TypeProvider {
   static std::shared_ptr<TypeProvider>
   CreateNullTypeProvider(llvm::LLVMContext &context_);
 
+  // Creates a type provider that remembers the answers of `inner`, including
+  // its failures to provide type information, so that `inner` is asked about
+  // each function or variable address at most once. Register state queries
+  // are forwarded to `inner` as-is. The returned provider can be used by
+  // multiple threads at once if `inner` can.
+  static std::shared_ptr<TypeProvider>
+  CreateCachingTypeProvider(std::shared_ptr<TypeProvider> inner);
+
  protected:
   explicit TypeProvider(llvm::LLVMContext &context_);
 
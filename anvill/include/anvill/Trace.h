@@ -0,0 +1,204 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Error.h>
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef ANVILL_ENABLE_TRACY
+#  include <tracy/Tracy.hpp>
+
+#  include <cinttypes>
+#  include <cstdio>
+#endif
+
+namespace llvm {
+class Function;
+}  // namespace llvm
+namespace anvill {
+
+
+// A timed event, e.g. one lifter phase or one pass, over one function.
+struct TraceEvent final {
+
+  // Name of the phase or pass.
+  std::string name;
+
+  // Category of the event, e.g. `lift` or `pass`.
+  std::string category;
+
+  // Name of the function being lifted or optimized, if any.
+  std::string function;
+
+  // Address of the function being lifted or optimized, if known.
+  std::optional<uint64_t> address;
+
+  // Start time and duration, in microseconds. The start time is relative to
+  // when the tracer was created.
+  uint64_t start_us{0};
+  uint64_t duration_us{0};
+
+  // The thread that recorded the event.
+  uint64_t thread_id{0};
+
+  // Number of instructions in `function` before and after the event.
+  uint64_t instructions_before{0};
+  uint64_t instructions_after{0};
+
+  // Number of allocations made during the event, if the tracer can count
+  // them.
+  std::optional<uint64_t> allocations;
+
+  // Other named counters, e.g. the number of decoded instructions.
+  std::vector<std::pair<std::string, uint64_t>> counters;
+};
+
+// Called with each event recorded by a tracer, by the thread that recorded
+// it, e.g. to aggregate events into metrics.
+using TraceObserver = std::function<void(const TraceEvent &)>;
+
+// Collects timed events from the lifters and from `OptimizeModule`. A tracer
+// can be shared by many threads.
+class Tracer {
+ public:
+
+  // `count_allocations`, if provided, returns the number of allocations made
+  // so far by the calling thread.
+  explicit Tracer(uint64_t (*count_allocations_)(void) = nullptr);
+
+  // Same as above, but each recorded event is also given to `observer_`. If
+  // `keep_events_` is `false`, then events are only observed, and not kept,
+  // so that a long-running process doesn't accumulate them.
+  Tracer(uint64_t (*count_allocations_)(void), TraceObserver observer_,
+         bool keep_events_);
+
+  // Record `event`.
+  void Record(TraceEvent event);
+
+  // Returns the number of microseconds since the tracer was created.
+  uint64_t Now(void) const;
+
+  // Returns the number of allocations made so far by the calling thread, if
+  // known.
+  std::optional<uint64_t> Allocations(void) const;
+
+  // Returns a copy of the events recorded so far.
+  std::vector<TraceEvent> Events(void) const;
+
+  // Write the recorded events to `path`, in the Chrome trace event format
+  // understood by `chrome://tracing` and Perfetto.
+  llvm::Error WriteChromeTrace(const std::string &path) const;
+
+ private:
+  Tracer(const Tracer &) = delete;
+  Tracer &operator=(const Tracer &) = delete;
+
+  const std::chrono::steady_clock::time_point start;
+  uint64_t (*const count_allocations)(void);
+  const TraceObserver observer;
+  const bool keep_events;
+
+  mutable std::mutex events_lock;
+  std::vector<TraceEvent> events;
+};
+
+// Times a region of code, and records it into a tracer once the scope ends.
+// A scope with a null tracer does nothing.
+class TraceScope {
+ public:
+  TraceScope(Tracer *tracer_, llvm::StringRef name, llvm::StringRef category,
+             const llvm::Function *func_,
+             std::optional<uint64_t> address = std::nullopt);
+
+  ~TraceScope(void);
+
+  // Add a named counter to the event.
+  void AddCounter(llvm::StringRef name, uint64_t value);
+
+  // Stop timing the event, e.g. so that the work of adding counters isn't
+  // counted as part of it. The event is still only recorded once the scope
+  // ends.
+  void Stop(void);
+
+ private:
+  TraceScope(const TraceScope &) = delete;
+  TraceScope &operator=(const TraceScope &) = delete;
+
+  Tracer *const tracer;
+  const llvm::Function *const func;
+  TraceEvent event;
+  bool stopped{false};
+};
+
+// Are trace zones (see `ANVILL_TRACE_ZONE` below) compiled in?
+#ifdef ANVILL_ENABLE_TRACY
+static constexpr bool kTraceZonesEnabled = true;
+#else
+static constexpr bool kTraceZonesEnabled = false;
+#endif
+
+#ifdef ANVILL_ENABLE_TRACY
+
+// Tag `zone` with the address and size of what it is working on.
+inline void TagTraceZone(tracy::ScopedZone &zone, uint64_t address,
+                         uint64_t size) {
+  char text[64];
+  const auto len =
+      std::snprintf(text, sizeof(text), "address=0x%" PRIx64 " size=%" PRIu64,
+                    address, size);
+  zone.Text(text, static_cast<size_t>(len));
+}
+
+#endif  // ANVILL_ENABLE_TRACY
+
+}  // namespace anvill
+
+// Trace zones, for looking at where the time goes on a timeline, in the Tracy
+// profiler. Unlike `TraceScope`, which is always compiled in and records
+// into a `Tracer` chosen at run time, zones only exist when anvill is built
+// with `-DANVILL_ENABLE_TRACY=ON`. Otherwise, the macros expand to nothing,
+// and their arguments aren't evaluated.
+//
+// A zone lasts until the end of the C++ scope that opens it, and there can
+// be at most one zone per scope.
+//
+//    ANVILL_TRACE_ZONE("name")           Open a zone with a literal name.
+//    ANVILL_TRACE_ZONE_NAMED(name)       Open a zone named by a string ref.
+//    ANVILL_TRACE_ZONE_TAG(addr, size)   Tag the open zone with the address
+//                                        and size of what it's working on.
+#ifdef ANVILL_ENABLE_TRACY
+#  define ANVILL_TRACE_ZONE(name) ZoneScopedN(name)
+#  define ANVILL_TRACE_ZONE_NAMED(name) \
+    ZoneScoped; \
+    ZoneName((name).data(), (name).size())
+#  define ANVILL_TRACE_ZONE_TAG(address, size) \
+    ::anvill::TagTraceZone(___tracy_scoped_zone, (address), (size))
+#else
+#  define ANVILL_TRACE_ZONE(name)
+#  define ANVILL_TRACE_ZONE_NAMED(name)
+#  define ANVILL_TRACE_ZONE_TAG(address, size)
+#endif
@@ -17,15 +17,24 @@
 
 #pragma once
 
+#include <cstdint>
 #include <string>
 
 namespace llvm {
 
+class Function;
 class Instruction;
+class IRBuilderBase;
+class Value;
 
 }  // namespace llvm
+namespace remill {
+class Register;
+}  // namespace remill
 namespace anvill {
 
+class Program;
+
 // Creates a `sub_<address>` name from an address
 std::string CreateFunctionName(uint64_t addr);
 
@@ -36,4 +45,27 @@ std::string CreateVariableName(uint64_t addr);
 // them into other instructions in the same block.
 void UnfoldConstantExpressions(llvm::Instruction *inst);
 
+// Replace the body of `to` with the body of `from`, then delete `from`. This
+// is used to bring in a function body from another module, e.g. after linking
+// it in under a different name, while keeping `to`, which other things may
+// refer to, alive.
+void MoveFunctionBody(llvm::Function *from, llvm::Function *to);
+
+// Clear out the names of the basic blocks and instructions of `func`. They're
+// usually not helpful.
+void ClearVariableNames(llvm::Function *func);
+
+// Read up to `max_size` executable bytes of `program`, starting at `ea`. The
+// bytes may span several adjacent mapped ranges.
+std::string ReadExecutableBytes(const Program &program, uint64_t ea,
+                                uint64_t max_size);
+
+// Returns a pointer to `reg` in the `State` structure pointed to by
+// `state_ptr`. Unlike `remill::Register::AddressOf`, this doesn't build a
+// chain of indices through the nested structures of `State`, but uses the
+// byte offset of `reg`, which SROA also finds easier to split up.
+llvm::Value *StateRegisterAddress(llvm::IRBuilderBase &ir,
+                                  llvm::Value *state_ptr,
+                                  const remill::Register *reg);
+
 }  // namespace anvill
@@ -34,7 +34,33 @@ def main():
     arg_parser.add_argument("--bin_in", help="Path to input binary.", required=True)
 
     arg_parser.add_argument(
-        "--spec_out", help="Path to output JSON specification.", required=True
+        "--spec_out", help="Path to output specification.", required=True
+    )
+
+    arg_parser.add_argument(
+        "--spec_format",
+        choices=["json", "binary"],
+        default="json",
+        help="Format of the output specification. Binary specs can be read "
+        "with `decompile-json --spec_format binary`.",
+    )
+
+    arg_parser.add_argument(
+        "--blob_dir",
+        type=str,
+        default=None,
+        help="Directory in which to store the bytes of large memory ranges, "
+        "named by their hashes, instead of storing them in a JSON "
+        "specification. Pass the same directory to `decompile-json "
+        "--blob_dir`.",
+    )
+
+    arg_parser.add_argument(
+        "--jobs",
+        type=int,
+        default=os.cpu_count() or 1,
+        help="Number of threads used to analyze functions ahead of visiting "
+        "them.",
     )
 
     arg_parser.add_argument(
@@ -50,6 +76,14 @@ def main():
         default=False,
     )
 
+    arg_parser.add_argument(
+        "--type_cache",
+        type=str,
+        default=None,
+        help="Path to a type cache database shared across runs. Converted "
+        "types are looked up in, and added to, this cache.",
+    )
+
     arg_parser.add_argument(
         "--log_file",
         type=str,
@@ -87,7 +121,7 @@ def main():
             ERROR(f"The specified address it not valid: '{hex(args.base_address)}'")
             return 1
 
-    p = get_program(args.bin_in, maybe_base_address)
+    p = get_program(args.bin_in, maybe_base_address, type_cache_path=args.type_cache)
     if p is None:
         sys.stderr.write("FATAL: Could not initialize BinaryNinja's BinaryView\n")
         sys.stderr.write("Does BinaryNinja support this architecture?\n")
@@ -107,6 +141,9 @@ def main():
     ep_ea = None
 
     if ep is None:
+        if args.jobs > 1:
+            p.prefetch_functions(list(p.functions), args.jobs)
+
         for f in bv.functions:
             ea = f.start
             DEBUG(f"Looking at binja found function at: {ea:x}")
@@ -142,7 +179,13 @@ def main():
         if ea != ep_ea:
             p.add_symbol(ea, name)
 
-    open(args.spec_out, "w").write(json.dumps(p.proto()))
+    if args.spec_format == "binary":
+        p.write_binary_spec(args.spec_out)
+    else:
+        with open(args.spec_out, "w") as spec_out:
+            p.write_json(spec_out, blob_dir=args.blob_dir)
+
+    p.type_cache.flush()
 
 
 if __name__ == "__main__":
@@ -31,6 +31,7 @@ def get_program(
     binary_path_or_bv: Union[str, bn.BinaryView],
     maybe_base_address: Optional[int] = None,
     cache: bool = False,
+    type_cache_path: Optional[str] = None,
 ) -> Optional[Program]:
     if cache:
         DEBUG("Ignoring deprecated `cache` parameter to anvill.get_program")
@@ -65,4 +66,4 @@ def get_program(
         return None
 
     DEBUG("Recovering program {}".format(binary_path))
-    return BNProgram(bv, binary_path)
+    return BNProgram(bv, binary_path, type_cache_path)
@@ -212,11 +212,11 @@ class BNFunction(Function):
         return results
 
     def _fill_bytes(self, program, memory, start, end, ref_eas):
-        br = bn.BinaryReader(program.bv)
+        bv = program.bv
         for bb in self._bn_func.basic_blocks:
-            for ea in range(bb.start, bb.end):
-                seg = program.bv.get_segment_at(ea)
-                br.seek(ea)
+            ea = bb.start
+            while ea < bb.end:
+                seg = bv.get_segment_at(ea)
 
                 # NOTE(artem): This is a workaround for binary ninja's fake
                 # .externs section, which is (correctly) mapped as
@@ -228,10 +228,17 @@ class BNFunction(Function):
                 if seg.writable == seg.readable == False:
                     is_executable = True
 
-                memory.map_byte(ea, br.read8(), seg.writable, is_executable)
+                # Map the block's bytes with one read per segment, rather than
+                # one read per byte.
+                chunk_end = min(bb.end, seg.end)
+                data = bv.read(ea, chunk_end - ea).ljust(chunk_end - ea, b"\0")
+                memory.map_bytes(ea, data, seg.writable, is_executable)
+                ea = chunk_end
+
+            for ea in range(bb.start, bb.end):
                 inst = self._bn_func.get_low_level_il_at(ea)
-                if inst and not is_unimplemented(program.bv, inst):
-                    _collect_xrefs_from_inst(program.bv, program, inst, ref_eas)
+                if inst and not is_unimplemented(bv, inst):
+                    _collect_xrefs_from_inst(bv, program, inst, ref_eas)
 
 
 def _convert_bn_llil_type(
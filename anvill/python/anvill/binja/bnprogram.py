@@ -18,6 +18,7 @@ import binaryninja as bn
 from typing import Optional
 
 import struct
+from concurrent.futures import ThreadPoolExecutor
 
 from .typecache import *
 from .bnfunction import *
@@ -45,11 +46,16 @@ def _is_function_pointer(bn_var):
 
 
 class BNProgram(Program):
-    def __init__(self, bv: bn.BinaryView, path: str):
+    def __init__(
+        self, bv: bn.BinaryView, path: str, type_cache_path: Optional[str] = None
+    ):
         Program.__init__(self, _get_arch(bv), _get_os(bv))
         self._path: Final[str] = path
         self._bv: Final[bn.BinaryView] = bv
-        self._type_cache: Final[TypeCache] = TypeCache(self._bv)
+        persistent = None
+        if type_cache_path is not None:
+            persistent = PersistentTypeCache(type_cache_path)
+        self._type_cache: Final[TypeCache] = TypeCache(self._bv, persistent)
 
         try:
             self._init_func_thunk_ctrl_flow()
@@ -280,6 +286,22 @@ class BNProgram(Program):
         for s in self._bv.get_symbols(address, 1):
             yield s.name
 
+    def prefetch_functions(self, eas, num_threads: int):
+        """Generate the IL of the functions at `eas` across `num_threads`
+        threads. Visiting functions mutates the program, and so is serial,
+        but most of the time it spends is in Binary Ninja lazily lifting each
+        function to LLIL and MLIL. That happens in Binary Ninja's core, which
+        doesn't hold the GIL, so it can be done in parallel ahead of time."""
+
+        def prefetch(ea: int):
+            for bn_func in self._bv.get_functions_at(ea):
+                bn_func.llil
+                bn_func.mlil
+
+        with ThreadPoolExecutor(max_workers=num_threads) as pool:
+            for _ in pool.map(prefetch, eas):
+                pass
+
     @property
     def functions(self):
         for f in self._bv.functions:
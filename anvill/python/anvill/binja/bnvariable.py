@@ -38,17 +38,17 @@ class BNVariable(Variable):
             return
 
         bv = program.bv
-        br = bn.BinaryReader(bv)
         mem = program.memory
         begin = self._address
         end = begin + self._type.size(self._arch)
 
-        for ea in range(begin, end):
-            br.seek(ea)
+        ea = begin
+        while ea < end:
             seg = bv.get_segment_at(ea)
             # _elf_header is getting recovered as variable
             # get_segment_at(...) returns None for elf_header
             if seg is None:
+                ea += 1
                 continue
 
             #NOTE(artem): This is a workaround for binary ninja's fake
@@ -64,4 +64,9 @@ class BNVariable(Variable):
             if seg.writable == seg.readable == False:
                 is_executable = True
 
-            mem.map_byte(ea, br.read8(), seg.writable, is_executable)
+            # Map the variable's bytes with one read per segment, rather than
+            # one read per byte.
+            chunk_end = min(end, seg.end)
+            data = bv.read(ea, chunk_end - ea).ljust(chunk_end - ea, b"\0")
+            mem.map_bytes(ea, data, seg.writable, is_executable)
+            ea = chunk_end
@@ -14,6 +14,11 @@
 # along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 
+import hashlib
+import pickle
+import sqlite3
+from typing import Dict, List, Optional, Set, Tuple
+
 import binaryninja as bn
 
 
@@ -25,13 +30,63 @@ from anvill.function import *
 from anvill.util import *
 
 
+class PersistentTypeCache:
+    """An on-disk cache of converted types, shared across runs and across
+    concurrent processes. Entries are keyed by the architecture and by the
+    full content of a binja type, i.e. its string and the definitions of all
+    named types that it refers to, so binaries that share headers or type
+    libraries share entries, but two binaries with different definitions of
+    the same named type don't."""
+
+    # Bump this whenever the conversion of types or the layout of `Type`
+    # changes, so that stale entries are never used.
+    _VERSION = 1
+
+    def __init__(self, path: str):
+        self._db = sqlite3.connect(path, timeout=60, isolation_level=None)
+        self._db.execute(
+            "CREATE TABLE IF NOT EXISTS types (key TEXT PRIMARY KEY, value BLOB)"
+        )
+        self._pending: List[Tuple[str, bytes]] = []
+
+    def key(self, arch: str, content: str) -> str:
+        data = f"{PersistentTypeCache._VERSION}\0{arch}\0{content}"
+        return hashlib.sha256(data.encode("utf-8")).hexdigest()
+
+    def get(self, key: str) -> Optional[Type]:
+        row = self._db.execute(
+            "SELECT value FROM types WHERE key = ?", (key,)
+        ).fetchone()
+        if row is None:
+            return None
+        try:
+            return pickle.loads(row[0])
+        except Exception:
+            return None
+
+    def put(self, key: str, ty: Type):
+        self._pending.append((key, pickle.dumps(ty)))
+
+    def flush(self):
+        """Write out the entries added since the last flush, all in one
+        transaction."""
+        if not self._pending:
+            return
+        with self._db:
+            self._db.executemany(
+                "INSERT OR IGNORE INTO types (key, value) VALUES (?, ?)",
+                self._pending,
+            )
+        self._pending = []
+
+
 class TypeCache:
     """The class provides API to recursively visit the binja types and convert
     them to the anvill `Type` instance. It maintains a cache of visited binja
     types to reduce lookup time.
     """
 
-    __slots__ = ("_bv", "_cache")
+    __slots__ = ("_bv", "_cache", "_persistent", "_named_content")
 
     # list of unhandled type classes which should log error
     _err_type_class = {
@@ -40,9 +95,11 @@ class TypeCache:
         bn.TypeClass.WideCharTypeClass: "WideCharTypeClass",
     }
 
-    def __init__(self, bv):
+    def __init__(self, bv, persistent: Optional[PersistentTypeCache] = None):
         self._bv = bv
         self._cache = dict()
+        self._persistent = persistent
+        self._named_content: Dict[str, str] = {}
 
     def _cache_key(self, tinfo: bn.types.Type):
         """ Convert bn Type instance to cache key"""
@@ -264,6 +321,89 @@ class TypeCache:
         else:
             raise UnhandledTypeException("Unhandled type: {}".format(str(tinfo)), tinfo)
 
+    def _named_type(self, named_tinfo) -> Optional[bn.types.Type]:
+        ref_type = self._bv.get_type_by_name(named_tinfo.name)
+        if ref_type is None:
+            ref_type = self._bv.get_type_by_id(named_tinfo.type_id)
+        return ref_type
+
+    def _collect_content(self, tinfo: bn.types.Type, names: Set[str]):
+        """Collect into `names` the names of the named types that `tinfo`
+        transitively refers to, and remember their definitions."""
+        if tinfo is None:
+            return
+
+        type_class = tinfo.type_class
+        if type_class in (bn.TypeClass.PointerTypeClass, bn.TypeClass.ArrayTypeClass):
+            self._collect_content(tinfo.element_type, names)
+
+        elif type_class == bn.TypeClass.FunctionTypeClass:
+            self._collect_content(tinfo.return_value, names)
+            for var in tinfo.parameters:
+                self._collect_content(var.type, names)
+
+        elif type_class == bn.TypeClass.StructureTypeClass:
+            for elem in tinfo.structure.members:
+                self._collect_content(elem.type, names)
+
+        elif type_class == bn.TypeClass.NamedTypeReferenceClass:
+            named_tinfo = tinfo.named_type_reference
+            name = str(named_tinfo.name)
+            if name in names:
+                return
+            names.add(name)
+
+            if name not in self._named_content:
+                ref_type = self._named_type(named_tinfo)
+                content = [str(named_tinfo.type_class), str(ref_type)]
+                if ref_type is not None:
+                    content.append(str(ref_type.width))
+                    if ref_type.type_class == bn.TypeClass.StructureTypeClass:
+                        for elem in ref_type.structure.members:
+                            content.append(f"{elem.offset}:{elem.type}")
+                self._named_content[name] = "\0".join(content)
+
+            self._collect_content(self._named_type(named_tinfo), names)
+
+    def _content_key(self, tinfo: bn.types.Type) -> str:
+        """Convert bn Type instance to a persistent cache key, which covers
+        the definitions of the named types that it refers to."""
+        names: Set[str] = set()
+        self._collect_content(tinfo, names)
+        content = [str(tinfo), str(self._bv.address_size)]
+        for name in sorted(names):
+            content.append(f"{name}={self._named_content[name]}")
+        return self._persistent.key(self._bv.arch.name, "\0".join(content))
+
+    def _get_bn_type(self, tinfo: bn.types.Type) -> Type:
+        """Convert an bn `Type` instance, by way of the persistent type
+        cache, if there is one."""
+
+        if self._persistent is None or self._cache_key(tinfo) in self._cache:
+            return self._convert_bn_type(tinfo)
+
+        # Anonymous structs, unions, and enums are never cached, as their
+        # strings can collide with one another.
+        if (
+            tinfo.type_class
+            in (bn.TypeClass.StructureTypeClass, bn.TypeClass.EnumerationTypeClass)
+            and not tinfo.registered_name
+        ):
+            return self._convert_bn_type(tinfo)
+
+        key = self._content_key(tinfo)
+        ret = self._persistent.get(key)
+        if ret is None:
+            ret = self._convert_bn_type(tinfo)
+            self._persistent.put(key, ret)
+        self._cache[self._cache_key(tinfo)] = ret
+        return ret
+
+    def flush(self):
+        """Write out any new entries of the persistent type cache."""
+        if self._persistent is not None:
+            self._persistent.flush()
+
     def get(self, ty) -> Type:
         """Type class that gives access to type sizes, printings, etc."""
 
@@ -274,7 +414,7 @@ class TypeCache:
             return ty.type()
 
         elif isinstance(ty, bn.Type):
-            return self._convert_bn_type(ty)
+            return self._get_bn_type(ty)
 
         elif not ty:
             return VoidType()
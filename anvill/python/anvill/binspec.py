@@ -0,0 +1,278 @@
+# Copyright (c) 2021 Trail of Bits, Inc.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as
+# published by the Free Software Foundation, either version 3 of the
+# License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU Affero General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+import struct
+from typing import Dict, List, Optional
+
+
+# These mirror the constants in `anvill/src/BinarySpec.cpp`.
+_MAGIC = b"ANVLSPEC"
+_VERSION = 1
+_NO_STRING = 0xFFFFFFFF
+_HEADER_SIZE = 16
+_SECTION_ENTRY_SIZE = 24
+_RANGE_ENTRY_SIZE = 32
+_PAGE_SIZE = 4096
+
+_SECTION_STRINGS = 1
+_SECTION_TARGET = 2
+_SECTION_MEMORY = 3
+_SECTION_FUNCTIONS = 4
+_SECTION_VARIABLES = 5
+_SECTION_CONTROL_FLOW_REDIRECTIONS = 6
+_SECTION_CONTROL_FLOW_TARGETS = 7
+_SECTION_SYMBOLS = 8
+
+_RANGE_IS_WRITEABLE = 1 << 0
+_RANGE_IS_EXECUTABLE = 1 << 1
+_RANGE_IS_ZERO_FILL = 1 << 2
+
+_FUNCTION_IS_NORETURN = 1 << 0
+_FUNCTION_IS_VARIADIC = 1 << 1
+
+
+def _align_to(val: int, align: int) -> int:
+    return (val + align - 1) & ~(align - 1)
+
+
+class _Section(object):
+    """Serializes the little-endian integers and interned strings of one
+    section of a binary spec."""
+
+    def __init__(self, strings: Dict[str, int]):
+        self._strings = strings
+        self._parts: List[bytes] = []
+
+    def u8(self, val: int):
+        self._parts.append(struct.pack("<B", val))
+
+    def u32(self, val: int):
+        self._parts.append(struct.pack("<I", val))
+
+    def u64(self, val: int):
+        self._parts.append(struct.pack("<Q", val & 0xFFFFFFFFFFFFFFFF))
+
+    def i64(self, val: int):
+        self._parts.append(struct.pack("<q", val))
+
+    def boolean(self, val: bool):
+        self.u8(1 if val else 0)
+
+    def string(self, val: Optional[str]):
+        if not val:
+            self.u32(_NO_STRING)
+        else:
+            self.u32(self._strings.setdefault(val, len(self._strings)))
+
+    def value(self, proto: Dict):
+        self.string(proto.get("type"))
+        self.string(proto.get("register"))
+        mem = proto.get("memory", {})
+        self.string(mem.get("register"))
+        self.i64(mem.get("offset", 0))
+
+    def data(self) -> bytes:
+        return b"".join(self._parts)
+
+    def raw(self, data: bytes):
+        self._parts.append(data)
+
+
+class BinarySpecWriter(object):
+    """Writes a `Program` as a binary spec, laid out exactly like the files
+    written by `anvill::BinarySpec::Write`, so that they can be read by
+    `decompile-json --spec_format binary`."""
+
+    def __init__(self):
+        self._strings: Dict[str, int] = {}
+        self._sections: List[tuple] = []
+
+    def _new_section(self) -> _Section:
+        return _Section(self._strings)
+
+    def _add_section(self, kind: int, section: _Section):
+        self._sections.append((kind, section.data()))
+
+    def _write_function(self, out: _Section, proto: Dict):
+        out.u64(proto["address"])
+
+        # Like the JSON spec, a function's type takes precedence over its
+        # parameters and return values, so they are not written.
+        func_type = proto.get("type")
+        out.string(func_type)
+        if func_type:
+            out.u32(0)
+            out.value({})
+            out.string(None)
+            out.i64(0)
+            out.u32(0)
+            out.u8(0)
+            out.u32(0)
+
+        else:
+            params = proto.get("parameters", [])
+            out.u32(len(params))
+            for param in params:
+                out.value(param)
+                out.string(param.get("name"))
+
+            out.value(proto["return_address"])
+            ret_sp = proto["return_stack_pointer"]
+            out.string(ret_sp["register"])
+            out.i64(ret_sp.get("offset", 0))
+
+            returns = proto.get("return_values", [])
+            out.u32(len(returns))
+            for ret in returns:
+                out.value(ret)
+
+            flags = 0
+            if proto.get("is_noreturn", False):
+                flags |= _FUNCTION_IS_NORETURN
+            if proto.get("is_variadic", False):
+                flags |= _FUNCTION_IS_VARIADIC
+            out.u8(flags)
+            out.u32(proto.get("calling_convention", 0))
+
+        reg_info = proto.get("register_info", [])
+        out.u32(len(reg_info))
+        for reg in reg_info:
+            out.u64(reg["address"])
+            out.string(reg["register"])
+            out.string(reg.get("type"))
+            out.boolean("value" in reg)
+            out.u64(reg.get("value", 0))
+
+    def write(self, program, path: str):
+        target = self._new_section()
+        target.string(program._arch.name())
+        target.string(program._os.name())
+        self._add_section(_SECTION_TARGET, target)
+
+        # Function protos are serialized as they are produced, so only the
+        # encoded bytes are kept around.
+        func_records = self._new_section()
+        num_funcs = 0
+        for proto in program.function_protos():
+            self._write_function(func_records, proto)
+            num_funcs += 1
+
+        funcs = self._new_section()
+        funcs.u32(num_funcs)
+        funcs.raw(func_records.data())
+        self._add_section(_SECTION_FUNCTIONS, funcs)
+
+        variables = self._new_section()
+        var_protos = list(program.variable_protos())
+        variables.u32(len(var_protos))
+        for proto in var_protos:
+            variables.u64(proto["address"])
+            variables.string(proto.get("type"))
+        self._add_section(_SECTION_VARIABLES, variables)
+
+        redirections = self._new_section()
+        redirection_protos = list(program.control_flow_redirection_protos())
+        redirections.u32(len(redirection_protos))
+        for source, dest in redirection_protos:
+            redirections.u64(source)
+            redirections.u64(dest)
+        self._add_section(_SECTION_CONTROL_FLOW_REDIRECTIONS, redirections)
+
+        targets = self._new_section()
+        target_protos = list(program.control_flow_target_protos())
+        targets.u32(len(target_protos))
+        for proto in target_protos:
+            targets.u64(proto["source"])
+            targets.boolean(proto["complete"])
+            targets.u32(len(proto["destination_list"]))
+            for dest in proto["destination_list"]:
+                targets.u64(dest)
+        self._add_section(_SECTION_CONTROL_FLOW_TARGETS, targets)
+
+        syms = self._new_section()
+        sym_protos = list(program.symbol_protos())
+        syms.u32(len(sym_protos))
+        for ea, name in sym_protos:
+            syms.u64(ea)
+            syms.string(name)
+        self._add_section(_SECTION_SYMBOLS, syms)
+
+        # Everything has now been interned, so the string table is complete.
+        # Interning assigns IDs in insertion order, which `dict` preserves.
+        strs = self._new_section()
+        strs.u32(len(self._strings))
+        for val in self._strings.keys():
+            encoded = val.encode("utf-8")
+            strs.u32(len(encoded))
+            strs.raw(encoded)
+        self._add_section(_SECTION_STRINGS, strs)
+
+        # The memory section is laid out last, as it records the file offsets
+        # of the range data, which follows all of the sections.
+        ranges = list(program.memory.chunks())
+        num_sections = len(self._sections) + 1
+        metadata_size = (
+            _HEADER_SIZE
+            + (num_sections * _SECTION_ENTRY_SIZE)
+            + 4
+            + (len(ranges) * _RANGE_ENTRY_SIZE)
+        )
+        for _, data in self._sections:
+            metadata_size += len(data)
+
+        mem = self._new_section()
+        mem.u32(len(ranges))
+        data_offset = _align_to(metadata_size, _PAGE_SIZE)
+        for ea, size, data, can_write, can_exec in ranges:
+            flags = 0
+            if can_write:
+                flags |= _RANGE_IS_WRITEABLE
+            if can_exec:
+                flags |= _RANGE_IS_EXECUTABLE
+            mem.u64(ea)
+            mem.u64(size)
+
+            # Zero-fill ranges have no data in the file.
+            if data is None:
+                mem.u64(0)
+                mem.u32(flags | _RANGE_IS_ZERO_FILL)
+                mem.u32(0)
+                continue
+
+            mem.u64(data_offset)
+            mem.u32(flags)
+            mem.u32(0)
+            data_offset = _align_to(data_offset + size, _PAGE_SIZE)
+        self._add_section(_SECTION_MEMORY, mem)
+
+        with open(path, "wb") as out:
+            out.write(_MAGIC)
+            out.write(struct.pack("<II", _VERSION, len(self._sections)))
+
+            offset = _HEADER_SIZE + (len(self._sections) * _SECTION_ENTRY_SIZE)
+            for kind, data in self._sections:
+                out.write(struct.pack("<IIQQ", kind, 0, offset, len(data)))
+                offset += len(data)
+
+            for _, data in self._sections:
+                out.write(data)
+
+            for _, _, data, _, _ in ranges:
+                if data is None:
+                    continue
+                aligned_offset = _align_to(offset, _PAGE_SIZE)
+                out.write(b"\0" * (aligned_offset - offset))
+                out.write(data)
+                offset = aligned_offset + len(data)
@@ -14,6 +14,55 @@
 # along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 
+import hashlib
+import os
+import re
+import tempfile
+from typing import Iterator, Optional, Tuple
+
+
+# Runs of zeros at least this long are emitted as zero-fill ranges, which
+# only record their size.
+MIN_ZERO_FILL_SIZE = 4096
+
+
+def split_zero_fill(
+    ea: int, data, min_len: int = MIN_ZERO_FILL_SIZE
+) -> Iterator[Tuple[int, int, Optional[bytes]]]:
+    """Split the bytes of `data`, starting at `ea`, into `(ea, size, data)`
+    chunks, where `data` is `None` for the runs of at least `min_len` zeros."""
+    offset = 0
+    for match in re.finditer(b"\\x00{%d,}" % min_len, data):
+        begin, end = match.span()
+        if offset < begin:
+            yield (ea + offset, begin - offset, data[offset:begin])
+        yield (ea + begin, end - begin, None)
+        offset = end
+
+    if offset < len(data):
+        yield (ea + offset, len(data) - offset, data[offset:])
+
+
+# Memory ranges at least this big are worth storing in a blob directory,
+# rather than inline in a spec.
+MIN_BLOB_SIZE = 4096
+
+
+def write_blob(blob_dir: str, data) -> str:
+    """Store `data` in the content-addressed `blob_dir`, and return its name,
+    which is the SHA-256 hash of `data`. Existing blobs are never rewritten,
+    so many producers can share one blob directory."""
+    name = hashlib.sha256(data).hexdigest()
+    path = os.path.join(blob_dir, name)
+    if not os.path.exists(path):
+        os.makedirs(blob_dir, exist_ok=True)
+        fd, tmp_path = tempfile.mkstemp(dir=blob_dir, prefix=".tmp-")
+        with os.fdopen(fd, "wb") as tmp:
+            tmp.write(data)
+        os.replace(tmp_path, path)
+    return name
+
+
 class Memory(object):
     def __init__(self):
         self._bytes = {}
@@ -21,44 +70,60 @@ class Memory(object):
     def map_byte(self, ea, val, can_write, can_exec):
         self._bytes[ea] = (int(val & 0xFF), can_write, can_exec)
 
-    def _extend_range(self, range_proto, ea, val, can_write, can_exec):
-        if not len(range_proto):
-            range_proto["address"] = ea
-            range_proto["is_writeable"] = can_write
-            range_proto["is_executable"] = can_exec
-            range_proto["data"] = "{:02x}".format(val)
-            return True
-
-        elif (
-            range_proto["is_writeable"] == can_write
-            and range_proto["is_executable"] == can_exec
-        ):
-
-            next_ea = range_proto["address"] + (len(range_proto["data"]) / 2)
-            if next_ea != ea:
-                return False
-            else:
-                range_proto["data"] += "{:02x}".format(val)
-                return True
-        else:
-            return False
+    def map_bytes(self, ea, data, can_write, can_exec):
+        """Map the contiguous bytes of `data`, starting at `ea`."""
+        for i, val in enumerate(data):
+            self._bytes[ea + i] = (val & 0xFF, can_write, can_exec)
 
-    def proto(self):
-        proto = []
-        if not len(self._bytes):
-            return proto
+    def ranges(self):
+        """Yield the maximal runs of contiguous bytes with the same
+        permissions, as `(ea, bytearray, can_write, can_exec)` tuples, in
+        order of increasing address."""
 
-        range_proto = {}
+        data = bytearray()
+        begin_ea, next_ea, perms = 0, None, None
         for ea in sorted(self._bytes.keys()):
-
             val, can_write, can_exec = self._bytes[ea]
-            if not self._extend_range(range_proto, ea, val, can_write, can_exec):
-                proto.append(range_proto)
-                range_proto = {}
-                ret = self._extend_range(range_proto, ea, val, can_write, can_exec)
-                assert ret
+            if ea != next_ea or (can_write, can_exec) != perms:
+                if len(data):
+                    yield (begin_ea, data, perms[0], perms[1])
+                data = bytearray()
+                begin_ea, perms = ea, (can_write, can_exec)
 
-        if len(range_proto):
-            proto.append(range_proto)
+            data.append(val)
+            next_ea = ea + 1
+
+        if len(data):
+            yield (begin_ea, data, perms[0], perms[1])
+
+    def chunks(self):
+        """Like `ranges`, but splits long runs of zeros out into zero-fill
+        chunks, yielding `(ea, size, data, can_write, can_exec)` tuples where
+        `data` is `None` for zero-fill chunks."""
+
+        for ea, data, can_write, can_exec in self.ranges():
 
+            # NOTE: Executable ranges are never split, so that instructions
+            #       never straddle two ranges.
+            if can_exec:
+                yield (ea, len(data), data, can_write, can_exec)
+                continue
+
+            for chunk_ea, size, chunk in split_zero_fill(ea, data):
+                yield (chunk_ea, size, chunk, can_write, can_exec)
+
+    def proto(self):
+        proto = []
+        for ea, size, data, can_write, can_exec in self.chunks():
+            range_proto = {
+                "address": ea,
+                "is_writeable": can_write,
+                "is_executable": can_exec,
+            }
+            if data is None:
+                range_proto["zero_fill"] = True
+                range_proto["size"] = size
+            else:
+                range_proto["data"] = data.hex()
+            proto.append(range_proto)
         return proto
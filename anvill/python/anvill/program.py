@@ -17,11 +17,22 @@
 from abc import ABC, abstractmethod
 import collections
 from dataclasses import dataclass, field
-from typing import List, DefaultDict, Dict, Iterator, Optional, Set
+import json
+from typing import (
+    List,
+    DefaultDict,
+    Dict,
+    Iterable,
+    Iterator,
+    Optional,
+    Set,
+    TextIO,
+)
 
 from .function import *
 from .var import *
 from .mem import *
+from .binspec import *
 from .exc import *
 
 
@@ -34,6 +45,40 @@ class ControlFlowTargetList:
     complete: bool = False
 
 
+class TypeTable:
+    """Deduplicates the type specifications of a spec into its top-level
+    `types` list. Declarations then refer to a type by its index in the
+    list, rather than repeating its specification."""
+
+    # Specifications this short are no longer than the indices that would
+    # replace them, so they are left inline.
+    _MIN_INTERNED_LEN = 3
+
+    def __init__(self):
+        self._ids: Dict[str, int] = {}
+
+    def intern(self, proto):
+        """Replace the `type` fields in `proto`, and in any of its nested
+        objects, with indices into this table."""
+        if isinstance(proto, dict):
+            for key, val in proto.items():
+                if (
+                    key == "type"
+                    and isinstance(val, str)
+                    and len(val) >= TypeTable._MIN_INTERNED_LEN
+                ):
+                    proto[key] = self._ids.setdefault(val, len(self._ids))
+                else:
+                    self.intern(val)
+        elif isinstance(proto, list):
+            for val in proto:
+                self.intern(val)
+        return proto
+
+    def proto(self) -> List[str]:
+        return list(self._ids.keys())
+
+
 class Program(ABC):
     """Represents a program."""
 
@@ -204,46 +249,123 @@ class Program(ABC):
     def memory(self) -> Memory:
         return self._memory
 
-    def proto(self) -> Dict:
-        proto = {}
-        proto["arch"] = self._arch.name()
-        proto["os"] = self._os.name()
-        proto["functions"] = []
-        proto["control_flow_redirections"] = []
-        proto["control_flow_targets"] = []
-        proto["variables"] = []
-        proto["symbols"] = []
-
+    def symbol_protos(self) -> Iterator[List]:
         for ea, names in self._symbols.items():
             for name in names:
-                proto["symbols"].append([ea, name])
+                yield [ea, name]
 
+    def function_protos(self) -> Iterator[Dict]:
         for func in self._func_decls.values():
-            proto["functions"].append(func.proto())
+            yield func.proto()
 
         for func in self._func_defs.values():
-            proto["functions"].append(func.proto())
+            yield func.proto()
 
+    def control_flow_redirection_protos(self) -> Iterator[List[int]]:
         for source, target in self._control_flow_redirections.items():
             # Use 2-entry lists so that we don't use 'source' as a key. That
             # would turn it into a string in the final JSON forcing us to
             # handle integers in two different ways
-            proto["control_flow_redirections"].append([source, target])
+            yield [source, target]
 
+    def control_flow_target_protos(self) -> Iterator[Dict]:
         for entry in self._control_flow_targets.values():
             obj = {}
             obj["complete"] = entry.complete
             obj["source"] = entry.source
             obj["destination_list"] = entry.destination_list
+            yield obj
 
-            proto["control_flow_targets"].append(obj)
-
+    def variable_protos(self) -> Iterator[Dict]:
         for var in self._var_decls.values():
-            proto["variables"].append(var.proto())
+            yield var.proto()
 
         for var in self._var_defs.values():
-            proto["variables"].append(var.proto())
+            yield var.proto()
 
+    def proto(self) -> Dict:
+        proto = {}
+        proto["arch"] = self._arch.name()
+        proto["os"] = self._os.name()
+        proto["functions"] = list(self.function_protos())
+        proto["control_flow_redirections"] = list(
+            self.control_flow_redirection_protos()
+        )
+        proto["control_flow_targets"] = list(self.control_flow_target_protos())
+        proto["variables"] = list(self.variable_protos())
+        proto["symbols"] = list(self.symbol_protos())
         proto["memory"] = self._memory.proto()
-
         return proto
+
+    def write_json(
+        self,
+        out: TextIO,
+        use_type_table: bool = True,
+        blob_dir: Optional[str] = None,
+    ):
+        """Write the JSON spec of this program to the file `out`. Unlike
+        `json.dump(self.proto(), out)`, this never holds the whole spec in
+        memory: each function, variable, and memory range is serialized and
+        written on its own. If `use_type_table` is true, then repeated type
+        specifications are written once, into the spec's `types` list.
+
+        Long runs of zeros are written as zero-fill ranges. If `blob_dir` is
+        given, then the bytes of large memory ranges are stored in it, in
+        files named by the hashes of their contents, and the spec refers to
+        them by hash, so that specs of similar binaries share them."""
+
+        types = TypeTable()
+
+        def write_list(key: str, protos: Iterable):
+            out.write(f", {json.dumps(key)}: [")
+            sep = ""
+            for proto in protos:
+                out.write(sep)
+                if use_type_table:
+                    proto = types.intern(proto)
+                out.write(json.dumps(proto))
+                sep = ", "
+            out.write("]")
+
+        out.write(f'{{"arch": {json.dumps(self._arch.name())}')
+        out.write(f', "os": {json.dumps(self._os.name())}')
+        write_list("functions", self.function_protos())
+        write_list(
+            "control_flow_redirections", self.control_flow_redirection_protos()
+        )
+        write_list("control_flow_targets", self.control_flow_target_protos())
+        write_list("variables", self.variable_protos())
+        write_list("symbols", self.symbol_protos())
+
+        # Hex-encode one range at a time, rather than building every range's
+        # string up front.
+        out.write(', "memory": [')
+        sep = ""
+        for ea, size, data, can_write, can_exec in self._memory.chunks():
+            out.write(sep)
+            out.write(
+                f'{{"address": {ea}, "is_writeable": {json.dumps(can_write)}, '
+                f'"is_executable": {json.dumps(can_exec)}, '
+            )
+            if data is None:
+                out.write(f'"zero_fill": true, "size": {size}}}')
+            elif blob_dir is not None and size >= MIN_BLOB_SIZE:
+                blob = write_blob(blob_dir, data)
+                out.write(f'"blob": "{blob}", "size": {size}}}')
+            else:
+                out.write('"data": "')
+                out.write(data.hex())
+                out.write('"}')
+            sep = ", "
+        out.write("]")
+
+        # The type table is only complete once everything else is written,
+        # so it comes last. Readers of the spec look it up by name.
+        if use_type_table:
+            out.write(f', "types": {json.dumps(types.proto())}')
+        out.write("}")
+
+    def write_binary_spec(self, path: str):
+        """Write the compact binary spec of this program to the file at
+        `path`. See `anvill/BinarySpec.h` for the layout of the file."""
+        BinarySpecWriter().write(self, path)
@@ -81,9 +81,8 @@ const std::string kAnvillSwitchCompleteFunc(
 const std::string kAnvillSwitchIncompleteFunc(
     kAnvillNamePrefix + "incomplete_switch");
 
-// The name of the uninterpreted function that implements data provenance
-// tracking.
-extern const std::string kAnvillDataProvenanceFunc(
-    kAnvillNamePrefix + "data_provenance");
+// The function attribute given to functions that went over a budget.
+const std::string kBudgetExceededAttribute(kAnvillNamePrefix +
+                                           "budget_exceeded");
 
 }  // namespace anvill
@@ -20,7 +20,9 @@
 #include <anvill/Analysis/Utils.h>
 #include <anvill/Lifters/EntityLifter.h>
 #include <anvill/Lifters/Options.h>
+#include <anvill/Trace.h>
 #include <glog/logging.h>
+#include <llvm/ADT/DenseSet.h>
 #include <llvm/IR/Constant.h>
 #include <llvm/IR/Constants.h>
 #include <llvm/IR/DataLayout.h>
@@ -29,7 +31,12 @@
 #include <llvm/IR/Module.h>
 #include <remill/BC/Util.h>
 
-#include <unordered_map>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "Lifters/EntityLifter.h"
+#include "ResolvedCrossReferenceCache.h"
 
 namespace anvill {
 namespace {
@@ -60,25 +67,39 @@ static int64_t Signed(uint64_t val, uint64_t size) {
 
 }  // namespace
 
-using ResolvedCrossReferenceCache = std::unordered_map<llvm::Value *, ResolvedCrossReference>;
-
 class CrossReferenceResolverImpl {
  public:
-  CrossReferenceResolverImpl(const llvm::DataLayout &dl_,
-                             AddressResolverFuncType address_of_entity_,
-                             EntityResolverFuncType entity_at_address_)
+  CrossReferenceResolverImpl(
+      const llvm::DataLayout &dl_, AddressResolverFuncType address_of_entity_,
+      EntityResolverFuncType entity_at_address_,
+      std::shared_ptr<ResolvedCrossReferenceCache> constant_xref_cache_)
       : dl(dl_),
         address_of_entity(address_of_entity_),
-        entity_at_address(entity_at_address_) {}
+        entity_at_address(entity_at_address_),
+        constant_xref_cache(std::move(constant_xref_cache_)) {}
 
+  // Resolve a single instruction or constant. These expect the operands of
+  // the value being resolved to have already been resolved, and they look
+  // up the results for those operands with `ResolvedOperand`.
   ResolvedCrossReference ResolveInstruction(llvm::Instruction *inst_val);
   ResolvedCrossReference ResolveConstant(llvm::Constant *const_val);
   ResolvedCrossReference ResolveGlobalValue(llvm::GlobalValue *const_val);
   ResolvedCrossReference ResolveConstantExpr(llvm::ConstantExpr *const_val);
-
-  // Try to resolve `val` as a cross-reference.
   ResolvedCrossReference ResolveCall(llvm::CallInst *val);
 
+  // Returns the cache that holds, or will hold, the resolution of `val`, or
+  // `nullptr` if `val` is never resolved.
+  ResolvedCrossReferenceCache *CacheFor(llvm::Value *val);
+
+  // Returns the already computed resolution of the operand `val`. If `val`
+  // has no resolution, e.g. because it is part of a cycle, then an invalid
+  // cross-reference is returned.
+  ResolvedCrossReference ResolvedOperand(llvm::Value *val);
+
+  // Add the operands of `val` that are needed to resolve `val`, and that
+  // aren't yet resolved, to the work list.
+  void PushOperands(llvm::Value *val);
+
   // Try to resolve `val` as a cross-reference.
   ResolvedCrossReference ResolveValue(llvm::Value *val);
 
@@ -178,8 +199,20 @@ class CrossReferenceResolverImpl {
   // with addresses.
   const EntityResolverFuncType entity_at_address;
 
-  // Cache of resolved values.
+  // Cache of resolved instructions.
   ResolvedCrossReferenceCache xref_cache;
+
+  // Cache of resolved constants. Constants are immutable, so this may be
+  // shared by all resolvers of a module, e.g. across passes.
+  const std::shared_ptr<ResolvedCrossReferenceCache> constant_xref_cache;
+
+  // Work list used by `ResolveValue` to evaluate values in post-order. The
+  // flag of each entry tells us whether or not the operands of the entry's
+  // value have been pushed.
+  std::vector<std::pair<llvm::Value *, bool>> work_list;
+
+  // Values whose operands have been pushed in the current `ResolveValue`.
+  llvm::DenseSet<llvm::Value *> visited;
 };
 
 
@@ -251,13 +284,7 @@ ResolvedCrossReference CrossReferenceResolverImpl::MergeLeft(
 
 ResolvedCrossReference
 CrossReferenceResolverImpl::ResolveInstruction(llvm::Instruction *inst_val) {
-
-  auto it = xref_cache.find(inst_val);
-  if (it != xref_cache.end()) {
-    return it->second;
-  }
-
-  auto &xr = xref_cache[inst_val];
+  ResolvedCrossReference xr = {};
 
   auto opnd_type = inst_val->getOperand(0)->getType();
   uint64_t size = opnd_type->getPrimitiveSizeInBits();
@@ -277,8 +304,8 @@ CrossReferenceResolverImpl::ResolveInstruction(llvm::Instruction *inst_val) {
   switch (inst_val->getOpcode()) {
 #define FOLD_CASE(name) \
   case llvm::Instruction::name: { \
-    xr = Fold##name(ResolveValue(inst_val->getOperand(0)), \
-                    ResolveValue(inst_val->getOperand(1)), mask, size); \
+    xr = Fold##name(ResolvedOperand(inst_val->getOperand(0)), \
+                    ResolvedOperand(inst_val->getOperand(1)), mask, size); \
     xr.size = static_cast<unsigned>(out_size); \
     return xr; \
   }
@@ -300,14 +327,14 @@ CrossReferenceResolverImpl::ResolveInstruction(llvm::Instruction *inst_val) {
 #undef FOLD_CASE
 
     case llvm::Instruction::ZExt: {
-      xr = ResolveValue(inst_val->getOperand(0));
+      xr = ResolvedOperand(inst_val->getOperand(0));
       xr.u.address &= mask;
       xr.size = static_cast<unsigned>(out_size);
       return xr;
     }
 
     case llvm::Instruction::SExt: {
-      xr = ResolveValue(inst_val->getOperand(0));
+      xr = ResolvedOperand(inst_val->getOperand(0));
       xr.u.displacement = Signed(xr.u.address, size);
       xr.u.address &= out_mask;
       xr.size = static_cast<unsigned>(out_size);
@@ -315,14 +342,14 @@ CrossReferenceResolverImpl::ResolveInstruction(llvm::Instruction *inst_val) {
     }
 
     case llvm::Instruction::Trunc: {
-      xr = ResolveValue(inst_val->getOperand(0));
+      xr = ResolvedOperand(inst_val->getOperand(0));
       xr.u.address &= out_mask;
       xr.size = static_cast<unsigned>(out_size);
       return xr;
     }
 
     case llvm::Instruction::IntToPtr: {
-      xr = ResolveValue(inst_val->getOperand(0));
+      xr = ResolvedOperand(inst_val->getOperand(0));
       xr.size = static_cast<unsigned>(out_size);
       if (auto ptr_type = llvm::cast<llvm::PointerType>(inst_val->getType());
           !xr.displacement_from_hinted_value_type) {
@@ -332,13 +359,13 @@ CrossReferenceResolverImpl::ResolveInstruction(llvm::Instruction *inst_val) {
     }
 
     case llvm::Instruction::PtrToInt: {
-      xr = ResolveValue(inst_val->getOperand(0));
+      xr = ResolvedOperand(inst_val->getOperand(0));
       xr.size = static_cast<unsigned>(out_size);
       return xr;
     }
 
     case llvm::Instruction::BitCast: {
-      xr = ResolveValue(inst_val->getOperand(0));
+      xr = ResolvedOperand(inst_val->getOperand(0));
       xr.size = static_cast<unsigned>(out_size);
       if (auto ptr_type =
               llvm::dyn_cast<llvm::PointerType>(inst_val->getType());
@@ -361,13 +388,7 @@ CrossReferenceResolverImpl::ResolveInstruction(llvm::Instruction *inst_val) {
 // Try to resolve a constant to a cross-reference.
 ResolvedCrossReference
 CrossReferenceResolverImpl::ResolveConstant(llvm::Constant *const_val) {
-
-  auto it = xref_cache.find(const_val);
-  if (it != xref_cache.end()) {
-    return it->second;
-  }
-
-  auto &xr = xref_cache[const_val];
+  ResolvedCrossReference xr = {};
 
   if (auto gv = llvm::dyn_cast<llvm::GlobalValue>(const_val)) {
     xr = ResolveGlobalValue(gv);
@@ -486,8 +507,8 @@ CrossReferenceResolverImpl::ResolveConstantExpr(llvm::ConstantExpr *ce) {
 
 #define FOLD_CASE(name) \
   case llvm::Instruction::name: { \
-    auto xr = Fold##name(ResolveConstant(ce->getOperand(0)), \
-                         ResolveConstant(ce->getOperand(1)), mask, size); \
+    auto xr = Fold##name(ResolvedOperand(ce->getOperand(0)), \
+                         ResolvedOperand(ce->getOperand(1)), mask, size); \
     xr.size = static_cast<unsigned>(out_size); \
     return xr; \
   }
@@ -509,14 +530,14 @@ CrossReferenceResolverImpl::ResolveConstantExpr(llvm::ConstantExpr *ce) {
 #undef FOLD_CASE
 
     case llvm::Instruction::ZExt: {
-      auto xr = ResolveConstant(ce->getOperand(0));
+      auto xr = ResolvedOperand(ce->getOperand(0));
       xr.u.address &= mask;
       xr.size = static_cast<unsigned>(out_size);
       return xr;
     }
 
     case llvm::Instruction::SExt: {
-      auto xr = ResolveConstant(ce->getOperand(0));
+      auto xr = ResolvedOperand(ce->getOperand(0));
       xr.u.displacement = Signed(xr.u.address, size);
       xr.u.address &= out_mask;
       xr.size = static_cast<unsigned>(out_size);
@@ -524,14 +545,14 @@ CrossReferenceResolverImpl::ResolveConstantExpr(llvm::ConstantExpr *ce) {
     }
 
     case llvm::Instruction::Trunc: {
-      auto xr = ResolveConstant(ce->getOperand(0));
+      auto xr = ResolvedOperand(ce->getOperand(0));
       xr.u.address &= out_mask;
       xr.size = static_cast<unsigned>(out_size);
       return xr;
     }
 
     case llvm::Instruction::IntToPtr: {
-      auto xr = ResolveConstant(ce->getOperand(0));
+      auto xr = ResolvedOperand(ce->getOperand(0));
       xr.size = static_cast<unsigned>(out_size);
       if (auto ptr_type = llvm::cast<llvm::PointerType>(ce->getType());
           !xr.displacement_from_hinted_value_type) {
@@ -541,13 +562,13 @@ CrossReferenceResolverImpl::ResolveConstantExpr(llvm::ConstantExpr *ce) {
     }
 
     case llvm::Instruction::PtrToInt: {
-      auto xr = ResolveConstant(ce->getOperand(0));
+      auto xr = ResolvedOperand(ce->getOperand(0));
       xr.size = static_cast<unsigned>(out_size);
       return xr;
     }
 
     case llvm::Instruction::BitCast: {
-      auto xr = ResolveConstant(ce->getOperand(0));
+      auto xr = ResolvedOperand(ce->getOperand(0));
       xr.size = static_cast<unsigned>(out_size);
       if (auto ptr_type = llvm::dyn_cast<llvm::PointerType>(ce->getType());
           ptr_type && !xr.displacement_from_hinted_value_type) {
@@ -557,20 +578,21 @@ CrossReferenceResolverImpl::ResolveConstantExpr(llvm::ConstantExpr *ce) {
     }
 
     case llvm::Instruction::ICmp: {
-      auto xr = FoldICmp(ResolveConstant(ce->getOperand(0)),
-                         ResolveConstant(ce->getOperand(1)), mask, size,
+      auto xr = FoldICmp(ResolvedOperand(ce->getOperand(0)),
+                         ResolvedOperand(ce->getOperand(1)), mask, size,
                          ce->getPredicate());
       xr.size = static_cast<unsigned>(out_size);
       return xr;
     }
 
     case llvm::Instruction::GetElementPtr: {
-      auto base = ResolveConstant(ce->getOperand(0));
+      auto base = ResolvedOperand(ce->getOperand(0));
 
       // In the event that an index is non-constant, we'll try to also resolve
-      // it using our value resolver.
+      // it using our value resolver. All indices are operands of `ce`, and so
+      // have already been resolved.
       auto visit = [=](llvm::Value &val, llvm::APInt &ap) -> bool {
-        if (const auto index_xr = ResolveValue(&val); index_xr.is_valid) {
+        if (const auto index_xr = ResolvedOperand(&val); index_xr.is_valid) {
           ap += static_cast<uint64_t>(Signed(index_xr.u.address, ptr_size));
           return true;
         } else {
@@ -596,12 +618,12 @@ CrossReferenceResolverImpl::ResolveConstantExpr(llvm::ConstantExpr *ce) {
     // TODO(pag): What happens if there's a `trunc` on a pointer and that is
     //            the condition?
     case llvm::Instruction::Select: {
-      auto cond = ResolveConstant(ce->getOperand(0));
+      auto cond = ResolvedOperand(ce->getOperand(0));
       ResolvedCrossReference selected_val = {};
       if (cond.u.address) {
-        selected_val = ResolveConstant(ce->getOperand(1));
+        selected_val = ResolvedOperand(ce->getOperand(1));
       } else {
-        selected_val = ResolveConstant(ce->getOperand(2));
+        selected_val = ResolvedOperand(ce->getOperand(2));
       }
       selected_val.size = static_cast<unsigned>(out_size);
       selected_val.is_valid &= cond.is_valid;
@@ -617,24 +639,41 @@ ResolvedCrossReference
 CrossReferenceResolverImpl::ResolveCall(llvm::CallInst *call) {
   switch (call->getIntrinsicID()) {
     case llvm::Intrinsic::ctlz: {
-      auto xr = ResolveValue(call->getArgOperand(0));
+      auto xr = ResolvedOperand(call->getArgOperand(0));
       xr.u.address = __builtin_clzl(xr.u.address);
       xr.size = call->getType()->getPrimitiveSizeInBits();
       return xr;
     }
     case llvm::Intrinsic::cttz: {
-      auto xr = ResolveValue(call->getArgOperand(0));
+      auto xr = ResolvedOperand(call->getArgOperand(0));
       xr.u.address = __builtin_ctzl(xr.u.address);
       xr.size = call->getType()->getPrimitiveSizeInBits();
       return xr;
     }
     case llvm::Intrinsic::ctpop: {
-      auto xr = ResolveValue(call->getArgOperand(0));
+      auto xr = ResolvedOperand(call->getArgOperand(0));
       xr.u.address = __builtin_popcountl(xr.u.address);
       xr.size = call->getType()->getPrimitiveSizeInBits();
       return xr;
     }
 
+    // The value of a register on entry to a lifted function. The stack
+    // pointer and program counter resolve like `__anvill_sp` and
+    // `__anvill_pc` do.
+    case llvm::Intrinsic::read_register: {
+      ResolvedCrossReference xr = {};
+      const auto module = call->getModule();
+      if (IsStackPointer(module, call)) {
+        xr.references_stack_pointer = true;
+        xr.is_valid = true;
+      } else if (IsProgramCounter(module, call)) {
+        xr.references_program_counter = true;
+        xr.is_valid = true;
+      }
+      xr.size = call->getType()->getPrimitiveSizeInBits();
+      return xr;
+    }
+
     // Not an intrinsic.
     case 0: break;
 
@@ -645,7 +684,7 @@ CrossReferenceResolverImpl::ResolveCall(llvm::CallInst *call) {
   // Looks like a call through a type hint function.
   if (auto func = call->getCalledFunction();
       func && func->getName().startswith(kTypeHintFunctionPrefix)) {
-    auto xr = ResolveValue(call->getArgOperand(0));
+    auto xr = ResolvedOperand(call->getArgOperand(0));
     xr.hinted_value_type = func->getReturnType()->getPointerElementType();
     xr.displacement_from_hinted_value_type = 0;
     xr.size = dl.getPointerSizeInBits(0);
@@ -657,17 +696,105 @@ CrossReferenceResolverImpl::ResolveCall(llvm::CallInst *call) {
   }
 }
 
+// Returns the cache that holds, or will hold, the resolution of `val`, or
+// `nullptr` if `val` is never resolved.
+ResolvedCrossReferenceCache *
+CrossReferenceResolverImpl::CacheFor(llvm::Value *val) {
+  if (llvm::isa<llvm::Constant>(val)) {
+    return constant_xref_cache.get();
+  } else if (llvm::isa<llvm::Instruction>(val)) {
+    return &xref_cache;
+  } else {
+    return nullptr;
+  }
+}
+
+// Returns the already computed resolution of the operand `val`.
+ResolvedCrossReference
+CrossReferenceResolverImpl::ResolvedOperand(llvm::Value *val) {
+  if (auto cache = CacheFor(val)) {
+    if (auto it = cache->find(val); it != cache->end()) {
+      return it->second;
+    }
+  }
+  return {};
+}
+
+// Add the operands of `val` that are needed to resolve `val`, and that
+// aren't yet resolved, to the work list.
+void CrossReferenceResolverImpl::PushOperands(llvm::Value *val) {
+  auto push = [this](llvm::Value *op) {
+    if (auto cache = CacheFor(op); cache && !cache->count(op)) {
+      work_list.emplace_back(op, false);
+    }
+  };
+
+  if (auto ce = llvm::dyn_cast<llvm::ConstantExpr>(val)) {
+    for (auto &op : ce->operands()) {
+      push(op.get());
+    }
+
+  } else if (auto call = llvm::dyn_cast<llvm::CallInst>(val)) {
+    if (call->arg_size()) {
+      push(call->getArgOperand(0));
+    }
+
+  } else if (llvm::isa<llvm::BinaryOperator>(val) ||
+             llvm::isa<llvm::CastInst>(val)) {
+    for (auto &op : llvm::cast<llvm::Instruction>(val)->operands()) {
+      push(op.get());
+    }
+  }
+}
+
 // Try to resolve `val` as a cross-reference.
+//
+// Instructions and constant expressions can be nested arbitrarily deeply, so
+// rather than recursing on operands, we evaluate `val` in post-order using an
+// explicit work list. A value is resolved only once all of its operands have
+// been resolved.
 ResolvedCrossReference
 CrossReferenceResolverImpl::ResolveValue(llvm::Value *val) {
-  if (auto const_val = llvm::dyn_cast<llvm::Constant>(val)) {
-    return ResolveConstant(const_val);
-
-  } else if (auto inst_val = llvm::dyn_cast<llvm::Instruction>(val)) {
-    return ResolveInstruction(inst_val);
-  } else {
+  const auto root_cache = CacheFor(val);
+  if (!root_cache) {
     return {};
+  } else if (auto it = root_cache->find(val); it != root_cache->end()) {
+    return it->second;
   }
+
+  work_list.clear();
+  visited.clear();
+  work_list.emplace_back(val, false);
+
+  while (!work_list.empty()) {
+    auto [node, operands_pushed] = work_list.back();
+    const auto cache = CacheFor(node);
+
+    // All operands of `node` are resolved, so now resolve `node`.
+    if (operands_pushed) {
+      work_list.pop_back();
+
+      ResolvedCrossReference xr = {};
+      if (auto inst_val = llvm::dyn_cast<llvm::Instruction>(node)) {
+        xr = ResolveInstruction(inst_val);
+      } else {
+        xr = ResolveConstant(llvm::cast<llvm::Constant>(node));
+      }
+      cache->insert({node, xr});
+
+    // Already resolved via another path, or we've found a cycle, e.g. an
+    // instruction in unreachable code using itself. In the case of a cycle,
+    // the user of `node` sees an invalid operand.
+    } else if (cache->count(node) || !visited.insert(node).second) {
+      work_list.pop_back();
+
+    } else {
+      work_list.back().second = true;
+      PushOperands(node);
+    }
+  }
+
+  return ResolvedOperand(val);
 }
 
 // Returns the "magic" value that represents the return address.
@@ -684,6 +811,10 @@ CrossReferenceResolver::~CrossReferenceResolver(void) {}
 
 // The primary way of using a cross-reference resolver is with an entity
 // lifter that can resolve global references on our behalf.
+//
+// Resolvers made from the same entity lifter share its cache of resolved
+// constants, which is cleared whenever the entity lifter learns about a new
+// entity.
 CrossReferenceResolver::CrossReferenceResolver(const EntityLifter &lifter)
     : impl(std::make_shared<CrossReferenceResolverImpl>(
           lifter.Options().module->getDataLayout(),
@@ -691,34 +822,43 @@ CrossReferenceResolver::CrossReferenceResolver(const EntityLifter &lifter)
             return lifter.AddressOfEntity(entity);
           },
           [=](uint64_t addr) -> llvm::Constant * {
-            llvm::Constant *ret = nullptr;
-            return ret;
-          })) {}
+            auto [entity, offset] = lifter.EntityContainingAddress(addr);
+            return offset ? nullptr : entity;
+          },
+          lifter.impl->constant_xref_cache)) {}
 
 // In the absence of an entity lifter, we need a DataLayout to determine
 // offsets, etc.
 CrossReferenceResolver::CrossReferenceResolver(const llvm::DataLayout &dl)
     : impl(std::make_shared<CrossReferenceResolverImpl>(
           dl, [](llvm::Constant *) { return std::nullopt; },
-          [](uint64_t) -> llvm::Constant * { return nullptr; })) {}
+          [](uint64_t) -> llvm::Constant * { return nullptr; },
+          std::make_shared<ResolvedCrossReferenceCache>())) {}
 
 // Clear the internal cache.
 void CrossReferenceResolver::ClearCache(void) const {
+  ANVILL_TRACE_ZONE("CrossReferenceResolver::ClearCache");
   impl->xref_cache.clear();
+  impl->constant_xref_cache->clear();
 }
 
 // Try to resolve `val` as a cross-reference. `uses_cache` flag is set to true
 // if the application is using the cache and does not want to invalidate it.
 ResolvedCrossReference
 CrossReferenceResolver::TryResolveReferenceWithCaching(llvm::Value *val) const {
+  ANVILL_TRACE_ZONE("CrossReferenceResolver::TryResolveReferenceWithCaching");
   return impl->ResolveValue(val);
 }
 
 ResolvedCrossReference
 CrossReferenceResolver::TryResolveReferenceWithClearedCache(llvm::Value *val) const {
+  ANVILL_TRACE_ZONE(
+      "CrossReferenceResolver::TryResolveReferenceWithClearedCache");
   // If the application is not using cache, invalidate it before resolving
   // the cross references. It is done to avoid stale `val` sitting in the
-  // cache if it has been changed/deleted.
+  // cache if its operands have been changed. Constants are immutable, and
+  // entries for deleted constants are dropped automatically, so the cache of
+  // constants is kept.
   impl->xref_cache.clear();
   return impl->ResolveValue(val);
 }
@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <anvill/Analysis/CrossReferenceResolver.h>
+#include <llvm/IR/ValueMap.h>
+
+namespace anvill {
+
+// Configures a cache of resolved cross-references so that an entry is
+// dropped when its value is deleted, and so that it isn't moved over to the
+// replacement of a value whose uses are replaced. This means that a cached
+// pointer never refers to a deleted value that was reallocated as something
+// else.
+struct ResolvedCrossReferenceCacheConfig
+    : public llvm::ValueMapConfig<llvm::Value *> {
+  enum { FollowRAUW = false };
+};
+
+// Maps values to their resolved cross-references.
+using ResolvedCrossReferenceCache =
+    llvm::ValueMap<llvm::Value *, ResolvedCrossReference,
+                   ResolvedCrossReferenceCacheConfig>;
+
+}  // namespace anvill
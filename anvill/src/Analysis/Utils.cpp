@@ -22,20 +22,40 @@
 #include <llvm/IR/Instruction.h>
 #include <llvm/IR/Instructions.h>
 #include <llvm/IR/Intrinsics.h>
+#include <llvm/IR/Metadata.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Operator.h>
 
+#include <optional>
 #include <unordered_map>
 
 namespace anvill {
 namespace {
 
+// Lazily finds, and then remembers, the target architecture of a module, so
+// that we don't need to re-parse the module's target triple for every value
+// that we look at.
+class ModuleArch {
+ public:
+  explicit ModuleArch(llvm::Module *module_) : module(module_) {}
+
+  llvm::Triple::ArchType operator*(void) {
+    if (!arch) {
+      arch = llvm::Triple(module->getTargetTriple()).getArch();
+    }
+    return *arch;
+  }
+
+ private:
+  llvm::Module *const module;
+  std::optional<llvm::Triple::ArchType> arch;
+};
+
 // Returns `true` if `reg_name` appears to be the name of the stack pointer
-// register in the target architecture of `module`.
-static bool IsStackPointerRegName(llvm::Module *module,
+// register in the target architecture `arch`.
+static bool IsStackPointerRegName(llvm::Triple::ArchType arch,
                                   const std::string &reg_name) {
-  llvm::Triple triple(module->getTargetTriple());
-  switch (triple.getArch()) {
+  switch (arch) {
     case llvm::Triple::ArchType::x86: return reg_name == "esp";
     case llvm::Triple::ArchType::x86_64:
       return reg_name == "rsp" || reg_name == "esp";
@@ -54,11 +74,10 @@ static bool IsStackPointerRegName(llvm::Module *module,
 }
 
 // Returns `true` if `reg_name` appears to be the name of the program counter
-// register in the target architecture of `module`.
-static bool IsProgramCounterRegName(llvm::Module *module,
+// register in the target architecture `arch`.
+static bool IsProgramCounterRegName(llvm::Triple::ArchType arch,
                                     const std::string &reg_name) {
-  llvm::Triple triple(module->getTargetTriple());
-  switch (triple.getArch()) {
+  switch (arch) {
     case llvm::Triple::ArchType::x86: return reg_name == "eip";
     case llvm::Triple::ArchType::x86_64:
       return reg_name == "rip" || reg_name == "eip";
@@ -79,24 +98,48 @@ static bool IsProgramCounterRegName(llvm::Module *module,
 // `__anvill_reg_RSP`, which under certain lifting options, would represent
 // an unmodelled dependency on the native stack pointer on entry to a function.
 template <typename RegNamePred>
-static bool IsLoadOfUnmodelledRegister(llvm::LoadInst *load, RegNamePred pred) {
+static bool IsLoadOfUnmodelledRegister(llvm::LoadInst *load,
+                                       ModuleArch &arch, RegNamePred pred) {
   if (auto gv =
           llvm::dyn_cast<llvm::GlobalVariable>(load->getPointerOperand())) {
     if (const auto gv_name = gv->getName();
         gv_name.startswith(kUnmodelledRegisterPrefix)) {
-      return pred(gv->getParent(),
+      return pred(*arch,
                   gv_name.substr(kUnmodelledRegisterPrefix.size()).lower());
     }
   }
   return false;
 }
 
+// Returns `true` if `call` is a call to `llvm.read_register` of a register
+// whose lower-case name satisfies `pred`. Lifted code reads registers this
+// way under the `kReadRegister` state structure initialization procedure.
+template <typename RegNamePred>
+static bool IsReadOfRegister(llvm::CallBase *call, ModuleArch &arch,
+                             RegNamePred pred) {
+  if (call->getIntrinsicID() != llvm::Intrinsic::read_register) {
+    return false;
+  }
+
+  auto reg_val = llvm::dyn_cast<llvm::MetadataAsValue>(call->getArgOperand(0));
+  auto reg_tuple_md =
+      reg_val ? llvm::dyn_cast<llvm::MDTuple>(reg_val->getMetadata()) : nullptr;
+  if (!reg_tuple_md || !reg_tuple_md->getNumOperands()) {
+    return false;
+  }
+
+  auto reg_name_md =
+      llvm::dyn_cast<llvm::MDString>(reg_tuple_md->getOperand(0));
+  return reg_name_md && pred(*arch, reg_name_md->getString().lower());
+}
+
 // Returns `true` if it looks like we're calling a function that should get
 // use the value of the native stack pointer on entry to a function.
 //
 // NOTE(pag): We're overly defensive here just in case parts of Anvill permit
 //            using intrinsics in the future.
-static bool IsCallRelatedToStackPointerItrinsic(llvm::CallBase *call) {
+static bool IsCallRelatedToStackPointerItrinsic(llvm::CallBase *call,
+                                                ModuleArch &arch) {
   const auto intrinsic_id = call->getIntrinsicID();
 
   // This is only valid on AArch64.
@@ -106,12 +149,24 @@ static bool IsCallRelatedToStackPointerItrinsic(llvm::CallBase *call) {
   // This intrinsic can be used for getting the address of the stack
   // pointer.
   } else if (intrinsic_id == llvm::Intrinsic::read_register) {
-    auto reg_val = call->getArgOperand(0);
-    auto reg_tuple_md = llvm::cast<llvm::MDTuple>(
-        llvm::cast<llvm::MetadataAsValue>(reg_val)->getMetadata());
-    auto reg_name_md = llvm::cast<llvm::MDString>(reg_tuple_md->getOperand(0));
-    auto reg_name = reg_name_md->getString().lower();
-    return IsStackPointerRegName(call->getModule(), reg_name);
+    return IsReadOfRegister(call, arch, IsStackPointerRegName);
+
+  } else {
+    return false;
+  }
+}
+
+// Returns `true` if it looks like `val` is the stack pointer of a function
+// targeting `arch`.
+static bool IsStackPointerInArch(ModuleArch &arch, llvm::Value *val) {
+  if (auto gv = llvm::dyn_cast<llvm::GlobalVariable>(val)) {
+    return gv->getName() == kSymbolicSPName;
+
+  } else if (auto load = llvm::dyn_cast<llvm::LoadInst>(val)) {
+    return IsLoadOfUnmodelledRegister(load, arch, IsStackPointerRegName);
+
+  } else if (auto call = llvm::dyn_cast<llvm::CallBase>(val)) {
+    return IsCallRelatedToStackPointerItrinsic(call, arch);
 
   } else {
     return false;
@@ -124,21 +179,17 @@ namespace {
 
 class SymbolicStackResolverImpl {
  public:
-  SymbolicStackResolverImpl() = delete;
-
-  static bool IsRelatedToStackPointer(llvm::Module *module, llvm::Value *val) {
-    auto impl = new SymbolicStackResolverImpl(module);
-    return impl->ResolveFromValue(val);
-  }
+  explicit SymbolicStackResolverImpl(llvm::Module *m)
+      : module(m),
+        arch(m) {}
 
   bool ResolveFromValue(llvm::Value *val);
   bool ResolveFromConstantExpr(llvm::ConstantExpr *ce);
 
- private:
-  SymbolicStackResolverImpl(llvm::Module *m) : module(m) {}
-  ~SymbolicStackResolverImpl() {}
+  llvm::Module *const module;
+  ModuleArch arch;
 
-  llvm::Module *module;
+ private:
   std::unordered_map<llvm::Value *, bool> cache;
 };
 
@@ -174,7 +225,7 @@ bool SymbolicStackResolverImpl::ResolveFromValue(llvm::Value *val) {
         val3 && val3 != val) {
       result = ResolveFromValue(val3);
     } else {
-      result = IsStackPointer(module, val);
+      result = IsStackPointerInArch(arch, val);
     }
   }
 
@@ -219,35 +270,17 @@ bool SymbolicStackResolverImpl::ResolveFromConstantExpr(
   return false;
 }
 
-}  // namespace
-
-bool IsRelatedToStackPointer(llvm::Module *module, llvm::Value *val) {
-  return SymbolicStackResolverImpl::IsRelatedToStackPointer(module, val);
-}
-
-// Returns `true` if it looks like `val` is the stack counter.
-bool IsStackPointer(llvm::Module *module, llvm::Value *val) {
+// Returns `true` if it looks like `val` is the program counter of a function
+// targeting `arch`.
+static bool IsProgramCounterInArch(ModuleArch &arch, llvm::Value *val) {
   if (auto gv = llvm::dyn_cast<llvm::GlobalVariable>(val)) {
-    return gv->getName() == kSymbolicSPName;
+    return gv->getName() == kSymbolicPCName;
 
   } else if (auto load = llvm::dyn_cast<llvm::LoadInst>(val)) {
-    return IsLoadOfUnmodelledRegister(load, IsStackPointerRegName);
+    return IsLoadOfUnmodelledRegister(load, arch, IsProgramCounterRegName);
 
   } else if (auto call = llvm::dyn_cast<llvm::CallBase>(val)) {
-    return IsCallRelatedToStackPointerItrinsic(call);
-
-  } else {
-    return false;
-  }
-}
-
-// Returns `true` if it looks like `val` is the program counter.
-bool IsProgramCounter(llvm::Module *, llvm::Value *val) {
-  if (auto gv = llvm::dyn_cast<llvm::GlobalVariable>(val)) {
-    return gv->getName() == kSymbolicPCName;
-
-  } else if (auto load = llvm::dyn_cast<llvm::LoadInst>(val)) {
-    return IsLoadOfUnmodelledRegister(load, IsProgramCounterRegName);
+    return IsReadOfRegister(call, arch, IsProgramCounterRegName);
 
   // TODO(pag): Cover arguments to remill three-argument form functions?
   } else {
@@ -255,7 +288,7 @@ bool IsProgramCounter(llvm::Module *, llvm::Value *val) {
   }
 }
 
-static bool IsAcceptableReturnAddressDisplacement(llvm::Module *module,
+static bool IsAcceptableReturnAddressDisplacement(ModuleArch &arch,
                                                   llvm::Constant *v) {
   auto ci = llvm::dyn_cast<llvm::ConstantInt>(v);
   if (!ci) {
@@ -264,8 +297,7 @@ static bool IsAcceptableReturnAddressDisplacement(llvm::Module *module,
 
   auto disp = ci->getZExtValue();
 
-  llvm::Triple triple(module->getTargetTriple());
-  switch (triple.getArch()) {
+  switch (*arch) {
     case llvm::Triple::ArchType::sparc:
     case llvm::Triple::ArchType::sparcel:
     case llvm::Triple::ArchType::sparcv9:
@@ -274,8 +306,9 @@ static bool IsAcceptableReturnAddressDisplacement(llvm::Module *module,
   }
 }
 
-// Returns `true` if it looks like `val` is the return address.
-bool IsReturnAddress(llvm::Module *module, llvm::Value *val) {
+// Returns `true` if it looks like `val` is the return address of a function
+// targeting `arch`.
+static bool IsReturnAddressInArch(ModuleArch &arch, llvm::Value *val) {
   const auto addressofreturnaddress = [](llvm::CallBase *call) -> bool {
     return call &&
            call->getIntrinsicID() == llvm::Intrinsic::addressofreturnaddress;
@@ -299,23 +332,23 @@ bool IsReturnAddress(llvm::Module *module, llvm::Value *val) {
         llvm::dyn_cast<llvm::CallBase>(li->getPointerOperand()));
 
   } else if (auto pti = llvm::dyn_cast<llvm::PtrToIntOperator>(val)) {
-    return IsReturnAddress(module, pti->getOperand(0));
+    return IsReturnAddressInArch(arch, pti->getOperand(0));
 
   } else if (auto itp = llvm::dyn_cast<llvm::IntToPtrInst>(val)) {
-    return IsReturnAddress(module, itp->getOperand(0));
+    return IsReturnAddressInArch(arch, itp->getOperand(0));
 
   } else if (auto bc = llvm::dyn_cast<llvm::BitCastOperator>(val)) {
-    return IsReturnAddress(module, bc->getOperand(0));
+    return IsReturnAddressInArch(arch, bc->getOperand(0));
 
   } else if (auto ce = llvm::dyn_cast<llvm::ConstantExpr>(val)) {
     switch (ce->getOpcode()) {
       case llvm::Instruction::Add: {
         llvm::Constant *o0 = ce->getOperand(0);
         llvm::Constant *o1 = ce->getOperand(1);
-        if (IsReturnAddress(module, o0)) {
-          return IsAcceptableReturnAddressDisplacement(module, o1);
-        } else if (IsReturnAddress(module, o1)) {
-          return IsAcceptableReturnAddressDisplacement(module, o0);
+        if (IsReturnAddressInArch(arch, o0)) {
+          return IsAcceptableReturnAddressDisplacement(arch, o1);
+        } else if (IsReturnAddressInArch(arch, o1)) {
+          return IsAcceptableReturnAddressDisplacement(arch, o0);
 
         } else {
           return false;
@@ -323,7 +356,7 @@ bool IsReturnAddress(llvm::Module *module, llvm::Value *val) {
       }
 
       case llvm::Instruction::IntToPtr:
-        return IsReturnAddress(module, ce->getOperand(0));
+        return IsReturnAddressInArch(arch, ce->getOperand(0));
 
       default: return false;
     }
@@ -333,6 +366,97 @@ bool IsReturnAddress(llvm::Module *module, llvm::Value *val) {
   }
 }
 
+}  // namespace
+
+bool IsRelatedToStackPointer(llvm::Module *module, llvm::Value *val) {
+  SymbolicStackResolverImpl resolver(module);
+  return resolver.ResolveFromValue(val);
+}
+
+// Returns `true` if it looks like `val` is the stack counter.
+bool IsStackPointer(llvm::Module *, llvm::Value *val) {
+  if (auto gv = llvm::dyn_cast<llvm::GlobalVariable>(val)) {
+    return gv->getName() == kSymbolicSPName;
+
+  } else if (auto inst = llvm::dyn_cast<llvm::Instruction>(val)) {
+    ModuleArch arch(inst->getModule());
+    return IsStackPointerInArch(arch, val);
+
+  } else {
+    return false;
+  }
+}
+
+// Returns `true` if it looks like `val` is the program counter.
+bool IsProgramCounter(llvm::Module *, llvm::Value *val) {
+  if (auto gv = llvm::dyn_cast<llvm::GlobalVariable>(val)) {
+    return gv->getName() == kSymbolicPCName;
+
+  } else if (auto inst = llvm::dyn_cast<llvm::Instruction>(val)) {
+    ModuleArch arch(inst->getModule());
+    return IsProgramCounterInArch(arch, val);
+
+  } else {
+    return false;
+  }
+}
+
+// Returns `true` if it looks like `val` is the return address.
+bool IsReturnAddress(llvm::Module *module, llvm::Value *val) {
+  ModuleArch arch(module);
+  return IsReturnAddressInArch(arch, val);
+}
+
+class SymbolicValueAnalysis::Impl {
+ public:
+  explicit Impl(llvm::Module *module) : resolver(module) {}
+
+  // Remembers the answer to the question asked by `pred` about `val` in
+  // `answers`.
+  template <typename Pred>
+  bool Remember(std::unordered_map<llvm::Value *, bool> &answers,
+                llvm::Value *val, Pred pred) {
+    auto [it, added] = answers.emplace(val, false);
+    if (added) {
+      it->second = pred(resolver.arch, val);
+    }
+    return it->second;
+  }
+
+  // Answers `IsRelatedToStackPointer`, and owns the module's architecture.
+  SymbolicStackResolverImpl resolver;
+
+  std::unordered_map<llvm::Value *, bool> is_program_counter;
+  std::unordered_map<llvm::Value *, bool> is_stack_pointer;
+  std::unordered_map<llvm::Value *, bool> is_return_address;
+};
+
+SymbolicValueAnalysis::SymbolicValueAnalysis(llvm::Module *module)
+    : impl(new Impl(module)) {}
+
+SymbolicValueAnalysis::~SymbolicValueAnalysis(void) {}
+
+// Returns `true` if it looks like `val` is the program counter.
+bool SymbolicValueAnalysis::IsProgramCounter(llvm::Value *val) {
+  return impl->Remember(impl->is_program_counter, val, IsProgramCounterInArch);
+}
+
+// Returns `true` if it looks like `val` is the stack counter.
+bool SymbolicValueAnalysis::IsStackPointer(llvm::Value *val) {
+  return impl->Remember(impl->is_stack_pointer, val, IsStackPointerInArch);
+}
+
+// Returns `true` if it looks like `val` is the return address.
+bool SymbolicValueAnalysis::IsReturnAddress(llvm::Value *val) {
+  return impl->Remember(impl->is_return_address, val, IsReturnAddressInArch);
+}
+
+// Returns `true` if it looks like `val` is derived from a symbolic stack
+// pointer representation.
+bool SymbolicValueAnalysis::IsRelatedToStackPointer(llvm::Value *val) {
+  return impl->resolver.ResolveFromValue(val);
+}
+
 // Returns `true` if `val` looks like it is backed by a definition, and thus can
 // be the aliasee of an `llvm::GlobalAlias`.
 bool CanBeAliased(llvm::Value *val) {
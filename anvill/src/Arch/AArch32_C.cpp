@@ -56,6 +56,9 @@ static llvm::Type *IntegerTypeSplitter(llvm::Type *type) {
   return llvm::ArrayType::get(i32_ty, num_elements);
 }
 
+static const ScalarParameterAllocator
+    kScalarParamAllocator(kParamRegConstraints);
+
 }  // namespace
 
 // This is AAPCS calling convention for armv7 architecture. It does not
@@ -79,6 +82,7 @@ class AArch32_C : public CallingConvention {
 
   const std::vector<RegisterConstraint> &parameter_register_constraints;
   const std::vector<RegisterConstraint> &return_register_constraints;
+  const ScalarParameterAllocator &scalar_parameter_allocator;
 };
 
 std::unique_ptr<CallingConvention>
@@ -89,7 +93,8 @@ CallingConvention::CreateAArch32_C(const remill::Arch *arch) {
 AArch32_C::AArch32_C(const remill::Arch *arch)
     : CallingConvention(llvm::CallingConv::C, arch),
       parameter_register_constraints(kParamRegConstraints),
-      return_register_constraints(kReturnRegConstraints) {}
+      return_register_constraints(kReturnRegConstraints),
+      scalar_parameter_allocator(kScalarParamAllocator) {}
 
 // Allocates the elements of the function signature of func to memory or
 // registers. This includes parameters/arguments, return values, and the return
@@ -291,6 +296,12 @@ AArch32_C::BindParameters(llvm::Function &function, bool injected_sret,
                           std::vector<ParameterDecl> &parameter_declarations) {
 
   const auto param_names = TryRecoverParamNames(function);
+
+  if (scalar_parameter_allocator.TryAllocate(arch, function, param_names,
+                                             parameter_declarations)) {
+    return llvm::Error::success();
+  }
+
   llvm::DataLayout dl(function.getParent());
 
   // Used to keep track of which registers have been allocated
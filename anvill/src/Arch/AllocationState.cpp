@@ -19,6 +19,7 @@
 
 #include <glog/logging.h>
 #include <llvm/IR/Attributes.h>
+#include <llvm/IR/Function.h>
 #include <remill/Arch/Arch.h>
 #include <remill/BC/Compat/VectorType.h>
 
@@ -71,6 +72,61 @@ GetSmallestVariantName(const std::vector<VariantConstraint> &variants,
   return kEmptyRegName;
 }
 
+// Assigns a SizeConstraint and TypeConstraint to the scalar type `type`, where
+// pointers are `ptr_size_constraint`-sized. Returns `llvm::None` if `type`
+// isn't a scalar, or is an integer that's too big for any register.
+static llvm::Optional<SizeAndType>
+AssignScalarSizeAndType(llvm::Type &type, SizeConstraint ptr_size_constraint) {
+  switch (type.getTypeID()) {
+    case llvm::Type::IntegerTyID: {
+      const auto width = llvm::cast<llvm::IntegerType>(&type)->getBitWidth();
+      if (width <= 8) {
+        return SizeAndType(kMinBit8, kTypeInt);
+      } else if (width <= 16) {
+        return SizeAndType(kMinBit16, kTypeInt);
+      } else if (width <= 32) {
+        return SizeAndType(kMinBit32, kTypeInt);
+      } else if (width <= 64) {
+        return SizeAndType(kMinBit64, kTypeInt);
+      } else if (width <= 80) {
+        return SizeAndType(kMinBit80, kTypeInt);
+      } else if (width <= 128) {
+        return SizeAndType(kMinBit128, kTypeInt);
+      } else if (width <= 256) {
+        return SizeAndType(kMinBit256, kTypeInt);
+      } else if (width <= 512) {
+        return SizeAndType(kMinBit512, kTypeInt);
+      } else {
+        return llvm::None;
+      }
+    }
+
+    case llvm::Type::HalfTyID: return SizeAndType(kMinBit16, kTypeFloat);
+    case llvm::Type::FloatTyID: return SizeAndType(kMinBit32, kTypeFloat);
+    case llvm::Type::DoubleTyID: return SizeAndType(kMinBit64, kTypeFloat);
+    case llvm::Type::FP128TyID: return SizeAndType(kMinBit128, kTypeFloat);
+    case llvm::Type::PointerTyID:
+      return SizeAndType(ptr_size_constraint, kTypeIntegral);
+    case llvm::Type::X86_FP80TyID: return SizeAndType(kMinBit80, kTypeIntegral);
+    default: return llvm::None;
+  }
+}
+
+// Index of `size`, one of the sizes returned by `SizeConstraintToSize`, into
+// the per-size tables of a `ScalarParameterAllocator`.
+static unsigned SizeIndex(uint64_t size) {
+  switch (size) {
+    case 8: return 0u;
+    case 16: return 1u;
+    case 32: return 2u;
+    case 64: return 3u;
+    case 80: return 4u;
+    case 128: return 5u;
+    case 256: return 6u;
+    default: return 7u;
+  }
+}
+
 }  // namespace
 
 AllocationState::~AllocationState(void) {}
@@ -102,63 +158,16 @@ uint64_t AllocationState::RemainingSpace(size_t i) {
 // might need to alter the types and or size that this function returns before
 // passing that information to TryRegisterAllocate.
 SizeAndType AllocationState::AssignSizeAndType(llvm::Type &type) {
-  SizeConstraint size_constraint;
-  TypeConstraint type_constraint;
-
-  switch (type.getTypeID()) {
-    case llvm::Type::IntegerTyID: {
-      type_constraint = kTypeInt;
-      auto derived = llvm::cast<llvm::IntegerType>(&type);
-      unsigned int width = derived->getBitWidth();
-      if (width <= 8) {
-        size_constraint = kMinBit8;
-      } else if (width <= 16) {
-        size_constraint = kMinBit16;
-      } else if (width <= 32) {
-        size_constraint = kMinBit32;
-      } else if (width <= 64) {
-        size_constraint = kMinBit64;
-      } else if (width <= 80) {
-        size_constraint = kMinBit80;
-      } else if (width <= 128) {
-        size_constraint = kMinBit128;
-      } else if (width <= 256) {
-        size_constraint = kMinBit256;
-      } else if (width <= 512) {
-        size_constraint = kMinBit512;
-      } else {
-        LOG(FATAL) << "Integer too big: " << remill::LLVMThingToString(derived);
-      }
-      break;
-    }
-    case llvm::Type::HalfTyID:
-      type_constraint = kTypeFloat;
-      size_constraint = kMinBit16;
-      break;
-
-    case llvm::Type::FloatTyID:
-      type_constraint = kTypeFloat;
-      size_constraint = kMinBit32;
-      break;
-
-    case llvm::Type::DoubleTyID:
-      type_constraint = kTypeFloat;
-      size_constraint = kMinBit64;
-      break;
-
-    case llvm::Type::FP128TyID:
-      type_constraint = kTypeFloat;
-      size_constraint = kMinBit128;
-      break;
+  if (auto scalar = AssignScalarSizeAndType(type, ptr_size_constraint)) {
+    return scalar.getValue();
+  }
 
-    case llvm::Type::PointerTyID:
-      type_constraint = kTypeIntegral;
-      size_constraint = ptr_size_constraint;
-      break;
+  SizeConstraint size_constraint = kMinBit8;
+  TypeConstraint type_constraint = kTypeInt;
 
-    case llvm::Type::X86_FP80TyID:
-      type_constraint = kTypeIntegral;
-      size_constraint = kMinBit80;
+  switch (type.getTypeID()) {
+    case llvm::Type::IntegerTyID:
+      LOG(FATAL) << "Integer too big: " << remill::LLVMThingToString(&type);
       break;
 
     case llvm::GetFixedVectorTypeId():
@@ -522,4 +531,75 @@ llvm::Error AllocationState::CoalescePacking(
   return llvm::Error::success();
 }
 
+ScalarParameterAllocator::ScalarParameterAllocator(
+    const std::vector<RegisterConstraint> &constraints) {
+  static constexpr uint64_t kSizes[kNumSizes] = {8, 16, 32, 64,
+                                                 80, 128, 256, 512};
+  slots.reserve(constraints.size());
+  for (const auto &constraint : constraints) {
+    auto &slot = slots.emplace_back();
+    slot.type_constraint = constraint.variants.front().type_constraint;
+    slot.max_size =
+        SizeConstraintToSize(constraint.variants.back().size_constraint);
+    for (auto i = 0u; i < kNumSizes; ++i) {
+      const auto &name = GetSmallestVariantName(constraint.variants, kSizes[i]);
+      slot.variant_names[i] = name.empty() ? nullptr : &name;
+    }
+  }
+}
+
+// This mirrors `AllocationState::TryBasicRegisterAllocate` when values aren't
+// packed together: each parameter takes the first unused register whose type
+// and size fit, and the smallest variant of that register that fits the
+// parameter.
+bool ScalarParameterAllocator::TryAllocate(
+    const remill::Arch *arch, llvm::Function &function,
+    const std::vector<std::string> &param_names,
+    std::vector<ParameterDecl> &param_decls) const {
+
+  // Registers in use are tracked in a bitmask.
+  if (slots.size() > 64u) {
+    return false;
+  }
+
+  const auto ptr_size_constraint =
+      arch->address_size == 32 ? kMinBit32 : kMinBit64;
+  const auto prev_size = param_decls.size();
+  uint64_t used = 0u;
+
+  for (auto &argument : function.args()) {
+    const auto param_type = argument.getType();
+    const remill::Register *reg = nullptr;
+
+    if (auto st = AssignScalarSizeAndType(*param_type, ptr_size_constraint)) {
+      const auto size = SizeConstraintToSize(st->sc);
+      for (auto i = 0u; i < slots.size(); ++i) {
+        const auto &slot = slots[i];
+        if (((used >> i) & 1u) || !(slot.type_constraint & st->tc) ||
+            size > slot.max_size) {
+          continue;
+        }
+
+        used |= 1ull << i;
+        if (auto name = slot.variant_names[SizeIndex(size)]) {
+          reg = arch->RegisterByName(*name);
+        }
+        break;
+      }
+    }
+
+    if (!reg) {
+      param_decls.erase(param_decls.begin() + prev_size, param_decls.end());
+      return false;
+    }
+
+    auto &decl = param_decls.emplace_back();
+    decl.reg = reg;
+    decl.type = param_type;
+    decl.name = param_names[argument.getArgNo()];
+  }
+
+  return true;
+}
+
 }  // namespace anvill
@@ -21,6 +21,7 @@
 #include <remill/BC/Compat/VectorType.h>
 #include <remill/BC/Util.h>
 
+#include <string>
 #include <vector>
 
 #include "Arch.h"
@@ -83,4 +84,42 @@ struct AllocationState {
   const SizeConstraint ptr_size_constraint;
 };
 
+// Register assignments for scalar parameters, i.e. integers, pointers, and
+// floating point values, precomputed from the parameter register constraints
+// of a calling convention. Most signatures are made up of a handful of
+// scalars, e.g. up to six integers and eight floats on x86-64, and for those
+// this gives the same assignment as `AllocationState::TryRegisterAllocate`
+// would, without scanning the register variants or allocating for each
+// parameter. Calling conventions try this first, and fall back on the general
+// allocator, i.e. `AllocationState`, for signatures that aren't made up only
+// of scalars that all fit in registers.
+class ScalarParameterAllocator {
+ public:
+  explicit ScalarParameterAllocator(
+      const std::vector<RegisterConstraint> &constraints);
+
+  // Allocate every parameter of `function` to a register. Returns `false`,
+  // leaving `param_decls` as it was, if any parameter isn't a scalar, or
+  // doesn't fit in a register, in which case the parameters should be
+  // allocated by an `AllocationState`.
+  bool TryAllocate(const remill::Arch *arch, llvm::Function &function,
+                   const std::vector<std::string> &param_names,
+                   std::vector<ParameterDecl> &param_decls) const;
+
+ private:
+  // Number of distinct sizes that a `SizeConstraint` can name.
+  static constexpr unsigned kNumSizes = 8u;
+
+  struct Slot {
+    TypeConstraint type_constraint;
+    uint64_t max_size;
+
+    // Name of the smallest variant of the register that fits each size, or
+    // `nullptr` if none does.
+    const std::string *variant_names[kNumSizes];
+  };
+
+  std::vector<Slot> slots;
+};
+
 }  // namespace anvill
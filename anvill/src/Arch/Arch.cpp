@@ -276,19 +276,4 @@ ApplyX86Ext(const std::vector<RegisterConstraint> &constraints,
   return ret;
 }
 
-// Select and return one of `basic`, `avx`, or `avx512` given `arch_name`.
-const std::vector<RegisterConstraint> &
-SelectX86Constraint(remill::ArchName arch_name,
-                    const std::vector<RegisterConstraint> &basic,
-                    const std::vector<RegisterConstraint> &avx,
-                    const std::vector<RegisterConstraint> &avx512) {
-  switch (arch_name) {
-    case remill::kArchX86:
-    case remill::kArchAMD64: return basic;
-    case remill::kArchX86_AVX:
-    case remill::kArchAMD64_AVX: return avx;
-    default: return avx512;
-  }
-}
-
 }  // namespace anvill
@@ -18,6 +18,7 @@
 #pragma once
 
 #include <llvm/IR/CallingConv.h>
+#include <remill/Arch/Name.h>
 #include <remill/BC/Compat/Error.h>
 
 #include <string>
@@ -28,7 +29,6 @@ class Function;
 }  // namespace llvm
 namespace remill {
 class Arch;
-enum ArchName : uint32_t;
 class IntrinsicTable;
 struct Register;
 }  // namespace remill
@@ -119,11 +119,17 @@ ApplyX86Ext(const std::vector<RegisterConstraint> &constraints,
             remill::ArchName arch_name);
 
 // Select and return one of `basic`, `avx`, or `avx512` given `arch_name`.
-const std::vector<RegisterConstraint> &
-SelectX86Constraint(remill::ArchName arch_name,
-                    const std::vector<RegisterConstraint> &basic,
-                    const std::vector<RegisterConstraint> &avx,
-                    const std::vector<RegisterConstraint> &avx512);
+template <typename T>
+const T &SelectX86Constraint(remill::ArchName arch_name, const T &basic,
+                             const T &avx, const T &avx512) {
+  switch (arch_name) {
+    case remill::kArchX86:
+    case remill::kArchAMD64: return basic;
+    case remill::kArchX86_AVX:
+    case remill::kArchAMD64_AVX: return avx;
+    default: return avx512;
+  }
+}
 
 class CallingConvention {
  public:
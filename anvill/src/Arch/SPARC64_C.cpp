@@ -163,6 +163,9 @@ static llvm::Type *IntegerTypeSplitter(llvm::Type *type) {
   return llvm::ArrayType::get(i64_ty, num_elements);
 }
 
+static const ScalarParameterAllocator
+    kScalarParamAllocator(kParamRegConstraints);
+
 }  // namespace
 
 // This is the only calling convention for 32-bit SPARC code.
@@ -183,6 +186,7 @@ class SPARC64_C : public CallingConvention {
 
   const std::vector<RegisterConstraint> &parameter_register_constraints;
   const std::vector<RegisterConstraint> &return_register_constraints;
+  const ScalarParameterAllocator &scalar_parameter_allocator;
 };
 
 std::unique_ptr<CallingConvention>
@@ -193,7 +197,8 @@ CallingConvention::CreateSPARC64_C(const remill::Arch *arch) {
 SPARC64_C::SPARC64_C(const remill::Arch *arch)
     : CallingConvention(llvm::CallingConv::C, arch),
       parameter_register_constraints(kParamRegConstraints),
-      return_register_constraints(kReturnRegConstraints) {}
+      return_register_constraints(kReturnRegConstraints),
+      scalar_parameter_allocator(kScalarParamAllocator) {}
 
 // Allocates the elements of the function signature of func to memory or
 // registers. This includes parameters/arguments, return values, and the return
@@ -360,6 +365,12 @@ SPARC64_C::BindParameters(llvm::Function &function, bool injected_sret,
       << "Injected struct returns are not supported on SPARC targets";
 
   const auto param_names = TryRecoverParamNames(function);
+
+  if (scalar_parameter_allocator.TryAllocate(arch, function, param_names,
+                                             parameter_declarations)) {
+    return llvm::Error::success();
+  }
+
   llvm::DataLayout dl(function.getParent());
 
   // Used to keep track of which registers have been allocated
@@ -88,6 +88,15 @@ static const std::vector<RegisterConstraint> kAVXParamRegConstraints =
 static const std::vector<RegisterConstraint> kAVX512ParamRegConstraints =
     ApplyX86Ext(kParamRegConstraints, remill::kArchAMD64_AVX512);
 
+static const ScalarParameterAllocator
+    kScalarParamAllocator(kParamRegConstraints);
+
+static const ScalarParameterAllocator
+    kAVXScalarParamAllocator(kAVXParamRegConstraints);
+
+static const ScalarParameterAllocator
+    kAVX512ScalarParamAllocator(kAVX512ParamRegConstraints);
+
 // This a bit undocumented and warrants and explanation. For x86_64, clang has
 // the option to split a created (not passed by reference) struct over the
 // following registers: RAX, RDX, RCX, XMM0, XMM1, ST0, ST1. The first 3 are
@@ -147,6 +156,7 @@ class X86_64_SysV : public CallingConvention {
 
   const std::vector<RegisterConstraint> &parameter_register_constraints;
   const std::vector<RegisterConstraint> &return_register_constraints;
+  const ScalarParameterAllocator &scalar_parameter_allocator;
 };
 
 std::unique_ptr<CallingConvention>
@@ -161,7 +171,10 @@ X86_64_SysV::X86_64_SysV(const remill::Arch *arch)
           kAVX512ParamRegConstraints)),
       return_register_constraints(SelectX86Constraint(
           arch->arch_name, kReturnRegConstraints, kAVXReturnRegConstraints,
-          kAVX512ReturnRegConstraints)) {}
+          kAVX512ReturnRegConstraints)),
+      scalar_parameter_allocator(SelectX86Constraint(
+          arch->arch_name, kScalarParamAllocator, kAVXScalarParamAllocator,
+          kAVX512ScalarParamAllocator)) {}
 
 // Allocates the elements of the function signature of func to memory or
 // registers. This includes parameters/arguments, return values, and the return
@@ -375,6 +388,15 @@ llvm::Error X86_64_SysV::BindParameters(
     std::vector<ParameterDecl> &parameter_declarations) {
 
   const auto param_names = TryRecoverParamNames(function);
+
+  // An injected return pointer takes up the first parameter register, which
+  // the scalar allocator doesn't know to skip.
+  if (!injected_sret &&
+      scalar_parameter_allocator.TryAllocate(arch, function, param_names,
+                                             parameter_declarations)) {
+    return llvm::Error::success();
+  }
+
   llvm::DataLayout dl(function.getParent());
 
   // Used to keep track of which registers have been allocated
@@ -0,0 +1,221 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "anvill/BinaryImage.h"
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/BinaryFormat/ELF.h>
+#include <llvm/Support/Endian.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include <system_error>
+
+#include "anvill/Program.h"
+
+namespace anvill {
+namespace {
+
+// Offsets of the fields of ELF file and program headers that we care about.
+struct ELFLayout {
+  uint64_t file_header_size;
+  uint64_t phoff_offset;
+  uint64_t phentsize_offset;
+  uint64_t phnum_offset;
+  uint64_t phdr_size;
+  uint64_t p_flags_offset;
+  uint64_t p_offset_offset;
+  uint64_t p_vaddr_offset;
+  uint64_t p_filesz_offset;
+  uint64_t p_memsz_offset;
+  bool is_64_bit;
+};
+
+static constexpr ELFLayout kELF32Layout = {52u, 28u, 42u, 44u, 32u, 24u,
+                                           4u,  8u,  16u, 20u, false};
+
+static constexpr ELFLayout kELF64Layout = {64u, 32u, 54u, 56u, 56u, 4u,
+                                           8u,  16u, 32u, 40u, true};
+
+// The number of program headers at and beyond which an ELF file keeps their
+// real number in its first section header.
+static constexpr uint64_t kELFExtendedNumbering = 0xffffu;
+
+static llvm::Error MalformedImage(const std::string &path, const char *what) {
+  return llvm::createStringError(
+      std::make_error_code(std::errc::invalid_argument),
+      "Malformed %s in executable file '%s'", what, path.c_str());
+}
+
+// Reads the fields of an ELF file, which are all native-sized integers of the
+// file's byte order, and either 32 or 64 bits wide for addresses and sizes.
+class ELFReader {
+ public:
+  ELFReader(llvm::StringRef file_, const ELFLayout &layout_,
+            llvm::support::endianness order_)
+      : file(file_),
+        layout(layout_),
+        order(order_) {}
+
+  template <typename T>
+  T Read(uint64_t offset) const {
+    return llvm::support::endian::read<T>(file.data() + offset, order);
+  }
+
+  // Read an address- or size-typed field.
+  uint64_t ReadWord(uint64_t offset) const {
+    if (layout.is_64_bit) {
+      return Read<uint64_t>(offset);
+    } else {
+      return Read<uint32_t>(offset);
+    }
+  }
+
+  const llvm::StringRef file;
+  const ELFLayout &layout;
+  const llvm::support::endianness order;
+};
+
+static llvm::Error ReadELFSegments(const std::string &path,
+                                   llvm::StringRef file,
+                                   std::vector<BinaryImage::Segment> &segments) {
+  const ELFLayout *layout = nullptr;
+  switch (file[llvm::ELF::EI_CLASS]) {
+    case llvm::ELF::ELFCLASS32: layout = &kELF32Layout; break;
+    case llvm::ELF::ELFCLASS64: layout = &kELF64Layout; break;
+    default: return MalformedImage(path, "ELF class");
+  }
+
+  llvm::support::endianness order;
+  switch (file[llvm::ELF::EI_DATA]) {
+    case llvm::ELF::ELFDATA2LSB: order = llvm::support::little; break;
+    case llvm::ELF::ELFDATA2MSB: order = llvm::support::big; break;
+    default: return MalformedImage(path, "ELF byte order");
+  }
+
+  if (file.size() < layout->file_header_size) {
+    return MalformedImage(path, "ELF header");
+  }
+
+  const ELFReader reader(file, *layout, order);
+  const auto phoff = reader.ReadWord(layout->phoff_offset);
+  const uint64_t phentsize = reader.Read<uint16_t>(layout->phentsize_offset);
+  const uint64_t phnum = reader.Read<uint16_t>(layout->phnum_offset);
+
+  // Nothing real has enough segments to need extended numbering, so we don't
+  // bother supporting it.
+  if (phnum >= kELFExtendedNumbering || (phnum && phentsize < layout->phdr_size) ||
+      phoff > file.size() || (phnum * phentsize) > (file.size() - phoff)) {
+    return MalformedImage(path, "ELF program header table");
+  }
+
+  for (auto i = 0u; i < phnum; ++i) {
+    const auto phdr = phoff + (i * phentsize);
+    if (reader.Read<uint32_t>(phdr) != llvm::ELF::PT_LOAD) {
+      continue;
+    }
+
+    BinaryImage::Segment seg;
+    seg.address = reader.ReadWord(phdr + layout->p_vaddr_offset);
+    seg.size = reader.ReadWord(phdr + layout->p_memsz_offset);
+    seg.file_offset = reader.ReadWord(phdr + layout->p_offset_offset);
+    seg.file_size = reader.ReadWord(phdr + layout->p_filesz_offset);
+
+    const auto flags = reader.Read<uint32_t>(phdr + layout->p_flags_offset);
+    seg.is_writeable = !!(flags & llvm::ELF::PF_W);
+    seg.is_executable = !!(flags & llvm::ELF::PF_X);
+
+    if (seg.file_size > seg.size || seg.file_offset > file.size() ||
+        seg.file_size > (file.size() - seg.file_offset) ||
+        seg.size > (~0ull - seg.address)) {
+      return MalformedImage(path, "ELF program header");
+    }
+
+    if (seg.size) {
+      segments.push_back(seg);
+    }
+  }
+
+  return llvm::Error::success();
+}
+
+}  // namespace
+
+// Read the segments of the executable file at `path`.
+llvm::Expected<BinaryImage> BinaryImage::Read(const std::string &path) {
+  uint64_t file_size = 0;
+  if (auto ec = llvm::sys::fs::file_size(path, file_size)) {
+    return llvm::createStringError(
+        ec, "Unable to read executable file '%s': %s", path.c_str(),
+        ec.message().c_str());
+  }
+
+  // `getFileSlice` will `mmap` large files, so only the pages holding the
+  // headers are ever touched here.
+  auto maybe_buff = llvm::MemoryBuffer::getFileSlice(path, file_size, 0);
+  if (!maybe_buff) {
+    const auto ec = maybe_buff.getError();
+    return llvm::createStringError(
+        ec, "Unable to read executable file '%s': %s", path.c_str(),
+        ec.message().c_str());
+  }
+
+  BinaryImage image;
+  image.path = path;
+
+  const llvm::StringRef file = maybe_buff.get()->getBuffer();
+  if (file.size() >= llvm::ELF::EI_NIDENT &&
+      file.startswith(llvm::ELF::ElfMagic)) {
+    if (auto err = ReadELFSegments(path, file, image.segments)) {
+      return err;
+    }
+    return image;
+  }
+
+  return llvm::createStringError(
+      std::make_error_code(std::errc::not_supported),
+      "File '%s' is not a supported executable file; only ELF files are "
+      "supported",
+      path.c_str());
+}
+
+// Map the segments of this image into `program`.
+llvm::Error BinaryImage::MapMemory(Program &program) const {
+  for (const auto &seg : segments) {
+    if (seg.file_size) {
+      if (auto err = program.MapFile(path, seg.file_offset, seg.address,
+                                     seg.file_size, seg.is_writeable,
+                                     seg.is_executable)) {
+        return err;
+      }
+    }
+
+    if (seg.size > seg.file_size) {
+      if (auto err = program.MapZeroRange(seg.address + seg.file_size,
+                                          seg.size - seg.file_size,
+                                          seg.is_writeable,
+                                          seg.is_executable)) {
+        return err;
+      }
+    }
+  }
+
+  return llvm::Error::success();
+}
+
+}  // namespace anvill
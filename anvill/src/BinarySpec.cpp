@@ -0,0 +1,894 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "anvill/BinarySpec.h"
+
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Support/Endian.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MathExtras.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <remill/Arch/Arch.h>
+
+#include <algorithm>
+#include <system_error>
+
+#include "anvill/Decl.h"
+#include "anvill/ITypeSpecification.h"
+#include "anvill/Program.h"
+
+namespace anvill {
+namespace {
+
+static constexpr char kMagic[8] = {'A', 'N', 'V', 'L', 'S', 'P', 'E', 'C'};
+static constexpr uint32_t kVersion = 1u;
+static constexpr uint32_t kNoString = ~0u;
+
+static constexpr uint64_t kHeaderSize = 16u;
+static constexpr uint64_t kSectionEntrySize = 24u;
+static constexpr uint64_t kRangeEntrySize = 32u;
+
+// Memory range data is page-aligned, so that ranges can be memory-mapped
+// exactly, without sharing pages with one another or with the metadata.
+static constexpr uint64_t kPageSize = 4096u;
+
+enum : uint32_t {
+  kRangeIsWriteable = 1u << 0u,
+  kRangeIsExecutable = 1u << 1u,
+  kRangeIsZeroFill = 1u << 2u,
+};
+
+enum : uint8_t {
+  kFunctionIsNoReturn = 1u << 0u,
+  kFunctionIsVariadic = 1u << 1u,
+};
+
+// Interns strings, assigning each unique string an index in the order in
+// which it was first seen.
+class StringTable {
+ public:
+  uint32_t Intern(llvm::StringRef str) {
+    if (str.empty()) {
+      return kNoString;
+    }
+    auto [it, added] =
+        ids.try_emplace(str, static_cast<uint32_t>(strings.size()));
+    if (added) {
+      strings.push_back(it->first());
+    }
+    return it->second;
+  }
+
+  llvm::StringMap<uint32_t> ids;
+  std::vector<llvm::StringRef> strings;
+};
+
+// Serializes little-endian integers and interned strings.
+class SpecWriter {
+ public:
+  explicit SpecWriter(StringTable &table_) : table(table_) {}
+
+  template <typename T>
+  void Write(T val) {
+    char bytes[sizeof(T)];
+    llvm::support::endian::write<T, llvm::support::little,
+                                 llvm::support::unaligned>(bytes, val);
+    data.append(bytes, sizeof(T));
+  }
+
+  void WriteBool(bool val) {
+    Write<uint8_t>(val ? 1u : 0u);
+  }
+
+  void WriteString(llvm::StringRef str) {
+    Write<uint32_t>(table.Intern(str));
+  }
+
+  void WriteCount(size_t count) {
+    Write<uint32_t>(static_cast<uint32_t>(count));
+  }
+
+  void WriteValue(const BinarySpec::Value &val) {
+    WriteString(val.type);
+    WriteString(val.reg);
+    WriteString(val.mem_reg);
+    Write<int64_t>(val.mem_offset);
+  }
+
+  StringTable &table;
+  std::string data;
+};
+
+// Deserializes little-endian integers and interned strings. All reads are
+// bounds-checked, and fail by returning `false`.
+class SpecReader {
+ public:
+  SpecReader(llvm::StringRef data_, const std::vector<std::string> &strings_)
+      : data(data_),
+        strings(strings_) {}
+
+  template <typename T>
+  bool Read(T &val) {
+    if ((data.size() - pos) < sizeof(T)) {
+      return false;
+    }
+    val = llvm::support::endian::read<T, llvm::support::little,
+                                      llvm::support::unaligned>(data.data() +
+                                                                pos);
+    pos += sizeof(T);
+    return true;
+  }
+
+  bool ReadBool(bool &val) {
+    uint8_t byte = 0;
+    if (!Read(byte) || byte > 1u) {
+      return false;
+    }
+    val = !!byte;
+    return true;
+  }
+
+  bool ReadString(llvm::StringRef &str) {
+    uint32_t id = 0;
+    if (!Read(id)) {
+      return false;
+    } else if (id == kNoString) {
+      str = llvm::StringRef();
+      return true;
+    } else if (id >= strings.size()) {
+      return false;
+    } else {
+      str = strings[id];
+      return true;
+    }
+  }
+
+  // Read the number of entries of an array whose entries are each at least
+  // `min_entry_size` bytes. This guards against allocating space for a
+  // bogus number of entries.
+  bool ReadCount(uint32_t &count, uint64_t min_entry_size) {
+    return Read(count) &&
+           (static_cast<uint64_t>(count) * min_entry_size) <=
+               (data.size() - pos);
+  }
+
+  bool ReadValue(BinarySpec::Value &val) {
+    return ReadString(val.type) && ReadString(val.reg) &&
+           ReadString(val.mem_reg) && Read(val.mem_offset);
+  }
+
+  bool AtEnd(void) const {
+    return pos == data.size();
+  }
+
+  llvm::StringRef data;
+  const std::vector<std::string> &strings;
+  size_t pos{0};
+};
+
+static void WriteFunction(SpecWriter &writer,
+                          const BinarySpec::Function &func) {
+  writer.Write<uint64_t>(func.address);
+  writer.WriteString(func.type);
+
+  writer.WriteCount(func.params.size());
+  for (const auto &param : func.params) {
+    writer.WriteValue(param);
+    writer.WriteString(param.name);
+  }
+
+  writer.WriteValue(func.return_address);
+  writer.WriteString(func.return_stack_pointer);
+  writer.Write<int64_t>(func.return_stack_pointer_offset);
+
+  writer.WriteCount(func.returns.size());
+  for (const auto &ret : func.returns) {
+    writer.WriteValue(ret);
+  }
+
+  uint8_t flags = 0u;
+  if (func.is_noreturn) {
+    flags |= kFunctionIsNoReturn;
+  }
+  if (func.is_variadic) {
+    flags |= kFunctionIsVariadic;
+  }
+  writer.Write<uint8_t>(flags);
+  writer.Write<uint32_t>(func.calling_convention);
+
+  writer.WriteCount(func.register_info.size());
+  for (const auto &reg : func.register_info) {
+    writer.Write<uint64_t>(reg.address);
+    writer.WriteString(reg.reg);
+    writer.WriteString(reg.type);
+    writer.WriteBool(reg.has_value);
+    writer.Write<uint64_t>(reg.value);
+  }
+}
+
+static bool ReadFunction(SpecReader &reader, BinarySpec::Function &func) {
+  uint32_t count = 0;
+  if (!reader.Read(func.address) || !reader.ReadString(func.type) ||
+      !reader.ReadCount(count, 24u)) {
+    return false;
+  }
+
+  func.params.resize(count);
+  for (auto &param : func.params) {
+    if (!reader.ReadValue(param) || !reader.ReadString(param.name)) {
+      return false;
+    }
+  }
+
+  if (!reader.ReadValue(func.return_address) ||
+      !reader.ReadString(func.return_stack_pointer) ||
+      !reader.Read(func.return_stack_pointer_offset) ||
+      !reader.ReadCount(count, 20u)) {
+    return false;
+  }
+
+  func.returns.resize(count);
+  for (auto &ret : func.returns) {
+    if (!reader.ReadValue(ret)) {
+      return false;
+    }
+  }
+
+  uint8_t flags = 0u;
+  if (!reader.Read(flags) || !reader.Read(func.calling_convention) ||
+      !reader.ReadCount(count, 25u)) {
+    return false;
+  }
+
+  func.is_noreturn = !!(flags & kFunctionIsNoReturn);
+  func.is_variadic = !!(flags & kFunctionIsVariadic);
+
+  func.register_info.resize(count);
+  for (auto &reg : func.register_info) {
+    if (!reader.Read(reg.address) || !reader.ReadString(reg.reg) ||
+        !reader.ReadString(reg.type) || !reader.ReadBool(reg.has_value) ||
+        !reader.Read(reg.value)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static bool ReadTarget(SpecReader &reader, BinarySpec &spec) {
+  llvm::StringRef arch, os;
+  if (!reader.ReadString(arch) || !reader.ReadString(os)) {
+    return false;
+  }
+  spec.arch = arch.str();
+  spec.os = os.str();
+  return true;
+}
+
+static bool ReadMemory(SpecReader &reader, uint64_t file_size,
+                       BinarySpec &spec) {
+  uint32_t count = 0;
+  if (!reader.ReadCount(count, kRangeEntrySize)) {
+    return false;
+  }
+
+  spec.memory.resize(count);
+  for (auto &range : spec.memory) {
+    uint32_t flags = 0u;
+    uint32_t padding = 0u;
+    if (!reader.Read(range.address) || !reader.Read(range.size) ||
+        !reader.Read(range.file_offset) || !reader.Read(flags) ||
+        !reader.Read(padding)) {
+      return false;
+    }
+
+    range.is_writeable = !!(flags & kRangeIsWriteable);
+    range.is_executable = !!(flags & kRangeIsExecutable);
+    range.is_zero_fill = !!(flags & kRangeIsZeroFill);
+
+    if (!range.is_zero_fill &&
+        (range.file_offset > file_size ||
+         range.size > (file_size - range.file_offset))) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static bool ReadVariables(SpecReader &reader, BinarySpec &spec) {
+  uint32_t count = 0;
+  if (!reader.ReadCount(count, 12u)) {
+    return false;
+  }
+
+  spec.variables.resize(count);
+  for (auto &var : spec.variables) {
+    if (!reader.Read(var.address) || !reader.ReadString(var.type)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool ReadFunctions(SpecReader &reader, BinarySpec &spec) {
+  uint32_t count = 0;
+  if (!reader.ReadCount(count, 12u)) {
+    return false;
+  }
+
+  spec.functions.resize(count);
+  for (auto &func : spec.functions) {
+    if (!ReadFunction(reader, func)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool ReadControlFlowRedirections(SpecReader &reader, BinarySpec &spec) {
+  uint32_t count = 0;
+  if (!reader.ReadCount(count, 16u)) {
+    return false;
+  }
+
+  spec.control_flow_redirections.resize(count);
+  for (auto &[source, dest] : spec.control_flow_redirections) {
+    if (!reader.Read(source) || !reader.Read(dest)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool ReadControlFlowTargets(SpecReader &reader, BinarySpec &spec) {
+  uint32_t count = 0;
+  if (!reader.ReadCount(count, 13u)) {
+    return false;
+  }
+
+  spec.control_flow_targets.resize(count);
+  for (auto &targets : spec.control_flow_targets) {
+    uint32_t num_dests = 0;
+    if (!reader.Read(targets.source) || !reader.ReadBool(targets.complete) ||
+        !reader.ReadCount(num_dests, 8u)) {
+      return false;
+    }
+
+    targets.destinations.resize(num_dests);
+    for (auto &dest : targets.destinations) {
+      if (!reader.Read(dest)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+static bool ReadSymbols(SpecReader &reader, BinarySpec &spec) {
+  uint32_t count = 0;
+  if (!reader.ReadCount(count, 12u)) {
+    return false;
+  }
+
+  spec.symbols.resize(count);
+  for (auto &sym : spec.symbols) {
+    if (!reader.Read(sym.address) || !reader.ReadString(sym.name)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Interns the strings of a snapshot while its records are built. The records
+// first refer to the keys of `ids`, and are rebound to the strings of the
+// snapshot once those are all known, as the strings of a spec can't move.
+class SnapshotStrings {
+ public:
+  llvm::StringRef Intern(llvm::StringRef str) {
+    if (str.empty()) {
+      return {};
+    }
+    return ids.try_emplace(str, static_cast<uint32_t>(ids.size()))
+        .first->first();
+  }
+
+  llvm::StringRef Intern(const llvm::Type *type,
+                         const llvm::DataLayout &layout) {
+    return type ? Intern(ITypeSpecification::TypeToString(*type, layout))
+                : llvm::StringRef();
+  }
+
+  llvm::StringRef Intern(const remill::Register *reg) {
+    return reg ? Intern(reg->name) : llvm::StringRef();
+  }
+
+  void Rebind(llvm::StringRef &str,
+              const std::vector<std::string> &strings) const {
+    if (!str.empty()) {
+      str = strings[ids.find(str)->second];
+    }
+  }
+
+  void Rebind(BinarySpec::Value &val,
+              const std::vector<std::string> &strings) const {
+    Rebind(val.type, strings);
+    Rebind(val.reg, strings);
+    Rebind(val.mem_reg, strings);
+  }
+
+  llvm::StringMap<uint32_t> ids;
+};
+
+static void SnapshotValue(const ValueDecl &decl, BinarySpec::Value &val,
+                          SnapshotStrings &strings,
+                          const llvm::DataLayout &layout) {
+  val.type = strings.Intern(decl.type, layout);
+  val.reg = strings.Intern(decl.reg);
+  val.mem_reg = strings.Intern(decl.mem_reg);
+  val.mem_offset = decl.mem_offset;
+}
+
+static void SnapshotFunction(const FunctionDecl &decl,
+                             BinarySpec::Function &func,
+                             SnapshotStrings &strings,
+                             const llvm::DataLayout &layout) {
+  func.address = decl.address;
+  for (const auto &param_decl : decl.params) {
+    auto &param = func.params.emplace_back();
+    SnapshotValue(param_decl, param, strings, layout);
+    param.name = strings.Intern(param_decl.name);
+  }
+  SnapshotValue(decl.return_address, func.return_address, strings, layout);
+  func.return_stack_pointer = strings.Intern(decl.return_stack_pointer);
+  func.return_stack_pointer_offset = decl.return_stack_pointer_offset;
+  for (const auto &ret_decl : decl.returns) {
+    SnapshotValue(ret_decl, func.returns.emplace_back(), strings, layout);
+  }
+  func.is_noreturn = decl.is_noreturn;
+  func.is_variadic = decl.is_variadic;
+  func.calling_convention = static_cast<uint32_t>(decl.calling_convention);
+  for (const auto &reg_decl : decl.reg_info) {
+    auto &reg = func.register_info.emplace_back();
+    reg.address = reg_decl.address;
+    reg.reg = strings.Intern(reg_decl.reg);
+    reg.type = strings.Intern(reg_decl.type, layout);
+    reg.has_value = reg_decl.value.has_value();
+    reg.value = reg_decl.value.value_or(0u);
+  }
+}
+
+static llvm::Error MalformedSpec(const std::string &path, const char *what) {
+  return llvm::createStringError(
+      std::make_error_code(std::errc::illegal_byte_sequence),
+      "Malformed %s in binary spec file '%s'", what, path.c_str());
+}
+
+}  // namespace
+
+// Read the binary spec at `path`.
+llvm::Expected<BinarySpec> BinarySpec::Read(const std::string &path) {
+  uint64_t file_size = 0;
+  if (auto ec = llvm::sys::fs::file_size(path, file_size)) {
+    return llvm::createStringError(ec, "Unable to read binary spec file '%s': %s",
+                                   path.c_str(), ec.message().c_str());
+  }
+
+  if (file_size < kHeaderSize) {
+    return MalformedSpec(path, "header");
+  }
+
+  // `getFileSlice` will `mmap` large files, so the pages holding the bytes of
+  // memory ranges are never touched here.
+  auto maybe_buff = llvm::MemoryBuffer::getFileSlice(path, file_size, 0);
+  if (!maybe_buff) {
+    const auto ec = maybe_buff.getError();
+    return llvm::createStringError(ec, "Unable to read binary spec file '%s': %s",
+                                   path.c_str(), ec.message().c_str());
+  }
+
+  const llvm::StringRef file = maybe_buff.get()->getBuffer();
+  if (!file.startswith(llvm::StringRef(kMagic, sizeof(kMagic)))) {
+    return llvm::createStringError(
+        std::make_error_code(std::errc::invalid_argument),
+        "File '%s' is not a binary spec file", path.c_str());
+  }
+
+  BinarySpec spec;
+  spec.path = path;
+
+  SpecReader header(file.substr(sizeof(kMagic)), spec.strings);
+  uint32_t version = 0;
+  uint32_t num_sections = 0;
+  if (!header.Read(version) || !header.ReadCount(num_sections,
+                                                 kSectionEntrySize)) {
+    return MalformedSpec(path, "header");
+  }
+
+  if (version != kVersion) {
+    return llvm::createStringError(
+        std::make_error_code(std::errc::not_supported),
+        "Unsupported version %u of binary spec file '%s'", version,
+        path.c_str());
+  }
+
+  std::vector<std::pair<uint32_t, llvm::StringRef>> sections;
+  sections.reserve(num_sections);
+  for (auto i = 0u; i < num_sections; ++i) {
+    uint32_t kind = 0;
+    uint32_t padding = 0;
+    uint64_t offset = 0;
+    uint64_t size = 0;
+    if (!header.Read(kind) || !header.Read(padding) || !header.Read(offset) ||
+        !header.Read(size) || offset > file_size ||
+        size > (file_size - offset)) {
+      return MalformedSpec(path, "section table");
+    }
+    sections.emplace_back(kind, file.substr(offset, size));
+  }
+
+  // The string table must be read first, as everything else refers to it.
+  for (auto [kind, data] : sections) {
+    if (kind != kStrings) {
+      continue;
+    }
+
+    SpecReader reader(data, spec.strings);
+    uint32_t count = 0;
+    if (!reader.ReadCount(count, 4u)) {
+      return MalformedSpec(path, "string table");
+    }
+
+    spec.strings.reserve(count);
+    for (auto i = 0u; i < count; ++i) {
+      uint32_t size = 0;
+      if (!reader.Read(size) || size > (data.size() - reader.pos)) {
+        return MalformedSpec(path, "string table");
+      }
+      spec.strings.emplace_back(data.substr(reader.pos, size).str());
+      reader.pos += size;
+    }
+  }
+
+  for (auto [kind, data] : sections) {
+    SpecReader reader(data, spec.strings);
+    bool ok = true;
+    const char *what = "";
+    switch (kind) {
+      case kStrings: continue;
+      case kTarget:
+        ok = ReadTarget(reader, spec);
+        what = "target section";
+        break;
+      case kMemory:
+        ok = ReadMemory(reader, file_size, spec);
+        what = "memory section";
+        break;
+      case kFunctions:
+        ok = ReadFunctions(reader, spec);
+        what = "functions section";
+        break;
+      case kVariables:
+        ok = ReadVariables(reader, spec);
+        what = "variables section";
+        break;
+      case kControlFlowRedirections:
+        ok = ReadControlFlowRedirections(reader, spec);
+        what = "control flow redirections section";
+        break;
+      case kControlFlowTargets:
+        ok = ReadControlFlowTargets(reader, spec);
+        what = "control flow targets section";
+        break;
+      case kSymbols:
+        ok = ReadSymbols(reader, spec);
+        what = "symbols section";
+        break;
+
+      // Unknown sections are skipped, so that newer writers can add sections
+      // without breaking older readers.
+      default: continue;
+    }
+
+    if (!ok || !reader.AtEnd()) {
+      return MalformedSpec(path, what);
+    }
+  }
+
+  return spec;
+}
+
+// Write this spec to the file at `path`.
+llvm::Error BinarySpec::Write(const std::string &path_) const {
+  StringTable table;
+  std::vector<std::pair<uint32_t, std::string>> sections;
+
+  auto add_section = [&](SectionKind kind, SpecWriter &writer) {
+    sections.emplace_back(kind, std::move(writer.data));
+  };
+
+  SpecWriter target(table);
+  target.WriteString(arch);
+  target.WriteString(os);
+  add_section(kTarget, target);
+
+  SpecWriter funcs(table);
+  funcs.WriteCount(functions.size());
+  for (const auto &func : functions) {
+    WriteFunction(funcs, func);
+  }
+  add_section(kFunctions, funcs);
+
+  SpecWriter vars(table);
+  vars.WriteCount(variables.size());
+  for (const auto &var : variables) {
+    vars.Write<uint64_t>(var.address);
+    vars.WriteString(var.type);
+  }
+  add_section(kVariables, vars);
+
+  SpecWriter redirections(table);
+  redirections.WriteCount(control_flow_redirections.size());
+  for (auto [source, dest] : control_flow_redirections) {
+    redirections.Write<uint64_t>(source);
+    redirections.Write<uint64_t>(dest);
+  }
+  add_section(kControlFlowRedirections, redirections);
+
+  SpecWriter targets(table);
+  targets.WriteCount(control_flow_targets.size());
+  for (const auto &entry : control_flow_targets) {
+    targets.Write<uint64_t>(entry.source);
+    targets.WriteBool(entry.complete);
+    targets.WriteCount(entry.destinations.size());
+    for (auto dest : entry.destinations) {
+      targets.Write<uint64_t>(dest);
+    }
+  }
+  add_section(kControlFlowTargets, targets);
+
+  SpecWriter syms(table);
+  syms.WriteCount(symbols.size());
+  for (const auto &sym : symbols) {
+    syms.Write<uint64_t>(sym.address);
+    syms.WriteString(sym.name);
+  }
+  add_section(kSymbols, syms);
+
+  // Everything has now been interned, so the string table is complete.
+  SpecWriter strs(table);
+  strs.WriteCount(table.strings.size());
+  for (auto str : table.strings) {
+    strs.WriteCount(str.size());
+    strs.data.append(str.data(), str.size());
+  }
+  add_section(kStrings, strs);
+
+  // The memory section is laid out last, as it records the file offsets of
+  // the range data, which follows all of the sections.
+  const auto num_sections = sections.size() + 1u;
+  auto metadata_size = kHeaderSize + (num_sections * kSectionEntrySize) +
+                       4u + (memory.size() * kRangeEntrySize);
+  for (const auto &[kind, data] : sections) {
+    metadata_size += data.size();
+  }
+
+  SpecWriter mem(table);
+  mem.WriteCount(memory.size());
+  auto data_offset = llvm::alignTo(metadata_size, kPageSize);
+  for (const auto &range : memory) {
+    uint32_t flags = 0u;
+    if (range.is_writeable) {
+      flags |= kRangeIsWriteable;
+    }
+    if (range.is_executable) {
+      flags |= kRangeIsExecutable;
+    }
+    mem.Write<uint64_t>(range.address);
+    if (range.is_zero_fill) {
+      mem.Write<uint64_t>(range.size);
+      mem.Write<uint64_t>(0u);
+      mem.Write<uint32_t>(flags | kRangeIsZeroFill);
+      mem.Write<uint32_t>(0u);
+      continue;
+    }
+    mem.Write<uint64_t>(range.data.size());
+    mem.Write<uint64_t>(data_offset);
+    mem.Write<uint32_t>(flags);
+    mem.Write<uint32_t>(0u);
+    data_offset = llvm::alignTo(data_offset + range.data.size(), kPageSize);
+  }
+  add_section(kMemory, mem);
+
+  std::error_code ec;
+  llvm::raw_fd_ostream os_(path_, ec, llvm::sys::fs::OF_None);
+  if (ec) {
+    return llvm::createStringError(
+        ec, "Unable to open binary spec file '%s' for writing: %s",
+        path_.c_str(), ec.message().c_str());
+  }
+
+  SpecWriter header(table);
+  header.data.append(kMagic, sizeof(kMagic));
+  header.Write<uint32_t>(kVersion);
+  header.WriteCount(sections.size());
+
+  uint64_t offset = kHeaderSize + (sections.size() * kSectionEntrySize);
+  for (const auto &[kind, data] : sections) {
+    header.Write<uint32_t>(kind);
+    header.Write<uint32_t>(0u);
+    header.Write<uint64_t>(offset);
+    header.Write<uint64_t>(data.size());
+    offset += data.size();
+  }
+
+  os_ << header.data;
+  for (const auto &[kind, data] : sections) {
+    os_ << data;
+  }
+
+  for (const auto &range : memory) {
+    if (range.is_zero_fill) {
+      continue;
+    }
+    os_.write_zeros(llvm::alignTo(offset, kPageSize) - offset);
+    offset = llvm::alignTo(offset, kPageSize);
+    os_.write(reinterpret_cast<const char *>(range.data.data()),
+              range.data.size());
+    offset += range.data.size();
+  }
+
+  os_.close();
+  if (os_.has_error()) {
+    ec = os_.error();
+    os_.clear_error();
+    return llvm::createStringError(
+        ec, "Unable to write binary spec file '%s': %s", path_.c_str(),
+        ec.message().c_str());
+  }
+
+  return llvm::Error::success();
+}
+
+// Capture everything that has been built up in `program` as a spec.
+BinarySpec BinarySpec::Snapshot(const Program &program,
+                                const llvm::DataLayout &layout) {
+  BinarySpec spec;
+  SnapshotStrings strings;
+
+  program.ForEachMappedRange([&](const ByteSequence &bytes, bool is_zero_fill) {
+    auto &range = spec.memory.emplace_back();
+    const auto first_byte = bytes[bytes.Address()];
+    range.address = bytes.Address();
+    range.size = bytes.Size();
+    range.is_writeable = first_byte.IsWriteable();
+    range.is_executable = first_byte.IsExecutable();
+    range.is_zero_fill = is_zero_fill;
+    if (!is_zero_fill) {
+      const auto data = bytes.ToString();
+      range.data.assign(data.begin(), data.end());
+    }
+    return true;
+  });
+
+  program.ForEachFunction([&](const FunctionDecl *decl) {
+    SnapshotFunction(*decl, spec.functions.emplace_back(), strings, layout);
+    return true;
+  });
+
+  program.ForEachVariable([&](const GlobalVarDecl *decl) {
+    auto &var = spec.variables.emplace_back();
+    var.address = decl->address;
+    var.type = strings.Intern(decl->type, layout);
+    return true;
+  });
+
+  program.ForEachControlFlowRedirection([&](uint64_t from, uint64_t to) {
+    spec.control_flow_redirections.emplace_back(from, to);
+    return true;
+  });
+  std::sort(spec.control_flow_redirections.begin(),
+            spec.control_flow_redirections.end());
+
+  program.ForEachControlFlowTargets([&](const ControlFlowTargetList &list) {
+    auto &targets = spec.control_flow_targets.emplace_back();
+    targets.source = list.source;
+    targets.complete = list.complete;
+    targets.destinations = list.destination_list;
+    return true;
+  });
+  std::sort(spec.control_flow_targets.begin(), spec.control_flow_targets.end(),
+            [](const ControlFlowTargets &a, const ControlFlowTargets &b) {
+              return a.source < b.source;
+            });
+
+  program.ForEachNamedAddress([&](uint64_t ea, const std::string &name,
+                                  const FunctionDecl *, const GlobalVarDecl *) {
+    auto &sym = spec.symbols.emplace_back();
+    sym.address = ea;
+    sym.name = strings.Intern(name);
+    return true;
+  });
+
+  // Now that every string is known, move them into the snapshot, and point
+  // the records at them.
+  spec.strings.resize(strings.ids.size());
+  for (const auto &entry : strings.ids) {
+    spec.strings[entry.second] = entry.first().str();
+  }
+
+  for (auto &func : spec.functions) {
+    for (auto &param : func.params) {
+      strings.Rebind(param, spec.strings);
+      strings.Rebind(param.name, spec.strings);
+    }
+    strings.Rebind(func.return_address, spec.strings);
+    strings.Rebind(func.return_stack_pointer, spec.strings);
+    for (auto &ret : func.returns) {
+      strings.Rebind(ret, spec.strings);
+    }
+    for (auto &reg : func.register_info) {
+      strings.Rebind(reg.reg, spec.strings);
+      strings.Rebind(reg.type, spec.strings);
+    }
+  }
+  for (auto &var : spec.variables) {
+    strings.Rebind(var.type, spec.strings);
+  }
+  for (auto &sym : spec.symbols) {
+    strings.Rebind(sym.name, spec.strings);
+  }
+
+  return spec;
+}
+
+// Map the memory ranges of a spec returned by `Read` into `program`.
+llvm::Error BinarySpec::MapMemory(Program &program) const {
+  for (const auto &range : memory) {
+    if (range.is_zero_fill) {
+      if (auto err = program.MapZeroRange(range.address, range.size,
+                                          range.is_writeable,
+                                          range.is_executable)) {
+        return err;
+      }
+
+    // The range was added by hand, rather than being read from a file.
+    } else if (!range.data.empty()) {
+      ByteRange bytes;
+      bytes.address = range.address;
+      bytes.begin = range.data.data();
+      bytes.end = bytes.begin + range.data.size();
+      bytes.is_writeable = range.is_writeable;
+      bytes.is_executable = range.is_executable;
+      if (auto err = program.MapRange(bytes)) {
+        return err;
+      }
+
+    } else if (auto err = program.MapFile(path, range.file_offset,
+                                          range.address, range.size,
+                                          range.is_writeable,
+                                          range.is_executable)) {
+      return err;
+    }
+  }
+
+  return llvm::Error::success();
+}
+
+}  // namespace anvill
@@ -0,0 +1,573 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "anvill/CompressedFunctions.h"
+
+#include <anvill/Counters.h>
+#include <anvill/Util.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DebugInfo.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/GVMaterializer.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Metadata.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/TypeFinder.h>
+#include <llvm/Linker/IRMover.h>
+#include <llvm/Support/Compression.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+#include <remill/BC/Util.h>
+
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace anvill {
+namespace {
+
+// Suffix given to a compressed function while it's linked back into its
+// module, so that linking doesn't replace the function whose body it will
+// become.
+static constexpr const char *kCompressedFunctionSuffix = ".anvill.compressed";
+
+// Compressed functions are compressed once and decompressed once, so favor
+// speed over size.
+#if LLVM_VERSION_MAJOR >= 15
+static constexpr int kCompressionLevel =
+    llvm::compression::zlib::BestSpeedCompression;
+#else
+static constexpr int kCompressionLevel = llvm::zlib::BestSpeedCompression;
+#endif
+
+// Compress `bitcode` into `compressed`. Returns `false` if it wasn't
+// compressed, e.g. because LLVM was built without zlib.
+static bool Compress(llvm::StringRef bitcode,
+                     llvm::SmallVectorImpl<char> &compressed) {
+#if LLVM_VERSION_MAJOR >= 15
+  if (!llvm::compression::zlib::isAvailable()) {
+    return false;
+  }
+  llvm::SmallVector<uint8_t, 0> bytes;
+  llvm::compression::zlib::compress(llvm::arrayRefFromStringRef(bitcode),
+                                    bytes, kCompressionLevel);
+  compressed.assign(bytes.begin(), bytes.end());
+  return true;
+#else
+  if (!llvm::zlib::isAvailable()) {
+    return false;
+  }
+  if (auto err = llvm::zlib::compress(bitcode, compressed, kCompressionLevel)) {
+    llvm::consumeError(std::move(err));
+    return false;
+  }
+  return true;
+#endif
+}
+
+// Decompress `compressed` into `bitcode`, which is `size` bytes long.
+static llvm::Error Decompress(llvm::StringRef compressed,
+                              llvm::SmallVectorImpl<char> &bitcode,
+                              size_t size) {
+#if LLVM_VERSION_MAJOR >= 15
+  llvm::SmallVector<uint8_t, 0> bytes;
+  if (auto err = llvm::compression::zlib::decompress(
+          llvm::arrayRefFromStringRef(compressed), bytes, size)) {
+    return err;
+  }
+  bitcode.assign(bytes.begin(), bytes.end());
+  return llvm::Error::success();
+#else
+  return llvm::zlib::uncompress(compressed, bitcode, size);
+#endif
+}
+
+// Adds the functions and variables that `func` refers to, by way of its
+// instructions, its attached metadata, or its personality, prefix, or
+// prologue, to `gvs`.
+static void CollectReferencedGlobals(
+    llvm::Function &func, llvm::SmallPtrSetImpl<llvm::GlobalValue *> &gvs) {
+  llvm::SmallPtrSet<const llvm::Value *, 32> seen_values;
+  llvm::SmallPtrSet<const llvm::Metadata *, 32> seen_mds;
+  std::vector<const llvm::Value *> values;
+  std::vector<const llvm::Metadata *> mds;
+
+  auto add_value = [&](const llvm::Value *val) {
+    if (llvm::isa<llvm::Constant>(val) && seen_values.insert(val).second) {
+      values.push_back(val);
+    } else if (auto md_val = llvm::dyn_cast<llvm::MetadataAsValue>(val);
+               md_val && seen_mds.insert(md_val->getMetadata()).second) {
+      mds.push_back(md_val->getMetadata());
+    }
+  };
+
+  auto add_mds = [&](const auto &attached) {
+    for (auto [kind, md] : attached) {
+      if (seen_mds.insert(md).second) {
+        mds.push_back(md);
+      }
+    }
+  };
+
+  llvm::SmallVector<std::pair<unsigned, llvm::MDNode *>, 4> attached;
+  for (auto &inst : llvm::instructions(func)) {
+    for (auto &op : inst.operands()) {
+      add_value(op.get());
+    }
+    attached.clear();
+    inst.getAllMetadata(attached);
+    add_mds(attached);
+  }
+
+  attached.clear();
+  func.getAllMetadata(attached);
+  add_mds(attached);
+
+  if (func.hasPersonalityFn()) {
+    add_value(func.getPersonalityFn());
+  }
+  if (func.hasPrefixData()) {
+    add_value(func.getPrefixData());
+  }
+  if (func.hasPrologueData()) {
+    add_value(func.getPrologueData());
+  }
+
+  while (!values.empty() || !mds.empty()) {
+    if (!mds.empty()) {
+      const auto md = mds.back();
+      mds.pop_back();
+      if (auto val_md = llvm::dyn_cast<llvm::ValueAsMetadata>(md)) {
+        add_value(val_md->getValue());
+      } else if (auto node = llvm::dyn_cast<llvm::MDNode>(md)) {
+        for (auto &op : node->operands()) {
+          if (op && seen_mds.insert(op.get()).second) {
+            mds.push_back(op.get());
+          }
+        }
+      }
+      continue;
+    }
+
+    const auto val = values.back();
+    values.pop_back();
+    if (auto gv = llvm::dyn_cast<llvm::GlobalValue>(val)) {
+      gvs.insert(const_cast<llvm::GlobalValue *>(gv));
+    } else if (auto user = llvm::dyn_cast<llvm::User>(val)) {
+      for (auto &op : user->operands()) {
+        add_value(op.get());
+      }
+    }
+  }
+}
+
+}  // namespace
+
+// The compressed bitcode of one function.
+struct CompressedFunction {
+  llvm::SmallVector<char, 0> data;
+
+  // Size of the uncompressed bitcode, or zero if `data` isn't compressed.
+  size_t bitcode_size{0u};
+};
+
+class CompressedFunctionsImpl
+    : public std::enable_shared_from_this<CompressedFunctionsImpl> {
+ public:
+  explicit CompressedFunctionsImpl(llvm::Module &module_) : module(module_) {}
+
+  bool Compress(llvm::Function &func);
+
+  // Materialize `func`, if it's compressed.
+  llvm::Error Materialize(llvm::Function *func);
+
+  // Materialize every compressed function.
+  llvm::Error MaterializeAll(void);
+
+  // Returns the identified struct types of the module, including the ones
+  // that only compressed functions use.
+  std::vector<llvm::StructType *> IdentifiedStructTypes(void) const;
+
+  // Install a materializer of the module that materializes compressed
+  // functions.
+  void InstallMaterializer(void);
+
+  // Link the compressed functions of `funcs` back into the module.
+  llvm::Error LinkAll(const std::vector<llvm::Function *> &funcs);
+
+  llvm::Module &module;
+
+  // The materializer of `module` installed by `InstallMaterializer`, if it's
+  // still installed.
+  llvm::GVMaterializer *materializer{nullptr};
+
+  // Compressed functions that get deleted, e.g. by `OptimizeModule` because
+  // nothing refers to them, leave behind stale entries, so only materializable
+  // functions of `module` are looked up.
+  std::unordered_map<llvm::Function *, CompressedFunction> functions;
+
+  // Struct types used by compressed functions, which the linker should map
+  // the struct types of the decompressed bitcode back to.
+  std::unordered_set<llvm::StructType *> struct_types;
+  std::vector<llvm::StructType *> struct_type_list;
+
+  uint64_t num_compressed_bytes{0u};
+  uint64_t num_bitcode_bytes{0u};
+
+ private:
+  // Link the compressed function of `func`, held in `compressed`, back into
+  // the module using `mover`.
+  llvm::Error Link(llvm::Function *func, const CompressedFunction &compressed,
+                   llvm::IRMover &mover);
+};
+
+namespace {
+
+// Materializes the compressed functions of a module as they're needed.
+class Materializer final : public llvm::GVMaterializer {
+ public:
+  explicit Materializer(std::shared_ptr<CompressedFunctionsImpl> impl_)
+      : impl(std::move(impl_)) {}
+
+  ~Materializer(void) final {
+    if (impl->materializer == this) {
+      impl->materializer = nullptr;
+    }
+  }
+
+  llvm::Error materialize(llvm::GlobalValue *gv) final {
+    if (auto func = llvm::dyn_cast<llvm::Function>(gv)) {
+      return impl->Materialize(func);
+    }
+    return llvm::Error::success();
+  }
+
+  // The module has already let go of this materializer by the time this is
+  // called.
+  llvm::Error materializeModule(void) final {
+    return impl->MaterializeAll();
+  }
+
+  llvm::Error materializeMetadata(void) final {
+    return llvm::Error::success();
+  }
+
+  void setStripDebugInfo(void) final {}
+
+  std::vector<llvm::StructType *> getIdentifiedStructTypes(void) const final {
+    return impl->IdentifiedStructTypes();
+  }
+
+ private:
+  const std::shared_ptr<CompressedFunctionsImpl> impl;
+};
+
+}  // namespace
+
+void CompressedFunctionsImpl::InstallMaterializer(void) {
+  materializer = new Materializer(shared_from_this());
+  module.setMaterializer(materializer);
+}
+
+bool CompressedFunctionsImpl::Compress(llvm::Function &func) {
+  if (func.getParent() != &module || func.isDeclaration() ||
+      func.isMaterializable() || !func.hasName() ||
+      (!materializer && module.getMaterializer())) {
+    return false;
+  }
+
+  // Decompressed functions are linked back in by name, which doesn't work
+  // for anything that has local linkage, or that has no name.
+  llvm::SmallPtrSet<llvm::GlobalValue *, 32> gvs;
+  CollectReferencedGlobals(func, gvs);
+  for (auto gv : gvs) {
+    if (gv != &func && (gv->hasLocalLinkage() || !gv->hasName())) {
+      return false;
+    }
+  }
+
+  llvm::Module func_module(func.getName(), module.getContext());
+  func_module.setDataLayout(module.getDataLayout());
+  func_module.setTargetTriple(module.getTargetTriple());
+
+  auto compressed_func =
+      llvm::Function::Create(func.getFunctionType(),
+                             llvm::GlobalValue::ExternalLinkage,
+                             func.getName(), &func_module);
+  remill::CloneFunctionInto(&func, compressed_func);
+
+  // Debug info only survives the trip through bitcode if its version is
+  // known. Cloning can leave an empty list of compile units behind, which
+  // would otherwise be stripped, with a warning, when it's read back.
+  if (auto version = llvm::getDebugMetadataVersionFromModule(module)) {
+    func_module.addModuleFlag(llvm::Module::Warning, "Debug Info Version",
+                              version);
+  }
+  if (auto cus = func_module.getNamedMetadata("llvm.dbg.cu");
+      cus && !cus->getNumOperands()) {
+    cus->eraseFromParent();
+  }
+
+  llvm::TypeFinder types;
+  types.run(func_module, false);
+  for (auto type : types) {
+    if (!type->isLiteral() && !type->isOpaque() &&
+        struct_types.insert(type).second) {
+      struct_type_list.push_back(type);
+    }
+  }
+
+  llvm::SmallVector<char, 0> bitcode;
+  llvm::raw_svector_ostream os(bitcode);
+  llvm::WriteBitcodeToFile(func_module, os);
+
+  CompressedFunction compressed;
+  if (anvill::Compress(llvm::StringRef(bitcode.data(), bitcode.size()),
+                       compressed.data)) {
+    compressed.bitcode_size = bitcode.size();
+  } else {
+    compressed.data = std::move(bitcode);
+  }
+
+  num_compressed_bytes += compressed.data.size();
+  num_bitcode_bytes += compressed.bitcode_size ? compressed.bitcode_size
+                                               : compressed.data.size();
+  functions[&func] = std::move(compressed);
+
+  // `deleteBody` also makes `func` external, and drops its personality and
+  // metadata; these come back with the body.
+  const auto linkage = func.getLinkage();
+  func.deleteBody();
+  func.setLinkage(linkage);
+  func.setIsMaterializable(true);
+
+  if (!materializer) {
+    InstallMaterializer();
+  }
+
+  IncrementCounter(Counter::kFunctionsCompressed);
+  return true;
+}
+
+llvm::Error CompressedFunctionsImpl::Link(llvm::Function *func,
+                                          const CompressedFunction &compressed,
+                                          llvm::IRMover &mover) {
+  llvm::StringRef bitcode(compressed.data.data(), compressed.data.size());
+  llvm::SmallVector<char, 0> decompressed;
+  if (compressed.bitcode_size) {
+    if (auto err = Decompress(bitcode, decompressed, compressed.bitcode_size)) {
+      return err;
+    }
+    bitcode = llvm::StringRef(decompressed.data(), decompressed.size());
+  }
+
+  auto maybe_func_module = llvm::parseBitcodeFile(
+      llvm::MemoryBufferRef(bitcode, func->getName()), module.getContext());
+  if (!maybe_func_module) {
+    return maybe_func_module.takeError();
+  }
+
+  auto &func_module = *maybe_func_module;
+  const auto linked_name = func->getName().str() + kCompressedFunctionSuffix;
+  auto compressed_func = func_module->getFunction(func->getName());
+  if (!compressed_func || compressed_func->isDeclaration()) {
+    return llvm::createStringError(
+        std::make_error_code(std::errc::invalid_argument),
+        "Compressed module of function '%s' doesn't define it",
+        func->getName().str().c_str());
+  }
+  compressed_func->setName(linked_name);
+
+  // Only the function is moved into the module; everything that it refers to
+  // binds to what's already in the module by name.
+  llvm::GlobalValue *to_link[] = {compressed_func};
+  if (auto err = mover.move(
+          std::move(func_module), to_link,
+          [](llvm::GlobalValue &, llvm::IRMover::ValueAdder) {}, false)) {
+    return err;
+  }
+
+  const auto linked_func = module.getFunction(linked_name);
+  if (!linked_func ||
+      linked_func->getFunctionType() != func->getFunctionType()) {
+    return llvm::createStringError(
+        std::make_error_code(std::errc::invalid_argument),
+        "Unable to link compressed function '%s' back into module",
+        func->getName().str().c_str());
+  }
+
+  llvm::SmallVector<std::pair<unsigned, llvm::MDNode *>, 4> mds;
+  linked_func->getAllMetadata(mds);
+  const auto personality =
+      linked_func->hasPersonalityFn() ? linked_func->getPersonalityFn()
+                                      : nullptr;
+  const auto prefix =
+      linked_func->hasPrefixData() ? linked_func->getPrefixData() : nullptr;
+  const auto prologue = linked_func->hasPrologueData()
+                            ? linked_func->getPrologueData()
+                            : nullptr;
+
+  func->setIsMaterializable(false);
+  MoveFunctionBody(linked_func, func);
+
+  for (auto [kind, md] : mds) {
+    func->setMetadata(kind, md);
+  }
+  if (personality) {
+    func->setPersonalityFn(personality);
+  }
+  if (prefix) {
+    func->setPrefixData(prefix);
+  }
+  if (prologue) {
+    func->setPrologueData(prologue);
+  }
+
+  IncrementCounter(Counter::kFunctionsDecompressed);
+  return llvm::Error::success();
+}
+
+llvm::Error CompressedFunctionsImpl::LinkAll(
+    const std::vector<llvm::Function *> &funcs) {
+
+  // The linker maps the struct types of the decompressed bitcode back onto
+  // those of the module by name, but only onto the ones that it finds in the
+  // module. The types that only compressed functions use are found by way of a
+  // declaration of them that only lives until the linker has looked.
+  auto types_var =
+      struct_type_list.empty()
+          ? nullptr
+          : new llvm::GlobalVariable(
+                module,
+                llvm::StructType::get(
+                    module.getContext(),
+                    llvm::ArrayRef<llvm::Type *>(
+                        reinterpret_cast<llvm::Type *const *>(
+                            struct_type_list.data()),
+                        struct_type_list.size())),
+                false, llvm::GlobalValue::ExternalLinkage, nullptr);
+
+  // One mover links in all of the functions, so that the types of the module
+  // are only collected once.
+  llvm::IRMover mover(module);
+  if (types_var) {
+    types_var->eraseFromParent();
+  }
+
+  llvm::Error ret = llvm::Error::success();
+  for (auto func : funcs) {
+    auto it = functions.find(func);
+    const auto compressed = std::move(it->second);
+    functions.erase(it);
+    num_compressed_bytes -= compressed.data.size();
+    num_bitcode_bytes -= compressed.bitcode_size ? compressed.bitcode_size
+                                                 : compressed.data.size();
+    if (auto err = Link(func, compressed, mover)) {
+      ret = llvm::joinErrors(std::move(ret), std::move(err));
+    }
+  }
+  return ret;
+}
+
+llvm::Error CompressedFunctionsImpl::Materialize(llvm::Function *func) {
+  if (!func->isMaterializable()) {
+    return llvm::Error::success();
+  } else if (!functions.count(func)) {
+    return llvm::createStringError(
+        std::make_error_code(std::errc::invalid_argument),
+        "Function '%s' wasn't compressed", func->getName().str().c_str());
+  } else {
+    return LinkAll({func});
+  }
+}
+
+llvm::Error CompressedFunctionsImpl::MaterializeAll(void) {
+  std::vector<llvm::Function *> funcs;
+  for (auto &func : module) {
+    if (func.isMaterializable() && functions.count(&func)) {
+      funcs.push_back(&func);
+    }
+  }
+
+  auto ret = funcs.empty() ? llvm::Error::success() : LinkAll(funcs);
+  functions.clear();
+  num_compressed_bytes = 0u;
+  num_bitcode_bytes = 0u;
+  return ret;
+}
+
+std::vector<llvm::StructType *>
+CompressedFunctionsImpl::IdentifiedStructTypes(void) const {
+  llvm::TypeFinder types;
+  types.run(module, false);
+
+  std::unordered_set<llvm::StructType *> seen;
+  std::vector<llvm::StructType *> ret;
+  for (auto type : types) {
+    if (!type->isLiteral() && seen.insert(type).second) {
+      ret.push_back(type);
+    }
+  }
+  for (auto type : struct_type_list) {
+    if (seen.insert(type).second) {
+      ret.push_back(type);
+    }
+  }
+  return ret;
+}
+
+CompressedFunctions::~CompressedFunctions(void) {}
+
+CompressedFunctions::CompressedFunctions(llvm::Module &module)
+    : impl(std::make_shared<CompressedFunctionsImpl>(module)) {}
+
+// Compress the body of `func`.
+bool CompressedFunctions::Compress(llvm::Function &func) const {
+  return impl->Compress(func);
+}
+
+// Materialize every function that is still compressed.
+llvm::Error CompressedFunctions::MaterializeAll(void) const {
+  if (impl->materializer) {
+    return impl->module.materializeAll();
+  }
+  return llvm::Error::success();
+}
+
+// Returns the number of functions that are compressed right now.
+uint64_t CompressedFunctions::NumFunctions(void) const {
+  return impl->functions.size();
+}
+
+// Returns the number of bytes of compressed bitcode held right now.
+uint64_t CompressedFunctions::NumCompressedBytes(void) const {
+  return impl->num_compressed_bytes;
+}
+
+// Returns the number of bytes of uncompressed bitcode.
+uint64_t CompressedFunctions::NumBitcodeBytes(void) const {
+  return impl->num_bitcode_bytes;
+}
+
+}  // namespace anvill
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "anvill/Counters.h"
+
+#include <atomic>
+
+namespace anvill {
+namespace {
+
+static const char *const kCounterNames[kNumCounters] = {
+    "semantics_cache_hits", "semantics_cache_misses",
+    "decode_cache_hits",    "decode_cache_misses",
+    "type_cache_hits",      "type_cache_misses",
+    "function_cache_hits",  "function_cache_misses",
+    "lift_budget_exceeded", "optimize_budget_exceeded",
+    "functions_compressed", "functions_decompressed",
+    "memory_page_cache_hits", "memory_page_cache_misses"};
+
+// Threads add into different stripes so that counting on many threads at
+// once doesn't contend on one cache line; the value of a counter is the sum
+// over all stripes.
+static constexpr unsigned kNumStripes = 16u;
+
+struct alignas(64) CounterStripe {
+  std::atomic<uint64_t> values[kNumCounters];
+};
+
+static CounterStripe gStripes[kNumStripes] = {};
+static std::atomic<unsigned> gNextStripe{0u};
+static thread_local CounterStripe &gStripe =
+    gStripes[gNextStripe++ % kNumStripes];
+
+}  // namespace
+
+// Adds `amount` to `counter`.
+void IncrementCounter(Counter counter, uint64_t amount) {
+  gStripe.values[static_cast<unsigned>(counter)].fetch_add(
+      amount, std::memory_order_relaxed);
+}
+
+// Returns the value of `counter`.
+uint64_t ReadCounter(Counter counter) {
+  uint64_t value = 0u;
+  for (const auto &stripe : gStripes) {
+    value += stripe.values[static_cast<unsigned>(counter)].load(
+        std::memory_order_relaxed);
+  }
+  return value;
+}
+
+// Returns the name of `counter`.
+const char *CounterName(Counter counter) {
+  return kCounterNames[static_cast<unsigned>(counter)];
+}
+
+}  // namespace anvill
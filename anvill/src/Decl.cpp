@@ -19,6 +19,7 @@
 
 #include <anvill/ITypeSpecification.h>
 #include <anvill/Lifters/DeclLifter.h>
+#include <anvill/Util.h>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <llvm/ADT/StringRef.h>
@@ -37,9 +38,26 @@
 #include <remill/BC/IntrinsicTable.h>
 #include <remill/BC/Util.h>
 
+#include <algorithm>
+#include <map>
+#include <tuple>
+
 #include "Arch/Arch.h"
 
 namespace anvill {
+namespace {
+
+// Orders typed registers by the addresses of their instructions.
+struct RegisterInfoOrder {
+  bool operator()(const TypedRegisterDecl &a, uint64_t b) const {
+    return a.address < b;
+  }
+  bool operator()(uint64_t a, const TypedRegisterDecl &b) const {
+    return a < b.address;
+  }
+};
+
+}  // namespace
 
 // Declare this global variable in an LLVM module.
 llvm::GlobalVariable *
@@ -107,6 +125,16 @@ llvm::Function *FunctionDecl::DeclareInModule(const std::string &name,
   return func;
 }
 
+// Return the typed registers on entry to the instruction at `inst_address`.
+llvm::ArrayRef<TypedRegisterDecl>
+FunctionDecl::RegisterInfoAt(uint64_t inst_address) const {
+  auto [begin, end] = std::equal_range(
+      reg_info.begin(), reg_info.end(), inst_address, RegisterInfoOrder());
+  return llvm::ArrayRef<TypedRegisterDecl>(reg_info).slice(
+      static_cast<size_t>(begin - reg_info.begin()),
+      static_cast<size_t>(end - begin));
+}
+
 // Create a call to this function from within a basic block in a
 // lifted bitcode function. Returns the new value of the memory
 // pointer.
@@ -126,13 +154,14 @@ llvm::Value *FunctionDecl::CallFromLiftedBlock(
   // Go and get a pointer to the stack pointer register, so that we can
   // later store our computed return value stack pointer to it.
   auto sp_reg = arch->RegisterByName(arch->StackPointerRegisterName());
-  const auto ptr_to_sp = sp_reg->AddressOf(state_ptr, block);
+  const auto ptr_to_sp = StateRegisterAddress(ir, state_ptr, sp_reg);
   ir.SetInsertPoint(block);
 
   // Go and compute the value of the stack pointer on exit from
   // the function, which will be based off of the register state
   // on entry to the function.
-  auto new_sp_base = return_stack_pointer->AddressOf(state_ptr, block);
+  auto new_sp_base =
+      StateRegisterAddress(ir, state_ptr, return_stack_pointer);
   ir.SetInsertPoint(block);
 
   const auto sp_val_on_exit = ir.CreateAdd(
@@ -300,6 +329,24 @@ ValueDecl::SerializeToJSON(const llvm::DataLayout &dl) const {
 
   return value_json;
 }
+
+// Serialize a TypedRegisterDecl to JSON
+llvm::json::Object
+TypedRegisterDecl::SerializeToJSON(const llvm::DataLayout &dl) const {
+  llvm::json::Object reg_json;
+  reg_json.insert(llvm::json::Object::KV{llvm::json::ObjectKey("address"),
+                                         static_cast<int64_t>(address)});
+  reg_json.insert(
+      llvm::json::Object::KV{llvm::json::ObjectKey("register"), reg->name});
+  reg_json.insert(
+      llvm::json::Object::KV{llvm::json::ObjectKey("type"),
+                             ITypeSpecification::TypeToString(*type, dl)});
+  if (value) {
+    reg_json.insert(llvm::json::Object::KV{llvm::json::ObjectKey("value"),
+                                           static_cast<int64_t>(*value)});
+  }
+  return reg_json;
+}
 #endif
 
 // Create a Function Declaration from an `llvm::Function`.
@@ -354,4 +401,85 @@ llvm::Expected<FunctionDecl> FunctionDecl::Create(llvm::Function &func,
   return decl;
 }
 
+namespace {
+
+// Everything about a function that its calling convention looks at when
+// allocating the function's signature, except for the names of its
+// parameters.
+using SignatureKey =
+    std::tuple<const remill::Arch *, const llvm::Module *,
+               llvm::FunctionType *, llvm::CallingConv::ID, int>;
+
+// Returns the index of the `sret` parameter of `func`, if any. Calling
+// conventions only look for an `sret` on one of the first two parameters.
+static int StructRetParamIndex(const llvm::Function &func) {
+  if (func.hasParamAttribute(0, llvm::Attribute::StructRet)) {
+    return 0;
+  } else if (func.hasParamAttribute(1, llvm::Attribute::StructRet)) {
+    return 1;
+  } else {
+    return -1;
+  }
+}
+
+}  // namespace
+
+class SignatureAllocationCache::Impl {
+ public:
+  std::map<SignatureKey, FunctionDecl> allocations;
+};
+
+SignatureAllocationCache::SignatureAllocationCache(void)
+    : impl(new Impl) {}
+
+SignatureAllocationCache::~SignatureAllocationCache(void) {}
+
+// Create a function declaration from an LLVM function, reusing previous
+// allocations of signatures from `cache`.
+llvm::Expected<FunctionDecl>
+FunctionDecl::Create(llvm::Function &func, const remill::Arch *arch,
+                     SignatureAllocationCache &cache) {
+  const SignatureKey key(arch, func.getParent(), func.getFunctionType(),
+                         func.getCallingConv(), StructRetParamIndex(func));
+
+  // Calling conventions allocate any injected `sret` parameter first, followed
+  // by one parameter per argument of `func`, in order. Only the names of the
+  // latter differ between functions of the same type.
+  auto &allocations = cache.impl->allocations;
+  const auto num_args = func.arg_size();
+  if (auto it = allocations.find(key); it != allocations.end()) {
+    FunctionDecl decl = it->second;
+    decl.is_noreturn = func.hasFnAttribute(llvm::Attribute::NoReturn);
+
+    const auto param_names = TryRecoverParamNames(func);
+    const auto first_arg_param = decl.params.size() - num_args;
+    for (auto i = 0u; i < num_args; ++i) {
+      decl.params[first_arg_param + i].name = param_names[i];
+    }
+    return decl;
+  }
+
+  auto maybe_decl = Create(func, arch);
+  if (remill::IsError(maybe_decl)) {
+    return maybe_decl;
+  }
+
+  // Only remember the allocation if its parameters were named the way that
+  // we expect, so that we can correctly rename them next time.
+  const auto &decl = remill::GetReference(maybe_decl);
+  if (decl.params.size() >= num_args) {
+    const auto param_names = TryRecoverParamNames(func);
+    const auto first_arg_param = decl.params.size() - num_args;
+    auto names_match = true;
+    for (auto i = 0u; i < num_args && names_match; ++i) {
+      names_match = decl.params[first_arg_param + i].name == param_names[i];
+    }
+    if (names_match) {
+      allocations.emplace(key, decl);
+    }
+  }
+
+  return maybe_decl;
+}
+
 }  // namespace anvill
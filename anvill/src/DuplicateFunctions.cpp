@@ -0,0 +1,258 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "anvill/DuplicateFunctions.h"
+
+#include <anvill/Decl.h>
+#include <anvill/Program.h>
+#include <anvill/Util.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/Support/SHA1.h>
+#include <llvm/Support/raw_ostream.h>
+#include <remill/Arch/Arch.h>
+#include <remill/Arch/Instruction.h>
+#include <remill/BC/Util.h>
+
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace anvill {
+namespace {
+
+// Returns `true` if any operand of `inst` reads or writes the program
+// counter.
+static bool UsesProgramCounter(const remill::Instruction &inst,
+                               std::string_view pc_reg_name) {
+  auto is_pc = [=](const std::string &reg_name) {
+    return reg_name == pc_reg_name || reg_name == remill::kPCVariableName ||
+           reg_name == remill::kNextPCVariableName;
+  };
+
+  for (const auto &op : inst.operands) {
+    switch (op.type) {
+      case remill::Operand::kTypeRegister:
+        if (is_pc(op.reg.name)) {
+          return true;
+        }
+        break;
+      case remill::Operand::kTypeShiftRegister:
+        if (is_pc(op.shift_reg.reg.name)) {
+          return true;
+        }
+        break;
+      case remill::Operand::kTypeAddress:
+        if (is_pc(op.addr.base_reg.name) || is_pc(op.addr.index_reg.name) ||
+            is_pc(op.addr.segment_base_reg.name)) {
+          return true;
+        }
+        break;
+      default: break;
+    }
+  }
+  return false;
+}
+
+// Decode the instructions reachable from the entry point of `decl`, which
+// must all be within `[decl.address, end)`, and describe their offsets and
+// bytes into `os`. Returns `false` if the code of `decl` isn't
+// position-independent.
+static bool DescribePositionIndependentCode(const Program &program,
+                                            const remill::Arch *arch,
+                                            const FunctionDecl &decl,
+                                            uint64_t end,
+                                            llvm::raw_ostream &os) {
+  const auto max_inst_size = arch->MaxInstructionSize();
+  const auto pc_reg_name = arch->ProgramCounterRegisterName();
+
+  // Ordered by offset, so that the description doesn't depend on the order
+  // in which instructions were found.
+  std::map<uint64_t, std::string> insts;
+  std::vector<uint64_t> work_list{decl.address};
+  remill::Instruction inst;
+
+  while (!work_list.empty()) {
+    const auto ea = work_list.back();
+    work_list.pop_back();
+
+    if (ea < decl.address || ea >= end) {
+      return false;
+    }
+
+    const auto offset = ea - decl.address;
+    if (insts.count(offset)) {
+      continue;
+    }
+
+    // Redirections and targets are given by absolute address.
+    uint64_t dest = ea;
+    if ((program.TryGetControlFlowRedirection(dest, ea) && dest != ea) ||
+        program.TryGetControlFlowTargets(ea)) {
+      return false;
+    }
+
+    inst.Reset();
+    auto bytes = ReadExecutableBytes(
+        program, ea, std::min<uint64_t>(max_inst_size, end - ea));
+    if (!arch->DecodeInstruction(ea, bytes, inst) ||
+        arch->MayHaveDelaySlot(inst)) {
+      return false;
+    }
+
+    // The targets of direct branches are checked to be within the function,
+    // which makes them relative to it, whatever their operands look like.
+    switch (inst.category) {
+      case remill::Instruction::kCategoryNormal:
+      case remill::Instruction::kCategoryNoOp:
+        if (UsesProgramCounter(inst, pc_reg_name)) {
+          return false;
+        }
+        work_list.push_back(inst.next_pc);
+        break;
+      case remill::Instruction::kCategoryDirectJump:
+        work_list.push_back(inst.branch_taken_pc);
+        break;
+      case remill::Instruction::kCategoryConditionalBranch:
+        work_list.push_back(inst.branch_taken_pc);
+        work_list.push_back(inst.branch_not_taken_pc);
+        break;
+      case remill::Instruction::kCategoryFunctionReturn:
+        if (UsesProgramCounter(inst, pc_reg_name)) {
+          return false;
+        }
+        break;
+      case remill::Instruction::kCategoryConditionalFunctionReturn:
+        if (UsesProgramCounter(inst, pc_reg_name)) {
+          return false;
+        }
+        work_list.push_back(inst.branch_not_taken_pc);
+        break;
+
+      // Calls push return addresses, indirect jumps go through tables of
+      // absolute addresses, and hyper calls may save the program counter.
+      default: return false;
+    }
+
+    insts.emplace(offset, inst.bytes);
+  }
+
+  for (const auto &[offset, inst_bytes] : insts) {
+    os << "inst=" << offset << ',' << llvm::toHex(inst_bytes, true) << '\n';
+  }
+  return true;
+}
+
+}  // namespace
+
+// Find the duplicate functions of `program`, decoding their code with
+// `arch`.
+DuplicateFunctions DuplicateFunctions::Find(const Program &program,
+                                            const remill::Arch *arch) {
+  std::vector<const FunctionDecl *> decls;
+  program.ForEachFunction([&](const FunctionDecl *decl) {
+    decls.push_back(decl);
+    return true;
+  });
+
+  // The lowest-addressed function of each group of duplicates represents
+  // the group.
+  std::sort(decls.begin(), decls.end(),
+            [](const FunctionDecl *a, const FunctionDecl *b) {
+              return a->address < b->address;
+            });
+
+  DuplicateFunctions dups;
+  std::unordered_map<std::string, uint64_t> first_with_hash;
+  for (auto i = 0u; i < decls.size(); ++i) {
+    const auto decl = decls[i];
+    if (!decl->prototype || !decl->reg_info.empty() ||
+        decl->arch != arch) {
+      continue;
+    }
+
+    const auto end = i + 1u < decls.size()
+                         ? decls[i + 1u]->address
+                         : std::numeric_limits<uint64_t>::max();
+
+    std::string desc;
+    llvm::raw_string_ostream os(desc);
+    os << "prototype=" << reinterpret_cast<uintptr_t>(decl->prototype)
+       << "\nredzone=" << decl->num_bytes_in_redzone << '\n';
+    if (!DescribePositionIndependentCode(program, arch, *decl, end, os)) {
+      continue;
+    }
+
+    llvm::SHA1 sha;
+    sha.update(os.str());
+    auto [it, added] = first_with_hash.emplace(
+        llvm::toHex(sha.final(), true), decl->address);
+    if (!added) {
+      dups.representatives.emplace(decl->address, it->second);
+    }
+  }
+
+  return dups;
+}
+
+// Returns the address of the representative of the function at `address`,
+// if that function is a duplicate.
+std::optional<uint64_t>
+DuplicateFunctions::RepresentativeOf(uint64_t address) const {
+  if (auto it = representatives.find(address); it != representatives.end()) {
+    return it->second;
+  }
+  return std::nullopt;
+}
+
+// Define `func` as a thunk that tail-calls `representative`.
+bool DuplicateFunctions::DefineAsThunk(llvm::Function &func,
+                                       llvm::Function &representative) {
+  const auto func_type = func.getFunctionType();
+  if (!func.isDeclaration() || &func == &representative ||
+      func_type != representative.getFunctionType() || func_type->isVarArg()) {
+    return false;
+  }
+
+  auto &context = func.getContext();
+  llvm::IRBuilder<> ir(llvm::BasicBlock::Create(context, "", &func));
+
+  std::vector<llvm::Value *> args;
+  for (auto &arg : func.args()) {
+    args.push_back(&arg);
+  }
+
+  auto call = ir.CreateCall(&representative, args);
+  call->setCallingConv(representative.getCallingConv());
+  call->setTailCall(true);
+
+  if (func_type->getReturnType()->isVoidTy()) {
+    ir.CreateRetVoid();
+  } else {
+    ir.CreateRet(call);
+  }
+  return true;
+}
+
+}  // namespace anvill
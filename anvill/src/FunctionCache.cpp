@@ -0,0 +1,464 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "anvill/FunctionCache.h"
+
+#include <anvill/Counters.h>
+#include <anvill/Decl.h>
+#include <anvill/ITypeSpecification.h>
+#include <anvill/Lifters/Options.h>
+#include <anvill/Optimize.h>
+#include <anvill/Program.h>
+#include <anvill/Util.h>
+#include <anvill/Version.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Metadata.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/SHA1.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <remill/Arch/Arch.h>
+#include <remill/OS/OS.h>
+
+#include <algorithm>
+#include <limits>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include "Lifters/SemanticsCache.h"
+
+namespace anvill {
+namespace {
+
+// Bumped whenever the layout of keys or of cached modules changes.
+static constexpr unsigned kCacheFormatVersion = 3u;
+
+// Name of the metadata of a cached module that lists the address and the
+// prototype hash of each entity that the cached function refers to.
+static constexpr const char *kReferencesMetadataName =
+    "anvill.cache.references";
+
+// Suffix given to a cached function while it's linked into a module, so that
+// linking doesn't replace the function whose body it will become.
+static constexpr const char *kCachedFunctionSuffix = ".anvill.cached";
+
+static llvm::StringRef ToStringRef(std::string_view view) {
+  return llvm::StringRef(view.data(), view.size());
+}
+
+// Describe the lifter options that affect the lifted code.
+static void DescribeOptions(llvm::raw_ostream &os,
+                            const LifterOptions &options) {
+  os << "state_init=" << static_cast<int>(options.state_struct_init_procedure)
+     << "\nstack_init="
+     << static_cast<int>(options.stack_frame_struct_init_procedure)
+     << "\npc_metadata="
+     << (options.pc_metadata_name ? options.pc_metadata_name : "")
+     << "\nstack_padding=" << options.stack_frame_lower_padding << ','
+     << options.stack_frame_higher_padding
+     << "\nsymbolic_pc=" << options.symbolic_program_counter
+     << "\nsymbolic_sp=" << options.symbolic_stack_pointer
+     << "\nsymbolic_ra=" << options.symbolic_return_address
+     << "\nsymbolic_types=" << options.symbolic_register_types
+     << "\nstore_values=" << options.store_inferred_register_values
+     << "\nbreakpoints=" << options.add_breakpoints
+     << "\ncompact_breakpoints=" << options.compact_breakpoints
+     << "\nprovenance=" << options.track_provenance
+     << "\ndiscard_names=" << options.discard_value_names
+     << "\nmax_inline=" << options.max_inlined_semantics_size
+     << "\ntemplates=" << options.lift_from_instruction_templates
+     << "\nlive_regs=" << options.initialize_only_live_registers
+     << "\nzero_vectors=" << options.zero_vector_and_float_state
+     << "\nthunks=" << options.lift_thunks_as_tail_calls
+     << "\nregs_on_demand=" << options.declare_registers_on_demand
+     << "\nentity_accesses=" << options.lower_memory_accesses_to_entities
+     << '\n';
+}
+
+// Describe everything about `decl` that affects the lifted code.
+static void DescribeDecl(llvm::raw_ostream &os, const FunctionDecl &decl,
+                         const llvm::DataLayout &dl) {
+  os << "type=" << ITypeSpecification::TypeToString(*decl.type, dl)
+     << "\nredzone=" << decl.num_bytes_in_redzone
+     << "\ndecl=" << llvm::json::Value(decl.SerializeToJSON(dl)) << '\n';
+
+  // `reg_info` is sorted by address when the decl is declared.
+  for (const auto &reg : decl.reg_info) {
+    os << "reg_info=" << llvm::json::Value(reg.SerializeToJSON(dl)) << '\n';
+  }
+}
+
+}  // namespace
+
+FunctionCache::FunctionCache(std::string dir_) : dir(std::move(dir_)) {}
+
+// Open the cache in the directory `dir`, creating the directory if it
+// doesn't exist.
+llvm::Expected<FunctionCache> FunctionCache::Open(const std::string &dir) {
+  if (auto ec = llvm::sys::fs::create_directories(dir)) {
+    return llvm::createStringError(
+        ec, "Unable to create function cache directory '%s': %s",
+        dir.c_str(), ec.message().c_str());
+  }
+  return FunctionCache(dir);
+}
+
+// Returns the key of the function described by `decl`, whose bytes in
+// `program` extend up to, but not including, `end_address`.
+std::string FunctionCache::Key(const Program &program,
+                               const FunctionDecl &decl, uint64_t end_address,
+                               const LifterOptions &options,
+                               const OptimizationPipeline &pipeline) {
+  const auto arch = options.arch;
+  const auto &dl = options.module->getDataLayout();
+
+  std::string desc;
+  llvm::raw_string_ostream os(desc);
+  os << "format=" << kCacheFormatVersion
+     << "\nanvill=" << ToStringRef(version::GetCommitHash())
+     << "\nllvm=" << LLVM_VERSION_STRING
+     << "\narch=" << ToStringRef(remill::GetArchName(arch->arch_name))
+     << "\nos=" << ToStringRef(remill::GetOSName(arch->os_name))
+     << "\nsemantics=" << CachedArchSemanticsHash(arch)
+     << "\npipeline=" << pipeline.ToString()
+     << "\nmax_iterations=" << pipeline.MaxIterations()
+     << "\naddress=" << decl.address << '\n';
+  DescribeOptions(os, options);
+  DescribeDecl(os, decl, dl);
+
+  llvm::SHA1 sha;
+
+  // Hash the executable bytes of the function, stopping early at the first
+  // byte that isn't mapped or isn't executable.
+  auto max_address = std::numeric_limits<uint64_t>::max();
+  if (decl.address < max_address - kMaxFunctionSize) {
+    max_address = decl.address + kMaxFunctionSize;
+  }
+  const auto end = std::min(end_address, max_address);
+  auto ea = decl.address;
+  const auto size = static_cast<size_t>(end > ea ? end - ea : 0u);
+  for (auto seq = program.FindBytes(ea, size); seq && seq.IsExecutable();
+       seq = program.FindNextBytes(seq, size - (ea - decl.address))) {
+    sha.update(ToStringRef(seq.ToString()));
+    ea += seq.Size();
+  }
+  os << "end=" << ea << '\n';
+
+  // Control-flow information about these bytes directs how they're lifted.
+  for (auto inst_ea = decl.address; inst_ea < ea; ++inst_ea) {
+    uint64_t dest = inst_ea;
+    if (program.TryGetControlFlowRedirection(dest, inst_ea) &&
+        dest != inst_ea) {
+      os << "redirect=" << inst_ea << ',' << dest << '\n';
+    }
+    if (auto targets = program.TryGetControlFlowTargets(inst_ea)) {
+      os << "targets=" << inst_ea << ',' << targets->complete;
+      for (auto target : targets->destination_list) {
+        os << ',' << target;
+      }
+      os << '\n';
+    }
+  }
+
+  sha.update(os.str());
+  return llvm::toHex(sha.final(), true);
+}
+
+// Returns a hash of the declaration `decl`.
+std::string FunctionCache::PrototypeHash(const FunctionDecl &decl,
+                                         const llvm::DataLayout &dl) {
+  std::string desc;
+  llvm::raw_string_ostream os(desc);
+  os << "address=" << decl.address << '\n';
+  DescribeDecl(os, decl, dl);
+
+  llvm::SHA1 sha;
+  sha.update(os.str());
+  return llvm::toHex(sha.final(), true);
+}
+
+// Returns a hash of the declaration `decl`, and of the bytes of its variable.
+std::string FunctionCache::PrototypeHash(const GlobalVarDecl &decl,
+                                         const Program &program,
+                                         const llvm::DataLayout &dl) {
+  std::string desc;
+  llvm::raw_string_ostream os(desc);
+  os << "address=" << decl.address
+     << "\ntype=" << ITypeSpecification::TypeToString(*decl.type, dl) << '\n';
+
+  llvm::SHA1 sha;
+
+  // Optimization can fold loads of the variable into the code that refers to
+  // it, so its bytes are hashed too, up to the first byte that isn't mapped.
+  const auto size = static_cast<size_t>(dl.getTypeAllocSize(decl.type));
+  auto ea = decl.address;
+  for (auto seq = program.FindBytes(ea, size); seq;
+       seq = program.FindNextBytes(seq, size - (ea - decl.address))) {
+    sha.update(ToStringRef(seq.ToString()));
+    os << "writable=" << seq.IsWriteable() << '\n';
+    ea += seq.Size();
+  }
+  os << "end=" << ea << '\n';
+
+  sha.update(os.str());
+  return llvm::toHex(sha.final(), true);
+}
+
+std::string FunctionCache::PathOf(const std::string &key) const {
+  llvm::SmallString<128> path(dir);
+  llvm::sys::path::append(path, key + ".bc");
+  return path.str().str();
+}
+
+// Load the cached module of `key` into `context`. Returns `nullptr` if
+// nothing is cached under `key`, or if what it refers to has changed.
+llvm::Expected<std::unique_ptr<llvm::Module>>
+FunctionCache::Load(const std::string &key, llvm::LLVMContext &context,
+                    const PrototypeHashFunc &prototype_of) const {
+  const auto path = PathOf(key);
+  auto maybe_buff = llvm::MemoryBuffer::getFile(path);
+  if (!maybe_buff) {
+    const auto ec = maybe_buff.getError();
+    if (ec == std::errc::no_such_file_or_directory) {
+      IncrementCounter(Counter::kFunctionCacheMisses);
+      return nullptr;
+    }
+    return llvm::createStringError(
+        ec, "Unable to read cached function '%s': %s", path.c_str(),
+        ec.message().c_str());
+  }
+
+  auto maybe_cached =
+      llvm::parseBitcodeFile(maybe_buff.get()->getMemBufferRef(), context);
+  if (!maybe_cached) {
+    return maybe_cached.takeError();
+  }
+
+  // The entry is stale if the prototype of anything that it refers to has
+  // changed, e.g. if a callee takes different arguments, as then the cached
+  // code marshals the arguments of its calls to that callee the old way.
+  auto &cached = *maybe_cached;
+  if (auto refs = cached->getNamedMetadata(kReferencesMetadataName)) {
+    for (auto ref : refs->operands()) {
+      auto address = llvm::mdconst::dyn_extract_or_null<llvm::ConstantInt>(
+          ref->getNumOperands() == 2u ? ref->getOperand(0u).get() : nullptr);
+      auto hash = ref->getNumOperands() == 2u
+                      ? llvm::dyn_cast_or_null<llvm::MDString>(
+                            ref->getOperand(1u).get())
+                      : nullptr;
+      if (!address || !hash) {
+        return llvm::createStringError(
+            std::make_error_code(std::errc::invalid_argument),
+            "Cached function '%s' has malformed references", path.c_str());
+      }
+
+      if (prototype_of(address->getZExtValue()) != hash->getString()) {
+        IncrementCounter(Counter::kFunctionCacheMisses);
+        return nullptr;
+      }
+    }
+    cached->eraseNamedMetadata(refs);
+  }
+
+  IncrementCounter(Counter::kFunctionCacheHits);
+  return std::move(cached);
+}
+
+// Replace the body of `func` with the body of the function defined by
+// `cached`, and link the rest of `cached` into the module of `func`.
+llvm::Error FunctionCache::Link(std::unique_ptr<llvm::Module> cached,
+                                llvm::Function &func) {
+  llvm::Function *cached_func = nullptr;
+  for (auto &other_func : *cached) {
+    if (other_func.isDeclaration()) {
+      continue;
+    } else if (cached_func) {
+      return llvm::createStringError(
+          std::make_error_code(std::errc::invalid_argument),
+          "Cached module of function '%s' defines more than one function",
+          func.getName().str().c_str());
+    } else {
+      cached_func = &other_func;
+    }
+  }
+
+  if (!cached_func) {
+    return llvm::createStringError(
+        std::make_error_code(std::errc::invalid_argument),
+        "Cached module of function '%s' doesn't define a function",
+        func.getName().str().c_str());
+  }
+
+  // The linker would otherwise bind things of different types by casting
+  // them, silently keeping a stale use of whatever changed.
+  const auto module = func.getParent();
+  for (const auto &gv : cached->global_values()) {
+    if (&gv == cached_func) {
+      continue;
+    }
+    auto existing = module->getNamedValue(gv.getName());
+    if (existing && existing->getValueType() != gv.getValueType()) {
+      return llvm::createStringError(
+          std::make_error_code(std::errc::invalid_argument),
+          "Cached function '%s' refers to '%s' with a different type",
+          func.getName().str().c_str(), gv.getName().str().c_str());
+    }
+  }
+
+  const auto linked_name = func.getName().str() + kCachedFunctionSuffix;
+  cached_func->setName(linked_name);
+
+  if (llvm::Linker::linkModules(*module, std::move(cached))) {
+    return llvm::createStringError(
+        std::make_error_code(std::errc::invalid_argument),
+        "Unable to link cached function '%s' into module",
+        func.getName().str().c_str());
+  }
+
+  const auto linked_func = module->getFunction(linked_name);
+  if (linked_func->getFunctionType() != func.getFunctionType()) {
+    linked_func->replaceAllUsesWith(&func);
+    linked_func->eraseFromParent();
+    return llvm::createStringError(
+        std::make_error_code(std::errc::invalid_argument),
+        "Cached function '%s' has the wrong type",
+        func.getName().str().c_str());
+  }
+
+  MoveFunctionBody(linked_func, &func);
+  return llvm::Error::success();
+}
+
+// Cache the definition of `func` under `key`, along with the prototype hashes
+// of what it refers to.
+llvm::Error FunctionCache::Store(const std::string &key,
+                                 const llvm::Function &func,
+                                 const EntityAddressFunc &address_of,
+                                 const PrototypeHashFunc &prototype_of) const {
+  const auto &module = *func.getParent();
+
+  llvm::ValueToValueMapTy vmap;
+  auto cached = llvm::CloneModule(module, vmap,
+                                  [&](const llvm::GlobalValue *gv) {
+                                    return gv == &func;
+                                  });
+
+  // `CloneModule` turns everything but `func` into external declarations, which
+  // would bind to the wrong things if they were originally local.
+  for (const auto &gv : module.global_values()) {
+    if (!gv.hasLocalLinkage()) {
+      continue;
+    }
+    if (auto it = vmap.find(&gv); it != vmap.end() && it->second &&
+                                  !it->second->use_empty()) {
+      return llvm::createStringError(
+          std::make_error_code(std::errc::not_supported),
+          "Function '%s' refers to '%s', which has local linkage",
+          func.getName().str().c_str(), gv.getName().str().c_str());
+    }
+  }
+
+  // Drop the declarations that `func` doesn't need.
+  std::vector<llvm::GlobalValue *> unused;
+  for (auto &gv : cached->global_values()) {
+    if (gv.isDeclaration() && gv.use_empty()) {
+      unused.push_back(&gv);
+    }
+  }
+  for (auto gv : unused) {
+    gv->eraseFromParent();
+  }
+
+  // Record the prototypes of the entities that are left, which are what the
+  // cached function refers to. An empty hash records that there was no
+  // entity at an address, in case one is declared there later.
+  auto &context = cached->getContext();
+  auto refs = cached->getOrInsertNamedMetadata(kReferencesMetadataName);
+  for (const auto &gv : cached->global_values()) {
+    auto original = module.getNamedValue(gv.getName());
+    if (gv.getName() == func.getName() || !original) {
+      continue;
+    }
+    if (auto address = address_of(*original)) {
+      llvm::Metadata *ops[] = {
+          llvm::ConstantAsMetadata::get(
+              llvm::ConstantInt::get(llvm::Type::getInt64Ty(context),
+                                     *address)),
+          llvm::MDString::get(context, prototype_of(*address))};
+      refs->addOperand(llvm::MDTuple::get(context, ops));
+    }
+  }
+
+  std::string error;
+  llvm::raw_string_ostream error_os(error);
+  if (llvm::verifyModule(*cached, &error_os)) {
+    return llvm::createStringError(
+        std::make_error_code(std::errc::invalid_argument),
+        "Unable to cache function '%s': %s", func.getName().str().c_str(),
+        error_os.str().c_str());
+  }
+
+  // Write to a temporary file and then rename it, so that concurrent readers
+  // never see a partially written entry.
+  const auto path = PathOf(key);
+  llvm::SmallString<128> tmp_path;
+  int fd = -1;
+  if (auto ec = llvm::sys::fs::createUniqueFile(path + ".%%%%%%%%.tmp", fd,
+                                                tmp_path)) {
+    return llvm::createStringError(
+        ec, "Unable to create temporary file for '%s': %s", path.c_str(),
+        ec.message().c_str());
+  }
+
+  {
+    llvm::raw_fd_ostream os(fd, true);
+    llvm::WriteBitcodeToFile(*cached, os);
+    os.close();
+    if (os.has_error()) {
+      const auto ec = os.error();
+      os.clear_error();
+      llvm::sys::fs::remove(tmp_path);
+      return llvm::createStringError(
+          ec, "Unable to write cached function to '%s': %s",
+          tmp_path.c_str(), ec.message().c_str());
+    }
+  }
+
+  if (auto ec = llvm::sys::fs::rename(tmp_path, path)) {
+    llvm::sys::fs::remove(tmp_path);
+    return llvm::createStringError(
+        ec, "Unable to rename '%s' to '%s': %s", tmp_path.c_str(),
+        path.c_str(), ec.message().c_str());
+  }
+
+  return llvm::Error::success();
+}
+
+}  // namespace anvill
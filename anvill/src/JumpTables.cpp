@@ -0,0 +1,512 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "anvill/JumpTables.h"
+
+#include <anvill/Decl.h>
+#include <anvill/Program.h>
+#include <anvill/Util.h>
+#include <llvm/ADT/StringRef.h>
+#include <remill/Arch/Arch.h>
+#include <remill/Arch/Instruction.h>
+#include <remill/BC/ABI.h>
+
+#include <algorithm>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+namespace anvill {
+namespace {
+
+// Most `switch` statements have far fewer cases than this.
+static constexpr uint64_t kMaxTableEntries = 4096u;
+
+// The number of instructions before an indirect jump that are looked at to
+// find how the jump's target is computed.
+static constexpr unsigned kMaxLookBehind = 8u;
+
+// Bound on the number of instructions decoded per function.
+static constexpr size_t kMaxFunctionInstructions = 1u << 16u;
+
+static constexpr size_t kNotFound = ~static_cast<size_t>(0u);
+
+// Returns `true` if `inst` writes to the register `name`.
+static bool WritesRegister(const remill::Instruction &inst,
+                           const std::string &name) {
+  for (const auto &op : inst.operands) {
+    if (op.type == remill::Operand::kTypeRegister &&
+        op.action == remill::Operand::kActionWrite && op.reg.name == name) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Returns the first address operand of `inst` of kind `kind`, if any.
+static const remill::Operand *
+FindAddressOperand(const remill::Instruction &inst,
+                   remill::Operand::Address::Kind kind) {
+  for (const auto &op : inst.operands) {
+    if (op.type == remill::Operand::kTypeAddress && op.addr.kind == kind) {
+      return &op;
+    }
+  }
+  return nullptr;
+}
+
+// Returns the index of the instruction in `window` at or after `index` that
+// writes to the register `name`, or `kNotFound`.
+static size_t
+FindDefinition(const std::vector<const remill::Instruction *> &window,
+               size_t index, const std::string &name) {
+  for (; index < window.size(); ++index) {
+    if (WritesRegister(*window[index], name)) {
+      return index;
+    }
+  }
+  return kNotFound;
+}
+
+// Finds and reads the jump tables of one function at a time.
+class JumpTableFinder {
+ public:
+  JumpTableFinder(const Program &program_, const remill::Arch *arch_)
+      : program(program_),
+        arch(arch_),
+        pc_reg_name(arch->ProgramCounterRegisterName()),
+        ptr_size(arch->address_size / 8u),
+        address_mask(arch->address_size >= 64u
+                         ? std::numeric_limits<uint64_t>::max()
+                         : (1ull << arch->address_size) - 1u),
+        is_little_endian(arch->MemoryAccessIsLittleEndian()) {}
+
+  // Start on the function whose bytes are `[begin, end)`.
+  void Reset(uint64_t begin_, uint64_t end_) {
+    begin = begin_;
+    end = end_;
+    insts.clear();
+  }
+
+  // Decode the instructions reachable from `work_list`, adding the addresses
+  // of indirect jumps without targets to `jumps`.
+  void Decode(std::vector<uint64_t> &work_list, std::vector<uint64_t> &jumps);
+
+  // Try to recover the targets of the indirect jump at `ea`.
+  std::vector<uint64_t> Recognize(uint64_t ea) const;
+
+ private:
+  bool IsProgramCounter(const std::string &name) const {
+    return name == pc_reg_name || name == remill::kPCVariableName ||
+           name == remill::kNextPCVariableName;
+  }
+
+  // Returns `true` if `ea` could be the target of a jump table entry.
+  bool IsTarget(uint64_t ea) const {
+    return begin <= ea && ea < end && program.FindByte(ea).IsExecutable();
+  }
+
+  uint64_t DecodeInteger(std::string_view bytes) const;
+
+  bool ReadInteger(uint64_t ea, unsigned size, uint64_t &val) const;
+
+  std::optional<uint64_t>
+  StaticBase(const remill::Instruction &inst,
+             const remill::Operand::Address &addr) const;
+
+  std::vector<const remill::Instruction *> LookBehind(uint64_t ea) const;
+
+  std::vector<uint64_t> ReadAbsoluteTable(const remill::Instruction &inst,
+                                          const remill::Operand &op) const;
+
+  std::vector<uint64_t> ReadRelativeTable(uint64_t table, uint64_t base,
+                                          unsigned entry_size) const;
+
+  const Program &program;
+  const remill::Arch *const arch;
+  const std::string pc_reg_name;
+  const unsigned ptr_size;
+  const uint64_t address_mask;
+  const bool is_little_endian;
+
+  uint64_t begin{0};
+  uint64_t end{0};
+
+  // Decoded instructions of the current function, by address.
+  std::map<uint64_t, remill::Instruction> insts;
+};
+
+// Interpret `bytes` as an integer.
+uint64_t JumpTableFinder::DecodeInteger(std::string_view bytes) const {
+  const auto size = bytes.size();
+  uint64_t val = 0u;
+  for (size_t i = 0u; i < size; ++i) {
+    const auto byte = is_little_endian ? bytes[size - i - 1u] : bytes[i];
+    val = (val << 8u) | static_cast<uint8_t>(byte);
+  }
+  return val;
+}
+
+// Read the `size`-byte integer at `ea`.
+bool JumpTableFinder::ReadInteger(uint64_t ea, unsigned size,
+                                  uint64_t &val) const {
+  auto seq = program.FindBytes(ea, size);
+  if (!seq || seq.Size() != size) {
+    return false;
+  }
+
+  val = DecodeInteger(seq.ToString());
+  return true;
+}
+
+// Returns the value of the base and displacement of `addr`, an address
+// operand of `inst`, if it's known without running any code, i.e. if there
+// is no base register, or if the base register is the program counter.
+std::optional<uint64_t>
+JumpTableFinder::StaticBase(const remill::Instruction &inst,
+                            const remill::Operand::Address &addr) const {
+  const llvm::StringRef segment = addr.segment_base_reg.name;
+  if (segment.startswith("FS") || segment.startswith("GS")) {
+    return std::nullopt;
+  }
+
+  const auto disp = static_cast<uint64_t>(addr.displacement);
+  if (addr.base_reg.name.empty()) {
+    return disp & address_mask;
+  } else if (addr.base_reg.name == remill::kNextPCVariableName) {
+    return (inst.next_pc + disp) & address_mask;
+  } else if (IsProgramCounter(addr.base_reg.name)) {
+    return (inst.pc + disp) & address_mask;
+  } else {
+    return std::nullopt;
+  }
+}
+
+// Returns the instructions leading up to the one at `ea` in a straight line,
+// nearest first.
+std::vector<const remill::Instruction *>
+JumpTableFinder::LookBehind(uint64_t ea) const {
+  std::vector<const remill::Instruction *> window;
+  for (auto it = insts.find(ea);
+       it != insts.end() && it != insts.begin() &&
+       window.size() < kMaxLookBehind;) {
+    const auto prev = std::prev(it);
+    const auto &inst = prev->second;
+    if (inst.next_pc != it->first ||
+        (inst.category != remill::Instruction::kCategoryNormal &&
+         inst.category != remill::Instruction::kCategoryNoOp)) {
+      break;
+    }
+    window.push_back(&inst);
+    it = prev;
+  }
+  return window;
+}
+
+// Read the entries of a table of absolute addresses, which `inst` indexes
+// with its memory operand `op`.
+std::vector<uint64_t>
+JumpTableFinder::ReadAbsoluteTable(const remill::Instruction &inst,
+                                   const remill::Operand &op) const {
+  std::vector<uint64_t> targets;
+  const auto &addr = op.addr;
+  if (addr.index_reg.name.empty() ||
+      addr.scale != static_cast<int64_t>(ptr_size) ||
+      op.size != arch->address_size) {
+    return targets;
+  }
+
+  const auto table = StaticBase(inst, addr);
+  if (!table) {
+    return targets;
+  }
+
+  // Tables can be big, so rather than looking up each entry on its own, find
+  // which entries point into executable code for a whole run of bytes at a
+  // time.
+  const auto max_size = kMaxTableEntries * ptr_size;
+  uint64_t num_bytes = 0u;
+  for (auto seq = program.FindBytes(*table, max_size); seq;
+       seq = program.FindNextBytes(seq, max_size - num_bytes)) {
+    num_bytes += seq.Size();
+
+    const auto bytes = seq.ToString();
+    const auto num_entries = bytes.size() / ptr_size;
+    const auto is_code = program.FindPointerCandidates(
+        bytes, ptr_size, is_little_endian, true /* executable_only */);
+
+    for (size_t i = 0u; i < num_entries; ++i) {
+      const auto target =
+          DecodeInteger(bytes.substr(i * ptr_size, ptr_size)) & address_mask;
+      if (!((is_code[i / 64u] >> (i % 64u)) & 1u) || target < begin ||
+          target >= end) {
+        return targets;
+      }
+      targets.push_back(target);
+    }
+
+    // The next entry spans two mapped ranges.
+    if (bytes.size() % ptr_size) {
+      break;
+    }
+  }
+  return targets;
+}
+
+// Read the entries of a table at `table` of signed, `entry_size`-byte offsets
+// from `base`.
+std::vector<uint64_t>
+JumpTableFinder::ReadRelativeTable(uint64_t table, uint64_t base,
+                                   unsigned entry_size) const {
+  std::vector<uint64_t> targets;
+  const auto sign_shift = 64u - (entry_size * 8u);
+  for (uint64_t i = 0u; i < kMaxTableEntries; ++i) {
+    uint64_t offset = 0u;
+    if (!ReadInteger(table + (i * entry_size), entry_size, offset)) {
+      break;
+    }
+
+    const auto disp = static_cast<uint64_t>(
+        static_cast<int64_t>(offset << sign_shift) >> sign_shift);
+    const auto target = (base + disp) & address_mask;
+    if (!IsTarget(target)) {
+      break;
+    }
+    targets.push_back(target);
+  }
+  return targets;
+}
+
+// Decode the instructions reachable from `work_list`.
+void JumpTableFinder::Decode(std::vector<uint64_t> &work_list,
+                             std::vector<uint64_t> &jumps) {
+  const auto max_inst_size = arch->MaxInstructionSize();
+  remill::Instruction inst;
+
+  while (!work_list.empty() && insts.size() < kMaxFunctionInstructions) {
+    const auto ea = work_list.back();
+    work_list.pop_back();
+
+    if (ea < begin || ea >= end || insts.count(ea)) {
+      continue;
+    }
+
+    uint64_t dest = ea;
+    if (program.TryGetControlFlowRedirection(dest, ea) && dest != ea) {
+      continue;
+    }
+
+    inst.Reset();
+    const auto bytes = ReadExecutableBytes(
+        program, ea, std::min<uint64_t>(max_inst_size, end - ea));
+    if (!arch->DecodeInstruction(ea, bytes, inst) ||
+        arch->MayHaveDelaySlot(inst)) {
+      continue;
+    }
+
+    switch (inst.category) {
+      case remill::Instruction::kCategoryNormal:
+      case remill::Instruction::kCategoryNoOp:
+      case remill::Instruction::kCategoryDirectFunctionCall:
+      case remill::Instruction::kCategoryIndirectFunctionCall:
+        work_list.push_back(inst.next_pc);
+        break;
+      case remill::Instruction::kCategoryDirectJump:
+        work_list.push_back(inst.branch_taken_pc);
+        break;
+      case remill::Instruction::kCategoryConditionalBranch:
+        work_list.push_back(inst.branch_taken_pc);
+        work_list.push_back(inst.branch_not_taken_pc);
+        break;
+      case remill::Instruction::kCategoryConditionalFunctionReturn:
+        work_list.push_back(inst.branch_not_taken_pc);
+        break;
+      case remill::Instruction::kCategoryIndirectJump:
+        if (auto targets = program.TryGetControlFlowTargets(ea)) {
+          work_list.insert(work_list.end(), targets->destination_list.begin(),
+                           targets->destination_list.end());
+        } else {
+          jumps.push_back(ea);
+        }
+        break;
+      default: break;
+    }
+
+    insts.emplace(ea, std::move(inst));
+  }
+}
+
+// Try to recover the targets of the indirect jump at `ea`.
+std::vector<uint64_t> JumpTableFinder::Recognize(uint64_t ea) const {
+  const auto &jump = insts.at(ea);
+
+  // `jmp [table + index * ptr_size]`
+  if (auto op =
+          FindAddressOperand(jump, remill::Operand::Address::kMemoryRead)) {
+    return ReadAbsoluteTable(jump, *op);
+  }
+
+  const std::string *reg = nullptr;
+  for (const auto &op : jump.operands) {
+    if (op.type == remill::Operand::kTypeRegister &&
+        op.action == remill::Operand::kActionRead &&
+        !IsProgramCounter(op.reg.name)) {
+      reg = &(op.reg.name);
+      break;
+    }
+  }
+
+  if (!reg) {
+    return {};
+  }
+
+  const auto window = LookBehind(ea);
+  const auto def = FindDefinition(window, 0u, *reg);
+  if (def == kNotFound) {
+    return {};
+  }
+
+  // `mov reg, [table + index * ptr_size]`
+  const auto &def_inst = *window[def];
+  if (auto op = FindAddressOperand(def_inst,
+                                   remill::Operand::Address::kMemoryRead)) {
+    return ReadAbsoluteTable(def_inst, *op);
+  }
+
+  // `add reg, base`
+  if (!llvm::StringRef(def_inst.function).startswith("ADD")) {
+    return {};
+  }
+
+  const std::string *base_reg = nullptr;
+  for (const auto &op : def_inst.operands) {
+    if (op.type == remill::Operand::kTypeRegister &&
+        op.action == remill::Operand::kActionRead && op.reg.name != *reg) {
+      base_reg = &(op.reg.name);
+      break;
+    }
+  }
+
+  if (!base_reg) {
+    return {};
+  }
+
+  // `movsxd reg, dword [base + index * 4]`, after `base` is defined.
+  const auto load = FindDefinition(window, def + 1u, *reg);
+  const auto lea = FindDefinition(window, def + 1u, *base_reg);
+  if (load == kNotFound || lea == kNotFound || lea <= load) {
+    return {};
+  }
+
+  const auto load_op = FindAddressOperand(
+      *window[load], remill::Operand::Address::kMemoryRead);
+  if (!load_op || load_op->addr.base_reg.name != *base_reg ||
+      load_op->addr.index_reg.name.empty() || load_op->addr.scale != 4 ||
+      load_op->size != 32u) {
+    return {};
+  }
+
+  // `lea base, [pc + offset]`
+  const auto lea_op = FindAddressOperand(
+      *window[lea], remill::Operand::Address::kAddressCalculation);
+  if (!lea_op || !lea_op->addr.index_reg.name.empty()) {
+    return {};
+  }
+
+  const auto base = StaticBase(*window[lea], lea_op->addr);
+  if (!base) {
+    return {};
+  }
+
+  const auto table =
+      (*base + static_cast<uint64_t>(load_op->addr.displacement)) &
+      address_mask;
+  return ReadRelativeTable(table, *base, 4u);
+}
+
+}  // namespace
+
+// Speculatively recover the targets of the jump tables in the functions of
+// `program`.
+size_t SpeculateJumpTableTargets(Program &program, const remill::Arch *arch) {
+  std::vector<const FunctionDecl *> decls;
+  program.ForEachFunction([&](const FunctionDecl *decl) {
+    decls.push_back(decl);
+    return true;
+  });
+
+  std::sort(decls.begin(), decls.end(),
+            [](const FunctionDecl *a, const FunctionDecl *b) {
+              return a->address < b->address;
+            });
+
+  JumpTableFinder finder(program, arch);
+  std::vector<uint64_t> work_list;
+  std::vector<uint64_t> jumps;
+  std::unordered_set<uint64_t> tried;
+  size_t num_jumps = 0u;
+
+  for (auto i = 0u; i < decls.size(); ++i) {
+    const auto decl = decls[i];
+    if (decl->arch != arch) {
+      continue;
+    }
+
+    const auto end = i + 1u < decls.size()
+                         ? decls[i + 1u]->address
+                         : std::numeric_limits<uint64_t>::max();
+
+    finder.Reset(decl->address, end);
+    work_list.assign(1u, decl->address);
+    tried.clear();
+
+    // The targets of each recovered table are decoded in turn, as they may
+    // lead to more tables.
+    while (!work_list.empty()) {
+      finder.Decode(work_list, jumps);
+      work_list.clear();
+
+      for (auto jump : jumps) {
+        if (!tried.insert(jump).second) {
+          continue;
+        }
+
+        ControlFlowTargetList targets;
+        targets.source = jump;
+        targets.destination_list = finder.Recognize(jump);
+        targets.complete = false;
+        if (!targets.destination_list.empty() &&
+            program.TrySetControlFlowTargets(targets)) {
+          ++num_jumps;
+          work_list.insert(work_list.end(), targets.destination_list.begin(),
+                           targets.destination_list.end());
+        }
+      }
+      jumps.clear();
+    }
+  }
+
+  return num_jumps;
+}
+
+}  // namespace anvill
@@ -24,15 +24,44 @@
 #include <anvill/Providers/MemoryProvider.h>
 #include <glog/logging.h>
 #include <llvm/ADT/APInt.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/SmallVector.h>
 #include <llvm/IR/GlobalAlias.h>
+#include <llvm/IR/Instruction.h>
 #include <llvm/IR/Module.h>
 #include <remill/BC/Util.h>
 
+#include <algorithm>
 #include <sstream>
 
 #include "EntityLifter.h"
 
 namespace anvill {
+namespace {
+
+// Returns `true` if `var` is referred to by an instruction, or by the
+// initializer of a global variable. Uses by aliases and constant expressions
+// only count if those are themselves referred to, as the entity lifter makes
+// aliases of variables that nothing may ever use.
+static bool IsReferenced(llvm::GlobalVariable *var) {
+  llvm::SmallPtrSet<llvm::Value *, 16> seen;
+  llvm::SmallVector<llvm::Value *, 16> work_list;
+  work_list.push_back(var);
+  while (!work_list.empty()) {
+    const auto val = work_list.pop_back_val();
+    for (auto user : val->users()) {
+      if (llvm::isa<llvm::Instruction>(user) ||
+          llvm::isa<llvm::GlobalVariable>(user)) {
+        return true;
+      } else if (llvm::isa<llvm::Constant>(user) && seen.insert(user).second) {
+        work_list.push_back(user);
+      }
+    }
+  }
+  return false;
+}
+
+}  // namespace
 
 DataLifter::~DataLifter(void) {}
 
@@ -147,10 +176,6 @@ llvm::Constant *DataLifter::LiftData(const GlobalVarDecl &decl,
   const auto &dl = options.module->getDataLayout();
   const auto type = remill::RecontextualizeType(decl.type, context);
 
-  std::vector<uint8_t> bytes;
-  llvm::Constant *value = nullptr;
-  bool bytes_accessable = false;
-
   std::stringstream ss2;
   ss2 << kGlobalVariableNamePrefix << std::hex << decl.address << '_'
       << ITypeSpecification::TypeToString(*type, dl, true);
@@ -161,50 +186,109 @@ llvm::Constant *DataLifter::LiftData(const GlobalVarDecl &decl,
     return var;
   }
 
-  // Inspect the availability of first byte at `decl.address` and append
-  // it into the bytes vector
+  if (options.lazy_data_initializers) {
+    var = new llvm::GlobalVariable(*options.module, type, false,
+                                   llvm::GlobalValue::ExternalLinkage,
+                                   nullptr, var_name);
+    deferred.push_back({llvm::WeakVH(var), decl});
+    return var;
+  }
+
+  return new llvm::GlobalVariable(*options.module, type, false,
+                                  llvm::GlobalValue::ExternalLinkage,
+                                  LiftInitializer(decl, type, lifter_context),
+                                  var_name);
+}
+
+// Lift the initializer of a variable from its bytes.
+llvm::Constant *
+DataLifter::LiftInitializer(const GlobalVarDecl &decl, llvm::Type *type,
+                            EntityLifterImpl &lifter_context) {
+  const auto &dl = options.module->getDataLayout();
   const auto data_size = dl.getTypeAllocSize(type);
-  auto [first_byte, first_byte_avail, first_byte_perms] =
-      memory_provider.Query(decl.address);
-  if (MemoryProvider::HasByte(first_byte_avail)) {
-    bytes.push_back(first_byte);
-    bytes_accessable = true;
+  if (options.max_data_initializer_size &&
+      data_size > options.max_data_initializer_size) {
+    return nullptr;
   }
 
-  // Inspect the read/write permission of bytes and check if it is crossing
-  // permission boundaries. Log error in such case
-  if (bytes_accessable) {
-    for (auto i = 1U; i < data_size; ++i) {
-      auto [byte, byte_avail, byte_perms] =
-          memory_provider.Query(decl.address + i);
-      if (!MemoryProvider::HasByte(byte_avail)) {
-
-        bytes_accessable = false;
-        LOG(ERROR) << "Variable at address " << std::hex << decl.address
-                   << " crosses into inaccessible bytes (Byte offset " << i
-                   << " )!" << std::dec;
-        break;
-      } else if (first_byte_perms != byte_perms) {
-        bytes_accessable = false;
-        LOG(ERROR) << "Variable at address " << std::hex << decl.address
-                   << " crosses permission (Byte offset " << i << " )!"
-                   << std::dec;
-        break;
-      }
+  std::string bytes;
+  bool bytes_accessable = false;
+
+  // Read the bytes of the variable, one run at a time. All bytes must be
+  // available, and must share the permissions of the first byte. Log an error
+  // if the variable crosses into inaccessible bytes or crosses permission
+  // boundaries.
+  bytes.reserve(data_size);
+  auto [first_run_size, first_byte_avail, first_byte_perms] =
+      memory_provider.QueryRange(decl.address, data_size, bytes);
+  if (MemoryProvider::HasByte(first_byte_avail) && first_run_size) {
+    bytes_accessable = true;
+  }
 
-      bytes.push_back(byte);
+  while (bytes_accessable && bytes.size() < data_size) {
+    const auto i = bytes.size();
+    auto [run_size, byte_avail, byte_perms] =
+        memory_provider.QueryRange(decl.address + i, data_size - i, bytes);
+    if (!MemoryProvider::HasByte(byte_avail) || !run_size) {
+      bytes_accessable = false;
+      LOG(ERROR) << "Variable at address " << std::hex << decl.address
+                 << " crosses into inaccessible bytes (Byte offset " << i
+                 << " )!" << std::dec;
+
+    } else if (first_byte_perms != byte_perms) {
+      bytes_accessable = false;
+      LOG(ERROR) << "Variable at address " << std::hex << decl.address
+                 << " crosses permission (Byte offset " << i << " )!"
+                 << std::dec;
     }
   }
 
-  if (bytes_accessable) {
-    value = lifter_context.value_lifter.Lift(
-        std::string_view(reinterpret_cast<char *>(bytes.data()), bytes.size()),
-        type, lifter_context, decl.address);
+  if (!bytes_accessable) {
+    return nullptr;
   }
 
-  return new llvm::GlobalVariable(*options.module, type, false,
-                                  llvm::GlobalValue::ExternalLinkage, value,
-                                  var_name);
+  return lifter_context.value_lifter.Lift(bytes, type, lifter_context,
+                                          decl.address);
+}
+
+// Lift the deferred initializers of variables that are now referenced. Lifting
+// one initializer can make more variables referenced, so this goes until no
+// more are.
+unsigned DataLifter::LiftReferencedData(EntityLifterImpl &lifter_context) {
+  auto num_lifted = 0u;
+  for (auto changed = true; changed;) {
+    changed = false;
+
+    // Lifting an initializer can declare new variables, and so append to
+    // `deferred`; hence indexing rather than iterators.
+    for (size_t i = 0u; i < deferred.size(); ++i) {
+      auto var = llvm::dyn_cast_or_null<llvm::GlobalVariable>(
+          static_cast<llvm::Value *>(deferred[i].var));
+      if (!var || !var->isDeclaration()) {
+        deferred[i].var = nullptr;
+        continue;
+      } else if (!IsReferenced(var)) {
+        continue;
+      }
+
+      const auto decl = deferred[i].decl;
+      deferred[i].var = nullptr;
+      if (auto init =
+              LiftInitializer(decl, var->getValueType(), lifter_context)) {
+        var->setInitializer(init);
+        ++num_lifted;
+      }
+      changed = true;
+    }
+
+    // Forget about the variables that were lifted or deleted.
+    deferred.erase(std::remove_if(deferred.begin(), deferred.end(),
+                                  [](const DeferredInitializer &entry) {
+                                    return !entry.var;
+                                  }),
+                   deferred.end());
+  }
+  return num_lifted;
 }
 
 // Declare a lifted a variable. Will return `nullptr` if the memory is
@@ -236,4 +320,9 @@ llvm::Constant *EntityLifter::LiftEntity(const GlobalVarDecl &decl) const {
   return impl->data_lifter.GetOrDeclareData(decl, *impl);
 }
 
+// Lift the deferred initializers of variables that are now referenced.
+unsigned EntityLifter::LiftReferencedData(void) const {
+  return impl->data_lifter.LiftReferencedData(*impl);
+}
+
 }  // namespace anvill
@@ -19,15 +19,19 @@
 
 #include <anvill/Decl.h>
 #include <anvill/Lifters/Options.h>
+#include <llvm/IR/ValueHandle.h>
 
 #include <cstdint>
 #include <map>
 #include <memory>
 #include <set>
 #include <unordered_map>
+#include <vector>
 
 namespace llvm {
+class Constant;
 class GlobalAlias;
+class GlobalVariable;
 class LLVMContext;
 class Module;
 class Type;
@@ -56,15 +60,35 @@ class DataLifter {
   llvm::Constant *GetOrDeclareData(const GlobalVarDecl &decl,
                                    EntityLifterImpl &lifter_context);
 
+  // Lift the deferred initializers of variables that are now referenced.
+  // Returns the number of initializers lifted.
+  unsigned LiftReferencedData(EntityLifterImpl &lifter_context);
+
  private:
   friend class FunctionLifter;
 
+  // Lift the initializer of the variable described by `decl`, of type `type`.
+  // Returns `nullptr` if the variable's bytes aren't all accessible, or if it
+  // is bigger than `options.max_data_initializer_size`.
+  llvm::Constant *LiftInitializer(const GlobalVarDecl &decl, llvm::Type *type,
+                                  EntityLifterImpl &lifter_context);
+
+  // A variable whose initializer hasn't been lifted yet. The variable is
+  // tracked weakly, as optimization can delete it if nothing refers to it.
+  struct DeferredInitializer {
+    llvm::WeakVH var;
+    GlobalVarDecl decl;
+  };
+
   const LifterOptions &options;
   MemoryProvider &memory_provider;
   TypeProvider &type_provider;
 
   // Context associated with `module`.
   llvm::LLVMContext &context;
+
+  // Variables whose initializers are deferred, in declaration order.
+  std::vector<DeferredInitializer> deferred;
 };
 
 }  // namespace anvill
@@ -17,6 +17,7 @@
 
 #include <anvill/Decl.h>
 #include <anvill/Lifters/DeclLifter.h>
+#include <anvill/Util.h>
 #include <glog/logging.h>
 #include <llvm/IR/BasicBlock.h>
 #include <llvm/IR/DerivedTypes.h>
@@ -157,8 +158,8 @@ llvm::Value *StoreNativeValue(llvm::Value *native_val, const ValueDecl &decl,
 
   // Store it to a register.
   if (decl.reg) {
-    auto ptr_to_reg = decl.reg->AddressOf(state_ptr, in_block);
     llvm::IRBuilder<> ir(in_block);
+    auto ptr_to_reg = StateRegisterAddress(ir, state_ptr, decl.reg);
     if (decl.type != decl.reg->type) {
       ir.CreateStore(llvm::Constant::getNullValue(decl.reg->type), ptr_to_reg);
     }
@@ -177,9 +178,8 @@ llvm::Value *StoreNativeValue(llvm::Value *native_val, const ValueDecl &decl,
 
   // Store it to memory.
   } else if (decl.mem_reg) {
-    auto ptr_to_reg = decl.mem_reg->AddressOf(state_ptr, in_block);
-
     llvm::IRBuilder<> ir(in_block);
+    auto ptr_to_reg = StateRegisterAddress(ir, state_ptr, decl.mem_reg);
     const auto addr = ir.CreateAdd(
         ir.CreateLoad(ptr_to_reg),
         llvm::ConstantInt::get(decl.mem_reg->type,
@@ -204,8 +204,8 @@ llvm::Value *LoadLiftedValue(const ValueDecl &decl,
 
   // Load it out of a register.
   if (decl.reg) {
-    auto ptr_to_reg = decl.reg->AddressOf(state_ptr, in_block);
     llvm::IRBuilder<> ir(in_block);
+    auto ptr_to_reg = StateRegisterAddress(ir, state_ptr, decl.reg);
     auto reg = ir.CreateLoad(ptr_to_reg);
     if (auto adapted_val = AdaptToType(ir, reg, decl.type)) {
       return adapted_val;
@@ -216,8 +216,8 @@ llvm::Value *LoadLiftedValue(const ValueDecl &decl,
 
   // Load it out of memory.
   } else if (decl.mem_reg) {
-    auto ptr_to_reg = decl.mem_reg->AddressOf(state_ptr, in_block);
     llvm::IRBuilder<> ir(in_block);
+    auto ptr_to_reg = StateRegisterAddress(ir, state_ptr, decl.mem_reg);
     const auto addr = ir.CreateAdd(
         ir.CreateLoad(ptr_to_reg),
         llvm::ConstantInt::get(decl.mem_reg->type,
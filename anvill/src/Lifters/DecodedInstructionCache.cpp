@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "DecodedInstructionCache.h"
+
+namespace anvill {
+
+size_t DecodedInstructionCache::SlotIndex(uint64_t addr, bool is_delayed) {
+  static_assert((kNumSlots & (kNumSlots - 1u)) == 0u,
+                "The number of slots must be a power of two.");
+
+  // Fibonacci hashing, so that the fixed alignments of instructions on some
+  // architectures don't leave most slots unused.
+  const uint64_t key = (addr << 1u) | (is_delayed ? 1u : 0u);
+  return static_cast<size_t>((key * 0x9e3779b97f4a7c15ull) >> 50u) &
+         (kNumSlots - 1u);
+}
+
+// Find the instruction decoded at `addr` from `bytes`.
+const remill::Instruction *
+DecodedInstructionCache::Find(uint64_t addr, bool is_delayed,
+                              const std::string &bytes, bool &decoded) const {
+  if (slots.empty()) {
+    return nullptr;
+  }
+
+  const auto &slot = slots[SlotIndex(addr, is_delayed)];
+  if (!slot.is_used || slot.addr != addr || slot.is_delayed != is_delayed ||
+      slot.bytes != bytes) {
+    return nullptr;
+  }
+
+  decoded = slot.decoded;
+  return &(slot.inst);
+}
+
+// Cache `inst`, which was decoded at `addr` from `bytes`.
+void DecodedInstructionCache::Insert(uint64_t addr, bool is_delayed,
+                                     const std::string &bytes,
+                                     const remill::Instruction &inst,
+                                     bool decoded) {
+  if (slots.empty()) {
+    slots.resize(kNumSlots);
+  }
+
+  auto &slot = slots[SlotIndex(addr, is_delayed)];
+  slot.addr = addr;
+  slot.is_used = true;
+  slot.is_delayed = is_delayed;
+  slot.decoded = decoded;
+  slot.bytes = bytes;
+  slot.inst = inst;
+}
+
+}  // namespace anvill
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <remill/Arch/Instruction.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace anvill {
+
+// A bounded cache of decoded instructions, keyed by address. It's shared by
+// all functions lifted by one entity lifter, so that shared tails,
+// fall-through prologues, thunks, and functions lifted more than once are
+// only decoded once.
+//
+// The cache is direct-mapped: each address maps to one slot, and a newly
+// decoded instruction replaces whatever was in its slot. Its memory is thus
+// bounded by the number of slots, regardless of how much code is lifted.
+class DecodedInstructionCache {
+ public:
+  static constexpr size_t kNumSlots = 1u << 14;
+
+  // Find the instruction decoded at `addr` from `bytes`. Returns `nullptr`
+  // if it isn't cached. Otherwise, `decoded` is set to whether or not
+  // decoding succeeded.
+  //
+  // Entries remember the exact bytes that they were decoded from, so an address
+  // whose bytes have changed, e.g. because more memory was mapped, is decoded
+  // again.
+  const remill::Instruction *Find(uint64_t addr, bool is_delayed,
+                                  const std::string &bytes,
+                                  bool &decoded) const;
+
+  // Cache `inst`, which was decoded at `addr` from `bytes`.
+  void Insert(uint64_t addr, bool is_delayed, const std::string &bytes,
+              const remill::Instruction &inst, bool decoded);
+
+ private:
+  struct Slot {
+    uint64_t addr{0};
+    bool is_used{false};
+    bool is_delayed{false};
+    bool decoded{false};
+    std::string bytes;
+    remill::Instruction inst;
+  };
+
+  static size_t SlotIndex(uint64_t addr, bool is_delayed);
+
+  // Allocated on first use.
+  std::vector<Slot> slots;
+};
+
+}  // namespace anvill
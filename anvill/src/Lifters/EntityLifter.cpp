@@ -17,18 +17,30 @@
 
 #include "EntityLifter.h"
 
+#include <anvill/ABI.h>
+#include <anvill/Optimize.h>
 #include <anvill/Providers/MemoryProvider.h>
 #include <anvill/Providers/TypeProvider.h>
 #include <glog/logging.h>
+#include <llvm/IR/Constants.h>
 #include <llvm/IR/Function.h>
 #include <llvm/IR/GlobalAlias.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instructions.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
 #include <llvm/Transforms/Utils/ModuleUtils.h>
 #include <remill/Arch/Arch.h>
+#include <remill/BC/Compat/Error.h>
 #include <remill/BC/Util.h>
 
+#include <algorithm>
+#include <iterator>
 #include <sstream>
+#include <utility>
+
+#include "SemanticsCache.h"
 
 namespace anvill {
 
@@ -42,8 +54,9 @@ EntityLifterImpl::EntityLifterImpl(
       memory_provider(mem_provider_),
       type_provider(type_provider_),
       value_lifter(options),
-      function_lifter(options, *mem_provider_, *type_provider_),
-      data_lifter(options, *mem_provider_, *type_provider_) {
+      function_lifter(options, *mem_provider_, *type_provider_, decode_cache),
+      data_lifter(options, *mem_provider_, *type_provider_),
+      constant_xref_cache(std::make_shared<ResolvedCrossReferenceCache>()) {
   CHECK_EQ(options.arch->context, &(options.module->getContext()));
   options.arch->PrepareModule(options.module);
 }
@@ -54,13 +67,73 @@ EntityLifterImpl::EntityLifterImpl(
 // view of the world remains consistent.
 void EntityLifterImpl::AddEntity(llvm::Constant *entity, uint64_t address) {
   CHECK_NOTNULL(entity);
-  address_to_entity[address].insert(entity);
-  if (auto [it, added] = entity_to_address.emplace(entity, address); added) {
+  auto &entities = address_to_entity[address];
+  if (std::find(entities.begin(), entities.end(), entity) == entities.end()) {
+    entities.push_back(entity);
+    value_lifter.ForgetPointersTo(address);
+  }
+  if (auto [it, added] = entity_to_address.try_emplace(entity, address);
+      added) {
+    constant_xref_cache->clear();
     if (auto gv = llvm::dyn_cast<llvm::GlobalValue>(entity); gv) {
       llvm::GlobalValue *used[] = {gv};
       llvm::appendToCompilerUsed(*(options.module), used);
     }
+    AddEntityExtent(entity, address);
+  }
+}
+
+// Index the extent of `entity`, if it's a function or variable, so that
+// interior pointers into it can be resolved.
+void EntityLifterImpl::AddEntityExtent(llvm::Constant *entity,
+                                       uint64_t address) {
+  uint64_t size = 0u;
+  if (llvm::isa<llvm::Function>(entity)) {
+    size = 1u;
+
+  } else if (auto var = llvm::dyn_cast<llvm::GlobalVariable>(entity)) {
+    const auto type = var->getValueType();
+    if (type->isSized()) {
+      size = options.module->getDataLayout().getTypeAllocSize(type);
+    }
+  }
+
+  if (!size || (address + size) < address) {
+    return;
+  }
+
+  // Don't let this extent overlap the extent of the entity before it, or of
+  // the one after it.
+  auto next_it = entity_extents.lower_bound(address);
+  if (next_it != entity_extents.end() && next_it->first < (address + size)) {
+    return;
+  }
+
+  if (next_it != entity_extents.begin() &&
+      std::prev(next_it)->second.first > address) {
+    return;
+  }
+
+  entity_extents.emplace_hint(next_it, address,
+                              std::make_pair(address + size, entity));
+}
+
+// Returns the lifted function or variable whose extent contains `address`,
+// along with the offset of `address` into it, or `{nullptr, 0}`.
+std::pair<llvm::Constant *, uint64_t>
+EntityLifterImpl::EntityContainingAddress(uint64_t address) const {
+  auto it = entity_extents.upper_bound(address);
+  if (it == entity_extents.begin()) {
+    return {nullptr, 0u};
   }
+
+  --it;
+  const auto [end, entity] = it->second;
+  if (address >= end) {
+    return {nullptr, 0u};
+  }
+
+  return {entity, address - it->first};
 }
 
 // Assuming that `entity` is an entity that was lifted by this `EntityLifter`,
@@ -76,17 +149,6 @@ EntityLifterImpl::AddressOfEntity(llvm::Constant *entity) const {
   }
 }
 
-// Applies a callback `cb` to each entity at a specified address.
-void EntityLifterImpl::ForEachEntityAtAddress(
-    uint64_t address, std::function<void(llvm::Constant *)> cb) const {
-  if (auto it = address_to_entity.find(address);
-      it != address_to_entity.end()) {
-    for (auto gv : it->second) {
-      cb(gv);
-    }
-  }
-}
-
 EntityLifter::~EntityLifter(void) {}
 
 EntityLifter::EntityLifter(
@@ -103,6 +165,23 @@ EntityLifter::AddressOfEntity(llvm::Constant *entity) const {
   return impl->AddressOfEntity(entity);
 }
 
+// Return the lifted function or variable whose extent contains `address`,
+// along with the offset of `address` into it, or `{nullptr, 0}`.
+std::pair<llvm::Constant *, uint64_t>
+EntityLifter::EntityContainingAddress(uint64_t address) const {
+  return impl->EntityContainingAddress(address);
+}
+
+// Tell this entity lifter that `entity` is the lifted function or variable at
+// `address`.
+void EntityLifter::AddEntity(llvm::Constant *entity, uint64_t address) const {
+  CHECK_NOTNULL(entity);
+  if (auto gv = llvm::dyn_cast<llvm::GlobalValue>(entity)) {
+    CHECK_EQ(gv->getParent(), impl->options.module);
+  }
+  impl->AddEntity(entity, address);
+}
+
 // Return the options being used by this entity lifter.
 const LifterOptions &EntityLifter::Options(void) const {
   return impl->options;
@@ -113,4 +192,96 @@ TypeProvider &EntityLifter::TypeProvider(void) const {
   return *(impl->type_provider);
 }
 
+// Lift and optimize a function into a module of its own.
+std::unique_ptr<llvm::Module>
+EntityLifter::LiftAndOptimizeFunction(const FunctionDecl &decl) const {
+  return LiftAndOptimizeFunction(
+      decl, OptimizationPipeline::Create(OptimizationLevel::kDefault));
+}
+
+// Lift and optimize a function into a module of its own.
+std::unique_ptr<llvm::Module> EntityLifter::LiftAndOptimizeFunction(
+    const FunctionDecl &decl, const OptimizationPipeline &pipeline) const {
+  const auto func = LiftEntity(decl);
+  if (!func || func->isDeclaration()) {
+    return nullptr;
+  }
+
+  OptimizeFunction(*this, *func, impl->options, pipeline);
+  if (func->isDeclaration()) {
+    return nullptr;  // Went over an optimization budget.
+  }
+
+  const auto &module = *impl->options.module;
+  auto func_module =
+      std::make_unique<llvm::Module>(func->getName(), module.getContext());
+  func_module->setDataLayout(module.getDataLayout());
+  func_module->setTargetTriple(module.getTargetTriple());
+
+  auto new_func = llvm::Function::Create(
+      func->getFunctionType(), llvm::GlobalValue::ExternalLinkage,
+      func->getName(), func_module.get());
+  remill::CloneFunctionInto(func, new_func);
+
+  // Semantics functions that were too big to be inlined are still called by
+  // the lifted function, so copy their bodies, and whatever they call, into
+  // the new module too. Other lifted functions are left as declarations.
+  std::vector<llvm::Function *> callers{new_func};
+  while (!callers.empty()) {
+    auto caller = callers.back();
+    callers.pop_back();
+    for (auto &inst : llvm::instructions(*caller)) {
+      auto call = llvm::dyn_cast<llvm::CallBase>(&inst);
+      if (!call) {
+        continue;
+      }
+
+      auto callee = call->getCalledFunction();
+      if (!callee || !callee->isDeclaration() || callee->isIntrinsic()) {
+        continue;
+      }
+
+      auto source = module.getFunction(callee->getName());
+      if (!source || impl->AddressOfEntity(source)) {
+        continue;
+      }
+
+      if (auto err = source->materialize(); remill::IsError(err)) {
+        LOG(ERROR) << remill::GetErrorString(err);
+        continue;
+      }
+
+      if (!source->isDeclaration()) {
+        remill::CloneFunctionInto(source, callee);
+        callers.push_back(callee);
+      }
+    }
+  }
+
+  // Get rid of all final uses of `__anvill_pc`, as `OptimizeModule` would.
+  if (auto anvill_pc = func_module->getGlobalVariable(kSymbolicPCName)) {
+    remill::ReplaceAllUsesOfConstant(
+        anvill_pc, llvm::Constant::getNullValue(anvill_pc->getType()),
+        func_module.get());
+  }
+
+  func->deleteBody();
+  return func_module;
+}
+
+// Load and cache the instruction semantics of `arch`.
+void EntityLifter::PreloadSemantics(const remill::Arch *arch) {
+  (void) CachedArchSemanticsHash(arch);
+}
+
+// Returns the number of bytes of cached instruction semantics.
+uint64_t EntityLifter::SemanticsCacheBytes(void) {
+  return CachedArchSemanticsBytes();
+}
+
+// Load instruction semantics from the pruned modules in `dir`.
+void EntityLifter::SetPrunedSemanticsDirectory(std::string dir) {
+  anvill::SetPrunedSemanticsDirectory(std::move(dir));
+}
+
 }  // namespace anvill
@@ -22,13 +22,17 @@
 #include <anvill/Providers/MemoryProvider.h>
 #include <anvill/Providers/TypeProvider.h>
 
-#include <functional>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallVector.h>
+
+#include <map>
 #include <unordered_map>
-#include <unordered_set>
 #include <utility>
 #include <vector>
 
+#include "Analysis/ResolvedCrossReferenceCache.h"
 #include "DataLifter.h"
+#include "DecodedInstructionCache.h"
 #include "FunctionLifter.h"
 #include "ValueLifter.h"
 
@@ -58,15 +62,29 @@ class EntityLifterImpl {
   // view of the world remains consistent.
   void AddEntity(llvm::Constant *entity, uint64_t address);
 
-  // Applies a callback `cb` to each entity at a specified address.
-  void ForEachEntityAtAddress(uint64_t address,
-                              std::function<void(llvm::Constant *)> cb) const;
+  // Applies a callback `cb` to each entity at a specified address. Entities
+  // are visited in the order in which they were added.
+  template <typename CB>
+  void ForEachEntityAtAddress(uint64_t address, CB &&cb) const {
+    if (auto it = address_to_entity.find(address);
+        it != address_to_entity.end()) {
+      for (auto entity : it->second) {
+        cb(entity);
+      }
+    }
+  }
 
   // Assuming that `entity` is an entity that was lifted by this `EntityLifter`,
   // then return the address of that entity in the binary being lifted.
   std::optional<uint64_t> AddressOfEntity(llvm::Constant *entity) const;
 
+  // Returns the lifted function or variable whose extent contains `address`,
+  // along with the offset of `address` into it, or `{nullptr, 0}`.
+  std::pair<llvm::Constant *, uint64_t>
+  EntityContainingAddress(uint64_t address) const;
+
  private:
+  friend class CrossReferenceResolver;
   friend class EntityLifter;
   friend class DataLifter;
   friend class FunctionLifter;
@@ -75,6 +93,8 @@ class EntityLifterImpl {
 
   EntityLifterImpl(void) = delete;
 
+  void AddEntityExtent(llvm::Constant *entity, uint64_t address);
+
   // Options used to guide how lifting should occur.
   const LifterOptions &options;
 
@@ -89,6 +109,11 @@ class EntityLifterImpl {
   // embedded in initialziers.
   ValueLifterImpl value_lifter;
 
+  // Instructions decoded while lifting functions. It's shared across all
+  // lifted functions, so that code reachable from several functions is only
+  // decoded once.
+  DecodedInstructionCache decode_cache;
+
   // Used to lift functions.
   FunctionLifter function_lifter;
 
@@ -98,11 +123,32 @@ class EntityLifterImpl {
 
   // Maps native code addresses to lifted entities. The lifted entities reside
   // in the `options.module` module.
-  std::unordered_map<uint64_t, std::unordered_set<llvm::Constant *>>
+  //
+  // There are usually only one or two entities at any given address, e.g. a
+  // function and an alias of it, so they're kept inline in a small vector
+  // rather than in a node-based set. This isn't an `llvm::DenseMap`, as that
+  // reserves two keys, and entities can be at any address.
+  std::unordered_map<uint64_t, llvm::SmallVector<llvm::Constant *, 2>>
       address_to_entity;
 
-  // Maps lifted entities to native addresses. The lifted
-  std::unordered_map<llvm::Constant *, uint64_t> entity_to_address;
+  // Maps lifted entities to native addresses.
+  llvm::DenseMap<llvm::Constant *, uint64_t> entity_to_address;
+
+  // Maps the start address of each lifted function and variable to the end
+  // address of its extent, i.e. `[address, address + size)`, and to the
+  // entity itself. Functions are one byte long, as only their entry points
+  // can be referenced. This answers "which entity contains this address" for
+  // interior pointers without going back to the declarations.
+  //
+  // Extents don't overlap; an entity that would overlap an already indexed one
+  // is left out of this index, though it is still in `address_to_entity`.
+  std::map<uint64_t, std::pair<uint64_t, llvm::Constant *>> entity_extents;
+
+  // Cross-references resolved from constants in `options.module`. This is
+  // shared by all cross-reference resolvers made from this entity lifter.
+  // What a constant resolves to depends on which entities are known, so
+  // it's cleared whenever a new entity is added.
+  const std::shared_ptr<ResolvedCrossReferenceCache> constant_xref_cache;
 };
 
 }  // namespace anvill
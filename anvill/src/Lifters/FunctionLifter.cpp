@@ -18,12 +18,17 @@
 #include "FunctionLifter.h"
 
 #include <anvill/ABI.h>
+#include <anvill/Counters.h>
 #include <anvill/ITypeSpecification.h>
 #include <anvill/Lifters/DeclLifter.h>
+#include <anvill/Provenance.h>
 #include <anvill/Providers/MemoryProvider.h>
 #include <anvill/Providers/TypeProvider.h>
+#include <anvill/Trace.h>
+#include <anvill/Util.h>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <llvm/ADT/Twine.h>
 #include <llvm/IR/BasicBlock.h>
 #include <llvm/IR/DerivedTypes.h>
 #include <llvm/IR/Function.h>
@@ -31,15 +36,18 @@
 #include <llvm/IR/InstIterator.h>
 #include <llvm/IR/Instruction.h>
 #include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
 #include <llvm/IR/Intrinsics.h>
 #include <llvm/IR/LegacyPassManager.h>
 #include <llvm/IR/Module.h>
+#include <llvm/IR/Operator.h>
 #include <llvm/IR/Type.h>
 #include <llvm/IR/Verifier.h>
 #include <llvm/Transforms/InstCombine/InstCombine.h>
 #include <llvm/Transforms/Scalar.h>
 #include <llvm/Transforms/Utils.h>
 #include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/ValueMapper.h>
 #include <remill/Arch/Arch.h>
 #include <remill/Arch/Instruction.h>
 #include <remill/BC/Compat/Error.h>
@@ -47,33 +55,52 @@
 #include <remill/BC/Version.h>
 #include <remill/OS/OS.h>
 
+#include <algorithm>
+#include <deque>
+#include <functional>
 #include <sstream>
-#include <unordered_set>
+#include <thread>
+#include <unordered_map>
 
+#include "DecodedInstructionCache.h"
 #include "EntityLifter.h"
+#include "SemanticsCache.h"
 
 namespace anvill {
 namespace {
 
-// Clear out LLVM variable names. They're usually not helpful.
-static void ClearVariableNames(llvm::Function *func) {
-  for (auto &block : *func) {
-    block.setName(llvm::Twine::createNull());
-    for (auto &inst : block) {
-      if (inst.hasName()) {
-        inst.setName(llvm::Twine::createNull());
-      }
-    }
+// Functions whose lifting decodes this many instructions one at a time get
+// the code that follows swept by the speculative decoder, this many bytes at
+// a time.
+static constexpr unsigned kSpeculativeDecodeThreshold = 1024u;
+static constexpr size_t kSpeculativeDecodeWindowSize = 128u * 1024u;
+
+// Number of bytes of code at the start of a block to hint to the memory
+// provider when the block is added to the work list, so that they're likely
+// to be available by the time it is decoded.
+static constexpr size_t kBlockPrefetchSize = 256u;
+
+// Create a basic block in `func`. Its name is only formatted and kept if
+// `options` wants names.
+static llvm::BasicBlock *CreateBlock(const LifterOptions &options,
+                                     llvm::LLVMContext &context,
+                                     const llvm::Twine &name,
+                                     llvm::Function *func) {
+  if (options.discard_value_names) {
+    return llvm::BasicBlock::Create(context, "", func);
+  } else {
+    return llvm::BasicBlock::Create(context, name, func);
   }
 }
 
-// Compatibility function for performing a single step of inlining.
-static llvm::InlineResult InlineFunction(llvm::CallBase *call,
-                                         llvm::InlineFunctionInfo &info) {
+// Compatibility function for performing a single step of inlining. Returns
+// `true` if `call` was inlined.
+static bool InlineFunction(llvm::CallBase *call,
+                           llvm::InlineFunctionInfo &info) {
 #if LLVM_VERSION_NUMBER < LLVM_VERSION(11, 0)
-  return llvm::InlineFunction(call, info);
+  return static_cast<bool>(llvm::InlineFunction(call, info));
 #else
-  return llvm::InlineFunction(*call, info);
+  return llvm::InlineFunction(*call, info).isSuccess();
 #endif
 }
 
@@ -157,17 +184,78 @@ static void AnnotateInstructions(llvm::BasicBlock *block, unsigned id,
   }
 }
 
+// Annotate the instructions of `block` that follow `prev_inst`, or all of
+// them if `prev_inst` is null, with the `id` annotation if they are
+// unannotated.
+static void AnnotateInstructionsAfter(llvm::BasicBlock *block,
+                                      llvm::Instruction *prev_inst, unsigned id,
+                                      llvm::MDNode *annot) {
+  if (annot) {
+    auto it = prev_inst ? std::next(prev_inst->getIterator()) : block->begin();
+    for (auto &inst : llvm::make_range(it, block->end())) {
+      AnnotateInstruction(&inst, id, annot);
+    }
+  }
+}
+
+// Returns the key of `edge_to_dest_block` for the edge `from_pc -> addr`.
+// Edges from other instructions back into the entrypoint of the function at
+// `func_address` are self-tail-calls, and each one gets its own block.
+static std::pair<uint64_t, uint64_t> BlockKey(uint64_t func_address,
+                                              uint64_t from_pc, uint64_t addr) {
+  if (addr == func_address && from_pc) {
+    return {from_pc, addr};
+  } else {
+    return {0, addr};
+  }
+}
+
+// Returns `true` if `a` and `b` take their parameters, and leave their return
+// values, in the same places.
+static bool HaveSameLocations(const ValueDecl &a, const ValueDecl &b) {
+  return a.type == b.type && a.reg == b.reg && a.mem_reg == b.mem_reg &&
+         a.mem_offset == b.mem_offset;
+}
+
+static bool HaveSameLocations(const FunctionDecl &a, const FunctionDecl &b) {
+  if (a.params.size() != b.params.size() ||
+      a.returns.size() != b.returns.size() ||
+      !HaveSameLocations(a.return_address, b.return_address) ||
+      a.return_stack_pointer != b.return_stack_pointer ||
+      a.return_stack_pointer_offset != b.return_stack_pointer_offset ||
+      a.is_variadic != b.is_variadic ||
+      a.calling_convention != b.calling_convention) {
+    return false;
+  }
+
+  for (auto i = 0u; i < a.params.size(); ++i) {
+    if (!HaveSameLocations(a.params[i], b.params[i])) {
+      return false;
+    }
+  }
+
+  for (auto i = 0u; i < a.returns.size(); ++i) {
+    if (!HaveSameLocations(a.returns[i], b.returns[i])) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
 }  // namespace
 
 FunctionLifter::~FunctionLifter(void) {}
 
 FunctionLifter::FunctionLifter(const LifterOptions &options_,
                                MemoryProvider &memory_provider_,
-                               TypeProvider &type_provider_)
+                               TypeProvider &type_provider_,
+                               DecodedInstructionCache &decode_cache_)
     : options(options_),
       memory_provider(memory_provider_),
       type_provider(type_provider_),
-      semantics_module(remill::LoadArchSemantics(options.arch)),
+      decode_cache(decode_cache_),
+      semantics_module(LoadCachedArchSemantics(options.arch)),
       llvm_context(semantics_module->getContext()),
       intrinsics(semantics_module.get()),
       inst_lifter(options.arch, intrinsics),
@@ -176,6 +264,7 @@ FunctionLifter::FunctionLifter(const LifterOptions &options_,
       sp_reg(options.arch->RegisterByName(
           options.arch->StackPointerRegisterName())),
       is_sparc(options.arch->IsSPARC32() || options.arch->IsSPARC64()),
+      has_delay_slots(is_sparc),
       is_x86_or_amd64(options.arch->IsX86() || options.arch->IsAMD64()),
       i8_type(llvm::Type::getInt8Ty(llvm_context)),
       i8_zero(llvm::Constant::getNullValue(i8_type)),
@@ -193,6 +282,15 @@ FunctionLifter::FunctionLifter(const LifterOptions &options_,
   if (options.pc_metadata_name) {
     pc_annotation_id = llvm_context.getMDKindID(options.pc_metadata_name);
   }
+
+  if (options.track_provenance) {
+    provenance_id = llvm_context.getMDKindID(kProvenanceMetadataName);
+  }
+
+  num_decode_threads = options.num_decode_threads;
+  if (!num_decode_threads) {
+    num_decode_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
 }
 
 // Helper to get the basic block to contain the instruction at `addr`. This
@@ -201,20 +299,33 @@ FunctionLifter::FunctionLifter(const LifterOptions &options_,
 // instruction.
 llvm::BasicBlock *FunctionLifter::GetOrCreateBlock(uint64_t addr) {
   const auto from_pc = curr_inst ? curr_inst->pc : 0;
-  auto &block = edge_to_dest_block[{from_pc, addr}];
+  const auto key = BlockKey(func_address, from_pc, addr);
+  auto &block = edge_to_dest_block[key];
   if (block) {
     return block;
   }
 
-  std::stringstream ss;
-  ss << "inst_" << std::hex << addr;
-  block = llvm::BasicBlock::Create(llvm_context, ss.str(), lifted_func);
+  // Block names are formatted via a `Twine`, rather than via a
+  // `std::stringstream`, so that no temporary strings are allocated; LLVM
+  // copies the name into its own storage.
+  block = CreateBlock(options, llvm_context,
+                      "inst_" + llvm::Twine::utohexstr(addr), lifted_func);
 
-  // NOTE(pag): We always add to the work list without consulting/updating
-  //            `addr_to_block` so that we can observe self-tail-calls and
-  //            lift them as such, rather than as jumps back into the first
-  //            lifted block.
-  edge_work_list.emplace(addr, from_pc);
+  // The instruction was already lifted into the middle of a block by way of
+  // a fall-through; the block will be split there once all instructions
+  // are lifted.
+  //
+  // Self-tail-calls are always added to the work list, so that they're lifted
+  // as such, rather than as jumps back into the first lifted block.
+  if (!key.first && addr_to_inst.count(addr)) {
+    pending_splits.emplace_back(block, addr);
+    return block;
+  }
+
+  memory_provider.Prefetch(addr, kBlockPrefetchSize);
+  edge_work_list.emplace_back(addr, from_pc);
+  std::push_heap(edge_work_list.begin(), edge_work_list.end(),
+                 std::greater<>());
 
   return block;
 }
@@ -236,35 +347,211 @@ bool FunctionLifter::DecodeInstructionInto(const uint64_t addr, bool is_delayed,
   // architecture. For x86(-64), this is 15 bytes, whereas for fixed-width
   // architectures like AArch32/AArch64 and SPARC32/SPARC64, this is 4 bytes.
   inst_out->bytes.reserve(max_inst_size);
+  ReadExecutableBytes(addr, max_inst_size, inst_out->bytes);
+
+  // The same instructions are often decoded many times, e.g. when functions
+  // share tails, or fall through into one another, so check if we've already
+  // decoded these exact bytes at this address.
+  bool decoded = false;
+  if (auto cached_inst =
+          decode_cache.Find(addr, is_delayed, inst_out->bytes, decoded)) {
+    IncrementCounter(Counter::kDecodeCacheHits);
+    *inst_out = *cached_inst;
+    return decoded;
+  }
+
+  IncrementCounter(Counter::kDecodeCacheMisses);
+
+  // Check if this instruction was decoded ahead of time, as part of a linear
+  // sweep of the code that follows what was decoded before it.
+  if (!is_delayed) {
+    if (auto swept_inst =
+            speculative_decoder.Find(addr, inst_out->bytes, decoded)) {
+      *inst_out = *swept_inst;
+      decode_cache.Insert(addr, is_delayed, inst_out->bytes, *inst_out,
+                          decoded);
+      return decoded;
+    }
+  }
 
-  auto accumulate_inst_byte = [=](auto byte, auto accessible, auto perms) {
-    switch (accessible) {
-      case ByteAvailability::kUnknown:
-      case ByteAvailability::kUnavailable: return false;
-      default:
-        switch (perms) {
-          case BytePermission::kUnknown:
-          case BytePermission::kReadableExecutable:
-          case BytePermission::kReadableWritableExecutable:
-            inst_out->bytes.push_back(static_cast<char>(byte));
-            return true;
-          case BytePermission::kReadable:
-          case BytePermission::kReadableWritable: return false;
-        }
+  // Decoding can modify `inst_out->bytes`, e.g. to trim it to the size of the
+  // decoded instruction, so keep hold of what we read for use as the cache key.
+  std::string read_bytes = inst_out->bytes;
+  if (is_delayed) {
+    decoded = options.arch->DecodeDelayedInstruction(addr, inst_out->bytes,
+                                                     *inst_out);
+  } else {
+    decoded =
+        options.arch->DecodeInstruction(addr, inst_out->bytes, *inst_out);
+  }
+
+  decode_cache.Insert(addr, is_delayed, read_bytes, *inst_out, decoded);
+
+  // Only functions with many instructions are worth decoding in parallel, so
+  // the code after this instruction is swept once enough instructions have
+  // been decoded one at a time.
+  if (num_decode_threads > 1u && !is_delayed &&
+      ++num_serial_decodes >= kSpeculativeDecodeThreshold) {
+    num_serial_decodes = 0u;
+    std::string swept_bytes;
+    ReadExecutableBytes(addr, kSpeculativeDecodeWindowSize, swept_bytes);
+    speculative_decoder.Sweep(options.arch, addr, std::move(swept_bytes),
+                              num_decode_threads);
+  }
+
+  return decoded;
+}
+
+// Read up to `max_size` bytes of code starting at `addr` into `bytes`, after
+// whatever is already in `bytes`. Reading stops at the first byte that isn't
+// available or executable.
+void FunctionLifter::ReadExecutableBytes(uint64_t addr, size_t max_size,
+                                         std::string &bytes) {
+
+  // Each run of bytes returned by `QueryRange` shares the same availability
+  // and permissions, so usually a single query is enough to read a whole
+  // instruction.
+  const auto start_size = bytes.size();
+  while ((bytes.size() - start_size) < max_size) {
+    const auto num_bytes = bytes.size() - start_size;
+    auto [run_size, accessible, perms] = memory_provider.QueryRange(
+        addr + num_bytes, max_size - num_bytes, bytes);
+
+    if (!run_size || !MemoryProvider::HasByte(accessible)) {
+      break;
+    }
+
+    switch (perms) {
+      case BytePermission::kUnknown:
+      case BytePermission::kReadableExecutable:
+      case BytePermission::kReadableWritableExecutable: continue;
+      case BytePermission::kReadable:
+      case BytePermission::kReadableWritable: break;
+    }
+
+    // Take back the bytes that aren't executable.
+    bytes.resize(bytes.size() - run_size);
+    break;
+  }
+}
+
+// Returns a key describing the shape of the lifted code of `inst`.
+std::string
+FunctionLifter::InstructionTemplateKey(const remill::Instruction &inst) const {
+  auto is_pc = [=](const std::string &reg_name) {
+    return reg_name == pc_reg->name || reg_name == remill::kPCVariableName ||
+           reg_name == remill::kNextPCVariableName;
+  };
+
+  std::string key = inst.function;
+  key += ':';
+  key += std::to_string(inst.bytes.size());
+  for (const auto &op : inst.operands) {
+
+    // Remill computes PC-relative addresses from the PC in the `State`
+    // structure, but don't rely on it never folding the instruction's address
+    // into the lifted code.
+    if (op.type == remill::Operand::kTypeAddress &&
+        (is_pc(op.addr.base_reg.name) || is_pc(op.addr.index_reg.name))) {
+      return {};
+    }
+
+    key += ' ';
+    key += op.Serialize();
+  }
+  return key;
+}
+
+// Lift `inst` into `block`, possibly by stamping out a copy of the code lifted
+// for an earlier instruction with the same shape.
+void FunctionLifter::LiftInstructionIntoBlock(remill::Instruction &inst,
+                                              llvm::BasicBlock *block) {
+  std::string key;
+  if (options.lift_from_instruction_templates) {
+    key = InstructionTemplateKey(inst);
+  }
+
+  // Even when something isn't supported or is invalid, we still lift
+  // a call to a semantic, e.g.`INVALID_INSTRUCTION`, so we really want
+  // to treat instruction lifting as an operation that can't fail.
+  if (key.empty()) {
+    (void) inst_lifter.LiftIntoBlock(inst, block, state_ptr,
+                                     false /* is_delayed */);
+    return;
+  }
+
+  auto &template_insts = inst_templates[key];
+  if (!template_insts.empty()) {
+    if (!template_insts.front()) {
+      (void) inst_lifter.LiftIntoBlock(inst, block, state_ptr,
+                                       false /* is_delayed */);
+      return;
+    }
+
+    // Clone the template. Operands that aren't part of the template, e.g.
+    // the state pointer or register pointers in the entry block, are shared
+    // with the template.
+    llvm::ValueToValueMapTy value_map;
+    for (auto template_inst : template_insts) {
+      auto new_inst = template_inst->clone();
+      block->getInstList().push_back(new_inst);
+      if (template_inst->hasName()) {
+        new_inst->setName(template_inst->getName());
+      }
+      if (options.pc_metadata_name) {
+        new_inst->setMetadata(pc_annotation_id, nullptr);
+      }
+      value_map[template_inst] = new_inst;
+      llvm::RemapInstruction(new_inst, value_map,
+                             llvm::RF_NoModuleLevelChanges |
+                                 llvm::RF_IgnoreMissingLocals);
+    }
+    return;
+  }
+
+  // Straight-line code is lifted into a single block, so `block` may already
+  // hold the code of many instructions.
+  const auto prev_inst = block->empty() ? nullptr : &(block->back());
+  (void) inst_lifter.LiftIntoBlock(inst, block, state_ptr,
+                                   false /* is_delayed */);
+
+  // The lifted instructions can be used as a template if they only depend on
+  // each other, and on things that dominate every block, i.e. arguments,
+  // globals, and the entry block.
+  const auto entry_block = &(lifted_func->getEntryBlock());
+  auto can_be_template = [&](llvm::Instruction &lifted_inst) {
+    if (llvm::isa<llvm::PHINode>(lifted_inst) ||
+        llvm::isa<llvm::AllocaInst>(lifted_inst) ||
+        lifted_inst.isTerminator()) {
+      return false;
+    }
+    for (auto &op : lifted_inst.operands()) {
+      auto op_inst = llvm::dyn_cast<llvm::Instruction>(op.get());
+      if (!op_inst || op_inst->getParent() == entry_block) {
+        continue;
+      }
+      if (std::find(template_insts.begin(), template_insts.end(), op_inst) ==
+          template_insts.end()) {
+        return false;
+      }
     }
+    return true;
   };
 
-  for (auto i = 0u; i < max_inst_size; ++i) {
-    if (!std::apply(accumulate_inst_byte, memory_provider.Query(addr + i))) {
-      break;
+  for (auto &lifted_inst :
+       llvm::make_range(prev_inst ? std::next(prev_inst->getIterator())
+                                  : block->begin(),
+                        block->end())) {
+    if (!can_be_template(lifted_inst)) {
+      template_insts.assign(1u, nullptr);
+      return;
     }
+    template_insts.push_back(&lifted_inst);
   }
 
-  if (is_delayed) {
-    return options.arch->DecodeDelayedInstruction(addr, inst_out->bytes,
-                                                  *inst_out);
-  } else {
-    return options.arch->DecodeInstruction(addr, inst_out->bytes, *inst_out);
+  // Nothing was lifted, so there's nothing to clone.
+  if (template_insts.empty()) {
+    template_insts.push_back(nullptr);
   }
 }
 
@@ -289,10 +576,29 @@ void FunctionLifter::VisitError(const remill::Instruction &inst,
 
 // Visit a normal instruction. Normal instructions have straight line control-
 // flow semantics, i.e. after executing the instruction, execution proceeds
-// to the next instruction (`inst.next_pc`).
+// to the next instruction (`inst.next_pc`). If possible, the next instruction
+// is lifted into `block` as well, rather than into a block of its own.
 void FunctionLifter::VisitNormal(const remill::Instruction &inst,
                                  llvm::BasicBlock *block) {
-  llvm::BranchInst::Create(GetOrCreateTargetBlock(inst.next_pc), block);
+  const auto next_pc = options.ctrl_flow_provider->GetRedirection(inst.next_pc);
+  if (CanFallThroughInto(next_pc)) {
+    fall_through_pc = next_pc;
+  } else {
+    llvm::BranchInst::Create(GetOrCreateBlock(next_pc), block);
+  }
+}
+
+// Returns `true` if the instruction at `addr` can be lifted into the same
+// block as the instruction that falls through into it.
+//
+// Fall-throughs into other functions are lifted as tail-calls, in the blocks of
+// the edges into them. See `VisitInstructions`.
+bool FunctionLifter::CanFallThroughInto(uint64_t addr) {
+  if (addr == func_address || addr_to_inst.count(addr) ||
+      edge_to_dest_block.count(BlockKey(func_address, 0, addr))) {
+    return false;
+  }
+  return !IsTargetFunctionHead(addr);
 }
 
 // Visit a no-op instruction. These behave identically to normal instructions
@@ -343,12 +649,19 @@ void FunctionLifter::VisitIndirectJump(const remill::Instruction &inst,
   if (maybe_target_list.has_value()) {
     const auto &target_list = maybe_target_list.value();
 
+    // Jump tables often repeat targets, e.g. for the many cases that lead to
+    // a `default:` label, so only look at each distinct target once.
+    auto destinations = target_list.destination_list;
+    std::sort(destinations.begin(), destinations.end());
+    destinations.erase(std::unique(destinations.begin(), destinations.end()),
+                       destinations.end());
+
     // If the target list is complete and has only one destination, then we
     // can handle it as normal jump
-    if (target_list.destination_list.size() == 1U && target_list.complete) {
+    if (destinations.size() == 1U && target_list.complete) {
       add_remill_jump = false;
 
-      auto destination = target_list.destination_list.front();
+      auto destination = destinations.front();
       llvm::BranchInst::Create(GetOrCreateTargetBlock(destination), block);
 
     // We have multiple destinations. Handle this with a switch. If the target
@@ -374,37 +687,50 @@ void FunctionLifter::VisitIndirectJump(const remill::Instruction &inst,
         current_bb = default_case;
       }
 
-      // Create the parameters for the special anvill switch
       auto pc = inst_lifter.LoadRegValue(
           block, state_ptr, options.arch->ProgramCounterRegisterName());
 
-      std::vector<llvm::Value *> switch_parameters;
-      switch_parameters.push_back(pc);
+      llvm::IRBuilder<> ir(block);
+      const auto dest_count = destinations.size();
+
+      // Concrete program counters can be switched on directly, with one
+      // case per distinct target address.
+      if (!options.symbolic_program_counter) {
+        auto switch_inst = ir.CreateSwitch(pc, default_case, dest_count);
+        for (auto dest : destinations) {
+          switch_inst->addCase(llvm::ConstantInt::get(address_type, dest),
+                               GetOrCreateTargetBlock(dest));
+        }
 
-      for (auto destination : target_list.destination_list) {
-        auto dest_as_value = GenerateProgramCounter(block, destination);
-        switch_parameters.push_back(dest_as_value);
-      }
+      // Symbolic program counters are constant expressions, and so can't be
+      // switch cases. Instead, go through the special anvill switch, which
+      // maps the program counter to the index of its target.
+      } else {
+        std::vector<llvm::Value *> switch_parameters;
+        switch_parameters.reserve(dest_count + 1u);
+        switch_parameters.push_back(pc);
 
-      // Invoke the anvill switch
-      auto &module = *block->getModule();
-      auto anvill_switch_func =
-          GetAnvillSwitchFunc(module, address_type, target_list.complete);
+        for (auto destination : destinations) {
+          auto dest_as_value = GenerateProgramCounter(block, destination);
+          switch_parameters.push_back(dest_as_value);
+        }
 
-      llvm::IRBuilder<> ir(block);
-      auto next_pc = ir.CreateCall(anvill_switch_func, switch_parameters);
+        // Invoke the anvill switch
+        auto &module = *block->getModule();
+        auto anvill_switch_func =
+            GetAnvillSwitchFunc(module, address_type, target_list.complete);
 
-      // Now use the anvill switch output with a SwitchInst, mapping cases
-      // by index
-      auto dest_count = target_list.destination_list.size();
-      auto switch_inst = ir.CreateSwitch(next_pc, default_case, dest_count);
+        auto next_pc = ir.CreateCall(anvill_switch_func, switch_parameters);
 
-      for (std::size_t dest_id{0U}; dest_id < dest_count; ++dest_id) {
-        auto dest = target_list.destination_list.at(dest_id);
-        auto dest_block = GetOrCreateTargetBlock(dest);
+        // Now use the anvill switch output with a SwitchInst, mapping cases
+        // by index
+        auto switch_inst = ir.CreateSwitch(next_pc, default_case, dest_count);
 
-        auto dest_id_as_value = llvm::ConstantInt::get(address_type, dest_id);
-        switch_inst->addCase(dest_id_as_value, dest_block);
+        for (std::size_t dest_id{0U}; dest_id < dest_count; ++dest_id) {
+          auto dest_block = GetOrCreateTargetBlock(destinations[dest_id]);
+          auto dest_id_as_value = llvm::ConstantInt::get(address_type, dest_id);
+          switch_inst->addCase(dest_id_as_value, dest_block);
+        }
       }
     }
   }
@@ -470,28 +796,36 @@ void FunctionLifter::VisitConditionalFunctionReturn(
                            not_taken_block);
 }
 
-std::optional<FunctionDecl>
+// Returns `true` if `TryGetTargetFunctionType` would find a decl for
+// `address`. This is much cheaper, as no decl is copied or redirected.
+bool FunctionLifter::IsTargetFunctionHead(std::uint64_t address) {
+  const auto redirected_addr =
+      options.ctrl_flow_provider->GetRedirection(address);
+  return type_provider.IsFunctionHead(redirected_addr) ||
+         (redirected_addr != address && type_provider.IsFunctionHead(address));
+}
+
+std::shared_ptr<const FunctionDecl>
 FunctionLifter::TryGetTargetFunctionType(std::uint64_t address) {
   auto redirected_addr = options.ctrl_flow_provider->GetRedirection(address);
 
   // In case we get redirected but still fail, try once more with the original
   // address
-  auto opt_function_decl = type_provider.TryGetFunctionType(redirected_addr);
-  if (!opt_function_decl.has_value() && redirected_addr != address) {
+  auto function_decl = type_provider.TryGetFunctionType(redirected_addr);
+  if (!function_decl && redirected_addr != address) {
 
     // When we retry using the original address, still keep the (possibly)
     // redirected value
-    opt_function_decl = type_provider.TryGetFunctionType(address);
-  }
-
-  if (!opt_function_decl.has_value()) {
-    return std::nullopt;
+    function_decl = type_provider.TryGetFunctionType(address);
   }
 
   // The `redirected_addr` value can either be the original one or the
-  // redirected address
-  auto function_decl = opt_function_decl.value();
-  function_decl.address = redirected_addr;
+  // redirected address. Only copy the decl when we need to change it.
+  if (function_decl && function_decl->address != redirected_addr) {
+    auto redirected_decl = std::make_shared<FunctionDecl>(*function_decl);
+    redirected_decl->address = redirected_addr;
+    function_decl = std::move(redirected_decl);
+  }
 
   return function_decl;
 }
@@ -506,10 +840,11 @@ void FunctionLifter::CallFunction(const remill::Instruction &inst,
   // equivalent to a tail-call in the original code.
   const auto maybe_other_decl = TryGetTargetFunctionType(inst.branch_taken_pc);
 
-  if (maybe_other_decl.has_value()) {
-    auto other_decl = maybe_other_decl.value();
+  if (maybe_other_decl) {
+    const auto &other_decl = *maybe_other_decl;
 
     if (const auto other_func = DeclareFunction(other_decl)) {
+      NoteReferencedFunction(other_decl.address);
       const auto mem_ptr_from_call =
           TryCallNativeFunction(other_decl.address, other_func, block);
 
@@ -710,14 +1045,10 @@ FunctionLifter::LoadFunctionReturnAddress(const remill::Instruction &inst,
 void FunctionLifter::VisitAfterFunctionCall(const remill::Instruction &inst,
                                             llvm::BasicBlock *block) {
   const auto [ret_pc, ret_pc_val] = LoadFunctionReturnAddress(inst, block);
-  const auto pc_ptr =
-      inst_lifter.LoadRegAddress(block, state_ptr, remill::kPCVariableName);
-  const auto next_pc_ptr =
-      inst_lifter.LoadRegAddress(block, state_ptr, remill::kNextPCVariableName);
 
   llvm::IRBuilder<> ir(block);
-  ir.CreateStore(ret_pc_val, pc_ptr, false);
-  ir.CreateStore(ret_pc_val, next_pc_ptr, false);
+  ir.CreateStore(ret_pc_val, pc_ptr_ref, false);
+  ir.CreateStore(ret_pc_val, next_pc_ptr_ref, false);
   ir.CreateBr(GetOrCreateTargetBlock(ret_pc));
 }
 
@@ -730,22 +1061,18 @@ void FunctionLifter::VisitAfterFunctionCall(const remill::Instruction &inst,
 void FunctionLifter::VisitConditionalBranch(const remill::Instruction &inst,
                                             remill::Instruction *delayed_inst,
                                             llvm::BasicBlock *block) {
-  std::stringstream taken_ss;
-  taken_ss
-      << "inst_" << std::hex << inst.pc << "_taken_"
-      << inst.branch_taken_pc;
-
-  std::stringstream not_taken_ss;
-  not_taken_ss
-      << "inst_" << std::hex << inst.pc << "_not_taken_"
-      << inst.branch_not_taken_pc;
-
   const auto lifted_func = block->getParent();
   const auto cond = remill::LoadBranchTaken(block);
-  const auto taken_block =
-      llvm::BasicBlock::Create(llvm_context, taken_ss.str(), lifted_func);
-  const auto not_taken_block =
-      llvm::BasicBlock::Create(llvm_context, not_taken_ss.str(), lifted_func);
+  const auto taken_block = CreateBlock(
+      options, llvm_context,
+      "inst_" + llvm::Twine::utohexstr(inst.pc) + "_taken_" +
+          llvm::Twine::utohexstr(inst.branch_taken_pc),
+      lifted_func);
+  const auto not_taken_block = CreateBlock(
+      options, llvm_context,
+      "inst_" + llvm::Twine::utohexstr(inst.pc) + "_not_taken_" +
+          llvm::Twine::utohexstr(inst.branch_not_taken_pc),
+      lifted_func);
   llvm::BranchInst::Create(taken_block, not_taken_block, cond, block);
   VisitDelayedInstruction(inst, delayed_inst, taken_block, true);
   VisitDelayedInstruction(inst, delayed_inst, not_taken_block, false);
@@ -822,6 +1149,11 @@ llvm::Function *FunctionLifter::GetOrCreateTaintedFunction(
     llvm::Type *current_type, llvm::Type *goal_type,
     llvm::BasicBlock *curr_block, const remill::Register *reg, uint64_t pc) {
 
+  auto &func = type_hint_funcs[{current_type, goal_type}];
+  if (func) {
+    return func;
+  }
+
   const auto &dl = semantics_module->getDataLayout();
 
   // Consider adding in:
@@ -838,7 +1170,7 @@ llvm::Function *FunctionLifter::GetOrCreateTaintedFunction(
       llvm::FunctionType::get(return_type, {current_type}, false);
 
   // Return the function if it exists.
-  auto func = semantics_module->getFunction(func_name);
+  func = semantics_module->getFunction(func_name);
   if (func) {
     return func;
   }
@@ -853,46 +1185,6 @@ llvm::Function *FunctionLifter::GetOrCreateTaintedFunction(
   return func;
 }
 
-// Instrument an instruction. This inject a `printf`-like function call just
-// before a lifted instruction to aid in tracking the provenance of register
-// values, and relating them back to original instructions.
-//
-// TODO(pag): In future, this mechanism should be used to provide a feedback
-//            loop, or to provide information to the `TypeProvider` for future
-//            re-lifting of code.
-//
-// TODO(pag): Right now, this feature is enabled by a command-line flag, and
-//            that flag is tested in `VisitInstruction`; we should move
-//            lifting configuration decisions out of here so that we can pass
-//            in a kind of `LiftingOptions` type that changes the lifter's
-//            behavior.
-void FunctionLifter::InstrumentDataflowProvenance(llvm::BasicBlock *block) {
-  if (!data_provenance_function) {
-    data_provenance_function =
-        semantics_module->getFunction(kAnvillDataProvenanceFunc);
-
-    if (!data_provenance_function) {
-      llvm::Type *args[] = {mem_ptr_type, pc_reg_type};
-      auto fty = llvm::FunctionType::get(mem_ptr_type, args, true);
-      data_provenance_function = llvm::Function::Create(
-          fty, llvm::GlobalValue::ExternalLinkage,
-          kAnvillDataProvenanceFunc, *semantics_module);
-    }
-  }
-
-  std::vector<llvm::Value *> args;
-  llvm::IRBuilder<> ir(block);
-  args.push_back(ir.CreateLoad(mem_ptr_type, mem_ptr_ref));
-  args.push_back(llvm::ConstantInt::get(pc_reg_type, curr_inst->pc));
-  options.arch->ForEachRegister([&](const remill::Register *reg) {
-    if (reg != pc_reg && reg != sp_reg && reg->EnclosingRegister() == reg) {
-      args.push_back(inst_lifter.LoadRegValue(block, state_ptr, reg->name));
-    }
-  });
-
-  ir.CreateStore(ir.CreateCall(data_provenance_function, args), mem_ptr_ref);
-}
-
 // Adds a 'breakpoint' instrumentation, which calls functions that are named
 // with an instruction's address just before that instruction executes. These
 // are nifty to spot checking bitcode. This function is used like:
@@ -902,11 +1194,21 @@ void FunctionLifter::InstrumentDataflowProvenance(llvm::BasicBlock *block) {
 // That way, we can look at uses and compare the second argument to the
 // hex address encoded in the function name, and also look at the third argument
 // and see if it corresponds to the subsequent instruction address.
+//
+// With compact breakpoints, every instruction instead calls the one function
+//
+//      mem = breakpoint(mem, <addr>, NEXT_PC)
+//
+// where `<addr>` is the instruction's address as a constant, which is what a
+// conditional debugger breakpoint on `breakpoint` would test.
 void FunctionLifter::InstrumentCallBreakpointFunction(llvm::BasicBlock *block) {
-  std::stringstream ss;
-  ss << "breakpoint_" << std::hex << curr_inst->pc;
+  std::string func_name = "breakpoint";
+  if (!options.compact_breakpoints) {
+    std::stringstream ss;
+    ss << "breakpoint_" << std::hex << curr_inst->pc;
+    func_name = ss.str();
+  }
 
-  const auto func_name = ss.str();
   auto module = block->getModule();
   auto func = module->getFunction(func_name);
   if (!func) {
@@ -926,10 +1228,17 @@ void FunctionLifter::InstrumentCallBreakpointFunction(llvm::BasicBlock *block) {
     ir.CreateRet(remill::NthArgument(func, 0));
   }
 
+  llvm::Value *pc = nullptr;
+  if (options.compact_breakpoints) {
+    pc = llvm::ConstantInt::get(address_type, curr_inst->pc);
+  } else {
+    pc = inst_lifter.LoadRegValue(block, state_ptr, remill::kPCVariableName);
+  }
+
   llvm::Value *args[] = {
       new llvm::LoadInst(mem_ptr_type, mem_ptr_ref,
                          llvm::Twine::createNull(), block),
-      inst_lifter.LoadRegValue(block, state_ptr, remill::kPCVariableName),
+      pc,
       inst_lifter.LoadRegValue(block, state_ptr, remill::kNextPCVariableName)};
   llvm::IRBuilder<> ir(block);
   ir.CreateCall(func, args);
@@ -950,13 +1259,12 @@ void FunctionLifter::VisitTypedHintedRegister(
   }
 
   llvm::IRBuilder irb(block);
-  auto reg_pointer = inst_lifter.LoadRegAddress(block, state_ptr, reg_name);
+  auto reg_pointer = StateRegisterAddress(irb, state_ptr, reg);
   llvm::Value *reg_value = nullptr;
 
   // If we have a concrete value that is being provided for this value, then
   // save it into the `State` structure. This improves our ability to optimize.
   if (options.store_inferred_register_values && maybe_value) {
-    reg_value = irb.CreateLoad(reg->type, reg_pointer);
     reg_value = llvm::ConstantInt::get(reg->type, *maybe_value);
     irb.CreateStore(reg_value, reg_pointer);
   }
@@ -989,6 +1297,12 @@ void FunctionLifter::VisitInstruction(remill::Instruction &inst,
                                       llvm::BasicBlock *block) {
   curr_inst = &inst;
 
+  // The last instruction lifted into `block` before this one, if any.
+  // Straight-line code is lifted into a single block, so the code of `inst`
+  // goes after the code for the instructions that fall through into it.
+  llvm::Instruction *const prev_inst =
+      block->empty() ? nullptr : &(block->back());
+
   // TODO(pag): Consider emitting calls to the `llvm.pcmarker` intrinsic. Figure
   //            out if the `i32` parameter is different on 64-bit targets, or
   //            if it's actually a metadata ID.
@@ -1013,23 +1327,15 @@ void FunctionLifter::VisitInstruction(remill::Instruction &inst,
         });
   }
 
-  if (options.track_provenance) {
-    InstrumentDataflowProvenance(block);
-  }
-
   if (options.add_breakpoints) {
     InstrumentCallBreakpointFunction(block);
   }
 
-  // Even when something isn't supported or is invalid, we still lift
-  // a call to a semantic, e.g.`INVALID_INSTRUCTION`, so we really want
-  // to treat instruction lifting as an operation that can't fail.
-  (void) inst_lifter.LiftIntoBlock(inst, block, state_ptr,
-                                   false /* is_delayed */);
+  LiftInstructionIntoBlock(inst, block);
 
   // Figure out if we have to decode the subsequent instruction as a delayed
   // instruction.
-  if (options.arch->MayHaveDelaySlot(inst)) {
+  if (has_delay_slots && options.arch->MayHaveDelaySlot(inst)) {
     delayed_inst = new (&delayed_inst_storage) remill::Instruction;
     if (!DecodeInstructionInto(inst.delayed_pc, true /* is_delayed */,
                                delayed_inst)) {
@@ -1043,7 +1349,8 @@ void FunctionLifter::VisitInstruction(remill::Instruction &inst,
   // and prior to any lifting of a delayed instruction that might happen
   // in any of the below `Visit*` calls.
   const auto inst_annotation = GetPCAnnotation(inst.pc);
-  AnnotateInstructions(block, pc_annotation_id, inst_annotation);
+  AnnotateInstructionsAfter(block, prev_inst, pc_annotation_id,
+                            inst_annotation);
 
   switch (inst.category) {
 
@@ -1099,7 +1406,17 @@ void FunctionLifter::VisitInstruction(remill::Instruction &inst,
 
   // Do a second pass of annotations to apply to the control-flow branching
   // instructions added in by the above `Visit*` calls.
-  AnnotateInstructions(block, pc_annotation_id, inst_annotation);
+  AnnotateInstructionsAfter(block, prev_inst, pc_annotation_id,
+                            inst_annotation);
+
+  // Remember where the code for `inst` starts, so that later edges into the
+  // middle of `block` can split it there. If nothing was lifted, then `inst`
+  // is lifted again by later edges into it.
+  auto first_inst = prev_inst ? prev_inst->getNextNode()
+                              : (block->empty() ? nullptr : &(block->front()));
+  if (first_inst) {
+    addr_to_inst.try_emplace(inst.pc, first_inst);
+  }
 
   if (delayed_inst) {
     delayed_inst->~Instruction();
@@ -1122,7 +1439,8 @@ llvm::Value *FunctionLifter::TryCallNativeFunction(uint64_t native_addr,
                                                    llvm::BasicBlock *block) {
   auto &decl = addr_to_decl[native_addr];
   if (!decl.address) {
-    auto maybe_decl = FunctionDecl::Create(*native_func, options.arch);
+    auto maybe_decl = FunctionDecl::Create(*native_func, options.arch,
+                                            signature_allocations);
     if (remill::IsError(maybe_decl)) {
       LOG(ERROR) << "Unable to create FunctionDecl for "
                  << remill::LLVMThingToString(native_func->getFunctionType())
@@ -1145,19 +1463,39 @@ llvm::Value *FunctionLifter::TryCallNativeFunction(uint64_t native_addr,
 
 // Visit all instructions. This runs the work list and lifts instructions.
 void FunctionLifter::VisitInstructions(uint64_t address) {
-  remill::Instruction inst;
+  auto &inst = decoded_inst;
+
+  const auto tracer = options.tracer;
+  TraceScope scope(tracer, "visit-instructions", "lift", lifted_func,
+                   func_address);
+  ANVILL_TRACE_ZONE("FunctionLifter::VisitInstructions");
+  uint64_t decode_us = 0u;
+  uint64_t num_decoded = 0u;
 
   // Recursively decode and lift all instructions that we come across.
   while (!edge_work_list.empty()) {
-    const auto [inst_addr, from_addr] = *(edge_work_list.begin());
-    edge_work_list.erase(edge_work_list.begin());
+    std::pop_heap(edge_work_list.begin(), edge_work_list.end(),
+                  std::greater<>());
+    const auto [inst_addr, from_addr] = edge_work_list.back();
+    edge_work_list.pop_back();
 
-    llvm::BasicBlock *const block = edge_to_dest_block[{from_addr, inst_addr}];
+    llvm::BasicBlock *const block =
+        edge_to_dest_block[BlockKey(func_address, from_addr, inst_addr)];
     DCHECK_NOTNULL(block);
     if (!block->empty()) {
       continue;  // Already handled.
     }
 
+    // Once the lift has gone over one of its budgets, everything left in the
+    // work list ends in an error, and we're left with a partial lift.
+    if (!exceeded_budget) {
+      exceeded_budget = CheckLiftBudget();
+    }
+    if (exceeded_budget) {
+      MuteStateEscape(remill::AddTerminatingTailCall(block, intrinsics.error));
+      continue;
+    }
+
     // First, try to see if it's actually related to another function. This is
     // equivalent to a tail-call in the original code. This comes up with fall-
     // throughs, i.e. where one function is a prologue of another one. It also
@@ -1170,12 +1508,19 @@ void FunctionLifter::VisitInstructions(uint64_t address) {
     //            it means we have a control-flow edge or fall-through edge
     //            back to the entrypoint of our function. In this case, treat it
     //            like a tail-call.
-    if (inst_addr != func_address || from_addr) {
+    //
+    // Most edges are into the function's own code, so the decl is only looked
+    // up once a cheaper check says it exists.
+    if ((inst_addr != func_address || from_addr) &&
+        IsTargetFunctionHead(inst_addr)) {
 
       auto maybe_decl = TryGetTargetFunctionType(inst_addr);
-      if (maybe_decl.has_value()) {
-        auto decl = maybe_decl.value();
+      if (maybe_decl) {
+        const auto &decl = *maybe_decl;
         llvm::Function *const other_decl = DeclareFunction(decl);
+        if (other_decl) {
+          NoteReferencedFunction(decl.address);
+        }
 
         if (const auto mem_ptr_from_call =
                 TryCallNativeFunction(decl.address, other_decl, block)) {
@@ -1193,33 +1538,125 @@ void FunctionLifter::VisitInstructions(uint64_t address) {
       }
     }
 
-    llvm::BasicBlock *&inst_block = addr_to_block[inst_addr];
-    if (!inst_block) {
-      inst_block = block;
-
-    // We've already lifted this instruction via another control-flow edge.
-    } else {
-      llvm::BranchInst::Create(inst_block, block);
+    // We've already lifted this instruction via another control-flow edge,
+    // e.g. this is a backward edge to the entrypoint of the function that
+    // couldn't be lifted as a self-tail-call.
+    if (addr_to_inst.count(inst_addr)) {
+      pending_splits.emplace_back(block, inst_addr);
       continue;
     }
 
-    // Decode.
-    if (!DecodeInstructionInto(inst_addr, false /* is_delayed */, &inst)) {
-      LOG(ERROR) << "Could not decode instruction at " << std::hex << inst_addr
-                 << " reachable from instruction " << from_addr
-                 << " in function at " << func_address << std::dec;
-      MuteStateEscape(remill::AddTerminatingTailCall(block, intrinsics.error));
-      continue;
+    // Lift the instruction at `inst_addr`, and then every instruction that
+    // it falls through into, into `block`. Straight-line code thus ends up in
+    // a single block, and only the targets of control-flow edges start new
+    // blocks.
+    for (auto addr = inst_addr, from = from_addr;;) {
+
+      // Decode.
+      const auto decode_start = tracer ? tracer->Now() : 0u;
+      const auto decoded =
+          DecodeInstructionInto(addr, false /* is_delayed */, &inst);
+      if (tracer) {
+        decode_us += tracer->Now() - decode_start;
+        num_decoded += 1u;
+      }
 
-    // Didn't get a valid instruction.
-    } else if (!inst.IsValid() || inst.IsError()) {
-      MuteStateEscape(remill::AddTerminatingTailCall(block, intrinsics.error));
-      continue;
+      if (!decoded) {
+        LOG(ERROR) << "Could not decode instruction at " << std::hex << addr
+                   << " reachable from instruction " << from
+                   << " in function at " << func_address << std::dec;
+        MuteStateEscape(
+            remill::AddTerminatingTailCall(block, intrinsics.error));
+        break;
+
+      // Didn't get a valid instruction.
+      } else if (!inst.IsValid() || inst.IsError()) {
+        MuteStateEscape(
+            remill::AddTerminatingTailCall(block, intrinsics.error));
+        break;
+      }
 
-    } else {
+      ++num_lifted_insts;
+      fall_through_pc.reset();
       VisitInstruction(inst, block);
+      if (!fall_through_pc) {
+        break;
+      }
+
+      from = addr;
+      addr = *fall_through_pc;
+      fall_through_pc.reset();
+
+      if (!exceeded_budget) {
+        exceeded_budget = CheckLiftBudget();
+      }
+      if (exceeded_budget) {
+        MuteStateEscape(
+            remill::AddTerminatingTailCall(block, intrinsics.error));
+        break;
+      }
+    }
+  }
+
+  SplitBlocksAtEdges();
+
+  scope.AddCounter("decoded_instructions", num_decoded);
+  scope.AddCounter("decode_us", decode_us);
+  ANVILL_TRACE_ZONE_TAG(func_address, num_decoded);
+}
+
+// Split blocks at the targets of edges into the middle of them. Each pending
+// block is empty, and is replaced by the bottom half of the split block.
+void FunctionLifter::SplitBlocksAtEdges(void) {
+  for (auto [edge_block, addr] : pending_splits) {
+    auto inst = addr_to_inst[addr];
+    auto block = inst->getParent();
+    auto dest_block = block;
+    if (inst != &(block->front())) {
+      dest_block = block->splitBasicBlock(
+          inst, "inst_" + llvm::Twine::utohexstr(addr));
     }
+    edge_block->replaceAllUsesWith(dest_block);
+    edge_block->eraseFromParent();
+  }
+  pending_splits.clear();
+}
+
+// Returns the name of the first lifting budget in `options` that the current
+// lift has gone over, or `nullptr` if it's within all of them.
+//
+// Straight-line code is lifted into a single block, so the number of blocks is
+// roughly the number of distinct targets of the control-flow edges that we've
+// followed.
+const char *FunctionLifter::CheckLiftBudget(void) const {
+  if (options.max_lifted_instructions &&
+      num_lifted_insts >= options.max_lifted_instructions) {
+    return "max_lifted_instructions";
+  }
+
+  if (options.max_lifted_blocks &&
+      edge_to_dest_block.size() > options.max_lifted_blocks) {
+    return "max_lifted_blocks";
+  }
+
+  if (options.max_lift_time_ms &&
+      std::chrono::steady_clock::now() - lift_start >=
+          std::chrono::milliseconds(options.max_lift_time_ms)) {
+    return "max_lift_time_ms";
   }
+
+  return nullptr;
+}
+
+// Give up on `native_func`, leaving it as a declaration, because it went over
+// `budget`.
+void FunctionLifter::AbandonFunction(const char *budget) {
+  LOG(WARNING) << "Function at " << std::hex << func_address << std::dec
+               << " went over its " << budget
+               << " budget; leaving it as a declaration";
+  IncrementCounter(Counter::kLiftBudgetExceeded);
+  native_func->deleteBody();
+  native_func->addFnAttr(kBudgetExceededAttribute, budget);
 }
 
 // Get the annotation for the program counter `pc`, or `nullptr` if we're
@@ -1292,7 +1729,7 @@ void FunctionLifter::AllocateAndInitializeStateStructure(
       break;
     case StateStructureInitializationProcedure::kZeroes:
       state_ptr = ir.CreateAlloca(state_type);
-      ir.CreateStore(llvm::Constant::getNullValue(state_type), state_ptr);
+      ZeroStateStructure(block);
       break;
     case StateStructureInitializationProcedure::kUndef:
       state_ptr = ir.CreateAlloca(state_type);
@@ -1300,19 +1737,23 @@ void FunctionLifter::AllocateAndInitializeStateStructure(
       break;
     case StateStructureInitializationProcedure::kGlobalRegisterVariables:
       state_ptr = ir.CreateAlloca(state_type);
-      InitializeStateStructureFromGlobalRegisterVariables(block);
+      InitializeStateStructureRegisters(block);
       break;
     case StateStructureInitializationProcedure::
         kGlobalRegisterVariablesAndZeroes:
       state_ptr = ir.CreateAlloca(state_type);
-      ir.CreateStore(llvm::Constant::getNullValue(state_type), state_ptr);
-      InitializeStateStructureFromGlobalRegisterVariables(block);
+      ZeroStateStructure(block);
+      InitializeStateStructureRegisters(block);
       break;
     case StateStructureInitializationProcedure::
         kGlobalRegisterVariablesAndUndef:
       state_ptr = ir.CreateAlloca(state_type);
       ir.CreateStore(llvm::UndefValue::get(state_type), state_ptr);
-      InitializeStateStructureFromGlobalRegisterVariables(block);
+      InitializeStateStructureRegisters(block);
+      break;
+    case StateStructureInitializationProcedure::kReadRegister:
+      state_ptr = ir.CreateAlloca(state_type);
+      InitializeStateStructureRegisters(block);
       break;
   }
 
@@ -1339,7 +1780,7 @@ void FunctionLifter::ArchSpecificStateStructureInitialization(
                       llvm::PointerType::get(i8_type, 256)),
                   llvm::PointerType::get(i8_type, 0)),
               pc_reg_type);
-      ir.CreateStore(gsbase_val, gsbase_reg->AddressOf(state_ptr, ir));
+      ir.CreateStore(gsbase_val, StateRegisterAddress(ir, state_ptr, gsbase_reg));
     }
 
     if (fsbase_reg) {
@@ -1350,29 +1791,113 @@ void FunctionLifter::ArchSpecificStateStructureInitialization(
                       llvm::PointerType::get(i8_type, 257)),
                   llvm::PointerType::get(i8_type, 0)),
               pc_reg_type);
-      ir.CreateStore(fsbase_val, fsbase_reg->AddressOf(state_ptr, ir));
+      ir.CreateStore(fsbase_val, StateRegisterAddress(ir, state_ptr, fsbase_reg));
     }
 
     if (ssbase_reg) {
       ir.CreateStore(llvm::Constant::getNullValue(pc_reg_type),
-                     ssbase_reg->AddressOf(state_ptr, ir));
+                     StateRegisterAddress(ir, state_ptr, ssbase_reg));
+    }
+  }
+}
+
+// Zero the state structure in `block`, or defer it until the live registers
+// are known.
+//
+// This used to store a `ConstantAggregateZero` of the whole `State` type, which
+// is kilobytes big on x86-64 with AVX state. Such stores are lowered poorly,
+// and SROA and DSE struggle to split them up, so we use `llvm.memset` instead.
+void FunctionLifter::ZeroStateStructure(llvm::BasicBlock *block) {
+  if (options.initialize_only_live_registers) {
+    deferred_state_init_point = &(block->back());
+    return;
+  }
+
+  llvm::IRBuilder<> ir(block);
+  StoreStateZeroes(ir, nullptr);
+}
+
+// Zero the state structure using `ir`, with one `llvm.memset` per run of
+// zeroed bytes.
+void FunctionLifter::StoreStateZeroes(llvm::IRBuilder<> &ir,
+                                      const llvm::BitVector *live_bytes) {
+  const auto &dl = semantics_module->getDataLayout();
+  const auto state_type = state_ptr_type->getElementType();
+  const auto state_size =
+      static_cast<unsigned>(dl.getTypeAllocSize(state_type));
+
+  llvm::BitVector zeroed_bytes(state_size, true);
+  if (live_bytes) {
+    zeroed_bytes &= *live_bytes;
+
+  // Leave out the vector and floating point registers.
+  } else if (!options.zero_vector_and_float_state) {
+    options.arch->ForEachRegister([&](const remill::Register *reg) {
+      if (reg->EnclosingRegister() != reg || reg->type->isIntegerTy() ||
+          reg->type->isPointerTy()) {
+        return;
+      }
+      const auto begin = static_cast<unsigned>(reg->offset);
+      const auto end = std::min<unsigned>(
+          static_cast<unsigned>(reg->offset + reg->size), state_size);
+      if (begin < end) {
+        zeroed_bytes.reset(begin, end);
+      }
+    });
+  }
+
+  // Zero the whole thing in one go.
+  if (zeroed_bytes.all()) {
+    ir.CreateMemSet(state_ptr, ir.getInt8(0), state_size,
+                    dl.getABITypeAlign(state_type));
+    return;
+  }
+
+  const auto i8_ptr_type =
+      llvm::PointerType::get(i8_type, state_ptr_type->getAddressSpace());
+  const auto state_bytes = ir.CreateBitCast(state_ptr, i8_ptr_type);
+  for (auto begin = zeroed_bytes.find_first(); begin != -1;) {
+    auto end = zeroed_bytes.find_next_unset(static_cast<unsigned>(begin));
+    if (end == -1) {
+      end = static_cast<int>(state_size);
     }
+    const auto dest = ir.CreateConstInBoundsGEP1_32(
+        i8_type, state_bytes, static_cast<unsigned>(begin));
+    ir.CreateMemSet(dest, ir.getInt8(0), static_cast<uint64_t>(end - begin),
+                    llvm::MaybeAlign(1));
+    begin = zeroed_bytes.find_next(static_cast<unsigned>(end - 1));
   }
 }
 
-// Initialize the state structure with default values, loaded from global
-// variables. The purpose of these global variables is to show that there are
-// some unmodelled external dependencies inside of a lifted function.
-void FunctionLifter::InitializeStateStructureFromGlobalRegisterVariables(
+// Initialize the registers of the state structure with default values,
+// loaded from global variables, or read with `llvm.read_register`. The
+// purpose of these is to show that there are some unmodelled external
+// dependencies inside of a lifted function.
+void FunctionLifter::InitializeStateStructureRegisters(
     llvm::BasicBlock *block) {
 
-  // Get or create globals for all top-level registers. The idea here is that
-  // the spec could feasibly miss some dependencies, and so after optimization,
-  // we'll be able to observe uses of `__anvill_reg_*` globals, and handle
-  // them appropriately.
+  // Which registers are live is only known once the lifted function has been
+  // inlined into `native_func`, so remember where the initialization goes.
+  if (options.initialize_only_live_registers) {
+    deferred_state_init_point = &(block->back());
+    return;
+  }
 
   llvm::IRBuilder<> ir(block);
+  StoreInitialRegisterValues(ir, nullptr);
+}
 
+// Store the default values of the registers into the state structure.
+void FunctionLifter::StoreInitialRegisterValues(
+    llvm::IRBuilder<> &ir, const llvm::BitVector *live_bytes) {
+  const auto read_register =
+      options.state_struct_init_procedure ==
+      StateStructureInitializationProcedure::kReadRegister;
+
+  // Get or create globals for all top-level registers, or read them. The idea
+  // here is that the spec could feasibly miss some dependencies, and so after
+  // optimization, we'll be able to observe uses of `__anvill_reg_*` globals,
+  // or of `llvm.read_register`, and handle them appropriately.
   options.arch->ForEachRegister([=, &ir](const remill::Register *reg_) {
     if (auto reg = reg_->EnclosingRegister(); reg_ == reg) {
 
@@ -1385,6 +1910,21 @@ void FunctionLifter::InitializeStateStructureFromGlobalRegisterVariables(
         return;
       }
 
+      if (live_bytes) {
+        const auto begin = static_cast<unsigned>(reg->offset);
+        const auto end = std::min<unsigned>(
+            static_cast<unsigned>(reg->offset + reg->size),
+            live_bytes->size());
+        if (begin >= end || live_bytes->find_first_in(begin, end) == -1) {
+          return;
+        }
+      }
+
+      if (read_register) {
+        ReadRegisterIntoState(ir, reg);
+        return;
+      }
+
       std::stringstream ss;
       ss << kUnmodelledRegisterPrefix << reg->name;
       const auto reg_name = ss.str();
@@ -1396,36 +1936,158 @@ void FunctionLifter::InitializeStateStructureFromGlobalRegisterVariables(
             llvm::GlobalValue::ExternalLinkage, nullptr, reg_name);
       }
 
-      const auto reg_ptr = reg->AddressOf(state_ptr, block);
+      const auto reg_ptr = StateRegisterAddress(ir, state_ptr, reg);
       ir.CreateStore(ir.CreateLoad(reg_global), reg_ptr);
     }
   });
 }
 
-llvm::Value *FunctionLifter::GenerateProgramCounter(llvm::BasicBlock *block,
-                                                    std::uint64_t address) {
-  if (options.symbolic_program_counter) {
-    return GenerateSymbolicProgramCounter(block, address);
-  } else {
-    return GenerateConcreteProgramCounter(block, address);
-  }
+// Store the value of `reg`, as read with `llvm.read_register`, into the state
+// structure. `llvm.read_register` only reads integers, so registers of other
+// types, e.g. vector registers, are stored as integers of the same size.
+void FunctionLifter::ReadRegisterIntoState(llvm::IRBuilder<> &ir,
+                                           const remill::Register *reg) {
+  const auto int_type = llvm::IntegerType::get(
+      llvm_context, static_cast<unsigned>(reg->size * 8u));
+  const auto read_register_func = llvm::Intrinsic::getDeclaration(
+      semantics_module.get(), llvm::Intrinsic::read_register, {int_type});
+
+  llvm::Metadata *reg_name_md[] = {
+      llvm::MDString::get(llvm_context, llvm::StringRef(reg->name).lower())};
+  llvm::Value *args[] = {llvm::MetadataAsValue::get(
+      llvm_context, llvm::MDNode::get(llvm_context, reg_name_md))};
+
+  auto reg_ptr = StateRegisterAddress(ir, state_ptr, reg);
+  if (reg->type != int_type) {
+    reg_ptr = ir.CreateBitCast(
+        reg_ptr, llvm::PointerType::get(
+                     int_type, reg_ptr->getType()->getPointerAddressSpace()));
+  }
+  ir.CreateStore(ir.CreateCall(read_register_func, args), reg_ptr);
 }
 
-void FunctionLifter::UpdateProgramCounter(llvm::BasicBlock *block,
-                                          llvm::Value *pc) {
-  auto pc_reg =
-      options.arch->RegisterByName(options.arch->ProgramCounterRegisterName());
+// Find the bytes of the `State` structure that may be read by `native_func`.
+// This follows the constant-offset pointer arithmetic on `state_ptr` to the
+// loads from it, and gives up if `state_ptr` is used in any other way.
+bool FunctionLifter::FindLiveStateBytes(llvm::BitVector &live_bytes) const {
+  const auto &dl = semantics_module->getDataLayout();
+  const auto state_type = state_ptr_type->getElementType();
+  const auto state_size =
+      static_cast<int64_t>(dl.getTypeAllocSize(state_type));
+  live_bytes.resize(static_cast<unsigned>(state_size));
+
+  auto mark_read = [&](int64_t offset, uint64_t size) {
+    const auto end = std::min<int64_t>(state_size,
+                                       offset + static_cast<int64_t>(size));
+    if (offset < end) {
+      live_bytes.set(static_cast<unsigned>(offset),
+                     static_cast<unsigned>(end));
+    }
+  };
 
-  auto pc_reg_ptr = pc_reg->AddressOf(state_ptr, block);
+  std::vector<std::pair<const llvm::Value *, int64_t>> work_list;
+  work_list.emplace_back(state_ptr, 0);
+  while (!work_list.empty()) {
+    const auto [ptr, offset] = work_list.back();
+    work_list.pop_back();
+
+    for (const llvm::User *user : ptr->users()) {
+      if (auto gep = llvm::dyn_cast<llvm::GEPOperator>(user)) {
+        llvm::APInt gep_offset(dl.getIndexTypeSizeInBits(gep->getType()), 0);
+        if (!gep->accumulateConstantOffset(dl, gep_offset)) {
+          return false;
+        }
+        const auto new_offset = offset + gep_offset.getSExtValue();
+        if (new_offset < 0 || new_offset >= state_size) {
+          return false;
+        }
+        work_list.emplace_back(gep, new_offset);
 
-  llvm::IRBuilder<> ir(block);
-  ir.CreateStore(pc, pc_reg_ptr);
-}
+      } else if (llvm::isa<llvm::BitCastOperator>(user) ||
+                 llvm::isa<llvm::AddrSpaceCastOperator>(user)) {
+        work_list.emplace_back(user, offset);
 
-llvm::Value *
-FunctionLifter::GenerateSymbolicProgramCounter(llvm::BasicBlock *block,
-                                               std::uint64_t address) {
-  auto base_pc = semantics_module->getGlobalVariable(kSymbolicPCName);
+      } else if (auto load = llvm::dyn_cast<llvm::LoadInst>(user)) {
+        mark_read(offset, dl.getTypeStoreSize(load->getType()));
+
+      } else if (auto store = llvm::dyn_cast<llvm::StoreInst>(user)) {
+        if (store->getValueOperand() == ptr) {
+          return false;
+        }
+
+      } else if (auto mem_set = llvm::dyn_cast<llvm::MemSetInst>(user)) {
+        if (mem_set->getRawDest() != ptr) {
+          return false;
+        }
+
+      } else if (auto mem_cpy = llvm::dyn_cast<llvm::MemTransferInst>(user)) {
+        if (mem_cpy->getRawSource() == ptr) {
+          auto len = llvm::dyn_cast<llvm::ConstantInt>(mem_cpy->getLength());
+          if (!len) {
+            return false;
+          }
+          mark_read(offset, len->getZExtValue());
+        }
+
+      } else if (auto intrinsic = llvm::dyn_cast<llvm::IntrinsicInst>(user);
+                 intrinsic && intrinsic->isLifetimeStartOrEnd()) {
+        continue;
+
+      } else {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+// Zero the state structure and initialize the registers that are live in
+// `native_func`, if this was deferred.
+void FunctionLifter::InitializeLiveStateStructureRegisters(void) {
+  if (!deferred_state_init_point) {
+    return;
+  }
+
+  llvm::BitVector live_bytes;
+  const auto found = FindLiveStateBytes(live_bytes);
+
+  llvm::IRBuilder<> ir(deferred_state_init_point->getNextNode());
+  switch (options.state_struct_init_procedure) {
+    case StateStructureInitializationProcedure::kZeroes:
+      StoreStateZeroes(ir, found ? &live_bytes : nullptr);
+      break;
+    case StateStructureInitializationProcedure::
+        kGlobalRegisterVariablesAndZeroes:
+      StoreStateZeroes(ir, found ? &live_bytes : nullptr);
+      StoreInitialRegisterValues(ir, found ? &live_bytes : nullptr);
+      break;
+    default:
+      StoreInitialRegisterValues(ir, found ? &live_bytes : nullptr);
+      break;
+  }
+  deferred_state_init_point = nullptr;
+}
+
+llvm::Value *FunctionLifter::GenerateProgramCounter(llvm::BasicBlock *block,
+                                                    std::uint64_t address) {
+  if (options.symbolic_program_counter) {
+    return GenerateSymbolicProgramCounter(block, address);
+  } else {
+    return GenerateConcreteProgramCounter(block, address);
+  }
+}
+
+void FunctionLifter::UpdateProgramCounter(llvm::BasicBlock *block,
+                                          llvm::Value *pc) {
+  llvm::IRBuilder<> ir(block);
+  ir.CreateStore(pc, StateRegisterAddress(ir, state_ptr, pc_reg));
+}
+
+llvm::Value *
+FunctionLifter::GenerateSymbolicProgramCounter(llvm::BasicBlock *block,
+                                               std::uint64_t address) {
+  auto base_pc = semantics_module->getGlobalVariable(kSymbolicPCName);
   if (!base_pc) {
     base_pc = new llvm::GlobalVariable(*semantics_module, i8_type, false,
                                        llvm::GlobalValue::ExternalLinkage,
@@ -1472,10 +2134,6 @@ FunctionLifter::InitializeConcreteProgramCounter(llvm::BasicBlock *block) {
 // mechanism is used to improve stack frame recovery, in a similar way that
 // a symbolic PC improves cross-reference discovery.
 void FunctionLifter::InitializeSymbolicStackPointer(llvm::BasicBlock *block) {
-  auto sp_reg =
-      options.arch->RegisterByName(options.arch->StackPointerRegisterName());
-
-  auto sp_reg_ptr = sp_reg->AddressOf(state_ptr, block);
 
   auto base_sp = semantics_module->getGlobalVariable(kSymbolicSPName);
   if (!base_sp) {
@@ -1486,7 +2144,7 @@ void FunctionLifter::InitializeSymbolicStackPointer(llvm::BasicBlock *block) {
 
   auto sp = llvm::ConstantExpr::getPtrToInt(base_sp, sp_reg->type);
   llvm::IRBuilder<> ir(block);
-  ir.CreateStore(sp, sp_reg_ptr);
+  ir.CreateStore(sp, StateRegisterAddress(ir, state_ptr, sp_reg));
 }
 
 // Initialize a symbolic return address. This is similar to symbolic program
@@ -1502,8 +2160,6 @@ FunctionLifter::InitializeSymbolicReturnAddress(llvm::BasicBlock *block,
                                        i8_zero, kSymbolicRAName);
   }
 
-  auto pc_reg =
-      options.arch->RegisterByName(options.arch->ProgramCounterRegisterName());
   auto ret_addr = llvm::ConstantExpr::getPtrToInt(base_ra, pc_reg->type);
 
   return StoreNativeValue(ret_addr, ret_address, intrinsics, block, state_ptr,
@@ -1519,9 +2175,6 @@ FunctionLifter::InitializeConcreteReturnAddress(llvm::BasicBlock *block,
       semantics_module.get(), llvm::Intrinsic::returnaddress);
   llvm::Value *args[] = {llvm::ConstantInt::get(i32_type, 0)};
 
-  auto pc_reg =
-      options.arch->RegisterByName(options.arch->ProgramCounterRegisterName());
-
   llvm::Value *ret_addr =
       llvm::CallInst::Create(ret_addr_func, args, llvm::None,
                              llvm::Twine::createNull(), &(block->front()));
@@ -1533,6 +2186,76 @@ FunctionLifter::InitializeConcreteReturnAddress(llvm::BasicBlock *block,
                           mem_ptr);
 }
 
+// Start the body of `lifted_func` with the variables of `__remill_basic_block`
+// that aren't registers.
+//
+// Most of `__remill_basic_block` is a table of named pointers into the `State`
+// structure, one per register and sub-register, and nearly all of them are dead
+// in any one lifted function. Remill's instruction lifter computes the address
+// of a register that isn't a variable of the function from the register itself,
+// so only the other variables, e.g. `MEMORY`, `BRANCH_TAKEN`, or `RETURN_PC`,
+// need to be copied, along with whatever they're computed from.
+// `__remill_basic_block` is cloned only once, to find them.
+void FunctionLifter::InitializeLiftedFunctionFromTemplate(void) {
+  if (!block_template) {
+    block_template = remill::DeclareLiftedFunction(
+        semantics_module.get(), "__anvill_lifted_function_template");
+    remill::CloneBlockFunctionInto(block_template);
+
+    auto &entry = block_template->getEntryBlock();
+    llvm::DenseSet<llvm::Instruction *> needed;
+    for (auto it = entry.rbegin(); it != entry.rend(); ++it) {
+      auto &inst = *it;
+      if (inst.isTerminator()) {
+        continue;
+      }
+
+      if (!needed.count(&inst)) {
+        const auto is_reg = !llvm::isa<llvm::AllocaInst>(inst) &&
+                            !inst.mayHaveSideEffects() && inst.hasName() &&
+                            options.arch->RegisterByName(inst.getName().str());
+        if (is_reg) {
+          continue;
+        }
+        needed.insert(&inst);
+      }
+
+      // Operands come before their uses, so walking backward finds everything
+      // that a needed instruction depends upon.
+      for (auto &op : inst.operands()) {
+        if (auto op_inst = llvm::dyn_cast<llvm::Instruction>(op.get());
+            op_inst && op_inst->getParent() == &entry) {
+          needed.insert(op_inst);
+        }
+      }
+    }
+
+    template_insts.clear();
+    for (auto &inst : entry) {
+      if (needed.count(&inst)) {
+        template_insts.push_back(&inst);
+      }
+    }
+  }
+
+  llvm::ValueToValueMapTy value_map;
+  for (auto i = 0u; i < lifted_func->arg_size(); ++i) {
+    value_map[block_template->getArg(i)] = lifted_func->getArg(i);
+  }
+
+  auto entry = llvm::BasicBlock::Create(llvm_context, "", lifted_func);
+  for (auto inst : template_insts) {
+    auto copy = inst->clone();
+    copy->setName(inst->getName());
+    copy->setDebugLoc(llvm::DebugLoc());
+    entry->getInstList().push_back(copy);
+    value_map[inst] = copy;
+    llvm::RemapInstruction(copy, value_map,
+                           llvm::RF_NoModuleLevelChanges |
+                               llvm::RF_IgnoreMissingLocals);
+  }
+}
+
 // Set up `native_func` to be able to call `lifted_func`. This means
 // marshalling high-level argument types into lower-level values to pass into
 // a stack-allocated `State` structure. This also involves providing initial
@@ -1547,7 +2270,8 @@ void FunctionLifter::CallLiftedFunctionFromNativeFunction(void) {
   // of Remill lifted code, and marshal out the return value, if any.
   auto &decl = addr_to_decl[func_address];
   if (!decl.address) {
-    auto maybe_decl = FunctionDecl::Create(*native_func, options.arch);
+    auto maybe_decl = FunctionDecl::Create(*native_func, options.arch,
+                                            signature_allocations);
     if (remill::IsError(maybe_decl)) {
       LOG(ERROR) << "Unable to create FunctionDecl for "
                  << remill::LLVMThingToString(native_func->getFunctionType())
@@ -1650,68 +2374,194 @@ void FunctionLifter::CallLiftedFunctionFromNativeFunction(void) {
   }
 }
 
+// Record the data provenance of `native_func`. Now that everything is inlined,
+// the writes to registers are stores into the `State` structure, annotated
+// with the PCs of the instructions that made them. The stored values are
+// tagged with provenance records, as the stores themselves won't survive the
+// `State` structure being optimized away.
+void FunctionLifter::RecordDataflowProvenance(void) {
+  const auto &dl = semantics_module->getDataLayout();
+  const auto entry_block = &(native_func->getEntryBlock());
+  std::vector<llvm::Metadata *> records;
+  llvm::DenseSet<llvm::MDNode *> seen_records;
+
+  for (auto &inst : llvm::instructions(*native_func)) {
+    auto store = llvm::dyn_cast<llvm::StoreInst>(&inst);
+
+    // The entry block only initializes the `State` structure; the first lifted
+    // instruction is always in a later block.
+    if (!store || store->getParent() == entry_block) {
+      continue;
+    }
+
+    auto val = llvm::dyn_cast<llvm::Instruction>(store->getValueOperand());
+    auto pc_annot = store->getMetadata(pc_annotation_id);
+    if (!val || !pc_annot || pc_annot->getNumOperands() != 1u ||
+        val->getMetadata(provenance_id)) {
+      continue;
+    }
+
+    auto pc = llvm::mdconst::dyn_extract<llvm::ConstantInt>(
+        pc_annot->getOperand(0));
+    if (!pc) {
+      continue;
+    }
+
+    auto ptr = store->getPointerOperand();
+    llvm::APInt offset(dl.getIndexTypeSizeInBits(ptr->getType()), 0);
+    if (ptr->stripAndAccumulateConstantOffsets(dl, offset, true) !=
+            state_ptr ||
+        offset.isNegative()) {
+      continue;
+    }
+
+    auto reg = options.arch->RegisterAtStateOffset(offset.getZExtValue());
+    if (!reg) {
+      continue;
+    }
+
+    auto record = GetProvenanceNode(pc, reg->name);
+    val->setMetadata(provenance_id, record);
+    if (seen_records.insert(record).second) {
+      records.push_back(record);
+    }
+  }
+
+  if (!records.empty()) {
+    SetProvenanceTable(*native_func, records);
+  }
+}
+
 // In practice, lifted functions are not workable as is; we need to emulate
 // `__attribute__((flatten))`, i.e. recursively inline as much as possible, so
 // that all semantics and helpers are completely inlined.
+//
+// This is driven by a work list of call sites. The only new call sites after an
+// inlining step are those that were copied in from the callee, so we never
+// rescan the rest of `native_func`.
 void FunctionLifter::RecursivelyInlineLiftedFunctionIntoNativeFunction(void) {
-  std::vector<llvm::CallInst *> calls_to_inline;
+  calls_to_inline.clear();
+  insts_without_provenance.clear();
 
-  // Set of instructions that we should not annotate because we can't tie them
-  // to a particular instruction address.
-  std::unordered_set<llvm::Instruction *> insts_without_provenance;
-  if (options.pc_metadata_name) {
-    for (auto &inst : llvm::instructions(*native_func)) {
-      if (!inst.getMetadata(pc_annotation_id)) {
-        insts_without_provenance.insert(&inst);
-      }
+  const auto max_size = options.max_inlined_semantics_size;
+  auto enqueue_if_inlinable = [&](llvm::Instruction &inst) {
+    auto call_inst = llvm::dyn_cast<llvm::CallInst>(&inst);
+    if (!call_inst) {
+      return;
+    }
+
+    auto called_func = call_inst->getCalledFunction();
+    if (!called_func || called_func->isDeclaration() ||
+        called_func->hasFnAttribute(llvm::Attribute::NoInline)) {
+      return;
     }
+
+    // Semantics functions are lazily loaded, so the first call to one is what
+    // pulls its body into `semantics_module`.
+    MaterializeSemanticsFunction(called_func);
+
+    // Leave overly big semantics functions as out-of-line calls. They are
+    // copied into the target module alongside the lifted function. The
+    // lifted function itself must always be inlined.
+    if (max_size && called_func != lifted_func &&
+        called_func->getInstructionCount() > max_size) {
+      return;
+    }
+
+    calls_to_inline.push_back(call_inst);
+  };
+
+  for (auto &inst : llvm::instructions(*native_func)) {
+    if (options.pc_metadata_name && !inst.getMetadata(pc_annotation_id)) {
+      insts_without_provenance.insert(&inst);
+    }
+    enqueue_if_inlinable(inst);
   }
 
-  for (auto changed = true; changed; changed = !calls_to_inline.empty()) {
-    calls_to_inline.clear();
+  while (!calls_to_inline.empty()) {
+    llvm::CallInst *const call_inst = calls_to_inline.back();
+    calls_to_inline.pop_back();
 
-    for (auto &inst : llvm::instructions(*native_func)) {
-      if (auto call_inst = llvm::dyn_cast<llvm::CallInst>(&inst); call_inst) {
-        if (auto called_func = call_inst->getCalledFunction();
-            called_func && !called_func->isDeclaration() &&
-            !called_func->hasFnAttribute(llvm::Attribute::NoInline)) {
-          calls_to_inline.push_back(call_inst);
-        }
-      }
+    llvm::MDNode *call_pc = nullptr;
+    if (options.pc_metadata_name) {
+      call_pc = call_inst->getMetadata(pc_annotation_id);
     }
 
-    for (llvm::CallInst *call_inst : calls_to_inline) {
-      llvm::MDNode *call_pc = nullptr;
-      if (options.pc_metadata_name) {
-        call_pc = call_inst->getMetadata(pc_annotation_id);
+    // `InlineFunction` splits the block containing the call, and lays out
+    // the inlined code after `prev_inst` and before `next_inst`, all before
+    // `next_block`. The only exception is static allocas, which are hoisted
+    // into the entry block. This lets us find all the inlined instructions
+    // without scanning the whole function after every inlining.
+    llvm::Instruction *const prev_inst = call_inst->getPrevNode();
+    llvm::Instruction *const next_inst = call_inst->getNextNode();
+    llvm::BasicBlock *const call_block = call_inst->getParent();
+    llvm::BasicBlock *const next_block = call_block->getNextNode();
+
+    llvm::InlineFunctionInfo info;
+    if (!InlineFunction(call_inst, info)) {
+      LOG(ERROR) << "Unable to inline call to "
+                 << call_inst->getCalledFunction()->getName().str()
+                 << " in function at " << std::hex << func_address
+                 << std::dec;
+      continue;
+    }
+
+    // Propagate PC metadata from call sites into inlined call bodies.
+    auto annotate = [&](llvm::Instruction &inst) {
+      if (!options.pc_metadata_name || inst.getMetadata(pc_annotation_id) ||
+          insts_without_provenance.count(&inst)) {
+        return;
+
+      // This call site had no associated PC metadata, and so we want
+      // to exclude any inlined code from accidentally being associated
+      // with other PCs on future passes.
+      } else if (!call_pc) {
+        insts_without_provenance.insert(&inst);
+
+      // We can propagate the annotation.
+      } else {
+        inst.setMetadata(pc_annotation_id, call_pc);
       }
+    };
 
-      llvm::InlineFunctionInfo info;
-      InlineFunction(call_inst, info);
+    if (options.pc_metadata_name) {
+      for (auto &inst : native_func->getEntryBlock()) {
+        if (!llvm::isa<llvm::AllocaInst>(inst)) {
+          break;
+        }
+        annotate(inst);
+      }
+    }
 
-      // Propagate PC metadata from call sites into inlined call bodies.
-      if (options.pc_metadata_name) {
-        for (auto &inst : llvm::instructions(*native_func)) {
-          if (!inst.getMetadata(pc_annotation_id)) {
-            if (insts_without_provenance.count(&inst)) {
-              continue;
-
-            // This call site had no associated PC metadata, and so we want
-            // to exclude any inlined code from accidentally being associated
-            // with other PCs on future passes.
-            } else if (!call_pc) {
-              insts_without_provenance.insert(&inst);
-
-            // We can propagate the annotation.
-            } else {
-              inst.setMetadata(pc_annotation_id, call_pc);
-            }
-          }
+    llvm::BasicBlock *block = prev_inst ? prev_inst->getParent() : call_block;
+    auto it = prev_inst ? std::next(prev_inst->getIterator()) : block->begin();
+    for (;;) {
+      if (it == block->end()) {
+        block = block->getNextNode();
+        if (!block || block == next_block) {
+          break;
         }
+        it = block->begin();
+
+      } else if (&*it == next_inst) {
+        break;
+
+      } else {
+        auto &inst = *it++;
+        annotate(inst);
+        enqueue_if_inlinable(inst);
       }
     }
   }
 
+  // Now that everything that reads from the `State` structure is inlined, we
+  // can tell which registers need to be initialized.
+  InitializeLiveStateStructureRegisters();
+
+  if (options.track_provenance) {
+    RecordDataflowProvenance();
+  }
+
   // Initialize cleanup optimizations
   llvm::legacy::FunctionPassManager fpm(semantics_module.get());
   fpm.add(llvm::createCFGSimplificationPass());
@@ -1749,47 +2599,9 @@ llvm::Function *FunctionLifter::DeclareFunction(const FunctionDecl &decl) {
   return GetOrDeclareFunction(decl);
 }
 
-// Lift a function. Will return `nullptr` if the memory is
-// not accessible or executable.
-llvm::Function *FunctionLifter::LiftFunction(const FunctionDecl &decl) {
-
-  addr_to_decl.clear();
-  addr_to_func.clear();
-  edge_work_list.clear();
-  edge_to_dest_block.clear();
-  addr_to_block.clear();
-  inst_lifter.ClearCache();
-  curr_inst = nullptr;
-  state_ptr = nullptr;
-  mem_ptr_ref = nullptr;
-  func_address = decl.address;
-  native_func = DeclareFunction(decl);
-
-  // Not a valid address, or memory isn't executable.
-  auto [first_byte, first_byte_avail, first_byte_perms] =
-      memory_provider.Query(func_address);
-  if (!MemoryProvider::IsValidAddress(first_byte_avail) ||
-      !MemoryProvider::IsExecutable(first_byte_perms)) {
-    return nullptr;
-  }
-
-  // This is our higher-level function, i.e. it presents itself more like
-  // a function compiled from C/C++, rather than being a three-argument Remill
-  // function. In this function, we will stack-allocate a `State` structure,
-  // then call a `lifted_func` below, which will embed the instruction
-  // semantics.
-  native_func = GetOrDeclareFunction(decl);
-
-  // Check if we already lifted this function. If so, do not re-lift it.
-  if (!native_func->isDeclaration()) {
-    return native_func;
-  }
-
-  // The address is valid, the memory is executable, but we don't actually have
-  // the data available for lifting, so leave us with just a declaration.
-  if (!MemoryProvider::HasByte(first_byte_avail)) {
-    return native_func;
-  }
+// Declare `lifted_func`, and lift the instructions of the function at
+// `func_address` into it.
+void FunctionLifter::LiftInstructionsIntoLiftedFunction(void) {
 
   // Every lifted function starts as a clone of __remill_basic_block. That
   // prototype has multiple arguments (memory pointer, state pointer, program
@@ -1800,7 +2612,12 @@ llvm::Function *FunctionLifter::LiftFunction(const FunctionDecl &decl) {
   state_ptr = remill::NthArgument(lifted_func, remill::kStatePointerArgNum);
   CHECK(lifted_func->isDeclaration());
 
-  remill::CloneBlockFunctionInto(lifted_func);
+  if (options.declare_registers_on_demand) {
+    InitializeLiftedFunctionFromTemplate();
+  } else {
+    remill::CloneBlockFunctionInto(lifted_func);
+  }
+
   lifted_func->removeFnAttr(llvm::Attribute::NoInline);
   lifted_func->addFnAttr(llvm::Attribute::InlineHint);
   lifted_func->addFnAttr(llvm::Attribute::AlwaysInline);
@@ -1808,10 +2625,10 @@ llvm::Function *FunctionLifter::LiftFunction(const FunctionDecl &decl) {
 
   const auto pc = remill::NthArgument(lifted_func, remill::kPCArgNum);
   const auto entry_block = &(lifted_func->getEntryBlock());
-  const auto pc_ptr = inst_lifter.LoadRegAddress(entry_block, state_ptr,
-                                                 remill::kPCVariableName);
-  const auto next_pc_ptr = inst_lifter.LoadRegAddress(
-      entry_block, state_ptr, remill::kNextPCVariableName);
+  pc_ptr_ref = inst_lifter.LoadRegAddress(entry_block, state_ptr,
+                                          remill::kPCVariableName);
+  next_pc_ptr_ref = inst_lifter.LoadRegAddress(entry_block, state_ptr,
+                                               remill::kNextPCVariableName);
 
   mem_ptr_ref = remill::LoadMemoryPointerRef(entry_block);
 
@@ -1821,8 +2638,8 @@ llvm::Function *FunctionLifter::LiftFunction(const FunctionDecl &decl) {
   // so we want to ensure it gets reliably initialized before any lifted
   // instructions may depend upon it.
   llvm::IRBuilder<> ir(entry_block);
-  ir.CreateStore(pc, next_pc_ptr);
-  ir.CreateStore(pc, pc_ptr);
+  ir.CreateStore(pc, next_pc_ptr_ref);
+  ir.CreateStore(pc, pc_ptr_ref);
 
   // Add a branch between the first block of the lifted function, which sets
   // up some local variables, and the block that will contain the lifted
@@ -1837,20 +2654,247 @@ llvm::Function *FunctionLifter::LiftFunction(const FunctionDecl &decl) {
   AnnotateInstructions(entry_block, pc_annotation_id,
                        GetPCAnnotation(func_address));
 
+  TraceScope lift_scope(options.tracer, "lift", "lift", native_func,
+                        func_address);
+
   // Go lift all instructions!
   VisitInstructions(func_address);
+}
+
+// Make `lifted_func` a copy of `body`, in place of lifting the instructions
+// of the function at `func_address`.
+//
+// The kept body was lifted alongside one of the other native functions at
+// `func_address`, so recursive calls in it go to that function, rather than to
+// `native_func`. They run the same code.
+void FunctionLifter::CopyKeptBodyIntoLiftedFunction(const LiftedBody &body) {
+  llvm::ValueToValueMapTy value_map;
+  lifted_func = llvm::CloneFunction(body.func, value_map);
+  lifted_func->setName(native_func->getName() + ".lifted");
+  lifted_func->removeFnAttr(llvm::Attribute::NoInline);
+  lifted_func->addFnAttr(llvm::Attribute::InlineHint);
+  lifted_func->addFnAttr(llvm::Attribute::AlwaysInline);
+  state_ptr = remill::NthArgument(lifted_func, remill::kStatePointerArgNum);
+
+  for (auto addr : body.referenced_funcs) {
+    NoteReferencedFunction(addr);
+  }
+  exceeded_budget = body.exceeded_budget;
+  num_lifted_insts = body.num_lifted_insts;
+}
+
+// Keep the Remill form of the function at `address` once it's next lifted.
+void FunctionLifter::KeepLiftedBody(uint64_t address) {
+  if (!kept_bodies.count(address)) {
+    addrs_to_keep.insert(address);
+  }
+}
+
+// Lift a function. Will return `nullptr` if the memory is
+// not accessible or executable.
+llvm::Function *FunctionLifter::LiftFunction(const FunctionDecl &decl) {
+  ANVILL_TRACE_ZONE("FunctionLifter::LiftFunction");
+  ANVILL_TRACE_ZONE_TAG(decl.address, 0u);
+
+  addr_to_decl.clear();
+  addr_to_func.clear();
+  edge_work_list.clear();
+  edge_to_dest_block.clear();
+  addr_to_inst.clear();
+  pending_splits.clear();
+  fall_through_pc.reset();
+  speculative_decoder.Clear();
+  num_serial_decodes = 0u;
+  inst_templates.clear();
+  inst_lifter.ClearCache();
+  curr_inst = nullptr;
+  state_ptr = nullptr;
+  deferred_state_init_point = nullptr;
+  mem_ptr_ref = nullptr;
+  pc_ptr_ref = nullptr;
+  next_pc_ptr_ref = nullptr;
+  lift_start = std::chrono::steady_clock::now();
+  num_lifted_insts = 0u;
+  exceeded_budget = nullptr;
+  func_address = decl.address;
+  native_func = DeclareFunction(decl);
+
+  // Not a valid address, or memory isn't executable.
+  auto [first_byte, first_byte_avail, first_byte_perms] =
+      memory_provider.Query(func_address);
+  if (!MemoryProvider::IsValidAddress(first_byte_avail) ||
+      !MemoryProvider::IsExecutable(first_byte_perms)) {
+    return nullptr;
+  }
+
+  // This is our higher-level function, i.e. it presents itself more like
+  // a function compiled from C/C++, rather than being a three-argument Remill
+  // function. In this function, we will stack-allocate a `State` structure,
+  // then call a `lifted_func` below, which will embed the instruction
+  // semantics.
+  native_func = GetOrDeclareFunction(decl);
+
+  // Check if we already lifted this function, or gave up on lifting it. If
+  // so, do not re-lift it.
+  if (!native_func->isDeclaration() ||
+      native_func->hasFnAttribute(kBudgetExceededAttribute)) {
+    return native_func;
+  }
+
+  // The address is valid, the memory is executable, but we don't actually have
+  // the data available for lifting, so leave us with just a declaration.
+  if (!MemoryProvider::HasByte(first_byte_avail)) {
+    return native_func;
+  }
+
+  if (options.lift_thunks_as_tail_calls && TryLiftThunk(decl)) {
+    return native_func;
+  }
+
+  // If we've kept the Remill form of this function from lifting it with
+  // another prototype, then call a copy of it, rather than lifting all of
+  // its instructions again.
+  if (auto kept_it = kept_bodies.find(func_address);
+      kept_it != kept_bodies.end()) {
+    CopyKeptBodyIntoLiftedFunction(kept_it->second);
+
+  } else if (addrs_to_keep.count(func_address)) {
+    LiftedBody body;
+    kept_body_refs = &(body.referenced_funcs);
+    LiftInstructionsIntoLiftedFunction();
+    kept_body_refs = nullptr;
+
+    llvm::ValueToValueMapTy value_map;
+    body.func = llvm::CloneFunction(lifted_func, value_map);
+    body.func->setName(lifted_func->getName() + ".kept");
+    body.func->removeFnAttr(llvm::Attribute::AlwaysInline);
+    body.func->addFnAttr(llvm::Attribute::NoInline);
+    body.exceeded_budget = exceeded_budget;
+    body.num_lifted_insts = num_lifted_insts;
+    kept_bodies.emplace(func_address, std::move(body));
+    addrs_to_keep.erase(func_address);
+
+  } else {
+    LiftInstructionsIntoLiftedFunction();
+  }
 
   // Fill up `native_func` with a basic block and make it call `lifted_func`.
   // This creates things like the stack-allocated `State` structure.
-  CallLiftedFunctionFromNativeFunction();
+  {
+    TraceScope scope(options.tracer, "call-lifted-function", "lift",
+                     native_func, func_address);
+    ANVILL_TRACE_ZONE("FunctionLifter::CallLiftedFunctionFromNativeFunction");
+    CallLiftedFunctionFromNativeFunction();
+  }
 
   // The last stage is that we need to recursively inline all calls to semantics
   // functions into `native_func`.
-  RecursivelyInlineLiftedFunctionIntoNativeFunction();
+  {
+    TraceScope scope(options.tracer, "inline", "lift", native_func,
+                     func_address);
+    ANVILL_TRACE_ZONE("FunctionLifter::RecursivelyInline");
+    ANVILL_TRACE_ZONE_TAG(func_address, num_lifted_insts);
+    RecursivelyInlineLiftedFunctionIntoNativeFunction();
+  }
+
+  // Everything in `lifted_func` is now inlined into `native_func`, so drop
+  // it rather than keeping it alive in `semantics_module` across lifts.
+  if (lifted_func->use_empty()) {
+    lifted_func->eraseFromParent();
+    lifted_func = nullptr;
+  }
+
+  if (options.max_function_ir_size &&
+      native_func->getInstructionCount() > options.max_function_ir_size) {
+    AbandonFunction("max_function_ir_size");
+
+  } else if (exceeded_budget) {
+    LOG(WARNING) << "Function at " << std::hex << func_address << std::dec
+                 << " went over its " << exceeded_budget
+                 << " budget; the rest of its code was not lifted";
+    IncrementCounter(Counter::kLiftBudgetExceeded);
+    native_func->addFnAttr(kBudgetExceededAttribute, exceeded_budget);
+  }
 
   return native_func;
 }
 
+// Try to lift `native_func` as a thunk, i.e. a function whose entry is
+// redirected to another function, or whose first instruction jumps to another
+// function, e.g. a PLT entry or an import trampoline. If the other function
+// has the same prototype as `decl`, then `native_func` is made to tail-call
+// it, without going through the instruction lifter.
+bool FunctionLifter::TryLiftThunk(const FunctionDecl &decl) {
+  auto target = options.ctrl_flow_provider->GetRedirection(func_address);
+  if (target == func_address) {
+    remill::Instruction inst;
+    if (!DecodeInstructionInto(func_address, false /* is_delayed */, &inst) ||
+        !inst.IsValid() ||
+        (has_delay_slots && options.arch->MayHaveDelaySlot(inst))) {
+      return false;
+    }
+
+    switch (inst.category) {
+      case remill::Instruction::kCategoryDirectJump:
+        target = inst.branch_taken_pc;
+        break;
+
+      // E.g. `jmp [rip + slot]`, where the slot is known to hold exactly one
+      // function.
+      case remill::Instruction::kCategoryIndirectJump: {
+        const auto maybe_targets =
+            options.ctrl_flow_provider->TryGetControlFlowTargets(inst.pc);
+        if (!maybe_targets || !maybe_targets->complete) {
+          return false;
+        }
+
+        const auto &dests = maybe_targets->destination_list;
+        if (dests.empty() ||
+            std::any_of(dests.begin(), dests.end(),
+                        [&](uint64_t dest) { return dest != dests.front(); })) {
+          return false;
+        }
+        target = dests.front();
+        break;
+      }
+
+      default: return false;
+    }
+  }
+
+  const auto target_decl = TryGetTargetFunctionType(target);
+  if (!target_decl || target_decl->address == func_address ||
+      !HaveSameLocations(decl, *target_decl)) {
+    return false;
+  }
+
+  const auto target_func = DeclareFunction(*target_decl);
+  if (!target_func ||
+      target_func->getFunctionType() != native_func->getFunctionType()) {
+    return false;
+  }
+
+  NoteReferencedFunction(target_decl->address);
+
+  std::vector<llvm::Value *> args;
+  args.reserve(native_func->arg_size());
+  for (auto &arg : native_func->args()) {
+    args.push_back(&arg);
+  }
+
+  llvm::IRBuilder<> ir(
+      llvm::BasicBlock::Create(llvm_context, "", native_func));
+  const auto call = ir.CreateCall(target_func, args);
+  call->setCallingConv(target_func->getCallingConv());
+  call->setTailCallKind(llvm::CallInst::TCK_Tail);
+  if (call->getType()->isVoidTy()) {
+    ir.CreateRetVoid();
+  } else {
+    ir.CreateRet(call);
+  }
+  return true;
+}
+
 // Returns the address of a named function.
 std::optional<uint64_t>
 FunctionLifter::AddressOfNamedFunction(const std::string &func_name) const {
@@ -1892,12 +2936,16 @@ llvm::Function *EntityLifter::LiftEntity(const FunctionDecl &decl) const {
     }
   });
 
-  LOG_IF(ERROR, found_by_address != nullptr)
-      << "Ignoring existing version of function at address " << std::hex
-      << decl.address << " with type "
-      << remill::LLVMThingToString(found_by_address->getFunctionType())
-      << " and lifting function with type "
-      << remill::LLVMThingToString(module_func_type);
+  // There's another version of this function, with a different prototype,
+  // e.g. because its prototype is ambiguous. Keep the Remill form of whichever
+  // version is lifted next, so that the other versions can share it rather
+  // than each lifting the same instructions.
+  if (found_by_address) {
+    DLOG(INFO) << "Lifting another version of function at address "
+               << std::hex << decl.address << std::dec << " with type "
+               << remill::LLVMThingToString(module_func_type);
+    func_lifter.KeepLiftedBody(decl.address);
+  }
 
   // Try to lift the function. If we failed then return the function found
   // with a matching type, if any.
@@ -1933,6 +2981,68 @@ llvm::Function *EntityLifter::LiftEntity(const FunctionDecl &decl) const {
   return func_in_target_module;
 }
 
+// Lift a function, recording the functions that its lifted code references
+// into `referenced_funcs`.
+llvm::Function *
+EntityLifter::LiftEntity(const FunctionDecl &decl,
+                         std::vector<uint64_t> &referenced_funcs) const {
+  auto &func_lifter = impl->function_lifter;
+  func_lifter.TrackReferencedFunctions(&referenced_funcs);
+  const auto func = LiftEntity(decl);
+  func_lifter.TrackReferencedFunctions(nullptr);
+  return func;
+}
+
+// Lift the functions at `roots`, then the functions that they reference, and
+// so on, breadth-first, so that each function is lifted at its least depth.
+std::vector<llvm::Function *>
+EntityLifter::LiftReachableEntities(const std::vector<uint64_t> &roots,
+                                    unsigned max_depth) const {
+  std::vector<llvm::Function *> lifted;
+  std::unordered_map<uint64_t, unsigned> depths;
+  std::deque<uint64_t> work_list;
+  for (auto addr : roots) {
+    if (depths.try_emplace(addr, 0u).second) {
+      work_list.push_back(addr);
+    }
+  }
+
+  std::vector<uint64_t> refs;
+  while (!work_list.empty()) {
+    const auto addr = work_list.front();
+    work_list.pop_front();
+
+    const auto decl = impl->type_provider->TryGetFunctionType(addr);
+    if (!decl) {
+      LOG(ERROR) << "Missing type information for function at address "
+                 << std::hex << addr << std::dec;
+      continue;
+    }
+
+    refs.clear();
+    const auto func = LiftEntity(*decl, refs);
+    if (!func || func->isDeclaration()) {
+      continue;
+    }
+    lifted.push_back(func);
+
+    // Functions past the depth limit have already been declared by the code
+    // that references them; they just aren't lifted.
+    const auto depth = depths[addr];
+    if (max_depth && depth >= max_depth) {
+      continue;
+    }
+
+    for (auto ref : refs) {
+      if (depths.try_emplace(ref, depth + 1u).second) {
+        work_list.push_back(ref);
+      }
+    }
+  }
+
+  return lifted;
+}
+
 // Declare the function associated with `decl` in the context's module.
 //
 // NOTE(pag): If this function returns `nullptr` then it means that we cannot
@@ -1968,12 +3078,10 @@ llvm::Function *EntityLifter::DeclareEntity(const FunctionDecl &decl) const {
     return found_by_type;
   }
 
-  LOG_IF(ERROR, found_by_address != nullptr)
-      << "Ignoring existing version of function at address " << std::hex
-      << decl.address << " with type "
-      << remill::LLVMThingToString(found_by_address->getFunctionType())
-      << " and declaring function with type "
-      << remill::LLVMThingToString(module_func_type);
+  // See `EntityLifter::LiftEntity`.
+  if (found_by_address) {
+    func_lifter.KeepLiftedBody(decl.address);
+  }
 
   if (const auto func = func_lifter.DeclareFunction(decl)) {
     DCHECK(!module->getFunction(func->getName()));
@@ -2050,6 +3158,39 @@ FunctionLifter::AddFunctionToContext(llvm::Function *func, uint64_t address,
 
   remill::CloneFunctionInto(func, new_version);
 
+  // Semantics functions that were too big to be inlined are still called by
+  // the lifted function, so copy them, and whatever they call, into the
+  // target module.
+  std::vector<llvm::Function *> out_of_line_funcs{new_version};
+  while (!out_of_line_funcs.empty()) {
+    auto caller = out_of_line_funcs.back();
+    out_of_line_funcs.pop_back();
+    for (auto &inst : llvm::instructions(*caller)) {
+      auto call = llvm::dyn_cast<llvm::CallBase>(&inst);
+      if (!call) {
+        continue;
+      }
+
+      auto called_func = call->getCalledFunction();
+      if (!called_func || !called_func->isDeclaration()) {
+        continue;
+      }
+
+      auto sem_func = semantics_module->getFunction(called_func->getName());
+      if (!sem_func || sem_func->isDeclaration()) {
+        continue;
+      }
+
+      MaterializeSemanticsFunction(sem_func);
+      remill::CloneFunctionInto(sem_func, called_func);
+      called_func->setLinkage(sem_func->getLinkage());
+      called_func->removeFnAttr(llvm::Attribute::AlwaysInline);
+      called_func->removeFnAttr(llvm::Attribute::InlineHint);
+      called_func->addFnAttr(llvm::Attribute::NoInline);
+      out_of_line_funcs.push_back(called_func);
+    }
+  }
+
   // Now that we're done, erase the body of `func`. We keep `func` around
   // just in case it will be needed in future lifts.
   EraseFunctionBody(func);
@@ -19,19 +19,33 @@
 
 #include <anvill/Decl.h>
 #include <anvill/Lifters/Options.h>
+#include <llvm/ADT/BitVector.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/DenseSet.h>
+#include <llvm/ADT/Hashing.h>
 #include <llvm/IR/CallingConv.h>
+#include <llvm/IR/IRBuilder.h>
+#include <remill/Arch/Instruction.h>
 #include <remill/BC/InstructionLifter.h>
 #include <remill/BC/IntrinsicTable.h>
 
+#include <chrono>
 #include <cstdint>
-#include <map>
 #include <memory>
-#include <set>
+#include <optional>
+#include <string>
 #include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "SpeculativeDecoder.h"
 
 namespace llvm {
+class CallInst;
 class Function;
 class FunctionType;
+class Instruction;
 class LLVMContext;
 class MDNode;
 class Module;
@@ -39,11 +53,11 @@ class Value;
 }  // namespace llvm
 namespace remill {
 class Arch;
-class Instruction;
 struct Register;
 }  // namespace remill
 namespace anvill {
 
+class DecodedInstructionCache;
 class EntityLifterImpl;
 class MemoryProvider;
 class TypeProvider;
@@ -55,7 +69,8 @@ class FunctionLifter {
 
   FunctionLifter(const LifterOptions &options_,
                  MemoryProvider &memory_provider_,
-                 TypeProvider &type_provider_);
+                 TypeProvider &type_provider_,
+                 DecodedInstructionCache &decode_cache_);
 
   // Declare a lifted a function. Will return `nullptr` if the memory is
   // not accessible or executable.
@@ -75,12 +90,47 @@ class FunctionLifter {
   llvm::Function *AddFunctionToContext(llvm::Function *func, uint64_t address,
                                        EntityLifterImpl &lifter_context) const;
 
+  // Append the addresses of the functions that lifted code calls, or whose
+  // addresses it takes, to `refs`, until this is called with `nullptr`.
+  inline void TrackReferencedFunctions(std::vector<uint64_t> *refs) {
+    referenced_funcs = refs;
+  }
+
+  // Record that lifted code refers to the function at `address`, if
+  // references are being tracked.
+  inline void NoteReferencedFunction(uint64_t address) {
+    if (referenced_funcs) {
+      referenced_funcs->push_back(address);
+    }
+    if (kept_body_refs) {
+      kept_body_refs->push_back(address);
+    }
+  }
+
+  // Keep the Remill form of the function at `address` once it's next lifted,
+  // so that other native functions at `address`, i.e. with other prototypes,
+  // can be made to call it without decoding and lifting its instructions
+  // again.
+  void KeepLiftedBody(uint64_t address);
+
  private:
   const LifterOptions &options;
   MemoryProvider &memory_provider;
   TypeProvider &type_provider;
 
-  // Semantics module containing all instruction semantics.
+  // Instructions decoded by any function lifter of the entity lifter.
+  DecodedInstructionCache &decode_cache;
+
+  // Instructions decoded ahead of time for the function being lifted, and
+  // how many threads to use to decode them. See
+  // `LifterOptions::num_decode_threads`. `num_serial_decodes` counts the
+  // instructions decoded one at a time since the last sweep.
+  SpeculativeDecoder speculative_decoder;
+  unsigned num_decode_threads{1u};
+  unsigned num_serial_decodes{0u};
+
+  // Semantics module containing all instruction semantics. This is this
+  // lifter's own copy of the process-wide cached semantics.
   std::unique_ptr<llvm::Module> semantics_module;
 
   // Context associated with `module`.
@@ -98,6 +148,10 @@ class FunctionLifter {
   // double checking on function return addresses;
   const bool is_sparc;
 
+  // Can instructions of this architecture have delay slots? If not, then we
+  // don't need to ask about delay slots for every lifted instruction.
+  const bool has_delay_slots;
+
   // Are we lifting x86(-64) code?
   const bool is_x86_or_amd64;
 
@@ -114,6 +168,9 @@ class FunctionLifter {
   // original instructions.
   unsigned pc_annotation_id{0};
 
+  // Metadata kind of data provenance records. See `anvill/Provenance.h`.
+  unsigned provenance_id{0};
+
   // Address of the function currently being lifted.
   uint64_t func_address{0};
 
@@ -123,21 +180,71 @@ class FunctionLifter {
   // Three-argument Remill function into which instructions are lifted.
   llvm::Function *lifted_func{nullptr};
 
+  // If registers are declared on demand, then this is a clone of
+  // `__remill_basic_block`, made once, and `template_insts` are the
+  // instructions of its entry block that every `lifted_func` starts with.
+  // See `LifterOptions::declare_registers_on_demand`.
+  llvm::Function *block_template{nullptr};
+  std::vector<llvm::Instruction *> template_insts;
+
   // State pointer in `lifted_func`.
   llvm::Value *state_ptr{nullptr};
 
+  // If only live registers are initialized, then this is the instruction
+  // after which their initialization, and the zeroing of the `State`
+  // structure, goes, once it's known which registers are live.
+  llvm::Instruction *deferred_state_init_point{nullptr};
+
   // Pointer to the `Memory *` in `lifted_func`.
   llvm::Value *mem_ptr_ref{nullptr};
 
+  // Pointers to the `PC` and `NEXT_PC` variables in `lifted_func`, looked up
+  // once in its entry block rather than by name at every call site.
+  llvm::Value *pc_ptr_ref{nullptr};
+  llvm::Value *next_pc_ptr_ref{nullptr};
+
   // Current instruction being lifted.
   remill::Instruction *curr_inst{nullptr};
 
-  // The function that we use to track data provenance. This is a variadic
-  // function that takes each register as an argument. The parameters are
-  // untyped, due to using a variadic argument list.
+  // Where to record the functions referenced by lifted code, if anywhere.
+  // See `TrackReferencedFunctions`.
+  std::vector<uint64_t> *referenced_funcs{nullptr};
+
+  // The Remill form of a function, kept around so that each native function
+  // at its address can be lifted by calling a copy of it. The functions that
+  // it references, and the budget that it went over, are replayed for each
+  // of them.
+  struct LiftedBody {
+    llvm::Function *func{nullptr};
+    std::vector<uint64_t> referenced_funcs;
+    const char *exceeded_budget{nullptr};
+    uint64_t num_lifted_insts{0u};
+  };
+
+  // Addresses of functions whose bodies we should keep, and the bodies that
+  // we've kept. See `KeepLiftedBody`.
+  std::unordered_set<uint64_t> addrs_to_keep;
+  std::unordered_map<uint64_t, LiftedBody> kept_bodies;
+
+  // Where the functions referenced by the body being kept are recorded.
+  std::vector<uint64_t> *kept_body_refs{nullptr};
+
+  // When the current lift started, how many instructions it has lifted so
+  // far, and which of its budgets it went over, if any.
+  std::chrono::steady_clock::time_point lift_start;
+  uint64_t num_lifted_insts{0u};
+  const char *exceeded_budget{nullptr};
+
+  // Scratch state that is reset, but not freed, by each lift, so that lifting
+  // many functions in a row doesn't repeatedly allocate the same temporaries.
   //
-  // TODO(pag): Think about eventually having one per architecture.
-  llvm::Function *data_provenance_function{nullptr};
+  // `decoded_inst` is the most recently decoded instruction; its byte string
+  // and operand list keep their capacity from one instruction to the next.
+  // `calls_to_inline` and `insts_without_provenance` are used when inlining
+  // the lifted function into the native function.
+  remill::Instruction decoded_inst;
+  std::vector<llvm::CallInst *> calls_to_inline;
+  llvm::DenseSet<llvm::Instruction *> insts_without_provenance;
 
   // Mapping of function names to addresses.
   std::unordered_map<std::string, uint64_t> func_name_to_address;
@@ -146,19 +253,47 @@ class FunctionLifter {
   // is the instruction PC; the second entry is the PC of how we got to even
   // ask about the first entry (provenance).
   //
-  // NOTE(pag): The destination PC of the edge comes first in the work list so
-  //            that the ordering of the `std::set` processes the instructions
-  //            roughly in order.
-  std::set<std::pair<uint64_t, uint64_t>> edge_work_list;
+  // The work list is a min-heap, and the destination PC of the edge comes
+  // first, so that the instructions are processed roughly in order.
+  //
+  // The work list and the maps below are cleared, but not freed, at the start
+  // of each lift, so that their storage is reused across all functions lifted
+  // by this lifter.
+  std::vector<std::pair<uint64_t, uint64_t>> edge_work_list;
+
+  struct EdgeHash {
+    size_t operator()(const std::pair<uint64_t, uint64_t> &edge) const {
+      return llvm::hash_combine(edge.first, edge.second);
+    }
+  };
 
   // Maps control flow edges `(from_pc -> to_pc)` to the basic block associated
-  // with `to_pc`.
-  std::map<std::pair<uint64_t, uint64_t>, llvm::BasicBlock *>
+  // with `to_pc`. Only edges back into the entrypoint of the
+  // function are keyed by their `from_pc`, so that they are lifted as self-
+  // tail-calls. All other edges into the same `to_pc` share one block.
+  //
+  // Addresses can be anything, including the keys that `llvm::DenseMap`
+  // reserves, so maps keyed by addresses are `std::unordered_map`s.
+  std::unordered_map<std::pair<uint64_t, uint64_t>, llvm::BasicBlock *,
+                     EdgeHash>
       edge_to_dest_block;
 
-  // Maps an instruction address to a basic block that will hold the lifted code
-  // for that instruction.
-  std::unordered_map<uint64_t, llvm::BasicBlock *> addr_to_block;
+  // Maps an instruction address to the first LLVM instruction lifted for that
+  // instruction. Straight-line code is lifted into a single block, so this
+  // need not be the first instruction of its block.
+  std::unordered_map<uint64_t, llvm::Instruction *> addr_to_inst;
+
+  // Empty blocks standing in for edges into the middle of already lifted
+  // blocks, and the addresses that they target. Once all instructions are
+  // lifted, the targeted blocks are split, and these are replaced by the
+  // bottom halves. Splitting is deferred because the targeted block might be
+  // the one that's currently being lifted into, and so it may not yet have a
+  // terminator.
+  std::vector<std::pair<llvm::BasicBlock *, uint64_t>> pending_splits;
+
+  // Set by `VisitNormal` when the next instruction should be lifted into the
+  // same block as the current one, rather than into a block of its own.
+  std::optional<uint64_t> fall_through_pc;
 
   // Maps program counters to lifted functions.
   std::unordered_map<uint64_t, llvm::Function *> addr_to_func;
@@ -166,6 +301,26 @@ class FunctionLifter {
   // Maps addresses to function declarations, which describe ABIs and such.
   std::unordered_map<uint64_t, FunctionDecl> addr_to_decl;
 
+  // Signature allocations of native functions, shared by all native functions
+  // with the same type and calling convention.
+  SignatureAllocationCache signature_allocations;
+
+  // Maps `(current type, goal type)` pairs to the type hint functions in
+  // `semantics_module` that convert between them. Type hints are named after
+  // their goal types, and so this saves us from turning a type into a string
+  // for every hinted register at every instruction.
+  llvm::DenseMap<std::pair<llvm::Type *, llvm::Type *>, llvm::Function *>
+      type_hint_funcs;
+
+  // Maps instruction template keys to the instructions lifted for the first
+  // instruction with that key. An entry holding only a `nullptr` means that
+  // the lifted code couldn't be used as a template.
+  //
+  // Templates refer to values in the entry block of the function being lifted,
+  // e.g. register pointers, so they only live for the duration of one lift.
+  std::unordered_map<std::string, std::vector<llvm::Instruction *>>
+      inst_templates;
+
   // Get the annotation for the program counter `pc`, or `nullptr` if we're
   // not doing annotations.
   llvm::MDNode *GetPCAnnotation(uint64_t pc) const;
@@ -174,6 +329,17 @@ class FunctionLifter {
   // returned function is a "high-level" function.
   llvm::Function *GetOrDeclareFunction(const FunctionDecl &decl);
 
+  // Returns a key describing the shape of the lifted code of `inst`, i.e. its
+  // semantics function, size, and operands, but not its address. Returns an
+  // empty string if `inst` can't be lifted from a template.
+  std::string InstructionTemplateKey(const remill::Instruction &inst) const;
+
+  // Lift `inst` into `block`. If `options` allows it, then this stamps out a
+  // copy of the code lifted for an earlier instruction with the same shape,
+  // rather than driving Remill's instruction lifter.
+  void LiftInstructionIntoBlock(remill::Instruction &inst,
+                                llvm::BasicBlock *block);
+
   // Helper to get the basic block to contain the instruction at `addr`. This
   // function drives a work list, where the first time we ask for the
   // instruction at `addr`, we enqueue a bit of work to decode and lift that
@@ -215,6 +381,11 @@ class FunctionLifter {
   // from a control-flow perspective.
   void VisitNoOp(const remill::Instruction &inst, llvm::BasicBlock *block);
 
+  // Returns `true` if the instruction at `addr` can be lifted into the same
+  // block as the instruction that falls through into it, i.e. if it isn't
+  // already lifted or enqueued, and if it isn't the start of a function.
+  bool CanFallThroughInto(uint64_t addr);
+
   // Visit a direct jump control-flow instruction. The target of the jump is
   // known at decode time, and the target address is available in
   // `inst.branch_taken_pc`. Execution thus needs to transfer to the instruction
@@ -262,7 +433,12 @@ class FunctionLifter {
   // A wrapper around the type provider's TryGetFunctionType that makes use
   // of the control flow provider to handle control flow redirections for
   // thunks
-  std::optional<FunctionDecl> TryGetTargetFunctionType(std::uint64_t address);
+  std::shared_ptr<const FunctionDecl>
+  TryGetTargetFunctionType(std::uint64_t address);
+
+  // Returns `true` if `TryGetTargetFunctionType` would find a decl for
+  // `address`, without looking up the decl.
+  bool IsTargetFunctionHead(std::uint64_t address);
 
   // Visit a direct function call control-flow instruction. The target is known
   // at decode time, and its realized address is stored in
@@ -350,23 +526,10 @@ class FunctionLifter {
                                remill::Instruction *delayed_inst,
                                llvm::BasicBlock *block, bool on_taken_path);
 
-  // Instrument an instruction. This inject a `printf` call just before a
-  // lifted instruction to aid in debugging.
-  //
-  // TODO(pag): In future, this mechanism should be used to provide a feedback
-  //            loop, or to provide information to the `TypeProvider` for future
-  //            re-lifting of code.
-  //
-  // TODO(pag): Right now, this feature is enabled by a command-line flag, and
-  //            that flag is tested in `VisitInstruction`; we should move
-  //            lifting configuration decisions out of here so that we can pass
-  //            in a kind of `LiftingOptions` type that changes the lifter's
-  //            behavior.
-  void InstrumentDataflowProvenance(llvm::BasicBlock *block);
-
   // Adds a 'breakpoint' instrumentation, which calls functions that are named
   // with an instruction's address just before that instruction executes. These
-  // are nifty to spot checking bitcode.
+  // are nifty to spot checking bitcode. Compact breakpoints instead all call
+  // one function, passing it the instruction's address.
   void InstrumentCallBreakpointFunction(llvm::BasicBlock *block);
 
   // Visit a type hinted register at the current instruction. We use this
@@ -397,6 +560,18 @@ class FunctionLifter {
   // Visit all instructions. This runs the work list and lifts instructions.
   void VisitInstructions(uint64_t address);
 
+  // Split blocks at the targets of edges into the middle of them. See
+  // `pending_splits`.
+  void SplitBlocksAtEdges(void);
+
+  // Returns the name of the first lifting budget in `options` that the
+  // current lift has gone over, or `nullptr` if it's within all of them.
+  const char *CheckLiftBudget(void) const;
+
+  // Give up on `native_func`, leaving it as a declaration, because it went
+  // over `budget`.
+  void AbandonFunction(const char *budget);
+
   // Creates a type hint taint value that we can hook into downstream in the
   // optimization process.
   llvm::Function *
@@ -411,17 +586,44 @@ class FunctionLifter {
   bool DecodeInstructionInto(const uint64_t addr, bool is_delayed,
                              remill::Instruction *inst_out);
 
+  // Read up to `max_size` bytes of code starting at `addr` into `bytes`,
+  // after whatever is already in `bytes`. Reading stops at the first byte
+  // that isn't available or executable.
+  void ReadExecutableBytes(uint64_t addr, size_t max_size, std::string &bytes);
+
+  // Try to make `native_func` tail-call the function that it's a thunk for.
+  // Returns `false` if it isn't a thunk, or if it can't be lifted this way.
+  bool TryLiftThunk(const FunctionDecl &decl);
+
+  // Start the body of `lifted_func` with the variables of
+  // `__remill_basic_block` that aren't registers, leaving the addresses of
+  // registers to be computed as the lifted code uses them.
+  void InitializeLiftedFunctionFromTemplate(void);
+
   // Set up `native_func` to be able to call `lifted_func`. This means
   // marshalling high-level argument types into lower-level values to pass into
   // a stack-allocated `State` structure. This also involves providing initial
   // default values for registers.
   void CallLiftedFunctionFromNativeFunction(void);
 
+  // Record the data provenance of `native_func` by tagging the values written
+  // into registers with provenance records, and listing those records in the
+  // side table of `native_func`.
+  void RecordDataflowProvenance(void);
+
   // In practice, lifted functions are not workable as is; we need to emulate
   // `__attribute__((flatten))`, i.e. recursively inline as much as possible, so
   // that all semantics and helpers are completely inlined.
   void RecursivelyInlineLiftedFunctionIntoNativeFunction(void);
 
+  // Declare `lifted_func`, and lift the instructions of the function at
+  // `func_address` into it.
+  void LiftInstructionsIntoLiftedFunction(void);
+
+  // Make `lifted_func` a copy of `body`, in place of lifting the
+  // instructions of the function at `func_address`.
+  void CopyKeptBodyIntoLiftedFunction(const LiftedBody &body);
+
   // Allocate and initialize the state structure.
   void AllocateAndInitializeStateStructure(llvm::BasicBlock *block);
 
@@ -429,11 +631,41 @@ class FunctionLifter {
   // in `block`.
   void ArchSpecificStateStructureInitialization(llvm::BasicBlock *block);
 
-  // Initialize the state structure with default values, loaded from global
-  // variables. The purpose of these global variables is to show that there are
-  // some unmodelled external dependencies inside of a lifted function.
-  void
-  InitializeStateStructureFromGlobalRegisterVariables(llvm::BasicBlock *block);
+  // Zero the state structure in `block`, or defer it until the live
+  // registers are known.
+  void ZeroStateStructure(llvm::BasicBlock *block);
+
+  // Zero the state structure using `ir`, with one `llvm.memset` per run of
+  // zeroed bytes. If `live_bytes` is non-null, then only the bytes of `State`
+  // in `live_bytes` are zeroed.
+  void StoreStateZeroes(llvm::IRBuilder<> &ir,
+                        const llvm::BitVector *live_bytes);
+
+  // Initialize the registers of the state structure with default values,
+  // loaded from global variables, or read with `llvm.read_register`. The
+  // purpose of these is to show that there are some unmodelled external
+  // dependencies inside of a lifted function.
+  void InitializeStateStructureRegisters(llvm::BasicBlock *block);
+
+  // Store the default values of the registers into the state structure using
+  // `ir`. If `live_bytes` is non-null, then only the registers overlapping
+  // with the bytes of `State` in `live_bytes` are initialized.
+  void StoreInitialRegisterValues(llvm::IRBuilder<> &ir,
+                                  const llvm::BitVector *live_bytes);
+
+  // Store the value of `reg`, as read with `llvm.read_register`, into the
+  // state structure using `ir`.
+  void ReadRegisterIntoState(llvm::IRBuilder<> &ir,
+                             const remill::Register *reg);
+
+  // Find the bytes of the `State` structure that may be read by
+  // `native_func`, once everything is inlined into it. Returns `false` if the
+  // `State` structure escapes, and so any byte may be read.
+  bool FindLiveStateBytes(llvm::BitVector &live_bytes) const;
+
+  // Zero the state structure and initialize the registers that are live in
+  // `native_func`, if this was deferred.
+  void InitializeLiveStateStructureRegisters(void);
 
   // Generates a new program counter
   llvm::Value *GenerateProgramCounter(llvm::BasicBlock *block,
@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "SemanticsCache.h"
+
+#include <anvill/Counters.h>
+#include <glog/logging.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/DebugInfo.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Support/xxhash.h>
+#include <remill/Arch/Arch.h>
+#include <remill/BC/Compat/Error.h>
+#include <remill/BC/Util.h>
+#include <remill/OS/OS.h>
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+
+namespace anvill {
+namespace {
+
+using SemanticsKey = std::pair<std::string, std::string>;
+
+struct CachedSemantics {
+  llvm::SmallVector<char, 0> bitcode;
+  uint64_t hash{0};
+};
+
+// Serialized, pre-optimized semantics modules, keyed by architecture and
+// operating system names.
+static std::mutex gSemanticsLock;
+static std::map<SemanticsKey, CachedSemantics> gSemantics;
+
+// Directory of pruned semantics modules, produced by `anvill-prune-semantics`.
+static std::string gPrunedSemanticsDir;
+
+// Load the pruned semantics module of `arch` from `gPrunedSemanticsDir`, if
+// there is one. Pruned modules are named after the architecture only, as the
+// operating system only changes the triple and data layout, which
+// `PrepareModule` sets.
+static std::unique_ptr<llvm::Module>
+LoadPrunedSemantics(const remill::Arch *arch) {
+  if (gPrunedSemanticsDir.empty()) {
+    return nullptr;
+  }
+
+  llvm::SmallString<256> path(gPrunedSemanticsDir);
+  auto arch_name = remill::GetArchName(arch->arch_name);
+  llvm::sys::path::append(path,
+                          llvm::StringRef(arch_name.data(), arch_name.size()));
+  path += ".bc";
+
+  auto maybe_buffer = llvm::MemoryBuffer::getFile(path);
+  if (!maybe_buffer) {
+    return nullptr;
+  }
+
+  auto maybe_module =
+      llvm::parseBitcodeFile(**maybe_buffer, *(arch->context));
+  if (remill::IsError(maybe_module)) {
+    LOG(WARNING) << "Ignoring pruned semantics '" << path.str().str()
+                 << "': " << remill::GetErrorString(maybe_module);
+    return nullptr;
+  }
+
+  std::unique_ptr<llvm::Module> module =
+      std::move(remill::GetReference(maybe_module));
+  if (!remill::BasicBlockFunction(module.get())) {
+    LOG(WARNING) << "Ignoring pruned semantics '" << path.str().str()
+                 << "': it has no __remill_basic_block";
+    return nullptr;
+  }
+
+  arch->PrepareModule(module.get());
+  return module;
+}
+
+// Load the semantics of `arch` from disk, and prepare them for caching.
+static std::unique_ptr<llvm::Module> LoadSemantics(const remill::Arch *arch) {
+  if (auto module = LoadPrunedSemantics(arch)) {
+    return module;
+  }
+
+  auto module = remill::LoadArchSemantics(arch);
+  CHECK(module) << "Unable to load semantics for architecture "
+                << remill::GetArchName(arch->arch_name);
+
+  // Nothing downstream of lifting reads the debug information of the semantics,
+  // and it makes up a sizable fraction of the module. It's cheaper to drop it
+  // once here than in every lifted module.
+  llvm::StripDebugInfo(*module);
+  return module;
+}
+
+// Returns the cached semantics of `arch`, loading them if this is the first
+// time that they're requested.
+//
+// Cached semantics are never modified or freed, so it's safe to use them
+// without holding the lock.
+static const CachedSemantics &GetCachedSemantics(const remill::Arch *arch) {
+  SemanticsKey key(remill::GetArchName(arch->arch_name),
+                   remill::GetOSName(arch->os_name));
+
+  // We hold the lock while loading so that concurrent lifters for the same
+  // target don't all go to disk at once.
+  std::lock_guard<std::mutex> locker(gSemanticsLock);
+  auto it = gSemantics.find(key);
+  if (it != gSemantics.end()) {
+    IncrementCounter(Counter::kSemanticsCacheHits);
+  } else {
+    IncrementCounter(Counter::kSemanticsCacheMisses);
+    auto module = LoadSemantics(arch);
+    it = gSemantics.emplace(key, CachedSemantics()).first;
+    llvm::raw_svector_ostream os(it->second.bitcode);
+    llvm::WriteBitcodeToFile(*module, os);
+    it->second.hash = llvm::xxHash64(
+        llvm::StringRef(it->second.bitcode.data(), it->second.bitcode.size()));
+  }
+  return it->second;
+}
+
+}  // namespace
+
+std::unique_ptr<llvm::Module>
+LoadCachedArchSemantics(const remill::Arch *arch) {
+  const auto &semantics = GetCachedSemantics(arch);
+
+  // The lazy module keeps referring to the cached bitcode.
+  llvm::MemoryBufferRef buff(
+      llvm::StringRef(semantics.bitcode.data(), semantics.bitcode.size()),
+      "cached_semantics");
+
+  auto maybe_module = llvm::getLazyBitcodeModule(buff, *(arch->context));
+  CHECK(!remill::IsError(maybe_module))
+      << "Unable to parse cached semantics for architecture "
+      << remill::GetArchName(arch->arch_name) << ": "
+      << remill::GetErrorString(maybe_module);
+
+  std::unique_ptr<llvm::Module> module =
+      std::move(remill::GetReference(maybe_module));
+
+  // Every lifted function starts as a clone of `__remill_basic_block`, and
+  // the instruction lifter finds registers by looking into it.
+  MaterializeSemanticsFunction(remill::BasicBlockFunction(module.get()));
+  return module;
+}
+
+// Returns a hash of the cached semantics of `arch`.
+uint64_t CachedArchSemanticsHash(const remill::Arch *arch) {
+  return GetCachedSemantics(arch).hash;
+}
+
+// Returns the total size of the cached semantics of all architectures.
+uint64_t CachedArchSemanticsBytes(void) {
+  std::lock_guard<std::mutex> locker(gSemanticsLock);
+  uint64_t num_bytes = 0u;
+  for (const auto &[key, semantics] : gSemantics) {
+    num_bytes += semantics.bitcode.size();
+  }
+  return num_bytes;
+}
+
+// Look for pruned semantics modules in `dir` before falling back on those
+// of remill.
+void SetPrunedSemanticsDirectory(std::string dir) {
+  std::lock_guard<std::mutex> locker(gSemanticsLock);
+  gPrunedSemanticsDir = std::move(dir);
+}
+
+// Materialize the body of `func` if it was lazily loaded by
+// `LoadCachedArchSemantics`. This is a no-op for any other function.
+void MaterializeSemanticsFunction(llvm::Function *func) {
+  if (!func->isMaterializable()) {
+    return;
+  }
+  if (auto err = func->materialize(); remill::IsError(err)) {
+    LOG(FATAL) << "Unable to materialize semantics function "
+               << func->getName().str() << ": "
+               << remill::GetErrorString(err);
+  }
+}
+
+}  // namespace anvill
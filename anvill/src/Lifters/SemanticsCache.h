@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace llvm {
+class Function;
+class Module;
+}  // namespace llvm
+namespace remill {
+class Arch;
+}  // namespace remill
+namespace anvill {
+
+// Returns a fresh copy of the instruction semantics module for `arch`, in
+// the context of `arch`.
+//
+// Loading semantics from disk, and then preparing them, is expensive, and
+// every entity lifter needs its own copy. The first time that the semantics
+// of an architecture/OS pair are requested, they are loaded with remill (or
+// from a pruned semantics module, see `SetPrunedSemanticsDirectory`), have
+// their debug information stripped, and are then serialized into an in-memory
+// bitcode buffer that is shared by the whole process. The returned module is
+// lazily loaded from that buffer: only `__remill_basic_block` has a body, and
+// the bodies of all other semantics functions are left unmaterialized until
+// `MaterializeSemanticsFunction` is called on them.
+std::unique_ptr<llvm::Module> LoadCachedArchSemantics(const remill::Arch *arch);
+
+// Returns a hash of the cached semantics of `arch`, loading them if needed.
+// The hash changes whenever the semantics do, e.g. when remill is updated.
+uint64_t CachedArchSemanticsHash(const remill::Arch *arch);
+
+// Returns the total size of the cached semantics of all architectures.
+uint64_t CachedArchSemanticsBytes(void);
+
+// Look for pruned semantics modules in `dir`, named like `amd64_avx.bc`,
+// before falling back on the full semantics of remill. Only semantics that
+// haven't yet been cached are affected.
+void SetPrunedSemanticsDirectory(std::string dir);
+
+// Materialize the body of `func` if it was lazily loaded by
+// `LoadCachedArchSemantics`. This is a no-op for any other function.
+void MaterializeSemanticsFunction(llvm::Function *func);
+
+}  // namespace anvill
@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "SpeculativeDecoder.h"
+
+#include <llvm/ADT/StringRef.h>
+#include <remill/Arch/Arch.h>
+
+#include <algorithm>
+#include <thread>
+
+namespace anvill {
+
+// Decode the instructions in `bytes`, which start at `base`, using up to
+// `num_threads` threads.
+void SpeculativeDecoder::Sweep(const remill::Arch *arch, uint64_t base_,
+                               std::string bytes_, unsigned num_threads) {
+  Clear();
+  base = base_;
+  bytes = std::move(bytes_);
+  if (bytes.empty()) {
+    return;
+  }
+
+  // Chunks start on instruction boundaries on architectures with fixed-size
+  // instructions. They're at least a page in size, so that threads don't
+  // spend most of their time re-synchronizing with the instruction stream.
+  const uint64_t align = std::max<uint64_t>(1u, arch->MinInstructionAlign());
+  const uint64_t min_chunk_size = 4096u;
+  const uint64_t max_num_chunks =
+      std::max<uint64_t>(1u, bytes.size() / min_chunk_size);
+  const auto num_chunks = static_cast<unsigned>(
+      std::min<uint64_t>(std::max(1u, num_threads), max_num_chunks));
+  auto chunk_size = (bytes.size() + num_chunks - 1u) / num_chunks;
+  chunk_size = (chunk_size + align - 1u) / align * align;
+
+  chunks.resize(num_chunks);
+  std::vector<std::thread> threads;
+  threads.reserve(num_chunks);
+  for (auto i = 0u; i < num_chunks; ++i) {
+    const auto begin = std::min<uint64_t>(i * chunk_size, bytes.size());
+    const auto end = std::min<uint64_t>(begin + chunk_size, bytes.size());
+    threads.emplace_back([=](void) {
+      SweepChunk(arch, begin, end, chunks[i]);
+    });
+  }
+
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  // An instruction that straddles two chunks is decoded by both threads, from
+  // the same address and bytes, so it doesn't matter which one is kept.
+  for (const auto &entries : chunks) {
+    for (const auto &entry : entries) {
+      addr_to_entry.try_emplace(entry.addr, &entry);
+    }
+  }
+}
+
+// Linear-sweep decode `bytes[begin, end)`.
+void SpeculativeDecoder::SweepChunk(const remill::Arch *arch, uint64_t begin,
+                                    uint64_t end,
+                                    std::vector<Entry> &entries) const {
+  const uint64_t align = std::max<uint64_t>(1u, arch->MinInstructionAlign());
+  const uint64_t max_inst_size = arch->MaxInstructionSize();
+  for (auto offset = begin; offset < end;) {
+    auto &entry = entries.emplace_back();
+    entry.addr = base + offset;
+    entry.num_bytes = static_cast<unsigned>(
+        std::min<uint64_t>(max_inst_size, bytes.size() - offset));
+    entry.inst.bytes = bytes.substr(offset, entry.num_bytes);
+    entry.decoded =
+        arch->DecodeInstruction(entry.addr, entry.inst.bytes, entry.inst);
+
+    // Carry on after the decoded instruction, or, if decoding failed, at the
+    // next address where an instruction could start.
+    if (entry.decoded && !entry.inst.bytes.empty()) {
+      offset += entry.inst.bytes.size();
+    } else {
+      offset += align;
+    }
+  }
+}
+
+// Find the instruction decoded at `addr` from `bytes`.
+const remill::Instruction *
+SpeculativeDecoder::Find(uint64_t addr, const std::string &bytes_,
+                         bool &decoded) const {
+  if (!Covers(addr)) {
+    return nullptr;
+  }
+
+  auto it = addr_to_entry.find(addr);
+  if (it == addr_to_entry.end()) {
+    return nullptr;
+  }
+
+  const auto entry = it->second;
+  if (llvm::StringRef(bytes).substr(addr - base, entry->num_bytes) !=
+      llvm::StringRef(bytes_)) {
+    return nullptr;
+  }
+
+  decoded = entry->decoded;
+  return &(entry->inst);
+}
+
+// Forget everything that was decoded.
+void SpeculativeDecoder::Clear(void) {
+  base = 0;
+  bytes.clear();
+  chunks.clear();
+  addr_to_entry.clear();
+}
+
+}  // namespace anvill
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <remill/Arch/Instruction.h>
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace remill {
+class Arch;
+}  // namespace remill
+namespace anvill {
+
+// Decodes a run of executable bytes ahead of the function lifter, by linear
+// sweep, using several threads. This is speculative: each thread starts
+// decoding at the beginning of its own chunk of the bytes, which on
+// architectures with variable-length instructions needn't be the start of
+// an instruction. The lifter still decides which instructions are reachable
+// by recursive descent, and only uses the speculatively decoded instruction
+// at an address if it reaches that address, and reads the same bytes there.
+//
+// This relies on Remill's decoders being reentrant. They only read the
+// architecture's register tables, which are complete before anything is lifted.
+class SpeculativeDecoder {
+ public:
+  // Decode the instructions in `bytes`, which start at `base`, using up to
+  // `num_threads` threads. This replaces whatever was decoded before.
+  void Sweep(const remill::Arch *arch, uint64_t base, std::string bytes,
+             unsigned num_threads);
+
+  // Find the instruction decoded at `addr` from `bytes`. Returns `nullptr`
+  // if it wasn't decoded from those bytes. Otherwise, `decoded` is set to
+  // whether or not decoding succeeded.
+  const remill::Instruction *Find(uint64_t addr, const std::string &bytes,
+                                  bool &decoded) const;
+
+  // Forget everything that was decoded.
+  void Clear(void);
+
+  // Returns `true` if `addr` is inside of the most recently swept bytes.
+  bool Covers(uint64_t addr) const {
+    return addr >= base && (addr - base) < bytes.size();
+  }
+
+ private:
+  struct Entry {
+    uint64_t addr{0};
+    bool decoded{false};
+
+    // How many bytes were given to the decoder.
+    unsigned num_bytes{0u};
+    remill::Instruction inst;
+  };
+
+  // Linear-sweep decode `bytes[begin, end)`, plus the tail of the last
+  // instruction, if it extends past `end`, into `entries`.
+  void SweepChunk(const remill::Arch *arch, uint64_t begin, uint64_t end,
+                  std::vector<Entry> &entries) const;
+
+  uint64_t base{0};
+  std::string bytes;
+
+  // Decoded instructions, in one list per thread, and where the instruction
+  // at each address is.
+  std::vector<std::vector<Entry>> chunks;
+  std::unordered_map<uint64_t, const Entry *> addr_to_entry;
+};
+
+}  // namespace anvill
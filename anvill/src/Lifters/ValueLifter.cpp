@@ -27,6 +27,7 @@
 #include <llvm/IR/DerivedTypes.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Type.h>
+#include <llvm/Support/Host.h>
 #include <remill/BC/Compat/VectorType.h>
 #include <remill/BC/Util.h>
 
@@ -39,10 +40,24 @@ namespace anvill {
 // data.
 llvm::APInt ValueLifterImpl::ConsumeBytesAsInt(std::string_view &data,
                                                unsigned num_bytes) const {
+  const auto bytes = reinterpret_cast<const uint8_t *>(data.data());
+
+  // Common case: the integer fits in a single word, so assemble it directly
+  // in the target's byte order.
+  if (num_bytes <= 8u) {
+    uint64_t val = 0u;
+    for (auto i = 0u; i < num_bytes; ++i) {
+      const auto shift = dl.isLittleEndian() ? i : (num_bytes - i - 1u);
+      val |= static_cast<uint64_t>(bytes[i]) << (shift * 8u);
+    }
+    data = data.substr(num_bytes);
+    return llvm::APInt(num_bytes * 8u, val);
+  }
+
   llvm::APInt result(num_bytes * 8u, 0u);
   for (auto i = 0u; i < num_bytes; ++i) {
     result <<= 8u;
-    result |= data[i];
+    result |= bytes[i];
   }
   data = data.substr(num_bytes);
 
@@ -60,6 +75,7 @@ ValueLifterImpl::GetFunctionPointer(const FunctionDecl &decl,
   auto func = func_lifter.DeclareFunction(decl);
   auto func_in_context =
       func_lifter.AddFunctionToContext(func, decl.address, ent_lifter);
+  func_lifter.NoteReferencedFunction(decl.address);
   return func_in_context;
 }
 
@@ -213,6 +229,20 @@ ValueLifterImpl::TryGetPointerForAddress(uint64_t ea,
     }
   }
 
+  // `ea` could point into the middle of a variable that we've already lifted.
+  if (auto [entity, offset] = ent_lifter.EntityContainingAddress(ea);
+      entity && offset && llvm::isa<llvm::GlobalVariable>(entity)) {
+    llvm::IRBuilder<> builder(options.module->getContext());
+    auto ptr_type = hinted_type;
+    if (!ptr_type) {
+      ptr_type = llvm::Type::getInt8PtrTy(options.module->getContext());
+    }
+    if (auto ret = llvm::dyn_cast<llvm::Constant>(
+            remill::BuildPointerToOffset(builder, entity, offset, ptr_type))) {
+      return unrwap_zero_indices(ret);
+    }
+  }
+
   auto ret = GetVarPointer(ea, ea, ent_lifter);
 
   // `ea` could be just after the section for symbols e.g `__text_end`;
@@ -225,12 +255,56 @@ ValueLifterImpl::TryGetPointerForAddress(uint64_t ea,
 }
 
 // Lift the pointer at address `ea` which is getting referenced by the
-// variable at `loc_ea`. It checks the type and lift them as function
-// or variable pointer
+// variable at `loc_ea`, reusing the pointer made by an earlier request for
+// the same address and pointer type.
 llvm::Constant *ValueLifterImpl::GetPointer(uint64_t ea,
                                             llvm::PointerType *ptr_type,
                                             EntityLifterImpl &ent_lifter,
                                             uint64_t loc_ea) const {
+  if (auto it = pointer_cache.find(ea); it != pointer_cache.end()) {
+    for (const auto &[cached_type, cached_ptr] : it->second) {
+      llvm::Value *cached_val = cached_ptr;
+      if (cached_type != ptr_type || !cached_val) {
+        continue;
+      }
+
+      // Lifting a function pointer notes the function as referenced by the
+      // function being lifted, so do the same here.
+      const auto ptr = llvm::cast<llvm::Constant>(cached_val);
+      if (llvm::isa<llvm::Function>(ptr->stripPointerCastsAndAliases())) {
+        ent_lifter.function_lifter.NoteReferencedFunction(ea);
+      }
+      return ptr;
+    }
+  }
+
+  const auto ret = LiftPointer(ea, ptr_type, ent_lifter, loc_ea);
+  if (ret) {
+    auto &entries = pointer_cache[ea];
+    for (auto &[cached_type, cached_ptr] : entries) {
+      if (cached_type == ptr_type) {
+        cached_ptr = ret;
+        return ret;
+      }
+    }
+    entries.emplace_back(ptr_type, ret);
+  }
+  return ret;
+}
+
+// Forget the pointers to `ea` that `GetPointer` has returned, because a new
+// entity at `ea` may change what the best pointer to it is.
+void ValueLifterImpl::ForgetPointersTo(uint64_t ea) {
+  pointer_cache.erase(ea);
+}
+
+// Lift the pointer at address `ea` which is getting referenced by the
+// variable at `loc_ea`. It checks the type and lift them as function
+// or variable pointer
+llvm::Constant *ValueLifterImpl::LiftPointer(uint64_t ea,
+                                             llvm::PointerType *ptr_type,
+                                             EntityLifterImpl &ent_lifter,
+                                             uint64_t loc_ea) const {
 
   const auto addr_space = ptr_type->getAddressSpace();
   auto ret = TryGetPointerForAddress(ea, ent_lifter, ptr_type);
@@ -354,6 +428,20 @@ llvm::Constant *ValueLifterImpl::Lift(std::string_view data, llvm::Type *type,
       const auto elm_type = type->getArrayElementType();
       const auto elm_size = dl.getTypeAllocSize(elm_type);
       const auto num_elms = type->getArrayNumElements();
+
+      // Fast path for arrays of plain integers or floats, e.g. tables and
+      // string pools: these can't contain pointers, so if the elements are
+      // tightly packed and the target has the same byte order as us, then
+      // the bytes can be used as-is.
+      if (llvm::ConstantDataSequential::isElementTypeCompatible(elm_type) &&
+          elm_size == dl.getTypeStoreSize(elm_type) &&
+          dl.isLittleEndian() == llvm::sys::IsLittleEndianHost &&
+          (num_elms * elm_size) <= data.size()) {
+        return llvm::ConstantDataArray::getRaw(
+            llvm::StringRef(data.data(), num_elms * elm_size), num_elms,
+            elm_type);
+      }
+
       std::vector<llvm::Constant *> initializer_list;
       initializer_list.reserve(num_elms);
 
@@ -20,8 +20,13 @@
 #include <anvill/Lifters/Options.h>
 #include <anvill/Lifters/ValueLifter.h>
 #include <llvm/ADT/APInt.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/IR/ValueHandle.h>
 #include <llvm/Support/TypeSize.h>
 
+#include <unordered_map>
+#include <utility>
+
 namespace llvm {
 class Constant;
 class DataLayout;
@@ -79,7 +84,15 @@ class ValueLifterImpl {
                              EntityLifterImpl &ent_lifter,
                              uint64_t loc_ea) const;
 
+  // Forget the pointers to `ea` that `GetPointer` has returned, because a new
+  // entity at `ea` may change what the best pointer to it is.
+  void ForgetPointersTo(uint64_t ea);
+
  private:
+  llvm::Constant *LiftPointer(uint64_t ea, llvm::PointerType *type,
+                              EntityLifterImpl &ent_lifter,
+                              uint64_t loc_ea) const;
+
   llvm::Constant *GetFunctionPointer(const FunctionDecl &decl,
                                      EntityLifterImpl &ent_lifter) const;
 
@@ -90,6 +103,21 @@ class ValueLifterImpl {
   const LifterOptions &options;
   const llvm::DataLayout &dl;
   llvm::LLVMContext &context;
+
+  // Pointers returned by `GetPointer`, keyed by target address and then by
+  // the requested pointer type. Tables of pointers, e.g. vtables, refer to
+  // the same targets over and over again, and this turns every reference
+  // after the first into a lookup, rather than a rebuild of the same
+  // constant expressions and aliases.
+  //
+  // The handles are weak, so pointers to entities that have since been deleted,
+  // e.g. by optimizations, are rebuilt. Data words can hold any address,
+  // including the keys that `llvm::DenseMap` reserves, e.g. a `(void *) -1`
+  // terminating a constructor list, so this is a `std::unordered_map`.
+  mutable std::unordered_map<
+      uint64_t,
+      llvm::SmallVector<std::pair<llvm::PointerType *, llvm::WeakVH>, 1>>
+      pointer_cache;
 };
 
 }  // namespace anvill
@@ -29,24 +29,59 @@
 #include <llvm/IR/Function.h>
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/InlineAsm.h>
+#include <llvm/IR/InstIterator.h>
 #include <llvm/IR/Instruction.h>
 #include <llvm/IR/Instructions.h>
-#include <llvm/IR/LegacyPassManager.h>
 #include <llvm/IR/Module.h>
+#include <llvm/IR/PassManager.h>
 #include <llvm/IR/Type.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/ADT/SCCIterator.h>
+#include <llvm/Analysis/CallGraph.h>
+#include <llvm/Analysis/InlineCost.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Pass.h>
+#include <llvm/Passes/PassBuilder.h>
 #include <llvm/Transforms/InstCombine/InstCombine.h>
-#include <llvm/Transforms/IPO.h>
+#include <llvm/Transforms/IPO/GlobalDCE.h>
+#include <llvm/Transforms/IPO/GlobalOpt.h>
+#include <llvm/Transforms/IPO/Inliner.h>
+#include <llvm/Transforms/IPO/StripSymbols.h>
+#include <llvm/Transforms/Scalar/BDCE.h>
+#include <llvm/Transforms/Scalar/DCE.h>
+#include <llvm/Transforms/Scalar/DeadStoreElimination.h>
+#include <llvm/Transforms/Scalar/EarlyCSE.h>
+#include <llvm/Transforms/Scalar/NewGVN.h>
+#include <llvm/Transforms/Scalar/SCCP.h>
+#include <llvm/Transforms/Scalar/SROA.h>
+#include <llvm/Transforms/Scalar/SimplifyCFG.h>
+#include <llvm/Transforms/Scalar/Sink.h>
+#include <llvm/Transforms/Utils/Cloning.h>
 #include <llvm/Transforms/Utils/Local.h>
+#include <llvm/Transforms/Utils/ValueMapper.h>
 
 // clang-format on
 
+#include <anvill/Counters.h>
+#include <anvill/Lifters/EntityLifter.h>
+#include <anvill/Trace.h>
 #include <anvill/Transforms.h>
 #include <remill/BC/ABI.h>
 #include <remill/BC/Compat/ScalarTransforms.h>
 #include <remill/BC/Optimizer.h>
 #include <remill/BC/Util.h>
 
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
 #include <unordered_set>
+#include <utility>
 #include <vector>
 
 #include "anvill/ABI.h"
@@ -58,89 +93,1059 @@ DEFINE_uint32(
     pointer_brighten_gas, 64u,
     "Amount of internal iterations permitted for the pointer brightening pass.");
 
+DEFINE_bool(snapshot_function_ir, false,
+            "Capture the IR of each function before every anvill function "
+            "pass runs, so that fatal pass errors can show the IR from before "
+            "and after the transformation. This is slow on large functions.");
+
+DEFINE_string(transformation_errors_out, "",
+              "Path to a file to which the errors reported by anvill passes "
+              "are streamed, one JSON object per line. Only the most recent "
+              "errors are otherwise kept in memory.");
+
+DEFINE_uint32(optimize_threads, 1u,
+              "Number of threads to use for the function-local parts of "
+              "optimization. Each thread optimizes a disjoint subset of the "
+              "module's functions in its own LLVM context. A value of zero "
+              "uses one thread per hardware thread.");
+
 namespace anvill {
+namespace {
 
-// Optimize a module. This can be a module with semantics code, lifted
-// code, etc.
-void OptimizeModule(const EntityLifter &lifter_context,
-                    const remill::Arch *arch, const Program &program,
-                    llvm::Module &module, const LifterOptions &options) {
+#if LLVM_VERSION_MAJOR >= 14
+using SROAPass = llvm::SROAPass;
+#else
+using SROAPass = llvm::SROA;
+#endif
 
-  if (auto err = module.materializeAll(); remill::IsError(err)) {
-    LOG(FATAL) << remill::GetErrorString(err);
+
+// Adds passes to a function pass manager. The passes report errors into the
+// provided error manager.
+using PipelineBuilder = std::function<void(llvm::FunctionPassManager &,
+                                           ITransformationErrorManager &)>;
+
+// Suffix given to the optimized copies of functions while they are linked
+// back into the original module.
+static const char kOptimizedFunctionSuffix[] = ".anvill.optimized";
+
+// Names of the optimization budgets, as recorded in the
+// `kBudgetExceededAttribute` attribute of functions that go over them.
+static const char kOptimizeTimeBudget[] = "max_optimize_time_ms";
+static const char kIRSizeBudget[] = "max_function_ir_size";
+
+// Per-function optimization budgets, from the `LifterOptions`. Zero means no
+// limit.
+struct OptimizationBudget {
+  unsigned max_ir_size{0u};
+  unsigned max_time_ms{0u};
+};
+
+// Returns the name of the budget that `func` went over during one run of a
+// function pipeline that started at `start`, or `nullptr` if it's within
+// budget.
+//
+// A pass can't be interrupted, so the budget is only checked after each run of
+// the pipeline on a function.
+static const char *
+CheckOptimizationBudget(const llvm::Function &func,
+                        const OptimizationBudget &budget,
+                        std::chrono::steady_clock::time_point start) {
+  if (budget.max_time_ms &&
+      std::chrono::steady_clock::now() - start >=
+          std::chrono::milliseconds(budget.max_time_ms)) {
+    return kOptimizeTimeBudget;
   }
 
-  if (auto used = module.getGlobalVariable("llvm.used"); used) {
-    used->setLinkage(llvm::GlobalValue::PrivateLinkage);
-    used->eraseFromParent();
+  if (budget.max_ir_size &&
+      func.getInstructionCount() > budget.max_ir_size) {
+    return kIRSizeBudget;
   }
 
-  LOG(INFO) << "Optimizing module.";
+  return nullptr;
+}
 
-  if (auto memory_escape = module.getFunction(kMemoryPointerEscapeFunction)) {
-    for (auto call : remill::CallersOf(memory_escape)) {
-      call->eraseFromParent();
+// Reduce the functions that went over an optimization budget to declarations.
+// Functions are only marked as over budget while they're optimized, because
+// those running in the shards of a parallel pipeline need to keep their bodies
+// until they're moved back into the original module.
+static void AbandonOverBudgetFunctions(llvm::Module &module,
+                                       llvm::FunctionAnalysisManager &fam) {
+  for (auto &func : module) {
+    if (func.isDeclaration()) {
+      continue;
     }
-    memory_escape->eraseFromParent();
+
+    const auto attr = func.getFnAttribute(kBudgetExceededAttribute);
+    if (!attr.isStringAttribute()) {
+      continue;
+    }
+
+    const auto budget = attr.getValueAsString();
+    if (budget != kOptimizeTimeBudget && budget != kIRSizeBudget) {
+      continue;
+    }
+
+    LOG(WARNING) << "Function " << func.getName().str() << " went over its "
+                 << budget.str() << " budget; leaving it as a declaration";
+    fam.clear(func, func.getName());
+    func.deleteBody();
   }
+}
 
-  llvm::legacy::PassManager mpm;
-  mpm.add(llvm::createFunctionInliningPass(250));
-  mpm.add(llvm::createGlobalOptimizerPass());
-  mpm.add(llvm::createGlobalDCEPass());
-  mpm.add(llvm::createStripDeadDebugInfoPass());
-  mpm.run(module);
-
-  llvm::legacy::FunctionPassManager fpm(&module);
-  fpm.add(llvm::createDeadCodeEliminationPass());
-  fpm.add(llvm::createSinkingPass());
-  fpm.add(llvm::createNewGVNPass());
-  fpm.add(llvm::createSCCPPass());
-  fpm.add(llvm::createDeadStoreEliminationPass());
-  fpm.add(llvm::createSROAPass());
-  fpm.add(llvm::createEarlyCSEPass(true));
-  fpm.add(llvm::createBitTrackingDCEPass());
-  fpm.add(llvm::createCFGSimplificationPass());
-  fpm.add(llvm::createSinkingPass());
-  fpm.add(llvm::createCFGSimplificationPass());
-  fpm.add(llvm::createInstructionCombiningPass());
-
-  auto error_manager_ptr = ITransformationErrorManager::Create();
-  auto &err_man = *error_manager_ptr.get();
+// Add an anvill function pass to `fpm`. Passes that `preserve_cfg` never
+// add or remove blocks or edges.
+static void AddPass(llvm::FunctionPassManager &fpm, llvm::FunctionPass *pass,
+                    bool preserves_cfg) {
+  fpm.addPass(LegacyPassAdaptor(pass, preserves_cfg));
+}
+
+// Returns the strongly connected components of the call graph of the
+// functions defined in `module`, in bottom-up order: the functions called by
+// an SCC's functions are in that SCC or in an earlier one.
+static std::vector<std::vector<llvm::Function *>>
+CallGraphSCCs(llvm::Module &module) {
+  std::vector<std::vector<llvm::Function *>> sccs;
+  std::unordered_set<llvm::Function *> seen;
 
-  fpm.add(CreateSinkSelectionsIntoBranchTargets(err_man));
-  fpm.add(CreateRemoveUnusedFPClassificationCalls());
-  fpm.add(CreateRemoveDelaySlotIntrinsics());
-  fpm.add(CreateRemoveErrorIntrinsics());
-  fpm.add(CreateLowerRemillMemoryAccessIntrinsics());
-  fpm.add(CreateRemoveCompilerBarriers());
-  fpm.add(CreateLowerTypeHintIntrinsics());
-  fpm.add(CreateInstructionFolderPass(err_man));
-  fpm.add(llvm::createDeadCodeEliminationPass());
-  fpm.add(CreateRecoverEntityUseInformation(err_man, lifter_context));
-  fpm.add(CreateSinkSelectionsIntoBranchTargets(err_man));
-  fpm.add(CreateRemoveTrivialPhisAndSelects());
-  fpm.add(llvm::createDeadCodeEliminationPass());
-  fpm.add(CreateRecoverStackFrameInformation(err_man, options));
-  fpm.add(llvm::createSROAPass());
-  fpm.add(CreateSplitStackFrameAtReturnAddress(err_man));
-  fpm.add(llvm::createSROAPass());
-
-  // Sometimes we have a values in the form of (expr ^ 1) used as branch
-  // conditions or other targets. Try to fix these to be CMPs, since it
-  // makes code easier to read and analyze. This is a fairly narrow optimization
-  // but it comes up often enough for lifted code.
-  fpm.add(CreateConvertXorToCmp());
-
-  if (FLAGS_pointer_brighten_gas) {
-    fpm.add(CreateBrightenPointerOperations(FLAGS_pointer_brighten_gas));
-  }
-
-  fpm.doInitialization();
+  llvm::CallGraph call_graph(module);
+  for (auto it = llvm::scc_begin(&call_graph); !it.isAtEnd(); ++it) {
+    std::vector<llvm::Function *> scc;
+    for (llvm::CallGraphNode *node : *it) {
+      auto func = node->getFunction();
+      if (func && !func->isDeclaration() && seen.insert(func).second) {
+        scc.push_back(func);
+      }
+    }
+    if (!scc.empty()) {
+      sccs.emplace_back(std::move(scc));
+    }
+  }
+
+  // The call graph is walked from the functions visible outside of the module,
+  // so internal functions whose addresses aren't taken and that are never
+  // called aren't reached.
   for (auto &func : module) {
-    fpm.run(func);
+    if (!func.isDeclaration() && seen.insert(&func).second) {
+      sccs.push_back({&func});
+    }
+  }
+
+  return sccs;
+}
+
+// Run the pipeline produced by `build_pipeline` over every function defined
+// in `module`, on the calling thread. The first sweep visits every function;
+// each of the up to `max_iterations - 1` later sweeps only revisits the
+// functions that the previous sweep changed, along with their callers, until
+// nothing changes. Functions that go over `budget` are marked, and not
+// revisited.
+//
+// Functions are visited bottom-up in the call graph, so that callees are
+// optimized, and their returns and prototypes settled, before their callers.
+// A changed function only causes callers that were already visited in the
+// same sweep to be revisited.
+static void RunFunctionPipeline(llvm::Module &module,
+                                llvm::FunctionAnalysisManager &fam,
+                                ITransformationErrorManager &err_man,
+                                const PipelineBuilder &build_pipeline,
+                                unsigned max_iterations,
+                                const OptimizationBudget &budget) {
+  llvm::FunctionPassManager fpm;
+  build_pipeline(fpm, err_man);
+
+  std::vector<llvm::Function *> worklist;
+  std::unordered_map<llvm::Function *, size_t> order;
+  for (const auto &scc : CallGraphSCCs(module)) {
+    for (auto func : scc) {
+      order.emplace(func, worklist.size());
+      worklist.push_back(func);
+    }
+  }
+
+  std::vector<llvm::Function *> next_worklist;
+  std::unordered_set<llvm::Function *> dirty;
+  std::unordered_set<llvm::Function *> over_budget;
+  std::unordered_set<llvm::Function *> unvisited;
+  auto mark_dirty = [&](llvm::Function *func) {
+    if (!func->isDeclaration() && !over_budget.count(func) &&
+        dirty.insert(func).second) {
+      next_worklist.push_back(func);
+    }
+  };
+
+  for (auto i = 0u; i < max_iterations && !worklist.empty(); ++i) {
+    unvisited.clear();
+    unvisited.insert(worklist.begin(), worklist.end());
+
+    for (auto func : worklist) {
+
+      // A fatal error means that the module is broken, and we'll give up on it,
+      // so there's no point optimizing it further. This also cancels the work
+      // of the other threads.
+      if (err_man.HasFatalError()) {
+        return;
+      }
+
+      unvisited.erase(func);
+      if (over_budget.count(func)) {
+        continue;
+      }
+
+      // The analysis managers use the preserved analyses to decide what to
+      // invalidate, and passes that return `false` from `runOnFunction`
+      // preserve everything.
+      const auto start = std::chrono::steady_clock::now();
+      const auto all_preserved = fpm.run(*func, fam).areAllPreserved();
+
+      if (auto exceeded = CheckOptimizationBudget(*func, budget, start)) {
+        IncrementCounter(Counter::kOptimizeBudgetExceeded);
+        func->addFnAttr(kBudgetExceededAttribute, exceeded);
+        over_budget.insert(func);
+        continue;
+      }
+
+      if (all_preserved) {
+        continue;
+      }
+
+      mark_dirty(func);
+      for (auto call : remill::CallersOf(func)) {
+        if (auto caller = call->getFunction(); !unvisited.count(caller)) {
+          mark_dirty(caller);
+        }
+      }
+    }
+
+    // Functions that didn't exist when the SCCs were found, e.g. ones made by
+    // outlining, are visited last.
+    auto position_of = [&](llvm::Function *func) {
+      auto it = order.find(func);
+      return it == order.end() ? order.size() : it->second;
+    };
+
+    std::stable_sort(next_worklist.begin(), next_worklist.end(),
+                     [&](llvm::Function *a, llvm::Function *b) {
+                       return position_of(a) < position_of(b);
+                     });
+
+    if (!next_worklist.empty() && (i + 1u) < max_iterations) {
+      DLOG(INFO) << "Revisiting " << next_worklist.size()
+                 << " changed functions";
+    }
+
+    worklist.swap(next_worklist);
+    next_worklist.clear();
+    dirty.clear();
+  }
+}
+
+// Run the pipeline produced by `build_pipeline` over `func` alone, up to
+// `max_iterations` times, or until it stops changing. If `func` goes over
+// `budget`, then it's marked, and not revisited.
+static void RunFunctionPipelineOnFunction(llvm::Function &func,
+                                          llvm::FunctionAnalysisManager &fam,
+                                          ITransformationErrorManager &err_man,
+                                          const PipelineBuilder &build_pipeline,
+                                          unsigned max_iterations,
+                                          const OptimizationBudget &budget) {
+  llvm::FunctionPassManager fpm;
+  build_pipeline(fpm, err_man);
+
+  for (auto i = 0u; i < max_iterations && !err_man.HasFatalError(); ++i) {
+    const auto start = std::chrono::steady_clock::now();
+    const auto all_preserved = fpm.run(func, fam).areAllPreserved();
+
+    if (auto exceeded = CheckOptimizationBudget(func, budget, start)) {
+      IncrementCounter(Counter::kOptimizeBudgetExceeded);
+      func.addFnAttr(kBudgetExceededAttribute, exceeded);
+      break;
+    }
+
+    if (all_preserved) {
+      break;
+    }
+  }
+}
+
+// Parse the shard in `bitcode` into its own context, optimize its functions,
+// and serialize the result back into `bitcode`.
+static bool OptimizeShard(llvm::SmallVectorImpl<char> &bitcode,
+                          ITransformationErrorManager &err_man,
+                          const PipelineBuilder &build_pipeline,
+                          unsigned max_iterations,
+                          const OptimizationBudget &budget,
+                          bool discard_value_names) {
+  llvm::LLVMContext context;
+  context.setDiscardValueNames(discard_value_names);
+  llvm::MemoryBufferRef buff(llvm::StringRef(bitcode.data(), bitcode.size()),
+                             "optimized_shard");
+  auto maybe_module = llvm::parseBitcodeFile(buff, context);
+  if (remill::IsError(maybe_module)) {
+    LOG(ERROR) << "Unable to parse bitcode of optimization shard: "
+               << remill::GetErrorString(maybe_module);
+    return false;
+  }
+
+  auto &module = *remill::GetReference(maybe_module);
+
+  llvm::PassBuilder pb;
+  llvm::FunctionAnalysisManager fam;
+  pb.registerFunctionAnalyses(fam);
+  RunFunctionPipeline(module, fam, err_man, build_pipeline, max_iterations,
+                      budget);
+
+  bitcode.clear();
+  llvm::raw_svector_ostream os(bitcode);
+  llvm::WriteBitcodeToFile(module, os);
+  return true;
+}
+
+// Run the pipeline produced by `build_pipeline` over every function defined
+// in `module`, using up to `num_threads` threads. Returns `false` if a shard
+// couldn't be optimized or brought back into `module`, in which case some
+// functions of `module` may not have been optimized.
+//
+// An `llvm::LLVMContext` isn't thread-safe, and every pass creates constants,
+// types, or metadata in it, so functions of one module can't be optimized
+// concurrently. Instead, we split the defined functions into shards, round-trip
+// each shard through bitcode into a private context, and then move the
+// optimized function bodies back into the original `llvm::Function`s, which the
+// lifter's entity maps refer to. Passes that need the `EntityLifter` must not
+// be part of the pipeline, as its entities live in the original context. Each
+// shard iterates to its own fixed point, so a changed function only causes
+// callers in the same shard to be revisited.
+static bool RunFunctionPipelineInParallel(llvm::Module &module,
+                                          llvm::FunctionAnalysisManager &fam,
+                                          ITransformationErrorManager &err_man,
+                                          const PipelineBuilder &build_pipeline,
+                                          unsigned max_iterations,
+                                          const OptimizationBudget &budget,
+                                          unsigned num_threads) {
+  // The functions of a strongly connected component of the call graph are
+  // optimized together, in the same shard, so that changes to one of them
+  // can cause the others to be revisited. Independent SCCs are spread across
+  // the shards.
+  auto sccs = CallGraphSCCs(module);
+  std::vector<std::pair<const std::vector<llvm::Function *> *, size_t>> units;
+  for (const auto &scc : sccs) {
+    size_t size = 0u;
+    for (auto func : scc) {
+      size += func->getInstructionCount();
+    }
+    units.emplace_back(&scc, size);
+  }
+
+  const auto num_shards =
+      std::min<unsigned>(num_threads, static_cast<unsigned>(units.size()));
+  if (num_shards <= 1u) {
+    RunFunctionPipeline(module, fam, err_man, build_pipeline, max_iterations,
+                        budget);
+    return true;
+  }
+
+  // Balance the shards by size, assigning the biggest SCC to the least
+  // loaded shard first.
+  std::stable_sort(units.begin(), units.end(),
+                   [](const auto &a, const auto &b) {
+                     return a.second > b.second;
+                   });
+
+  std::vector<size_t> shard_sizes(num_shards);
+  std::unordered_map<const llvm::Function *, unsigned> func_to_shard;
+  for (auto [scc, size] : units) {
+    auto shard = static_cast<unsigned>(
+        std::min_element(shard_sizes.begin(), shard_sizes.end()) -
+        shard_sizes.begin());
+    shard_sizes[shard] += size;
+    for (auto func : *scc) {
+      func_to_shard.emplace(func, shard);
+    }
+  }
+
+  // Shards refer to things defined elsewhere by name, so local things need
+  // to be temporarily visible across modules, and unnamed ones need names.
+  struct LocalValue {
+    llvm::GlobalValue *gv;
+    llvm::GlobalValue::LinkageTypes linkage;
+    bool had_name;
+  };
+  std::vector<LocalValue> locals;
+  for (auto &gv : module.global_values()) {
+    if (gv.hasLocalLinkage()) {
+      locals.push_back({&gv, gv.getLinkage(), gv.hasName()});
+      if (!gv.hasName()) {
+        gv.setName("anvill.local");
+      }
+      gv.setLinkage(llvm::GlobalValue::ExternalLinkage);
+    }
+  }
+
+  // Each shard gets definitions of its own functions and of constant
+  // variables, so that loads from them can still be folded. Everything else
+  // is a declaration.
+  std::vector<llvm::SmallVector<char, 0>> shard_bitcodes(num_shards);
+  std::vector<std::vector<std::string>> shard_func_names(num_shards);
+  for (auto i = 0u; i < num_shards; ++i) {
+    llvm::ValueToValueMapTy vmap;
+    auto shard = llvm::CloneModule(
+        module, vmap, [&](const llvm::GlobalValue *gv) {
+          if (auto func = llvm::dyn_cast<llvm::Function>(gv)) {
+            auto it = func_to_shard.find(func);
+            return it != func_to_shard.end() && it->second == i;
+          } else if (auto var = llvm::dyn_cast<llvm::GlobalVariable>(gv)) {
+            return var->isConstant();
+          } else {
+            return false;
+          }
+        });
+
+    for (auto &var : shard->globals()) {
+      if (!var.isDeclaration()) {
+        var.setLinkage(llvm::GlobalValue::AvailableExternallyLinkage);
+      }
+    }
+
+    for (auto &func : *shard) {
+      if (!func.isDeclaration()) {
+        shard_func_names[i].push_back(func.getName().str());
+      }
+    }
+
+    llvm::raw_svector_ostream os(shard_bitcodes[i]);
+    llvm::WriteBitcodeToFile(*shard, os);
+  }
+
+  // Error managers can be inserted into concurrently, so the shards all report
+  // into `err_man`.
+  std::unique_ptr<bool[]> shard_succeeded(new bool[num_shards]());
+  const auto discard_value_names =
+      module.getContext().shouldDiscardValueNames();
+  std::vector<std::thread> threads;
+  threads.reserve(num_shards);
+  for (auto i = 0u; i < num_shards; ++i) {
+    threads.emplace_back([&, i](void) {
+      shard_succeeded[i] =
+          OptimizeShard(shard_bitcodes[i], err_man, build_pipeline,
+                        max_iterations, budget, discard_value_names);
+    });
+  }
+
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  // Bring the optimized function bodies back, one shard at a time. The
+  // functions of a shard that fails keep their unoptimized bodies.
+  auto succeeded = true;
+  std::unordered_set<std::string> shard_defined_vars;
+  llvm::Linker linker(module);
+  for (auto i = 0u; i < num_shards && succeeded; ++i) {
+    if (!shard_succeeded[i]) {
+      LOG(ERROR) << "Failed to optimize shard " << i << " of " << num_shards;
+      succeeded = false;
+      break;
+    }
+
+    llvm::MemoryBufferRef buff(
+        llvm::StringRef(shard_bitcodes[i].data(), shard_bitcodes[i].size()),
+        "optimized_shard");
+    auto maybe_shard = llvm::parseBitcodeFile(buff, module.getContext());
+    if (remill::IsError(maybe_shard)) {
+      LOG(ERROR) << "Unable to parse bitcode of optimized shard " << i << ": "
+                 << remill::GetErrorString(maybe_shard);
+      succeeded = false;
+      break;
+    }
+
+    // Rename the optimized functions so that linking doesn't replace the
+    // original functions.
+    auto &shard = remill::GetReference(maybe_shard);
+    for (const auto &name : shard_func_names[i]) {
+      if (auto func = shard->getFunction(name)) {
+        func->setName(name + kOptimizedFunctionSuffix);
+      } else {
+        LOG(ERROR) << "Optimized shard " << i << " lost function " << name;
+        succeeded = false;
+      }
+    }
+
+    // Passes define symbolic values by name, e.g. stack frame recovery's
+    // `__anvill_stack_*` variables, so several shards may define the same one.
+    // Same-named symbolic values are interchangeable, so let the linker keep
+    // any one of them, rather than fail on a multiply defined symbol.
+    for (auto &var : shard->globals()) {
+      if (!var.isDeclaration() && var.hasExternalLinkage()) {
+        var.setLinkage(llvm::GlobalValue::LinkOnceODRLinkage);
+        shard_defined_vars.insert(var.getName().str());
+      }
+    }
+
+    if (!succeeded || linker.linkInModule(std::move(shard))) {
+      LOG(ERROR) << "Unable to link optimized shard " << i << " into module";
+      succeeded = false;
+      break;
+    }
+
+    for (const auto &name : shard_func_names[i]) {
+      MoveFunctionBody(module.getFunction(name + kOptimizedFunctionSuffix),
+                       module.getFunction(name));
+    }
+
+    llvm::SmallVector<char, 0>().swap(shard_bitcodes[i]);
+  }
+
+  // Make the variables defined by the shards look like they would had the
+  // functions been optimized in `module`.
+  for (const auto &name : shard_defined_vars) {
+    if (auto var = module.getGlobalVariable(name);
+        var && var->hasLinkOnceODRLinkage()) {
+      var->setLinkage(llvm::GlobalValue::ExternalLinkage);
+    }
+  }
+
+  for (const auto &local : locals) {
+    local.gv->setLinkage(local.linkage);
+    if (!local.had_name) {
+      local.gv->setName("");
+    }
+  }
+
+  // The function bodies have been replaced, so any cached analyses are
+  // stale.
+  fam.clear();
+  return succeeded;
+}
+
+// Run the pipeline produced by `build_pipeline` over every function defined
+// in `module`, in parallel if the `--optimize_threads` flag asks for it.
+// Returns `false` if optimizing in parallel failed.
+static bool
+RunFunctionPipelineOnThreads(llvm::Module &module,
+                             llvm::FunctionAnalysisManager &fam,
+                             ITransformationErrorManager &err_man,
+                             const PipelineBuilder &build_pipeline,
+                             unsigned max_iterations,
+                             const OptimizationBudget &budget) {
+  auto num_threads = FLAGS_optimize_threads;
+  if (!num_threads) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  if (num_threads == 1u) {
+    RunFunctionPipeline(module, fam, err_man, build_pipeline, max_iterations,
+                        budget);
+    return true;
+  } else {
+    return RunFunctionPipelineInParallel(module, fam, err_man, build_pipeline,
+                                         max_iterations, budget, num_threads);
+  }
+}
+
+// Maps the names of lifted functions to their addresses. Functions in the
+// shards used for parallel optimization are only known by name.
+using FunctionAddressMap = std::unordered_map<std::string, uint64_t>;
+
+// Returns the number of memory operations in `func`, i.e. loads, stores,
+// and calls to remill's memory access intrinsics, which are what loads and
+// stores look like before they're lowered.
+static uint64_t CountMemoryOperations(const llvm::Function &func) {
+  uint64_t num_memory_ops = 0u;
+  for (const auto &inst : llvm::instructions(func)) {
+    if (llvm::isa<llvm::LoadInst>(inst) || llvm::isa<llvm::StoreInst>(inst)) {
+      ++num_memory_ops;
+    } else if (auto call = llvm::dyn_cast<llvm::CallBase>(&inst)) {
+      if (auto callee = call->getCalledFunction()) {
+        const auto name = callee->getName();
+        if (name.startswith("__remill_read_memory_") ||
+            name.startswith("__remill_write_memory_")) {
+          ++num_memory_ops;
+        }
+      }
+    }
+  }
+  return num_memory_ops;
+}
+
+// Runs a pass, and records how long it took on each function into a tracer.
+// If `record_impact` is set, then the events also record what the pass
+// changed (see `LifterOptions::record_pass_impact`), and which `occurrence`
+// of the pass in the pipeline this is.
+class TracedPass : public llvm::PassInfoMixin<TracedPass> {
+ public:
+  TracedPass(llvm::FunctionPassManager fpm_, llvm::StringRef pass_name_,
+             Tracer *tracer_, const FunctionAddressMap &addresses_,
+             bool record_impact_, unsigned occurrence_)
+      : fpm(std::move(fpm_)),
+        pass_name(pass_name_),
+        tracer(tracer_),
+        addresses(addresses_),
+        record_impact(record_impact_ && tracer_),
+        occurrence(occurrence_) {}
+
+  llvm::PreservedAnalyses run(llvm::Function &func,
+                              llvm::FunctionAnalysisManager &fam) {
+    std::optional<uint64_t> address;
+    if (auto it = addresses.find(func.getName().str());
+        it != addresses.end()) {
+      address = it->second;
+    }
+
+    // The blocks and memory operations are counted outside of the timed part of
+    // the event, so that counting doesn't inflate the time of the pass.
+    uint64_t blocks_before = 0u;
+    uint64_t memory_ops_before = 0u;
+    if (record_impact) {
+      blocks_before = func.size();
+      memory_ops_before = CountMemoryOperations(func);
+    }
+
+    TraceScope scope(tracer, pass_name, "pass", &func, address);
+    ANVILL_TRACE_ZONE_NAMED(pass_name);
+    ANVILL_TRACE_ZONE_TAG(address.value_or(0u), func.getInstructionCount());
+    auto preserved = fpm.run(func, fam);
+
+    if (record_impact) {
+      scope.Stop();
+      scope.AddCounter("occurrence", occurrence);
+      scope.AddCounter("changed", preserved.areAllPreserved() ? 0u : 1u);
+      scope.AddCounter("blocks_before", blocks_before);
+      scope.AddCounter("blocks_after", func.size());
+      scope.AddCounter("memory_ops_before", memory_ops_before);
+      scope.AddCounter("memory_ops_after", CountMemoryOperations(func));
+    }
+    return preserved;
+  }
+
+ private:
+  llvm::FunctionPassManager fpm;
+  llvm::StringRef pass_name;
+  Tracer *tracer;
+  const FunctionAddressMap &addresses;
+  const bool record_impact;
+  const unsigned occurrence;
+};
+
+// Names of passes in textual pipeline descriptions.
+static const std::pair<OptimizationPass, const char *> kPassNames[] = {
+    {OptimizationPass::kInliner, "inline"},
+    {OptimizationPass::kGlobalOpt, "globalopt"},
+    {OptimizationPass::kGlobalDCE, "globaldce"},
+    {OptimizationPass::kStripDeadDebugInfo, "strip-dead-debug-info"},
+    {OptimizationPass::kDCE, "dce"},
+    {OptimizationPass::kSinking, "sink"},
+    {OptimizationPass::kNewGVN, "newgvn"},
+    {OptimizationPass::kSCCP, "sccp"},
+    {OptimizationPass::kDSE, "dse"},
+    {OptimizationPass::kSROA, "sroa"},
+    {OptimizationPass::kEarlyCSE, "early-cse"},
+    {OptimizationPass::kBDCE, "bdce"},
+    {OptimizationPass::kSimplifyCFG, "simplifycfg"},
+    {OptimizationPass::kInstCombine, "instcombine"},
+    {OptimizationPass::kSinkSelectionsIntoBranchTargets,
+     "sink-selections-into-branch-targets"},
+    {OptimizationPass::kRemoveUnusedFPClassificationCalls,
+     "remove-unused-fp-classification-calls"},
+    {OptimizationPass::kRemoveDelaySlotIntrinsics,
+     "remove-delay-slot-intrinsics"},
+    {OptimizationPass::kRemoveErrorIntrinsics, "remove-error-intrinsics"},
+    {OptimizationPass::kLowerRemillMemoryAccessIntrinsics,
+     "lower-remill-memory-access-intrinsics"},
+    {OptimizationPass::kRemoveCompilerBarriers, "remove-compiler-barriers"},
+    {OptimizationPass::kLowerTypeHintIntrinsics, "lower-type-hint-intrinsics"},
+    {OptimizationPass::kInstructionFolder, "instruction-folder"},
+    {OptimizationPass::kRecoverEntityUseInformation,
+     "recover-entity-use-information"},
+    {OptimizationPass::kRemoveTrivialPhisAndSelects,
+     "remove-trivial-phis-and-selects"},
+    {OptimizationPass::kRecoverStackFrameInformation,
+     "recover-stack-frame-information"},
+    {OptimizationPass::kSplitStackFrameAtReturnAddress,
+     "split-stack-frame-at-return-address"},
+    {OptimizationPass::kRecoverAndSplitStackFrame,
+     "recover-and-split-stack-frame"},
+    {OptimizationPass::kConvertXorToCmp, "convert-xor-to-cmp"},
+    {OptimizationPass::kBrightenPointerOperations,
+     "brighten-pointer-operations"},
+    {OptimizationPass::kTransformRemillJumpIntrinsics,
+     "transform-remill-jump-intrinsics"},
+    {OptimizationPass::kRemoveRemillFunctionReturns,
+     "remove-remill-function-returns"},
+    {OptimizationPass::kLowerRemillUndefinedIntrinsics,
+     "lower-remill-undefined-intrinsics"},
+    {OptimizationPass::kCleanUpRemillIntrinsics, "clean-up-remill-intrinsics"},
+    {OptimizationPass::kPeepholes, "peepholes"},
+    {OptimizationPass::kMergeFunctions, "merge-functions"},
+};
+
+// Returns `true` if `pass` runs over the whole module.
+static bool IsModulePass(OptimizationPass pass) {
+  switch (pass) {
+    case OptimizationPass::kInliner:
+    case OptimizationPass::kGlobalOpt:
+    case OptimizationPass::kGlobalDCE:
+    case OptimizationPass::kStripDeadDebugInfo: return true;
+    default: return false;
+  }
+}
+
+// Returns `true` if `pass` runs over the whole module after every other pass,
+// wherever it is in the pipeline.
+static bool IsLateModulePass(OptimizationPass pass) {
+  return pass == OptimizationPass::kMergeFunctions;
+}
+
+// Returns `true` if `pass` is an anvill pass that goes straight to the calls
+// of some intrinsics by way of their use lists. These run once over the whole
+// module, in their place in the pipeline, rather than once per function.
+static bool IsCallSitePass(OptimizationPass pass) {
+  switch (pass) {
+    case OptimizationPass::kRemoveUnusedFPClassificationCalls:
+    case OptimizationPass::kRemoveDelaySlotIntrinsics:
+    case OptimizationPass::kRemoveErrorIntrinsics:
+    case OptimizationPass::kLowerRemillMemoryAccessIntrinsics:
+    case OptimizationPass::kLowerTypeHintIntrinsics:
+    case OptimizationPass::kLowerRemillUndefinedIntrinsics:
+    case OptimizationPass::kCleanUpRemillIntrinsics: return true;
+    default: return false;
+  }
+}
+
+// Returns `true` if `pass` refers to entities of the `EntityLifter`, and so
+// must run in the context of the original module.
+static bool NeedsEntityLifter(OptimizationPass pass) {
+  switch (pass) {
+    case OptimizationPass::kRecoverEntityUseInformation:
+    case OptimizationPass::kTransformRemillJumpIntrinsics:
+    case OptimizationPass::kRemoveRemillFunctionReturns:
+    case OptimizationPass::kCleanUpRemillIntrinsics: return true;
+    default: return false;
+  }
+}
+
+// Returns `true` if `pass` reports errors into an error manager.
+static bool ReportsErrors(OptimizationPass pass) {
+  switch (pass) {
+    case OptimizationPass::kSinkSelectionsIntoBranchTargets:
+    case OptimizationPass::kInstructionFolder:
+    case OptimizationPass::kRecoverEntityUseInformation:
+    case OptimizationPass::kRecoverStackFrameInformation:
+    case OptimizationPass::kSplitStackFrameAtReturnAddress:
+    case OptimizationPass::kRecoverAndSplitStackFrame: return true;
+    default: return false;
+  }
+}
+
+static void AddModulePass(llvm::ModulePassManager &mpm,
+                          OptimizationPass pass) {
+  switch (pass) {
+    case OptimizationPass::kInliner:
+      mpm.addPass(llvm::ModuleInlinerWrapperPass(llvm::getInlineParams(250)));
+      break;
+    case OptimizationPass::kGlobalOpt:
+      mpm.addPass(llvm::GlobalOptPass());
+      break;
+    case OptimizationPass::kGlobalDCE:
+      mpm.addPass(llvm::GlobalDCEPass());
+      break;
+    case OptimizationPass::kStripDeadDebugInfo:
+      mpm.addPass(llvm::StripDeadDebugInfoPass());
+      break;
+    default: LOG(FATAL) << "Not a module pass"; break;
+  }
+}
+
+static llvm::ModulePass *
+CreateCallSitePass(OptimizationPass pass, const EntityLifter &lifter_context) {
+  switch (pass) {
+    case OptimizationPass::kRemoveUnusedFPClassificationCalls:
+      return CreateRemoveUnusedFPClassificationCalls();
+    case OptimizationPass::kRemoveDelaySlotIntrinsics:
+      return CreateRemoveDelaySlotIntrinsics();
+    case OptimizationPass::kRemoveErrorIntrinsics:
+      return CreateRemoveErrorIntrinsics();
+    case OptimizationPass::kLowerRemillMemoryAccessIntrinsics:
+      if (lifter_context.Options().lower_memory_accesses_to_entities) {
+        return CreateLowerRemillMemoryAccessIntrinsics(lifter_context);
+      }
+      return CreateLowerRemillMemoryAccessIntrinsics();
+    case OptimizationPass::kLowerTypeHintIntrinsics:
+      return CreateLowerTypeHintIntrinsics();
+    case OptimizationPass::kLowerRemillUndefinedIntrinsics:
+      return CreateLowerRemillUndefinedIntrinsics();
+    case OptimizationPass::kCleanUpRemillIntrinsics:
+      return CreateCleanUpRemillIntrinsics(lifter_context);
+    default: LOG(FATAL) << "Not a call site pass"; return nullptr;
+  }
+}
+
+// Run the call site pass `pass` over `module`, on the calling thread. If
+// `record_impact` is set, then the traced event records whether the pass
+// changed anything, and which `occurrence` of the pass this is. It runs over
+// the whole module, so its changes can't be attributed to functions.
+static void RunCallSitePass(llvm::Module &module,
+                            llvm::FunctionAnalysisManager &fam,
+                            OptimizationPass pass,
+                            const EntityLifter &lifter_context,
+                            Tracer *tracer, bool record_impact,
+                            unsigned occurrence) {
+  std::unique_ptr<llvm::ModulePass> module_pass(
+      CreateCallSitePass(pass, lifter_context));
+  TraceScope scope(tracer, OptimizationPipeline::PassName(pass), "pass",
+                   nullptr);
+  ANVILL_TRACE_ZONE_NAMED(OptimizationPipeline::PassName(pass));
+
+  // Like the function passes, these don't depend on any legacy analyses, so
+  // they can be invoked directly. We don't know which functions they changed,
+  // so any cached analyses are stale.
+  const auto changed = module_pass->runOnModule(module);
+  if (changed) {
+    fam.clear();
+  }
+
+  if (record_impact) {
+    scope.AddCounter("occurrence", occurrence);
+    scope.AddCounter("changed", changed ? 1u : 0u);
+  }
+}
+
+using ReturnAddressCachePtr = std::shared_ptr<ReturnAddressCache>;
+
+static void AddUntracedFunctionPass(llvm::FunctionPassManager &fpm,
+                                    OptimizationPass pass,
+                                    ITransformationErrorManager &err_man,
+                                    const EntityLifter &lifter_context,
+                                    const LifterOptions &options,
+                                    const ReturnAddressCachePtr &ret_addrs) {
+  switch (pass) {
+    case OptimizationPass::kDCE: fpm.addPass(llvm::DCEPass()); break;
+    case OptimizationPass::kSinking: fpm.addPass(llvm::SinkingPass()); break;
+    case OptimizationPass::kNewGVN: fpm.addPass(llvm::NewGVNPass()); break;
+    case OptimizationPass::kSCCP: fpm.addPass(llvm::SCCPPass()); break;
+    case OptimizationPass::kDSE: fpm.addPass(llvm::DSEPass()); break;
+    case OptimizationPass::kSROA: fpm.addPass(SROAPass()); break;
+    case OptimizationPass::kEarlyCSE:
+      fpm.addPass(llvm::EarlyCSEPass(true));
+      break;
+    case OptimizationPass::kBDCE: fpm.addPass(llvm::BDCEPass()); break;
+    case OptimizationPass::kSimplifyCFG:
+      fpm.addPass(llvm::SimplifyCFGPass());
+      break;
+    case OptimizationPass::kInstCombine:
+      fpm.addPass(llvm::InstCombinePass());
+      break;
+    case OptimizationPass::kSinkSelectionsIntoBranchTargets:
+      AddPass(fpm, CreateSinkSelectionsIntoBranchTargets(err_man), true);
+      break;
+    case OptimizationPass::kRemoveCompilerBarriers:
+      AddPass(fpm, CreateRemoveCompilerBarriers(), true);
+      break;
+    case OptimizationPass::kInstructionFolder:
+      AddPass(fpm, CreateInstructionFolderPass(err_man), true);
+      break;
+    case OptimizationPass::kRecoverEntityUseInformation:
+      AddPass(fpm, CreateRecoverEntityUseInformation(err_man, lifter_context),
+              true);
+      break;
+    case OptimizationPass::kRemoveTrivialPhisAndSelects:
+      AddPass(fpm, CreateRemoveTrivialPhisAndSelects(), true);
+      break;
+    case OptimizationPass::kRecoverStackFrameInformation:
+      AddPass(fpm, CreateRecoverStackFrameInformation(err_man, options), true);
+      break;
+    case OptimizationPass::kSplitStackFrameAtReturnAddress:
+      AddPass(fpm, CreateSplitStackFrameAtReturnAddress(err_man), true);
+      break;
+    case OptimizationPass::kRecoverAndSplitStackFrame:
+      AddPass(fpm, CreateRecoverAndSplitStackFrame(err_man, options), true);
+      break;
+
+    // Sometimes we have a values in the form of (expr ^ 1) used as branch
+    // conditions or other targets. Try to fix these to be CMPs, since it
+    // makes code easier to read and analyze. This is a fairly narrow
+    // optimization but it comes up often enough for lifted code.
+    case OptimizationPass::kConvertXorToCmp:
+      AddPass(fpm, CreateConvertXorToCmp(), true);
+      break;
+    case OptimizationPass::kPeepholes:
+      AddPass(fpm, CreatePeepholes(), true);
+      break;
+    case OptimizationPass::kBrightenPointerOperations:
+      if (FLAGS_pointer_brighten_gas) {
+        AddPass(fpm,
+                CreateBrightenPointerOperations(FLAGS_pointer_brighten_gas),
+                false);
+      }
+      break;
+    case OptimizationPass::kTransformRemillJumpIntrinsics:
+      AddPass(fpm, CreateTransformRemillJumpIntrinsics(ret_addrs), false);
+      break;
+    case OptimizationPass::kRemoveRemillFunctionReturns:
+      AddPass(fpm, CreateRemoveRemillFunctionReturns(ret_addrs), true);
+      break;
+    default: LOG(FATAL) << "Not a function pass"; break;
+  }
+}
+
+// Add `pass` to `fpm`. If we're tracing, or trace zones are compiled in, then
+// the pass records an event for every function that it runs on. The pass is
+// the `occurrence`th instance of `pass` in the pipeline.
+static void AddFunctionPass(llvm::FunctionPassManager &fpm,
+                            OptimizationPass pass,
+                            ITransformationErrorManager &err_man,
+                            const EntityLifter &lifter_context,
+                            const LifterOptions &options,
+                            const ReturnAddressCachePtr &ret_addrs,
+                            const FunctionAddressMap &addresses,
+                            unsigned occurrence) {
+  if (!options.tracer && !kTraceZonesEnabled) {
+    AddUntracedFunctionPass(fpm, pass, err_man, lifter_context, options,
+                            ret_addrs);
+    return;
+  }
+
+  llvm::FunctionPassManager traced_fpm;
+  AddUntracedFunctionPass(traced_fpm, pass, err_man, lifter_context, options,
+                          ret_addrs);
+  fpm.addPass(TracedPass(std::move(traced_fpm),
+                         OptimizationPipeline::PassName(pass), options.tracer,
+                         addresses, options.record_pass_impact, occurrence));
+}
+
+// Returns how many times the pass at `it` appears in `[first, it]`, so that
+// the events of passes that appear more than once in a pipeline can be told
+// apart.
+static unsigned
+PassOccurrence(std::vector<OptimizationPass>::const_iterator first,
+               std::vector<OptimizationPass>::const_iterator it) {
+  return static_cast<unsigned>(std::count(first, std::next(it), *it));
+}
+
+// Run the function passes in `[begin, end)`, which are part of the function
+// passes starting at `first`. Consecutive passes that don't need the
+// `EntityLifter` are run together, possibly in parallel. Each group of passes
+// is re-run over changed functions up to `max_iterations` times. Call site
+// passes split up the groups, and run once over the whole module. If
+// `only_func` is non-null, then the groups of passes only run over it.
+// Returns `false` if optimizing in parallel failed.
+static bool
+RunFunctionPasses(llvm::Module &module, llvm::FunctionAnalysisManager &fam,
+                  ITransformationErrorManager &err_man,
+                  const EntityLifter &lifter_context,
+                  const LifterOptions &options,
+                  std::vector<OptimizationPass>::const_iterator first,
+                  std::vector<OptimizationPass>::const_iterator begin,
+                  std::vector<OptimizationPass>::const_iterator end,
+                  unsigned max_iterations,
+                  const FunctionAddressMap &addresses,
+                  llvm::Function *only_func) {
+  OptimizationBudget budget;
+  budget.max_ir_size = options.max_function_ir_size;
+  budget.max_time_ms = options.max_optimize_time_ms;
+
+  // The return address passes need the lifter, so they only ever run on this
+  // thread, and can share their classifications across every segment and
+  // iteration.
+  const auto ret_addrs = CreateReturnAddressCache(lifter_context);
+
+  while (begin != end) {
+
+    // `only_func` is left as a declaration if it went over budget.
+    if (only_func && only_func->isDeclaration()) {
+      return true;
+    }
+
+    if (IsCallSitePass(*begin)) {
+      RunCallSitePass(module, fam, *begin, lifter_context, options.tracer,
+                      options.record_pass_impact,
+                      PassOccurrence(first, begin));
+      ++begin;
+      continue;
+    }
+
+    const auto needs_lifter = NeedsEntityLifter(*begin);
+    auto segment_end = std::find_if(begin, end, [=](OptimizationPass pass) {
+      return IsCallSitePass(pass) || NeedsEntityLifter(pass) != needs_lifter;
+    });
+
+    PipelineBuilder build_pipeline =
+        [&, begin, segment_end](llvm::FunctionPassManager &fpm,
+                                ITransformationErrorManager &em) {
+          for (auto it = begin; it != segment_end; ++it) {
+            AddFunctionPass(fpm, *it, em, lifter_context, options,
+                            ret_addrs, addresses, PassOccurrence(first, it));
+          }
+        };
+
+    // Entities of the `EntityLifter` live in this module's context, so passes
+    // that use them always run on this thread.
+    if (only_func) {
+      RunFunctionPipelineOnFunction(*only_func, fam, err_man, build_pipeline,
+                                    max_iterations, budget);
+    } else if (needs_lifter) {
+      RunFunctionPipeline(module, fam, err_man, build_pipeline,
+                          max_iterations, budget);
+    } else if (!RunFunctionPipelineOnThreads(module, fam, err_man,
+                                             build_pipeline, max_iterations,
+                                             budget)) {
+      return false;
+    }
+
+    if (budget.max_ir_size || budget.max_time_ms) {
+      AbandonOverBudgetFunctions(module, fam);
+    }
+
+    begin = segment_end;
+  }
+  return true;
+}
+
+// Create the error manager into which passes report errors, streaming them
+// to `--transformation_errors_out` if it's set.
+static std::unique_ptr<ITransformationErrorManager> CreateErrorManager(void) {
+  ITransformationErrorSink::Ptr error_sink;
+  if (!FLAGS_transformation_errors_out.empty()) {
+    error_sink = ITransformationErrorSink::CreateJSONLines(
+        FLAGS_transformation_errors_out);
+    if (!error_sink) {
+      LOG(ERROR) << "Unable to open transformation error report file '"
+                 << FLAGS_transformation_errors_out << "' for writing";
+    }
+  }
+
+  return ITransformationErrorManager::Create(
+      FLAGS_snapshot_function_ir ? IRSnapshotPolicy::Always
+                                 : IRSnapshotPolicy::OnError,
+      std::move(error_sink));
+}
+
+// The analysis managers of the new pass manager, registered with each other.
+//
+// We use the new pass manager so that analyses like dominator trees and memory
+// SSA stay cached across passes that preserve them, rather than being
+// recomputed by each pass.
+struct AnalysisManagers {
+  inline AnalysisManagers(void) {
+    pb.registerModuleAnalyses(mam);
+    pb.registerCGSCCAnalyses(cam);
+    pb.registerFunctionAnalyses(fam);
+    pb.registerLoopAnalyses(lam);
+    pb.crossRegisterProxies(lam, fam, cam, mam);
+  }
+
+  llvm::PassBuilder pb;
+  llvm::LoopAnalysisManager lam;
+  llvm::FunctionAnalysisManager fam;
+  llvm::CGSCCAnalysisManager cam;
+  llvm::ModuleAnalysisManager mam;
+};
+
+// Log the errors reported by passes.
+static void ReportErrors(const ITransformationErrorManager &err_man) {
+  if (auto num_dropped = err_man.NumDroppedErrors()) {
+    LOG(WARNING) << num_dropped << " earlier transformation errors were not "
+                 << "retained in memory; use --transformation_errors_out to "
+                 << "stream all errors to a file";
   }
-  fpm.doFinalization();
 
   // We can extend error handling here to provide more visibility
   // into what has happened
@@ -172,7 +1177,8 @@ void OptimizeModule(const EntityLifter &lifter_context,
 
     auto message = buffer.str();
 
-    // TODO: Maybe create a structured JSON report instead?
+    // The structured report is streamed to the file given by
+    // `--transformation_errors_out` as errors are inserted.
     switch (error.severity) {
       case SeverityType::Information: LOG(INFO) << message; break;
       case SeverityType::Warning: LOG(WARNING) << message; break;
@@ -180,17 +1186,265 @@ void OptimizeModule(const EntityLifter &lifter_context,
       case SeverityType::Fatal: LOG(FATAL) << message; break;
     }
   }
+}
 
-  CHECK(!err_man.HasFatalError());
+}  // namespace
+
+OptimizationPipeline OptimizationPipeline::Create(OptimizationLevel level) {
+  using P = OptimizationPass;
+  OptimizationPipeline pipeline;
+  auto add = [&](std::initializer_list<OptimizationPass> passes) {
+    for (auto pass : passes) {
+      pipeline.Add(pass);
+    }
+  };
+
+  add({P::kInliner, P::kGlobalOpt, P::kGlobalDCE, P::kStripDeadDebugInfo});
+
+  if (level == OptimizationLevel::kFast) {
+    add({P::kDCE, P::kSROA, P::kEarlyCSE, P::kSimplifyCFG, P::kInstCombine,
+         P::kRemoveUnusedFPClassificationCalls, P::kRemoveDelaySlotIntrinsics,
+         P::kRemoveErrorIntrinsics, P::kLowerRemillMemoryAccessIntrinsics,
+         P::kLowerTypeHintIntrinsics, P::kRemoveCompilerBarriers,
+         P::kInstructionFolder, P::kDCE, P::kRecoverEntityUseInformation,
+         P::kPeepholes, P::kRecoverAndSplitStackFrame, P::kSROA});
+
+  } else {
+    add({P::kDCE, P::kSinking, P::kNewGVN, P::kSCCP, P::kDSE, P::kSROA,
+         P::kEarlyCSE, P::kBDCE, P::kSimplifyCFG, P::kSinking,
+         P::kSimplifyCFG, P::kInstCombine,
+         P::kSinkSelectionsIntoBranchTargets,
+         P::kRemoveUnusedFPClassificationCalls, P::kRemoveDelaySlotIntrinsics,
+         P::kRemoveErrorIntrinsics, P::kLowerRemillMemoryAccessIntrinsics,
+         P::kLowerTypeHintIntrinsics, P::kRemoveCompilerBarriers,
+         P::kInstructionFolder, P::kDCE, P::kRecoverEntityUseInformation,
+         P::kSinkSelectionsIntoBranchTargets, P::kPeepholes,
+         P::kRecoverAndSplitStackFrame, P::kSROA, P::kPeepholes,
+         P::kBrightenPointerOperations});
+
+    // Clean up after the stack frames have been split up into scalars, and
+    // after pointer operations have been brightened.
+    if (level == OptimizationLevel::kThorough) {
+      add({P::kInstCombine, P::kNewGVN, P::kDSE, P::kSimplifyCFG,
+           P::kSinkSelectionsIntoBranchTargets, P::kPeepholes});
+    }
+  }
+
+  add({P::kCleanUpRemillIntrinsics});
+  if (level == OptimizationLevel::kThorough) {
+    add({P::kMergeFunctions});
+  }
+  return pipeline;
+}
+
+// Module passes always run before function passes, and `merge-functions`
+// always runs last, so descriptions that order them otherwise are rejected
+// rather than silently reordered.
+llvm::Expected<OptimizationPipeline>
+OptimizationPipeline::Parse(llvm::StringRef description) {
+  OptimizationPipeline pipeline;
+  llvm::SmallVector<llvm::StringRef, 32> names;
+  description.split(names, ',', -1, false);
+
+  const char *prev_name = nullptr;
+  auto seen_func_pass = false;
+  auto seen_late_pass = false;
+  for (auto name : names) {
+    name = name.trim();
+    if (name.empty()) {
+      continue;
+    }
+
+    auto it = std::find_if(
+        std::begin(kPassNames), std::end(kPassNames),
+        [=](const auto &pass_name) { return name == pass_name.second; });
+    if (it == std::end(kPassNames)) {
+      return llvm::createStringError(
+          std::make_error_code(std::errc::invalid_argument),
+          "Unknown optimization pass '%s'", name.str().c_str());
+    }
+
+    const auto pass = it->first;
+    if (seen_late_pass && !IsLateModulePass(pass)) {
+      return llvm::createStringError(
+          std::make_error_code(std::errc::invalid_argument),
+          "Optimization pass '%s' comes after '%s', which always runs last",
+          it->second, prev_name);
+    } else if (seen_func_pass && IsModulePass(pass)) {
+      return llvm::createStringError(
+          std::make_error_code(std::errc::invalid_argument),
+          "Module pass '%s' comes after function pass '%s', but module passes "
+          "always run first",
+          it->second, prev_name);
+    }
+
+    if (IsLateModulePass(pass)) {
+      seen_late_pass = true;
+    } else if (!IsModulePass(pass)) {
+      seen_func_pass = true;
+    }
+    prev_name = it->second;
+    pipeline.Add(pass);
+  }
+
+  return pipeline;
+}
+
+llvm::StringRef OptimizationPipeline::PassName(OptimizationPass pass) {
+  for (auto [p, name] : kPassNames) {
+    if (p == pass) {
+      return name;
+    }
+  }
+  return "";
+}
+
+OptimizationPipeline &OptimizationPipeline::Add(OptimizationPass pass) {
+  passes.push_back(pass);
+  return *this;
+}
+
+OptimizationPipeline &OptimizationPipeline::Remove(OptimizationPass pass) {
+  passes.erase(std::remove(passes.begin(), passes.end(), pass), passes.end());
+  return *this;
+}
+
+OptimizationPipeline &
+OptimizationPipeline::SetMaxIterations(unsigned max_iterations_) {
+  max_iterations = std::max(1u, max_iterations_);
+  return *this;
+}
 
-  fpm.add(CreateTransformRemillJumpIntrinsics(lifter_context));
-  fpm.add(CreateRemoveRemillFunctionReturns(lifter_context));
-  fpm.add(CreateLowerRemillUndefinedIntrinsics());
-  fpm.doInitialization();
+bool OptimizationPipeline::Contains(OptimizationPass pass) const {
+  return std::find(passes.begin(), passes.end(), pass) != passes.end();
+}
+
+std::string OptimizationPipeline::ToString(void) const {
+  std::string desc;
+  for (auto pass : passes) {
+    if (!desc.empty()) {
+      desc += ',';
+    }
+    desc += PassName(pass).str();
+  }
+  return desc;
+}
+
+// Optimize a module. This can be a module with semantics code, lifted
+// code, etc.
+bool OptimizeModule(const EntityLifter &lifter_context,
+                    const remill::Arch *arch, const Program &program,
+                    llvm::Module &module, const LifterOptions &options) {
+  return OptimizeModule(
+      lifter_context, arch, program, module, options,
+      OptimizationPipeline::Create(OptimizationLevel::kDefault));
+}
+
+// Optimize a module using the passes of `pipeline`.
+bool OptimizeModule(const EntityLifter &lifter_context,
+                    const remill::Arch *arch, const Program &program,
+                    llvm::Module &module, const LifterOptions &options,
+                    const OptimizationPipeline &pipeline) {
+
+  // Drop lazily loaded functions that nothing refers to, and that nothing
+  // outside of the module could refer to, before pulling in the rest, so
+  // that we don't materialize bodies only to have `GlobalDCE` delete them.
+  std::vector<llvm::Function *> unused_funcs;
   for (auto &func : module) {
-    fpm.run(func);
+    if (func.isMaterializable() && func.use_empty() &&
+        func.isDiscardableIfUnused()) {
+      unused_funcs.push_back(&func);
+    }
+  }
+  for (auto func : unused_funcs) {
+    func->eraseFromParent();
+  }
+
+  if (auto err = module.materializeAll(); remill::IsError(err)) {
+    LOG(FATAL) << remill::GetErrorString(err);
+  }
+
+  if (auto used = module.getGlobalVariable("llvm.used"); used) {
+    used->setLinkage(llvm::GlobalValue::PrivateLinkage);
+    used->eraseFromParent();
+  }
+
+  LOG(INFO) << "Optimizing module.";
+
+  // Optionally don't carry block and instruction names through optimization,
+  // nor let passes create new ones. Function and global variable names are
+  // never discarded by the context.
+  auto &context = module.getContext();
+  const auto discarded_value_names = context.shouldDiscardValueNames();
+  if (options.discard_value_names) {
+    for (auto &func : module) {
+      ClearVariableNames(&func);
+    }
+    context.setDiscardValueNames(true);
+  }
+
+  if (auto memory_escape = module.getFunction(kMemoryPointerEscapeFunction)) {
+    for (auto call : remill::CallersOf(memory_escape)) {
+      call->eraseFromParent();
+    }
+    memory_escape->eraseFromParent();
+  }
+
+  AnalysisManagers ams;
+  auto &fam = ams.fam;
+
+  std::vector<OptimizationPass> func_passes;
+  llvm::ModulePassManager mpm;
+  for (auto pass : pipeline.Passes()) {
+    if (IsModulePass(pass)) {
+      AddModulePass(mpm, pass);
+    } else if (!IsLateModulePass(pass)) {
+      func_passes.push_back(pass);
+    }
+  }
+  {
+    TraceScope scope(options.tracer, "module-passes", "pass", nullptr);
+    ANVILL_TRACE_ZONE("module-passes");
+    mpm.run(module, ams.mam);
+  }
+
+  // Function passes only see the names of functions when they run in
+  // parallel, so remember the addresses of lifted functions by name.
+  FunctionAddressMap addresses;
+  if (options.tracer || kTraceZonesEnabled) {
+    for (auto &func : module) {
+      if (auto maybe_addr = lifter_context.AddressOfEntity(&func)) {
+        addresses.emplace(func.getName().str(), *maybe_addr);
+      }
+    }
+  }
+
+  auto error_manager_ptr = CreateErrorManager();
+  auto &err_man = *error_manager_ptr.get();
+
+  // Errors are reported once the last pass that can report them has run, so
+  // that the remaining passes never see a module in an inconsistent state.
+  auto last_reporting_pass =
+      std::find_if(func_passes.rbegin(), func_passes.rend(), ReportsErrors);
+  auto mid = last_reporting_pass.base();
+
+  auto succeeded = RunFunctionPasses(
+      module, fam, err_man, lifter_context, options, func_passes.cbegin(),
+      func_passes.cbegin(), mid, pipeline.MaxIterations(), addresses, nullptr);
+  ReportErrors(err_man);
+  CHECK(!err_man.HasFatalError());
+
+  if (succeeded) {
+    succeeded = RunFunctionPasses(
+        module, fam, err_man, lifter_context, options, func_passes.cbegin(),
+        mid, func_passes.cend(), pipeline.MaxIterations(), addresses,
+        nullptr);
+  }
+
+  if (!succeeded) {
+    context.setDiscardValueNames(discarded_value_names);
+    return false;
   }
-  fpm.doFinalization();
 
   // Get rid of all final uses of `__anvill_pc`.
   if (auto anvill_pc = module.getGlobalVariable(::anvill::kSymbolicPCName)) {
@@ -198,7 +1452,83 @@ void OptimizeModule(const EntityLifter &lifter_context,
         anvill_pc, llvm::Constant::getNullValue(anvill_pc->getType()), &module);
   }
 
+  if (pipeline.Contains(OptimizationPass::kMergeFunctions)) {
+    TraceScope scope(options.tracer,
+                     OptimizationPipeline::PassName(
+                         OptimizationPass::kMergeFunctions),
+                     "pass", nullptr);
+    ANVILL_TRACE_ZONE("merge-functions");
+    const auto num_merged = MergeEquivalentFunctions(module, lifter_context);
+    scope.AddCounter("merged_functions", num_merged);
+  }
+
   CHECK(remill::VerifyModule(&module));
+
+  context.setDiscardValueNames(discarded_value_names);
+  return true;
+}
+
+// Optimize only `func`, using the function passes of `pipeline`.
+void OptimizeFunction(const EntityLifter &lifter_context, llvm::Function &func,
+                      const LifterOptions &options,
+                      const OptimizationPipeline &pipeline) {
+  auto &module = *func.getParent();
+  if (auto err = func.materialize(); remill::IsError(err)) {
+    LOG(FATAL) << remill::GetErrorString(err);
+  }
+
+  auto &context = module.getContext();
+  const auto discarded_value_names = context.shouldDiscardValueNames();
+  if (options.discard_value_names) {
+    ClearVariableNames(&func);
+    context.setDiscardValueNames(true);
+  }
+
+  if (auto memory_escape = module.getFunction(kMemoryPointerEscapeFunction)) {
+    for (auto call : remill::CallersOf(memory_escape)) {
+      if (call->getFunction() == &func) {
+        call->eraseFromParent();
+      }
+    }
+  }
+
+  AnalysisManagers ams;
+  std::vector<OptimizationPass> func_passes;
+  for (auto pass : pipeline.Passes()) {
+    if (!IsModulePass(pass) && !IsLateModulePass(pass)) {
+      func_passes.push_back(pass);
+    }
+  }
+
+  FunctionAddressMap addresses;
+  if (options.tracer || kTraceZonesEnabled) {
+    if (auto maybe_addr = lifter_context.AddressOfEntity(&func)) {
+      addresses.emplace(func.getName().str(), *maybe_addr);
+    }
+  }
+
+  auto error_manager_ptr = CreateErrorManager();
+  auto &err_man = *error_manager_ptr.get();
+
+  auto last_reporting_pass =
+      std::find_if(func_passes.rbegin(), func_passes.rend(), ReportsErrors);
+  auto mid = last_reporting_pass.base();
+
+  // Passes only run in parallel over whole modules, so running them over one
+  // function can't fail.
+  RunFunctionPasses(module, ams.fam, err_man, lifter_context, options,
+                    func_passes.cbegin(), func_passes.cbegin(), mid,
+                    pipeline.MaxIterations(), addresses, &func);
+  ReportErrors(err_man);
+  CHECK(!err_man.HasFatalError());
+
+  RunFunctionPasses(module, ams.fam, err_man, lifter_context, options,
+                    func_passes.cbegin(), mid, func_passes.cend(),
+                    pipeline.MaxIterations(), addresses, &func);
+
+  CHECK(!llvm::verifyFunction(func, &llvm::errs()));
+
+  context.setDiscardValueNames(discarded_value_names);
 }
 
 }  // namespace anvill
@@ -18,46 +18,53 @@
 #include "anvill/Program.h"
 
 #include <glog/logging.h>
+#include <llvm/ADT/Hashing.h>
 #include <llvm/ADT/SmallVector.h>
+#include <llvm/IR/DataLayout.h>
 #include <llvm/IR/DerivedTypes.h>
 #include <llvm/IR/Type.h>
+#include <llvm/Support/Endian.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/Memory.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
 #include <remill/Arch/Arch.h>
 #include <remill/Arch/Name.h>
 #include <remill/BC/Compat/VectorType.h>
 #include <remill/BC/Util.h>
 
 #include <algorithm>
+#include <atomic>
+#include <deque>
 #include <map>
 #include <sstream>
+#include <string_view>
 #include <system_error>
 #include <tuple>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "anvill/Decl.h"
+#include "anvill/Trace.h"
 
 namespace anvill {
 
-// A byte's associated metadata. The metadata is updated throughout the
-// lifting/decompiling process.
+// The metadata associated with the bytes of a mapped range. The metadata is
+// updated throughout the lifting/decompiling process.
+//
+// Most of the metadata is uniform across a range, and so it is stored once per
+// range. The few bits that vary from byte to byte are stored as sorted lists
+// of the addresses of the bytes for which those bits are set.
 struct Byte::Meta {
+  uint64_t base_address{0};
+  uint64_t limit_address{0};  // Exclusive.
 
-  // True if there is a subsequent byte in the range that can be accessed.
-  bool next_byte_is_in_range : 1;
-
-  // True if there is a subsequent byte
-  bool next_byte_starts_new_range : 1;
-
-  // Is the value of this byte undefined? Our model of the stack
-  // begins with all stack bytes, unless explicitly specified, as
-  // undefined.
-  bool is_undefined : 1;
-
-  // Is this byte the beginning of a variable?
-  bool is_variable_head : 1;
-
-  // These require `is_executable` to be `true`.
-  bool is_function_head : 1;
+  // True if the byte at `limit_address` is the first byte of another mapped
+  // range.
+  bool next_range_is_adjacent{false};
 
   // If `false`, then the implied semantic is that the byte will *never* be
   // writable. For example, if we're decompiling a snapshot or a core dump,
@@ -67,27 +74,102 @@ struct Byte::Meta {
   // NOTE(pag): For jump tables to work most effectively, we expect the bytes
   //            that store the offsets/displacements/etc. to be marked as
   //            constants.
-  bool is_writeable : 1;
+  bool is_writeable{false};
 
   // NOTE(pag): We *only* treat a byte as possibly belonging to an instruction
   //            if `is_writable` is false. The semantic here is that we're
   //            unprepared to handle self-modifying code. Further, we don't
   //            want to treat bytes that might be in executable stacks as being
   //            code.
-  bool is_executable : 1;
+  bool is_executable{false};
+
+  // Addresses of the bytes that are the beginnings of functions. These
+  // require `is_executable` to be `true`.
+  std::vector<uint64_t> function_heads;
 
-  // Do we have extended meta-data attached to this byte? This might include
-  // things like devirtualization targets for calls through thunks or jump
-  // tables.
-  bool has_extended_meta : 1;
+  // Addresses of the bytes that are the beginnings of variables.
+  std::vector<uint64_t> variable_heads;
 
-} __attribute__((packed));
+  // Addresses of the bytes whose values are undefined. Our model of the stack
+  // begins with all stack bytes, unless explicitly specified, as undefined.
+  std::vector<uint64_t> undefined_bytes;
+
+  // True if the program owning this range is frozen, and so none of the
+  // above may change.
+  bool is_frozen{false};
+};
 
 static_assert(sizeof(Byte::Data) == sizeof(uint8_t),
               "Invalid packing of `struct Byte::Data`.");
 
-static_assert(sizeof(Byte::Meta) == sizeof(uint8_t),
-              "Invalid packing of `struct Byte::Meta`.");
+// A contiguous range of mapped bytes, along with their metadata.
+struct MappedRange {
+  inline size_t Size(void) const {
+    return static_cast<size_t>(limit_address - base_address);
+  }
+
+  uint64_t base_address{0};
+  uint64_t limit_address{0};  // Exclusive.
+
+  // The bytes of the range. These are backed by one of `owned_data`,
+  // `mapped_file`, `zero_pages`, or memory kept alive by `borrowed_owner`.
+  Byte::Data *data{nullptr};
+  std::vector<Byte::Data> owned_data;
+  std::unique_ptr<llvm::MemoryBuffer> mapped_file;
+  llvm::sys::OwningMemoryBlock zero_pages;
+  std::shared_ptr<const void> borrowed_owner;
+
+  // The metadata is separately allocated so that its address is stable as
+  // ranges are inserted, as `Byte`s point to it.
+  std::unique_ptr<Byte::Meta> meta;
+};
+
+static llvm::hash_code HashValueDecl(const ValueDecl &decl) {
+  return llvm::hash_combine(decl.reg, decl.mem_reg, decl.mem_offset,
+                            decl.type);
+}
+
+static bool SameValueDecl(const ValueDecl &a, const ValueDecl &b) {
+  return a.reg == b.reg && a.mem_reg == b.mem_reg &&
+         a.mem_offset == b.mem_offset && a.type == b.type;
+}
+
+static bool SameValueDecls(const std::vector<ValueDecl> &a,
+                           const std::vector<ValueDecl> &b) {
+  return std::equal(a.begin(), a.end(), b.begin(), b.end(), SameValueDecl);
+}
+
+struct PrototypeHash {
+  size_t operator()(const FunctionPrototype *proto) const {
+    auto hash = llvm::hash_combine(
+        proto->arch, proto->type, proto->calling_convention,
+        proto->is_noreturn, proto->is_variadic,
+        HashValueDecl(proto->return_address), proto->return_stack_pointer,
+        proto->return_stack_pointer_offset);
+    for (const auto &param : proto->params) {
+      hash = llvm::hash_combine(hash, HashValueDecl(param));
+    }
+    for (const auto &ret : proto->returns) {
+      hash = llvm::hash_combine(hash, HashValueDecl(ret));
+    }
+    return hash;
+  }
+};
+
+struct PrototypeEq {
+  bool operator()(const FunctionPrototype *a,
+                  const FunctionPrototype *b) const {
+    return a->arch == b->arch && a->type == b->type &&
+           a->calling_convention == b->calling_convention &&
+           a->is_noreturn == b->is_noreturn &&
+           a->is_variadic == b->is_variadic &&
+           SameValueDecl(a->return_address, b->return_address) &&
+           a->return_stack_pointer == b->return_stack_pointer &&
+           a->return_stack_pointer_offset == b->return_stack_pointer_offset &&
+           SameValueDecls(a->params, b->params) &&
+           SameValueDecls(a->returns, b->returns);
+  }
+};
 
 enum ProgramEvent {
   kFunctionDeclared,
@@ -99,6 +181,8 @@ enum ProgramEvent {
 // Default implementation of a program.
 class Program::Impl : public std::enable_shared_from_this<Program::Impl> {
  public:
+  Impl(void);
+
   llvm::Expected<FunctionDecl *>
   DeclareFunction(const FunctionDecl &decl_template, bool force);
 
@@ -107,13 +191,16 @@ class Program::Impl : public std::enable_shared_from_this<Program::Impl> {
   bool TryGetControlFlowRedirection(std::uint64_t &destination,
                                     std::uint64_t address) const;
 
-  void AddControlFlowRedirection(std::uint64_t from, std::uint64_t to);
+  bool AddControlFlowRedirection(std::uint64_t from, std::uint64_t to);
 
   std::optional<ControlFlowTargetList>
   TryGetControlFlowTargets(std::uint64_t address) const;
 
   bool TrySetControlFlowTargets(const ControlFlowTargetList &target_list);
 
+  void ForEachControlFlowTargets(
+      std::function<bool(const ControlFlowTargetList &)> callback) const;
+
   llvm::Error DeclareVariable(const GlobalVarDecl &decl_template);
 
   GlobalVarDecl *FindVariable(uint64_t address);
@@ -123,6 +210,8 @@ class Program::Impl : public std::enable_shared_from_this<Program::Impl> {
   GlobalVarDecl *FindInVariable(uint64_t address,
                                 const llvm::DataLayout &layout);
 
+  MappedRange *FindRange(uint64_t address);
+
   std::pair<Byte::Data *, Byte::Meta *> FindByte(uint64_t address);
 
   std::tuple<Byte::Data *, Byte::Meta *, size_t, uint64_t>
@@ -131,18 +220,73 @@ class Program::Impl : public std::enable_shared_from_this<Program::Impl> {
   std::tuple<Byte::Data *, Byte::Meta *, size_t> FindBytes(uint64_t address,
                                                            size_t size);
 
+  llvm::Expected<MappedRange *> AllocateRange(uint64_t address, uint64_t size,
+                                              bool is_writeable,
+                                              bool is_executable);
+
   llvm::Error MapRange(const ByteRange &range);
 
+  llvm::Error MapRange(uint64_t address, std::vector<uint8_t> data,
+                       bool is_writeable, bool is_executable);
+
+  llvm::Error MapBorrowedRange(uint64_t address, const uint8_t *data,
+                               uint64_t size, std::shared_ptr<const void> owner,
+                               bool is_writeable, bool is_executable);
+
+  llvm::Error MapFile(const std::string &path, uint64_t file_offset,
+                      uint64_t address, uint64_t size, bool is_writeable,
+                      bool is_executable);
+
+  llvm::Error MapZeroRange(uint64_t address, uint64_t size, bool is_writeable,
+                           bool is_executable);
+
   void EmitEvent(ProgramEvent event, uint64_t address) {}
 
-  // Mapping between addresses and names.
-  std::multimap<uint64_t, std::string> ea_to_name;
-  std::multimap<std::string, uint64_t> name_to_ea;
+  // Sort the functions or variables by their addresses, if they aren't
+  // already sorted.
+  void SortFunctions(void);
+  void SortVariables(void);
+
+  // Sort the name indexes, if they aren't already sorted.
+  void SortNames(void);
+
+  void AddName(const std::string &name, uint64_t address);
+
+  // Returns the entries of `ea_to_name` for the names of `address`, or the
+  // entries of `name_to_ea` for the addresses of `name`.
+  std::pair<std::vector<std::pair<uint64_t, uint32_t>>::const_iterator,
+            std::vector<std::pair<uint64_t, uint32_t>>::const_iterator>
+  NamesOfAddress(uint64_t address);
+
+  std::pair<std::vector<std::pair<uint32_t, uint64_t>>::const_iterator,
+            std::vector<std::pair<uint32_t, uint64_t>>::const_iterator>
+  AddressesOfName(const std::string &name);
+
+  void Freeze(const llvm::DataLayout *layout);
+
+  // Interned names. `names` is a deque so that the keys of `name_ids` can
+  // refer to its strings.
+  std::deque<std::string> names;
+  std::unordered_map<std::string_view, uint32_t> name_ids;
+
+  // Mapping between addresses and name IDs, sorted by address and by name ID,
+  // respectively. The names of an address, and the addresses of a name, are
+  // kept in the order in which they were added.
+  bool names_are_sorted{true};
+  std::vector<std::pair<uint64_t, uint32_t>> ea_to_name;
+  std::vector<std::pair<uint32_t, uint64_t>> name_to_ea;
 
   // Declarations for the functions.
   bool funcs_are_sorted{true};
   std::vector<std::unique_ptr<FunctionDecl>> funcs;
-  std::unordered_map<uint64_t, FunctionDecl *> ea_to_func;
+  std::map<uint64_t, FunctionDecl *> ea_to_func;
+
+  // Interned prototypes of the functions. `prototypes` is a deque so that
+  // the decls, and the keys of `prototype_set`, can point into it.
+  const FunctionPrototype *InternPrototype(const FunctionDecl &decl);
+  std::deque<FunctionPrototype> prototypes;
+  std::unordered_set<const FunctionPrototype *, PrototypeHash, PrototypeEq>
+      prototype_set;
 
   // Control flow redirections
   std::unordered_map<std::uint64_t, std::uint64_t> ctrl_flow_redirections;
@@ -150,29 +294,91 @@ class Program::Impl : public std::enable_shared_from_this<Program::Impl> {
   // Control flow targets
   std::unordered_map<std::uint64_t, ControlFlowTargetList> ctrl_flow_targets;
 
+  // Read-only snapshots of the above, built by `Freeze`, and sorted by source
+  // address. Chains of redirections are resolved to their final destinations
+  // ahead of time.
+  std::vector<std::pair<std::uint64_t, std::uint64_t>> frozen_redirections;
+  std::vector<ControlFlowTargetList> frozen_targets;
+
   // Declarations for the variables.
   bool vars_are_sorted{true};
   std::vector<std::unique_ptr<GlobalVarDecl>> vars;
   std::map<uint64_t, GlobalVarDecl *> ea_to_var;
 
+  // Read-only snapshot of `ea_to_var`, built by `Freeze` when it is given a
+  // data layout, where each variable is paired with the end of its extent.
+  // An `end` of zero means that the variable's size is unknown.
+  struct VariableExtent {
+    uint64_t address;
+    uint64_t end;
+    GlobalVarDecl *decl;
+  };
+  std::vector<VariableExtent> frozen_var_extents;
+  std::string frozen_var_layout;
+  bool has_frozen_var_extents{false};
+
   // Values of all bytes mapped in memory, including additional
   // bits of metadata, and the address at which each byte is
   // loaded.
   //
-  // The keys of the maps are the address of the last byte in
-  // the range as represented in the mapped vector. The vectors
-  // are sorted in order.
-  std::map<uint64_t,
-           std::pair<std::vector<Byte::Data>, std::vector<Byte::Meta>>>
-      bytes;
+  // The ranges are non-overlapping, and sorted by their base addresses, so
+  // that they can be binary searched.
+  std::vector<MappedRange> ranges;
+
+  // Version number of `ranges`. This is changed each time `ranges` is
+  // changed, and is unique across all programs, so that per-thread caches
+  // of range lookups can be validated without holding any locks.
+  uint64_t ranges_version{0};
 
   // Initial stack pointer.
   uint64_t initial_stack_pointer{0};
   bool has_initial_stack_pointer{false};
+
+  // Is this program frozen? If so, then nothing above will change anymore.
+  bool is_frozen{false};
+
+  // Are function decls trusted, and so declared without being checked? See
+  // `Program::TrustDecls`.
+  bool trusts_decls{false};
 };
 
 namespace {
 
+// Source of unique `Program::Impl::ranges_version` numbers.
+static std::atomic<uint64_t> gNextRangesVersion{1u};
+
+// Per-thread cache of the last range found by `Program::Impl::FindRange`.
+// Lifting accesses strongly local addresses, and so the next lookup is
+// usually in the same range as the last.
+struct LastRangeHit {
+  uint64_t ranges_version{0};
+  size_t index{0};
+};
+
+static thread_local LastRangeHit gLastRangeHit;
+
+// Returns `true` if the sorted list `addrs` contains `addr`.
+static bool ContainsAddress(const std::vector<uint64_t> &addrs,
+                            uint64_t addr) {
+  return std::binary_search(addrs.begin(), addrs.end(), addr);
+}
+
+// Add `addr` to the sorted list `addrs`, if it isn't already present.
+static void InsertAddress(std::vector<uint64_t> &addrs, uint64_t addr) {
+  auto it = std::lower_bound(addrs.begin(), addrs.end(), addr);
+  if (it == addrs.end() || *it != addr) {
+    addrs.insert(it, addr);
+  }
+}
+
+// Remove `addr` from the sorted list `addrs`, if it is present.
+static void EraseAddress(std::vector<uint64_t> &addrs, uint64_t addr) {
+  auto it = std::lower_bound(addrs.begin(), addrs.end(), addr);
+  if (it != addrs.end() && *it == addr) {
+    addrs.erase(it);
+  }
+}
+
 static size_t EstimateSize(const remill::Arch *arch, llvm::Type *type) {
   switch (type->getTypeID()) {
     case llvm::Type::HalfTyID: return 2;
@@ -231,88 +437,149 @@ static size_t EstimateSize(const remill::Arch *arch, llvm::Type *type) {
   }
 }
 
-template <typename T>
-static llvm::Error CheckValueDecl(const T &decl, llvm::LLVMContext &context,
-                                  const char *desc, const FunctionDecl &tpl) {
+// A problem with the return address, a parameter, or a return value of a
+// function declaration. Specs can have lots of these, and not every caller
+// logs them, so the message is only formatted once it's asked for.
+class ValueDeclError final : public llvm::ErrorInfo<ValueDeclError> {
+ public:
+  enum Problem {
+    kMissingType,
+    kFunctionType,
+    kVoidType,
+    kTypeContext,
+    kRegAndMemReg,
+    kRegContext,
+    kMemRegContext,
+    kMemRegNotIntegral,
+    kRegTooSmall,
+  };
+
+  ValueDeclError(Problem problem_, const char *desc_, const ValueDecl &decl_,
+                 const FunctionDecl &tpl)
+      : problem(problem_),
+        desc(desc_),
+        decl(decl_),
+        arch(tpl.arch),
+        address(tpl.address) {}
+
+  void log(llvm::raw_ostream &os) const final;
+
+  std::error_code convertToErrorCode(void) const final {
+    return std::make_error_code(std::errc::invalid_argument);
+  }
+
+  static char ID;
+
+ private:
+  const Problem problem;
+  const char *const desc;
+  const ValueDecl decl;
+  const remill::Arch *const arch;
+  const uint64_t address;
+};
+
+char ValueDeclError::ID = '\0';
+
+void ValueDeclError::log(llvm::raw_ostream &os) const {
+  switch (problem) {
+    case kMissingType:
+      os << llvm::format("Missing LLVM type information for %s "
+                         "in function declaration at %lx",
+                         desc, address);
+      break;
+    case kFunctionType:
+      os << llvm::format("LLVM type information for %s "
+                         "in function declaration at %lx is a function type; "
+                         "did you mean to use a function pointer type?",
+                         desc, address);
+      break;
+    case kVoidType:
+      os << llvm::format("LLVM type information for %s "
+                         "in function declaration at %lx is a void type; "
+                         "did you mean to use a void pointer type, or to "
+                         "exclude it entirely?",
+                         desc, address);
+      break;
+    case kTypeContext:
+      os << llvm::format("LLVM type information for %s "
+                         "in function declaration at %lx is associated "
+                         "with a different LLVM context than the function's "
+                         "architecture",
+                         desc, address);
+      break;
+    case kRegAndMemReg:
+      os << llvm::format("A %s cannot be resident in both a "
+                         "register (%s) and a memory location (%s + %ld) in "
+                         "function declaration at %lx",
+                         desc, decl.reg->name.c_str(),
+                         decl.mem_reg->name.c_str(), decl.mem_offset, address);
+      break;
+    case kRegContext:
+      os << llvm::format("LLVM type information for %s "
+                         "in function declaration at %lx is associated "
+                         "with a different LLVM context than the %s's "
+                         "register location",
+                         desc, address, desc);
+      break;
+    case kMemRegContext:
+      os << llvm::format("LLVM type information for %s "
+                         "in function declaration at %lx is associated "
+                         "with a different LLVM context than the %s's "
+                         "memory location base register",
+                         desc, address, desc);
+      break;
+    case kMemRegNotIntegral:
+      os << llvm::format("Type of memory base register of %s in function "
+                         "declaration at %lx must be integral",
+                         desc, address);
+      break;
+    case kRegTooSmall:
+      os << llvm::format("Size of register %s of %s in function "
+                         "declaration at %lx is too small (%lu bytes) for "
+                         "value of size %lu bytes",
+                         decl.reg->name.c_str(), desc, address,
+                         EstimateSize(arch, decl.reg->type),
+                         EstimateSize(arch, decl.type));
+      break;
+  }
+}
+
+static llvm::Error CheckValueDecl(const ValueDecl &decl,
+                                  llvm::LLVMContext &context, const char *desc,
+                                  const FunctionDecl &tpl) {
+  auto problem = [&](ValueDeclError::Problem which) {
+    return llvm::make_error<ValueDeclError>(which, desc, decl, tpl);
+  };
+
   if (!decl.type) {
-    return llvm::createStringError(
-        std::make_error_code(std::errc::invalid_argument),
-        "Missing LLVM type information for %s "
-        "in function declaration at %lx",
-        desc, tpl.address);
+    return problem(ValueDeclError::kMissingType);
 
   } else if (decl.type->isFunctionTy()) {
-    return llvm::createStringError(
-        std::make_error_code(std::errc::invalid_argument),
-        "LLVM type information for %s "
-        "in function declaration at %lx is a function type; "
-        "did you mean to use a function pointer type?",
-        desc, tpl.address);
+    return problem(ValueDeclError::kFunctionType);
 
   } else if (decl.type->isVoidTy()) {
-    return llvm::createStringError(
-        std::make_error_code(std::errc::invalid_argument),
-        "LLVM type information for %s "
-        "in function declaration at %lx is a void type; "
-        "did you mean to use a void pointer type, or to "
-        "exclude it entirely?",
-        desc, tpl.address);
+    return problem(ValueDeclError::kVoidType);
 
   } else if (&(decl.type->getContext()) != &context) {
-    return llvm::createStringError(
-        std::make_error_code(std::errc::invalid_argument),
-        "LLVM type information for %s "
-        "in function declaration at %lx is associated "
-        "with a different LLVM context than the function's "
-        "architecture",
-        desc, tpl.address);
+    return problem(ValueDeclError::kTypeContext);
 
   } else if (decl.reg && decl.mem_reg) {
-    return llvm::createStringError(
-        std::make_error_code(std::errc::invalid_argument),
-        "A %s cannot be resident in both a "
-        "register (%s) and a memory location (%s + %ld) in "
-        "function declaration at %lx",
-        desc, decl.reg->name.c_str(), decl.mem_reg->name.c_str(),
-        decl.mem_offset, tpl.address);
+    return problem(ValueDeclError::kRegAndMemReg);
 
   } else if (decl.reg && &(decl.reg->type->getContext()) != &context) {
-    return llvm::createStringError(
-        std::make_error_code(std::errc::invalid_argument),
-        "LLVM type information for %s "
-        "in function declaration at %lx is associated "
-        "with a different LLVM context than the %s's "
-        "register location",
-        desc, tpl.address, desc);
+    return problem(ValueDeclError::kRegContext);
 
   } else if (decl.mem_reg && &(decl.mem_reg->type->getContext()) != &context) {
-    return llvm::createStringError(
-        std::make_error_code(std::errc::invalid_argument),
-        "LLVM type information for %s "
-        "in function declaration at %lx is associated "
-        "with a different LLVM context than the %s's "
-        "memory location base register",
-        desc, tpl.address, desc);
+    return problem(ValueDeclError::kMemRegContext);
 
   } else if (decl.mem_reg && !decl.mem_reg->type->isIntegerTy()) {
-    return llvm::createStringError(
-        std::make_error_code(std::errc::invalid_argument),
-        "Type of memory base register of %s in function "
-        "declaration at %lx must be integral",
-        desc, tpl.address);
+    return problem(ValueDeclError::kMemRegNotIntegral);
   }
 
-  if (decl.reg && decl.type) {
-    auto reg_size = EstimateSize(tpl.arch, decl.reg->type);
-    auto type_size = EstimateSize(tpl.arch, decl.type);
-    if (reg_size < type_size) {
-      return llvm::createStringError(
-          std::make_error_code(std::errc::invalid_argument),
-          "Size of register %s of %s in function "
-          "declaration at %lx is too small (%lu bytes) for "
-          "value of size %lu bytes",
-          decl.reg->name.c_str(), desc, tpl.address, reg_size, type_size);
-    }
+  if (decl.reg && decl.type &&
+      EstimateSize(tpl.arch, decl.reg->type) <
+          EstimateSize(tpl.arch, decl.type)) {
+    return problem(ValueDeclError::kRegTooSmall);
   }
 
   return llvm::Error::success();
@@ -329,12 +596,17 @@ bool Byte::IsExecutableImpl(void) const {
 }
 
 bool Byte::IsUndefinedImpl(void) const {
-  return meta->is_undefined;
+  return ContainsAddress(meta->undefined_bytes, addr);
 }
 
 bool Byte::SetUndefinedImpl(bool is_undef) const {
-  if (meta->is_function_head && !meta->is_variable_head) {
-    meta->is_undefined = is_undef;
+  if (!meta->is_frozen && ContainsAddress(meta->function_heads, addr) &&
+      !ContainsAddress(meta->variable_heads, addr)) {
+    if (is_undef) {
+      InsertAddress(meta->undefined_bytes, addr);
+    } else {
+      EraseAddress(meta->undefined_bytes, addr);
+    }
     return true;
   } else {
     return false;
@@ -366,67 +638,47 @@ std::string_view ByteSequence::Substring(uint64_t ea, size_t seq_size) const {
 
 // Index a specific byte within this sequence. Indexing is based off of the
 // byte's address.
+bool ByteSequence::IsWriteableImpl(void) const {
+  return meta->is_writeable;
+}
+
+bool ByteSequence::IsExecutableImpl(void) const {
+  return meta->is_executable;
+}
+
 Byte ByteSequence::operator[](uint64_t ea) const {
   if (const auto offset = ea - address; address <= ea && offset < size) {
-    return Byte(ea, &(first_data[offset]), &(first_meta[offset]));
+    return Byte(ea, &(first_data[offset]), meta);
   } else {
     return Byte();
   }
 }
 
-// Declare a function in this view.
-llvm::Expected<FunctionDecl *>
-Program::Impl::DeclareFunction(const FunctionDecl &tpl, bool force) {
-
-  const auto [data, meta] = FindByte(tpl.address);
-  if (meta) {
-    (void) data;
-    if (!meta->is_executable) {
-      return llvm::createStringError(
-          std::make_error_code(std::errc::bad_address),
-          "Function at address '%lx' is not executable.", tpl.address);
-    }
-  }
-
-  if (auto existing_decl = FindFunction(tpl.address); existing_decl && !force) {
-    return llvm::createStringError(
-        std::make_error_code(std::errc::address_in_use),
-        "A function is already declared at '%lx'", existing_decl->address);
-  }
+// Returns the error reported when trying to change a frozen program.
+static llvm::Error FrozenError(const char *what, uint64_t address) {
+  return llvm::createStringError(
+      std::make_error_code(std::errc::operation_not_permitted),
+      "Cannot %s at '%lx' in a frozen program", what, address);
+}
 
-  if (!tpl.arch) {
+// Check the parts of the function declaration `tpl` that `DeclareFunction`
+// doesn't derive itself, i.e. everything but its LLVM function type.
+static llvm::Error CheckFunctionDecl(const FunctionDecl &tpl,
+                                     const ValueDecl &return_address,
+                                     const remill::Register *pc_reg) {
+  auto &context = *(tpl.arch->context);
+  if (!return_address.type->isIntegerTy()) {
     return llvm::createStringError(
         std::make_error_code(std::errc::invalid_argument),
-        "Missing architecture for function declared at '%lx'", tpl.address);
-  }
-
-  auto &context = *(tpl.arch->context);
-
-  ValueDecl return_address = tpl.return_address;
-  const auto pc_reg_name = tpl.arch->ProgramCounterRegisterName();
-  if (auto pc_reg = tpl.arch->RegisterByName(pc_reg_name)) {
-    if (!return_address.type) {
-      return_address.type = pc_reg->type;
-    } else if (!return_address.type->isIntegerTy()) {
-      return llvm::createStringError(
-          std::make_error_code(std::errc::invalid_argument),
-          "Type of the return address in function declaration at "
-          "'%lx' must be integral",
-          tpl.address);
-    } else if (return_address.type != pc_reg->type) {
-      return llvm::createStringError(
-          std::make_error_code(std::errc::invalid_argument),
-          "Type of the return address in function declaration at "
-          "'%lx' must match type of the '%s' register",
-          tpl.address, pc_reg_name.data());
-    }
-  } else {
+        "Type of the return address in function declaration at "
+        "'%lx' must be integral",
+        tpl.address);
+  } else if (return_address.type != pc_reg->type) {
     return llvm::createStringError(
-        std::make_error_code(std::errc::operation_canceled),
-        "Cannot find register information for program counter "
-        "register '%s'; has the semantics module for the architecture "
-        "associated with the function declaration at '%lx' been loaded?",
-        pc_reg_name.data(), tpl.address);
+        std::make_error_code(std::errc::invalid_argument),
+        "Type of the return address in function declaration at "
+        "'%lx' must match type of the '%s' register",
+        tpl.address, pc_reg->name.c_str());
   }
 
   auto err = CheckValueDecl(return_address, context, "return address", tpl);
@@ -493,6 +745,63 @@ Program::Impl::DeclareFunction(const FunctionDecl &tpl, bool force) {
     }
   }
 
+  return llvm::Error::success();
+}
+
+// Declare a function in this view.
+llvm::Expected<FunctionDecl *>
+Program::Impl::DeclareFunction(const FunctionDecl &tpl, bool force) {
+  if (is_frozen) {
+    return FrozenError("declare a function", tpl.address);
+  }
+
+  const auto [data, meta] = FindByte(tpl.address);
+  if (meta) {
+    (void) data;
+    if (!meta->is_executable) {
+      return llvm::createStringError(
+          std::make_error_code(std::errc::bad_address),
+          "Function at address '%lx' is not executable.", tpl.address);
+    }
+  }
+
+  if (auto existing_decl = FindFunction(tpl.address); existing_decl && !force) {
+    return llvm::createStringError(
+        std::make_error_code(std::errc::address_in_use),
+        "A function is already declared at '%lx'", existing_decl->address);
+  }
+
+  if (!tpl.arch) {
+    return llvm::createStringError(
+        std::make_error_code(std::errc::invalid_argument),
+        "Missing architecture for function declared at '%lx'", tpl.address);
+  }
+
+  auto &context = *(tpl.arch->context);
+
+  ValueDecl return_address = tpl.return_address;
+  const auto pc_reg_name = tpl.arch->ProgramCounterRegisterName();
+  const auto pc_reg = tpl.arch->RegisterByName(pc_reg_name);
+  if (!pc_reg) {
+    return llvm::createStringError(
+        std::make_error_code(std::errc::operation_canceled),
+        "Cannot find register information for program counter "
+        "register '%s'; has the semantics module for the architecture "
+        "associated with the function declaration at '%lx' been loaded?",
+        pc_reg_name.data(), tpl.address);
+  }
+
+  if (!return_address.type) {
+    return_address.type = pc_reg->type;
+  }
+
+  // Decls from trusted specs were already checked by whatever produced them.
+  if (!trusts_decls) {
+    if (auto err = CheckFunctionDecl(tpl, return_address, pc_reg)) {
+      return std::move(err);
+    }
+  }
+
   // Figure out the return type of this function based off the return
   // values.
   llvm::Type *ret_type = nullptr;
@@ -541,6 +850,20 @@ Program::Impl::DeclareFunction(const FunctionDecl &tpl, bool force) {
   decl_ptr->return_address = return_address;
   decl_ptr->owner = this;
   decl_ptr->type = func_type;
+  decl_ptr->prototype = InternPrototype(*decl_ptr);
+
+  // Decls are never added to after being declared, so give back whatever the
+  // template over-allocated.
+  decl_ptr->params.shrink_to_fit();
+  decl_ptr->returns.shrink_to_fit();
+  decl_ptr->reg_info.shrink_to_fit();
+
+  // Keep typed registers in instruction order, so that they can be found by
+  // binary search.
+  std::stable_sort(decl_ptr->reg_info.begin(), decl_ptr->reg_info.end(),
+                   [](const TypedRegisterDecl &a, const TypedRegisterDecl &b) {
+                     return a.address < b.address;
+                   });
 
   if (funcs_are_sorted && !funcs.empty() &&
       funcs.back()->address > decl->address) {
@@ -551,7 +874,7 @@ Program::Impl::DeclareFunction(const FunctionDecl &tpl, bool force) {
   ea_to_func.emplace(decl_ptr->address, decl_ptr);
 
   if (meta) {
-    meta->is_function_head = true;
+    InsertAddress(meta->function_heads, decl_ptr->address);
     EmitEvent(kFunctionDefined, decl_ptr->address);
   } else {
     EmitEvent(kFunctionDeclared, decl_ptr->address);
@@ -570,12 +893,46 @@ FunctionDecl *Program::Impl::FindFunction(uint64_t address) {
   }
 }
 
+// Follow the chain of redirections starting at `address` to its final
+// destination. A cycle of redirections ends just before it would repeat.
+//
+// Redirections can be to or from any address, including the keys that
+// `llvm::DenseSet` reserves, so the visited addresses are kept in a
+// `std::unordered_set`.
+static bool FollowRedirections(
+    const std::unordered_map<std::uint64_t, std::uint64_t> &redirections,
+    std::uint64_t address, std::uint64_t &destination) {
+  auto it = redirections.find(address);
+  if (it == redirections.end()) {
+    return false;
+  }
+
+  std::unordered_set<std::uint64_t> seen;
+  seen.insert(address);
+  destination = it->second;
+  while (seen.insert(destination).second) {
+    it = redirections.find(destination);
+    if (it == redirections.end()) {
+      break;
+    }
+    destination = it->second;
+  }
+  return true;
+}
+
 bool Program::Impl::TryGetControlFlowRedirection(std::uint64_t &destination,
                                                  std::uint64_t address) const {
   destination = 0U;
 
-  auto it = ctrl_flow_redirections.find(address);
-  if (it == ctrl_flow_redirections.end()) {
+  if (!is_frozen) {
+    return FollowRedirections(ctrl_flow_redirections, address, destination);
+  }
+
+  auto it = std::lower_bound(
+      frozen_redirections.begin(), frozen_redirections.end(), address,
+      [](const std::pair<std::uint64_t, std::uint64_t> &redir,
+         std::uint64_t addr) { return redir.first < addr; });
+  if (it == frozen_redirections.end() || it->first != address) {
     return false;
   }
 
@@ -583,14 +940,31 @@ bool Program::Impl::TryGetControlFlowRedirection(std::uint64_t &destination,
   return true;
 }
 
-void Program::Impl::AddControlFlowRedirection(std::uint64_t from,
+bool Program::Impl::AddControlFlowRedirection(std::uint64_t from,
                                               std::uint64_t to) {
+  if (is_frozen) {
+    return false;
+  }
+
   CHECK_EQ(ctrl_flow_redirections.count(from), 0U);
   ctrl_flow_redirections.insert({from, to});
+  return true;
 }
 
 std::optional<ControlFlowTargetList>
 Program::Impl::TryGetControlFlowTargets(std::uint64_t address) const {
+  if (is_frozen) {
+    auto it = std::lower_bound(
+        frozen_targets.begin(), frozen_targets.end(), address,
+        [](const ControlFlowTargetList &targets, std::uint64_t addr) {
+          return targets.source < addr;
+        });
+    if (it == frozen_targets.end() || it->source != address) {
+      return std::nullopt;
+    }
+    return *it;
+  }
+
   auto it = ctrl_flow_targets.find(address);
   if (it == ctrl_flow_targets.end()) {
     return std::nullopt;
@@ -601,7 +975,7 @@ Program::Impl::TryGetControlFlowTargets(std::uint64_t address) const {
 
 bool Program::Impl::TrySetControlFlowTargets(
     const ControlFlowTargetList &target_list) {
-  if (ctrl_flow_targets.count(target_list.source) != 0U) {
+  if (is_frozen || ctrl_flow_targets.count(target_list.source) != 0U) {
     return false;
   }
 
@@ -609,9 +983,29 @@ bool Program::Impl::TrySetControlFlowTargets(
   return true;
 }
 
+void Program::Impl::ForEachControlFlowTargets(
+    std::function<bool(const ControlFlowTargetList &)> callback) const {
+  if (is_frozen) {
+    for (const auto &targets : frozen_targets) {
+      if (!callback(targets)) {
+        return;
+      }
+    }
+    return;
+  }
+
+  for (const auto &[source, targets] : ctrl_flow_targets) {
+    if (!callback(targets)) {
+      return;
+    }
+  }
+}
+
 // Declare a variable in this view.
 llvm::Error Program::Impl::DeclareVariable(const GlobalVarDecl &tpl) {
-
+  if (is_frozen) {
+    return FrozenError("declare a variable", tpl.address);
+  }
 
   if (auto existing_decl = FindVariable(tpl.address); existing_decl) {
     return llvm::createStringError(
@@ -649,7 +1043,7 @@ llvm::Error Program::Impl::DeclareVariable(const GlobalVarDecl &tpl) {
 
   if (meta) {
     (void) data;
-    meta->is_variable_head = true;
+    InsertAddress(meta->variable_heads, decl_ptr->address);
     EmitEvent(kGlobalVariableDefined, decl_ptr->address);
   } else {
     EmitEvent(kGlobalVariableDeclared, decl_ptr->address);
@@ -668,38 +1062,22 @@ GlobalVarDecl *Program::Impl::FindVariable(uint64_t address) {
   }
 }
 
-GlobalVarDecl *Program::Impl::FindInVariable(uint64_t address,
-                                             const llvm::DataLayout &layout) {
-
-  GlobalVarDecl *closest_match = nullptr;
-  for (auto [var_address, var] : ea_to_var) {
-    if (var_address <= address) {
-      closest_match = var;
-    } else {
-
-      // NOTE(artem): ea_to_var is a sorted map, so we can quit once we find and address out of range
-      break;
-    }
-  }
-
-  // the address is not in the range of variable map
-  if (!closest_match) {
-    return nullptr;
-  }
+namespace {
 
-  // this matched an exact address of a variable; return it
-  if (closest_match->address == address) {
-    return closest_match;
-  }
+// Returns the address one past the end of `var`, as sized by `layout`, or
+// zero if the size of `var` is unknown or if its extent overflows the address
+// space.
+static uint64_t VariableEnd(const GlobalVarDecl &var,
+                            const llvm::DataLayout &layout) {
 
   // if there is no type, we can't really see if `address` is inside the type size
-  if (!closest_match->type) {
-    return nullptr;
+  if (!var.type) {
+    return 0u;
   }
 
   // lets find out how big this type is (including padding)
   const auto type_size =
-      static_cast<uint64_t>(layout.getTypeAllocSize(closest_match->type));
+      static_cast<uint64_t>(layout.getTypeAllocSize(var.type));
 
   // make sure to clamp the address range to what our target actually uses
   auto address_mask = std::numeric_limits<uint64_t>::max();
@@ -709,17 +1087,61 @@ GlobalVarDecl *Program::Impl::FindInVariable(uint64_t address,
     address_mask >>= 32u;
   }
 
-  const auto address_max = address_mask & (closest_match->address + type_size);
+  const auto address_max = address_mask & (var.address + type_size);
 
-  if (address_max < closest_match->address || address_max < type_size) {
+  if (address_max < var.address || address_max < type_size) {
 
     // overflow occurred: address + type size overflows address space limits
     // TODO(artem): there is a chance that the reference could still be valid if
     // ea is between second->address and the max for the address space
-    return nullptr;
+    return 0u;
   }
 
-  if (closest_match->address <= address && address < address_max) {
+  return address_max;
+}
+
+}  // namespace
+
+GlobalVarDecl *Program::Impl::FindInVariable(uint64_t address,
+                                             const llvm::DataLayout &layout) {
+
+  // The extents of variables were computed at freeze time, so only a search
+  // for the closest variable at or below `address` is needed.
+  if (has_frozen_var_extents &&
+      layout.getStringRepresentation() == frozen_var_layout) {
+    auto it = std::upper_bound(
+        frozen_var_extents.begin(), frozen_var_extents.end(), address,
+        [](uint64_t addr, const VariableExtent &extent) {
+          return addr < extent.address;
+        });
+    if (it == frozen_var_extents.begin()) {
+      return nullptr;
+    }
+    --it;
+    if (it->address == address || address < it->end) {
+      return it->decl;
+    }
+    return nullptr;
+  }
+
+  // `ea_to_var` is a sorted map, so the closest match is the variable right
+  // before the first variable whose address is above `address`.
+  const auto it = ea_to_var.upper_bound(address);
+
+  // the address is not in the range of variable map
+  if (it == ea_to_var.begin()) {
+    return nullptr;
+  }
+
+  GlobalVarDecl *const closest_match = std::prev(it)->second;
+
+  // this matched an exact address of a variable; return it
+  if (closest_match->address == address) {
+    return closest_match;
+  }
+
+  const auto address_max = VariableEnd(*closest_match, layout);
+  if (closest_match->address <= address && address < address_max) {
 
     // The address referenced into the middle of the type
     return closest_match;
@@ -730,73 +1152,230 @@ GlobalVarDecl *Program::Impl::FindInVariable(uint64_t address,
   }
 }
 
-// Access memory, looking for a specific byte. Returns
-// a reference to the found byte, or to an invalid byte.
-std::pair<Byte::Data *, Byte::Meta *>
-Program::Impl::FindByte(uint64_t address) {
-  uint64_t limit_address = 0;
-  std::vector<Byte::Data> *mapped_data = nullptr;
-  std::vector<Byte::Meta> *mapped_meta = nullptr;
-
-  auto it = bytes.upper_bound(address);
-  if (it == bytes.end()) {
-    const auto rit = bytes.rbegin();
-    if (rit == bytes.rend()) {
-      return {nullptr, nullptr};
-
-    } else if (rit->first == address) {
-      limit_address = rit->first;
-      mapped_data = &(rit->second.first);
-      mapped_meta = &(rit->second.second);
-    } else {
-      return {nullptr, nullptr};
-    }
+Program::Impl::Impl(void) : ranges_version(gNextRangesVersion++) {}
+
+// Returns the interned prototype of `decl`. Parameter names aren't part of
+// the prototype, so functions that differ only by them share one.
+const FunctionPrototype *
+Program::Impl::InternPrototype(const FunctionDecl &decl) {
+  FunctionPrototype proto;
+  proto.arch = decl.arch;
+  proto.type = decl.type;
+  proto.calling_convention = decl.calling_convention;
+  proto.is_noreturn = decl.is_noreturn;
+  proto.is_variadic = decl.is_variadic;
+  proto.return_address = decl.return_address;
+  proto.return_stack_pointer = decl.return_stack_pointer;
+  proto.return_stack_pointer_offset = decl.return_stack_pointer_offset;
+  proto.params.assign(decl.params.begin(), decl.params.end());
+  proto.returns = decl.returns;
+
+  auto it = prototype_set.find(&proto);
+  if (it != prototype_set.end()) {
+    return *it;
+  }
 
-  } else {
-    limit_address = it->first;
-    mapped_data = &(it->second.first);
-    mapped_meta = &(it->second.second);
+  const auto &interned = prototypes.emplace_back(std::move(proto));
+  prototype_set.insert(&interned);
+  return &interned;
+}
+
+// Sort the functions by their addresses, if they aren't already sorted.
+void Program::Impl::SortFunctions(void) {
+  if (!funcs_are_sorted) {
+    std::sort(funcs.begin(), funcs.end(),
+              [](const std::unique_ptr<FunctionDecl> &a,
+                 const std::unique_ptr<FunctionDecl> &b) {
+                return a->address < b->address;
+              });
+    funcs_are_sorted = true;
+  }
+}
+
+// Sort the variables by their addresses, if they aren't already sorted.
+void Program::Impl::SortVariables(void) {
+  if (!vars_are_sorted) {
+    std::sort(vars.begin(), vars.end(),
+              [](const std::unique_ptr<GlobalVarDecl> &a,
+                 const std::unique_ptr<GlobalVarDecl> &b) {
+                return a->address < b->address;
+              });
+    vars_are_sorted = true;
   }
+}
 
-  const auto base_address = limit_address - mapped_data->size();
-  if (base_address <= address && address < limit_address) {
-    const auto offset = address - base_address;
-    return {&((*mapped_data)[offset]), &((*mapped_meta)[offset])};
+// Sort the name indexes, if they aren't already sorted.
+void Program::Impl::SortNames(void) {
+  if (!names_are_sorted) {
+    std::stable_sort(ea_to_name.begin(), ea_to_name.end(),
+                     [](const std::pair<uint64_t, uint32_t> &a,
+                        const std::pair<uint64_t, uint32_t> &b) {
+                       return a.first < b.first;
+                     });
+    std::stable_sort(name_to_ea.begin(), name_to_ea.end(),
+                     [](const std::pair<uint32_t, uint64_t> &a,
+                        const std::pair<uint32_t, uint64_t> &b) {
+                       return a.first < b.first;
+                     });
+    names_are_sorted = true;
+  }
+}
+
+// Intern `name`, and add it to the names of `address`.
+void Program::Impl::AddName(const std::string &name, uint64_t address) {
+  auto name_id = static_cast<uint32_t>(names.size());
+  if (auto it = name_ids.find(name); it != name_ids.end()) {
+    name_id = it->second;
   } else {
-    return {nullptr, nullptr};
+    name_ids.emplace(names.emplace_back(name), name_id);
   }
+
+  if (names_are_sorted &&
+      ((!ea_to_name.empty() && ea_to_name.back().first > address) ||
+       (!name_to_ea.empty() && name_to_ea.back().first > name_id))) {
+    names_are_sorted = false;
+  }
+
+  ea_to_name.emplace_back(address, name_id);
+  name_to_ea.emplace_back(name_id, address);
 }
 
-std::tuple<Byte::Data *, Byte::Meta *, size_t, uint64_t>
-Program::Impl::FindBytesContaining(uint64_t address) {
-  uint64_t limit_address = 0;
-  std::vector<Byte::Data> *mapped_data = nullptr;
-  std::vector<Byte::Meta> *mapped_meta = nullptr;
-
-  auto it = bytes.upper_bound(address);
-  if (it == bytes.end()) {
-    const auto rit = bytes.rbegin();
-    if (rit == bytes.rend()) {
-      return {nullptr, nullptr, 0, 0};
-
-    } else if (rit->first == address) {
-      limit_address = rit->first;
-      mapped_data = &(rit->second.first);
-      mapped_meta = &(rit->second.second);
-    } else {
-      return {nullptr, nullptr, 0, 0};
+std::pair<std::vector<std::pair<uint64_t, uint32_t>>::const_iterator,
+          std::vector<std::pair<uint64_t, uint32_t>>::const_iterator>
+Program::Impl::NamesOfAddress(uint64_t address) {
+  SortNames();
+  const auto begin = std::lower_bound(
+      ea_to_name.cbegin(), ea_to_name.cend(), address,
+      [](const std::pair<uint64_t, uint32_t> &entry, uint64_t addr) {
+        return entry.first < addr;
+      });
+  auto end = begin;
+  while (end != ea_to_name.cend() && end->first == address) {
+    ++end;
+  }
+  return {begin, end};
+}
+
+std::pair<std::vector<std::pair<uint32_t, uint64_t>>::const_iterator,
+          std::vector<std::pair<uint32_t, uint64_t>>::const_iterator>
+Program::Impl::AddressesOfName(const std::string &name) {
+  const auto it = name_ids.find(name);
+  if (it == name_ids.end()) {
+    return {name_to_ea.cend(), name_to_ea.cend()};
+  }
+
+  SortNames();
+  const auto name_id = it->second;
+  const auto begin = std::lower_bound(
+      name_to_ea.cbegin(), name_to_ea.cend(), name_id,
+      [](const std::pair<uint32_t, uint64_t> &entry, uint32_t id) {
+        return entry.first < id;
+      });
+  auto end = begin;
+  while (end != name_to_ea.cend() && end->first == name_id) {
+    ++end;
+  }
+  return {begin, end};
+}
+
+// Finalize all indexes, so that nothing changes on the read paths anymore.
+void Program::Impl::Freeze(const llvm::DataLayout *layout) {
+  if (is_frozen) {
+    return;
+  }
+
+  SortFunctions();
+  SortVariables();
+  SortNames();
+
+  if (layout) {
+    frozen_var_extents.reserve(ea_to_var.size());
+    for (auto [address, var] : ea_to_var) {
+      frozen_var_extents.push_back({address, VariableEnd(*var, *layout), var});
+    }
+    frozen_var_layout = layout->getStringRepresentation();
+    has_frozen_var_extents = true;
+  }
+
+  frozen_redirections.reserve(ctrl_flow_redirections.size());
+  for (const auto &[from, to] : ctrl_flow_redirections) {
+    std::uint64_t dest = to;
+    FollowRedirections(ctrl_flow_redirections, from, dest);
+    frozen_redirections.emplace_back(from, dest);
+  }
+  std::sort(frozen_redirections.begin(), frozen_redirections.end());
+  ctrl_flow_redirections.clear();
+
+  frozen_targets.reserve(ctrl_flow_targets.size());
+  for (auto &[source, targets] : ctrl_flow_targets) {
+    frozen_targets.emplace_back(std::move(targets));
+  }
+  std::sort(frozen_targets.begin(), frozen_targets.end(),
+            [](const ControlFlowTargetList &a, const ControlFlowTargetList &b) {
+              return a.source < b.source;
+            });
+  ctrl_flow_targets.clear();
+  for (auto &range : ranges) {
+    range.meta->is_frozen = true;
+  }
+  is_frozen = true;
+}
+
+// Find the mapped range containing `address`. Returns `nullptr` if no range
+// contains `address`.
+MappedRange *Program::Impl::FindRange(uint64_t address) {
+  auto &last_hit = gLastRangeHit;
+  if (last_hit.ranges_version == ranges_version) {
+    auto &range = ranges[last_hit.index];
+    if (range.base_address <= address && address < range.limit_address) {
+      return &range;
     }
 
+    // Scans walk from one range into the next, so try that before searching.
+    if (const auto next_index = last_hit.index + 1u;
+        next_index < ranges.size() && range.limit_address <= address &&
+        address < ranges[next_index].limit_address) {
+      if (address < ranges[next_index].base_address) {
+        return nullptr;
+      }
+      last_hit.index = next_index;
+      return &(ranges[next_index]);
+    }
+  }
+
+  // Find the first range whose limit is greater than `address`.
+  auto it = std::upper_bound(
+      ranges.begin(), ranges.end(), address,
+      [](uint64_t addr, const MappedRange &range) {
+        return addr < range.limit_address;
+      });
+
+  if (it == ranges.end() || address < it->base_address) {
+    return nullptr;
+  }
+
+  last_hit.ranges_version = ranges_version;
+  last_hit.index = static_cast<size_t>(it - ranges.begin());
+  return &*it;
+}
+
+// Access memory, looking for a specific byte. Returns
+// a reference to the found byte, or to an invalid byte.
+std::pair<Byte::Data *, Byte::Meta *>
+Program::Impl::FindByte(uint64_t address) {
+  if (auto range = FindRange(address)) {
+    const auto offset = address - range->base_address;
+    return {&(range->data[offset]), range->meta.get()};
   } else {
-    limit_address = it->first;
-    mapped_data = &(it->second.first);
-    mapped_meta = &(it->second.second);
+    return {nullptr, nullptr};
   }
+}
 
-  const auto base_address = limit_address - mapped_data->size();
-  if (base_address <= address && address < limit_address) {
-    return {&((*mapped_data)[0]), &((*mapped_meta)[0]), mapped_data->size(),
-            base_address};
+std::tuple<Byte::Data *, Byte::Meta *, size_t, uint64_t>
+Program::Impl::FindBytesContaining(uint64_t address) {
+  if (auto range = FindRange(address)) {
+    return {range->data, range->meta.get(), range->Size(),
+            range->base_address};
   } else {
     return {nullptr, nullptr, 0, 0};
   }
@@ -805,164 +1384,266 @@ Program::Impl::FindBytesContaining(uint64_t address) {
 // Find a sequence of bytes within the same mapped range starting at
 // `address` and including as many bytes fall within the range up to
 // but not including `address+size`.
-// TODO(artem): This code shares much in common with FindBytesContaining.
-// And it can be reimplemented in terms of FindBytesContaining
 std::tuple<Byte::Data *, Byte::Meta *, size_t>
 Program::Impl::FindBytes(uint64_t address, size_t size) {
   if (!size) {
     return {nullptr, nullptr, 0};
   }
 
-  uint64_t limit_address = 0;
-  std::vector<Byte::Data> *mapped_data = nullptr;
-  std::vector<Byte::Meta> *mapped_meta = nullptr;
-
-  auto it = bytes.upper_bound(address);
-  if (it == bytes.end()) {
-    const auto rit = bytes.rbegin();
-    if (rit == bytes.rend()) {
-      return {nullptr, nullptr, 0};
-
-    } else if (rit->first == address) {
-      limit_address = rit->first;
-      mapped_data = &(rit->second.first);
-      mapped_meta = &(rit->second.second);
-    } else {
-      return {nullptr, nullptr, 0};
+  if (auto range = FindRange(address)) {
+    const auto offset = address - range->base_address;
+    if (size > (range->Size() - offset)) {
+      size = range->Size() - offset;
     }
-
-  } else {
-    limit_address = it->first;
-    mapped_data = &(it->second.first);
-    mapped_meta = &(it->second.second);
-  }
-
-  const auto base_address = limit_address - mapped_data->size();
-  if (base_address <= address && address < limit_address) {
-    const auto offset = address - base_address;
-    if (size > mapped_data->size()) {
-      size = mapped_data->size();
-    }
-    return {&((*mapped_data)[offset]), &((*mapped_meta)[offset]), size};
-
+    return {&(range->data[offset]), range->meta.get(), size};
   } else {
     return {nullptr, nullptr, 0};
   }
 }
 
-// Make a byte into the memory of the program.
-llvm::Error Program::Impl::MapRange(const ByteRange &range) {
+// Check that the range `[address, address + size)` can be mapped into the
+// program, and if so, then allocate and return a new range for it. The new
+// range has its metadata initialized, but it is up to the caller to provide
+// its data.
+llvm::Expected<MappedRange *>
+Program::Impl::AllocateRange(uint64_t address, uint64_t size,
+                             bool is_writeable, bool is_executable) {
+  if (is_frozen) {
+    return FrozenError("map memory", address);
+  }
 
-  if (range.begin >= range.end) {
+  if (!size) {
     return llvm::createStringError(
         std::make_error_code(std::errc::invalid_argument),
         "Empty or negative-sized byte range for mapped range "
         "starting at '%lx'",
-        range.address);
+        address);
   }
 
-  const auto size = static_cast<uint64_t>(range.end - range.begin);
-
   // Look for overflow.
   //
   // TODO(pag): I think this is right.
   const auto max_addr = std::numeric_limits<uint64_t>::max();
-  const auto end_address = range.address + size;
-  if (((max_addr - (size - 1u)) < range.address) ||
-      end_address <= range.address || !end_address) {
+  const auto end_address = address + size;
+  if (((max_addr - (size - 1u)) < address) ||
+      end_address <= address || !end_address) {
     return llvm::createStringError(
         std::make_error_code(std::errc::bad_address),
         "Maximum address for mapped range starting at "
         "'%lx' is not representable",
-        range.address);
+        address);
   }
 
-  // Make sure this range doesn't overlap with another one.
-  for (const auto &existing : bytes) {
-    auto existing_max_address = existing.first;
-    auto existing_min_address =
-        existing_max_address - existing.second.first.size();
-
-    if (existing_min_address >= end_address) {
-      break;
-
-    } else if (existing_max_address <= range.address) {
-      continue;
-
-    } else {
-      return llvm::createStringError(
-          std::make_error_code(std::errc::invalid_argument),
-          "Memory range [%lx, %lx) overlaps with an "
-          "existing range [%lx, %lx)'",
-          range.address, end_address, existing_min_address,
-          existing_max_address);
-    }
+  // Make sure this range doesn't overlap with another one. The existing
+  // ranges are sorted and non-overlapping, so the only candidate is the first
+  // range that ends after our base address. That is also where the new range
+  // will be inserted.
+  auto insert_it = std::upper_bound(
+      ranges.begin(), ranges.end(), address,
+      [](uint64_t addr, const MappedRange &existing) {
+        return addr < existing.limit_address;
+      });
+
+  if (insert_it != ranges.end() && insert_it->base_address < end_address) {
+    return llvm::createStringError(
+        std::make_error_code(std::errc::invalid_argument),
+        "Memory range [%lx, %lx) overlaps with an "
+        "existing range [%lx, %lx)'",
+        address, end_address, insert_it->base_address,
+        insert_it->limit_address);
   }
 
-  bool contains_funcs = false;
-
   // Go see if this range is agreeable with any of our function
   // declarations.
-  for (const auto &decl : funcs) {
-    if (range.address <= decl->address && decl->address < end_address) {
-      if (!range.is_executable) {
-        return llvm::createStringError(
-            std::make_error_code(std::errc::invalid_argument),
-            "Memory range [%lx, %lx) is not marked as executable, "
-            "and contains a declared function at %lx",
-            range.address, end_address, decl->address);
-      } else {
-        contains_funcs = true;
-      }
-    }
+  const auto funcs_begin = ea_to_func.lower_bound(address);
+  const auto funcs_end = ea_to_func.lower_bound(end_address);
+  if (funcs_begin != funcs_end && !is_executable) {
+    return llvm::createStringError(
+        std::make_error_code(std::errc::invalid_argument),
+        "Memory range [%lx, %lx) is not marked as executable, "
+        "and contains a declared function at %lx",
+        address, end_address, funcs_begin->first);
   }
 
-  // Make sure the range isn't mapped twice.
-  auto &byte_impls = bytes[end_address];
-  byte_impls.first.reserve(size);
+  auto &mapped_range = *ranges.emplace(insert_it);
+  ranges_version = gNextRangesVersion++;
 
-  Byte::Meta meta_impl = {};
-  meta_impl.is_writeable = range.is_writeable;
-  meta_impl.is_executable = range.is_executable;
-  meta_impl.next_byte_is_in_range = true;
+  mapped_range.base_address = address;
+  mapped_range.limit_address = end_address;
 
-  byte_impls.first.insert(byte_impls.first.end(), range.begin, range.end);
-  byte_impls.second.insert(byte_impls.second.end(), size, meta_impl);
-  byte_impls.second.back().next_byte_is_in_range = false;
+  mapped_range.meta.reset(new Byte::Meta);
+  auto &meta = *mapped_range.meta;
+  meta.base_address = address;
+  meta.limit_address = end_address;
+  meta.is_writeable = is_writeable;
+  meta.is_executable = is_executable;
 
-  if (contains_funcs) {
-    for (const auto &decl : funcs) {
-      if (range.address <= decl->address && decl->address < end_address) {
-        if (auto [data, meta] = FindByte(decl->address); meta) {
-          (void) data;
-          meta->is_function_head = true;
-          EmitEvent(kFunctionDefined, decl->address);
-        }
-      }
-    }
+  // The declaration maps are sorted, and so the head lists will be too.
+  for (auto it = funcs_begin; it != funcs_end; ++it) {
+    meta.function_heads.push_back(it->first);
+    EmitEvent(kFunctionDefined, it->first);
   }
 
   // Go see if this range is agreeable with any of our global
   // variable declarations.
-  for (const auto &decl : vars) {
-    if (range.address <= decl->address && decl->address < end_address) {
-      if (auto [data, meta] = FindByte(decl->address); meta) {
-        (void) data;
-        meta->is_variable_head = true;
-        EmitEvent(kGlobalVariableDefined, decl->address);
-      }
+  const auto vars_end = ea_to_var.lower_bound(end_address);
+  for (auto it = ea_to_var.lower_bound(address); it != vars_end; ++it) {
+    meta.variable_heads.push_back(it->first);
+    EmitEvent(kGlobalVariableDefined, it->first);
+  }
+
+  // Mark the previous range, if it exists, as being followed by this range.
+  if (address) {
+    if (auto prev_range = FindRange(address - 1)) {
+      prev_range->meta->next_range_is_adjacent = true;
     }
   }
 
-  // Mark the last byte in the previous range, if it exists, as having a
-  // subsequent byte.
-  if (auto [prev_data, prev_meta] = FindByte(range.address - 1);
-      prev_meta && range.address) {
-    (void) prev_data;
-    prev_meta->next_byte_is_in_range = false;
-    prev_meta->next_byte_starts_new_range = true;
+  // Likewise, if the next range immediately follows this one.
+  if (FindRange(end_address)) {
+    meta.next_range_is_adjacent = true;
+  }
+
+  return &mapped_range;
+}
+
+// Make a byte into the memory of the program.
+llvm::Error Program::Impl::MapRange(const ByteRange &range) {
+
+  if (range.begin >= range.end) {
+    return llvm::createStringError(
+        std::make_error_code(std::errc::invalid_argument),
+        "Empty or negative-sized byte range for mapped range "
+        "starting at '%lx'",
+        range.address);
+  }
+
+  const auto size = static_cast<uint64_t>(range.end - range.begin);
+  auto maybe_range = AllocateRange(range.address, size, range.is_writeable,
+                                   range.is_executable);
+  if (!maybe_range) {
+    return maybe_range.takeError();
+  }
+
+  auto mapped_range = *maybe_range;
+  mapped_range->owned_data.assign(range.begin, range.end);
+  mapped_range->data = mapped_range->owned_data.data();
+  return llvm::Error::success();
+}
+
+// Move some bytes into the memory of the program.
+llvm::Error Program::Impl::MapRange(uint64_t address,
+                                    std::vector<uint8_t> data,
+                                    bool is_writeable, bool is_executable) {
+  auto maybe_range =
+      AllocateRange(address, data.size(), is_writeable, is_executable);
+  if (!maybe_range) {
+    return maybe_range.takeError();
+  }
+
+  auto mapped_range = *maybe_range;
+  mapped_range->owned_data = std::move(data);
+  mapped_range->data = mapped_range->owned_data.data();
+  return llvm::Error::success();
+}
+
+// Map some bytes that are owned by `owner` into the memory of the program.
+llvm::Error Program::Impl::MapBorrowedRange(uint64_t address,
+                                            const uint8_t *data,
+                                            uint64_t size,
+                                            std::shared_ptr<const void> owner,
+                                            bool is_writeable,
+                                            bool is_executable) {
+  if (!data || !size) {
+    return llvm::createStringError(
+        std::make_error_code(std::errc::invalid_argument),
+        "Empty byte range for mapped range starting at '%lx'", address);
+  }
+
+  auto maybe_range =
+      AllocateRange(address, size, is_writeable, is_executable);
+  if (!maybe_range) {
+    return maybe_range.takeError();
+  }
+
+  auto mapped_range = *maybe_range;
+  mapped_range->data = const_cast<Byte::Data *>(data);
+  mapped_range->borrowed_owner = std::move(owner);
+  return llvm::Error::success();
+}
+
+// Memory-map a slice of a file into the memory of the program.
+llvm::Error Program::Impl::MapFile(const std::string &path,
+                                   uint64_t file_offset, uint64_t address,
+                                   uint64_t size, bool is_writeable,
+                                   bool is_executable) {
+  uint64_t file_size = 0;
+  if (auto ec = llvm::sys::fs::file_size(path, file_size); ec) {
+    return llvm::createStringError(
+        ec, "Unable to get the size of file '%s' for mapped range "
+        "starting at '%lx': %s",
+        path.c_str(), address, ec.message().c_str());
+  }
+
+  if (file_offset > file_size || size > (file_size - file_offset)) {
+    return llvm::createStringError(
+        std::make_error_code(std::errc::invalid_argument),
+        "File slice [%lx, %lx) for mapped range starting at '%lx' is "
+        "outside of file '%s' of size %lu",
+        file_offset, file_offset + size, address, path.c_str(), file_size);
+  }
+
+  // `getFileSlice` will `mmap` the file where it is profitable to do so, and
+  // otherwise falls back on reading.
+  auto maybe_buff = llvm::MemoryBuffer::getFileSlice(path, size, file_offset);
+  if (!maybe_buff) {
+    const auto ec = maybe_buff.getError();
+    return llvm::createStringError(
+        ec, "Unable to map file '%s' for mapped range starting at '%lx': %s",
+        path.c_str(), address, ec.message().c_str());
+  }
+
+  auto maybe_range =
+      AllocateRange(address, size, is_writeable, is_executable);
+  if (!maybe_range) {
+    return maybe_range.takeError();
+  }
+
+  auto mapped_range = *maybe_range;
+  mapped_range->mapped_file = std::move(maybe_buff.get());
+  mapped_range->data = reinterpret_cast<Byte::Data *>(
+      const_cast<char *>(mapped_range->mapped_file->getBufferStart()));
+  return llvm::Error::success();
+}
+
+// Map a range of zero-valued bytes into the memory of the program.
+llvm::Error Program::Impl::MapZeroRange(uint64_t address, uint64_t size,
+                                        bool is_writeable,
+                                        bool is_executable) {
+
+  // Fresh anonymous mappings read as zero, and reading them only ever maps in
+  // the operating system's shared zero page, so a huge zero range costs address
+  // space, but not memory.
+  std::error_code ec;
+  auto block = llvm::sys::Memory::allocateMappedMemory(
+      static_cast<size_t>(size), nullptr, llvm::sys::Memory::MF_READ, ec);
+  if (ec) {
+    return llvm::createStringError(
+        ec, "Unable to map %lu zero bytes for mapped range starting at "
+        "'%lx': %s",
+        size, address, ec.message().c_str());
+  }
+
+  llvm::sys::OwningMemoryBlock zero_pages(block);
+  auto maybe_range =
+      AllocateRange(address, size, is_writeable, is_executable);
+  if (!maybe_range) {
+    return maybe_range.takeError();
   }
 
+  auto mapped_range = *maybe_range;
+  mapped_range->data = reinterpret_cast<Byte::Data *>(zero_pages.base());
+  mapped_range->zero_pages = std::move(zero_pages);
   return llvm::Error::success();
 }
 
@@ -970,6 +1651,107 @@ Program::Program(void) : impl(std::make_shared<Impl>()) {}
 
 Program::~Program(void) {}
 
+// Freeze this program, after which it can't be changed, and lookups into it
+// are safe to perform concurrently.
+void Program::Freeze(void) {
+  ANVILL_TRACE_ZONE("Program::Freeze");
+  impl->Freeze(nullptr);
+}
+
+// Freeze this program, and index the extents of its variables.
+void Program::Freeze(const llvm::DataLayout &layout) {
+  ANVILL_TRACE_ZONE("Program::Freeze");
+  impl->Freeze(&layout);
+}
+
+// Returns `true` if this program has been frozen.
+bool Program::IsFrozen(void) const {
+  return impl->is_frozen;
+}
+
+// Should function declarations be trusted to be well-formed?
+void Program::TrustDecls(bool trusted) {
+  impl->trusts_decls = trusted;
+}
+
+namespace {
+
+// Approximate overhead of a node in a node-based container, e.g. the tree
+// node of a `std::map`, or the chain link of a `std::unordered_map`.
+static constexpr uint64_t kNodeOverhead = 4u * sizeof(void *);
+
+template <typename T>
+static uint64_t VectorBytes(const std::vector<T> &vec) {
+  return static_cast<uint64_t>(vec.capacity() * sizeof(T));
+}
+
+template <typename M>
+static uint64_t MapBytes(const M &map) {
+  return static_cast<uint64_t>(map.size()) *
+         (sizeof(typename M::value_type) + kNodeOverhead);
+}
+
+template <typename M>
+static uint64_t HashMapBytes(const M &map) {
+  return MapBytes(map) +
+         static_cast<uint64_t>(map.bucket_count() * sizeof(void *));
+}
+
+}  // namespace
+
+// Returns the approximate memory usage of this program.
+Program::MemoryUsage Program::GetMemoryUsage(void) const {
+  MemoryUsage usage;
+
+  usage.metadata_bytes = VectorBytes(impl->ranges);
+  for (const auto &range : impl->ranges) {
+    if (!range.owned_data.empty()) {
+      usage.owned_data_bytes += range.owned_data.capacity();
+    } else if (range.mapped_file || range.borrowed_owner) {
+      usage.mapped_data_bytes += range.Size();
+    } else if (range.zero_pages.allocatedSize()) {
+      usage.zero_fill_bytes += range.Size();
+    }
+
+    const auto &meta = *range.meta;
+    usage.metadata_bytes += sizeof(meta) + VectorBytes(meta.function_heads) +
+                            VectorBytes(meta.variable_heads) +
+                            VectorBytes(meta.undefined_bytes);
+  }
+
+  usage.decl_bytes = VectorBytes(impl->funcs) + VectorBytes(impl->vars) +
+                     impl->vars.size() * sizeof(GlobalVarDecl) +
+                     HashMapBytes(impl->prototype_set);
+  for (const auto &proto : impl->prototypes) {
+    usage.decl_bytes += sizeof(proto) + VectorBytes(proto.params) +
+                        VectorBytes(proto.returns);
+  }
+  for (const auto &func : impl->funcs) {
+    usage.decl_bytes += sizeof(FunctionDecl) + VectorBytes(func->params) +
+                        VectorBytes(func->returns) +
+                        VectorBytes(func->reg_info);
+  }
+
+  usage.name_bytes = VectorBytes(impl->ea_to_name) +
+                     VectorBytes(impl->name_to_ea) +
+                     HashMapBytes(impl->name_ids);
+  for (const auto &name : impl->names) {
+    usage.name_bytes += sizeof(name) + name.capacity();
+  }
+
+  usage.index_bytes =
+      MapBytes(impl->ea_to_func) + MapBytes(impl->ea_to_var) +
+      HashMapBytes(impl->ctrl_flow_redirections) +
+      HashMapBytes(impl->ctrl_flow_targets) +
+      VectorBytes(impl->frozen_redirections) +
+      VectorBytes(impl->frozen_targets) + VectorBytes(impl->frozen_var_extents);
+  for (const auto &targets : impl->frozen_targets) {
+    usage.index_bytes += VectorBytes(targets.destination_list);
+  }
+
+  return usage;
+}
+
 // Declare a function in this view. This takes in a function
 // declaration that will act as a sort of "template" for the
 // declaration that we will make and will be owned by `Program`.
@@ -981,14 +1763,7 @@ Program::DeclareFunction(const FunctionDecl &decl, bool force) const {
 // Internal iterator over all functions.
 void Program::ForEachFunction(
     std::function<bool(const FunctionDecl *)> callback) const {
-  if (!impl->funcs_are_sorted) {
-    std::sort(impl->vars.begin(), impl->vars.end(),
-              [](const std::unique_ptr<GlobalVarDecl> &a,
-                 const std::unique_ptr<GlobalVarDecl> &b) {
-                return a->address < b->address;
-              });
-    impl->funcs_are_sorted = true;
-  }
+  impl->SortFunctions();
   for (size_t i = 0; i < impl->funcs.size(); ++i) {
     if (const auto decl = impl->funcs[i].get()) {
       if (!callback(decl)) {
@@ -1000,6 +1775,8 @@ void Program::ForEachFunction(
 
 // Search for a specific function by its address.
 const FunctionDecl *Program::FindFunction(uint64_t address) const {
+  ANVILL_TRACE_ZONE("Program::FindFunction");
+  ANVILL_TRACE_ZONE_TAG(address, 0u);
   return impl->FindFunction(address);
 }
 
@@ -1009,8 +1786,7 @@ void Program::ForEachFunctionWithName(
     const std::string &name,
     std::function<bool(const FunctionDecl *)> callback) const {
   const auto func_it_end = impl->ea_to_func.end();
-  for (auto it = impl->name_to_ea.find(name), it_end = impl->name_to_ea.end();
-       it != it_end && it->first == name; ++it) {
+  for (auto [it, it_end] = impl->AddressesOfName(name); it != it_end; ++it) {
     if (auto func_it = impl->ea_to_func.find(it->second);
         func_it != func_it_end) {
       if (!callback(func_it->second)) {
@@ -1022,15 +1798,37 @@ void Program::ForEachFunctionWithName(
 
 bool Program::TryGetControlFlowRedirection(std::uint64_t &destination,
                                            std::uint64_t address) const {
+  ANVILL_TRACE_ZONE("Program::TryGetControlFlowRedirection");
+  ANVILL_TRACE_ZONE_TAG(address, 0u);
   return impl->TryGetControlFlowRedirection(destination, address);
 }
 
-void Program::AddControlFlowRedirection(std::uint64_t from, std::uint64_t to) {
+bool Program::AddControlFlowRedirection(std::uint64_t from, std::uint64_t to) {
   return impl->AddControlFlowRedirection(from, to);
 }
 
+void Program::ForEachControlFlowRedirection(
+    std::function<bool(std::uint64_t, std::uint64_t)> callback) const {
+  if (impl->is_frozen) {
+    for (auto [from, to] : impl->frozen_redirections) {
+      if (!callback(from, to)) {
+        return;
+      }
+    }
+    return;
+  }
+
+  for (auto [from, to] : impl->ctrl_flow_redirections) {
+    if (!callback(from, to)) {
+      return;
+    }
+  }
+}
+
 std::optional<ControlFlowTargetList>
 Program::TryGetControlFlowTargets(std::uint64_t address) const {
+  ANVILL_TRACE_ZONE("Program::TryGetControlFlowTargets");
+  ANVILL_TRACE_ZONE_TAG(address, 0u);
   return impl->TryGetControlFlowTargets(address);
 }
 
@@ -1039,6 +1837,11 @@ bool Program::TrySetControlFlowTargets(
   return impl->TrySetControlFlowTargets(target_list);
 }
 
+void Program::ForEachControlFlowTargets(
+    std::function<bool(const ControlFlowTargetList &)> callback) const {
+  impl->ForEachControlFlowTargets(std::move(callback));
+}
+
 // Apply a function `cb` to each name of the address `address`.
 void Program::ForEachNameOfAddress(
     uint64_t ea, std::function<bool(const std::string &, const FunctionDecl *,
@@ -1048,9 +1851,8 @@ void Program::ForEachNameOfAddress(
   const auto func = FindFunction(ea);
   const auto var = FindVariable(ea);
 
-  for (auto it = impl->ea_to_name.find(ea), it_end = impl->ea_to_name.end();
-       it != it_end && it->first == ea; ++it) {
-    if (!callback(it->second, func, var)) {
+  for (auto [it, it_end] = impl->NamesOfAddress(ea); it != it_end; ++it) {
+    if (!callback(impl->names[it->second], func, var)) {
       return;
     }
   }
@@ -1062,8 +1864,7 @@ void Program::ForEachAddressOfName(
     std::function<bool(uint64_t, const FunctionDecl *, const GlobalVarDecl *)>
         callback) const {
 
-  for (auto it = impl->name_to_ea.find(name), it_end = impl->name_to_ea.end();
-       it != it_end && it->first == name; ++it) {
+  for (auto [it, it_end] = impl->AddressesOfName(name); it != it_end; ++it) {
     const auto ea = it->second;
     const auto func = FindFunction(ea);
     const auto var = FindVariable(ea);
@@ -1078,24 +1879,25 @@ void Program::ForEachNamedAddress(
     std::function<bool(uint64_t, const std::string &, const FunctionDecl *,
                        const GlobalVarDecl *)>
         callback) const {
-  for (auto it = impl->ea_to_name.begin(), it_end = impl->ea_to_name.end();
-       it != it_end; ++it) {
-    const auto ea = it->first;
+  impl->SortNames();
+  for (auto [ea, name_id] : impl->ea_to_name) {
     const auto func = FindFunction(ea);
     const auto var = FindVariable(ea);
-    if (!callback(ea, it->second, func, var)) {
+    if (!callback(ea, impl->names[name_id], func, var)) {
       return;
     }
   }
 }
 
 // Add a name to an address.
-void Program::AddNameToAddress(const std::string &name,
+bool Program::AddNameToAddress(const std::string &name,
                                uint64_t address) const {
-  if (!name.empty() && address) {
-    impl->name_to_ea.emplace(name, address);
-    impl->ea_to_name.emplace(address, name);
+  if (impl->is_frozen || name.empty() || !address) {
+    return false;
   }
+
+  impl->AddName(name, address);
+  return true;
 }
 
 // Declare a variable in this view. This takes in a variable
@@ -1108,14 +1910,7 @@ llvm::Error Program::DeclareVariable(const GlobalVarDecl &decl) const {
 // Internal iterator over all vars.
 void Program::ForEachVariable(
     std::function<bool(const GlobalVarDecl *)> callback) const {
-  if (!impl->vars_are_sorted) {
-    std::sort(impl->vars.begin(), impl->vars.end(),
-              [](const std::unique_ptr<GlobalVarDecl> &a,
-                 const std::unique_ptr<GlobalVarDecl> &b) {
-                return a->address < b->address;
-              });
-    impl->vars_are_sorted = true;
-  }
+  impl->SortVariables();
 
   // NOTE(pag): Size of variables may change.
   for (size_t i = 0; i < impl->vars.size(); ++i) {
@@ -1129,12 +1924,16 @@ void Program::ForEachVariable(
 
 // Search for a specific variable by its address.
 const GlobalVarDecl *Program::FindVariable(uint64_t address) const {
+  ANVILL_TRACE_ZONE("Program::FindVariable");
+  ANVILL_TRACE_ZONE_TAG(address, 0u);
   return impl->FindVariable(address);
 }
 
 const GlobalVarDecl *
 Program::FindInVariable(uint64_t address,
                         const llvm::DataLayout &layout) const {
+  ANVILL_TRACE_ZONE("Program::FindInVariable");
+  ANVILL_TRACE_ZONE_TAG(address, 0u);
   return impl->FindInVariable(address, layout);
 }
 
@@ -1143,8 +1942,7 @@ void Program::ForEachVariableWithName(
     const std::string &name,
     std::function<bool(const GlobalVarDecl *)> callback) const {
   const auto var_it_end = impl->ea_to_var.end();
-  for (auto it = impl->name_to_ea.find(name), it_end = impl->name_to_ea.end();
-       it != it_end && it->first == name; ++it) {
+  for (auto [it, it_end] = impl->AddressesOfName(name); it != it_end; ++it) {
     if (auto var_it = impl->ea_to_var.find(it->second); var_it != var_it_end) {
       if (!callback(var_it->second)) {
         return;
@@ -1162,28 +1960,172 @@ Byte Program::FindByte(uint64_t address) const {
 
 // Find which byte sequence (defined in the spec) has the provided `address`
 ByteSequence Program::FindBytesContaining(uint64_t address) const {
+  ANVILL_TRACE_ZONE("Program::FindBytesContaining");
+  ANVILL_TRACE_ZONE_TAG(address, 0u);
   auto [data, meta, found_size, base_address] =
       impl->FindBytesContaining(address);
   return ByteSequence(base_address, data, meta, found_size);
 }
 
+// Call `callback` on the bytes of each mapped range.
+void Program::ForEachMappedRange(
+    std::function<bool(const ByteSequence &, bool)> callback) const {
+  for (const auto &range : impl->ranges) {
+    ByteSequence bytes(range.base_address, range.data, range.meta.get(),
+                       range.Size());
+    if (!callback(bytes, !!range.zero_pages.allocatedSize())) {
+      return;
+    }
+  }
+}
+
 // Find the next byte.
 Byte Program::FindNextByte(Byte byte) const {
   if (byte.meta) {
-    if (byte.meta->next_byte_is_in_range) {
-      return Byte(byte.addr + 1u, &(byte.data[1]), &(byte.meta[1]));
+    if ((byte.addr + 1u) < byte.meta->limit_address) {
+      return Byte(byte.addr + 1u, &(byte.data[1]), byte.meta);
 
-    } else if (byte.meta->next_byte_starts_new_range) {
+    } else if (byte.meta->next_range_is_adjacent) {
       return FindByte(byte.addr + 1u);
     }
   }
   return Byte(byte.addr + 1u, nullptr, nullptr);
 }
 
+// Find the sequence of up to `size` bytes that directly follows `bytes`.
+ByteSequence Program::FindNextBytes(const ByteSequence &bytes,
+                                    size_t size) const {
+  const auto address = bytes.address + bytes.size;
+  if (!bytes.meta || !size) {
+    return ByteSequence(address, nullptr, nullptr, 0u);
+
+  // The rest of the same range.
+  } else if (address < bytes.meta->limit_address) {
+    const auto max_size = bytes.meta->limit_address - address;
+    return ByteSequence(address, &(bytes.first_data[bytes.size]), bytes.meta,
+                        size < max_size ? size : max_size);
+
+  } else if (bytes.meta->next_range_is_adjacent) {
+    return FindBytes(address, size);
+
+  } else {
+    return ByteSequence(address, nullptr, nullptr, 0u);
+  }
+}
+
+namespace {
+
+// Number of words whose candidacy is decided at once, i.e. one bitmap entry.
+static constexpr size_t kWordsPerBlock = 64u;
+
+// Beyond this many range bounds, each word is binary searched in the bounds,
+// rather than compared against all of them.
+static constexpr size_t kMaxComparedBounds = 64u;
+
+// Read the `size`-byte integer at `bytes`.
+static uint64_t ReadWord(const char *bytes, unsigned size,
+                         bool is_little_endian) {
+  const auto endian =
+      is_little_endian ? llvm::support::little : llvm::support::big;
+  switch (size) {
+    case 8u: return llvm::support::endian::read<uint64_t>(bytes, endian);
+    case 4u: return llvm::support::endian::read<uint32_t>(bytes, endian);
+    default: {
+      uint64_t val = 0u;
+      for (auto i = 0u; i < size; ++i) {
+        const auto byte = is_little_endian ? bytes[size - i - 1u] : bytes[i];
+        val = (val << 8u) | static_cast<uint8_t>(byte);
+      }
+      return val;
+    }
+  }
+}
+
+}  // namespace
+
+// Scan `words` for values that could be pointers into this program.
+std::vector<uint64_t>
+Program::FindPointerCandidates(std::string_view words, unsigned pointer_size,
+                               bool is_little_endian,
+                               bool executable_only) const {
+  ANVILL_TRACE_ZONE("Program::FindPointerCandidates");
+  ANVILL_TRACE_ZONE_TAG(words.size(), pointer_size);
+
+  const auto num_words =
+      (pointer_size && pointer_size <= 8u) ? words.size() / pointer_size : 0u;
+  std::vector<uint64_t> bitmap((num_words + kWordsPerBlock - 1u) /
+                               kWordsPerBlock);
+  if (!num_words) {
+    return bitmap;
+  }
+
+  // Flatten the ranges into their sorted bounds, merging adjacent ranges. A
+  // value is then in some range if an odd number of bounds are at or below
+  // it.
+  llvm::SmallVector<uint64_t, kMaxComparedBounds> bounds;
+  for (const auto &range : impl->ranges) {
+    if (executable_only && !range.meta->is_executable) {
+      continue;
+    } else if (!bounds.empty() && bounds.back() == range.base_address) {
+      bounds.back() = range.limit_address;
+    } else {
+      bounds.push_back(range.base_address);
+      bounds.push_back(range.limit_address);
+    }
+  }
+
+  if (bounds.empty()) {
+    return bitmap;
+  }
+
+  uint64_t values[kWordsPerBlock];
+  uint64_t parities[kWordsPerBlock];
+  for (size_t first = 0u; first < num_words; first += kWordsPerBlock) {
+    const auto block_size = std::min(kWordsPerBlock, num_words - first);
+    const auto block_bytes = &(words[first * pointer_size]);
+    for (size_t i = 0u; i < block_size; ++i) {
+      values[i] = ReadWord(&(block_bytes[i * pointer_size]), pointer_size,
+                           is_little_endian);
+    }
+
+    uint64_t candidates = 0u;
+    if (bounds.size() <= kMaxComparedBounds) {
+
+      // The loops are over whole blocks, with branch-free bodies, so that
+      // they're vectorized; the words after the end of a short block are
+      // computed but not used.
+      std::fill_n(&(values[block_size]), kWordsPerBlock - block_size, 0u);
+      std::fill_n(parities, kWordsPerBlock, 0u);
+      for (const auto bound : bounds) {
+        for (size_t i = 0u; i < kWordsPerBlock; ++i) {
+          parities[i] ^= static_cast<uint64_t>(bound <= values[i]);
+        }
+      }
+      for (size_t i = 0u; i < block_size; ++i) {
+        candidates |= parities[i] << i;
+      }
+
+    } else {
+      for (size_t i = 0u; i < block_size; ++i) {
+        const auto num_below = static_cast<uint64_t>(
+            std::upper_bound(bounds.begin(), bounds.end(), values[i]) -
+            bounds.begin());
+        candidates |= (num_below & 1u) << i;
+      }
+    }
+
+    bitmap[first / kWordsPerBlock] = candidates;
+  }
+
+  return bitmap;
+}
+
 // Find a sequence of bytes within the same mapped range starting at
 // `address` and including as many bytes fall within the range up to
 // but not including `address+size`.
 ByteSequence Program::FindBytes(uint64_t address, size_t size) const {
+  ANVILL_TRACE_ZONE("Program::FindBytes");
+  ANVILL_TRACE_ZONE_TAG(address, size);
   auto [data, meta, found_size] = impl->FindBytes(address, size);
   return ByteSequence(address, data, meta, found_size);
 }
@@ -1197,6 +2139,38 @@ llvm::Error Program::MapRange(const ByteRange &range) {
   return impl->MapRange(range);
 }
 
+// Map a range of bytes into the program, taking ownership of them.
+llvm::Error Program::MapRange(uint64_t address, std::vector<uint8_t> data,
+                              bool is_writeable, bool is_executable) {
+  return impl->MapRange(address, std::move(data), is_writeable,
+                        is_executable);
+}
+
+// Map a range of bytes owned by `owner` into the program, without copying
+// them.
+llvm::Error Program::MapBorrowedRange(uint64_t address, const uint8_t *data,
+                                      uint64_t size,
+                                      std::shared_ptr<const void> owner,
+                                      bool is_writeable, bool is_executable) {
+  return impl->MapBorrowedRange(address, data, size, std::move(owner),
+                                is_writeable, is_executable);
+}
+
+// Memory-map a slice of a file into the program.
+llvm::Error Program::MapFile(const std::string &path, uint64_t file_offset,
+                             uint64_t address, uint64_t size,
+                             bool is_writeable, bool is_executable) {
+  return impl->MapFile(path, file_offset, address, size, is_writeable,
+                       is_executable);
+}
+
+// Map a range of zero-valued bytes into the program, without allocating
+// storage for them.
+llvm::Error Program::MapZeroRange(uint64_t address, uint64_t size,
+                                  bool is_writeable, bool is_executable) {
+  return impl->MapZeroRange(address, size, is_writeable, is_executable);
+}
+
 Program::Program(void *opaque)
     : impl(reinterpret_cast<Program::Impl *>(opaque)->shared_from_this()) {}
 
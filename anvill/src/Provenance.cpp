@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "anvill/Provenance.h"
+
+#include <llvm/ADT/DenseSet.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instruction.h>
+#include <llvm/IR/Metadata.h>
+#include <llvm/IR/Module.h>
+
+#include <system_error>
+
+namespace anvill {
+namespace {
+
+// Returns the record described by `node`, if `node` is a well-formed
+// provenance record.
+static std::optional<ProvenanceRecord> ReadRecord(const llvm::MDNode *node) {
+  if (!node || node->getNumOperands() != 2u) {
+    return std::nullopt;
+  }
+
+  auto pc_md =
+      llvm::dyn_cast_or_null<llvm::ConstantAsMetadata>(node->getOperand(0));
+  auto reg_md = llvm::dyn_cast_or_null<llvm::MDString>(node->getOperand(1));
+  if (!pc_md || !reg_md) {
+    return std::nullopt;
+  }
+
+  auto pc = llvm::dyn_cast<llvm::ConstantInt>(pc_md->getValue());
+  if (!pc) {
+    return std::nullopt;
+  }
+
+  ProvenanceRecord record;
+  record.pc = pc->getZExtValue();
+  record.reg = reg_md->getString();
+  return record;
+}
+
+static llvm::Error InvalidProvenance(const char *what,
+                                     const llvm::Function &func) {
+  return llvm::createStringError(
+      std::make_error_code(std::errc::invalid_argument),
+      "%s in function '%s'", what, func.getName().str().c_str());
+}
+
+}  // namespace
+
+const char kProvenanceMetadataName[] = "anvill.provenance";
+
+// Returns the provenance record node for a write of `reg` by the instruction
+// at `pc`.
+llvm::MDNode *GetProvenanceNode(llvm::ConstantInt *pc, llvm::StringRef reg) {
+  auto &context = pc->getContext();
+  llvm::Metadata *ops[] = {llvm::ConstantAsMetadata::get(pc),
+                           llvm::MDString::get(context, reg)};
+  return llvm::MDTuple::get(context, ops);
+}
+
+// Returns the provenance record attached to `inst`, if any.
+std::optional<ProvenanceRecord> GetProvenance(const llvm::Instruction &inst) {
+  return ReadRecord(inst.getMetadata(kProvenanceMetadataName));
+}
+
+// Set the side table of `func` to the record nodes in `records`.
+void SetProvenanceTable(llvm::Function &func,
+                        llvm::ArrayRef<llvm::Metadata *> records) {
+  func.setMetadata(kProvenanceMetadataName,
+                   llvm::MDTuple::get(func.getContext(), records));
+}
+
+// Validate the provenance in `module`.
+llvm::Expected<ProvenanceStats> VerifyProvenance(const llvm::Module &module) {
+  ProvenanceStats stats;
+  llvm::DenseSet<const llvm::MDNode *> recorded;
+  llvm::DenseSet<const llvm::MDNode *> surviving;
+
+  for (const auto &func : module) {
+    auto table = func.getMetadata(kProvenanceMetadataName);
+    if (!table) {
+      continue;
+    }
+    for (const auto &op : table->operands()) {
+      auto node = llvm::dyn_cast_or_null<llvm::MDNode>(op.get());
+      if (!ReadRecord(node)) {
+        return InvalidProvenance("Malformed provenance side table", func);
+      }
+      recorded.insert(node);
+    }
+  }
+
+  for (const auto &func : module) {
+    for (const auto &inst : llvm::instructions(func)) {
+      auto node = inst.getMetadata(kProvenanceMetadataName);
+      if (!node) {
+        continue;
+      } else if (!ReadRecord(node)) {
+        return InvalidProvenance("Malformed provenance record", func);
+      } else if (!recorded.count(node)) {
+        return InvalidProvenance("Provenance record missing from side tables",
+                                 func);
+      }
+      ++stats.num_tagged_instructions;
+      surviving.insert(node);
+    }
+  }
+
+  stats.num_records = recorded.size();
+  stats.num_surviving_records = surviving.size();
+  return stats;
+}
+
+}  // namespace anvill
@@ -17,7 +17,70 @@
 
 #include "ControlFlowProvider.h"
 
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
 namespace anvill {
+namespace {
+
+// Remembers the answers of another control-flow provider.
+class CachingControlFlowProvider final : public IControlFlowProvider {
+ public:
+  explicit CachingControlFlowProvider(IControlFlowProvider::Ptr inner_)
+      : inner(std::move(inner_)) {}
+
+  virtual ~CachingControlFlowProvider(void) override = default;
+
+  virtual std::uint64_t GetRedirection(std::uint64_t address) const override;
+
+  virtual std::optional<ControlFlowTargetList>
+  TryGetControlFlowTargets(std::uint64_t address) const override;
+
+ private:
+  const IControlFlowProvider::Ptr inner;
+
+  // An address without a redirection is mapped to itself, and an address
+  // without targets is mapped to `std::nullopt`.
+  mutable std::mutex lock;
+  mutable std::unordered_map<std::uint64_t, std::uint64_t> redirections;
+  mutable std::unordered_map<std::uint64_t,
+                             std::optional<ControlFlowTargetList>>
+      targets;
+};
+
+std::uint64_t
+CachingControlFlowProvider::GetRedirection(std::uint64_t address) const {
+  {
+    std::lock_guard<std::mutex> locker(lock);
+    if (auto it = redirections.find(address); it != redirections.end()) {
+      return it->second;
+    }
+  }
+
+  // `inner` is asked without holding the lock, as it may be slow. If two
+  // threads race to ask the same question, then the first answer is kept.
+  const auto destination = inner->GetRedirection(address);
+  std::lock_guard<std::mutex> locker(lock);
+  return redirections.emplace(address, destination).first->second;
+}
+
+std::optional<ControlFlowTargetList>
+CachingControlFlowProvider::TryGetControlFlowTargets(
+    std::uint64_t address) const {
+  {
+    std::lock_guard<std::mutex> locker(lock);
+    if (auto it = targets.find(address); it != targets.end()) {
+      return it->second;
+    }
+  }
+
+  auto target_list = inner->TryGetControlFlowTargets(address);
+  std::lock_guard<std::mutex> locker(lock);
+  return targets.emplace(address, std::move(target_list)).first->second;
+}
+
+}  // namespace
 
 struct ControlFlowProvider::PrivateData final {
   PrivateData(const Program &program_) : program(program_) {}
@@ -56,4 +119,14 @@ IControlFlowProvider::Create(const Program &program) {
     return error;
   }
 }
+
+Result<IControlFlowProvider::Ptr, ControlFlowProviderError>
+IControlFlowProvider::CreateCaching(Ptr inner) {
+  try {
+    return Ptr(new CachingControlFlowProvider(std::move(inner)));
+
+  } catch (const std::bad_alloc &) {
+    return ControlFlowProviderError::MemoryAllocationError;
+  }
+}
 }  // namespace anvill
@@ -15,12 +15,36 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <anvill/Counters.h>
 #include <anvill/Program.h>
 #include <anvill/Providers/MemoryProvider.h>
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
 
 namespace anvill {
 namespace {
 
+// Figure out the permissions of a byte in a program.
+static BytePermission PermissionsOf(const Byte &byte) {
+  if (byte.IsWriteable() && byte.IsExecutable()) {
+    return BytePermission::kReadableWritableExecutable;
+  } else if (byte.IsWriteable()) {
+    return BytePermission::kReadableWritable;
+  } else if (byte.IsExecutable()) {
+    return BytePermission::kReadableExecutable;
+  } else {
+    return BytePermission::kReadable;
+  }
+}
+
 // Provider of memory wrapping around an `anvill::Program`.
 class ProgramMemoryProvider final : public MemoryProvider {
  public:
@@ -37,19 +61,23 @@ class ProgramMemoryProvider final : public MemoryProvider {
       return {0, ByteAvailability::kUnknown, BytePermission::kUnknown};
     }
 
-    uint8_t byte_out = byte.ValueOr(0u);
-    auto perm_out = BytePermission::kUnknown;
-    if (byte.IsWriteable() && byte.IsWriteable()) {
-      perm_out = BytePermission::kReadableWritableExecutable;
-    } else if (byte.IsWriteable()) {
-      perm_out = BytePermission::kReadableWritable;
-    } else if (byte.IsExecutable()) {
-      perm_out = BytePermission::kReadableExecutable;
-    } else {
-      perm_out = BytePermission::kReadable;
+    return {byte.ValueOr(0u), ByteAvailability::kAvailable,
+            PermissionsOf(byte)};
+  }
+
+  // All bytes of a mapped range share the same permissions, so the run is
+  // the remainder of the range containing `address`, up to `size` bytes.
+  std::tuple<size_t, ByteAvailability, BytePermission>
+  QueryRange(uint64_t address, size_t size, std::string &bytes) final {
+    auto seq = program.FindBytes(address, size);
+    if (!seq) {
+      return {0u, ByteAvailability::kUnknown, BytePermission::kUnknown};
     }
 
-    return {byte_out, ByteAvailability::kAvailable, perm_out};
+    const auto run = seq.ToString();
+    bytes.append(run.data(), run.size());
+    return {run.size(), ByteAvailability::kAvailable,
+            PermissionsOf(seq[address])};
   }
 
  private:
@@ -65,12 +93,311 @@ class NullMemoryProvider final : public MemoryProvider {
   Query(uint64_t address) final {
     return {0, ByteAvailability::kUnknown, BytePermission::kUnknown};
   }
+
+  std::tuple<size_t, ByteAvailability, BytePermission>
+  QueryRange(uint64_t address, size_t size, std::string &bytes) final {
+    return {0u, ByteAvailability::kUnknown, BytePermission::kUnknown};
+  }
+};
+
+// Provider of memory that caches the pages of a `PageSource`, and that
+// fetches the pages hinted at by `Prefetch` on a background thread, so that
+// the lifter is rarely left waiting on the source.
+class PagedMemoryProvider final : public MemoryProvider {
+ public:
+  PagedMemoryProvider(std::shared_ptr<PageSource> source_, uint64_t page_size_,
+                      size_t max_cached_pages_, size_t max_batch_size_)
+      : source(std::move(source_)),
+        page_mask(~(page_size_ - 1u)),
+        max_cached_pages(std::max<size_t>(1u, max_cached_pages_)),
+        max_batch_size(std::max<size_t>(1u, max_batch_size_)),
+        fetcher([this](void) { FetchQueuedPages(); }) {
+    CHECK(page_size_ && !(page_size_ & (page_size_ - 1u)))
+        << "Page size " << page_size_ << " is not a power of two";
+  }
+
+  ~PagedMemoryProvider(void) final {
+    {
+      std::unique_lock<std::mutex> locker(lock);
+      stopping = true;
+    }
+    queued_cv.notify_all();
+    fetcher.join();
+  }
+
+  std::tuple<uint8_t, ByteAvailability, BytePermission>
+  Query(uint64_t address) final {
+    auto page = GetPage(address & page_mask);
+    const auto offset = address & ~page_mask;
+    if (!HasByte(page->availability)) {
+      return {0, page->availability, page->permission};
+    } else if (offset >= page->bytes.size()) {
+      return {0, ByteAvailability::kUnknown, page->permission};
+    }
+    return {static_cast<uint8_t>(page->bytes[offset]), page->availability,
+            page->permission};
+  }
+
+  // The run is the rest of the page containing `address`, up to `size`
+  // bytes.
+  std::tuple<size_t, ByteAvailability, BytePermission>
+  QueryRange(uint64_t address, size_t size, std::string &bytes) final {
+    auto page = GetPage(address & page_mask);
+    const auto offset = address & ~page_mask;
+    if (!HasByte(page->availability)) {
+      return {0u, page->availability, page->permission};
+    } else if (offset >= page->bytes.size()) {
+      return {0u, ByteAvailability::kUnknown, page->permission};
+    }
+
+    const auto run = std::string_view(page->bytes).substr(offset, size);
+    bytes.append(run.data(), run.size());
+    return {run.size(), page->availability, page->permission};
+  }
+
+  // Queue up the pages covering the hinted bytes for the background thread.
+  // Hints are dropped if the queue is already backed up, as the pages they
+  // name would likely be evicted before being used.
+  void Prefetch(uint64_t address, size_t size) final {
+    if (!size) {
+      return;
+    }
+
+    const auto first_page = address & page_mask;
+    const auto last_page = (address + (size - 1u)) & page_mask;
+    auto num_queued = 0u;
+    {
+      std::unique_lock<std::mutex> locker(lock);
+      for (auto page_address = first_page;;
+           page_address += (~page_mask + 1u)) {
+        if (queue.size() >= max_cached_pages / 2u) {
+          break;
+        }
+
+        auto &entry = entries[page_address];
+        if (entry.state == PageState::kAbsent) {
+          entry.state = PageState::kQueued;
+          queue.push_back(page_address);
+          ++num_queued;
+        }
+
+        if (page_address == last_page) {
+          break;
+        }
+      }
+    }
+
+    if (num_queued) {
+      queued_cv.notify_one();
+    }
+  }
+
+ private:
+  PagedMemoryProvider(void) = delete;
+
+  enum class PageState : uint8_t {
+
+    // Not cached, and nobody is getting it.
+    kAbsent,
+
+    // Waiting in `queue` to be fetched by the background thread.
+    kQueued,
+
+    // Being fetched, either by the background thread, or on demand.
+    kFetching,
+
+    // Cached in `page`, and in `lru`.
+    kCached
+  };
+
+  struct PageEntry {
+    PageState state{PageState::kAbsent};
+    std::shared_ptr<const MemoryPage> page;
+    std::list<uint64_t>::iterator lru_it;
+  };
+
+  // Return the page starting at `page_address`, fetching it if it isn't
+  // cached, or waiting for it if it's already being fetched.
+  std::shared_ptr<const MemoryPage> GetPage(uint64_t page_address) {
+    std::unique_lock<std::mutex> locker(lock);
+    auto &entry = entries[page_address];
+    switch (entry.state) {
+      case PageState::kCached:
+        IncrementCounter(Counter::kMemoryPageCacheHits);
+        lru.splice(lru.begin(), lru, entry.lru_it);
+        return entry.page;
+
+      case PageState::kFetching:
+        IncrementCounter(Counter::kMemoryPageCacheMisses);
+        fetched_cv.wait(locker, [&](void) {
+          return entries[page_address].state != PageState::kFetching;
+        });
+
+        // The page could have been evicted in the meantime, if there are fewer
+        // cached pages than pages being fetched.
+        if (auto &fetched_entry = entries[page_address];
+            fetched_entry.state == PageState::kCached) {
+          return fetched_entry.page;
+        }
+        break;
+
+      case PageState::kAbsent:
+      case PageState::kQueued:
+        IncrementCounter(Counter::kMemoryPageCacheMisses);
+        break;
+    }
+
+    // Fetch the page now, along with some of the queued ones, so that they
+    // share a round trip to the source.
+    std::vector<uint64_t> batch;
+    entries[page_address].state = PageState::kFetching;
+    batch.push_back(page_address);
+    TakeQueuedPages(batch);
+
+    locker.unlock();
+    std::vector<MemoryPage> pages(batch.size());
+    FetchPages(batch, pages);
+    locker.lock();
+
+    auto page = std::make_shared<const MemoryPage>(std::move(pages.front()));
+    CachePages(batch, pages, page);
+    return page;
+  }
+
+  // Move queued pages into `batch` until it is full, marking them as being
+  // fetched. Pages that were already fetched on demand are skipped.
+  void TakeQueuedPages(std::vector<uint64_t> &batch) {
+    while (batch.size() < max_batch_size && !queue.empty()) {
+      const auto page_address = queue.front();
+      queue.pop_front();
+
+      auto &entry = entries[page_address];
+      if (entry.state == PageState::kQueued) {
+        entry.state = PageState::kFetching;
+        batch.push_back(page_address);
+      }
+    }
+  }
+
+  // Fetch the pages of `batch` from the source. Only one fetch is in flight
+  // at a time.
+  void FetchPages(const std::vector<uint64_t> &batch,
+                  std::vector<MemoryPage> &pages) {
+    std::unique_lock<std::mutex> locker(fetch_lock);
+    source->FetchPages(batch, pages);
+  }
+
+  // Cache the fetched `pages` of `batch`, evicting the least recently used
+  // pages if there are too many, and wake anyone waiting on them. The first
+  // page is given as `first_page` if it was already made shareable.
+  void CachePages(const std::vector<uint64_t> &batch,
+                  std::vector<MemoryPage> &pages,
+                  std::shared_ptr<const MemoryPage> first_page = {}) {
+    for (auto i = 0u; i < batch.size(); ++i) {
+      auto &entry = entries[batch[i]];
+      entry.state = PageState::kCached;
+      if (!i && first_page) {
+        entry.page = std::move(first_page);
+      } else {
+        entry.page = std::make_shared<const MemoryPage>(std::move(pages[i]));
+      }
+      lru.push_front(batch[i]);
+      entry.lru_it = lru.begin();
+    }
+
+    while (lru.size() > max_cached_pages) {
+      entries.erase(lru.back());
+      lru.pop_back();
+    }
+
+    fetched_cv.notify_all();
+  }
+
+  // Body of the background thread, which fetches the queued pages in batches.
+  void FetchQueuedPages(void) {
+    std::vector<uint64_t> batch;
+    std::vector<MemoryPage> pages;
+
+    std::unique_lock<std::mutex> locker(lock);
+    while (true) {
+      queued_cv.wait(locker,
+                     [this](void) { return stopping || !queue.empty(); });
+      if (stopping) {
+        return;
+      }
+
+      batch.clear();
+      TakeQueuedPages(batch);
+      if (batch.empty()) {
+        continue;
+      }
+
+      locker.unlock();
+      pages.clear();
+      pages.resize(batch.size());
+      FetchPages(batch, pages);
+      locker.lock();
+
+      CachePages(batch, pages);
+    }
+  }
+
+  const std::shared_ptr<PageSource> source;
+  const uint64_t page_mask;
+  const size_t max_cached_pages;
+  const size_t max_batch_size;
+
+  // Guards everything below.
+  std::mutex lock;
+  std::condition_variable queued_cv;
+  std::condition_variable fetched_cv;
+  std::unordered_map<uint64_t, PageEntry> entries;
+
+  // Addresses of the cached pages, most recently used first.
+  std::list<uint64_t> lru;
+
+  // Addresses of the pages hinted at by `Prefetch`, in the order of hinting.
+  std::deque<uint64_t> queue;
+  bool stopping{false};
+
+  // Serializes calls into `source`.
+  std::mutex fetch_lock;
+
+  // This is last so that everything it uses is initialized first.
+  std::thread fetcher;
 };
 
 }  // namespace
 
 MemoryProvider::~MemoryProvider(void) {}
 
+PageSource::~PageSource(void) {}
+
+// By default, hints are ignored.
+void MemoryProvider::Prefetch(uint64_t, size_t) {}
+
+// Default implementation of a bulk query, in terms of `Query`.
+std::tuple<size_t, ByteAvailability, BytePermission>
+MemoryProvider::QueryRange(uint64_t address, size_t size, std::string &bytes) {
+  auto [first_byte, first_avail, first_perms] = Query(address);
+  if (!HasByte(first_avail) || !size) {
+    return {0u, first_avail, first_perms};
+  }
+
+  bytes.push_back(static_cast<char>(first_byte));
+
+  size_t i = 1u;
+  for (; i < size; ++i) {
+    auto [byte, avail, perms] = Query(address + i);
+    if (avail != first_avail || perms != first_perms) {
+      break;
+    }
+    bytes.push_back(static_cast<char>(byte));
+  }
+
+  return {i, first_avail, first_perms};
+}
+
 // Sources bytes from an `anvill::Program`.
 std::shared_ptr<MemoryProvider>
 MemoryProvider::CreateProgramMemoryProvider(const Program &program) {
@@ -82,4 +409,12 @@ std::shared_ptr<MemoryProvider> MemoryProvider::CreateNullMemoryProvider(void) {
   return std::make_shared<NullMemoryProvider>();
 }
 
+// Sources bytes from the pages of `source`.
+std::shared_ptr<MemoryProvider> MemoryProvider::CreatePagedMemoryProvider(
+    std::shared_ptr<PageSource> source, uint64_t page_size,
+    size_t max_cached_pages, size_t max_batch_size) {
+  return std::make_shared<PagedMemoryProvider>(
+      std::move(source), page_size, max_cached_pages, max_batch_size);
+}
+
 }  // namespace anvill
@@ -15,6 +15,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <anvill/Counters.h>
 #include <anvill/Decl.h>
 #include <anvill/Program.h>
 #include <anvill/Providers/TypeProvider.h>
@@ -25,6 +26,11 @@
 #include <llvm/IR/Type.h>
 #include <remill/BC/Util.h>
 
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
 namespace anvill {
 namespace {
 
@@ -34,13 +40,18 @@ class ProgramTypeProvider final : public TypeProvider {
   explicit ProgramTypeProvider(llvm::LLVMContext &context_,
                                const Program &program_)
       : TypeProvider(context_),
-        program(program_) {}
+        program(std::make_shared<const Program>(program_)) {}
 
   // Try to return the type of a function starting at address `address`. This
   // type is the prototype of the function.
-  std::optional<FunctionDecl> TryGetFunctionType(uint64_t address) final;
+  std::shared_ptr<const FunctionDecl>
+  TryGetFunctionType(uint64_t address) final;
+
+  bool IsFunctionHead(uint64_t address) final {
+    return program->FindFunction(address) != nullptr;
+  }
 
-  std::optional<GlobalVarDecl>
+  std::shared_ptr<const GlobalVarDecl>
   TryGetVariableType(uint64_t address, const llvm::DataLayout &layout) final;
 
   // Try to get the type of the register named `reg_name` on entry to the
@@ -55,44 +66,47 @@ class ProgramTypeProvider final : public TypeProvider {
  private:
   ProgramTypeProvider(void) = delete;
 
-  const Program &program;
+  // `Program`s are handles to shared data, so this refers to the same program
+  // as `program_`. The returned decls share ownership of it, keeping them alive
+  // for as long as they are used.
+  const std::shared_ptr<const Program> program;
 };
 
 // Try to return the type of a function starting at address `address`. This
 // type is the prototype of the function.
-std::optional<FunctionDecl>
+std::shared_ptr<const FunctionDecl>
 ProgramTypeProvider::TryGetFunctionType(uint64_t address) {
-  const auto decl = program.FindFunction(address);
+  const auto decl = program->FindFunction(address);
   if (!decl) {
-    return std::nullopt;
+    return {};
   }
 
   CHECK_NOTNULL(decl->type);
   CHECK_EQ(decl->address, address);
 
-  return *decl;
+  return std::shared_ptr<const FunctionDecl>(program, decl);
 }
 
-std::optional<GlobalVarDecl>
+std::shared_ptr<const GlobalVarDecl>
 ProgramTypeProvider::TryGetVariableType(uint64_t address,
                                         const llvm::DataLayout &layout) {
-  if (auto var_decl = program.FindVariable(address); var_decl) {
+  if (auto var_decl = program->FindVariable(address); var_decl) {
 
     // Check integrity of the var_decl
     CHECK_NOTNULL(var_decl->type);
     CHECK_EQ(var_decl->address, address);
-    return *var_decl;
+    return std::shared_ptr<const GlobalVarDecl>(program, var_decl);
 
   // if FindVariable fails to get the variable at address; get the variable
   // containing the address
-  } else if (auto var_decl = program.FindInVariable(address, layout);
+  } else if (auto var_decl = program->FindInVariable(address, layout);
              var_decl) {
     CHECK_NOTNULL(var_decl->type);
     CHECK_LE(var_decl->address, address);
-    return *var_decl;
+    return std::shared_ptr<const GlobalVarDecl>(program, var_decl);
   }
 
-  return std::nullopt;
+  return {};
 }
 
 // Try to get the type of the register named `reg_name` on entry to the
@@ -104,18 +118,13 @@ void ProgramTypeProvider::QueryRegisterStateAtInstruction(
                        std::optional<uint64_t>)>
         typed_reg_cb) {
 
-  auto decl = program.FindFunction(func_address);
+  auto decl = program->FindFunction(func_address);
   if (!decl) {
     return;
   }
 
-  auto types_it = decl->reg_info.find(inst_address);
-  if (types_it == decl->reg_info.end()) {
-    return;
-  }
-
-  for (const auto &decl : types_it->second) {
-    typed_reg_cb(decl.reg->name, decl.type, decl.value);
+  for (const auto &reg_decl : decl->RegisterInfoAt(inst_address)) {
+    typed_reg_cb(reg_decl.reg->name, reg_decl.type, reg_decl.value);
   }
 }
 
@@ -125,13 +134,17 @@ class NullTypeProvider final : public TypeProvider {
 
   // Try to return the type of a function starting at address `address`. This
   // type is the prototype of the function.
-  std::optional<FunctionDecl> TryGetFunctionType(uint64_t) final {
-    return std::nullopt;
+  std::shared_ptr<const FunctionDecl> TryGetFunctionType(uint64_t) final {
+    return {};
   }
 
-  std::optional<GlobalVarDecl>
+  bool IsFunctionHead(uint64_t) final {
+    return false;
+  }
+
+  std::shared_ptr<const GlobalVarDecl>
   TryGetVariableType(uint64_t, const llvm::DataLayout &) final {
-    return std::nullopt;
+    return {};
   }
 
   // Try to get the type of the register named `reg_name` on entry to the
@@ -146,6 +159,106 @@ class NullTypeProvider final : public TypeProvider {
   NullTypeProvider(void) = delete;
 };
 
+// Remembers the answers of another type provider.
+class CachingTypeProvider final : public TypeProvider {
+ public:
+  CachingTypeProvider(llvm::LLVMContext &context_,
+                      std::shared_ptr<TypeProvider> inner_)
+      : TypeProvider(context_),
+        inner(std::move(inner_)) {}
+
+  std::shared_ptr<const FunctionDecl>
+  TryGetFunctionType(uint64_t address) final;
+
+  bool IsFunctionHead(uint64_t address) final;
+
+  std::shared_ptr<const GlobalVarDecl>
+  TryGetVariableType(uint64_t address, const llvm::DataLayout &layout) final;
+
+  void QueryRegisterStateAtInstruction(
+      uint64_t func_address, uint64_t inst_address,
+      std::function<void(const std::string &, llvm::Type *,
+                         std::optional<uint64_t>)>
+          typed_reg_cb) final {
+    inner->QueryRegisterStateAtInstruction(func_address, inst_address,
+                                           std::move(typed_reg_cb));
+  }
+
+ private:
+  CachingTypeProvider(void) = delete;
+
+  const std::shared_ptr<TypeProvider> inner;
+
+  // A null decl means that `inner` has no decl for the address. Variable
+  // answers also depend on the data layout, as `inner` may be asked about an
+  // address inside of a variable.
+  std::mutex lock;
+  std::unordered_map<uint64_t, std::shared_ptr<const FunctionDecl>> funcs;
+  std::unordered_map<uint64_t, bool> heads;
+  std::map<std::pair<const llvm::DataLayout *, uint64_t>,
+           std::shared_ptr<const GlobalVarDecl>>
+      vars;
+};
+
+std::shared_ptr<const FunctionDecl>
+CachingTypeProvider::TryGetFunctionType(uint64_t address) {
+  {
+    std::lock_guard<std::mutex> locker(lock);
+    if (auto it = funcs.find(address); it != funcs.end()) {
+      IncrementCounter(Counter::kTypeCacheHits);
+      return it->second;
+    }
+  }
+
+  IncrementCounter(Counter::kTypeCacheMisses);
+
+  // `inner` is asked without holding the lock, as it may be slow. If two
+  // threads race to ask the same question, then the first answer is kept.
+  auto decl = inner->TryGetFunctionType(address);
+  std::lock_guard<std::mutex> locker(lock);
+  return funcs.emplace(address, std::move(decl)).first->second;
+}
+
+// Decls that were already asked for answer this too. Otherwise, `inner` is
+// asked at most once about each address.
+bool CachingTypeProvider::IsFunctionHead(uint64_t address) {
+  {
+    std::lock_guard<std::mutex> locker(lock);
+    if (auto it = funcs.find(address); it != funcs.end()) {
+      IncrementCounter(Counter::kTypeCacheHits);
+      return it->second != nullptr;
+    } else if (auto head_it = heads.find(address); head_it != heads.end()) {
+      IncrementCounter(Counter::kTypeCacheHits);
+      return head_it->second;
+    }
+  }
+
+  IncrementCounter(Counter::kTypeCacheMisses);
+
+  const auto is_head = inner->IsFunctionHead(address);
+  std::lock_guard<std::mutex> locker(lock);
+  return heads.emplace(address, is_head).first->second;
+}
+
+std::shared_ptr<const GlobalVarDecl>
+CachingTypeProvider::TryGetVariableType(uint64_t address,
+                                        const llvm::DataLayout &layout) {
+  const auto key = std::make_pair(&layout, address);
+  {
+    std::lock_guard<std::mutex> locker(lock);
+    if (auto it = vars.find(key); it != vars.end()) {
+      IncrementCounter(Counter::kTypeCacheHits);
+      return it->second;
+    }
+  }
+
+  IncrementCounter(Counter::kTypeCacheMisses);
+
+  auto decl = inner->TryGetVariableType(address, layout);
+  std::lock_guard<std::mutex> locker(lock);
+  return vars.emplace(key, std::move(decl)).first->second;
+}
+
 
 }  // namespace
 
@@ -153,6 +266,11 @@ TypeProvider::~TypeProvider(void) {}
 
 TypeProvider::TypeProvider(llvm::LLVMContext &context_) : context(context_) {}
 
+// Returns `true` if a function starts at address `address`.
+bool TypeProvider::IsFunctionHead(uint64_t address) {
+  return TryGetFunctionType(address) != nullptr;
+}
+
 // Try to get the type of the register named `reg_name` on entry to the
 // instruction at `inst_address` inside the function beginning at
 // `func_address`.
@@ -174,4 +292,12 @@ TypeProvider::CreateNullTypeProvider(llvm::LLVMContext &context_) {
   return std::make_shared<NullTypeProvider>(context_);
 }
 
+// Creates a type provider that remembers the answers of `inner`.
+std::shared_ptr<TypeProvider>
+TypeProvider::CreateCachingTypeProvider(std::shared_ptr<TypeProvider> inner) {
+  auto &inner_context = inner->context;
+  return std::make_shared<CachingTypeProvider>(inner_context,
+                                               std::move(inner));
+}
+
 }  // namespace anvill
@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "anvill/Trace.h"
+
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/IR/Function.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/Threading.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <system_error>
+
+namespace anvill {
+
+Tracer::Tracer(uint64_t (*count_allocations_)(void))
+    : Tracer(count_allocations_, nullptr, true) {}
+
+Tracer::Tracer(uint64_t (*count_allocations_)(void), TraceObserver observer_,
+               bool keep_events_)
+    : start(std::chrono::steady_clock::now()),
+      count_allocations(count_allocations_),
+      observer(std::move(observer_)),
+      keep_events(keep_events_) {}
+
+// Record `event`.
+void Tracer::Record(TraceEvent event) {
+  if (observer) {
+    observer(event);
+  }
+  if (keep_events) {
+    std::lock_guard<std::mutex> locker(events_lock);
+    events.emplace_back(std::move(event));
+  }
+}
+
+// Returns the number of microseconds since the tracer was created.
+uint64_t Tracer::Now(void) const {
+  return static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - start)
+          .count());
+}
+
+// Returns the number of allocations made so far by the calling thread, if
+// known.
+std::optional<uint64_t> Tracer::Allocations(void) const {
+  if (count_allocations) {
+    return count_allocations();
+  } else {
+    return std::nullopt;
+  }
+}
+
+// Returns a copy of the events recorded so far.
+std::vector<TraceEvent> Tracer::Events(void) const {
+  std::lock_guard<std::mutex> locker(events_lock);
+  return events;
+}
+
+// Write the recorded events to `path`, in the Chrome trace event format
+// understood by `chrome://tracing` and Perfetto.
+llvm::Error Tracer::WriteChromeTrace(const std::string &path) const {
+  std::error_code ec;
+  llvm::raw_fd_ostream os(path, ec, llvm::sys::fs::OF_Text);
+  if (ec) {
+    return llvm::createStringError(
+        ec, "Unable to open trace file '%s' for writing: %s", path.c_str(),
+        ec.message().c_str());
+  }
+
+  std::lock_guard<std::mutex> locker(events_lock);
+  llvm::json::OStream json(os);
+  json.object([&] {
+    json.attribute("displayTimeUnit", "ms");
+    json.attributeArray("traceEvents", [&] {
+      for (const auto &event : events) {
+        json.object([&] {
+          json.attribute("name", event.name);
+          json.attribute("cat", event.category);
+          json.attribute("ph", "X");
+          json.attribute("pid", 1);
+          json.attribute("tid", static_cast<int64_t>(event.thread_id));
+          json.attribute("ts", static_cast<int64_t>(event.start_us));
+          json.attribute("dur", static_cast<int64_t>(event.duration_us));
+          json.attributeObject("args", [&] {
+            if (!event.function.empty()) {
+              json.attribute("function", event.function);
+            }
+            if (event.address) {
+              json.attribute("address", llvm::utohexstr(*event.address));
+            }
+            json.attribute("instructions_before",
+                           static_cast<int64_t>(event.instructions_before));
+            json.attribute("instructions_after",
+                           static_cast<int64_t>(event.instructions_after));
+            if (event.allocations) {
+              json.attribute("allocations",
+                             static_cast<int64_t>(*event.allocations));
+            }
+            for (const auto &[name, value] : event.counters) {
+              json.attribute(name, static_cast<int64_t>(value));
+            }
+          });
+        });
+      }
+    });
+  });
+  os << '\n';
+
+  if (os.has_error()) {
+    return llvm::createStringError(os.error(),
+                                   "Unable to write trace file '%s'",
+                                   path.c_str());
+  }
+
+  return llvm::Error::success();
+}
+
+TraceScope::TraceScope(Tracer *tracer_, llvm::StringRef name,
+                       llvm::StringRef category, const llvm::Function *func_,
+                       std::optional<uint64_t> address)
+    : tracer(tracer_),
+      func(func_) {
+  if (!tracer) {
+    return;
+  }
+
+  event.name = name.str();
+  event.category = category.str();
+  event.address = address;
+  if (func) {
+    event.function = func->getName().str();
+    event.instructions_before = func->getInstructionCount();
+  }
+  event.thread_id = llvm::get_threadid();
+  event.allocations = tracer->Allocations();
+  event.start_us = tracer->Now();
+}
+
+TraceScope::~TraceScope(void) {
+  if (!tracer) {
+    return;
+  }
+
+  Stop();
+  tracer->Record(std::move(event));
+}
+
+// Stop timing the event.
+void TraceScope::Stop(void) {
+  if (!tracer || stopped) {
+    return;
+  }
+
+  stopped = true;
+  event.duration_us = tracer->Now() - event.start_us;
+  if (func) {
+    event.instructions_after = func->getInstructionCount();
+  }
+  if (event.allocations) {
+    event.allocations = *tracer->Allocations() - *event.allocations;
+  }
+}
+
+// Add a named counter to the event.
+void TraceScope::AddCounter(llvm::StringRef name, uint64_t value) {
+  if (tracer) {
+    event.counters.emplace_back(name.str(), value);
+  }
+}
+
+}  // namespace anvill
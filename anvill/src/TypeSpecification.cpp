@@ -25,8 +25,11 @@
 // clang-format on
 
 #include <glog/logging.h>
+#include <llvm/ADT/StringMap.h>
 #include <remill/BC/Util.h>
+#include <remill/BC/Version.h>
 
+#include <mutex>
 #include <sstream>
 #include <unordered_map>
 
@@ -241,10 +244,93 @@ TranslateTypeInternal(llvm::Type &type, std::stringstream &ss,
   }
 }
 
+// A previously parsed type specification.
+struct InternedSpec {
+  llvm::Type *type{nullptr};
+  bool sized{false};
+  std::string description;
+};
+
+// The type specifications parsed in a single LLVM context.
+struct InternedSpecs {
+
+  // An opaque structure type that we create in the LLVM context. Contexts
+  // are identified by their addresses, so if we find that this type isn't
+  // in the context at an address, then the context we saw at that address
+  // is dead, and `specs` is stale.
+  llvm::StructType *sentinel{nullptr};
+
+  llvm::StringMap<InternedSpec> specs;
+};
+
+static constexpr auto kInternedSpecsSentinelName = "anvill.interned_specs";
+
+// Type specifications are re-parsed from scratch each time, but real specs
+// repeat the same few type strings over and over, so we intern the parses,
+// per LLVM context. Specs are parsed concurrently in different contexts,
+// hence the lock.
+static std::mutex gInternedSpecsLock;
+static std::unordered_map<llvm::LLVMContext *, InternedSpecs> gInternedSpecs;
+
+// Returns the interned specs for `llvm_context`, if any, while holding
+// `gInternedSpecsLock`.
+static InternedSpecs *GetInternedSpecs(llvm::LLVMContext &llvm_context) {
+#if LLVM_VERSION_NUMBER < LLVM_VERSION(12, 0)
+  (void) llvm_context;
+  return nullptr;
+#else
+  auto &interned = gInternedSpecs[&llvm_context];
+  auto sentinel =
+      llvm::StructType::getTypeByName(llvm_context, kInternedSpecsSentinelName);
+  if (!sentinel || sentinel != interned.sentinel) {
+    interned.specs.clear();
+    interned.sentinel =
+        sentinel ? sentinel
+                 : llvm::StructType::create(llvm_context,
+                                            kInternedSpecsSentinelName);
+  }
+  return &interned;
+#endif
+}
+
 }  // namespace
 
 TypeSpecification::~TypeSpecification(void) {}
 
+// Look for a previous parse of `spec` in `llvm_context`.
+bool TypeSpecification::FindInternedSpec(llvm::LLVMContext &llvm_context,
+                                         llvm::StringRef spec,
+                                         Context &context) {
+  std::lock_guard<std::mutex> locker(gInternedSpecsLock);
+  const auto interned = GetInternedSpecs(llvm_context);
+  if (!interned) {
+    return false;
+  }
+
+  const auto it = interned->specs.find(spec);
+  if (it == interned->specs.end()) {
+    return false;
+  }
+
+  context.type = it->second.type;
+  context.sized = it->second.sized;
+  context.spec = spec.str();
+  context.description = it->second.description;
+  return true;
+}
+
+// Remember `context`, the parse of `context.spec` in `llvm_context`.
+void TypeSpecification::InternSpec(llvm::LLVMContext &llvm_context,
+                                   const Context &context) {
+  std::lock_guard<std::mutex> locker(gInternedSpecsLock);
+  if (const auto interned = GetInternedSpecs(llvm_context)) {
+    auto &spec = interned->specs[context.spec];
+    spec.type = context.type;
+    spec.sized = context.sized;
+    spec.description = context.description;
+  }
+}
+
 llvm::Type *TypeSpecification::Type(void) const {
   return context.type;
 }
@@ -261,15 +347,8 @@ const std::string &TypeSpecification::Description(void) const {
   return context.description;
 }
 
-TypeSpecification::TypeSpecification(llvm::LLVMContext &llvm_context,
-                                     llvm::StringRef spec) {
-  auto context_res = ParseSpec(llvm_context, spec);
-  if (!context_res.Succeeded()) {
-    throw context_res.TakeError();
-  }
-
-  context = context_res.TakeValue();
-}
+TypeSpecification::TypeSpecification(Context context_)
+    : context(std::move(context_)) {}
 
 TypeSpecificationError
 TypeSpecification::CreateError(const std::string &spec,
@@ -780,8 +859,23 @@ TypeSpecification::ParseSpec(llvm::LLVMContext &llvm_context,
 Result<ITypeSpecification::Ptr, TypeSpecificationError>
 ITypeSpecification::Create(llvm::LLVMContext &llvm_context,
                            llvm::StringRef spec) {
+  using Context = TypeSpecification::Context;
+
+  // Parse errors are returned rather than thrown, as specs can have lots of
+  // them, and unwinding is much slower than returning.
   try {
-    return Ptr(new TypeSpecification(llvm_context, spec));
+    Context context;
+    if (!TypeSpecification::FindInternedSpec(llvm_context, spec, context)) {
+      auto context_res = TypeSpecification::ParseSpec(llvm_context, spec);
+      if (!context_res.Succeeded()) {
+        return context_res.TakeError();
+      }
+
+      context = context_res.TakeValue();
+      TypeSpecification::InternSpec(llvm_context, context);
+    }
+
+    return Ptr(new TypeSpecification(std::move(context)));
 
   } catch (const std::bad_alloc &) {
     TypeSpecificationError error;
@@ -789,9 +883,6 @@ ITypeSpecification::Create(llvm::LLVMContext &llvm_context,
         TypeSpecificationError::ErrorCode::MemoryAllocationFailure;
 
     return error;
-
-  } catch (const TypeSpecificationError &error) {
-    return error;
   }
 }
 
@@ -25,7 +25,8 @@
 #include <remill/BC/Compat/Error.h>
 #include <remill/BC/Compat/VectorType.h>
 
-#include <sstream>
+#include <charconv>
+#include <system_error>
 #include <vector>
 
 namespace anvill {
@@ -50,7 +51,16 @@ class TypeSpecification final : public ITypeSpecification {
 
   Context context;
 
-  TypeSpecification(llvm::LLVMContext &llvm_context, llvm::StringRef spec);
+  explicit TypeSpecification(Context context_);
+
+  // Look for a previous parse of `spec` in `llvm_context`, and if found,
+  // then fill in `context` with it.
+  static bool FindInternedSpec(llvm::LLVMContext &llvm_context,
+                               llvm::StringRef spec, Context &context);
+
+  // Remember `context`, the parse of `context.spec` in `llvm_context`.
+  static void InternSpec(llvm::LLVMContext &llvm_context,
+                         const Context &context);
 
   friend class ITypeSpecification;
 
@@ -82,25 +92,18 @@ class TypeSpecification final : public ITypeSpecification {
 template <typename Filter, typename T>
 bool TypeSpecification::Parse(llvm::StringRef spec, size_t &i, Filter filter,
                               T *out) {
-  std::stringstream ss;
-
-  auto found = false;
-  for (; i < spec.size(); ++i) {
-    if (filter(spec[i])) {
-      ss << spec[i];
-      found = true;
-
-    } else {
-      break;
-    }
+  const auto begin = i;
+  while (i < spec.size() && filter(spec[i])) {
+    ++i;
   }
 
-  if (!found) {
+  if (begin == i) {
     return false;
   }
 
-  ss >> *out;
-  return !ss.bad();
+  const auto [end, ec] =
+      std::from_chars(spec.data() + begin, spec.data() + i, *out);
+  return ec == std::errc() && end == (spec.data() + i);
 }
 
 }  // namespace anvill
@@ -17,8 +17,12 @@
 
 #include "anvill/Util.h"
 
+#include <anvill/Program.h>
+#include <llvm/IR/Function.h>
 #include <llvm/IR/Instruction.h>
+#include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/Instructions.h>
+#include <remill/Arch/Arch.h>
 
 #include <sstream>
 
@@ -64,4 +68,64 @@ std::string CreateVariableName(uint64_t addr) {
   ss << "data_" << std::hex << addr;
   return ss.str();
 }
+
+// Replace the body of `to` with the body of `from`, then delete `from`.
+void MoveFunctionBody(llvm::Function *from, llvm::Function *to) {
+  for (auto &block : *to) {
+    block.dropAllReferences();
+  }
+  while (!to->empty()) {
+    to->begin()->eraseFromParent();
+  }
+
+  to->getBasicBlockList().splice(to->end(), from->getBasicBlockList());
+
+  auto to_arg = to->arg_begin();
+  for (auto &from_arg : from->args()) {
+    from_arg.replaceAllUsesWith(&*to_arg++);
+  }
+
+  to->setAttributes(from->getAttributes());
+  from->replaceAllUsesWith(to);
+  from->eraseFromParent();
+}
+
+// Clear out the names of the basic blocks and instructions of `func`.
+void ClearVariableNames(llvm::Function *func) {
+  for (auto &block : *func) {
+    block.setName(llvm::Twine::createNull());
+    for (auto &inst : block) {
+      if (inst.hasName()) {
+        inst.setName(llvm::Twine::createNull());
+      }
+    }
+  }
+}
+
+// Read up to `max_size` executable bytes of `program`, starting at `ea`.
+std::string ReadExecutableBytes(const Program &program, uint64_t ea,
+                                uint64_t max_size) {
+  std::string bytes;
+  for (auto seq = program.FindBytes(ea, max_size); seq && seq.IsExecutable();
+       seq = program.FindNextBytes(seq, max_size - bytes.size())) {
+    const auto data = seq.ToString();
+    bytes.append(data.data(), data.size());
+  }
+  return bytes;
+}
+
+// Returns a pointer to `reg` in the `State` structure pointed to by
+// `state_ptr`.
+llvm::Value *StateRegisterAddress(llvm::IRBuilderBase &ir,
+                                  llvm::Value *state_ptr,
+                                  const remill::Register *reg) {
+  const auto addr_space = state_ptr->getType()->getPointerAddressSpace();
+  const auto byte_ptr =
+      ir.CreateBitCast(state_ptr, ir.getInt8PtrTy(addr_space));
+  const auto reg_ptr =
+      ir.CreateConstInBoundsGEP1_64(ir.getInt8Ty(), byte_ptr, reg->offset);
+  return ir.CreateBitCast(reg_ptr,
+                          llvm::PointerType::get(reg->type, addr_space));
+}
+
 }  // namespace anvill
@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <anvill/BinaryImage.h>
+#include <anvill/Program.h>
+#include <doctest.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/BinaryFormat/ELF.h>
+#include <llvm/Support/Endian.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace anvill {
+
+namespace {
+
+static bool Succeeded(llvm::Error err) {
+  if (err) {
+    llvm::consumeError(std::move(err));
+    return false;
+  }
+  return true;
+}
+
+template <typename T>
+static void Put(std::vector<uint8_t> &file, uint64_t offset, T val) {
+  llvm::support::endian::write<T>(&(file[offset]), val, llvm::support::little);
+}
+
+static void PutSegment(std::vector<uint8_t> &file, uint64_t phdr,
+                       uint32_t type, uint32_t flags, uint64_t offset,
+                       uint64_t address, uint64_t file_size, uint64_t size) {
+  Put<uint32_t>(file, phdr, type);
+  Put<uint32_t>(file, phdr + 4u, flags);
+  Put<uint64_t>(file, phdr + 8u, offset);
+  Put<uint64_t>(file, phdr + 16u, address);
+  Put<uint64_t>(file, phdr + 24u, address);
+  Put<uint64_t>(file, phdr + 32u, file_size);
+  Put<uint64_t>(file, phdr + 40u, size);
+  Put<uint64_t>(file, phdr + 48u, 0x1000u);
+}
+
+// Make a little-endian, 64-bit ELF file with a code segment, a note segment,
+// and a data segment whose tail is zero-filled.
+static std::vector<uint8_t> MakeELF(void) {
+  std::vector<uint8_t> file(0x118u);
+  file[0] = 0x7f;
+  file[1] = 'E';
+  file[2] = 'L';
+  file[3] = 'F';
+  file[llvm::ELF::EI_CLASS] = llvm::ELF::ELFCLASS64;
+  file[llvm::ELF::EI_DATA] = llvm::ELF::ELFDATA2LSB;
+  file[llvm::ELF::EI_VERSION] = llvm::ELF::EV_CURRENT;
+  Put<uint16_t>(file, 16u, llvm::ELF::ET_EXEC);
+  Put<uint16_t>(file, 18u, llvm::ELF::EM_X86_64);
+  Put<uint64_t>(file, 32u, 64u);  // `e_phoff`.
+  Put<uint16_t>(file, 52u, 64u);  // `e_ehsize`.
+  Put<uint16_t>(file, 54u, 56u);  // `e_phentsize`.
+  Put<uint16_t>(file, 56u, 3u);  // `e_phnum`.
+
+  PutSegment(file, 64u, llvm::ELF::PT_LOAD,
+             llvm::ELF::PF_R | llvm::ELF::PF_X, 0x100u, 0x400000u, 0x10u,
+             0x10u);
+  PutSegment(file, 120u, llvm::ELF::PT_NOTE, llvm::ELF::PF_R, 0x100u,
+             0x400000u, 0x10u, 0x10u);
+  PutSegment(file, 176u, llvm::ELF::PT_LOAD,
+             llvm::ELF::PF_R | llvm::ELF::PF_W, 0x110u, 0x600000u, 0x8u,
+             0x1000u);
+
+  for (auto i = 0x100u; i < file.size(); ++i) {
+    file[i] = static_cast<uint8_t>(i);
+  }
+  return file;
+}
+
+static std::string WriteTemporaryFile(const std::vector<uint8_t> &data) {
+  llvm::SmallString<128> path;
+  int fd = -1;
+  REQUIRE(!llvm::sys::fs::createTemporaryFile("anvill", "elf", fd, path));
+  llvm::raw_fd_ostream os(fd, true);
+  os.write(reinterpret_cast<const char *>(data.data()), data.size());
+  return path.str().str();
+}
+
+}  // namespace
+
+TEST_SUITE("BinaryImage") {
+  TEST_CASE("ELF segments are mapped into a program") {
+    const auto path = WriteTemporaryFile(MakeELF());
+
+    auto maybe_image = BinaryImage::Read(path);
+    REQUIRE(maybe_image);
+    const auto &image = *maybe_image;
+    REQUIRE(image.segments.size() == 2u);
+    CHECK(image.segments[0].address == 0x400000u);
+    CHECK(image.segments[0].is_executable);
+    CHECK(!image.segments[0].is_writeable);
+    CHECK(image.segments[1].address == 0x600000u);
+    CHECK(image.segments[1].file_size == 0x8u);
+    CHECK(image.segments[1].size == 0x1000u);
+    CHECK(image.segments[1].is_writeable);
+
+    Program program;
+    REQUIRE(Succeeded(image.MapMemory(program)));
+
+    auto byte = program.FindByte(0x400001u);
+    REQUIRE(byte);
+    CHECK(byte.ValueOr(0u) == 0x01u);
+    CHECK(byte.IsExecutable());
+
+    byte = program.FindByte(0x600007u);
+    REQUIRE(byte);
+    CHECK(byte.ValueOr(0u) == 0x17u);
+    CHECK(byte.IsWriteable());
+
+    // The tail of the data segment isn't in the file.
+    byte = program.FindByte(0x600fffu);
+    REQUIRE(byte);
+    CHECK(byte.ValueOr(0xffu) == 0u);
+    CHECK(byte.IsWriteable());
+
+    CHECK(!program.FindByte(0x601000u));
+
+    llvm::sys::fs::remove(path);
+  }
+
+  TEST_CASE("Truncated segments are rejected") {
+    auto file = MakeELF();
+    file.resize(0x110u);
+    const auto path = WriteTemporaryFile(file);
+
+    auto maybe_image = BinaryImage::Read(path);
+    CHECK(!Succeeded(maybe_image.takeError()));
+
+    llvm::sys::fs::remove(path);
+  }
+
+  TEST_CASE("Non-ELF files are rejected") {
+    const auto path = WriteTemporaryFile({'M', 'Z', 0u, 0u});
+
+    auto maybe_image = BinaryImage::Read(path);
+    CHECK(!Succeeded(maybe_image.takeError()));
+
+    llvm::sys::fs::remove(path);
+  }
+}
+
+}  // namespace anvill
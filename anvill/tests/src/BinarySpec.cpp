@@ -0,0 +1,286 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <anvill/BinarySpec.h>
+#include <anvill/Decl.h>
+#include <anvill/Lifters/EntityLifter.h>
+#include <anvill/Lifters/Options.h>
+#include <anvill/Program.h>
+#include <doctest.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/raw_ostream.h>
+#include <remill/Arch/Arch.h>
+#include <remill/Arch/Name.h>
+#include <remill/OS/OS.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace anvill {
+
+namespace {
+
+static bool Succeeded(llvm::Error err) {
+  if (err) {
+    llvm::consumeError(std::move(err));
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+TEST_SUITE("BinarySpec") {
+  TEST_CASE("Specs round-trip through a file") {
+    llvm::SmallString<128> path;
+    REQUIRE(!llvm::sys::fs::createTemporaryFile("anvill", "spec", path));
+    const std::string path_str = path.str().str();
+
+    BinarySpec spec;
+    spec.arch = "amd64";
+    spec.os = "linux";
+
+    auto &func = spec.functions.emplace_back();
+    func.address = 0x1000;
+    func.return_address.mem_reg = "RSP";
+    func.return_stack_pointer = "RSP";
+    func.return_stack_pointer_offset = 8;
+    func.is_noreturn = true;
+    auto &param = func.params.emplace_back();
+    param.name = "x";
+    param.type = "i";
+    param.reg = "RDI";
+    auto &ret = func.returns.emplace_back();
+    ret.type = "i";
+    ret.reg = "RAX";
+
+    auto &var = spec.variables.emplace_back();
+    var.address = 0x2000;
+    var.type = "i";
+
+    spec.control_flow_redirections.emplace_back(0x1000, 0x1004);
+    auto &targets = spec.control_flow_targets.emplace_back();
+    targets.source = 0x1008;
+    targets.complete = true;
+    targets.destinations = {0x1010, 0x1020};
+
+    auto &sym = spec.symbols.emplace_back();
+    sym.address = 0x1000;
+    sym.name = "main";
+
+    auto &code = spec.memory.emplace_back();
+    code.address = 0x1000;
+    code.is_executable = true;
+    code.data = {0x31, 0xc0, 0xc3};
+
+    auto &data = spec.memory.emplace_back();
+    data.address = 0x2000;
+    data.is_writeable = true;
+    data.data = {1, 2, 3, 4};
+
+    auto &bss = spec.memory.emplace_back();
+    bss.address = 0x3000;
+    bss.is_writeable = true;
+    bss.is_zero_fill = true;
+    bss.size = 0x10000;
+
+    REQUIRE(Succeeded(spec.Write(path_str)));
+
+    auto maybe_read = BinarySpec::Read(path_str);
+    REQUIRE(Succeeded(maybe_read.takeError()));
+    BinarySpec read = std::move(*maybe_read);
+
+    CHECK(read.arch == "amd64");
+    CHECK(read.os == "linux");
+
+    REQUIRE(read.functions.size() == 1u);
+    CHECK(read.functions[0].address == 0x1000);
+    CHECK(read.functions[0].type.empty());
+    CHECK(read.functions[0].return_address.mem_reg == "RSP");
+    CHECK(read.functions[0].return_stack_pointer_offset == 8);
+    CHECK(read.functions[0].is_noreturn);
+    CHECK(!read.functions[0].is_variadic);
+    REQUIRE(read.functions[0].params.size() == 1u);
+    CHECK(read.functions[0].params[0].name == "x");
+    CHECK(read.functions[0].params[0].reg == "RDI");
+    REQUIRE(read.functions[0].returns.size() == 1u);
+    CHECK(read.functions[0].returns[0].reg == "RAX");
+
+    REQUIRE(read.variables.size() == 1u);
+    CHECK(read.variables[0].type == "i");
+
+    REQUIRE(read.control_flow_redirections.size() == 1u);
+    CHECK(read.control_flow_redirections[0].second == 0x1004);
+    REQUIRE(read.control_flow_targets.size() == 1u);
+    CHECK(read.control_flow_targets[0].complete);
+    CHECK(read.control_flow_targets[0].destinations.size() == 2u);
+    REQUIRE(read.symbols.size() == 1u);
+    CHECK(read.symbols[0].name == "main");
+
+    // Range data is mapped from the spec file, rather than being read.
+    REQUIRE(read.memory.size() == 3u);
+    CHECK(read.memory[0].data.empty());
+    CHECK(read.memory[0].size == 3u);
+    CHECK((read.memory[0].file_offset % 4096u) == 0u);
+
+    Program program;
+    REQUIRE(Succeeded(read.MapMemory(program)));
+
+    auto byte = program.FindByte(0x1002);
+    REQUIRE(byte);
+    CHECK(byte.ValueOr(0) == 0xc3);
+    CHECK(byte.IsExecutable());
+
+    byte = program.FindByte(0x2003);
+    REQUIRE(byte);
+    CHECK(byte.ValueOr(0) == 4);
+    CHECK(byte.IsWriteable());
+
+    // Zero-fill ranges take up no space in the spec file.
+    CHECK(read.memory[2].is_zero_fill);
+    CHECK(read.memory[2].size == 0x10000u);
+    uint64_t file_size = 0;
+    REQUIRE(!llvm::sys::fs::file_size(path_str, file_size));
+    CHECK(file_size < 0x10000u);
+
+    byte = program.FindByte(0x3000 + 0xffff);
+    REQUIRE(byte);
+    CHECK(byte.ValueOr(0xff) == 0u);
+    CHECK(byte.IsWriteable());
+
+    llvm::sys::fs::remove(path);
+  }
+
+  TEST_CASE("Programs round-trip through snapshots") {
+    llvm::LLVMContext context;
+    llvm::Module module("snapshot", context);
+    auto arch = remill::Arch::Build(&context, remill::GetOSName("linux"),
+                                    remill::GetArchName("amd64"));
+    REQUIRE(arch != nullptr);
+
+    // Loads the semantics, and thus the register information that declaring
+    // functions needs.
+    LifterOptions options(arch.get(), module, nullptr);
+    EntityLifter lifter(options, nullptr, nullptr);
+
+    Program program;
+    REQUIRE(Succeeded(program.MapRange(0x1000u, {0x31, 0xc0, 0xc3}, false,
+                                       true)));
+    REQUIRE(Succeeded(program.MapZeroRange(0x3000u, 0x10000u, true, false)));
+
+    const auto i32_type = llvm::Type::getInt32Ty(context);
+    FunctionDecl tpl;
+    tpl.arch = arch.get();
+    tpl.address = 0x1000u;
+    tpl.return_address.mem_reg = arch->RegisterByName("RSP");
+    tpl.return_address.type = llvm::Type::getInt64Ty(context);
+    tpl.return_stack_pointer = arch->RegisterByName("RSP");
+    tpl.return_stack_pointer_offset = 8;
+    auto &param = tpl.params.emplace_back();
+    param.name = "x";
+    param.reg = arch->RegisterByName("EDI");
+    param.type = i32_type;
+    auto &ret = tpl.returns.emplace_back();
+    ret.reg = arch->RegisterByName("EAX");
+    ret.type = i32_type;
+    REQUIRE(Succeeded(program.DeclareFunction(tpl).takeError()));
+
+    GlobalVarDecl var;
+    var.address = 0x3000u;
+    var.type = i32_type;
+    REQUIRE(Succeeded(program.DeclareVariable(var)));
+
+    program.AddControlFlowRedirection(0x1000u, 0x1002u);
+    ControlFlowTargetList targets;
+    targets.source = 0x1001u;
+    targets.destination_list = {0x1002u};
+    REQUIRE(program.TrySetControlFlowTargets(targets));
+    program.AddNameToAddress("main", 0x1000u);
+    program.Freeze(module.getDataLayout());
+
+    llvm::SmallString<128> path;
+    REQUIRE(!llvm::sys::fs::createTemporaryFile("anvill", "spec", path));
+    const std::string path_str = path.str().str();
+
+    auto snapshot = BinarySpec::Snapshot(program, module.getDataLayout());
+    REQUIRE(Succeeded(snapshot.Write(path_str)));
+
+    auto maybe_read = BinarySpec::Read(path_str);
+    REQUIRE(Succeeded(maybe_read.takeError()));
+    BinarySpec read = std::move(*maybe_read);
+
+    REQUIRE(read.functions.size() == 1u);
+    CHECK(read.functions[0].address == 0x1000u);
+    CHECK(read.functions[0].type.empty());
+    CHECK(read.functions[0].return_address.mem_reg == "RSP");
+    CHECK(read.functions[0].return_stack_pointer == "RSP");
+    CHECK(read.functions[0].return_stack_pointer_offset == 8);
+    REQUIRE(read.functions[0].params.size() == 1u);
+    CHECK(read.functions[0].params[0].name == "x");
+    CHECK(read.functions[0].params[0].reg == "EDI");
+    CHECK(read.functions[0].params[0].type == "i");
+    REQUIRE(read.functions[0].returns.size() == 1u);
+    CHECK(read.functions[0].returns[0].reg == "EAX");
+
+    REQUIRE(read.variables.size() == 1u);
+    CHECK(read.variables[0].address == 0x3000u);
+    CHECK(read.variables[0].type == "i");
+
+    REQUIRE(read.control_flow_redirections.size() == 1u);
+    CHECK(read.control_flow_redirections[0].second == 0x1002u);
+    REQUIRE(read.control_flow_targets.size() == 1u);
+    CHECK(read.control_flow_targets[0].source == 0x1001u);
+    REQUIRE(read.symbols.size() == 1u);
+    CHECK(read.symbols[0].name == "main");
+
+    REQUIRE(read.memory.size() == 2u);
+    CHECK(read.memory[1].is_zero_fill);
+
+    Program reloaded;
+    REQUIRE(Succeeded(read.MapMemory(reloaded)));
+    auto byte = reloaded.FindByte(0x1002u);
+    REQUIRE(byte);
+    CHECK(byte.ValueOr(0) == 0xc3);
+    CHECK(byte.IsExecutable());
+    byte = reloaded.FindByte(0x3000u + 0xffffu);
+    REQUIRE(byte);
+    CHECK(byte.IsWriteable());
+
+    llvm::sys::fs::remove(path);
+  }
+
+  TEST_CASE("Non-spec files are rejected") {
+    llvm::SmallString<128> path;
+    int fd = -1;
+    REQUIRE(!llvm::sys::fs::createTemporaryFile("anvill", "spec", fd, path));
+    {
+      llvm::raw_fd_ostream os(fd, true);
+      os << "{\"arch\": \"amd64\"}";
+    }
+
+    auto maybe_read = BinarySpec::Read(path.str().str());
+    CHECK(!Succeeded(maybe_read.takeError()));
+
+    llvm::sys::fs::remove(path);
+  }
+}
+
+}  // namespace anvill
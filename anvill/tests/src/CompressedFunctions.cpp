@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <anvill/CompressedFunctions.h>
+#include <doctest.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <string>
+
+namespace anvill {
+
+namespace {
+
+static bool Succeeded(llvm::Error err) {
+  if (err) {
+    llvm::consumeError(std::move(err));
+    return false;
+  }
+  return true;
+}
+
+static std::string PrintFunction(const llvm::Function &func) {
+  std::string ir;
+  llvm::raw_string_ostream os(ir);
+  func.print(os);
+  return os.str();
+}
+
+// Define `sub_1000` in `module`, which stores its argument into a frame of
+// type `frame_type`, and returns the result of calling `sub_2000` on the sum
+// of the value of `var` and the stored argument.
+static llvm::Function *DefineFunction(llvm::Module &module,
+                                      llvm::GlobalVariable *var,
+                                      llvm::StructType *frame_type) {
+  auto &context = module.getContext();
+  auto i32_type = llvm::Type::getInt32Ty(context);
+  auto func_type = llvm::FunctionType::get(i32_type, {i32_type}, false);
+  auto callee = llvm::Function::Create(
+      func_type, llvm::GlobalValue::ExternalLinkage, "sub_2000", module);
+  auto func = llvm::Function::Create(
+      func_type, llvm::GlobalValue::ExternalLinkage, "sub_1000", module);
+
+  llvm::IRBuilder<> ir(llvm::BasicBlock::Create(context, "", func));
+  auto frame = ir.CreateAlloca(frame_type);
+  auto slot = ir.CreateStructGEP(frame_type, frame, 0);
+  ir.CreateStore(&*func->arg_begin(), slot);
+  auto val = ir.CreateLoad(i32_type, var);
+  auto sum = ir.CreateAdd(val, ir.CreateLoad(i32_type, slot));
+  ir.CreateRet(ir.CreateCall(callee, {sum}));
+  return func;
+}
+
+}  // namespace
+
+TEST_SUITE("CompressedFunctions") {
+  TEST_CASE("Compressed functions are materialized on demand") {
+    llvm::LLVMContext context;
+    llvm::Module module("lifted_code", context);
+    auto i32_type = llvm::Type::getInt32Ty(context);
+    auto var = new llvm::GlobalVariable(module, i32_type, false,
+                                        llvm::GlobalValue::ExternalLinkage,
+                                        nullptr, "data_3000");
+    auto frame_type =
+        llvm::StructType::create(context, {i32_type, i32_type}, "frame");
+    auto func = DefineFunction(module, var, frame_type);
+    const auto ir = PrintFunction(*func);
+
+    CompressedFunctions compressed(module);
+    REQUIRE(compressed.Compress(*func));
+    CHECK(compressed.NumFunctions() == 1u);
+    CHECK(compressed.NumCompressedBytes() > 0u);
+    CHECK(func->isMaterializable());
+    CHECK(!func->isDeclaration());
+    CHECK(func->empty());
+    CHECK(var->use_empty());
+
+    // Compressing it again does nothing.
+    CHECK(!compressed.Compress(*func));
+
+    // The body comes back into the same function, referring to the same
+    // variable, callee, and types, e.g. when the module is materialized.
+    REQUIRE(Succeeded(func->materialize()));
+    CHECK(!func->isMaterializable());
+    CHECK(module.getFunction("sub_1000") == func);
+    CHECK(!module.getFunction("sub_1000.anvill.compressed"));
+    CHECK(!var->use_empty());
+    CHECK(PrintFunction(*func) == ir);
+    CHECK(compressed.NumFunctions() == 0u);
+    CHECK(compressed.NumCompressedBytes() == 0u);
+
+    // Once compressed again, materializing the module brings it back, and
+    // then the module is left without a materializer.
+    REQUIRE(compressed.Compress(*func));
+    REQUIRE(Succeeded(module.materializeAll()));
+    CHECK(module.isMaterialized());
+    CHECK(PrintFunction(*func) == ir);
+    CHECK(!llvm::verifyModule(module, &llvm::errs()));
+  }
+
+  TEST_CASE("Functions that refer to local things aren't compressed") {
+    llvm::LLVMContext context;
+    llvm::Module module("lifted_code", context);
+    auto i32_type = llvm::Type::getInt32Ty(context);
+    auto var = new llvm::GlobalVariable(
+        module, i32_type, false, llvm::GlobalValue::InternalLinkage,
+        llvm::Constant::getNullValue(i32_type), "data_3000");
+    auto frame_type =
+        llvm::StructType::create(context, {i32_type, i32_type}, "frame");
+    auto func = DefineFunction(module, var, frame_type);
+
+    CompressedFunctions compressed(module);
+    CHECK(!compressed.Compress(*func));
+    CHECK(!func->isMaterializable());
+    CHECK(!func->empty());
+    CHECK(module.isMaterialized());
+    CHECK(Succeeded(compressed.MaterializeAll()));
+  }
+}
+
+}  // namespace anvill
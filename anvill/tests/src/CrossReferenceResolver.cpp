@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <anvill/Analysis/CrossReferenceResolver.h>
+#include <doctest.h>
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+
+namespace anvill {
+
+TEST_SUITE("CrossReferenceResolver") {
+  TEST_CASE("Deep instruction chains are resolved") {
+    llvm::LLVMContext context;
+    llvm::Module module("xrefs", context);
+    auto i64_type = llvm::Type::getInt64Ty(context);
+    auto func_type = llvm::FunctionType::get(i64_type, false);
+    auto func = llvm::Function::Create(
+        func_type, llvm::GlobalValue::ExternalLinkage, "chain", &module);
+    auto block = llvm::BasicBlock::Create(context, "", func);
+    llvm::IRBuilder<> ir(block);
+
+    // Way deeper than a recursive resolver could handle on a small stack.
+    // The instructions are inserted directly, so that the builder doesn't
+    // constant fold them.
+    auto zero = llvm::ConstantInt::get(i64_type, 0);
+    auto one = llvm::ConstantInt::get(i64_type, 1);
+    llvm::Value *val = ir.Insert(llvm::BinaryOperator::CreateAdd(zero, zero));
+    for (auto i = 0u; i < 200000u; ++i) {
+      val = ir.Insert(llvm::BinaryOperator::CreateAdd(val, one));
+    }
+    ir.CreateRet(val);
+
+    CrossReferenceResolver resolver(module.getDataLayout());
+    auto xr = resolver.TryResolveReferenceWithClearedCache(val);
+    CHECK(xr.is_valid);
+    CHECK(xr.u.address == 200000u);
+  }
+
+  TEST_CASE("Cyclic instructions are not resolved") {
+    llvm::LLVMContext context;
+    llvm::Module module("xrefs", context);
+    auto i64_type = llvm::Type::getInt64Ty(context);
+    auto func_type = llvm::FunctionType::get(i64_type, false);
+    auto func = llvm::Function::Create(
+        func_type, llvm::GlobalValue::ExternalLinkage, "cycle", &module);
+    auto entry = llvm::BasicBlock::Create(context, "", func);
+    auto dead = llvm::BasicBlock::Create(context, "", func);
+    llvm::IRBuilder<> ir(entry);
+    ir.CreateRet(llvm::ConstantInt::get(i64_type, 0));
+
+    // Unreachable code is allowed to use itself.
+    ir.SetInsertPoint(dead);
+    auto one = llvm::ConstantInt::get(i64_type, 1);
+    auto add = ir.Insert(llvm::BinaryOperator::CreateAdd(one, one));
+    ir.CreateRet(add);
+    add->setOperand(0, add);
+
+    CrossReferenceResolver resolver(module.getDataLayout());
+    auto xr = resolver.TryResolveReferenceWithClearedCache(add);
+    CHECK(!xr.is_valid);
+  }
+}
+
+}  // namespace anvill
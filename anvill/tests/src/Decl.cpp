@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <anvill/Decl.h>
+#include <doctest.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <remill/Arch/Arch.h>
+#include <remill/Arch/Name.h>
+#include <remill/BC/Util.h>
+#include <remill/OS/OS.h>
+
+#include <vector>
+
+namespace anvill {
+
+TEST_SUITE("Decl") {
+  TEST_CASE("Typed registers are found by instruction address") {
+    FunctionDecl decl;
+    for (auto address : {0x10u, 0x10u, 0x14u, 0x20u}) {
+      auto &reg = decl.reg_info.emplace_back();
+      reg.address = address;
+      reg.reg = nullptr;
+      reg.type = nullptr;
+    }
+
+    CHECK(decl.RegisterInfoAt(0x10).size() == 2u);
+    CHECK(decl.RegisterInfoAt(0x14).size() == 1u);
+    CHECK(decl.RegisterInfoAt(0x20).front().address == 0x20u);
+    CHECK(decl.RegisterInfoAt(0x0).empty());
+    CHECK(decl.RegisterInfoAt(0x18).empty());
+    CHECK(decl.RegisterInfoAt(0x30).empty());
+  }
+
+  TEST_CASE("Scalar parameters are allocated in order on amd64") {
+    llvm::LLVMContext context;
+    auto arch = remill::Arch::Build(&context, remill::GetOSName("linux"),
+                                    remill::GetArchName("amd64"));
+    REQUIRE(arch != nullptr);
+
+    // Registers are only known once the semantics are loaded.
+    auto module = remill::LoadArchSemantics(arch.get());
+    REQUIRE(module != nullptr);
+
+    auto i32_type = llvm::Type::getInt32Ty(context);
+    auto i64_type = llvm::Type::getInt64Ty(context);
+    auto declare = [&](std::vector<llvm::Type *> param_types) {
+      auto func_type = llvm::FunctionType::get(i32_type, param_types, false);
+      auto func = llvm::Function::Create(
+          func_type, llvm::GlobalValue::ExternalLinkage, "", module.get());
+      auto maybe_decl = FunctionDecl::Create(*func, arch.get());
+      func->eraseFromParent();
+      if (!maybe_decl) {
+        FAIL(llvm::toString(maybe_decl.takeError()));
+      }
+      return std::move(maybe_decl.get());
+    };
+
+    // Integers and floats are counted separately.
+    auto decl = declare({i32_type, llvm::Type::getInt8PtrTy(context),
+                         llvm::Type::getDoubleTy(context), i64_type,
+                         llvm::Type::getFloatTy(context)});
+    REQUIRE(decl.params.size() == 5u);
+    const char *reg_names[] = {"EDI", "RSI", "XMM0", "RDX", "XMM1"};
+    for (auto i = 0u; i < 5u; ++i) {
+      CAPTURE(i);
+      REQUIRE(decl.params[i].reg != nullptr);
+      CHECK(decl.params[i].reg->name == reg_names[i]);
+      CHECK(decl.params[i].name == "param" + std::to_string(i));
+    }
+    CHECK(decl.returns.size() == 1u);
+
+    // The seventh integer goes on the stack, after the return address.
+    decl = declare(std::vector<llvm::Type *>(7u, i64_type));
+    REQUIRE(decl.params.size() == 7u);
+    CHECK(decl.params[5].reg->name == "R9");
+    CHECK(decl.params[6].reg == nullptr);
+    REQUIRE(decl.params[6].mem_reg != nullptr);
+    CHECK(decl.params[6].mem_reg->name == "RSP");
+    CHECK(decl.params[6].mem_offset == 8);
+
+    // Structures that fit are split over registers.
+    auto pair_type = llvm::StructType::get(context, {i64_type, i64_type});
+    decl = declare({i32_type, pair_type});
+    REQUIRE(decl.params.size() == 3u);
+    CHECK(decl.params[0].reg->name == "EDI");
+    CHECK(decl.params[1].reg->name == "RSI");
+    CHECK(decl.params[2].reg->name == "RDX");
+  }
+}
+
+}  // namespace anvill
@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <anvill/Decl.h>
+#include <anvill/DuplicateFunctions.h>
+#include <anvill/Lifters/EntityLifter.h>
+#include <anvill/Lifters/Options.h>
+#include <anvill/Program.h>
+#include <doctest.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#include <remill/Arch/Arch.h>
+#include <remill/Arch/Name.h>
+#include <remill/OS/OS.h>
+
+#include <cstring>
+#include <vector>
+
+namespace anvill {
+
+namespace {
+
+static bool Succeeded(llvm::Error err) {
+  if (err) {
+    llvm::consumeError(std::move(err));
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+TEST_SUITE("DuplicateFunctions") {
+  TEST_CASE("Position-independent copies of functions are duplicates") {
+    llvm::LLVMContext context;
+    llvm::Module module("dups", context);
+    auto arch = remill::Arch::Build(&context, remill::GetOSName("linux"),
+                                    remill::GetArchName("amd64"));
+    REQUIRE(arch != nullptr);
+
+    // Loads the semantics, and thus the register information that declaring
+    // functions needs.
+    LifterOptions options(arch.get(), module, nullptr);
+    EntityLifter lifter(options, nullptr, nullptr);
+
+    // `mov eax, 1; ret` twice, then `lea rax, [rip]; ret` twice, then
+    // `mov eax, 2; ret`.
+    static const char kMovRet1[] = "\xb8\x01\x00\x00\x00\xc3";
+    static const char kLeaRet[] = "\x48\x8d\x05\x00\x00\x00\x00\xc3";
+    static const char kMovRet2[] = "\xb8\x02\x00\x00\x00\xc3";
+    std::vector<uint8_t> code(0x50u, 0xccu);
+    std::memcpy(&code[0x00], kMovRet1, 6u);
+    std::memcpy(&code[0x10], kMovRet1, 6u);
+    std::memcpy(&code[0x20], kLeaRet, 8u);
+    std::memcpy(&code[0x30], kLeaRet, 8u);
+    std::memcpy(&code[0x40], kMovRet2, 6u);
+
+    Program program;
+    program.TrustDecls();
+    REQUIRE(Succeeded(
+        program.MapRange(0x1000u, std::move(code), false, true)));
+
+    FunctionDecl tpl;
+    tpl.arch = arch.get();
+    tpl.return_address.mem_reg = arch->RegisterByName("RSP");
+    tpl.return_stack_pointer = arch->RegisterByName("RSP");
+    tpl.return_stack_pointer_offset = 8;
+    for (uint64_t ea = 0x1000u; ea < 0x1050u; ea += 0x10u) {
+      tpl.address = ea;
+      REQUIRE(Succeeded(program.DeclareFunction(tpl).takeError()));
+    }
+
+    auto dups = DuplicateFunctions::Find(program, arch.get());
+    CHECK(dups.NumDuplicates() == 1u);
+    CHECK(dups.RepresentativeOf(0x1010u) == 0x1000u);
+    CHECK(!dups.RepresentativeOf(0x1000u));
+
+    // PC-relative code means something different at each address.
+    CHECK(!dups.RepresentativeOf(0x1030u));
+    CHECK(!dups.RepresentativeOf(0x1040u));
+  }
+
+  TEST_CASE("Duplicates become thunks to their representatives") {
+    llvm::LLVMContext context;
+    llvm::Module module("thunks", context);
+    auto i32_type = llvm::Type::getInt32Ty(context);
+    auto func_type = llvm::FunctionType::get(i32_type, {i32_type}, false);
+    auto rep = llvm::Function::Create(
+        func_type, llvm::GlobalValue::ExternalLinkage, "sub_1000", module);
+    auto dup = llvm::Function::Create(
+        func_type, llvm::GlobalValue::ExternalLinkage, "sub_1010", module);
+    auto other = llvm::Function::Create(
+        llvm::FunctionType::get(i32_type, false),
+        llvm::GlobalValue::ExternalLinkage, "sub_1020", module);
+
+    CHECK(!DuplicateFunctions::DefineAsThunk(*other, *rep));
+    CHECK(other->isDeclaration());
+
+    REQUIRE(DuplicateFunctions::DefineAsThunk(*dup, *rep));
+    CHECK(!dup->isDeclaration());
+    CHECK(!DuplicateFunctions::DefineAsThunk(*dup, *rep));
+
+    auto call = llvm::dyn_cast<llvm::CallInst>(&dup->getEntryBlock().front());
+    REQUIRE(call);
+    CHECK(call->getCalledFunction() == rep);
+    CHECK(call->isTailCall());
+    CHECK(!llvm::verifyFunction(*dup));
+  }
+}
+
+}  // namespace anvill
@@ -0,0 +1,204 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <anvill/FunctionCache.h>
+#include <doctest.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/FileSystem.h>
+
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+
+namespace anvill {
+
+namespace {
+
+static bool Succeeded(llvm::Error err) {
+  if (err) {
+    llvm::consumeError(std::move(err));
+    return false;
+  }
+  return true;
+}
+
+// Define `sub_1000` in `module`, which returns the result of calling
+// `sub_2000` on the value of `var`.
+static llvm::Function *DefineFunction(llvm::Module &module,
+                                      llvm::GlobalVariable *var) {
+  auto &context = module.getContext();
+  auto i32_type = llvm::Type::getInt32Ty(context);
+  auto func_type = llvm::FunctionType::get(i32_type, {i32_type}, false);
+  auto callee = llvm::Function::Create(
+      func_type, llvm::GlobalValue::ExternalLinkage, "sub_2000", module);
+  auto func = llvm::Function::Create(
+      func_type, llvm::GlobalValue::ExternalLinkage, "sub_1000", module);
+
+  llvm::IRBuilder<> ir(llvm::BasicBlock::Create(context, "", func));
+  auto val = ir.CreateLoad(i32_type, var);
+  auto sum = ir.CreateAdd(val, &*func->arg_begin());
+  ir.CreateRet(ir.CreateCall(callee, {sum}));
+  return func;
+}
+
+// Returns the address in the name of `gv`, e.g. `0x2000` for `sub_2000`.
+static std::optional<uint64_t> AddressOf(llvm::GlobalValue &gv) {
+  uint64_t address = 0;
+  if (gv.getName().rsplit('_').second.getAsInteger(16, address)) {
+    return std::nullopt;
+  }
+  return address;
+}
+
+}  // namespace
+
+TEST_SUITE("FunctionCache") {
+  TEST_CASE("Cached functions are linked into other modules") {
+    llvm::SmallString<128> dir;
+    REQUIRE(!llvm::sys::fs::createUniqueDirectory("anvill", dir));
+
+    auto maybe_cache = FunctionCache::Open(dir.str().str());
+    REQUIRE(Succeeded(maybe_cache.takeError()));
+    auto &cache = *maybe_cache;
+
+    std::map<uint64_t, std::string> prototypes = {{0x2000u, "callee"},
+                                                  {0x3000u, "var"}};
+    auto prototype_of = [&](uint64_t address) { return prototypes[address]; };
+
+    llvm::LLVMContext context;
+    auto i32_type = llvm::Type::getInt32Ty(context);
+
+    {
+      llvm::Module module("lifted_code", context);
+      auto var = new llvm::GlobalVariable(module, i32_type, false,
+                                          llvm::GlobalValue::ExternalLinkage,
+                                          nullptr, "data_3000");
+      auto func = DefineFunction(module, var);
+      REQUIRE(Succeeded(cache.Store("key", *func, AddressOf, prototype_of)));
+    }
+
+    auto maybe_missing = cache.Load("missing", context, prototype_of);
+    REQUIRE(Succeeded(maybe_missing.takeError()));
+    CHECK(!*maybe_missing);
+
+    llvm::Module module("lifted_code", context);
+    auto func_type = llvm::FunctionType::get(i32_type, {i32_type}, false);
+    auto func = llvm::Function::Create(
+        func_type, llvm::GlobalValue::ExternalLinkage, "sub_1000", module);
+
+    auto maybe_cached = cache.Load("key", context, prototype_of);
+    REQUIRE(Succeeded(maybe_cached.takeError()));
+    REQUIRE(*maybe_cached);
+    REQUIRE(Succeeded(FunctionCache::Link(std::move(*maybe_cached), *func)));
+
+    // The body was moved into the existing declaration, and what it refers to
+    // was brought in by name.
+    CHECK(module.getFunction("sub_1000") == func);
+    CHECK(!func->isDeclaration());
+    CHECK(!module.getFunction("sub_1000.anvill.cached"));
+    auto callee = module.getFunction("sub_2000");
+    REQUIRE(callee);
+    CHECK(callee->isDeclaration());
+    CHECK(!callee->use_empty());
+    CHECK(module.getGlobalVariable("data_3000"));
+
+    llvm::sys::fs::remove_directories(dir);
+  }
+
+  TEST_CASE("Functions that refer to local things aren't cached") {
+    llvm::SmallString<128> dir;
+    REQUIRE(!llvm::sys::fs::createUniqueDirectory("anvill", dir));
+
+    auto maybe_cache = FunctionCache::Open(dir.str().str());
+    REQUIRE(Succeeded(maybe_cache.takeError()));
+
+    llvm::LLVMContext context;
+    llvm::Module module("lifted_code", context);
+    auto i32_type = llvm::Type::getInt32Ty(context);
+    auto var = new llvm::GlobalVariable(
+        module, i32_type, false, llvm::GlobalValue::InternalLinkage,
+        llvm::Constant::getNullValue(i32_type), "data_3000");
+    auto func = DefineFunction(module, var);
+
+    auto prototype_of = [](uint64_t) { return std::string(); };
+    CHECK(!Succeeded(maybe_cache->Store("key", *func, AddressOf,
+                                        prototype_of)));
+
+    auto maybe_cached = maybe_cache->Load("key", context, prototype_of);
+    REQUIRE(Succeeded(maybe_cached.takeError()));
+    CHECK(!*maybe_cached);
+
+    llvm::sys::fs::remove_directories(dir);
+  }
+
+  TEST_CASE("Cached functions whose references changed aren't loaded") {
+    llvm::SmallString<128> dir;
+    REQUIRE(!llvm::sys::fs::createUniqueDirectory("anvill", dir));
+
+    auto maybe_cache = FunctionCache::Open(dir.str().str());
+    REQUIRE(Succeeded(maybe_cache.takeError()));
+    auto &cache = *maybe_cache;
+
+    std::map<uint64_t, std::string> prototypes = {{0x2000u, "callee"},
+                                                  {0x3000u, "var"}};
+    auto prototype_of = [&](uint64_t address) { return prototypes[address]; };
+
+    llvm::LLVMContext context;
+    {
+      llvm::Module module("lifted_code", context);
+      auto var = new llvm::GlobalVariable(
+          module, llvm::Type::getInt32Ty(context), false,
+          llvm::GlobalValue::ExternalLinkage, nullptr, "data_3000");
+      auto func = DefineFunction(module, var);
+      REQUIRE(Succeeded(cache.Store("key", *func, AddressOf, prototype_of)));
+    }
+
+    // The callee now has a different prototype.
+    prototypes[0x2000u] = "new_callee";
+    auto maybe_stale = cache.Load("key", context, prototype_of);
+    REQUIRE(Succeeded(maybe_stale.takeError()));
+    CHECK(!*maybe_stale);
+
+    // The callee's type in the module being linked into doesn't match the
+    // cached declaration's type.
+    prototypes[0x2000u] = "callee";
+    auto maybe_cached = cache.Load("key", context, prototype_of);
+    REQUIRE(Succeeded(maybe_cached.takeError()));
+    REQUIRE(*maybe_cached);
+
+    llvm::Module module("lifted_code", context);
+    auto i32_type = llvm::Type::getInt32Ty(context);
+    auto func = llvm::Function::Create(
+        llvm::FunctionType::get(i32_type, {i32_type}, false),
+        llvm::GlobalValue::ExternalLinkage, "sub_1000", module);
+    llvm::Function::Create(
+        llvm::FunctionType::get(i32_type, {i32_type, i32_type}, false),
+        llvm::GlobalValue::ExternalLinkage, "sub_2000", module);
+    CHECK(!Succeeded(FunctionCache::Link(std::move(*maybe_cached), *func)));
+
+    llvm::sys::fs::remove_directories(dir);
+  }
+}
+
+}  // namespace anvill
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <anvill/Decl.h>
+#include <anvill/JumpTables.h>
+#include <anvill/Lifters/EntityLifter.h>
+#include <anvill/Lifters/Options.h>
+#include <anvill/Program.h>
+#include <doctest.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/Endian.h>
+#include <remill/Arch/Arch.h>
+#include <remill/Arch/Name.h>
+#include <remill/OS/OS.h>
+
+#include <cstring>
+#include <vector>
+
+namespace anvill {
+
+namespace {
+
+static bool Succeeded(llvm::Error err) {
+  if (err) {
+    llvm::consumeError(std::move(err));
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+TEST_SUITE("JumpTables") {
+  TEST_CASE("Jump table entries become control-flow targets") {
+    llvm::LLVMContext context;
+    llvm::Module module("jump_tables", context);
+    auto arch = remill::Arch::Build(&context, remill::GetOSName("linux"),
+                                    remill::GetArchName("amd64"));
+    REQUIRE(arch != nullptr);
+
+    // Loads the semantics, and thus the register information that declaring
+    // functions needs.
+    LifterOptions options(arch.get(), module, nullptr);
+    EntityLifter lifter(options, nullptr, nullptr);
+
+    // `jmp [rax * 8 + 0x2000]; ret; ret`, then
+    // `lea rdx, [rip + 0xff9]; movsxd rax, [rdx + rax * 4]; add rax, rdx;
+    //  jmp rax; ret; ret`.
+    static const char kAbsolute[] = "\xff\x24\xc5\x00\x20\x00\x00\xc3\xc3";
+    static const char kRelative[] =
+        "\x48\x8d\x15\xf9\x0f\x00\x00\x48\x63\x04\x82\x48\x01\xd0\xff\xe0"
+        "\xc3\xc3";
+    std::vector<uint8_t> code(0x200u, 0xccu);
+    std::memcpy(&code[0x000], kAbsolute, sizeof(kAbsolute) - 1u);
+    std::memcpy(&code[0x100], kRelative, sizeof(kRelative) - 1u);
+
+    // The absolute table is at `0x2000`, and the relative one at `0x2100`.
+    // Both end with an entry that isn't in their function.
+    std::vector<uint8_t> data(0x200u, 0u);
+    llvm::support::endian::write64le(&data[0x00], 0x1007u);
+    llvm::support::endian::write64le(&data[0x08], 0x1008u);
+    llvm::support::endian::write64le(&data[0x10], 0x3000u);
+    llvm::support::endian::write32le(&data[0x100], 0x1110u - 0x2100u);
+    llvm::support::endian::write32le(&data[0x104], 0x1111u - 0x2100u);
+    llvm::support::endian::write32le(&data[0x108], 0x7fffffffu);
+
+    Program program;
+    program.TrustDecls();
+    REQUIRE(Succeeded(
+        program.MapRange(0x1000u, std::move(code), false, true)));
+    REQUIRE(Succeeded(
+        program.MapRange(0x2000u, std::move(data), false, false)));
+
+    FunctionDecl tpl;
+    tpl.arch = arch.get();
+    tpl.return_address.mem_reg = arch->RegisterByName("RSP");
+    tpl.return_stack_pointer = arch->RegisterByName("RSP");
+    tpl.return_stack_pointer_offset = 8;
+    for (uint64_t ea : {0x1000u, 0x1100u}) {
+      tpl.address = ea;
+      REQUIRE(Succeeded(program.DeclareFunction(tpl).takeError()));
+    }
+
+    CHECK(SpeculateJumpTableTargets(program, arch.get()) == 2u);
+
+    auto targets = program.TryGetControlFlowTargets(0x1000u);
+    REQUIRE(targets);
+    CHECK(!targets->complete);
+    CHECK(targets->destination_list == std::vector<uint64_t>{0x1007u, 0x1008u});
+
+    targets = program.TryGetControlFlowTargets(0x110eu);
+    REQUIRE(targets);
+    CHECK(!targets->complete);
+    CHECK(targets->destination_list == std::vector<uint64_t>{0x1110u, 0x1111u});
+
+    // Targets already in the spec are left alone.
+    CHECK(SpeculateJumpTableTargets(program, arch.get()) == 0u);
+  }
+}
+
+}  // namespace anvill
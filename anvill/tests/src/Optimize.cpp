@@ -0,0 +1,201 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <anvill/ABI.h>
+#include <anvill/Decl.h>
+#include <anvill/Lifters/EntityLifter.h>
+#include <anvill/Lifters/Options.h>
+#include <anvill/Optimize.h>
+#include <anvill/Program.h>
+#include <anvill/Providers/IControlFlowProvider.h>
+#include <anvill/Providers/MemoryProvider.h>
+#include <anvill/Providers/TypeProvider.h>
+#include <doctest.h>
+#include <gflags/gflags.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#include <remill/Arch/Arch.h>
+#include <remill/Arch/Name.h>
+#include <remill/OS/OS.h>
+
+#include <cstring>
+#include <vector>
+
+DECLARE_uint32(optimize_threads);
+
+namespace anvill {
+
+namespace {
+
+static bool Succeeded(llvm::Error err) {
+  if (err) {
+    llvm::consumeError(std::move(err));
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+TEST_SUITE("OptimizationPipeline") {
+  TEST_CASE("Pipelines round-trip through their textual form") {
+    for (auto level : {OptimizationLevel::kFast, OptimizationLevel::kDefault,
+                       OptimizationLevel::kThorough}) {
+      auto pipeline = OptimizationPipeline::Create(level);
+      auto maybe_parsed = OptimizationPipeline::Parse(pipeline.ToString());
+      REQUIRE(!!maybe_parsed);
+      CHECK(maybe_parsed->Passes() == pipeline.Passes());
+    }
+  }
+
+  TEST_CASE("Levels trade passes for speed") {
+    auto fast = OptimizationPipeline::Create(OptimizationLevel::kFast);
+    auto def = OptimizationPipeline::Create(OptimizationLevel::kDefault);
+    auto thorough = OptimizationPipeline::Create(OptimizationLevel::kThorough);
+
+    CHECK(fast.Passes().size() < def.Passes().size());
+    CHECK(def.Passes().size() < thorough.Passes().size());
+    CHECK(!fast.Contains(OptimizationPass::kBrightenPointerOperations));
+    CHECK(def.Contains(OptimizationPass::kBrightenPointerOperations));
+    CHECK(!def.Contains(OptimizationPass::kMergeFunctions));
+    CHECK(thorough.Contains(OptimizationPass::kMergeFunctions));
+
+    // Every level still gets rid of the remill intrinsics.
+    for (const auto &pipeline : {fast, def, thorough}) {
+      CHECK(pipeline.Contains(OptimizationPass::kInliner));
+      CHECK(pipeline.Contains(OptimizationPass::kRecoverEntityUseInformation));
+      CHECK(pipeline.Contains(OptimizationPass::kCleanUpRemillIntrinsics));
+    }
+  }
+
+  TEST_CASE("Textual pipelines are parsed in order") {
+    auto maybe_pipeline =
+        OptimizationPipeline::Parse("inline, sroa,instcombine,,sroa");
+    REQUIRE(!!maybe_pipeline);
+
+    const std::vector<OptimizationPass> expected = {
+        OptimizationPass::kInliner, OptimizationPass::kSROA,
+        OptimizationPass::kInstCombine, OptimizationPass::kSROA};
+    CHECK(maybe_pipeline->Passes() == expected);
+
+    maybe_pipeline->Remove(OptimizationPass::kSROA);
+    CHECK(maybe_pipeline->ToString() == "inline,instcombine");
+  }
+
+  TEST_CASE("Pipelines run their passes at least once") {
+    OptimizationPipeline pipeline;
+    CHECK(pipeline.MaxIterations() == 1u);
+    CHECK(pipeline.SetMaxIterations(4u).MaxIterations() == 4u);
+    CHECK(pipeline.SetMaxIterations(0u).MaxIterations() == 1u);
+  }
+
+  TEST_CASE("Passes out of running order are rejected") {
+    for (auto description : {"sroa,inline", "inline,sroa,globaldce",
+                             "merge-functions,sroa"}) {
+      auto maybe_pipeline = OptimizationPipeline::Parse(description);
+      REQUIRE(!maybe_pipeline);
+      llvm::consumeError(maybe_pipeline.takeError());
+    }
+
+    auto maybe_pipeline =
+        OptimizationPipeline::Parse("inline,globaldce,sroa,merge-functions");
+    CHECK(!!maybe_pipeline);
+  }
+
+  TEST_CASE("Unknown passes are rejected") {
+    auto maybe_pipeline = OptimizationPipeline::Parse("inline,not-a-pass");
+    REQUIRE(!maybe_pipeline);
+    llvm::consumeError(maybe_pipeline.takeError());
+  }
+}
+
+TEST_SUITE("OptimizeModule") {
+  TEST_CASE("Functions with stack frames are optimized on many threads") {
+    llvm::LLVMContext context;
+    llvm::Module module("frames", context);
+    auto arch = remill::Arch::Build(&context, remill::GetOSName("linux"),
+                                    remill::GetArchName("amd64"));
+    REQUIRE(arch != nullptr);
+
+    Program program;
+    auto memory = MemoryProvider::CreateProgramMemoryProvider(program);
+    auto types = TypeProvider::CreateProgramTypeProvider(context, program);
+    auto ctrl_flow_provider_res = IControlFlowProvider::Create(program);
+    REQUIRE(ctrl_flow_provider_res.Succeeded());
+
+    // The default pipeline initializes recovered stack frames from symbolic
+    // values, which each shard defines for itself.
+    LifterOptions options(arch.get(), module,
+                          ctrl_flow_provider_res.TakeValue());
+    REQUIRE(options.stack_frame_struct_init_procedure ==
+            StackFrameStructureInitializationProcedure::kSymbolic);
+    EntityLifter lifter(options, memory, types);
+
+    // `push rbp; mov rbp, rsp; mov [rbp - 4], edi; mov eax, [rbp - 4];
+    // pop rbp; ret`, twice.
+    static const char kFrame[] =
+        "\x55\x48\x89\xe5\x89\x7d\xfc\x8b\x45\xfc\x5d\xc3";
+    std::vector<uint8_t> code(0x20u, 0xccu);
+    std::memcpy(&code[0x00], kFrame, 12u);
+    std::memcpy(&code[0x10], kFrame, 12u);
+
+    program.TrustDecls();
+    REQUIRE(Succeeded(
+        program.MapRange(0x1000u, std::move(code), false, true)));
+
+    FunctionDecl tpl;
+    tpl.arch = arch.get();
+    tpl.return_address.mem_reg = arch->RegisterByName("RSP");
+    tpl.return_stack_pointer = arch->RegisterByName("RSP");
+    tpl.return_stack_pointer_offset = 8;
+    std::vector<llvm::Function *> funcs;
+    for (uint64_t ea : {0x1000u, 0x1010u}) {
+      tpl.address = ea;
+      auto maybe_decl = program.DeclareFunction(tpl);
+      REQUIRE(Succeeded(maybe_decl.takeError()));
+      funcs.push_back(lifter.LiftEntity(**maybe_decl));
+      REQUIRE(funcs.back() != nullptr);
+    }
+
+    const auto old_optimize_threads = FLAGS_optimize_threads;
+    FLAGS_optimize_threads = 2u;
+    const auto optimized =
+        OptimizeModule(lifter, arch.get(), program, module, options);
+    FLAGS_optimize_threads = old_optimize_threads;
+
+    REQUIRE(optimized);
+    CHECK(!llvm::verifyModule(module));
+
+    // The optimized bodies are moved back into the lifted functions.
+    for (auto func : funcs) {
+      CHECK(func->getParent() == &module);
+      CHECK(!func->isDeclaration());
+    }
+
+    // The symbolic values that the shards defined are defined once, as they
+    // would have been had the functions been optimized on one thread.
+    for (auto &var : module.globals()) {
+      if (var.getName().startswith(kSymbolicStackFrameValuePrefix)) {
+        CHECK(!var.isDeclaration());
+        CHECK(var.hasExternalLinkage());
+      }
+    }
+  }
+}
+
+}  // namespace anvill
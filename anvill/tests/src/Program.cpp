@@ -0,0 +1,480 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <anvill/Decl.h>
+#include <anvill/Program.h>
+#include <doctest.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/LLVMContext.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace anvill {
+
+namespace {
+
+static bool MapBytes(Program &program, uint64_t address,
+                     const std::vector<uint8_t> &bytes,
+                     bool is_writeable = false, bool is_executable = false) {
+  ByteRange range;
+  range.address = address;
+  range.begin = bytes.data();
+  range.end = bytes.data() + bytes.size();
+  range.is_writeable = is_writeable;
+  range.is_executable = is_executable;
+
+  auto err = program.MapRange(range);
+  if (err) {
+    llvm::consumeError(std::move(err));
+    return false;
+  }
+  return true;
+}
+
+static bool DeclareVariable(Program &program, uint64_t address,
+                            llvm::Type *type) {
+  GlobalVarDecl decl;
+  decl.address = address;
+  decl.type = type;
+
+  auto err = program.DeclareVariable(decl);
+  if (err) {
+    llvm::consumeError(std::move(err));
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+TEST_SUITE("Program") {
+  TEST_CASE("Byte lookups across mapped ranges") {
+    Program program;
+
+    const std::vector<uint8_t> first = {0x10, 0x11, 0x12, 0x13};
+    const std::vector<uint8_t> second = {0x20, 0x21};
+    const std::vector<uint8_t> third = {0x30, 0x31, 0x32};
+
+    // Map the ranges out of order, so that middle insertions happen.
+    REQUIRE(MapBytes(program, 0x3000, third, false, true));
+    REQUIRE(MapBytes(program, 0x1000, first));
+    REQUIRE(MapBytes(program, 0x2000, second, true));
+
+    CHECK(!program.FindByte(0xfff));
+    CHECK(!program.FindByte(0x1004));
+    CHECK(!program.FindByte(0x3003));
+
+    for (auto i = 0u; i < first.size(); ++i) {
+      auto byte = program.FindByte(0x1000 + i);
+      REQUIRE(byte);
+      CHECK(byte.ValueOr(0) == first[i]);
+      CHECK(!byte.IsWriteable());
+      CHECK(!byte.IsExecutable());
+    }
+
+    // Alternate between ranges to defeat any cached lookups.
+    CHECK(program.FindByte(0x2001).ValueOr(0) == 0x21);
+    CHECK(program.FindByte(0x3002).ValueOr(0) == 0x32);
+    CHECK(program.FindByte(0x1003).ValueOr(0) == 0x13);
+    CHECK(program.FindByte(0x2001).IsWriteable());
+    CHECK(program.FindByte(0x3000).IsExecutable());
+
+    auto seq = program.FindBytesContaining(0x3001);
+    REQUIRE(seq);
+    CHECK(seq.Address() == 0x3000);
+    CHECK(seq.Size() == third.size());
+
+    // Sequences are truncated to the end of the containing range.
+    auto sub_seq = program.FindBytes(0x1002, 16);
+    REQUIRE(sub_seq);
+    CHECK(sub_seq.Address() == 0x1002);
+    CHECK(sub_seq.Size() == 2u);
+    CHECK(sub_seq.ToString() == "\x12\x13");
+
+    CHECK(!program.FindBytes(0x1004, 1));
+  }
+
+  TEST_CASE("Overlapping ranges are rejected") {
+    Program program;
+
+    const std::vector<uint8_t> bytes = {0, 1, 2, 3};
+    REQUIRE(MapBytes(program, 0x1000, bytes));
+    CHECK(!MapBytes(program, 0x1000, bytes));
+    CHECK(!MapBytes(program, 0x0ffe, bytes));
+    CHECK(!MapBytes(program, 0x1003, bytes));
+    CHECK(MapBytes(program, 0x0ffc, bytes));
+    CHECK(MapBytes(program, 0x1004, bytes));
+  }
+
+  TEST_CASE("Zero-fill ranges read as zero") {
+    Program program;
+
+    // Big enough that allocating storage for it would be noticeable.
+    const uint64_t size = 1ull << 30u;
+    auto err = program.MapZeroRange(0x100000000ull, size, true, false);
+    REQUIRE(!err);
+
+    auto byte = program.FindByte(0x100000000ull + size - 1u);
+    REQUIRE(byte);
+    CHECK(byte.ValueOr(0xff) == 0u);
+    CHECK(byte.IsWriteable());
+    CHECK(!byte.IsExecutable());
+    CHECK(!program.FindByte(0x100000000ull + size));
+
+    const std::vector<uint8_t> bytes = {0, 1};
+    CHECK(!MapBytes(program, 0x100001000ull, bytes));
+    CHECK(MapBytes(program, 0x100000000ull + size, bytes));
+  }
+
+  TEST_CASE("Next byte crosses into adjacent ranges") {
+    Program program;
+
+    const std::vector<uint8_t> bytes = {0, 1};
+    REQUIRE(MapBytes(program, 0x1002, bytes));
+    REQUIRE(MapBytes(program, 0x1000, bytes));
+
+    auto byte = program.FindByte(0x1000);
+    for (auto i = 0u; i < 4u; ++i) {
+      REQUIRE(byte);
+      CHECK(byte.Address() == 0x1000 + i);
+      CHECK(byte.ValueOr(0xff) == (i % 2u));
+      byte = program.FindNextByte(byte);
+    }
+    CHECK(!byte);
+  }
+
+  TEST_CASE("Next sequence crosses into adjacent ranges") {
+    Program program;
+
+    const std::vector<uint8_t> first = {0x10, 0x11, 0x12};
+    const std::vector<uint8_t> second = {0x20, 0x21};
+    REQUIRE(MapBytes(program, 0x1003, second, false, true));
+    REQUIRE(MapBytes(program, 0x1000, first));
+    REQUIRE(MapBytes(program, 0x1010, first));
+
+    // The sequences of a run of bytes are walked one mapped range at a time,
+    // each with its own permissions, until the run ends with a gap.
+    auto seq = program.FindBytes(0x1001, 16u);
+    REQUIRE(seq);
+    CHECK(seq.ToString() == "\x11\x12");
+    CHECK(!seq.IsExecutable());
+
+    seq = program.FindNextBytes(seq, 14u);
+    REQUIRE(seq);
+    CHECK(seq.Address() == 0x1003);
+    CHECK(seq.ToString() == "\x20\x21");
+    CHECK(seq.IsExecutable());
+
+    CHECK(!program.FindNextBytes(seq, 12u));
+
+    // Sequences cut short by their size continue in the same range.
+    seq = program.FindBytes(0x1010, 1u);
+    REQUIRE(seq);
+    seq = program.FindNextBytes(seq, 1u);
+    REQUIRE(seq);
+    CHECK(seq.ToString() == "\x11");
+    CHECK(!program.FindNextBytes(seq, 0u));
+  }
+
+  TEST_CASE("Pointer candidates are found by range bounds") {
+    Program program;
+
+    const std::vector<uint8_t> bytes(4u);
+    REQUIRE(MapBytes(program, 0x1000, bytes, false, true));
+    REQUIRE(MapBytes(program, 0x1004, bytes));
+    REQUIRE(MapBytes(program, 0x2000, std::vector<uint8_t>(16u)));
+
+    const std::vector<uint32_t> values = {0xfff,  0x1000, 0x1007, 0x1008,
+                                          0x2000, 0x200f, 0x2010, 0};
+    std::string little, big;
+    for (auto val : values) {
+      for (auto i = 0u; i < 4u; ++i) {
+        little.push_back(static_cast<char>(val >> (i * 8u)));
+        big.push_back(static_cast<char>(val >> ((3u - i) * 8u)));
+      }
+    }
+
+    CHECK((program.FindPointerCandidates(little, 4u, true) ==
+           std::vector<uint64_t>{0x36}));
+    CHECK((program.FindPointerCandidates(big, 4u, false) ==
+           std::vector<uint64_t>{0x36}));
+    CHECK((program.FindPointerCandidates(little, 4u, true, true) ==
+           std::vector<uint64_t>{0x2}));
+
+    // Trailing partial words are ignored.
+    CHECK((program.FindPointerCandidates(little.substr(0, 7), 4u, true) ==
+           std::vector<uint64_t>{0x2}));
+    CHECK(program.FindPointerCandidates("", 4u, true).empty());
+
+    // The candidates agree with looking up each word on its own, both with
+    // few ranges, and with enough that words are searched for in the bounds
+    // rather than compared against all of them.
+    auto check_lookups = [&](uint64_t limit) {
+      std::string words;
+      std::vector<bool> expected;
+      for (uint64_t ea = 0xff8; ea < limit;
+           ea += (ea < 0x2020 ? 1u : 0x41u)) {
+        for (auto i = 0u; i < 8u; ++i) {
+          words.push_back(static_cast<char>(ea >> (i * 8u)));
+        }
+        expected.push_back(!!program.FindByte(ea));
+      }
+
+      const auto bitmap = program.FindPointerCandidates(words, 8u, true);
+      REQUIRE(bitmap.size() == (expected.size() + 63u) / 64u);
+      for (auto i = 0u; i < expected.size(); ++i) {
+        CHECK(((bitmap[i / 64u] >> (i % 64u)) & 1u) == expected[i]);
+      }
+    };
+
+    check_lookups(0x3000);
+    for (auto i = 0u; i < 64u; ++i) {
+      REQUIRE(MapBytes(program, 0x10000 + (i * 0x100), bytes));
+    }
+    check_lookups(0x14000);
+  }
+
+  TEST_CASE("Frozen programs can't be changed") {
+    Program program;
+
+    const std::vector<uint8_t> bytes = {0, 1, 2, 3};
+    REQUIRE(MapBytes(program, 0x1000, bytes));
+
+    ControlFlowTargetList targets;
+    targets.source = 0x1000;
+    targets.destination_list = {0x1002};
+    REQUIRE(program.TrySetControlFlowTargets(targets));
+
+    CHECK(!program.IsFrozen());
+    program.Freeze();
+    CHECK(program.IsFrozen());
+
+    CHECK(!MapBytes(program, 0x2000, bytes));
+    targets.source = 0x1001;
+    CHECK(!program.TrySetControlFlowTargets(targets));
+    CHECK(!program.AddControlFlowRedirection(0x1000, 0x1002));
+    CHECK(!program.AddNameToAddress("late", 0x1000));
+
+    uint64_t dest = 0;
+    CHECK(!program.TryGetControlFlowRedirection(dest, 0x1000));
+
+    // Lookups into a frozen program may happen concurrently.
+    std::vector<std::thread> threads;
+    std::vector<int> found(4u, 0);
+    for (auto i = 0u; i < found.size(); ++i) {
+      threads.emplace_back([&, i](void) {
+        auto found_all = 1;
+        for (auto j = 0u; j < 1000u; ++j) {
+          const auto addr = 0x1000u + ((i + j) % bytes.size());
+          found_all &= program.FindByte(addr).ValueOr(0xff) ==
+                       bytes[addr - 0x1000u];
+          found_all &= program.TryGetControlFlowTargets(0x1000).has_value();
+        }
+        found[i] = found_all;
+      });
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+    for (auto found_all : found) {
+      CHECK(found_all);
+    }
+  }
+
+  TEST_CASE("Borrowed ranges are mapped without copying") {
+    auto bytes = std::make_shared<std::vector<uint8_t>>(
+        std::vector<uint8_t>{0xc3, 0x90});
+    std::weak_ptr<std::vector<uint8_t>> weak_bytes = bytes;
+    {
+      Program program;
+      auto err = program.MapBorrowedRange(0x1000, bytes->data(),
+                                          bytes->size(), bytes, false, true);
+      const auto mapped = !err;
+      llvm::consumeError(std::move(err));
+      REQUIRE(mapped);
+      const auto data = bytes->data();
+      bytes.reset();
+
+      auto byte = program.FindByte(0x1001);
+      REQUIRE(byte);
+      CHECK(byte.ValueOr(0) == 0x90);
+      CHECK(byte.IsExecutable());
+      CHECK(program.FindBytesContaining(0x1000).ToString().data() ==
+            reinterpret_cast<const char *>(data));
+      CHECK(!weak_bytes.expired());
+    }
+    CHECK(weak_bytes.expired());
+  }
+
+  TEST_CASE("Control flow target lists can be enumerated") {
+    Program program;
+
+    ControlFlowTargetList targets;
+    targets.source = 0x1000;
+    targets.destination_list = {0x1002, 0x1004};
+    REQUIRE(program.TrySetControlFlowTargets(targets));
+    targets.source = 0x2000;
+    targets.destination_list = {0x2002};
+    REQUIRE(program.TrySetControlFlowTargets(targets));
+
+    for (auto freeze : {false, true}) {
+      if (freeze) {
+        program.Freeze();
+      }
+
+      auto num_lists = 0u;
+      auto num_destinations = 0u;
+      program.ForEachControlFlowTargets(
+          [&](const ControlFlowTargetList &list) {
+            ++num_lists;
+            num_destinations += list.destination_list.size();
+            return true;
+          });
+      CHECK(num_lists == 2u);
+      CHECK(num_destinations == 3u);
+    }
+  }
+
+  TEST_CASE("Redirection chains are followed") {
+    Program program;
+    program.AddControlFlowRedirection(0x1000, 0x2000);
+    program.AddControlFlowRedirection(0x2000, 0x3000);
+    program.AddControlFlowRedirection(0x4000, 0x5000);
+    program.AddControlFlowRedirection(0x5000, 0x4000);
+
+    for (auto freeze : {false, true}) {
+      if (freeze) {
+        program.Freeze();
+      }
+
+      uint64_t dest = 0;
+      CHECK(program.TryGetControlFlowRedirection(dest, 0x1000));
+      CHECK(dest == 0x3000u);
+      CHECK(program.TryGetControlFlowRedirection(dest, 0x2000));
+      CHECK(dest == 0x3000u);
+      CHECK(!program.TryGetControlFlowRedirection(dest, 0x3000));
+
+      // Cycles stop just before they would repeat.
+      CHECK(program.TryGetControlFlowRedirection(dest, 0x4000));
+      CHECK(dest == 0x4000u);
+    }
+  }
+
+  TEST_CASE("Redirections may involve any address") {
+    Program program;
+    program.AddControlFlowRedirection(~0ull, ~0ull - 1ull);
+    program.AddControlFlowRedirection(~0ull - 1ull, 0x1000);
+
+    for (auto freeze : {false, true}) {
+      if (freeze) {
+        program.Freeze();
+      }
+
+      uint64_t dest = 0;
+      CHECK(program.TryGetControlFlowRedirection(dest, ~0ull));
+      CHECK(dest == 0x1000u);
+      CHECK(program.TryGetControlFlowRedirection(dest, ~0ull - 1ull));
+      CHECK(dest == 0x1000u);
+    }
+  }
+
+  TEST_CASE("Names are indexed in both directions") {
+    Program program;
+    program.AddNameToAddress("b", 0x2000);
+    program.AddNameToAddress("a", 0x1000);
+    program.AddNameToAddress("b", 0x1000);
+    program.AddNameToAddress("c", 0x1000);
+
+    for (auto freeze : {false, true}) {
+      if (freeze) {
+        program.Freeze();
+      }
+
+      // Names of an address are visited in the order they were added.
+      std::vector<std::string> names;
+      program.ForEachNameOfAddress(
+          0x1000, [&](const std::string &name, const FunctionDecl *,
+                      const GlobalVarDecl *) {
+            names.push_back(name);
+            return true;
+          });
+      CHECK((names == std::vector<std::string>{"a", "b", "c"}));
+
+      std::vector<uint64_t> addrs;
+      program.ForEachAddressOfName(
+          "b", [&](uint64_t ea, const FunctionDecl *, const GlobalVarDecl *) {
+            addrs.push_back(ea);
+            return true;
+          });
+      CHECK((addrs == std::vector<uint64_t>{0x2000, 0x1000}));
+
+      addrs.clear();
+      program.ForEachNamedAddress(
+          [&](uint64_t ea, const std::string &, const FunctionDecl *,
+              const GlobalVarDecl *) {
+            addrs.push_back(ea);
+            return true;
+          });
+      CHECK((addrs ==
+             std::vector<uint64_t>{0x1000, 0x1000, 0x1000, 0x2000}));
+
+      auto found = false;
+      program.ForEachAddressOfName(
+          "d", [&](uint64_t, const FunctionDecl *, const GlobalVarDecl *) {
+            found = true;
+            return true;
+          });
+      CHECK(!found);
+    }
+  }
+
+  TEST_CASE("Addresses are found inside of variables") {
+    llvm::LLVMContext context;
+    llvm::DataLayout dl("e-p:32:32");
+    auto i32_type = llvm::Type::getInt32Ty(context);
+
+    Program program;
+    REQUIRE(DeclareVariable(program, 0x1000,
+                            llvm::ArrayType::get(i32_type, 4)));
+    REQUIRE(DeclareVariable(program, 0x1008, i32_type));
+    REQUIRE(DeclareVariable(program, 0x2000, i32_type));
+
+    // Lookups with indexed extents agree with those without. The variable at
+    // `0x1008` overlaps the array, and takes precedence after its start.
+    for (auto freeze : {false, true}) {
+      if (freeze) {
+        program.Freeze(dl);
+      }
+
+      CHECK(!program.FindInVariable(0xfff, dl));
+      REQUIRE(program.FindInVariable(0x1004, dl));
+      CHECK(program.FindInVariable(0x1004, dl)->address == 0x1000u);
+      REQUIRE(program.FindInVariable(0x100b, dl));
+      CHECK(program.FindInVariable(0x100b, dl)->address == 0x1008u);
+      CHECK(!program.FindInVariable(0x100c, dl));
+      CHECK(program.FindInVariable(0x2003, dl));
+      CHECK(!program.FindInVariable(0x2004, dl));
+    }
+  }
+}
+
+}  // namespace anvill
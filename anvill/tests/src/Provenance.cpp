@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <anvill/Provenance.h>
+#include <doctest.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Metadata.h>
+#include <llvm/IR/Module.h>
+
+namespace anvill {
+
+TEST_SUITE("Provenance") {
+  TEST_CASE("Provenance records are validated against side tables") {
+    llvm::LLVMContext context;
+    llvm::Module module("provenance", context);
+
+    auto i64 = llvm::Type::getInt64Ty(context);
+    auto fty = llvm::FunctionType::get(i64, {i64, i64}, false);
+    auto func = llvm::Function::Create(fty, llvm::GlobalValue::ExternalLinkage,
+                                       "func", module);
+
+    llvm::IRBuilder<> ir(llvm::BasicBlock::Create(context, "", func));
+    auto add = llvm::cast<llvm::Instruction>(
+        ir.CreateAdd(func->getArg(0), func->getArg(1)));
+    auto mul = llvm::cast<llvm::Instruction>(ir.CreateMul(add, add));
+    ir.CreateRet(mul);
+
+    auto add_record =
+        GetProvenanceNode(llvm::ConstantInt::get(i64, 0x1000), "RAX");
+    auto mul_record =
+        GetProvenanceNode(llvm::ConstantInt::get(i64, 0x1004), "RCX");
+    CHECK(add_record == GetProvenanceNode(
+                            llvm::ConstantInt::get(i64, 0x1000), "RAX"));
+
+    const auto kind = context.getMDKindID(kProvenanceMetadataName);
+    add->setMetadata(kind, add_record);
+    mul->setMetadata(kind, mul_record);
+    llvm::Metadata *records[] = {add_record, mul_record};
+    SetProvenanceTable(*func, records);
+
+    auto record = GetProvenance(*add);
+    REQUIRE(record.has_value());
+    CHECK(record->pc == 0x1000u);
+    CHECK(record->reg == "RAX");
+
+    auto maybe_stats = VerifyProvenance(module);
+    REQUIRE(!!maybe_stats);
+    CHECK(maybe_stats->num_records == 2u);
+    CHECK(maybe_stats->num_surviving_records == 2u);
+    CHECK(maybe_stats->num_tagged_instructions == 2u);
+
+    // Records disappear along with the instructions that hold them.
+    mul->setMetadata(kind, nullptr);
+    maybe_stats = VerifyProvenance(module);
+    REQUIRE(!!maybe_stats);
+    CHECK(maybe_stats->num_records == 2u);
+    CHECK(maybe_stats->num_surviving_records == 1u);
+
+    // Records that aren't in any side table are rejected.
+    mul->setMetadata(
+        kind, GetProvenanceNode(llvm::ConstantInt::get(i64, 0x1008), "RDX"));
+    maybe_stats = VerifyProvenance(module);
+    REQUIRE(!maybe_stats);
+    llvm::consumeError(maybe_stats.takeError());
+
+    // So are malformed records.
+    mul->setMetadata(kind, llvm::MDNode::get(context, {}));
+    CHECK(!GetProvenance(*mul));
+    maybe_stats = VerifyProvenance(module);
+    REQUIRE(!maybe_stats);
+    llvm::consumeError(maybe_stats.takeError());
+  }
+}
+
+}  // namespace anvill
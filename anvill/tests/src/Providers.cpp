@@ -0,0 +1,238 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <anvill/Counters.h>
+#include <anvill/Program.h>
+#include <anvill/Providers/IControlFlowProvider.h>
+#include <anvill/Providers/MemoryProvider.h>
+#include <anvill/Providers/TypeProvider.h>
+#include <doctest.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/LLVMContext.h>
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+namespace anvill {
+
+namespace {
+
+// Counts how often it is asked about anything, and never knows the answer.
+class CountingTypeProvider final : public TypeProvider {
+ public:
+  explicit CountingTypeProvider(llvm::LLVMContext &context_)
+      : TypeProvider(context_) {}
+
+  std::shared_ptr<const FunctionDecl> TryGetFunctionType(uint64_t) final {
+    ++num_queries;
+    return {};
+  }
+
+  std::shared_ptr<const GlobalVarDecl>
+  TryGetVariableType(uint64_t, const llvm::DataLayout &) final {
+    ++num_queries;
+    return {};
+  }
+
+  unsigned num_queries{0};
+};
+
+// Counts how often it is asked about anything, and redirects everything to
+// the next address.
+class CountingControlFlowProvider final : public IControlFlowProvider {
+ public:
+  std::uint64_t GetRedirection(std::uint64_t address) const final {
+    ++num_queries;
+    return address + 1u;
+  }
+
+  std::optional<ControlFlowTargetList>
+  TryGetControlFlowTargets(std::uint64_t) const final {
+    ++num_queries;
+    return std::nullopt;
+  }
+
+  mutable unsigned num_queries{0};
+};
+
+// Counts how many pages it fetches, and in how many batches. Pages below
+// `0x10000` are executable, and each byte is the low byte of its address;
+// the rest are unavailable.
+class CountingPageSource final : public PageSource {
+ public:
+  explicit CountingPageSource(uint64_t page_size_) : page_size(page_size_) {}
+
+  void FetchPages(const std::vector<uint64_t> &page_addresses,
+                  std::vector<MemoryPage> &pages) final {
+    std::unique_lock<std::mutex> locker(lock);
+    ++num_batches;
+    for (auto i = 0u; i < page_addresses.size(); ++i) {
+      ++num_pages;
+      const auto page_address = page_addresses[i];
+      if (page_address >= 0x10000u) {
+        pages[i].availability = ByteAvailability::kUnavailable;
+        continue;
+      }
+      pages[i].availability = ByteAvailability::kAvailable;
+      pages[i].permission = BytePermission::kReadableExecutable;
+      for (auto j = 0u; j < page_size; ++j) {
+        pages[i].bytes.push_back(static_cast<char>(page_address + j));
+      }
+    }
+  }
+
+  unsigned NumPages(void) {
+    std::unique_lock<std::mutex> locker(lock);
+    return num_pages;
+  }
+
+  unsigned NumBatches(void) {
+    std::unique_lock<std::mutex> locker(lock);
+    return num_batches;
+  }
+
+ private:
+  const uint64_t page_size;
+  std::mutex lock;
+  unsigned num_pages{0};
+  unsigned num_batches{0};
+};
+
+}  // namespace
+
+TEST_SUITE("Providers") {
+  TEST_CASE("Caching type providers remember missing decls") {
+    llvm::LLVMContext context;
+    llvm::DataLayout dl("");
+    auto counter = std::make_shared<CountingTypeProvider>(context);
+    auto cache = TypeProvider::CreateCachingTypeProvider(counter);
+
+    CHECK(!cache->TryGetFunctionType(0x1000));
+    CHECK(!cache->TryGetFunctionType(0x1000));
+    CHECK(counter->num_queries == 1u);
+
+    CHECK(!cache->TryGetVariableType(0x2000, dl));
+    CHECK(!cache->TryGetVariableType(0x2000, dl));
+    CHECK(counter->num_queries == 2u);
+
+    CHECK(!cache->TryGetFunctionType(0x2000));
+    CHECK(counter->num_queries == 3u);
+  }
+
+  TEST_CASE("Caching type providers remember function heads") {
+    llvm::LLVMContext context;
+    auto counter = std::make_shared<CountingTypeProvider>(context);
+    auto cache = TypeProvider::CreateCachingTypeProvider(counter);
+
+    CHECK(!cache->IsFunctionHead(0x1000));
+    CHECK(!cache->IsFunctionHead(0x1000));
+    CHECK(counter->num_queries == 1u);
+
+    // Decls that were already asked for answer whether there's a head too.
+    CHECK(!cache->TryGetFunctionType(0x2000));
+    CHECK(!cache->IsFunctionHead(0x2000));
+    CHECK(counter->num_queries == 2u);
+  }
+
+  TEST_CASE("Caching type providers count their hits and misses") {
+    llvm::LLVMContext context;
+    auto counter = std::make_shared<CountingTypeProvider>(context);
+    auto cache = TypeProvider::CreateCachingTypeProvider(counter);
+
+    // Counters are process-wide, so only their changes are checked.
+    const auto hits = ReadCounter(Counter::kTypeCacheHits);
+    const auto misses = ReadCounter(Counter::kTypeCacheMisses);
+    CHECK(!cache->TryGetFunctionType(0x1000));
+    CHECK(!cache->TryGetFunctionType(0x1000));
+    CHECK(!cache->IsFunctionHead(0x1000));
+    CHECK(ReadCounter(Counter::kTypeCacheHits) - hits == 2u);
+    CHECK(ReadCounter(Counter::kTypeCacheMisses) - misses == 1u);
+  }
+
+  TEST_CASE("Caching control-flow providers remember answers") {
+    auto counter = new CountingControlFlowProvider;
+    auto maybe_cache =
+        IControlFlowProvider::CreateCaching(IControlFlowProvider::Ptr(counter));
+    REQUIRE(maybe_cache.Succeeded());
+    auto cache = maybe_cache.TakeValue();
+
+    CHECK(cache->GetRedirection(0x1000) == 0x1001u);
+    CHECK(cache->GetRedirection(0x1000) == 0x1001u);
+    CHECK(counter->num_queries == 1u);
+
+    CHECK(!cache->TryGetControlFlowTargets(0x1000));
+    CHECK(!cache->TryGetControlFlowTargets(0x1000));
+    CHECK(counter->num_queries == 2u);
+  }
+
+  TEST_CASE("Paged memory providers cache pages") {
+    auto source = std::make_shared<CountingPageSource>(16u);
+    auto memory = MemoryProvider::CreatePagedMemoryProvider(source, 16u, 2u);
+
+    auto [byte, avail, perms] = memory->Query(0x1234);
+    CHECK(byte == 0x34u);
+    CHECK(avail == ByteAvailability::kAvailable);
+    CHECK(perms == BytePermission::kReadableExecutable);
+    CHECK(std::get<0>(memory->Query(0x1230)) == 0x30u);
+    CHECK(source->NumPages() == 1u);
+
+    // Runs stop at the end of a page.
+    std::string run = "\x01";
+    auto [run_size, run_avail, run_perms] =
+        memory->QueryRange(0x123c, 8u, run);
+    CHECK(run_size == 4u);
+    CHECK(run == std::string_view("\x01\x3c\x3d\x3e\x3f", 5u));
+    CHECK(run_avail == ByteAvailability::kAvailable);
+
+    // Unavailable pages are cached too.
+    CHECK(std::get<1>(memory->Query(0x20000)) ==
+          ByteAvailability::kUnavailable);
+    CHECK(!std::get<0>(memory->QueryRange(0x20000, 4u, run)));
+    CHECK(run.size() == 5u);
+    CHECK(source->NumPages() == 2u);
+
+    // Only the two most recently used pages are kept.
+    CHECK(std::get<0>(memory->Query(0x1240)) == 0x40u);
+    CHECK(std::get<0>(memory->Query(0x20000)) == 0u);
+    CHECK(source->NumPages() == 3u);
+    CHECK(std::get<0>(memory->Query(0x1230)) == 0x30u);
+    CHECK(source->NumPages() == 4u);
+  }
+
+  TEST_CASE("Paged memory providers fetch prefetched pages in batches") {
+    auto source = std::make_shared<CountingPageSource>(16u);
+    auto memory =
+        MemoryProvider::CreatePagedMemoryProvider(source, 16u, 64u, 4u);
+
+    // Hinted pages are fetched in the background, or along with the first
+    // page that is needed before they are.
+    memory->Prefetch(0x1000, 64u);
+    memory->Prefetch(0x2008, 16u);
+    CHECK(std::get<0>(memory->Query(0x2010)) == 0x10u);
+    CHECK(std::get<0>(memory->Query(0x1000)) == 0x00u);
+    CHECK(std::get<0>(memory->Query(0x1030)) == 0x30u);
+    CHECK(std::get<0>(memory->Query(0x2000)) == 0x00u);
+
+    CHECK(source->NumPages() == 6u);
+    CHECK(source->NumBatches() <= 3u);
+  }
+}
+
+}  // namespace anvill
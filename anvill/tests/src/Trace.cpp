@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <anvill/Trace.h>
+#include <doctest.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include <string>
+#include <vector>
+
+namespace anvill {
+
+namespace {
+
+static uint64_t gFakeAllocations = 0u;
+
+static uint64_t CountFakeAllocations(void) {
+  return gFakeAllocations;
+}
+
+static bool Succeeded(llvm::Error err) {
+  if (err) {
+    llvm::consumeError(std::move(err));
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+TEST_SUITE("Tracer") {
+  TEST_CASE("Scopes record events") {
+    llvm::LLVMContext context;
+    llvm::Module module("trace", context);
+    auto func = llvm::Function::Create(
+        llvm::FunctionType::get(llvm::Type::getVoidTy(context), false),
+        llvm::GlobalValue::ExternalLinkage, "sub_1000", &module);
+
+    Tracer tracer(CountFakeAllocations);
+    {
+      TraceScope scope(&tracer, "lift", "lift", func, 0x1000);
+      llvm::IRBuilder<> ir(llvm::BasicBlock::Create(context, "", func));
+      ir.CreateRetVoid();
+      gFakeAllocations += 3u;
+      scope.AddCounter("decoded_instructions", 1u);
+    }
+
+    auto events = tracer.Events();
+    REQUIRE(events.size() == 1u);
+    CHECK(events[0].name == "lift");
+    CHECK(events[0].function == "sub_1000");
+    CHECK(events[0].address == 0x1000u);
+    CHECK(events[0].instructions_before == 0u);
+    CHECK(events[0].instructions_after == 1u);
+    CHECK(events[0].allocations == 3u);
+    REQUIRE(events[0].counters.size() == 1u);
+    CHECK(events[0].counters[0].second == 1u);
+  }
+
+  TEST_CASE("Observers see events that aren't kept") {
+    std::vector<std::string> names;
+    Tracer tracer(
+        nullptr, [&](const TraceEvent &event) { names.push_back(event.name); },
+        false);
+    { TraceScope scope(&tracer, "dce", "pass", nullptr); }
+    { TraceScope scope(&tracer, "sroa", "pass", nullptr); }
+
+    REQUIRE(names.size() == 2u);
+    CHECK(names[0] == "dce");
+    CHECK(names[1] == "sroa");
+    CHECK(tracer.Events().empty());
+  }
+
+  TEST_CASE("Scopes without a tracer do nothing") {
+    TraceScope scope(nullptr, "lift", "lift", nullptr);
+    scope.AddCounter("decoded_instructions", 1u);
+  }
+
+  TEST_CASE("Traces are written as Chrome trace events") {
+    llvm::SmallString<128> path;
+    REQUIRE(!llvm::sys::fs::createTemporaryFile("anvill", "json", path));
+
+    Tracer tracer;
+    { TraceScope scope(&tracer, "dce", "pass", nullptr); }
+    REQUIRE(Succeeded(tracer.WriteChromeTrace(path.str().str())));
+
+    auto buff = llvm::MemoryBuffer::getFile(path);
+    REQUIRE(buff);
+    auto json = llvm::json::parse(buff.get()->getBuffer());
+    REQUIRE(!!json);
+    auto events = json->getAsObject()->getArray("traceEvents");
+    REQUIRE(events);
+    REQUIRE(events->size() == 1u);
+    CHECK(events->front().getAsObject()->getString("name").getValueOr("") ==
+          "dce");
+
+    llvm::sys::fs::remove(path);
+  }
+}
+
+}  // namespace anvill
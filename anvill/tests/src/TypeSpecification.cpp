@@ -231,6 +231,35 @@ TEST_SUITE("TypeSpecification") {
       WARN(generated_spec == test_spec);
     }
   }
+
+  TEST_CASE("Repeated specs are interned per context") {
+    const std::string spec = "{ii*[bx16]}";
+
+    for (auto i = 0; i < 2; ++i) {
+      llvm::LLVMContext llvm_context;
+
+      auto first_res = ITypeSpecification::Create(llvm_context, spec);
+      auto second_res = ITypeSpecification::Create(llvm_context, spec);
+      REQUIRE(first_res.Succeeded());
+      REQUIRE(second_res.Succeeded());
+
+      auto first = first_res.TakeValue();
+      auto second = second_res.TakeValue();
+      REQUIRE(first->Type() != nullptr);
+      CHECK(first->Type() == second->Type());
+      CHECK(&(first->Type()->getContext()) == &llvm_context);
+      CHECK(second->Spec() == spec);
+      CHECK(second->Description() == first->Description());
+      CHECK(second->Sized());
+    }
+  }
+
+  TEST_CASE("Oversized array lengths are rejected") {
+    llvm::LLVMContext llvm_context;
+    auto context_res = TypeSpecification::ParseSpec(
+        llvm_context, "[bx99999999999999999999999]");
+    CHECK(!context_res.Succeeded());
+  }
 }
 
 }  // namespace anvill
@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <anvill/ABI.h>
+#include <anvill/Analysis/Utils.h>
+#include <anvill/Util.h>
+#include <doctest.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <remill/Arch/Arch.h>
+#include <remill/Arch/Name.h>
+#include <remill/BC/Util.h>
+#include <remill/OS/OS.h>
+
+namespace anvill {
+
+TEST_SUITE("Analysis Utils") {
+  TEST_CASE("Symbolic value analysis agrees with the one-off queries") {
+    llvm::LLVMContext context;
+    llvm::Module module("symbolic_values", context);
+    module.setTargetTriple("x86_64-pc-linux-gnu");
+
+    auto i8_type = llvm::Type::getInt8Ty(context);
+    auto i64_type = llvm::Type::getInt64Ty(context);
+    auto make_global = [&](const std::string &name) {
+      return new llvm::GlobalVariable(module, i8_type, false,
+                                      llvm::GlobalValue::ExternalLinkage,
+                                      nullptr, name);
+    };
+
+    auto sp = make_global(kSymbolicSPName);
+    auto pc = make_global(kSymbolicPCName);
+    auto ra = make_global(kSymbolicRAName);
+    auto other = make_global("other");
+
+    auto eight = llvm::ConstantInt::get(i64_type, 8);
+    auto sp_plus_8 = llvm::ConstantExpr::getAdd(
+        llvm::ConstantExpr::getPtrToInt(sp, i64_type), eight);
+    auto ra_int = llvm::ConstantExpr::getPtrToInt(ra, i64_type);
+    auto other_plus_8 = llvm::ConstantExpr::getAdd(
+        llvm::ConstantExpr::getPtrToInt(other, i64_type), eight);
+
+    SymbolicValueAnalysis analysis(&module);
+
+    // Ask twice, so that the second answers come from what was remembered.
+    for (auto i = 0; i < 2; ++i) {
+      CHECK(analysis.IsStackPointer(sp));
+      CHECK(!analysis.IsStackPointer(pc));
+      CHECK(analysis.IsProgramCounter(pc));
+      CHECK(!analysis.IsProgramCounter(ra));
+      CHECK(analysis.IsReturnAddress(ra_int));
+      CHECK(!analysis.IsReturnAddress(sp_plus_8));
+      CHECK(analysis.IsRelatedToStackPointer(sp_plus_8));
+      CHECK(!analysis.IsRelatedToStackPointer(other_plus_8));
+    }
+
+    llvm::Value *const vals[] = {sp, pc, ra, ra_int, sp_plus_8, other_plus_8};
+    for (auto val : vals) {
+      CHECK(analysis.IsStackPointer(val) == IsStackPointer(&module, val));
+      CHECK(analysis.IsProgramCounter(val) == IsProgramCounter(&module, val));
+      CHECK(analysis.IsReturnAddress(val) == IsReturnAddress(&module, val));
+      CHECK(analysis.IsRelatedToStackPointer(val) ==
+            IsRelatedToStackPointer(&module, val));
+    }
+  }
+}
+
+TEST_SUITE("Utils") {
+  TEST_CASE("State register addresses agree with remill's") {
+    llvm::LLVMContext context;
+    auto arch = remill::Arch::Build(&context, remill::GetOSName("linux"),
+                                    remill::GetArchName("amd64"));
+    REQUIRE(arch != nullptr);
+
+    // Registers are only known once the semantics are loaded.
+    auto module = remill::LoadArchSemantics(arch.get());
+    REQUIRE(module != nullptr);
+
+    auto func_type = llvm::FunctionType::get(llvm::Type::getVoidTy(context),
+                                             {arch->StatePointerType()}, false);
+    auto func = llvm::Function::Create(
+        func_type, llvm::GlobalValue::ExternalLinkage, "regs", module.get());
+    auto block = llvm::BasicBlock::Create(context, "", func);
+    auto state_ptr = func->getArg(0);
+    llvm::IRBuilder<> ir(block);
+
+    const auto &dl = module->getDataLayout();
+    auto offset_of = [&](llvm::Value *ptr) {
+      llvm::APInt offset(dl.getPointerSizeInBits(0), 0);
+      CHECK(ptr->stripAndAccumulateConstantOffsets(dl, offset, true) ==
+            state_ptr);
+      return offset.getZExtValue();
+    };
+
+    for (auto name : {"RAX", "EAX", "AH", "RSP", "RIP", "XMM1", "FSBASE"}) {
+      CAPTURE(name);
+      auto reg = arch->RegisterByName(name);
+      REQUIRE(reg != nullptr);
+      auto ptr = StateRegisterAddress(ir, state_ptr, reg);
+      CHECK(ptr->getType()->getPointerElementType() == reg->type);
+      CHECK(offset_of(ptr) == offset_of(reg->AddressOf(state_ptr, ir)));
+      CHECK(offset_of(ptr) == reg->offset);
+    }
+  }
+}
+
+}  // namespace anvill
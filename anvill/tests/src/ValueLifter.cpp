@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <anvill/Lifters/EntityLifter.h>
+#include <anvill/Lifters/Options.h>
+#include <anvill/Lifters/ValueLifter.h>
+#include <doctest.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <remill/Arch/Arch.h>
+#include <remill/Arch/Name.h>
+#include <remill/OS/OS.h>
+
+#include <string_view>
+#include <utility>
+
+namespace anvill {
+
+TEST_SUITE("ValueLifter") {
+  TEST_CASE("Arrays of plain integers are lifted from their bytes") {
+    llvm::LLVMContext context;
+    llvm::Module module("values", context);
+    auto arch = remill::Arch::Build(&context, remill::GetOSName("linux"),
+                                    remill::GetArchName("amd64"));
+    REQUIRE(arch != nullptr);
+
+    LifterOptions options(arch.get(), module, nullptr);
+    EntityLifter lifter(options, nullptr, nullptr);
+    ValueLifter value_lifter(lifter);
+
+    // The high bit of each byte must not leak into the other bytes.
+    static const char kBytes[] = "\x01\x00\x00\x00\xff\x80\x00\x00";
+    const std::string_view data(kBytes, 8u);
+
+    auto i32_type = llvm::Type::getInt32Ty(context);
+    auto array = llvm::dyn_cast_or_null<llvm::ConstantDataArray>(
+        value_lifter.Lift(data, llvm::ArrayType::get(i32_type, 2u)));
+    REQUIRE(array != nullptr);
+    CHECK(array->getElementAsInteger(0u) == 1u);
+    CHECK(array->getElementAsInteger(1u) == 0x80ffu);
+
+    auto i64 = llvm::dyn_cast_or_null<llvm::ConstantInt>(
+        value_lifter.Lift(data, llvm::Type::getInt64Ty(context)));
+    REQUIRE(i64 != nullptr);
+    CHECK(i64->getZExtValue() == 0x000080ff00000001ull);
+  }
+
+  TEST_CASE("Interior addresses map to the lifted variable containing them") {
+    llvm::LLVMContext context;
+    llvm::Module module("values", context);
+    auto arch = remill::Arch::Build(&context, remill::GetOSName("linux"),
+                                    remill::GetArchName("amd64"));
+    REQUIRE(arch != nullptr);
+
+    LifterOptions options(arch.get(), module, nullptr);
+    EntityLifter lifter(options, nullptr, nullptr);
+
+    auto i8_type = llvm::Type::getInt8Ty(context);
+    auto table_type = llvm::ArrayType::get(i8_type, 16u);
+    auto table = new llvm::GlobalVariable(
+        module, table_type, false, llvm::GlobalValue::ExternalLinkage,
+        llvm::Constant::getNullValue(table_type), "table");
+    auto overlapping = new llvm::GlobalVariable(
+        module, table_type, false, llvm::GlobalValue::ExternalLinkage,
+        llvm::Constant::getNullValue(table_type), "overlapping");
+
+    lifter.AddEntity(table, 0x2000u);
+    lifter.AddEntity(overlapping, 0x2008u);
+
+    CHECK(lifter.EntityContainingAddress(0x2000u) ==
+          std::pair<llvm::Constant *, uint64_t>(table, 0u));
+    CHECK(lifter.EntityContainingAddress(0x200fu) ==
+          std::pair<llvm::Constant *, uint64_t>(table, 15u));
+    CHECK(lifter.EntityContainingAddress(0x1fffu).first == nullptr);
+    CHECK(lifter.EntityContainingAddress(0x2010u).first == nullptr);
+
+    // Exact lookups still find the variable that wasn't indexed.
+    CHECK(lifter.AddressOfEntity(overlapping) == 0x2008u);
+  }
+
+  TEST_CASE("Pointers to sentinel addresses are lifted and memoized") {
+    llvm::LLVMContext context;
+    llvm::Module module("values", context);
+    auto arch = remill::Arch::Build(&context, remill::GetOSName("linux"),
+                                    remill::GetArchName("amd64"));
+    REQUIRE(arch != nullptr);
+
+    LifterOptions options(arch.get(), module, nullptr);
+    EntityLifter lifter(options, nullptr, nullptr);
+    ValueLifter value_lifter(lifter);
+
+    // E.g. the `(void *) -1` terminating a constructor list. These are the
+    // keys that `llvm::DenseMap` reserves.
+    auto i8_type = llvm::Type::getInt8Ty(context);
+    auto ptr_type = llvm::PointerType::get(i8_type, 0);
+    for (uint64_t ea : {~0ull, ~0ull - 1ull}) {
+      auto var = new llvm::GlobalVariable(
+          module, i8_type, false, llvm::GlobalValue::ExternalLinkage,
+          llvm::Constant::getNullValue(i8_type));
+      lifter.AddEntity(var, ea);
+
+      auto ptr = value_lifter.Lift(ea, ptr_type);
+      REQUIRE(ptr != nullptr);
+      CHECK(ptr->stripPointerCasts() == var);
+      CHECK(value_lifter.Lift(ea, ptr_type) == ptr);
+    }
+  }
+}
+
+}  // namespace anvill
@@ -20,8 +20,22 @@ option(ANVILL_ENABLE_INSTALL_TARGET "Set to ON to enable the install directives.
 option(ANVILL_ENABLE_PYTHON3_LIBS "Build Python 3 libraries" TRUE)
 cmake_dependent_option(ANVILL_INSTALL_PYTHON3_LIBS "Install Python 3 libraries to the **local machine** at build time. Mostly used for local development, not required for packaging" FALSE
   "ANVILL_ENABLE_PYTHON3_LIBS" FALSE)
+option(ANVILL_ENABLE_PYTHON_BINDINGS "Set to ON to build the anvill_native Python extension module, which lets disassembler plugins lift without going through a JSON spec. Requires pybind11" FALSE)
+set(ANVILL_PYTHON_BINDINGS_INSTALL_DIR "lib/anvill/python" CACHE STRING "Directory, relative to the install prefix, into which to install the anvill_native Python extension module")
 option(ANVILL_ENABLE_TESTS "Set to ON to enable the tests" TRUE)
+option(ANVILL_ENABLE_BENCHMARKS "Set to ON to build the anvill-bench benchmark suite. Requires Google Benchmark" FALSE)
+option(ANVILL_ENABLE_ZSTD "Set to ON to let anvill-decompile-json write zstd-compressed '.zst' outputs. Requires zstd" FALSE)
+option(ANVILL_ENABLE_TRACY "Set to ON to compile in trace zones for the Tracy profiler. Requires Tracy" FALSE)
 option(ANVILL_ENABLE_SANITIZERS "Set to ON to enable sanitizers. May not work with VCPKG")
+option(ANVILL_ENABLE_LTO "Set to ON to build with link-time optimization" FALSE)
+set(ANVILL_LTO_MODE "thin" CACHE STRING "Kind of link-time optimization to do when ANVILL_ENABLE_LTO is ON: 'thin' for ThinLTO, or 'full'")
+set_property(CACHE ANVILL_LTO_MODE PROPERTY STRINGS "thin" "full")
+option(ANVILL_PGO_GENERATE "Set to ON to instrument the build for collecting a profile for profile-guided optimization" FALSE)
+set(ANVILL_PGO_PROFILE "" CACHE FILEPATH "Path to an indexed profile ('.profdata') with which to apply profile-guided optimization")
+option(ANVILL_ENABLE_PRUNED_SEMANTICS "Set to ON to build and install pruned instruction semantics modules, which anvill-decompile-json loads instead of remill's" FALSE)
+set(ANVILL_PRUNED_SEMANTICS_ARCHS "x86;x86_avx;x86_avx512;amd64;amd64_avx;amd64_avx512;aarch64" CACHE STRING "Architectures, named as in remill, for which to build pruned instruction semantics modules")
+option(ANVILL_ENABLE_ALLOCATION_ACCOUNTING "Set to ON to replace operator new and delete in anvill-decompile-json with versions that attribute live heap bytes to the phases of lifting, for --stats_out and --metrics_addr. This adds a header to every allocation" FALSE)
+set(ANVILL_MALLOC_LIBRARY "" CACHE FILEPATH "Path to a malloc replacement library, e.g. jemalloc or mimalloc, to link into anvill-decompile-json")
 
 set(VCPKG_ROOT "" CACHE FILEPATH "Root directory to use for vcpkg-managed dependencies")
 
@@ -17,10 +17,12 @@
 
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <deque>
 #include <memory>
 #include <optional>
 #include <string>
-#include <vector>
 
 namespace anvill {
 
@@ -33,6 +35,23 @@ enum class SeverityType {
   Fatal,
 };
 
+// Controls how much function IR is captured for the errors emitted by
+// function passes. Printing a function to a string is expensive on large
+// functions, so the IR is only captured eagerly when asked for.
+enum class IRSnapshotPolicy {
+
+  // Never capture function IR.
+  None,
+
+  // Capture the function IR only when an error is emitted. The IR from
+  // before the pass ran is not available.
+  OnError,
+
+  // Capture the function IR before every pass runs, so that errors include
+  // the IR from both before and after the transformation.
+  Always,
+};
+
 // An error, as emitted by an LLVM pass
 struct TransformationError final {
 
@@ -59,21 +78,59 @@ struct TransformationError final {
   // name of the function that was being transformed
   std::optional<std::string> function_name;
 
-  // The module IR, before the pass took place
+  // The module IR, before the pass took place. This is only
+  // available under `IRSnapshotPolicy::Always`
   std::optional<std::string> func_before;
 
   // The module IR, after the transformation pass has been
   // executed. It will be empty if nothing changed compared
-  // to the original module iR
+  // to the original module iR, or under `IRSnapshotPolicy::None`
   std::optional<std::string> func_after;
+
+  // Hashes of `func_before` and `func_after`. Only the errors retained by
+  // an error manager for fatal errors keep the IR itself; other retained
+  // errors only keep these hashes, which refer to the IR written to the
+  // error manager's sink.
+  std::optional<uint64_t> func_before_hash;
+  std::optional<uint64_t> func_after_hash;
+};
+
+// A destination to which an error manager streams errors as they're
+// inserted.
+class ITransformationErrorSink {
+ public:
+  using Ptr = std::unique_ptr<ITransformationErrorSink>;
+
+  // Create a sink that appends errors to the file at `path`, one JSON object
+  // per line. Each distinct function IR is written once, on its own line,
+  // and errors refer to it by hash. Returns `nullptr` if the file can't be
+  // opened.
+  static Ptr CreateJSONLines(const std::string &path);
+
+  ITransformationErrorSink(void) = default;
+  virtual ~ITransformationErrorSink(void) = default;
+
+  // Write out an error. This is never called concurrently, but may be called
+  // from a different thread than the one that inserted the error into the
+  // error manager.
+  virtual void Write(const TransformationError &error) = 0;
 };
 
 // An object that is used to collect errors emitted by LLVM
-// passes
+// passes. Errors are streamed to an optional sink, and only the most recent
+// ones are retained in memory, along with every fatal error. Errors can be
+// inserted concurrently.
 class ITransformationErrorManager {
  public:
   using Ptr = std::unique_ptr<ITransformationErrorManager>;
-  static Ptr Create(void);
+
+  // Default number of errors that are retained in memory.
+  static constexpr std::size_t kDefaultMaxRetainedErrors = 1024u;
+
+  static Ptr
+  Create(IRSnapshotPolicy policy = IRSnapshotPolicy::OnError,
+         ITransformationErrorSink::Ptr sink = nullptr,
+         std::size_t max_retained_errors = kDefaultMaxRetainedErrors);
 
   ITransformationErrorManager(void) = default;
   virtual ~ITransformationErrorManager(void) = default;
@@ -86,11 +143,20 @@ class ITransformationErrorManager {
 
   // Returns true if there is at least one error stored that
   // is marked as fatal (i.e. signalling that the LLVM module
-  // is no longer in a good state)
+  // is no longer in a good state). This is cheap enough to be checked
+  // often by concurrent workers, so that they can stop early.
   virtual bool HasFatalError(void) const = 0;
 
-  // Returns a list of all the stored errors
-  virtual const std::vector<TransformationError> &ErrorList(void) const = 0;
+  // Returns a list of the most recently stored errors, and of all the stored
+  // fatal errors, in the order in which they were stored
+  virtual const std::deque<TransformationError> &ErrorList(void) const = 0;
+
+  // Returns the number of errors that were stored, but that are no longer
+  // retained in `ErrorList`
+  virtual std::size_t NumDroppedErrors(void) const = 0;
+
+  // Returns how much function IR passes should capture for their errors
+  virtual IRSnapshotPolicy SnapshotPolicy(void) const = 0;
 };
 
 }  // namespace anvill
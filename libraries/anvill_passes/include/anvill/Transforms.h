@@ -21,14 +21,19 @@
 #include <anvill/ITransformationErrorManager.h>
 #include <anvill/Lifters/Options.h>
 #include <anvill/Lifters/ValueLifter.h>
+#include <llvm/IR/PassManager.h>
+
+#include <memory>
 
 namespace llvm {
 class Function;
 class FunctionPass;
+class ModulePass;
 }  // namespace llvm
 namespace anvill {
 
 class EntityLifter;
+class ReturnAddressCache;
 
 // When lifting conditional control-flow, we end up with the following pattern:
 //
@@ -99,11 +104,19 @@ llvm::FunctionPass *CreateSplitStackFrameAtReturnAddress(
 // NOTE(pag): This pass must be applied before any kind of renaming of lifted
 //            functions is performed, so that we don't accidentally remove
 //            calls to classification functions present in the target binary.
-llvm::FunctionPass *CreateRemoveUnusedFPClassificationCalls(void);
+llvm::ModulePass *CreateRemoveUnusedFPClassificationCalls(void);
 
 // Lowers the `__remill_read_memory_NN`, `__remill_write_memory_NN`, and the
 // various atomic read-modify-write variants into LLVM loads and stores.
-llvm::FunctionPass *CreateLowerRemillMemoryAccessIntrinsics(void);
+llvm::ModulePass *CreateLowerRemillMemoryAccessIntrinsics(void);
+
+// Like the above, but the accesses whose addresses resolve to entities of
+// `lifter`, e.g. `__anvill_pc + 0x1000` where a variable lives at `0x1000`,
+// load from and store to typed pointers into those entities, rather than to
+// an `inttoptr` of the address. This saves `RecoverEntityUseInformation` and
+// `BrightenPointerOperations` from having to see through the integer casts.
+llvm::ModulePass *
+CreateLowerRemillMemoryAccessIntrinsics(const EntityLifter &lifter);
 
 // Type information from prior lifting efforts, or from front-end tools
 // (e.g. Binary Ninja) is plumbed through the system by way of calls to // intrinsic functions such as `__anvill_type<blah>`. These function calls
@@ -114,7 +127,7 @@ llvm::FunctionPass *CreateLowerRemillMemoryAccessIntrinsics(void);
 //
 // These function calls need to be removed/lowered into `inttoptr` or `bitcast`
 // instructions.
-llvm::FunctionPass *CreateLowerTypeHintIntrinsics(void);
+llvm::ModulePass *CreateLowerTypeHintIntrinsics(void);
 
 // Anvill-lifted bitcode operates at a very low level, swapping between integer
 // and pointer representations. It is typically for just-lifted bitcode to
@@ -136,6 +149,13 @@ llvm::FunctionPass *CreateLowerTypeHintIntrinsics(void);
 // brighten integer operations into pointer operations.
 llvm::FunctionPass *CreateBrightenPointerOperations(unsigned max_gas = 250);
 
+// Brighten the pointer operations of `func` in place, exactly like the pass
+// returned by `CreateBrightenPointerOperations` does, and return the number
+// of rounds of brightening that were run. This is meant for tools that
+// profile pointer brightening one function at a time.
+unsigned BrightenPointerOperations(llvm::Function &func,
+                                   unsigned max_gas = 250);
+
 // Transforms the bitcode to eliminate calls to `__remill_function_return`,
 // where appropriate. This will not succeed for all architectures, but is
 // likely to always succeed for x86(-64) and aarch64, due to their support
@@ -166,6 +186,27 @@ llvm::FunctionPass *CreateBrightenPointerOperations(unsigned max_gas = 250);
 llvm::FunctionPass *
 CreateRemoveRemillFunctionReturns(const EntityLifter &lifter);
 
+// Same as above, but remembering the classifications of return addresses, and
+// the intrinsics used to rewrite returns, in `cache`. The same cache can be
+// given to `CreateTransformRemillJumpIntrinsics`, so that a call rewritten by
+// that pass doesn't need to be classified again by this one.
+llvm::FunctionPass *
+CreateRemoveRemillFunctionReturns(std::shared_ptr<ReturnAddressCache> cache);
+
+// Creates a cache of return address classifications that can be shared
+// between `CreateTransformRemillJumpIntrinsics` and
+// `CreateRemoveRemillFunctionReturns`.
+std::shared_ptr<ReturnAddressCache>
+CreateReturnAddressCache(const EntityLifter &lifter);
+
+// Does the work of `CreateTransformRemillJumpIntrinsics`,
+// `CreateRemoveRemillFunctionReturns`, and
+// `CreateLowerRemillUndefinedIntrinsics`, in that order, as one module pass.
+// Each call to `__remill_jump` or `__remill_function_return` is classified
+// only once, and a jump to the return address is removed directly, instead of
+// first being turned into a call to `__remill_function_return`.
+llvm::ModulePass *CreateCleanUpRemillIntrinsics(const EntityLifter &lifter);
+
 // This function pass makes use of the `__anvill_sp` usages to create an
 // `llvm::StructType` that acts as a stack frame. This initial stack frame
 // is an array of bytes. The initial purpose of this stack frame is to observe
@@ -179,6 +220,15 @@ llvm::FunctionPass *
 CreateRecoverStackFrameInformation(ITransformationErrorManager &error_manager,
                                    const LifterOptions &options);
 
+// This function pass is equivalent to `CreateRecoverStackFrameInformation`
+// followed by `CreateSplitStackFrameAtReturnAddress`, but it finds the return
+// address slots while it recovers the stack frame, and allocates the split
+// stack frame parts directly. This avoids creating, then re-analyzing and
+// rewriting, the whole stack frame.
+llvm::FunctionPass *
+CreateRecoverAndSplitStackFrame(ITransformationErrorManager &error_manager,
+                                const LifterOptions &options);
+
 // Anvill-lifted code is full of references to constant expressions related
 // to `__anvill_pc`. These constant expressions exist to "taint" values as
 // being possibly related to the program counter, and thus likely being
@@ -208,7 +258,7 @@ CreateRecoverEntityUseInformation(ITransformationErrorManager &error_manager,
 //
 // This pass exists to do the lowering to `undef` values, and should be run
 // as late as possible.
-llvm::FunctionPass *CreateLowerRemillUndefinedIntrinsics(void);
+llvm::ModulePass *CreateLowerRemillUndefinedIntrinsics(void);
 
 // This function pass will attempt to fold the following instruction
 // combinations:
@@ -238,6 +288,11 @@ llvm::FunctionPass *CreateRemoveTrivialPhisAndSelects(void);
 llvm::FunctionPass *
 CreateTransformRemillJumpIntrinsics(const EntityLifter &lifter);
 
+// Same as above, but sharing the return address classifications in `cache`
+// with `CreateRemoveRemillFunctionReturns`.
+llvm::FunctionPass *
+CreateTransformRemillJumpIntrinsics(std::shared_ptr<ReturnAddressCache> cache);
+
 // Finds values in the form of:
 // %cmp = icmp eq val1, val2
 // %n = xor %cmp, 1
@@ -254,12 +309,52 @@ CreateTransformRemillJumpIntrinsics(const EntityLifter &lifter);
 // in Branches and Selects
 llvm::FunctionPass *CreateConvertXorToCmp(void);
 
+// Runs several of the above narrow clean-ups as rules of one peephole pass,
+// in a single work list over a function, rather than as a function sweep
+// each. The rules are those of `RemoveTrivialPhisAndSelects`,
+// `ConvertXorToCmp`, and `RemoveUnusedFPClassificationCalls`, along with the
+// removal of trivially dead instructions. Every instruction is visited once,
+// and when a rule changes an instruction, only the users of the changed
+// instruction, and the operands of erased instructions, are revisited.
+llvm::FunctionPass *CreatePeepholes(void);
+
 // Removes calls to `__remill_delay_slot_begin` and `__remill_delay_slot_end`.
 // These calls surround the lifted versions of delayed instructions, to signal
 // their location in the bitcode.
-llvm::FunctionPass *CreateRemoveDelaySlotIntrinsics(void);
+llvm::ModulePass *CreateRemoveDelaySlotIntrinsics(void);
 
 // Removes calls to `__remill_error`.
-llvm::FunctionPass *CreateRemoveErrorIntrinsics(void);
+llvm::ModulePass *CreateRemoveErrorIntrinsics(void);
+
+// Merges the lifted functions of `module` whose optimized code is the same.
+// Functions are compared with LLVM's `FunctionComparator`, which ignores
+// metadata such as PC annotations and provenance records, and so unlike
+// LLVM's `MergeFunctions` pass, the address annotations of lifted code don't
+// keep otherwise identical functions apart. Of each group of equivalent
+// functions, the one at the lowest address keeps its body, and the others
+// become thunks that tail-call it. Their names, and their places in the
+// entity map of `lifter`, are unchanged, so their callers still refer to
+// them. Returns the number of functions that became thunks.
+//
+// This should be run after `__anvill_pc` has been replaced, as that is what
+// folds the addresses in lifted code into plain constants that can be compared.
+unsigned MergeEquivalentFunctions(llvm::Module &module,
+                                  const EntityLifter &lifter);
+
+// Adapts one of the above function passes so that it can be run by the new
+// pass manager. If `preserves_cfg` is `true`, then the pass promises never to
+// add or remove blocks or edges, which lets CFG analyses (e.g. dominator trees
+// and loop info) stay cached across runs of the pass.
+class LegacyPassAdaptor : public llvm::PassInfoMixin<LegacyPassAdaptor> {
+ public:
+  LegacyPassAdaptor(llvm::FunctionPass *pass_, bool preserves_cfg_);
+
+  llvm::PreservedAnalyses run(llvm::Function &func,
+                              llvm::FunctionAnalysisManager &fam);
+
+ private:
+  std::unique_ptr<llvm::FunctionPass> pass;
+  bool preserves_cfg;
+};
 
 }  // namespace anvill
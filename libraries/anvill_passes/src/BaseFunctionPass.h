@@ -30,6 +30,7 @@
 #include <remill/BC/Version.h>
 
 #include <magic_enum.hpp>
+#include <optional>
 #include <sstream>
 #include <unordered_set>
 
@@ -64,8 +65,9 @@ class BaseFunctionPass : public llvm::FunctionPass {
   // Module name
   std::string original_module_name;
 
-  // Module IR, before the function pass
-  std::string original_function_ir;
+  // Module IR, before the function pass. This is only captured under
+  // `IRSnapshotPolicy::Always`
+  std::optional<std::string> original_function_ir;
 
   // Current function name
   std::string original_function_name;
@@ -86,6 +88,12 @@ class BaseFunctionPass : public llvm::FunctionPass {
   InstructionReferencesStackPointer(llvm::Module *module,
                                     const llvm::Instruction &instr);
 
+  // Returns true if this instruction references the stack pointer, reusing
+  // the answers that `analysis` already has
+  static bool
+  InstructionReferencesStackPointer(SymbolicValueAnalysis &analysis,
+                                    const llvm::Instruction &instr);
+
   // Returns true if this is either a store or a load instruction
   static bool IsMemoryOperation(const llvm::Instruction &instr);
 
@@ -138,7 +146,11 @@ bool BaseFunctionPass<UserFunctionPass>::runOnFunction(
     llvm::Function &function_) {
   function = &function_;
   module = function->getParent();
-  original_function_ir = GetFunctionIR(*function);
+  if (error_manager.SnapshotPolicy() == IRSnapshotPolicy::Always) {
+    original_function_ir = GetFunctionIR(*function);
+  } else {
+    original_function_ir.reset();
+  }
   original_module_name = module->getName().str();
   original_function_name = function->getName().str();
 
@@ -150,13 +162,21 @@ template <typename UserFunctionPass>
 bool BaseFunctionPass<UserFunctionPass>::InstructionReferencesStackPointer(
     llvm::Module *module, const llvm::Instruction &instr) {
 
+  SymbolicValueAnalysis analysis(module);
+  return InstructionReferencesStackPointer(analysis, instr);
+}
+
+template <typename UserFunctionPass>
+bool BaseFunctionPass<UserFunctionPass>::InstructionReferencesStackPointer(
+    SymbolicValueAnalysis &analysis, const llvm::Instruction &instr) {
+
   auto operand_count = instr.getNumOperands();
 
   for (auto operand_index = 0U; operand_index < operand_count;
        ++operand_index) {
 
     auto operand = instr.getOperand(operand_index);
-    if (IsRelatedToStackPointer(module, operand)) {
+    if (analysis.IsRelatedToStackPointer(operand)) {
       return true;
     }
   }
@@ -229,11 +249,21 @@ void BaseFunctionPass<UserFunctionPass>::EmitError(SeverityType severity,
   error.message = message;
   error.module_name = original_module_name;
   error.function_name = original_function_name;
-  error.func_before = original_function_ir;
 
-  auto current_func_ir = GetFunctionIR(*function);
-  if (current_func_ir != error.func_before) {
-    error.func_after = current_func_ir;
+  switch (error_manager.SnapshotPolicy()) {
+    case IRSnapshotPolicy::None: break;
+    case IRSnapshotPolicy::OnError:
+      error.func_after = GetFunctionIR(*function);
+      break;
+    case IRSnapshotPolicy::Always: {
+      error.func_before = original_function_ir;
+
+      auto current_func_ir = GetFunctionIR(*function);
+      if (current_func_ir != error.func_before) {
+        error.func_after = std::move(current_func_ir);
+      }
+      break;
+    }
   }
 
   std::stringstream buffer;
@@ -19,9 +19,13 @@
 
 #include <anvill/Transforms.h>
 #include <glog/logging.h>
+#include <llvm/ADT/SmallPtrSet.h>
 #include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/Statistic.h>
 #include <llvm/IR/LegacyPassManager.h>
 #include <llvm/IR/Module.h>
+#include <llvm/IR/ValueHandle.h>
+#include <llvm/IR/ValueMap.h>
 #include <llvm/Passes/PassBuilder.h>
 #include <remill/BC/Compat/ScalarTransforms.h>
 #include <remill/BC/Util.h>
@@ -30,8 +34,44 @@
 
 #include "Utils.h"
 
+#define DEBUG_TYPE "brighten-pointer-operations"
+
+STATISTIC(NumRounds, "Number of rounds of pointer brightening");
+STATISTIC(NumVisits, "Number of instructions visited by pointer brightening");
+STATISTIC(NumReplacements, "Number of instructions replaced by brighter ones");
+STATISTIC(NumOutOfGas, "Number of functions that ran out of brightening gas");
 
 namespace anvill {
+namespace {
+
+// Instructions that have already been visited at least once. Entries are
+// dropped when their instructions are deleted, so that a new instruction
+// placed at the same address isn't mistaken for an old one.
+struct VisitedConfig : public llvm::ValueMapConfig<llvm::Instruction *> {
+  enum { FollowRAUW = false };
+};
+
+using VisitedMap = llvm::ValueMap<llvm::Instruction *, bool, VisitedConfig>;
+
+// Add `val`, and all of its transitive users, to `work_list`.
+static void AddUsersToWorkList(llvm::Value *val,
+                               llvm::SmallPtrSetImpl<llvm::Value *> &seen,
+                               std::vector<llvm::WeakVH> &work_list) {
+  llvm::SmallVector<llvm::Value *, 16> pending;
+  pending.push_back(val);
+  while (!pending.empty()) {
+    auto curr = pending.pop_back_val();
+    if (!llvm::isa<llvm::Instruction>(curr) || !seen.insert(curr).second) {
+      continue;
+    }
+    work_list.emplace_back(curr);
+    for (auto user : curr->users()) {
+      pending.push_back(user);
+    }
+  }
+}
+
+}  // namespace
 
 char PointerLifterPass::ID = '\0';
 
@@ -74,23 +114,32 @@ llvm::Value *PointerLifter::getPointerToValue(llvm::IRBuilder<> &ir,
   return ptr_cast;
 }
 
+llvm::Type *PointerLifter::InferredType(llvm::Instruction *inst) const {
+  if (auto it = inferences.find(inst); it != inferences.end()) {
+    return it->second.current;
+  }
+  return nullptr;
+}
+
 std::pair<llvm::Value *, bool>
 PointerLifter::visitInferInst(llvm::Instruction *inst,
                               llvm::Type *inferred_type) {
-  auto &inferred_val_type = inferred_types[inst];
-  auto &next_inferred_val_type = next_inferred_types[inst];
+  auto &inference = inferences[inst];
 
   // We're the first ones making an inference.
-  if (!inferred_val_type) {
-    inferred_val_type = inferred_type;
-    next_inferred_val_type = nullptr;
+  if (!inference.current) {
+    inference.current = inferred_type;
+    inference.next = nullptr;
     bool changed = false;
     llvm::Value *first_ret = nullptr;
 
     // In the process of visiting the instruction, if we come back across
-    // ourselves, then `next_inferred_val_type` will be set up to a non-null
-    // pointer and we'll re-recurse on that updated value.
-    while (inferred_val_type) {
+    // ourselves, then `next` will be set up to a non-null pointer and we'll
+    // re-recurse on that updated value.
+    //
+    // Visiting may add new inferences, which can move existing ones around, so
+    // `inferences` is looked into again after each visit.
+    for (auto curr_type = inferred_type; curr_type;) {
       const auto ret = visit(inst);
       if (!first_ret || ret.first->getType() == inferred_type) {
         first_ret = ret.first;
@@ -99,28 +148,29 @@ PointerLifter::visitInferInst(llvm::Instruction *inst,
         changed = true;
       }
 
-      inferred_val_type = next_inferred_val_type;
-      next_inferred_val_type = nullptr;
+      auto &curr_inference = inferences[inst];
+      curr_type = curr_inference.next;
+      curr_inference.current = curr_type;
+      curr_inference.next = nullptr;
 
       // Prevent cycling back and forth.
-      if (inferred_val_type == inferred_type) {
+      if (curr_type == inferred_type) {
         break;
       }
     }
 
-    inferred_val_type = nullptr;
-    next_inferred_val_type = nullptr;
+    inferences.erase(inst);
     return {first_ret, changed && first_ret->getType() == inferred_type};
 
   // We are recursively processing the same inference.
-  } else if (inferred_val_type == inferred_type) {
+  } else if (inference.current == inferred_type) {
     return {inst, false};
 
   // We're recursively making a /different/ inference than some parent caller.
   // Set it up so that the top-level caller commits to the last nest inferred
   // value type.
   } else {
-    next_inferred_val_type = inferred_type;
+    inference.next = inferred_type;
     return {inst, false};
   }
 }
@@ -279,7 +329,7 @@ define i64 @valid_test(i32** %0) local_unnamed_addr #1 {
 */
 std::pair<llvm::Value *, bool>
 PointerLifter::visitBitCastInst(llvm::BitCastInst &inst) {
-  llvm::Type *inferred_type = inferred_types[&inst];
+  llvm::Type *inferred_type = InferredType(&inst);
   if (inferred_type) {
 
     // If there is a bitcast that we could not eliminate for some reason (fell
@@ -496,7 +546,7 @@ PointerLifter::BrightenGEP_PeelLastIndex(llvm::GetElementPtrInst *gep,
 //      i. if works, update last
 std::pair<llvm::Value *, bool>
 PointerLifter::visitGetElementPtrInst(llvm::GetElementPtrInst &inst) {
-  llvm::Type *inferred_type = inferred_types[&inst];
+  llvm::Type *inferred_type = InferredType(&inst);
   if (!inferred_type) {
     return {&inst, false};
   }
@@ -517,7 +567,7 @@ PointerLifter::visitGetElementPtrInst(llvm::GetElementPtrInst &inst) {
 
 std::pair<llvm::Value *, bool>
 PointerLifter::visitPtrToIntInst(llvm::PtrToIntInst &inst) {
-  llvm::Type *inferred_type = inferred_types[&inst];
+  llvm::Type *inferred_type = InferredType(&inst);
   if (!inferred_type) {
     return {&inst, false};
   }
@@ -578,7 +628,7 @@ PointerLifter::visitIntToPtrInst(llvm::IntToPtrInst &inst) {
 std::pair<llvm::Value *, bool>
 PointerLifter::visitPHINode(llvm::PHINode &inst) {
 
-  llvm::Type *inferred_type = inferred_types[&inst];
+  llvm::Type *inferred_type = InferredType(&inst);
   if (!inferred_type) {
 
     //    DLOG(WARNING) << "No type info for load! Returning just the phi node\n";
@@ -636,7 +686,7 @@ PointerLifter::visitPHINode(llvm::PHINode &inst) {
 */
 std::pair<llvm::Value *, bool>
 PointerLifter::visitLoadInst(llvm::LoadInst &inst) {
-  llvm::Type *inferred_type = inferred_types[&inst];
+  llvm::Type *inferred_type = InferredType(&inst);
   if (!inferred_type) {
     return {&inst, false};
   }
@@ -757,7 +807,7 @@ PointerLifter::visitBinaryOperator(llvm::BinaryOperator &binop) {
   llvm::Value *lhs_op = inst->getOperand(0);
   llvm::Value *rhs_op = inst->getOperand(1);
 
-  llvm::Type *inferred_type = inferred_types[inst];
+  llvm::Type *inferred_type = InferredType(inst);
   if (!inferred_type) {
 
     // This looks naive but it's not
@@ -914,7 +964,7 @@ PointerLifter::visitBinaryOperator(llvm::BinaryOperator &binop) {
 
 std::pair<llvm::Value *, bool>
 PointerLifter::visitReturnInst(llvm::ReturnInst &inst) {
-  llvm::Type *inferred_type = inferred_types[&inst];
+  llvm::Type *inferred_type = InferredType(&inst);
   if (!inferred_type) {
     return {&inst, false};
   }
@@ -934,7 +984,7 @@ PointerLifter::visitReturnInst(llvm::ReturnInst &inst) {
 
 std::pair<llvm::Value *, bool>
 PointerLifter::visitStoreInst(llvm::StoreInst &inst) {
-  llvm::Type *inferred_type = inferred_types[&inst];
+  llvm::Type *inferred_type = InferredType(&inst);
   if (!inferred_type) {
     return {&inst, false};
   }
@@ -947,7 +997,7 @@ PointerLifter::visitStoreInst(llvm::StoreInst &inst) {
 
 std::pair<llvm::Value *, bool>
 PointerLifter::visitAllocaInst(llvm::AllocaInst &inst) {
-  llvm::Type *inferred_type = inferred_types[&inst];
+  llvm::Type *inferred_type = InferredType(&inst);
   if (!inferred_type) {
     return {&inst, false};
   }
@@ -959,7 +1009,7 @@ PointerLifter::visitAllocaInst(llvm::AllocaInst &inst) {
 
 std::pair<llvm::Value *, bool>
 PointerLifter::visitSExtInst(llvm::SExtInst &inst) {
-  llvm::Type *inferred_type = inferred_types[&inst];
+  llvm::Type *inferred_type = InferredType(&inst);
   if (!inferred_type) {
     return {&inst, false};
   }
@@ -976,7 +1026,7 @@ PointerLifter::visitSExtInst(llvm::SExtInst &inst) {
 
 std::pair<llvm::Value *, bool>
 PointerLifter::visitZExtInst(llvm::ZExtInst &inst) {
-  llvm::Type *inferred_type = inferred_types[&inst];
+  llvm::Type *inferred_type = InferredType(&inst);
   if (!inferred_type) {
     return {&inst, false};
   }
@@ -996,7 +1046,7 @@ PointerLifter::visitZExtInst(llvm::ZExtInst &inst) {
 // The interesting case will be to visit constant expressions
 std::pair<llvm::Value *, bool>
 PointerLifter::visitCmpInst(llvm::CmpInst &inst) {
-  llvm::Type *inferred_type = inferred_types[&inst];
+  llvm::Type *inferred_type = InferredType(&inst);
   if (!inferred_type) {
     return {&inst, false};
   }
@@ -1011,9 +1061,14 @@ It creates a worklist out of the instructions in the original function and
 visits them. In order to do downstream pointer propagation, additional uses of
 updated values are added into the next_worklist. Pointer lifting for a function
 is done when we reach a fixed point, when the next_worklist is empty.
+
+Only the first round visits every instruction. Later rounds only visit new
+instructions, and the replacements of replaced instructions along with
+everything downstream of them, as nothing else can have changed. `max_gas`
+is only a safety net against rounds that keep on replacing things.
 */
 
-void PointerLifter::LiftFunction(llvm::Function &func) {
+unsigned PointerLifter::LiftFunction(llvm::Function &func) {
   std::vector<llvm::Instruction *> worklist;
   std::vector<llvm::GetElementPtrInst *> gep_list;
 
@@ -1041,16 +1096,38 @@ void PointerLifter::LiftFunction(llvm::Function &func) {
   fpm.run(func);
   fpm.doFinalization();
 
+  VisitedMap visited;
+  std::vector<llvm::WeakVH> next_worklist;
+  llvm::SmallPtrSet<llvm::Value *, 32> seen;
+  llvm::SmallPtrSet<llvm::Value *, 32> queued;
+
   made_progress = true;
-  for (auto i = 0u; i < max_gas && made_progress; ++i) {
+  auto i = 0u;
+  for (; i < max_gas && made_progress; ++i) {
     made_progress = false;
+    ++NumRounds;
 
+    seen.clear();
     for (auto &block : func) {
       for (auto &inst : block) {
-        worklist.push_back(&inst);
+        if (visited.insert({&inst, true}).second && seen.insert(&inst).second) {
+          worklist.push_back(&inst);
+        }
       }
     }
 
+    // Queued instructions may have been deleted, or may have been removed from
+    // their blocks, since being queued.
+    for (auto &val : next_worklist) {
+      if (auto inst = llvm::dyn_cast_or_null<llvm::Instruction>(val);
+          inst && inst->getParent() && seen.insert(inst).second) {
+        worklist.push_back(inst);
+      }
+    }
+    next_worklist.clear();
+    queued.clear();
+
+    NumVisits += worklist.size();
     for (auto inst : worklist) {
       visit(inst);
     }
@@ -1065,7 +1142,7 @@ void PointerLifter::LiftFunction(llvm::Function &func) {
 
     // NOTE(Carson): We had a thought about how to change this... but i can't remember
     for (auto inst : to_remove) {
-      if (auto rep_inst = rep_map[inst];
+      if (auto rep_inst = rep_map.lookup(inst);
           rep_inst && rep_inst->getType() == inst->getType()) {
 
         // DLOG(ERROR) << "Replacing:\n";
@@ -1073,6 +1150,11 @@ void PointerLifter::LiftFunction(llvm::Function &func) {
         // DLOG(ERROR) << remill::LLVMThingToString(rep_inst) << "\n";
         CopyMetadataTo(inst, rep_inst);
         inst->replaceAllUsesWith(rep_inst);
+        ++NumReplacements;
+
+        // Revisit the replacement, and everything downstream of it, in the
+        // next round.
+        AddUsersToWorkList(rep_inst, queued, next_worklist);
       } else {
         DLOG(ERROR) << "Can't replace these two:\n";
         DLOG(ERROR) << remill::LLVMThingToString(inst) << "\n";
@@ -1083,19 +1165,23 @@ void PointerLifter::LiftFunction(llvm::Function &func) {
       if (inst->use_empty()) {
         inst->eraseFromParent();
         rep_map.erase(inst);
-        inferred_types.erase(inst);
-        next_inferred_types.erase(inst);
+        inferences.erase(inst);
       }
     }
     rep_map.clear();
-    inferred_types.clear();
-    next_inferred_types.clear();
+    inferences.clear();
     to_remove.clear();
 
     fpm.doInitialization();
     fpm.run(func);
     fpm.doFinalization();
   }
+
+  if (made_progress && i == max_gas) {
+    ++NumOutOfGas;
+  }
+
+  return i;
 }
 
 // Anvill-lifted bitcode operates at a very low level, swapping between integer
@@ -1120,4 +1206,9 @@ llvm::FunctionPass *CreateBrightenPointerOperations(unsigned max_gas) {
   return new PointerLifterPass(max_gas ? max_gas : 250u);
 }
 
+unsigned BrightenPointerOperations(llvm::Function &func, unsigned max_gas) {
+  PointerLifter lifter(&func, max_gas ? max_gas : 250u);
+  return lifter.LiftFunction(func);
+}
+
 }  // namespace anvill
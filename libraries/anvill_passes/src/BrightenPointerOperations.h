@@ -17,6 +17,8 @@
 
 #pragma once
 
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SetVector.h>
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/InstVisitor.h>
 #include <llvm/IR/Instruction.h>
@@ -25,8 +27,6 @@
 
 #include <algorithm>
 #include <string>
-#include <unordered_map>
-#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -99,19 +99,30 @@ class PointerLifter
   llvm::Value *GetIndexedPointer(llvm::IRBuilder<> &ir, llvm::Value *address,
                                  llvm::Value *offset, llvm::Type *t) const;
 
-  // Driver method
-  void LiftFunction(llvm::Function &func);
+  // Driver method. Returns the number of rounds of brightening that were run.
+  unsigned LiftFunction(llvm::Function &func);
 
  private:
   // Maximum number of iterations that `LiftFunction` is allowed to perform.
   const unsigned max_gas;
 
-  std::unordered_map<llvm::Value *, llvm::Type *> inferred_types;
-  std::unordered_map<llvm::Value *, llvm::Type *> next_inferred_types;
+  // The type currently being inferred for an instruction, and the type that a
+  // nested visit wants to infer for it next. See `visitInferInst`.
+  struct Inference {
+    llvm::Type *current{nullptr};
+    llvm::Type *next{nullptr};
+  };
 
-  std::unordered_set<llvm::Instruction *> to_remove;
-  std::unordered_map<llvm::Instruction *, llvm::Value *> rep_map;
-  std::unordered_map<llvm::Instruction *, bool> dead_inst;
+  // Returns the type currently being inferred for `inst`, if any. Unlike
+  // indexing `inferences`, this doesn't add an entry for `inst`.
+  llvm::Type *InferredType(llvm::Instruction *inst) const;
+
+  llvm::DenseMap<llvm::Instruction *, Inference> inferences;
+
+  // Instructions to replace at the end of this round, in the order in which
+  // their replacements were made, and what to replace them with.
+  llvm::SmallSetVector<llvm::Instruction *, 32> to_remove;
+  llvm::DenseMap<llvm::Instruction *, llvm::Value *> rep_map;
 
   // Whether or not progress has been made, e.g. a new type was inferred.
   bool made_progress{false};
@@ -18,6 +18,9 @@
 #include "InstructionFolderPass.h"
 
 #include <glog/logging.h>
+#include <llvm/ADT/PostOrderIterator.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/IR/CFG.h>
 
 #include <iostream>
 #include <magic_enum.hpp>
@@ -175,10 +178,22 @@ bool InstructionFolderPass::Run(llvm::Function &function) {
   }
 
   dt.reset(new llvm::DominatorTree(function));
-
-  // Create an initial queue of possible candidates
-  auto next_worklist =
-      SelectInstructions<llvm::SelectInst, llvm::PHINode>(function);
+  phi_incoming_values.clear();
+
+  // Create an initial queue of possible candidates. Visiting the blocks in
+  // reverse post-order means that a `select` or `PHINode` is folded before
+  // the ones that are computed from it, so that most folds happen in the
+  // first round.
+  InstructionList next_worklist;
+  llvm::ReversePostOrderTraversal<llvm::Function *> rpo(&function);
+  for (auto block : rpo) {
+    for (auto &instr : *block) {
+      if (llvm::isa<llvm::SelectInst>(instr) ||
+          llvm::isa<llvm::PHINode>(instr)) {
+        next_worklist.push_back(&instr);
+      }
+    }
+  }
 
   std::unordered_set<llvm::Instruction *> visited_instructions;
 
@@ -224,6 +239,7 @@ bool InstructionFolderPass::Run(llvm::Function &function) {
     }
   }
 
+  phi_incoming_values.clear();
   return function_changed;
 }
 
@@ -289,6 +305,15 @@ bool InstructionFolderPass::FoldSelectInstruction(
 void InstructionFolderPass::PerformInstructionReplacements(
     const InstructionReplacementList &replacement_list) {
   for (const auto &repl : replacement_list) {
+
+    // Forget what we know about the PHI nodes whose incoming values are
+    // about to change.
+    for (auto user : repl.original_instr->users()) {
+      if (auto phi_node = llvm::dyn_cast<llvm::PHINode>(user)) {
+        phi_incoming_values.erase(phi_node);
+      }
+    }
+
     repl.replacement_instr->copyMetadata(*repl.original_instr);
     repl.original_instr->replaceAllUsesWith(repl.replacement_instr);
     repl.original_instr->eraseFromParent();
@@ -300,19 +325,30 @@ void InstructionFolderPass::PerformInstructionReplacements(
 static inline bool
 IsPHINodeFoldable(llvm::Instruction *instr,
                   InstructionFolderPass::IncomingValueList &incoming_values) {
+  llvm::SmallPtrSet<llvm::Value *, 16> users(instr->user_begin(),
+                                             instr->user_end());
   for (auto &incoming_value : incoming_values) {
-    if (llvm::isa<llvm::PHINode>(incoming_value.value)) {
+    if (llvm::isa<llvm::PHINode>(incoming_value.value) ||
+        users.count(incoming_value.value)) {
       return false;
     }
-    for (auto user : instr->users()) {
-      if (user == incoming_value.value) {
-        return false;
-      }
-    }
   }
   return true;
 }
 
+const InstructionFolderPass::IncomingValueMap &
+InstructionFolderPass::GetIncomingValues(llvm::PHINode *phi_node) {
+  auto [it, added] = phi_incoming_values.emplace(phi_node, IncomingValueMap());
+  if (added) {
+    auto &vals = it->second;
+    auto num_incoming_blocks = phi_node->getNumIncomingValues();
+    for (auto i = 0u; i < num_incoming_blocks; ++i) {
+      vals[phi_node->getIncomingBlock(i)] = phi_node->getIncomingValue(i);
+    }
+  }
+  return it->second;
+}
+
 bool InstructionFolderPass::FoldPHINode(
     InstructionFolderPass::InstructionList &output, llvm::Instruction *instr) {
 
@@ -757,17 +793,19 @@ bool InstructionFolderPass::FoldPHINodeWithGEPInst(
   //
   // In this case, we want our value map to discover that `index` has a mapped
   // value for each predecessor block, specifically, `index1` and `index2`.
-  for (auto &inst : *curr_block) {
-    if (auto phi_in_block = llvm::dyn_cast<llvm::PHINode>(&inst)) {
-      auto &vals = value_map[phi_in_block];
-      auto num_incoming_blocks = phi_in_block->getNumIncomingValues();
-      for (auto i = 0u; i < num_incoming_blocks; ++i) {
-        auto iv = phi_in_block->getIncomingValue(i);
-        auto ib = phi_in_block->getIncomingBlock(i);
-        vals[ib] = iv;
-      }
-    } else {
-      break;
+  //
+  // Only the PHI nodes used by the GEP matter here, and their incoming values
+  // are memoized, as the same PHI nodes are looked at again for every GEP that
+  // uses them.
+  for (llvm::Use &op : gep_instr->operands()) {
+    auto phi_in_block = llvm::dyn_cast<llvm::PHINode>(op.get());
+    if (!phi_in_block || phi_in_block->getParent() != curr_block) {
+      continue;
+    }
+
+    auto &vals = value_map[phi_in_block];
+    for (auto [ib, iv] : GetIncomingValues(phi_in_block)) {
+      vals[ib] = iv;
     }
   }
 
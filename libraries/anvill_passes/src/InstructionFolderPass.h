@@ -19,8 +19,11 @@
 
 #include "BaseFunctionPass.h"
 
+#include <llvm/ADT/DenseMap.h>
 #include <llvm/IR/Dominators.h>
 
+#include <unordered_map>
+
 namespace anvill {
 
 class InstructionFolderPass final
@@ -68,7 +71,7 @@ class InstructionFolderPass final
 
   // Performs instruction replacements according to the given list, removing the
   // dropping all the instructions that are no longer needed
-  static void PerformInstructionReplacements(
+  void PerformInstructionReplacements(
       const InstructionReplacementList &replacement_list);
 
   // Folds `PHINode` instructions interacting with `CastInst`,
@@ -157,7 +160,20 @@ class InstructionFolderPass final
                                      IncomingValueList &incoming_values,
                                      llvm::Instruction *cast_instr);
 
+  // Maps the incoming blocks of a PHI node to their incoming values
+  using IncomingValueMap = llvm::SmallDenseMap<llvm::BasicBlock *,
+                                               llvm::Value *, 4>;
+
+  // Returns the incoming values of `phi_node`, computing them the first time
+  // that `phi_node` is asked about
+  const IncomingValueMap &GetIncomingValues(llvm::PHINode *phi_node);
+
   std::unique_ptr<llvm::DominatorTree> dt;
+
+  // Memoized incoming values of the PHI nodes seen during a `Run`. PHI nodes
+  // are only erased at the end of a `Run`, and an entry is dropped whenever
+  // an incoming value of its PHI node is replaced.
+  std::unordered_map<llvm::PHINode *, IncomingValueMap> phi_incoming_values;
 };
 
 }  // namespace anvill
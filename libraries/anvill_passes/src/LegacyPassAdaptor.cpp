@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <anvill/Transforms.h>
+#include <llvm/IR/Function.h>
+#include <llvm/Pass.h>
+
+namespace anvill {
+
+LegacyPassAdaptor::LegacyPassAdaptor(llvm::FunctionPass *pass_,
+                                     bool preserves_cfg_)
+    : pass(pass_),
+      preserves_cfg(preserves_cfg_) {}
+
+llvm::PreservedAnalyses
+LegacyPassAdaptor::run(llvm::Function &func,
+                       llvm::FunctionAnalysisManager &) {
+
+  // None of anvill's function passes depend on legacy analyses, so they can be
+  // invoked directly, outside of a legacy pass manager.
+  if (func.isDeclaration() || !pass->runOnFunction(func)) {
+    return llvm::PreservedAnalyses::all();
+  }
+
+  llvm::PreservedAnalyses preserved;
+  if (preserves_cfg) {
+    preserved.preserveSet<llvm::CFGAnalyses>();
+  }
+  return preserved;
+}
+
+}  // namespace anvill
@@ -15,38 +15,111 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <anvill/Analysis/CrossReferenceResolver.h>
+#include <anvill/Lifters/ValueLifter.h>
 #include <anvill/Transforms.h>
 #include <glog/logging.h>
 #include <llvm/IR/Function.h>
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/Instruction.h>
 #include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
 #include <llvm/Pass.h>
 
+#include <optional>
+
 #include "Utils.h"
 
 namespace anvill {
 namespace {
 
-class LowerRemillMemoryAccessIntrinsics final : public llvm::FunctionPass {
+// Finds the lifted entities that memory accesses refer to.
+class AccessedEntityResolver {
  public:
-  LowerRemillMemoryAccessIntrinsics(void) : llvm::FunctionPass(ID) {}
+  explicit AccessedEntityResolver(const EntityLifter &lifter)
+      : xref_resolver(lifter),
+        value_lifter(lifter) {}
 
-  bool runOnFunction(llvm::Function &func) final;
+  // Returns a pointer to the `val_type` at `addr`, if `addr` resolves to a
+  // lifted entity, or `nullptr` otherwise.
+  llvm::Value *TryResolve(llvm::IRBuilder<> &ir, llvm::Value *addr,
+                          llvm::Type *val_type) const;
+
+ private:
+  const CrossReferenceResolver xref_resolver;
+  const ValueLifter value_lifter;
+};
+
+llvm::Value *AccessedEntityResolver::TryResolve(llvm::IRBuilder<> &ir,
+                                                llvm::Value *addr,
+                                                llvm::Type *val_type) const {
+
+  // Lowering replaces calls, and the results of some calls are the addresses of
+  // other accesses, so cached resolutions could refer to deleted values.
+  const auto xref = xref_resolver.TryResolveReferenceWithClearedCache(addr);
+  if (!xref.is_valid || xref.references_stack_pointer ||
+      xref.references_return_address) {
+    return nullptr;
+  }
+
+  // Same criteria as `RecoverEntityUseInformation`.
+  if (!xref.hinted_value_type && !xref.references_entity &&
+      !xref.references_global_value && !xref.references_program_counter) {
+    return nullptr;
+  }
+
+  const auto ptr_type = llvm::PointerType::get(val_type, 0);
+  const auto entity = value_lifter.Lift(xref.u.address, ptr_type);
+  if (!entity) {
+    return nullptr;
+  }
+  return ir.CreatePointerBitCastOrAddrSpaceCast(entity, ptr_type);
+}
+
+class LowerRemillMemoryAccessIntrinsics final : public llvm::ModulePass {
+ public:
+  LowerRemillMemoryAccessIntrinsics(void) : llvm::ModulePass(ID) {}
+
+  explicit LowerRemillMemoryAccessIntrinsics(const EntityLifter &lifter)
+      : llvm::ModulePass(ID) {
+    entities.emplace(lifter);
+  }
+
+  bool runOnModule(llvm::Module &module) final;
 
  private:
   static char ID;
+
+  // Set if accesses to lifted entities go through typed pointers.
+  std::optional<AccessedEntityResolver> entities;
 };
 
 char LowerRemillMemoryAccessIntrinsics::ID = '\0';
 
+// Returns a pointer to the `val_type` accessed by `call_inst`. This points
+// into a lifted entity if `entities` can resolve the address to one, and is
+// otherwise an `inttoptr` of the address.
+static llvm::Value *AccessedPointer(llvm::IRBuilder<> &ir,
+                                    llvm::CallBase *call_inst,
+                                    llvm::Type *val_type,
+                                    const AccessedEntityResolver *entities) {
+  const auto addr = call_inst->getArgOperand(1);
+  llvm::Value *ptr = nullptr;
+  if (entities) {
+    ptr = entities->TryResolve(ir, addr, val_type);
+  }
+  if (!ptr) {
+    ptr = ir.CreateIntToPtr(addr, llvm::PointerType::get(val_type, 0));
+  }
+  CopyMetadataTo(call_inst, ptr);
+  return ptr;
+}
 
 // Lower a memory read intrinsic into a `load` instruction.
-static void ReplaceMemReadOp(llvm::CallBase *call_inst, llvm::Type *val_type) {
-  auto addr = call_inst->getArgOperand(1);
+static void ReplaceMemReadOp(llvm::CallBase *call_inst, llvm::Type *val_type,
+                             const AccessedEntityResolver *entities) {
   llvm::IRBuilder<> ir(call_inst);
-  auto ptr = ir.CreateIntToPtr(addr, llvm::PointerType::get(val_type, 0));
-  CopyMetadataTo(call_inst, ptr);
+  auto ptr = AccessedPointer(ir, call_inst, val_type, entities);
   llvm::Value *val = ir.CreateLoad(ptr);
   CopyMetadataTo(call_inst, val);
   if (val_type->isX86_FP80Ty() || val_type->isFP128Ty()) {
@@ -60,13 +133,12 @@ static void ReplaceMemReadOp(llvm::CallBase *call_inst, llvm::Type *val_type) {
 // Lower a memory read intrinsic with 3 arguments into `load` and
 // `store` instructions.
 static void ReplaceMemReadOpToRef(llvm::CallBase *call_inst,
-                                  llvm::Type *val_type) {
+                                  llvm::Type *val_type,
+                                  const AccessedEntityResolver *entities) {
   auto mem_ptr = call_inst->getArgOperand(0);
-  auto addr = call_inst->getArgOperand(1);
 
   llvm::IRBuilder<> ir(call_inst);
-  auto ptr = ir.CreateIntToPtr(addr, llvm::PointerType::get(val_type, 0));
-  CopyMetadataTo(call_inst, ptr);
+  auto ptr = AccessedPointer(ir, call_inst, val_type, entities);
   llvm::Value *val = ir.CreateLoad(ptr);
   CopyMetadataTo(call_inst, val);
 
@@ -81,14 +153,13 @@ static void ReplaceMemReadOpToRef(llvm::CallBase *call_inst,
 
 
 // Lower a memory write intrinsic into a `store` instruction.
-static void ReplaceMemWriteOp(llvm::CallBase *call_inst, llvm::Type *val_type) {
+static void ReplaceMemWriteOp(llvm::CallBase *call_inst, llvm::Type *val_type,
+                              const AccessedEntityResolver *entities) {
   auto mem_ptr = call_inst->getArgOperand(0);
-  auto addr = call_inst->getArgOperand(1);
   auto val = call_inst->getArgOperand(2);
 
   llvm::IRBuilder<> ir(call_inst);
-  auto ptr = ir.CreateIntToPtr(addr, llvm::PointerType::get(val_type, 0));
-  CopyMetadataTo(call_inst, ptr);
+  auto ptr = AccessedPointer(ir, call_inst, val_type, entities);
   if (val_type->isX86_FP80Ty() || val_type->isFP128Ty()) {
     val = ir.CreateFPExt(val, val_type);
     CopyMetadataTo(call_inst, val);
@@ -103,14 +174,13 @@ static void ReplaceMemWriteOp(llvm::CallBase *call_inst, llvm::Type *val_type) {
 // Lower a memory write intrinsic passing value by reference with `store`
 // instruction
 static void ReplaceMemWriteOpFromRef(llvm::CallBase *call_inst,
-                                     llvm::Type *val_type) {
+                                     llvm::Type *val_type,
+                                     const AccessedEntityResolver *entities) {
   auto mem_ptr = call_inst->getArgOperand(0);
-  auto addr = call_inst->getArgOperand(1);
   auto val_ptr = call_inst->getArgOperand(2);
 
   llvm::IRBuilder<> ir(call_inst);
-  auto ptr = ir.CreateIntToPtr(addr, llvm::PointerType::get(val_type, 0));
-  CopyMetadataTo(call_inst, ptr);
+  auto ptr = AccessedPointer(ir, call_inst, val_type, entities);
 
   llvm::Value *val = ir.CreateLoad(val_ptr);
   if (val_type->isX86_FP80Ty() || val_type->isFP128Ty()) {
@@ -125,7 +195,8 @@ static void ReplaceMemWriteOpFromRef(llvm::CallBase *call_inst,
 }
 
 // Dispatch to the proper memory replacement function given a function call.
-static bool ReplaceMemoryOp(llvm::CallBase *call) {
+static bool ReplaceMemoryOp(llvm::CallBase *call,
+                            const AccessedEntityResolver *entities) {
   const auto func = call->getCalledFunction();
   const auto func_name = func->getName();
 
@@ -151,7 +222,7 @@ static bool ReplaceMemoryOp(llvm::CallBase *call) {
       // `val = __remill_read_memory_NN(mem, addr)`.
       case 2: {
         const auto val_type = adjust_val_type(call->getType());
-        ReplaceMemReadOp(call, val_type);
+        ReplaceMemReadOp(call, val_type, entities);
         return true;
       }
 
@@ -159,7 +230,7 @@ static bool ReplaceMemoryOp(llvm::CallBase *call) {
       case 3: {
         const auto val_type =
             adjust_val_type(call->getArgOperand(2)->getType());
-        ReplaceMemReadOpToRef(call, val_type);
+        ReplaceMemReadOpToRef(call, val_type, entities);
         return true;
       }
       default:
@@ -174,13 +245,13 @@ static bool ReplaceMemoryOp(llvm::CallBase *call) {
     // `mem = __remill_write_memory_NN(mem, addr, val&)`.
     if (llvm::isa<llvm::PointerType>(arg3_type)) {
       const auto val_type = adjust_val_type(arg3_type);
-      ReplaceMemWriteOpFromRef(call, val_type);
+      ReplaceMemWriteOpFromRef(call, val_type, entities);
       return true;
 
       // `mem = __remill_write_memory_NN(mem, addr, val)`.
     } else {
       const auto val_type = adjust_val_type(arg3_type);
-      ReplaceMemWriteOp(call, val_type);
+      ReplaceMemWriteOp(call, val_type, entities);
       return true;
     }
   }
@@ -191,12 +262,8 @@ static bool ReplaceMemoryOp(llvm::CallBase *call) {
 }
 
 // Try to lower remill memory access intrinsics.
-bool LowerRemillMemoryAccessIntrinsics::runOnFunction(llvm::Function &func) {
-  auto calls = FindFunctionCalls(func, [](llvm::CallBase *call) -> bool {
-    const auto func = call->getCalledFunction();
-    if (!func) {
-      return false;
-    }
+bool LowerRemillMemoryAccessIntrinsics::runOnModule(llvm::Module &module) {
+  auto calls = FindFunctionCalls(module, [](llvm::Function *func) -> bool {
 
     // TODO(pag): Add support for atomic read-modify-write intrinsics.
     const auto name = func->getName();
@@ -206,7 +273,7 @@ bool LowerRemillMemoryAccessIntrinsics::runOnFunction(llvm::Function &func) {
 
   auto ret = false;
   for (auto call : calls) {
-    ret = ReplaceMemoryOp(call) || ret;
+    ret = ReplaceMemoryOp(call, entities ? &*entities : nullptr) || ret;
   }
 
   return ret;
@@ -216,8 +283,15 @@ bool LowerRemillMemoryAccessIntrinsics::runOnFunction(llvm::Function &func) {
 
 // Lowers the `__remill_read_memory_NN`, `__remill_write_memory_NN`, and the
 // various atomic read-modify-write variants into LLVM loads and stores.
-llvm::FunctionPass *CreateLowerRemillMemoryAccessIntrinsics(void) {
+llvm::ModulePass *CreateLowerRemillMemoryAccessIntrinsics(void) {
   return new LowerRemillMemoryAccessIntrinsics;
 }
 
+// Like the above, but accesses to the entities of `lifter` go through typed
+// pointers into those entities.
+llvm::ModulePass *
+CreateLowerRemillMemoryAccessIntrinsics(const EntityLifter &lifter) {
+  return new LowerRemillMemoryAccessIntrinsics(lifter);
+}
+
 }  // namespace anvill
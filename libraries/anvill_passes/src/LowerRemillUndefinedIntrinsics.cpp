@@ -19,7 +19,6 @@
 
 #include <anvill/ABI.h>
 #include <llvm/IR/Constants.h>
-#include <llvm/IR/InstIterator.h>
 #include <llvm/IR/Instructions.h>
 #include <llvm/IR/Module.h>
 #include <llvm/Pass.h>
@@ -29,12 +28,11 @@
 namespace anvill {
 namespace {
 
-class LowerRemillUndefinedIntrinsics final : public llvm::FunctionPass {
+class LowerRemillUndefinedIntrinsics final : public llvm::ModulePass {
  public:
-  LowerRemillUndefinedIntrinsics(void)
-      : llvm::FunctionPass(ID) {}
+  LowerRemillUndefinedIntrinsics(void) : llvm::ModulePass(ID) {}
 
-  bool runOnFunction(llvm::Function &func) override;
+  bool runOnModule(llvm::Module &module) override;
 
  private:
   static char ID;
@@ -42,15 +40,15 @@ class LowerRemillUndefinedIntrinsics final : public llvm::FunctionPass {
 
 char LowerRemillUndefinedIntrinsics::ID = '\0';
 
-bool LowerRemillUndefinedIntrinsics::runOnFunction(llvm::Function &func) {
+bool LowerRemillUndefinedIntrinsics::runOnModule(llvm::Module &module) {
   std::vector<llvm::CallInst *> calls;
+  auto callers = FindFunctionCalls(module, [](llvm::Function *func) -> bool {
+    return func->getName().startswith("__remill_undefined_");
+  });
 
-  for (auto &inst : llvm::instructions(func)) {
-    if (auto call = llvm::dyn_cast<llvm::CallInst>(&inst)) {
-      if (auto callee = call->getCalledFunction();
-          callee && callee->getName().startswith("__remill_undefined_")) {
-        calls.push_back(call);
-      }
+  for (auto call : callers) {
+    if (auto call_inst = llvm::dyn_cast<llvm::CallInst>(call)) {
+      calls.push_back(call_inst);
     }
   }
 
@@ -83,7 +81,7 @@ bool LowerRemillUndefinedIntrinsics::runOnFunction(llvm::Function &func) {
 //
 // This pass exists to do the lowering to `undef` values, and should be run
 // as late as possible.
-llvm::FunctionPass *CreateLowerRemillUndefinedIntrinsics(void) {
+llvm::ModulePass *CreateLowerRemillUndefinedIntrinsics(void) {
   return new LowerRemillUndefinedIntrinsics;
 }
 
@@ -19,7 +19,6 @@
 
 #include <anvill/ABI.h>
 #include <llvm/IR/IRBuilder.h>
-#include <llvm/IR/InstIterator.h>
 #include <llvm/IR/Instructions.h>
 #include <llvm/IR/Module.h>
 #include <llvm/Pass.h>
@@ -29,12 +28,11 @@
 namespace anvill {
 namespace {
 
-class LowerTypeHintIntrinsics final : public llvm::FunctionPass {
+class LowerTypeHintIntrinsics final : public llvm::ModulePass {
  public:
-  LowerTypeHintIntrinsics(void)
-      : llvm::FunctionPass(ID) {}
+  LowerTypeHintIntrinsics(void) : llvm::ModulePass(ID) {}
 
-  bool runOnFunction(llvm::Function &func) override;
+  bool runOnModule(llvm::Module &module) override;
 
  private:
   static char ID;
@@ -42,15 +40,15 @@ class LowerTypeHintIntrinsics final : public llvm::FunctionPass {
 
 char LowerTypeHintIntrinsics::ID = '\0';
 
-bool LowerTypeHintIntrinsics::runOnFunction(llvm::Function &func) {
+bool LowerTypeHintIntrinsics::runOnModule(llvm::Module &module) {
   std::vector<llvm::CallInst *> calls;
+  auto callers = FindFunctionCalls(module, [](llvm::Function *func) -> bool {
+    return func->getName().startswith(kTypeHintFunctionPrefix);
+  });
 
-  for (auto &inst : llvm::instructions(func)) {
-    if (auto call = llvm::dyn_cast<llvm::CallInst>(&inst)) {
-      if (auto callee = call->getCalledFunction();
-          callee && callee->getName().startswith(kTypeHintFunctionPrefix)) {
-        calls.push_back(call);
-      }
+  for (auto call : callers) {
+    if (auto call_inst = llvm::dyn_cast<llvm::CallInst>(call)) {
+      calls.push_back(call_inst);
     }
   }
 
@@ -71,6 +69,20 @@ bool LowerTypeHintIntrinsics::runOnFunction(llvm::Function &func) {
     }
   }
 
+  // There is one type hint function per hinted type; drop the ones that are
+  // no longer used, so that they don't linger in the symbol table.
+  std::vector<llvm::Function *> hint_funcs;
+  for (auto &func : module) {
+    if (func.isDeclaration() && func.use_empty() &&
+        func.getName().startswith(kTypeHintFunctionPrefix)) {
+      hint_funcs.push_back(&func);
+    }
+  }
+  for (auto func : hint_funcs) {
+    func->eraseFromParent();
+    changed = true;
+  }
+
   return changed;
 }
 
@@ -86,7 +98,7 @@ bool LowerTypeHintIntrinsics::runOnFunction(llvm::Function &func) {
 //
 // These function calls need to be removed/lowered into `inttoptr` or `bitcast`
 // instructions.
-llvm::FunctionPass *CreateLowerTypeHintIntrinsics(void) {
+llvm::ModulePass *CreateLowerTypeHintIntrinsics(void) {
   return new LowerTypeHintIntrinsics;
 }
 
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <anvill/DuplicateFunctions.h>
+#include <anvill/Lifters/EntityLifter.h>
+#include <anvill/Transforms.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Transforms/Utils/FunctionComparator.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace anvill {
+
+// Merges the lifted functions of `module` whose optimized code is the same.
+unsigned MergeEquivalentFunctions(llvm::Module &module,
+                                  const EntityLifter &lifter) {
+  std::vector<std::pair<uint64_t, llvm::Function *>> funcs;
+  for (auto &func : module) {
+
+    // A thunk is a call and a return, so there's nothing to gain by turning
+    // a function that small into one. Variadic functions can't be thunks.
+    if (func.isDeclaration() || func.isInterposable() || func.isVarArg() ||
+        func.getInstructionCount() <= 2u) {
+      continue;
+    }
+    if (auto maybe_addr = lifter.AddressOfEntity(&func)) {
+      funcs.emplace_back(*maybe_addr, &func);
+    }
+  }
+
+  // Visit functions by address, so that the canonical function of a group is
+  // the one at the lowest address, regardless of the order of the module.
+  std::sort(funcs.begin(), funcs.end(),
+            [](const auto &a, const auto &b) { return a.first < b.first; });
+
+  // Equal functions have equal hashes, so only functions with the same hash
+  // need to be compared.
+  llvm::GlobalNumberState numbers;
+  std::unordered_map<llvm::FunctionComparator::FunctionHash,
+                     std::vector<llvm::Function *>>
+      canonical_funcs;
+
+  auto num_merged = 0u;
+  for (const auto &entry : funcs) {
+    const auto func = entry.second;
+    auto &candidates =
+        canonical_funcs[llvm::FunctionComparator::functionHash(*func)];
+
+    auto it = std::find_if(
+        candidates.begin(), candidates.end(), [&](llvm::Function *canonical) {
+          return !llvm::FunctionComparator(func, canonical, &numbers)
+                      .compare();
+        });
+    if (it == candidates.end()) {
+      candidates.push_back(func);
+      continue;
+    }
+
+    // Equal functions have the same type, so the thunk can always be defined.
+    // `deleteBody` makes the function external, so its linkage is restored
+    // afterward.
+    const auto linkage = func->getLinkage();
+    func->deleteBody();
+    if (DuplicateFunctions::DefineAsThunk(*func, **it)) {
+      ++num_merged;
+    }
+    func->setLinkage(linkage);
+  }
+
+  return num_merged;
+}
+
+}  // namespace anvill
@@ -0,0 +1,294 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <anvill/Transforms.h>
+#include <llvm/ADT/DenseSet.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instruction.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/Pass.h>
+#include <llvm/Transforms/Utils/Local.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace anvill {
+namespace {
+
+// Drives the peephole rules over one function. Every instruction is visited
+// once up front; after that, only instructions that might newly match a rule
+// are revisited, i.e. the users of replaced instructions and the operands of
+// erased instructions.
+class PeepholeEngine {
+ public:
+  explicit PeepholeEngine(llvm::Function &func);
+
+  // Run the rules to a fixpoint. Returns `true` if anything changed.
+  bool Run(void);
+
+  // Replace all uses of `inst` with `val`, and then erase `inst`.
+  void Replace(llvm::Instruction *inst, llvm::Value *val);
+
+  // Erase `inst`, which must be unused.
+  void Erase(llvm::Instruction *inst);
+
+  // Revisit `inst` later.
+  void Enqueue(llvm::Instruction *inst);
+
+  // Revisit the users of `val` later.
+  void EnqueueUsers(llvm::Value *val);
+
+  // Note that an instruction was changed in place.
+  void MarkChanged(void) {
+    changed = true;
+  }
+
+ private:
+  std::vector<llvm::Instruction *> work_list;
+
+  // The instructions in `work_list`. Erased instructions are removed from
+  // here but left in `work_list`, where they're skipped.
+  llvm::DenseSet<llvm::Instruction *> queued;
+
+  bool changed{false};
+};
+
+// A peephole rule. Rules look at one instruction, and return `true` if they
+// changed it, in which case the remaining rules are skipped. Rules make their
+// changes through the engine, so that it knows what to revisit.
+using PeepholeRule = bool (*)(llvm::Instruction *inst, PeepholeEngine &engine);
+
+// Erase instructions that have no uses and no side effects.
+static bool EraseTriviallyDead(llvm::Instruction *inst,
+                               PeepholeEngine &engine) {
+  if (!llvm::isInstructionTriviallyDead(inst)) {
+    return false;
+  }
+  engine.Erase(inst);
+  return true;
+}
+
+// Replace `phi [BB0, VAL], ..., [BBn, VAL]` with `VAL`.
+static bool RemoveTrivialPhi(llvm::Instruction *inst, PeepholeEngine &engine) {
+  auto phi = llvm::dyn_cast<llvm::PHINode>(inst);
+  if (!phi || !phi->getNumIncomingValues()) {
+    return false;
+  }
+
+  const auto base_val = phi->getIncomingValue(0);
+  if (base_val == phi) {
+    return false;
+  }
+
+  for (auto &use : phi->incoming_values()) {
+    if (use.get() != base_val) {
+      return false;
+    }
+  }
+
+  engine.Replace(phi, base_val);
+  return true;
+}
+
+// Replace `select cond, VAL, VAL` with `VAL`.
+static bool RemoveTrivialSelect(llvm::Instruction *inst,
+                                PeepholeEngine &engine) {
+  auto sel = llvm::dyn_cast<llvm::SelectInst>(inst);
+  if (!sel || sel->getTrueValue() != sel->getFalseValue()) {
+    return false;
+  }
+
+  engine.Replace(sel, sel->getTrueValue());
+  return true;
+}
+
+// Turn
+//
+//    %c = icmp PREDICATE v1, v2
+//    %x = xor i1 %c, true
+//
+// into `%c = icmp !PREDICATE v1, v2`, replacing `%x` with `%c`. This is only
+// possible if every other use of `%c` is as the condition of a branch or of a
+// select, as those can be inverted to match.
+static bool ConvertXorToCmp(llvm::Instruction *inst, PeepholeEngine &engine) {
+  auto xor_inst = llvm::dyn_cast<llvm::BinaryOperator>(inst);
+  if (!xor_inst || xor_inst->getOpcode() != llvm::Instruction::Xor) {
+    return false;
+  }
+
+  auto lhs = xor_inst->getOperand(0);
+  auto rhs = xor_inst->getOperand(1);
+  auto cmp = llvm::dyn_cast<llvm::ICmpInst>(lhs);
+  auto true_val = llvm::dyn_cast<llvm::ConstantInt>(rhs);
+  if (!cmp) {
+    cmp = llvm::dyn_cast<llvm::ICmpInst>(rhs);
+    true_val = llvm::dyn_cast<llvm::ConstantInt>(lhs);
+  }
+
+  if (!cmp || !true_val || true_val->getBitWidth() != 1u ||
+      !true_val->isAllOnesValue()) {
+    return false;
+  }
+
+  for (auto &use : cmp->uses()) {
+    auto user = use.getUser();
+    if (user == xor_inst) {
+      continue;
+    } else if (llvm::isa<llvm::BranchInst>(user)) {
+      continue;
+    } else if (llvm::isa<llvm::SelectInst>(user) && !use.getOperandNo()) {
+      continue;
+    } else {
+      return false;
+    }
+  }
+
+  for (auto user : cmp->users()) {
+    if (auto br = llvm::dyn_cast<llvm::BranchInst>(user)) {
+      br->swapSuccessors();
+    } else if (auto sel = llvm::dyn_cast<llvm::SelectInst>(user)) {
+      sel->swapValues();
+    }
+  }
+
+  cmp->setPredicate(cmp->getInversePredicate());
+  cmp->copyMetadata(*xor_inst);
+  engine.MarkChanged();
+  engine.Replace(xor_inst, cmp);
+  return true;
+}
+
+// Remove unused calls to floating point classification functions. LLVM can't
+// remove these on its own, as they aren't known to be pure. See
+// `CreateRemoveUnusedFPClassificationCalls`.
+static bool RemoveUnusedFPClassificationCall(llvm::Instruction *inst,
+                                             PeepholeEngine &engine) {
+  auto call = llvm::dyn_cast<llvm::CallInst>(inst);
+  if (!call || !call->use_empty()) {
+    return false;
+  }
+
+  auto func = call->getCalledFunction();
+  if (!func) {
+    return false;
+  }
+
+  const auto name = func->getName();
+  if (name != "fpclassify" && name != "__fpclassifyd" &&
+      name != "__fpclassifyf" && name != "__fpclassifyld") {
+    return false;
+  }
+
+  engine.Erase(call);
+  return true;
+}
+
+// The rules, in the order in which they're tried on each instruction.
+static const PeepholeRule kPeepholeRules[] = {
+    EraseTriviallyDead,
+    RemoveTrivialPhi,
+    RemoveTrivialSelect,
+    ConvertXorToCmp,
+    RemoveUnusedFPClassificationCall,
+};
+
+PeepholeEngine::PeepholeEngine(llvm::Function &func) {
+
+  // The work list is popped from the back, so it's reversed, to visit
+  // instructions in order.
+  for (auto &inst : llvm::instructions(func)) {
+    work_list.push_back(&inst);
+    queued.insert(&inst);
+  }
+  std::reverse(work_list.begin(), work_list.end());
+}
+
+bool PeepholeEngine::Run(void) {
+  while (!work_list.empty()) {
+    auto inst = work_list.back();
+    work_list.pop_back();
+    if (!queued.erase(inst)) {
+      continue;
+    }
+
+    for (auto rule : kPeepholeRules) {
+      if (rule(inst, *this)) {
+        break;
+      }
+    }
+  }
+  return changed;
+}
+
+void PeepholeEngine::Replace(llvm::Instruction *inst, llvm::Value *val) {
+  EnqueueUsers(inst);
+  inst->replaceAllUsesWith(val);
+  Erase(inst);
+}
+
+void PeepholeEngine::Erase(llvm::Instruction *inst) {
+  for (auto &op : inst->operands()) {
+    if (auto op_inst = llvm::dyn_cast<llvm::Instruction>(op.get())) {
+      Enqueue(op_inst);
+    }
+  }
+  queued.erase(inst);
+  inst->eraseFromParent();
+  changed = true;
+}
+
+void PeepholeEngine::Enqueue(llvm::Instruction *inst) {
+  if (queued.insert(inst).second) {
+    work_list.push_back(inst);
+  }
+}
+
+void PeepholeEngine::EnqueueUsers(llvm::Value *val) {
+  for (auto user : val->users()) {
+    if (auto user_inst = llvm::dyn_cast<llvm::Instruction>(user)) {
+      Enqueue(user_inst);
+    }
+  }
+}
+
+class Peepholes final : public llvm::FunctionPass {
+ public:
+  Peepholes(void) : llvm::FunctionPass(ID) {}
+
+  bool runOnFunction(llvm::Function &func) final;
+
+ private:
+  static char ID;
+};
+
+char Peepholes::ID = '\0';
+
+bool Peepholes::runOnFunction(llvm::Function &func) {
+  PeepholeEngine engine(func);
+  return engine.Run();
+}
+
+}  // namespace
+
+// Runs anvill's peephole rules together, in one work list over a function.
+llvm::FunctionPass *CreatePeepholes(void) {
+  return new Peepholes;
+}
+
+}  // namespace anvill
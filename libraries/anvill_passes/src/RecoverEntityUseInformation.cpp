@@ -22,6 +22,7 @@
 #include <anvill/Lifters/ValueLifter.h>
 #include <anvill/Providers/TypeProvider.h>
 #include <llvm/IR/Constant.h>
+#include <llvm/IR/GlobalVariable.h>
 #include <remill/Arch/Arch.h>
 #include <remill/BC/Util.h>
 
@@ -167,6 +168,15 @@ RecoverEntityUseInformation::UpdateFunction(llvm::Function &function,
           maybe_func_decl) {
         entity = entity_lifter.DeclareEntity(*maybe_func_decl);
 
+      // Try to find a variable that we've already lifted and that contains
+      // the address, e.g. when the address is an interior pointer.
+      } else if (auto [containing, offset] =
+                     entity_lifter.EntityContainingAddress(ra.u.address);
+                 containing && llvm::isa<llvm::GlobalVariable>(containing)) {
+        is_var = true;
+        var_address = ra.u.address - offset;
+        entity = containing;
+
       // Try to look it up as a variable.
       } else if (auto maybe_var_decl =
                      type_provider.TryGetVariableType(ra.u.address, dl)) {
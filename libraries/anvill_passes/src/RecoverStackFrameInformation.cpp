@@ -18,19 +18,78 @@
 #include "RecoverStackFrameInformation.h"
 
 #include <anvill/Analysis/CrossReferenceResolver.h>
+#include <llvm/Support/MathExtras.h>
 #include <remill/BC/Util.h>
 
 #include <iostream>
 #include <limits>
 #include <magic_enum.hpp>
 
+#include "SplitStackFrameAtReturnAddress.h"
 #include "Utils.h"
 
 namespace anvill {
+namespace {
+
+// Stack frames bigger than this are initialized from a symbolic blob when
+// the `kSymbolic` initialization strategy is requested, as a load and a store
+// per byte would otherwise bloat the function.
+static constexpr std::size_t kMaxPerByteSymbolicStackFrameSize = 4096u;
+
+// A part of the recovered stack frame, allocated on its own.
+struct StackFramePart final {
+
+  // Zero-based offset of this part within the whole stack frame
+  std::size_t start_offset{};
+
+  // Part size
+  std::size_t size{};
+
+  // The instruction allocating this part
+  llvm::AllocaInst *alloca_inst{nullptr};
+};
+
+// Lays out the parts of a stack frame of `frame_size` bytes, giving each of
+// the return address slots at `return_address_offsets` (zero-based) a part of
+// its own, and the bytes between them parts of their own.
+static std::vector<StackFramePart>
+LayOutStackFrameParts(std::vector<std::size_t> return_address_offsets,
+                      std::size_t frame_size, std::size_t pointer_size) {
+  std::sort(return_address_offsets.begin(), return_address_offsets.end());
+
+  std::vector<StackFramePart> parts;
+  std::size_t current_offset{};
+
+  for (auto offset : return_address_offsets) {
+
+    // Skip repeated or overlapping stores of the return address.
+    if (offset < current_offset || (offset + pointer_size) > frame_size) {
+      continue;
+    }
+
+    if (offset != current_offset) {
+      parts.push_back({current_offset, offset - current_offset});
+    }
+
+    parts.push_back({offset, pointer_size});
+    current_offset = offset + pointer_size;
+  }
+
+  if (current_offset != frame_size) {
+    parts.push_back({current_offset, frame_size - current_offset});
+  }
+
+  return parts;
+}
+
+}  // namespace
+
 RecoverStackFrameInformation *
 RecoverStackFrameInformation::Create(ITransformationErrorManager &error_manager,
-                                     const LifterOptions &options) {
-  return new RecoverStackFrameInformation(error_manager, options);
+                                     const LifterOptions &options,
+                                     bool split_at_return_address) {
+  return new RecoverStackFrameInformation(error_manager, options,
+                                          split_at_return_address);
 }
 
 bool RecoverStackFrameInformation::Run(llvm::Function &function) {
@@ -58,7 +117,8 @@ bool RecoverStackFrameInformation::Run(llvm::Function &function) {
   // instructions
   auto update_func_res = UpdateFunction(
       function, stack_frame_analysis, options.stack_frame_struct_init_procedure,
-      options.stack_frame_lower_padding, options.stack_frame_higher_padding);
+      options.stack_frame_lower_padding, options.stack_frame_higher_padding,
+      split_at_return_address);
 
   if (!update_func_res.Succeeded()) {
     EmitError(
@@ -102,13 +162,15 @@ RecoverStackFrameInformation::EnumerateStackPointerUsages(
 
   StackPointerRegisterUsages output;
 
-  auto module = function.getParent();
+  // The same constant expressions tend to be used over and over again, so
+  // remember what we learn about them.
+  SymbolicValueAnalysis analysis(function.getParent());
 
   for (auto &basic_block : function) {
     for (auto &instr : basic_block) {
       for (auto i = 0u, num_ops = instr.getNumOperands(); i < num_ops; ++i) {
         auto &use = instr.getOperandUse(i);
-        if (auto val = use.get(); IsRelatedToStackPointer(module, val)) {
+        if (auto val = use.get(); analysis.IsRelatedToStackPointer(val)) {
           output.emplace_back(&use);
         }
       }
@@ -131,8 +193,10 @@ RecoverStackFrameInformation::AnalyzeStackFrame(llvm::Function &function) {
   // applied to the stack pointer symbol for us
   auto module = function.getParent();
   auto data_layout = module->getDataLayout();
+  const auto pointer_size = data_layout.getPointerSize(0);
 
   CrossReferenceResolver resolver(data_layout);
+  SymbolicValueAnalysis analysis(module);
 
   // Pre-initialize the stack limits
   StackFrameAnalysis output;
@@ -167,8 +231,15 @@ RecoverStackFrameInformation::AnalyzeStackFrame(llvm::Function &function) {
     // stored value as the type size or updating the stack offset.
     if (auto store_inst = llvm::dyn_cast<llvm::StoreInst>(use->getUser())) {
       if (use->getOperandNo() == 1) {
-        const auto stored_type = store_inst->getValueOperand()->getType();
+        const auto stored_val = store_inst->getValueOperand();
+        const auto stored_type = stored_val->getType();
         type_size = data_layout.getTypeAllocSize(stored_type).getFixedSize();
+
+        // Remember where the return address is saved, so that the stack
+        // frame can be split around it.
+        if (type_size == pointer_size && analysis.IsReturnAddress(stored_val)) {
+          output.return_address_offsets.push_back(stack_offset);
+        }
       }
 
     // In the case of `load` instructions, we want to redord the size of the
@@ -205,35 +276,21 @@ RecoverStackFrameInformation::GenerateStackFrameType(
     return StackAnalysisErrorCode::InvalidParameter;
   }
 
-  // Generate a stack frame type with a name that matches the anvill ABI
-  auto function_name = function.getName().str();
-  auto stack_frame_type_name = function_name + kStackFrameTypeNameSuffix;
-
-  // Make sure this type is not defined already
-  auto &module = *function.getParent();
-  auto &context = module.getContext();
-  auto stack_frame_type = getTypeByName(module, stack_frame_type_name);
-  if (stack_frame_type != nullptr) {
-    return StackAnalysisErrorCode::StackFrameTypeAlreadyExists;
-  }
-
   // Determine how many bytes we should allocate. We may have been
   // asked to add some additional padding. We don't care how it is
   // accessed right now, we just add to the total size of the final
   // stack frame
   auto stack_frame_size = padding_bytes + stack_frame_analysis.size;
 
-  // Generate the stack frame using a byte array
-  auto array_elem_type = llvm::Type::getInt8Ty(context);
-  auto byte_array_type =
-      llvm::ArrayType::get(array_elem_type, stack_frame_size);
-
-  const std::vector<llvm::Type *> stack_frame_types = {byte_array_type};
-  stack_frame_type =
-      llvm::StructType::create(stack_frame_types, stack_frame_type_name, true);
-
+  // Stack frames are byte arrays, so their types are shared by all the
+  // functions with stack frames of the same size. The type is only missing
+  // if its name is taken by some other type.
+  auto &module = *function.getParent();
+  auto stack_frame_type =
+      SplitStackFrameAtReturnAddress::GetOrCreateStackFrameType(
+          module, stack_frame_size);
   if (stack_frame_type == nullptr) {
-    return StackAnalysisErrorCode::InternalError;
+    return StackAnalysisErrorCode::StackFrameTypeAlreadyExists;
   }
 
   return stack_frame_type;
@@ -266,31 +323,59 @@ RecoverStackFrameInformation::GetStackSymbolicByteValue(llvm::Module &module,
   return symbolic_value_res.TakeValue();
 }
 
+Result<llvm::GlobalVariable *, StackAnalysisErrorCode>
+RecoverStackFrameInformation::GetStackSymbolicBlobValue(llvm::Module &module,
+                                                        std::uint64_t size) {
+  auto value_name = kSymbolicStackFrameValuePrefix + "blob_" +
+                    std::to_string(size);
+
+  auto &context = module.getContext();
+  auto blob_type = llvm::ArrayType::get(llvm::Type::getInt8Ty(context), size);
+
+  auto symbolic_value_res = GetSymbolicValue(module, blob_type, value_name);
+  if (!symbolic_value_res.Succeeded()) {
+    return StackAnalysisErrorCode::StackInitializationError;
+  }
+
+  return symbolic_value_res.TakeValue();
+}
+
 Result<std::monostate, StackAnalysisErrorCode>
 RecoverStackFrameInformation::UpdateFunction(
     llvm::Function &function, const StackFrameAnalysis &stack_frame_analysis,
     StackFrameStructureInitializationProcedure init_strategy,
     std::size_t stack_frame_lower_padding,
-    std::size_t stack_frame_higher_padding) {
+    std::size_t stack_frame_higher_padding, bool split_at_return_address) {
 
   if (function.isDeclaration() ||
       stack_frame_analysis.instruction_uses.empty()) {
     return StackAnalysisErrorCode::InvalidParameter;
   }
 
-  // Generate a new stack frame type, using a byte array inside a
-  // StructType
+  // The stack frame, padding included, is made of byte arrays inside of
+  // StructTypes
   auto padding_bytes = stack_frame_lower_padding + stack_frame_higher_padding;
 
-  auto stack_frame_type_res =
-      GenerateStackFrameType(function, stack_frame_analysis, padding_bytes);
+  auto total_stack_frame_size = padding_bytes + stack_frame_analysis.size;
+
+  // Lay out the parts of the stack frame. If we've been asked to split the
+  // stack frame at the return address, then this does so right away, rather
+  // than by rewriting the uses of the whole stack frame afterwards.
+  std::vector<StackFramePart> parts;
+  if (split_at_return_address) {
+    std::vector<std::size_t> return_address_offsets;
+    for (auto offset : stack_frame_analysis.return_address_offsets) {
+      return_address_offsets.push_back(static_cast<std::size_t>(
+          offset - stack_frame_analysis.lowest_offset) +
+          stack_frame_lower_padding);
+    }
 
-  if (!stack_frame_type_res.Succeeded()) {
-    return stack_frame_type_res.TakeError();
+    auto &data_layout = function.getParent()->getDataLayout();
+    parts = LayOutStackFrameParts(std::move(return_address_offsets),
+                                  total_stack_frame_size,
+                                  data_layout.getPointerSize(0));
   }
 
-  auto stack_frame_type = stack_frame_type_res.TakeValue();
-
   // Take the first instruction as an insert pointer for the
   // IRBuilder, and then create an `alloca` instruction to
   // generate our new stack frame
@@ -298,7 +383,59 @@ RecoverStackFrameInformation::UpdateFunction(
   auto &insert_point = *entry_block.getFirstInsertionPt();
 
   llvm::IRBuilder<> builder(&insert_point);
-  auto stack_frame_alloca = builder.CreateAlloca(stack_frame_type);
+
+  // Allocate each part of the stack frame with its own byte array type, the
+  // same as the parts made by `SplitStackFrameAtReturnAddress`. In this case,
+  // no type for the whole stack frame is generated.
+  if (1u < parts.size()) {
+    auto &module = *function.getParent();
+    for (auto &part : parts) {
+      auto part_type =
+          SplitStackFrameAtReturnAddress::GetOrCreateStackFramePartType(
+              module, part.size);
+      if (part_type == nullptr) {
+        return StackAnalysisErrorCode::StackFrameTypeAlreadyExists;
+      }
+
+      part.alloca_inst = builder.CreateAlloca(part_type);
+    }
+
+  } else {
+    auto stack_frame_type_res =
+        GenerateStackFrameType(function, stack_frame_analysis, padding_bytes);
+
+    if (!stack_frame_type_res.Succeeded()) {
+      return stack_frame_type_res.TakeError();
+    }
+
+    auto stack_frame_type = stack_frame_type_res.TakeValue();
+
+    parts.clear();
+    parts.push_back({0u, total_stack_frame_size,
+                     builder.CreateAlloca(stack_frame_type)});
+  }
+
+  // Returns the part of the stack frame containing the zero-based offset
+  // `offset`.
+  auto part_containing = [&parts](std::size_t offset) -> StackFramePart & {
+    auto it = std::upper_bound(
+        parts.begin(), parts.end(), offset,
+        [](std::size_t offset, const StackFramePart &part) {
+          return offset < part.start_offset;
+        });
+    return *std::prev(it);
+  };
+
+  // Returns a pointer to the byte at the zero-based offset `offset` within
+  // the stack frame.
+  auto stack_frame_byte_ptr = [&](std::size_t offset) -> llvm::Value * {
+    auto &part = part_containing(offset);
+    return builder.CreateGEP(
+        part.alloca_inst,
+        {builder.getInt32(0), builder.getInt32(0),
+         builder.getInt32(static_cast<std::uint32_t>(
+             offset - part.start_offset))});
+  };
 
   // When we have padding enabled in the configuration, we must
   // make sure that accesses are still correctly centered around the
@@ -326,27 +463,36 @@ RecoverStackFrameInformation::UpdateFunction(
   auto base_stack_offset = stack_frame_analysis.lowest_offset -
                            static_cast<std::int32_t>(stack_frame_lower_padding);
 
-  auto total_stack_frame_size = padding_bytes + stack_frame_analysis.size;
-
   // Pre-initialize the stack frame if we have been requested to do so. This
   // covers the frame padding bytes as well.
   //
   // Look at the definition for the `StackFrameStructureInitializationProcedure`
   // enum class to get more details on each initialization strategy.
+  if (init_strategy == StackFrameStructureInitializationProcedure::kSymbolic &&
+      total_stack_frame_size > kMaxPerByteSymbolicStackFrameSize) {
+    init_strategy = StackFrameStructureInitializationProcedure::kSymbolicBlob;
+  }
+
   switch (init_strategy) {
     case StackFrameStructureInitializationProcedure::kZeroes: {
 
       // Initialize to zero
-      auto null_value = llvm::Constant::getNullValue(stack_frame_type);
-      builder.CreateStore(null_value, stack_frame_alloca);
+      for (const auto &part : parts) {
+        auto part_type = part.alloca_inst->getAllocatedType();
+        auto null_value = llvm::Constant::getNullValue(part_type);
+        builder.CreateStore(null_value, part.alloca_inst);
+      }
       break;
     }
 
     case StackFrameStructureInitializationProcedure::kUndef: {
 
       // Mark the stack values as explicitly undefined
-      auto undef_value = llvm::UndefValue::get(stack_frame_type);
-      builder.CreateStore(undef_value, stack_frame_alloca);
+      for (const auto &part : parts) {
+        auto part_type = part.alloca_inst->getAllocatedType();
+        auto undef_value = llvm::UndefValue::get(part_type);
+        builder.CreateStore(undef_value, part.alloca_inst);
+      }
       break;
     }
 
@@ -357,13 +503,8 @@ RecoverStackFrameInformation::UpdateFunction(
 
       auto current_offset = base_stack_offset;
 
-      llvm::Value *gep_indexes[] = {builder.getInt32(0), builder.getInt32(0),
-                                    nullptr};
-
       for (auto i = 0U; i < total_stack_frame_size; ++i) {
-        gep_indexes[2] = builder.getInt32(i);
-        auto stack_frame_byte =
-            builder.CreateGEP(stack_frame_alloca, gep_indexes);
+        auto stack_frame_byte = stack_frame_byte_ptr(i);
 
         auto symbolic_value_ptr_res =
             GetStackSymbolicByteValue(module, current_offset);
@@ -382,6 +523,41 @@ RecoverStackFrameInformation::UpdateFunction(
       break;
     }
 
+    case StackFrameStructureInitializationProcedure::kSymbolicBlob: {
+
+      // Copy each part of the stack frame out of a symbolic blob. The blob
+      // is big enough to hold any stack frame of the same size class, and
+      // `__anvill_sp` lands in its middle, so that the same stack offset
+      // always maps to the same byte of the blob.
+      auto &module = *function.getParent();
+
+      const auto frame_end =
+          base_stack_offset + static_cast<std::int64_t>(total_stack_frame_size);
+      const auto half_blob_size = llvm::PowerOf2Ceil(static_cast<std::uint64_t>(
+          std::max<std::int64_t>({-base_stack_offset, frame_end, 1})));
+
+      auto symbolic_blob_res =
+          GetStackSymbolicBlobValue(module, half_blob_size * 2u);
+      if (!symbolic_blob_res.Succeeded()) {
+        return symbolic_blob_res.TakeError();
+      }
+
+      auto symbolic_blob = symbolic_blob_res.TakeValue();
+      const auto blob_base_index =
+          static_cast<std::int64_t>(half_blob_size) + base_stack_offset;
+
+      for (const auto &part : parts) {
+        auto blob_index =
+            static_cast<std::uint64_t>(blob_base_index) + part.start_offset;
+        auto symbolic_bytes = builder.CreateConstInBoundsGEP2_64(
+            symbolic_blob->getValueType(), symbolic_blob, 0, blob_index);
+        builder.CreateMemCpy(part.alloca_inst, llvm::MaybeAlign(1),
+                             symbolic_bytes, llvm::MaybeAlign(1), part.size);
+      }
+
+      break;
+    }
+
     case StackFrameStructureInitializationProcedure::kNone: {
 
       // Skip initialization
@@ -411,11 +587,10 @@ RecoverStackFrameInformation::UpdateFunction(
     // inserted after the alloca instead of before the instruction using
     // it.
     //
-    // As a reminder, the stack frame type is a StructType that contains
-    // an ArrayType with int8 elements
-    auto stack_frame_ptr = builder.CreateGEP(
-        stack_frame_alloca, {builder.getInt32(0), builder.getInt32(0),
-                             builder.getInt32(zero_based_offset)});
+    // As a reminder, each stack frame part type is a StructType that
+    // contains an ArrayType with int8 elements
+    auto stack_frame_ptr =
+        stack_frame_byte_ptr(static_cast<std::size_t>(zero_based_offset));
     CopyMetadataTo(sp_use.use->get(), stack_frame_ptr);
 
     stack_frame_ptr =
@@ -432,9 +607,11 @@ RecoverStackFrameInformation::UpdateFunction(
 }
 
 RecoverStackFrameInformation::RecoverStackFrameInformation(
-    ITransformationErrorManager &error_manager, const LifterOptions &options)
+    ITransformationErrorManager &error_manager, const LifterOptions &options,
+    bool split_at_return_address)
     : BaseFunctionPass(error_manager),
-      options(options) {}
+      options(options),
+      split_at_return_address(split_at_return_address) {}
 
 llvm::FunctionPass *
 CreateRecoverStackFrameInformation(ITransformationErrorManager &error_manager,
@@ -442,4 +619,10 @@ CreateRecoverStackFrameInformation(ITransformationErrorManager &error_manager,
   return RecoverStackFrameInformation::Create(error_manager, options);
 }
 
+llvm::FunctionPass *
+CreateRecoverAndSplitStackFrame(ITransformationErrorManager &error_manager,
+                                const LifterOptions &options) {
+  return RecoverStackFrameInformation::Create(error_manager, options, true);
+}
+
 }  // namespace anvill
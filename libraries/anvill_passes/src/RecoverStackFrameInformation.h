@@ -77,6 +77,10 @@ struct StackFrameAnalysis final {
 
   // Stack frame size
   std::size_t size{};
+
+  // SP-relative offsets of the pointer-sized stores of the return address
+  // into the stack frame
+  std::vector<std::int64_t> return_address_offsets;
 };
 
 // This function pass recovers stack information by analyzing the usage
@@ -87,11 +91,15 @@ class RecoverStackFrameInformation final
   // Lifting options
   const LifterOptions &options;
 
+  // Whether or not the return address slots should be split out into their
+  // own stack frame parts as the stack frame is recovered
+  const bool split_at_return_address;
+
  public:
   // Creates a new RecoverStackFrameInformation object
   static RecoverStackFrameInformation *
   Create(ITransformationErrorManager &error_manager,
-         const LifterOptions &options);
+         const LifterOptions &options, bool split_at_return_address = false);
 
   // Function pass entry point
   bool Run(llvm::Function &function);
@@ -120,17 +128,26 @@ class RecoverStackFrameInformation final
   static Result<llvm::GlobalVariable *, StackAnalysisErrorCode>
   GetStackSymbolicByteValue(llvm::Module &module, std::int32_t offset);
 
+  // Generates a new symbolic blob of `size` bytes, used to initialize
+  // whole stack frames at once
+  static Result<llvm::GlobalVariable *, StackAnalysisErrorCode>
+  GetStackSymbolicBlobValue(llvm::Module &module, std::uint64_t size);
+
   // Patches the function, replacing the load/store instructions so that
-  // they operate on the new stack frame type we generated
+  // they operate on the new stack frame type we generated. If
+  // `split_at_return_address` is true, then the stack frame is allocated in
+  // the same parts that `SplitStackFrameAtReturnAddress` would split it into
   static Result<std::monostate, StackAnalysisErrorCode>
   UpdateFunction(llvm::Function &function,
                  const StackFrameAnalysis &stack_frame_analysis,
                  StackFrameStructureInitializationProcedure init_strategy,
                  std::size_t stack_frame_lower_padding = 0U,
-                 std::size_t stack_frame_higher_padding = 0U);
+                 std::size_t stack_frame_higher_padding = 0U,
+                 bool split_at_return_address = false);
 
   RecoverStackFrameInformation(ITransformationErrorManager &error_manager,
-                               const LifterOptions &options);
+                               const LifterOptions &options,
+                               bool split_at_return_address);
 
   virtual ~RecoverStackFrameInformation(void) override = default;
 };
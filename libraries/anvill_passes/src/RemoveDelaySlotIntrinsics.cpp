@@ -21,6 +21,7 @@
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/Instruction.h>
 #include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
 #include <llvm/Pass.h>
 
 #include "Utils.h"
@@ -28,11 +29,11 @@
 namespace anvill {
 namespace {
 
-class RemoveDelaySlotIntrinsics final : public llvm::FunctionPass {
+class RemoveDelaySlotIntrinsics final : public llvm::ModulePass {
  public:
-  RemoveDelaySlotIntrinsics(void) : llvm::FunctionPass(ID) {}
+  RemoveDelaySlotIntrinsics(void) : llvm::ModulePass(ID) {}
 
-  bool runOnFunction(llvm::Function &func) final;
+  bool runOnModule(llvm::Module &module) final;
 
  private:
   static char ID;
@@ -40,18 +41,16 @@ class RemoveDelaySlotIntrinsics final : public llvm::FunctionPass {
 
 char RemoveDelaySlotIntrinsics::ID = '\0';
 
-// Try to lower remill memory access intrinsics.
-bool RemoveDelaySlotIntrinsics::runOnFunction(llvm::Function &func) {
-  auto module = func.getParent();
-  auto begin = module->getFunction("__remill_delay_slot_begin");
-  auto end = module->getFunction("__remill_delay_slot_end");
+// Try to remove remill delay slot intrinsics.
+bool RemoveDelaySlotIntrinsics::runOnModule(llvm::Module &module) {
+  auto begin = module.getFunction("__remill_delay_slot_begin");
+  auto end = module.getFunction("__remill_delay_slot_end");
 
   if (!begin && !end) {
     return false;
   }
 
-  auto calls = FindFunctionCalls(func, [=](llvm::CallBase *call) -> bool {
-    const auto func = call->getCalledFunction();
+  auto calls = FindFunctionCalls(module, [=](llvm::Function *func) -> bool {
     return func == begin || func == end;
   });
 
@@ -68,7 +67,7 @@ bool RemoveDelaySlotIntrinsics::runOnFunction(llvm::Function &func) {
 }  // namespace
 
 // Removes calls to `__remill_delay_slot_begin` and `__remill_delay_slot_end`.
-llvm::FunctionPass *CreateRemoveDelaySlotIntrinsics(void) {
+llvm::ModulePass *CreateRemoveDelaySlotIntrinsics(void) {
   return new RemoveDelaySlotIntrinsics;
 }
 
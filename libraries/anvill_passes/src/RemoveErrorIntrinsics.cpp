@@ -21,20 +21,23 @@
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/Instruction.h>
 #include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
 #include <llvm/Pass.h>
 
+#include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #include "Utils.h"
 
 namespace anvill {
 namespace {
 
-class RemoveErrorIntrinsics final : public llvm::FunctionPass {
+class RemoveErrorIntrinsics final : public llvm::ModulePass {
  public:
-  RemoveErrorIntrinsics(void) : llvm::FunctionPass(ID) {}
+  RemoveErrorIntrinsics(void) : llvm::ModulePass(ID) {}
 
-  bool runOnFunction(llvm::Function &func) final;
+  bool runOnModule(llvm::Module &module) final;
 
  private:
   static char ID;
@@ -42,19 +45,10 @@ class RemoveErrorIntrinsics final : public llvm::FunctionPass {
 
 char RemoveErrorIntrinsics::ID = '\0';
 
-// Try to lower remill error intrinsics.
-bool RemoveErrorIntrinsics::runOnFunction(llvm::Function &func) {
-  auto module = func.getParent();
-  auto error = module->getFunction("__remill_error");
-
-  if (!error) {
-    return false;
-  }
-
-  auto calls = FindFunctionCalls(func, [=](llvm::CallBase *call) -> bool {
-    return call->getCalledFunction() == error;
-  });
-
+// Remove the calls to `__remill_error` in `calls`, all of which are in
+// `func`, along with everything that follows them in their blocks.
+static bool RemoveErrorCalls(llvm::Function &func,
+                             const std::vector<llvm::CallBase *> &calls) {
   std::unordered_set<llvm::Instruction *> removed;
   std::unordered_set<llvm::BasicBlock *> affected_blocks;
 
@@ -183,10 +177,38 @@ bool RemoveErrorIntrinsics::runOnFunction(llvm::Function &func) {
   return !removed.empty();
 }
 
+// Try to lower remill error intrinsics.
+bool RemoveErrorIntrinsics::runOnModule(llvm::Module &module) {
+  auto error = module.getFunction("__remill_error");
+
+  if (!error) {
+    return false;
+  }
+
+  auto calls = FindFunctionCalls(module, [=](llvm::Function *func) -> bool {
+    return func == error;
+  });
+
+  // Removing an error call rewrites the PHI nodes of its function, so group
+  // the calls by function.
+  std::unordered_map<llvm::Function *, std::vector<llvm::CallBase *>>
+      func_calls;
+  for (llvm::CallBase *call : calls) {
+    func_calls[call->getFunction()].push_back(call);
+  }
+
+  auto changed = false;
+  for (auto &[func, calls_in_func] : func_calls) {
+    changed = RemoveErrorCalls(*func, calls_in_func) || changed;
+  }
+
+  return changed;
+}
+
 }  // namespace
 
 // Removes calls to `__remill_error`.
-llvm::FunctionPass *CreateRemoveErrorIntrinsics(void) {
+llvm::ModulePass *CreateRemoveErrorIntrinsics(void) {
   return new RemoveErrorIntrinsics;
 }
 
@@ -26,113 +26,59 @@
 #include <llvm/IR/Instruction.h>
 #include <llvm/IR/Instructions.h>
 #include <llvm/IR/Intrinsics.h>
+#include <llvm/IR/LegacyPassManager.h>
 #include <llvm/IR/Metadata.h>
 #include <llvm/IR/Module.h>
 #include <llvm/Pass.h>
+#include <llvm/Transforms/InstCombine/InstCombine.h>
+#include <llvm/Transforms/Utils/Local.h>
 #include <remill/BC/ABI.h>
+#include <remill/BC/Compat/ScalarTransforms.h>
 #include <remill/BC/Util.h>
 
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
+#include "ReturnAddressCache.h"
 #include "Utils.h"
 
 namespace anvill {
 namespace {
 
-enum ReturnAddressResult {
-
-  // We've found a case where a value returned by `llvm.returnaddress`, or
-  // casted from `__anvill_ra`, reaches into the `pc` argument of the
-  // `__remill_function_return` intrinsic. This is the ideal case that we
-  // want to handle.
-  kFoundReturnAddress,
-
-  // We've found a case where we're seeing a load from something derived from
-  // `__anvill_sp`, our "symbolic stack pointer", is reaching into the `pc`
-  // argument of `__remill_function_return`. This suggests that stack frame
-  // recovery has not happened yet, and thus we haven't really given stack
-  // frame recovery or stack frame splitting a chance to work.
-  kFoundSymbolicStackPointerLoad,
-
-  // We've found a `load` or something else. This is probably a sign that
-  // stack frame recovery has happened, and that the actual return address
-  // is not necessarily the expected value, and so we need to try to swap
-  // out the return address with whatever we loaded.
-  kUnclassifiableReturnAddress
-};
-
 class RemoveRemillFunctionReturns final : public llvm::FunctionPass {
  public:
-  RemoveRemillFunctionReturns(const EntityLifter &lifter_)
+  RemoveRemillFunctionReturns(std::shared_ptr<ReturnAddressCache> cache_)
       : llvm::FunctionPass(ID),
-        xref_resolver(lifter_) {}
+        cache(std::move(cache_)) {}
 
   bool runOnFunction(llvm::Function &func) final;
 
  private:
-  ReturnAddressResult QueryReturnAddress(llvm::Module *module,
-                                         llvm::Value *val) const;
-
   static char ID;
-  const CrossReferenceResolver xref_resolver;
+  const std::shared_ptr<ReturnAddressCache> cache;
 };
 
 char RemoveRemillFunctionReturns::ID = '\0';
 
-// Returns `true` if `val` is a return address.
-ReturnAddressResult
-RemoveRemillFunctionReturns::QueryReturnAddress(llvm::Module *module,
-                                                llvm::Value *val) const {
-
-  if (IsReturnAddress(module, val)) {
-    return kFoundReturnAddress;
-  }
-
-  if (auto call = llvm::dyn_cast<llvm::CallBase>(val)) {
-    if (auto func = call->getCalledFunction()) {
-      if (func->getName().startswith("__remill_read_memory_")) {
-        auto addr = call->getArgOperand(1);  // Address
-        if (IsRelatedToStackPointer(module, addr)) {
-          return kFoundSymbolicStackPointerLoad;
-        } else {
-          return kUnclassifiableReturnAddress;
-        }
-      }
-    }
-    return kUnclassifiableReturnAddress;
-
-  } else if (auto li = llvm::dyn_cast<llvm::LoadInst>(val)) {
-    if (IsRelatedToStackPointer(module, li->getPointerOperand())) {
-      return kFoundSymbolicStackPointerLoad;
-    } else {
-      return kUnclassifiableReturnAddress;
-    }
-
-  } else if (auto pti = llvm::dyn_cast<llvm::PtrToIntOperator>(val)) {
-    return QueryReturnAddress(module, pti->getOperand(0));
-
-  } else if (auto cast = llvm::dyn_cast<llvm::CastInst>(val)) {
-    return QueryReturnAddress(module, cast->getOperand(0));
+// Fuses `TransformRemillJumpIntrinsics`, `RemoveRemillFunctionReturns`, and
+// `LowerRemillUndefinedIntrinsics` into a single pass over the calls to the
+// intrinsics.
+class CleanUpRemillIntrinsics final : public llvm::ModulePass {
+ public:
+  CleanUpRemillIntrinsics(const EntityLifter &lifter_)
+      : llvm::ModulePass(ID),
+        cache(lifter_) {}
 
-  } else if (IsRelatedToStackPointer(module, val)) {
-    return kFoundSymbolicStackPointerLoad;
+  bool runOnModule(llvm::Module &module) final;
 
-  // Sometimes optimizations result in really crazy looking constant expressions
-  // related to `__anvill_ra`, full of shifts, zexts, etc. We try to detect
-  // this situation by initializing a "magic" address associated with
-  // `__anvill_ra`, and then if we find this magic value on something that
-  // references `__anvill_ra`, then we conclude that all those manipulations
-  // in the constant expression are actually not important.
-  } else if (auto xr = xref_resolver.TryResolveReferenceWithClearedCache(val);
-             xr.is_valid && xr.references_return_address &&
-             xr.u.address == xref_resolver.MagicReturnAddressValue()) {
-    return kFoundReturnAddress;
+ private:
+  static char ID;
+  ReturnAddressCache cache;
+};
 
-  } else {
-    return kUnclassifiableReturnAddress;
-  }
-}
+char CleanUpRemillIntrinsics::ID = '\0';
 
 // Remove a single case of a call to `__remill_function_return` where the return
 // addresses reaches the `pc` argument of the call.
@@ -171,49 +117,6 @@ static void FoldReturnAddressMatch(llvm::CallBase *call) {
   }
 }
 
-// Returns the pointer to the function that lets us overwrite the return
-// address. This is not available on all architectures / OSes.
-static llvm::Function *AddressOfReturnAddressFunction(llvm::Module *module) {
-  llvm::Triple triple(module->getTargetTriple());
-  const char *func_name = nullptr;
-  switch (triple.getArch()) {
-    case llvm::Triple::ArchType::x86:
-    case llvm::Triple::ArchType::x86_64:
-    case llvm::Triple::ArchType::aarch64:
-    case llvm::Triple::ArchType::aarch64_be:
-      func_name = "llvm.addressofreturnaddress.p0i8";
-      break;
-
-    // The Windows `_AddressOfReturnAddress` intrinsic function works on
-    // AArch32 / ARMv7 (as well as the above).
-    case llvm::Triple::ArchType::arm:
-    case llvm::Triple::ArchType::armeb:
-    case llvm::Triple::ArchType::aarch64_32:
-      if (triple.isOSWindows()) {
-        func_name = "_AddressOfReturnAddress";
-      }
-      break;
-    default: break;
-  }
-
-  llvm::Function *func = nullptr;
-
-  // Common path to handle the Windows-specific case, or the slightly
-  // more general case uniformly.
-  if (func_name) {
-    func = module->getFunction(func_name);
-    if (!func) {
-      auto &context = module->getContext();
-      auto fty =
-          llvm::FunctionType::get(llvm::Type::getInt8PtrTy(context, 0), false);
-      func = llvm::Function::Create(fty, llvm::GlobalValue::ExternalLinkage,
-                                    func_name, module);
-    }
-  }
-
-  return func;
-}
-
 // Override the return address in the function `func` with values from
 // `fixups`.
 static void OverwriteReturnAddress(
@@ -256,18 +159,19 @@ bool RemoveRemillFunctionReturns::runOnFunction(llvm::Function &func) {
     if (auto call = llvm::dyn_cast<llvm::CallBase>(&inst)) {
       if (auto func = call->getCalledFunction();
           func && func->getName() == "__remill_function_return") {
-        auto ret_addr = call->getArgOperand(remill::kPCArgNum)
-                            ->stripPointerCastsAndAliases();
-        switch (QueryReturnAddress(module, ret_addr)) {
-          case kFoundReturnAddress: matches_pattern.push_back(call); break;
+        switch (cache->Classify(call)) {
+          case ReturnAddressKind::kReturnAddress:
+            matches_pattern.push_back(call);
+            break;
 
           // Do nothing if it's a symbolic stack pointer load; we're probably
           // running this pass too early.
-          case kFoundSymbolicStackPointerLoad: break;
+          case ReturnAddressKind::kSymbolicStackPointerLoad: break;
 
           // Here we'll do an arch-specific fixup.
-          case kUnclassifiableReturnAddress:
-            fixups.emplace_back(call, ret_addr);
+          case ReturnAddressKind::kUnclassifiable:
+            fixups.emplace_back(call, call->getArgOperand(remill::kPCArgNum)
+                                          ->stripPointerCastsAndAliases());
             break;
         }
       }
@@ -285,12 +189,120 @@ bool RemoveRemillFunctionReturns::runOnFunction(llvm::Function &func) {
   // Go use the `llvm.addressofreturnaddress` to store replace the return
   // address.
   if (!fixups.empty()) {
-    if (auto addr_of_ret_addr_func = AddressOfReturnAddressFunction(module)) {
+    if (auto addr_of_ret_addr_func =
+            cache->AddressOfReturnAddressFunction(*module)) {
       OverwriteReturnAddress(func, addr_of_ret_addr_func, fixups);
       ret = true;
     }
   }
 
+  if (ret) {
+    cache->Forget(func);
+  }
+
+  return ret;
+}
+
+// Classify each call to `__remill_jump` and `__remill_function_return` once,
+// and apply whichever rewrite is appropriate, then lower the calls to
+// `__remill_undefined_*`.
+bool CleanUpRemillIntrinsics::runOnModule(llvm::Module &module) {
+  const auto jump = module.getFunction("__remill_jump");
+  const auto func_return = module.getFunction("__remill_function_return");
+  auto calls = FindFunctionCalls(module, [=](llvm::Function *func) -> bool {
+    return func == jump || func == func_return;
+  });
+
+  std::vector<llvm::CallBase *> matches_pattern;
+  std::unordered_set<llvm::Function *> funcs_with_jumps;
+  std::unordered_map<llvm::Function *,
+                     std::vector<std::pair<llvm::CallBase *, llvm::Value *>>>
+      fixups;
+
+  for (auto call : calls) {
+    const auto result = cache.Classify(call);
+
+    // A jump to the return address is a function return, which we can remove
+    // immediately, rather than first turning it into a call to
+    // `__remill_function_return`. Any other jump is left alone.
+    if (call->getCalledFunction() == jump) {
+      if (result == ReturnAddressKind::kReturnAddress) {
+        matches_pattern.push_back(call);
+        funcs_with_jumps.insert(call->getFunction());
+      }
+      continue;
+    }
+
+    switch (result) {
+      case ReturnAddressKind::kReturnAddress:
+        matches_pattern.push_back(call);
+        break;
+
+      // Do nothing if it's a symbolic stack pointer load; we're probably
+      // running this pass too early.
+      case ReturnAddressKind::kSymbolicStackPointerLoad: break;
+
+      // Here we'll do an arch-specific fixup.
+      case ReturnAddressKind::kUnclassifiable:
+        fixups[call->getFunction()].emplace_back(
+            call, call->getArgOperand(remill::kPCArgNum)
+                      ->stripPointerCastsAndAliases());
+        break;
+    }
+  }
+
+  auto ret = false;
+
+  // Go remove all the matches that we can.
+  for (auto call : matches_pattern) {
+    FoldReturnAddressMatch(call);
+    ret = true;
+  }
+
+  // Go use the `llvm.addressofreturnaddress` to store replace the return
+  // address.
+  if (!fixups.empty()) {
+    if (auto addr_of_ret_addr_func =
+            cache.AddressOfReturnAddressFunction(module)) {
+      for (auto &[func, func_fixups] : fixups) {
+        OverwriteReturnAddress(*func, addr_of_ret_addr_func, func_fixups);
+      }
+      ret = true;
+    }
+  }
+
+  // Clean up the functions whose jumps were removed, as
+  // `TransformRemillJumpIntrinsics` does.
+  if (!funcs_with_jumps.empty()) {
+    llvm::legacy::FunctionPassManager fpm(&module);
+    fpm.add(llvm::createDeadCodeEliminationPass());
+    fpm.add(llvm::createSROAPass());
+    fpm.add(llvm::createCFGSimplificationPass());
+    fpm.add(llvm::createInstructionCombiningPass());
+    fpm.doInitialization();
+    for (auto func : funcs_with_jumps) {
+      fpm.run(*func);
+    }
+    fpm.doFinalization();
+  }
+
+  // Lower the undefined values last, as they would otherwise be able to
+  // spread through the above clean ups.
+  auto undef_calls =
+      FindFunctionCalls(module, [](llvm::Function *func) -> bool {
+        return func->getName().startswith("__remill_undefined_");
+      });
+
+  for (auto call : undef_calls) {
+    if (llvm::isa<llvm::CallInst>(call)) {
+      auto *undef_val = llvm::UndefValue::get(call->getType());
+      CopyMetadataTo(call, undef_val);
+      call->replaceAllUsesWith(undef_val);
+      call->eraseFromParent();
+      ret = true;
+    }
+  }
+
   return ret;
 }
 
@@ -325,7 +337,29 @@ bool RemoveRemillFunctionReturns::runOnFunction(llvm::Function &func) {
 //            `__remill_function_return` depends upon the memory pointer.
 llvm::FunctionPass *
 CreateRemoveRemillFunctionReturns(const EntityLifter &lifter) {
-  return new RemoveRemillFunctionReturns(lifter);
+  return new RemoveRemillFunctionReturns(CreateReturnAddressCache(lifter));
+}
+
+// Same as above, but sharing the classifications of return addresses in
+// `cache` with other passes.
+llvm::FunctionPass *
+CreateRemoveRemillFunctionReturns(std::shared_ptr<ReturnAddressCache> cache) {
+  return new RemoveRemillFunctionReturns(std::move(cache));
+}
+
+// Create a cache of the classifications of the program counters of calls to
+// `__remill_jump` and `__remill_function_return`.
+std::shared_ptr<ReturnAddressCache>
+CreateReturnAddressCache(const EntityLifter &lifter) {
+  return std::make_shared<ReturnAddressCache>(lifter);
+}
+
+// Does the work of `TransformRemillJumpIntrinsics`,
+// `RemoveRemillFunctionReturns`, and `LowerRemillUndefinedIntrinsics`, in
+// that order, but classifies each call to `__remill_jump` and
+// `__remill_function_return` only once.
+llvm::ModulePass *CreateCleanUpRemillIntrinsics(const EntityLifter &lifter) {
+  return new CleanUpRemillIntrinsics(lifter);
 }
 
 }  // namespace anvill
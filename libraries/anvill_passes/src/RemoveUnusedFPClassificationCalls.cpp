@@ -18,9 +18,9 @@
 #include <anvill/Transforms.h>
 #include <glog/logging.h>
 #include <llvm/IR/Function.h>
-#include <llvm/IR/InlineAsm.h>
 #include <llvm/IR/Instruction.h>
 #include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
 #include <llvm/Pass.h>
 
 #include "Utils.h"
@@ -28,11 +28,11 @@
 namespace anvill {
 namespace {
 
-class RemoveUnusedFPClassificationCalls final : public llvm::FunctionPass {
+class RemoveUnusedFPClassificationCalls final : public llvm::ModulePass {
  public:
-  RemoveUnusedFPClassificationCalls(void) : llvm::FunctionPass(ID) {}
+  RemoveUnusedFPClassificationCalls(void) : llvm::ModulePass(ID) {}
 
-  bool runOnFunction(llvm::Function &func) final;
+  bool runOnModule(llvm::Module &module) final;
 
  private:
   static char ID;
@@ -41,13 +41,8 @@ class RemoveUnusedFPClassificationCalls final : public llvm::FunctionPass {
 char RemoveUnusedFPClassificationCalls::ID = '\0';
 
 // Try to remove unused floating point classification function calls.
-bool RemoveUnusedFPClassificationCalls::runOnFunction(llvm::Function &func) {
-  auto calls = FindFunctionCalls(func, [](llvm::CallBase *call) -> bool {
-    const auto func = call->getCalledFunction();
-    if (!func) {
-      return false;
-    }
-
+bool RemoveUnusedFPClassificationCalls::runOnModule(llvm::Module &module) {
+  auto calls = FindFunctionCalls(module, [](llvm::Function *func) -> bool {
     const auto name = func->getName();
     return name == "fpclassify" || name == "__fpclassifyd" ||
            name == "__fpclassifyf" || name == "__fpclassifyld";
@@ -77,7 +72,7 @@ bool RemoveUnusedFPClassificationCalls::runOnFunction(llvm::Function &func) {
 // NOTE(pag): This pass must be applied before any kind of renaming of lifted
 //            functions is performed, so that we don't accidentally remove
 //            calls to classification functions present in the target binary.
-llvm::FunctionPass *CreateRemoveUnusedFPClassificationCalls(void) {
+llvm::ModulePass *CreateRemoveUnusedFPClassificationCalls(void) {
   return new RemoveUnusedFPClassificationCalls;
 }
 
@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "ReturnAddressCache.h"
+
+#include <anvill/Lifters/EntityLifter.h>
+#include <glog/logging.h>
+#include <llvm/ADT/Triple.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Operator.h>
+#include <remill/BC/ABI.h>
+
+namespace anvill {
+
+ReturnAddressCache::ReturnAddressCache(const EntityLifter &lifter)
+    : xref_resolver(lifter) {}
+
+ReturnAddressCache::~ReturnAddressCache(void) {}
+
+// Classify the program counter argument of `call`, a call to `__remill_jump`
+// or `__remill_function_return`.
+ReturnAddressKind ReturnAddressCache::Classify(llvm::CallBase *call) {
+  const auto pc =
+      call->getArgOperand(remill::kPCArgNum)->stripPointerCastsAndAliases();
+
+  auto &entry = classifications[call->getFunction()][call];
+  if (entry.call == call && entry.pc == pc) {
+    return entry.kind;
+  }
+
+  const auto module = call->getModule();
+  if (!analysis || analysis_module != module) {
+    analysis.reset(new SymbolicValueAnalysis(module));
+    analysis_module = module;
+  }
+
+  entry.kind = Query(pc);
+  entry.call = call;
+  entry.pc = pc;
+  return entry.kind;
+}
+
+// Forget the classifications of the calls in `func`, which was rewritten.
+void ReturnAddressCache::Forget(llvm::Function &func) {
+  classifications.erase(&func);
+  analysis.reset();
+  analysis_module = nullptr;
+}
+
+// Classify `val`, which reaches the program counter argument of a call to
+// `__remill_jump` or `__remill_function_return`.
+ReturnAddressKind ReturnAddressCache::Query(llvm::Value *val) {
+  if (analysis->IsReturnAddress(val)) {
+    return ReturnAddressKind::kReturnAddress;
+  }
+
+  if (auto call = llvm::dyn_cast<llvm::CallBase>(val)) {
+    if (auto func = call->getCalledFunction()) {
+      if (func->getName().startswith("__remill_read_memory_")) {
+        auto addr = call->getArgOperand(1);  // Address
+        if (analysis->IsRelatedToStackPointer(addr)) {
+          return ReturnAddressKind::kSymbolicStackPointerLoad;
+        } else {
+          return ReturnAddressKind::kUnclassifiable;
+        }
+      }
+    }
+    return ReturnAddressKind::kUnclassifiable;
+
+  } else if (auto li = llvm::dyn_cast<llvm::LoadInst>(val)) {
+    if (analysis->IsRelatedToStackPointer(li->getPointerOperand())) {
+      return ReturnAddressKind::kSymbolicStackPointerLoad;
+    } else {
+      return ReturnAddressKind::kUnclassifiable;
+    }
+
+  } else if (auto pti = llvm::dyn_cast<llvm::PtrToIntOperator>(val)) {
+    return Query(pti->getOperand(0));
+
+  } else if (auto cast = llvm::dyn_cast<llvm::CastInst>(val)) {
+    return Query(cast->getOperand(0));
+
+  } else if (analysis->IsRelatedToStackPointer(val)) {
+    return ReturnAddressKind::kSymbolicStackPointerLoad;
+
+  // Sometimes optimizations result in really crazy looking constant expressions
+  // related to `__anvill_ra`, full of shifts, zexts, etc. We try to detect
+  // this situation by initializing a "magic" address associated with
+  // `__anvill_ra`, and then if we find this magic value on something that
+  // references `__anvill_ra`, then we conclude that all those manipulations
+  // in the constant expression are actually not important.
+  } else if (auto xr = xref_resolver.TryResolveReferenceWithClearedCache(val);
+             xr.is_valid && xr.references_return_address &&
+             xr.u.address == xref_resolver.MagicReturnAddressValue()) {
+    return ReturnAddressKind::kReturnAddress;
+
+  } else {
+    return ReturnAddressKind::kUnclassifiable;
+  }
+}
+
+// Returns `__remill_function_return` in `module`, declaring it with `type` if
+// it's missing.
+llvm::Function *
+ReturnAddressCache::FunctionReturnIntrinsic(llvm::Module &module,
+                                            llvm::FunctionType *type) {
+  auto &handle = function_returns[&module];
+  if (llvm::Value *cached = handle) {
+    return llvm::cast<llvm::Function>(cached);
+  }
+
+  auto function = module.getFunction("__remill_function_return");
+  if (!function) {
+    function = llvm::Function::Create(type, llvm::GlobalValue::ExternalLinkage,
+                                      "__remill_function_return", &module);
+  }
+
+  function->addFnAttr(llvm::Attribute::NoDuplicate);
+  function->addFnAttr(llvm::Attribute::NoUnwind);
+  function->addFnAttr(llvm::Attribute::OptimizeNone);
+  function->addFnAttr(llvm::Attribute::NoInline);
+  function->removeFnAttr(llvm::Attribute::NoReturn);
+  function->removeFnAttr(llvm::Attribute::UWTable);
+  function->removeFnAttr(llvm::Attribute::AlwaysInline);
+
+  handle = function;
+  return function;
+}
+
+// Returns the function that lets us overwrite the return address. This is
+// not available on all architectures / OSes.
+llvm::Function *
+ReturnAddressCache::AddressOfReturnAddressFunction(llvm::Module &module) {
+  auto &handle = addr_of_ret_addr_funcs[&module];
+  if (llvm::Value *cached = handle) {
+    return llvm::cast<llvm::Function>(cached);
+  }
+
+  llvm::Triple triple(module.getTargetTriple());
+  const char *func_name = nullptr;
+  switch (triple.getArch()) {
+    case llvm::Triple::ArchType::x86:
+    case llvm::Triple::ArchType::x86_64:
+    case llvm::Triple::ArchType::aarch64:
+    case llvm::Triple::ArchType::aarch64_be:
+      func_name = "llvm.addressofreturnaddress.p0i8";
+      break;
+
+    // The Windows `_AddressOfReturnAddress` intrinsic function works on
+    // AArch32 / ARMv7 (as well as the above).
+    case llvm::Triple::ArchType::arm:
+    case llvm::Triple::ArchType::armeb:
+    case llvm::Triple::ArchType::aarch64_32:
+      if (triple.isOSWindows()) {
+        func_name = "_AddressOfReturnAddress";
+      }
+      break;
+    default: break;
+  }
+
+  llvm::Function *func = nullptr;
+
+  // Common path to handle the Windows-specific case, or the slightly
+  // more general case uniformly.
+  if (func_name) {
+    func = module.getFunction(func_name);
+    if (!func) {
+      auto &context = module.getContext();
+      auto fty =
+          llvm::FunctionType::get(llvm::Type::getInt8PtrTy(context, 0), false);
+      func = llvm::Function::Create(fty, llvm::GlobalValue::ExternalLinkage,
+                                    func_name, &module);
+    }
+  }
+
+  handle = func;
+  return func;
+}
+
+}  // namespace anvill
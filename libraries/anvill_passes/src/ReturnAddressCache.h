@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <anvill/Analysis/CrossReferenceResolver.h>
+#include <anvill/Analysis/Utils.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/IR/ValueHandle.h>
+
+#include <memory>
+
+namespace llvm {
+class CallBase;
+class Function;
+class FunctionType;
+class Module;
+class Value;
+}  // namespace llvm
+namespace anvill {
+
+class EntityLifter;
+
+// What reaches the program counter argument of a call to `__remill_jump` or
+// `__remill_function_return`.
+enum class ReturnAddressKind {
+
+  // A value returned by `llvm.returnaddress`, or casted from `__anvill_ra`.
+  // This is the ideal case, where the call is a function return.
+  kReturnAddress,
+
+  // A load from something derived from `__anvill_sp`, our "symbolic stack
+  // pointer". This suggests that stack frame recovery has not happened yet.
+  kSymbolicStackPointerLoad,
+
+  // A `load` or something else. This is probably a sign that stack frame
+  // recovery has happened, and that the actual return address is not
+  // necessarily the expected value.
+  kUnclassifiable
+};
+
+// Classifies the program counters of calls to `__remill_jump` and
+// `__remill_function_return`, and finds the functions needed to rewrite
+// those calls. Classifying a program counter may go through the
+// cross-reference resolver, so the answers are remembered, and shared by the
+// passes that rewrite the calls. A call is classified again only if its
+// program counter has changed, or if its function was rewritten.
+//
+// A classification depends on the values that the program counter is computed
+// from, and only the program counter itself is checked for changes. Passes that
+// rewrite calls must thus `Forget` the functions that they change.
+class ReturnAddressCache {
+ public:
+  explicit ReturnAddressCache(const EntityLifter &lifter);
+  ~ReturnAddressCache(void);
+
+  // Classify the program counter argument of `call`, a call to
+  // `__remill_jump` or `__remill_function_return`.
+  ReturnAddressKind Classify(llvm::CallBase *call);
+
+  // Forget the classifications of the calls in `func`, which was rewritten.
+  void Forget(llvm::Function &func);
+
+  // Returns `__remill_function_return` in `module`, declaring it with `type`
+  // if it's missing.
+  llvm::Function *FunctionReturnIntrinsic(llvm::Module &module,
+                                          llvm::FunctionType *type);
+
+  // Returns the function that lets us overwrite the return address. This is
+  // not available on all architectures / OSes, in which case it returns
+  // `nullptr`.
+  llvm::Function *AddressOfReturnAddressFunction(llvm::Module &module);
+
+ private:
+  ReturnAddressCache(const ReturnAddressCache &) = delete;
+  ReturnAddressCache &operator=(const ReturnAddressCache &) = delete;
+
+  ReturnAddressKind Query(llvm::Value *val);
+
+  const CrossReferenceResolver xref_resolver;
+
+  // Answers questions about symbolic values. It's remade whenever a function
+  // is forgotten, as it remembers answers about the values in that function.
+  std::unique_ptr<SymbolicValueAnalysis> analysis;
+  llvm::Module *analysis_module{nullptr};
+
+  struct Classification {
+    llvm::WeakVH call;
+    llvm::WeakVH pc;
+    ReturnAddressKind kind;
+  };
+
+  // Classified calls, grouped by their functions, so that they can be
+  // forgotten a function at a time.
+  llvm::DenseMap<llvm::Function *,
+                 llvm::DenseMap<llvm::CallBase *, Classification>>
+      classifications;
+
+  llvm::DenseMap<llvm::Module *, llvm::WeakVH> function_returns;
+  llvm::DenseMap<llvm::Module *, llvm::WeakVH> addr_of_ret_addr_funcs;
+};
+
+}  // namespace anvill
@@ -21,7 +21,6 @@
 #include <anvill/Transforms.h>
 #include <llvm/IR/Dominators.h>
 #include <llvm/IR/Function.h>
-#include <llvm/IR/InstIterator.h>
 #include <llvm/IR/Instruction.h>
 #include <llvm/IR/Instructions.h>
 #include <llvm/Pass.h>
@@ -52,51 +51,49 @@ SinkSelectionsIntoBranchTargets *SinkSelectionsIntoBranchTargets::Create(
 SinkSelectionsIntoBranchTargets::FunctionAnalysis
 SinkSelectionsIntoBranchTargets::AnalyzeFunction(llvm::Function &function) {
 
-  // Collect all the applicable instructions
+  // Collect all the applicable instructions. There are usually far fewer
+  // conditional branches than instructions, so go from the branches to the
+  // `SelectInst` instructions that share their conditions.
   SelectListMap select_list_map;
 
-  for (auto &instruction : llvm::instructions(function)) {
-
-    // Look for `SelectInst` instructions
-    auto select_inst = llvm::dyn_cast<llvm::SelectInst>(&instruction);
-    if (select_inst == nullptr) {
+  for (auto &block : function) {
+    const auto branch_inst =
+        llvm::dyn_cast_or_null<llvm::BranchInst>(block.getTerminator());
+    if (branch_inst == nullptr || !branch_inst->isConditional()) {
       continue;
     }
 
-    const auto select_condition = select_inst->getCondition();
-
-    for (auto &use : select_condition->uses()) {
-
-      // Look for users that are conditional branches
-      const auto branch_inst = llvm::dyn_cast<llvm::BranchInst>(use.getUser());
-      if (branch_inst == nullptr) {
-        continue;
-      }
+    // Constants are shared across the whole module, so their use lists would
+    // lead us into other functions.
+    const auto branch_condition = branch_inst->getCondition();
+    if (llvm::isa<llvm::Constant>(branch_condition)) {
+      continue;
+    }
 
-      if (!branch_inst->isConditional()) {
-        continue;
-      }
+    for (auto &use : branch_condition->uses()) {
 
       // The `SelectInst` and `BranchInst` must share the same
       // condition
-      if (branch_inst->getCondition() != select_condition) {
+      const auto select_inst = llvm::dyn_cast<llvm::SelectInst>(use.getUser());
+      if (select_inst == nullptr ||
+          &use != &(select_inst->getOperandUse(0))) {
         continue;
       }
 
-      auto select_list_it = select_list_map.find(select_inst);
-      if (select_list_it == select_list_map.end()) {
-        auto insert_status = select_list_map.insert({select_inst, {}});
-        select_list_it = insert_status.first;
-      }
-
-      auto &branch_list = select_list_it->second;
-      branch_list.emplace_back(branch_inst);
+      select_list_map[select_inst].emplace_back(branch_inst);
     }
   }
 
   // Determine which replacements need to happen
   FunctionAnalysis output;
+  if (select_list_map.empty()) {
+    return output;
+  }
 
+  // Sinking only replaces uses, and never changes the CFG, so one dominator
+  // tree stays valid for the whole function. It's only built when there is
+  // something to sink, which keeps re-runs of this pass over already-sunk
+  // functions cheap.
   llvm::DominatorTree doms(function);
 
   for (auto &select_list_map_p : select_list_map) {
@@ -48,6 +48,29 @@ struct AllocatedStackFramePart final {
 // A list of allocated stack frame parts
 using AllocatedStackFramePartList = std::vector<AllocatedStackFramePart>;
 
+// Returns the struct type named `name` that wraps an array of `size` bytes,
+// and that is packed if `is_packed` is `true`, creating it if necessary, or
+// `nullptr` if a different type already has that name.
+static llvm::StructType *GetOrCreateByteArrayType(const llvm::Module &module,
+                                                  const std::string &name,
+                                                  std::size_t size,
+                                                  bool is_packed) {
+  auto byte_array_type =
+      llvm::ArrayType::get(llvm::Type::getInt8Ty(module.getContext()), size);
+
+  auto type = SplitStackFrameAtReturnAddress::getTypeByName(module, name);
+  if (type == nullptr) {
+    return llvm::StructType::create({byte_array_type}, name, is_packed);
+
+  } else if (type->isPacked() == is_packed && type->getNumElements() == 1U &&
+             type->getElementType(0U) == byte_array_type) {
+    return type;
+
+  } else {
+    return nullptr;
+  }
+}
+
 }  // namespace
 
 SplitStackFrameAtReturnAddress *SplitStackFrameAtReturnAddress::Create(
@@ -224,7 +247,7 @@ SplitStackFrameAtReturnAddress::AnalyzeFunction(llvm::Function &function) {
     //
     // clang-format off
     //
-    //   %93 = getelementptr %sub_80482e0__Ai_S_Sb_S_Sbi_B_0.frame_type, %sub_80482e0__Ai_S_Sb_S_Sbi_B_0.frame_type* %4, i32 0, i32 0, i32 28
+    //   %93 = getelementptr %stack_frame_44.frame_type, %stack_frame_44.frame_type* %4, i32 0, i32 0, i32 28
     //   %94 = bitcast i8* %93 to i32*
     //   store i32 ptrtoint (i8* @__anvill_ra to i32), i32* %94, align 4
     //
@@ -341,35 +364,19 @@ SplitStackFrameAtReturnAddress::SplitStackFrame(
   //
 
   auto &module = *function.getParent();
-  auto &context = module.getContext();
   auto data_layout = module.getDataLayout();
 
-  auto byte_type = llvm::Type::getInt8Ty(context);
-
   llvm::IRBuilder<> builder(stack_analysis.stack_frame_alloca);
 
   AllocatedStackFramePartList allocated_part_list;
   std::size_t allocated_stack_parts_size{};
 
   for (const auto &part_info : stack_analysis.stack_frame_parts) {
-    // First, create the type
-    auto byte_array_type = llvm::ArrayType::get(byte_type, part_info.size);
-    if (byte_array_type == nullptr) {
-      return StackFrameSplitErrorCode::InternalError;
-    }
-
-    auto part_name =
-        GenerateStackFramePartTypeName(function, allocated_part_list.size());
-
-    if (getTypeByName(module, part_name) != nullptr) {
-      return StackFrameSplitErrorCode::TypeConflict;
-    }
-
-    auto part_type =
-        llvm::StructType::create({byte_array_type}, part_name, true);
-
+    // First, get the type; it's shared with other parts of the same size
+    auto part_type = GetOrCreateStackFramePartType(
+        module, static_cast<std::size_t>(part_info.size));
     if (part_type == nullptr) {
-      return StackFrameSplitErrorCode::InternalError;
+      return StackFrameSplitErrorCode::TypeConflict;
     }
 
     allocated_stack_parts_size += data_layout.getTypeAllocSize(part_type);
@@ -497,25 +504,42 @@ SplitStackFrameAtReturnAddress::SplitStackFrame(
   return std::monostate();
 }
 
-std::string SplitStackFrameAtReturnAddress::GetFunctionStackFrameTypeName(
-    const llvm::Function &function) {
-  return function.getName().str() + kStackFrameTypeNameSuffix;
+std::string
+SplitStackFrameAtReturnAddress::GetStackFrameTypeName(std::size_t size) {
+  return "stack_frame_" + std::to_string(size) + kStackFrameTypeNameSuffix;
+}
+
+llvm::StructType *
+SplitStackFrameAtReturnAddress::GetOrCreateStackFrameType(
+    const llvm::Module &module, std::size_t size) {
+  return GetOrCreateByteArrayType(module, GetStackFrameTypeName(size), size,
+                                  true);
 }
 
 Result<llvm::StructType *, StackFrameSplitErrorCode>
 SplitStackFrameAtReturnAddress::GetFunctionStackFrameType(
     const llvm::Function &function) {
 
-  auto module = function.getParent();
+  // Stack frame types are shared across functions, so go find the one that
+  // is allocated in this function.
+  llvm::StructType *struct_type = nullptr;
+  for (auto &inst : function.getEntryBlock()) {
+    auto alloca_inst = llvm::dyn_cast<llvm::AllocaInst>(&inst);
+    if (alloca_inst == nullptr) {
+      continue;
+    }
 
-  auto type = getTypeByName(*module, GetFunctionStackFrameTypeName(function));
-  if (type == nullptr) {
-    return StackFrameSplitErrorCode::StackFrameTypeNotFound;
+    auto allocated_type =
+        llvm::dyn_cast<llvm::StructType>(alloca_inst->getAllocatedType());
+    if (allocated_type != nullptr && allocated_type->hasName() &&
+        allocated_type->getName().endswith(kStackFrameTypeNameSuffix)) {
+      struct_type = allocated_type;
+      break;
+    }
   }
 
-  auto struct_type = llvm::dyn_cast<llvm::StructType>(type);
   if (struct_type == nullptr) {
-    return StackFrameSplitErrorCode::UnexpectedStackFrameTypeFormat;
+    return StackFrameSplitErrorCode::StackFrameTypeNotFound;
   }
 
   // This stack frame must be a struct containing an array of i8 integers
@@ -530,17 +554,17 @@ SplitStackFrameAtReturnAddress::GetFunctionStackFrameType(
 
   auto inner_array = llvm::dyn_cast<llvm::ArrayType>(inner_type);
   if (inner_array->getElementType() !=
-      llvm::Type::getInt8Ty(module->getContext())) {
+      llvm::Type::getInt8Ty(function.getContext())) {
     return StackFrameSplitErrorCode::UnexpectedStackFrameTypeFormat;
   }
 
   return struct_type;
 }
 
-std::string SplitStackFrameAtReturnAddress::GenerateStackFramePartTypeName(
-    const llvm::Function &function, std::size_t part_number) {
-  return function.getName().str() + kStackFrameTypeNameSuffix + "_part" +
-         std::to_string(part_number);
+llvm::StructType *SplitStackFrameAtReturnAddress::GetOrCreateStackFramePartType(
+    const llvm::Module &module, std::size_t size) {
+  return GetOrCreateByteArrayType(
+      module, GetStackFrameTypeName(size) + "_part", size, false);
 }
 
 SplitStackFrameAtReturnAddress::SplitStackFrameAtReturnAddress(
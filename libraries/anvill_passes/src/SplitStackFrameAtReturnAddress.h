@@ -182,18 +182,33 @@ class SplitStackFrameAtReturnAddress final
   // Executes the function pass logic
   Result<bool, StackFrameSplitErrorCode> execute(llvm::Function &function);
 
-  // Returns the name of the stack frame type for the given function
-  static std::string
-  GetFunctionStackFrameTypeName(const llvm::Function &function);
-
-  // Returns the stack frame type for the given function
+  // Returns the name of the stack frame type of `size` bytes. Stack frame
+  // types are byte arrays, so they are named after their size, and shared
+  // by all functions whose stack frames have that size.
+  static std::string GetStackFrameTypeName(std::size_t size);
+
+  // Returns the stack frame type of `size` bytes, creating it if necessary,
+  // or `nullptr` if a different type already has its name.
+  static llvm::StructType *
+  GetOrCreateStackFrameType(const llvm::Module &module, std::size_t size);
+
+  // Returns the stack frame type for the given function, i.e. the type of
+  // the frame allocated in the function, if any
   static Result<llvm::StructType *, StackFrameSplitErrorCode>
   GetFunctionStackFrameType(const llvm::Function &function);
 
-  // Generates a new name for a stack frame part
-  static std::string
-  GenerateStackFramePartTypeName(const llvm::Function &function,
-                                 std::size_t part_number);
+  // Returns the type of a stack frame part of `size` bytes, creating it if
+  // necessary, or `nullptr` if a different type already has its name. Like
+  // stack frame types, these are shared by all functions.
+  //
+  // Part types aren't packed, unlike stack frame types, even though both are
+  // byte arrays with the same layout. When modules are linked, the linker
+  // merges named types with the same body if the destination lacks one of the
+  // names, which would otherwise turn the part of one module into the whole
+  // stack frame of another, and make linked modules differ from modules lifted
+  // in one go.
+  static llvm::StructType *
+  GetOrCreateStackFramePartType(const llvm::Module &module, std::size_t size);
 
  private:
   SplitStackFrameAtReturnAddress(ITransformationErrorManager &error_manager);
@@ -36,9 +36,11 @@
 #include <remill/BC/Compat/ScalarTransforms.h>
 #include <remill/BC/Util.h>
 
+#include <memory>
 #include <utility>
 #include <vector>
 
+#include "ReturnAddressCache.h"
 #include "Utils.h"
 
 
@@ -46,91 +48,23 @@ namespace anvill {
 namespace {
 
 const std::string kRemillJumpIntrinsicName = "__remill_jump";
-const std::string kRemillFunctionReturnIntrinsicName =
-    "__remill_function_return";
-
-enum ReturnAddressResult {
-
-  // This is a case where a value returned by `llvm.returnaddress`, or
-  // casted from `__anvill_ra`, reaches into the `pc` argument of the
-  // `__remill_jump` intrinsic. This is the ideal case that we want to
-  // replace it with `__remill_function_return`.
-  kReturnAddressProgramCounter,
-
-  // This is a case a value returned by `llvm.returnaddress`, or casted
-  // from `__anvill_ra` does not reaches to the `pc` argument and it
-  // should not get transformed to `__remill_function_return`.
-  kUnclassifiableProgramCounter
-};
-
 class TransformRemillJumpIntrinsics final : public llvm::FunctionPass {
  public:
-  TransformRemillJumpIntrinsics(const EntityLifter &lifter_)
+  TransformRemillJumpIntrinsics(std::shared_ptr<ReturnAddressCache> cache_)
       : llvm::FunctionPass(ID),
-        xref_resolver_(lifter_) {}
+        cache(std::move(cache_)) {}
 
   bool runOnFunction(llvm::Function &func) final;
 
  private:
-  ReturnAddressResult QueryReturnAddress(llvm::Module *module,
-                                         llvm::Value *val) const;
-
   bool TransformJumpIntrinsic(llvm::CallBase *call);
 
   static char ID;
-  const CrossReferenceResolver xref_resolver_;
+  const std::shared_ptr<ReturnAddressCache> cache;
 };
 
 char TransformRemillJumpIntrinsics::ID = '\0';
 
-// Returns `true` if `val` is a possible return address
-ReturnAddressResult
-TransformRemillJumpIntrinsics::QueryReturnAddress(llvm::Module *module,
-                                                  llvm::Value *val) const {
-
-  if (IsReturnAddress(module, val)) {
-    return kReturnAddressProgramCounter;
-
-  } else if (auto pti = llvm::dyn_cast<llvm::PtrToIntOperator>(val)) {
-    return QueryReturnAddress(module, pti->getOperand(0));
-
-  // Sometimes optimizations result in really crazy looking constant expressions
-  // related to `__anvill_ra`, full of shifts, zexts, etc. We try to detect
-  // this situation by initializing a "magic" address associated with
-  // `__anvill_ra`, and then if we find this magic value on something that
-  // references `__anvill_ra`, then we conclude that all those manipulations
-  // in the constant expression are actually not important.
-  } else if (auto xr = xref_resolver_.TryResolveReferenceWithClearedCache(val);
-             xr.is_valid && xr.references_return_address &&
-             xr.u.address == xref_resolver_.MagicReturnAddressValue()) {
-    return kReturnAddressProgramCounter;
-  }
-
-  return kUnclassifiableProgramCounter;
-}
-
-// Find the remill intrinsic in module. If it is missing create one
-// with the given function type
-static llvm::Function *FindIntrinsic(llvm::Module *module,
-                                     llvm::FunctionType *type,
-                                     const std::string &name) {
-  auto function = module->getFunction(name);
-  if (!function) {
-    function = llvm::Function::Create(type, llvm::GlobalValue::ExternalLinkage,
-                                      name, module);
-  }
-
-  CHECK(nullptr != function) << "Unable to get intrinsic: " << name;
-  function->addFnAttr(llvm::Attribute::NoDuplicate);
-  function->addFnAttr(llvm::Attribute::NoUnwind);
-  function->addFnAttr(llvm::Attribute::OptimizeNone);
-  function->addFnAttr(llvm::Attribute::NoInline);
-  function->removeFnAttr(llvm::Attribute::NoReturn);
-  function->removeFnAttr(llvm::Attribute::UWTable);
-  function->removeFnAttr(llvm::Attribute::AlwaysInline);
-  return function;
-}
-
 // Find the call site of the given function and add them to vector
 // if `pred(call)` is true
 template <typename T>
@@ -154,8 +88,7 @@ bool TransformRemillJumpIntrinsics::TransformJumpIntrinsic(
   const auto called_func = call->getCalledFunction();
   if (called_func && called_func->getName() == kRemillJumpIntrinsicName) {
     auto func_type = call->getCalledFunction()->getFunctionType();
-    auto intrinsic =
-        FindIntrinsic(module, func_type, kRemillFunctionReturnIntrinsicName);
+    auto intrinsic = cache->FunctionReturnIntrinsic(*module, func_type);
 
     // undef state pointer argument
     auto state_ptr_arg = call->getArgOperand(remill::kStatePointerArgNum);
@@ -181,19 +114,13 @@ bool TransformRemillJumpIntrinsics::TransformJumpIntrinsic(
 // remove.
 bool TransformRemillJumpIntrinsics::runOnFunction(llvm::Function &func) {
   const auto module = func.getParent();
-  const auto &dl = module->getDataLayout();
   auto calls = FindFunctionCalls(func, [&](llvm::CallBase *call) -> bool {
     const auto func = call->getCalledFunction();
     if (!func || func->getName() != kRemillJumpIntrinsicName) {
       return false;
     }
 
-    const auto ret_addr =
-        call->getArgOperand(remill::kPCArgNum)->stripPointerCastsAndAliases();
-    switch (QueryReturnAddress(module, ret_addr)) {
-      case kReturnAddressProgramCounter: return true;
-      case kUnclassifiableProgramCounter: return false;
-    }
+    return cache->Classify(call) == ReturnAddressKind::kReturnAddress;
   });
 
   auto ret = false;
@@ -202,6 +129,7 @@ bool TransformRemillJumpIntrinsics::runOnFunction(llvm::Function &func) {
   }
 
   if (ret) {
+    cache->Forget(func);
 
     // Run private function passes if the jump instrinsics
     // are replaced
@@ -235,7 +163,14 @@ bool TransformRemillJumpIntrinsics::runOnFunction(llvm::Function &func) {
 
 llvm::FunctionPass *
 CreateTransformRemillJumpIntrinsics(const EntityLifter &lifter) {
-  return new TransformRemillJumpIntrinsics(lifter);
+  return new TransformRemillJumpIntrinsics(CreateReturnAddressCache(lifter));
+}
+
+// Same as above, but sharing the classifications of return addresses in
+// `cache` with other passes.
+llvm::FunctionPass *
+CreateTransformRemillJumpIntrinsics(std::shared_ptr<ReturnAddressCache> cache) {
+  return new TransformRemillJumpIntrinsics(std::move(cache));
 }
 
 }  // namespace anvill
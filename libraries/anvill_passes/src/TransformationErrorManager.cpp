@@ -17,33 +17,173 @@
 
 #include "TransformationErrorManager.h"
 
+#include <llvm/Support/xxhash.h>
+
+#include <algorithm>
+
 namespace anvill {
+namespace {
+
+// Returns the hash of `ir`, if present.
+static std::optional<uint64_t>
+HashIR(const std::optional<std::string> &ir,
+       const std::optional<uint64_t> &hash) {
+  if (hash || !ir) {
+    return hash;
+  } else {
+    return llvm::xxHash64(*ir);
+  }
+}
+
+}  // namespace
+
+TransformationErrorManager::TransformationErrorManager(
+    IRSnapshotPolicy snapshot_policy_, ITransformationErrorSink::Ptr sink_,
+    std::size_t max_retained_errors_)
+    : snapshot_policy(snapshot_policy_),
+      sink(std::move(sink_)),
+      max_retained_errors(max_retained_errors_) {}
 
 void TransformationErrorManager::Insert(const TransformationError &error) {
-  if (error.severity == SeverityType::Fatal) {
-    has_fatal_error = true;
+
+  // IR can be huge, so only retained fatal errors keep it; other retained
+  // errors refer to the IR in the sink by hash.
+  TransformationError retained;
+  retained.pass_name = error.pass_name;
+  retained.description = error.description;
+  retained.severity = error.severity;
+  retained.error_code = error.error_code;
+  retained.message = error.message;
+  retained.module_name = error.module_name;
+  retained.function_name = error.function_name;
+  retained.func_before_hash = HashIR(error.func_before, error.func_before_hash);
+  retained.func_after_hash = HashIR(error.func_after, error.func_after_hash);
+
+  const auto is_fatal = error.severity == SeverityType::Fatal;
+  if (is_fatal || sink) {
+    retained.func_before = error.func_before;
+    retained.func_after = error.func_after;
+  }
+
+  if (is_fatal) {
+    has_fatal_error.store(true, std::memory_order_release);
   }
 
-  error_list.push_back(error);
+  {
+    std::lock_guard<std::mutex> locker(lock);
+    auto retained_error_dropped = false;
+    if (sink) {
+      if (is_fatal) {
+        pending_writes.push_back(retained);
+
+      // Move the IR into the written error, rather than copying it.
+      } else {
+        std::optional<std::string> func_before;
+        std::optional<std::string> func_after;
+        func_before.swap(retained.func_before);
+        func_after.swap(retained.func_after);
+        auto &written = pending_writes.emplace_back(retained);
+        written.func_before.swap(func_before);
+        written.func_after.swap(func_after);
+      }
+    }
+
+    // Fatal errors are never dropped, as they explain why the module can't
+    // be used. Making room for an error evicts the oldest non-fatal error.
+    if (error_list.size() >= max_retained_errors) {
+      auto evicted = std::find_if(
+          error_list.begin(), error_list.end(),
+          [](const TransformationError &retained_error) {
+            return retained_error.severity != SeverityType::Fatal;
+          });
+      if (evicted != error_list.end()) {
+        error_list.erase(evicted);
+        ++num_dropped_errors;
+
+      } else if (!is_fatal) {
+        ++num_dropped_errors;
+        retained_error_dropped = true;
+      }
+    }
+
+    if (!retained_error_dropped) {
+      error_list.emplace_back(std::move(retained));
+    }
+  }
+
+  if (sink) {
+    WritePendingErrors();
+  }
+}
+
+// Write the pending errors to the sink, unless another thread is already
+// doing so, in which case it will write ours too.
+//
+// After giving up `sink_lock`, we check again for pending errors, as another
+// thread may have added some, and then failed to get `sink_lock`, after we last
+// took them.
+void TransformationErrorManager::WritePendingErrors(void) {
+  std::vector<TransformationError> to_write;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> sink_locker(sink_lock, std::try_to_lock);
+      if (!sink_locker) {
+        return;
+      }
+
+      for (;;) {
+        {
+          std::lock_guard<std::mutex> locker(lock);
+          to_write.swap(pending_writes);
+        }
+        if (to_write.empty()) {
+          break;
+        }
+        for (const auto &error : to_write) {
+          sink->Write(error);
+        }
+        to_write.clear();
+      }
+    }
+
+    std::lock_guard<std::mutex> locker(lock);
+    if (pending_writes.empty()) {
+      return;
+    }
+  }
 }
 
 void TransformationErrorManager::Reset(void) {
+  std::lock_guard<std::mutex> locker(lock);
   error_list.clear();
-  has_fatal_error = false;
+  num_dropped_errors = 0;
+  has_fatal_error.store(false, std::memory_order_release);
 }
 
 bool TransformationErrorManager::HasFatalError(void) const {
-  return has_fatal_error;
+  return has_fatal_error.load(std::memory_order_acquire);
 }
 
-const std::vector<TransformationError> &
+const std::deque<TransformationError> &
 TransformationErrorManager::ErrorList(void) const {
   return error_list;
 }
 
-ITransformationErrorManager::Ptr ITransformationErrorManager::Create(void) {
+std::size_t TransformationErrorManager::NumDroppedErrors(void) const {
+  return num_dropped_errors;
+}
+
+IRSnapshotPolicy TransformationErrorManager::SnapshotPolicy(void) const {
+  return snapshot_policy;
+}
+
+ITransformationErrorManager::Ptr
+ITransformationErrorManager::Create(IRSnapshotPolicy policy,
+                                    ITransformationErrorSink::Ptr sink,
+                                    std::size_t max_retained_errors) {
   try {
-    return Ptr(new TransformationErrorManager());
+    return Ptr(new TransformationErrorManager(policy, std::move(sink),
+                                              max_retained_errors));
 
   } catch (const std::bad_alloc &) {
     return nullptr;
@@ -19,14 +19,37 @@
 
 #include <anvill/ITransformationErrorManager.h>
 
+#include <atomic>
+#include <mutex>
+#include <vector>
+
 namespace anvill {
 
 class TransformationErrorManager final : public ITransformationErrorManager {
-  std::vector<TransformationError> error_list;
-  bool has_fatal_error{false};
+  std::mutex lock;
+  std::deque<TransformationError> error_list;
+  std::size_t num_dropped_errors{0};
+
+  // Checked by workers between functions, so that a fatal error cancels the
+  // rest of their work without them having to take `lock`.
+  std::atomic<bool> has_fatal_error{false};
+
+  const IRSnapshotPolicy snapshot_policy;
+  const ITransformationErrorSink::Ptr sink;
+  const std::size_t max_retained_errors;
+
+  // Errors waiting to be written to `sink`, guarded by `lock`. Whichever
+  // inserting thread holds `sink_lock` writes out everything pending, so
+  // that the other threads don't wait on the sink's I/O.
+  std::vector<TransformationError> pending_writes;
+  std::mutex sink_lock;
+
+  void WritePendingErrors(void);
 
  public:
-  TransformationErrorManager() = default;
+  TransformationErrorManager(IRSnapshotPolicy snapshot_policy_,
+                             ITransformationErrorSink::Ptr sink_,
+                             std::size_t max_retained_errors_);
   virtual ~TransformationErrorManager() override = default;
 
   virtual void Insert(const TransformationError &error) override;
@@ -34,8 +57,12 @@ class TransformationErrorManager final : public ITransformationErrorManager {
 
   virtual bool HasFatalError(void) const override;
 
-  virtual const std::vector<TransformationError> &
+  virtual const std::deque<TransformationError> &
   ErrorList(void) const override;
+
+  virtual std::size_t NumDroppedErrors(void) const override;
+
+  virtual IRSnapshotPolicy SnapshotPolicy(void) const override;
 };
 
 }  // namespace anvill
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <anvill/ITransformationErrorManager.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <system_error>
+#include <unordered_set>
+
+namespace anvill {
+namespace {
+
+static const char *SeverityName(SeverityType severity) {
+  switch (severity) {
+    case SeverityType::Information: return "information";
+    case SeverityType::Warning: return "warning";
+    case SeverityType::Error: return "error";
+    case SeverityType::Fatal: return "fatal";
+  }
+  return "";
+}
+
+// Writes errors to a file, one JSON object per line.
+class JSONLinesErrorSink final : public ITransformationErrorSink {
+ public:
+  explicit JSONLinesErrorSink(std::unique_ptr<llvm::raw_fd_ostream> os_)
+      : os(std::move(os_)) {}
+
+  virtual ~JSONLinesErrorSink(void) override {
+    os->flush();
+  }
+
+  virtual void Write(const TransformationError &error) override {
+    WriteIR(error.func_before, error.func_before_hash);
+    WriteIR(error.func_after, error.func_after_hash);
+
+    llvm::json::OStream json(*os);
+    json.object([&] {
+      json.attribute("severity", SeverityName(error.severity));
+      json.attribute("pass_name", error.pass_name);
+      json.attribute("error_code", error.error_code);
+      json.attribute("message", error.message);
+      json.attribute("description", error.description);
+      json.attribute("module_name", error.module_name);
+      if (error.function_name) {
+        json.attribute("function_name", *error.function_name);
+      }
+      if (error.func_before_hash) {
+        json.attribute("func_before", llvm::utohexstr(*error.func_before_hash));
+      }
+      if (error.func_after_hash) {
+        json.attribute("func_after", llvm::utohexstr(*error.func_after_hash));
+      }
+    });
+    *os << '\n';
+
+    // Make sure that the error is on disk before the fatal error is reported.
+    if (error.severity == SeverityType::Fatal) {
+      os->flush();
+    }
+  }
+
+ private:
+
+  // Write out `ir`, unless IR with the same hash has already been written.
+  void WriteIR(const std::optional<std::string> &ir,
+               const std::optional<uint64_t> &hash) {
+    if (!ir || !hash || !written_ir.insert(*hash).second) {
+      return;
+    }
+
+    llvm::json::OStream json(*os);
+    json.object([&] {
+      json.attribute("ir_hash", llvm::utohexstr(*hash));
+      json.attribute("ir", *ir);
+    });
+    *os << '\n';
+  }
+
+  const std::unique_ptr<llvm::raw_fd_ostream> os;
+
+  // Hashes of the IR that has already been written.
+  std::unordered_set<uint64_t> written_ir;
+};
+
+}  // namespace
+
+ITransformationErrorSink::Ptr
+ITransformationErrorSink::CreateJSONLines(const std::string &path) {
+  std::error_code ec;
+  auto os = std::make_unique<llvm::raw_fd_ostream>(path, ec,
+                                                   llvm::sys::fs::OF_Text);
+  if (ec) {
+    return nullptr;
+  }
+
+  return Ptr(new JSONLinesErrorSink(std::move(os)));
+}
+
+}  // namespace anvill
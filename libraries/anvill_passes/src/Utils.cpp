@@ -42,6 +42,29 @@ FindFunctionCalls(llvm::Function &func,
   return found;
 }
 
+// Find all calls to the functions of `module` for which `pred(func)` returns
+// `true`.
+std::vector<llvm::CallBase *>
+FindFunctionCalls(llvm::Module &module,
+                  std::function<bool(llvm::Function *)> pred) {
+  std::vector<llvm::CallBase *> found;
+  for (auto &func : module) {
+    if (!pred(&func)) {
+      continue;
+    }
+
+    // A function can also be used as an argument to a call, so only take the
+    // calls that actually target it.
+    for (auto &use : func.uses()) {
+      if (auto call = llvm::dyn_cast<llvm::CallBase>(use.getUser());
+          call && call->isCallee(&use)) {
+        found.push_back(call);
+      }
+    }
+  }
+  return found;
+}
+
 namespace {
 
 // Convert the constant `val` to have the pointer type `dest_ptr_ty`.
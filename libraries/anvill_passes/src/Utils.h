@@ -43,6 +43,14 @@ std::vector<llvm::CallBase *>
 FindFunctionCalls(llvm::Function &func,
                   std::function<bool(llvm::CallBase *)> pred);
 
+// Find all calls to the functions of `module` for which `pred(func)` returns
+// `true`. The calls are found by way of the use lists of the matching
+// functions, so the cost is proportional to the number of calls, and not to
+// the size of the module.
+std::vector<llvm::CallBase *>
+FindFunctionCalls(llvm::Module &module,
+                  std::function<bool(llvm::Function *)> pred);
+
 // Convert the constant `val` to have the pointer type `dest_ptr_ty`.
 llvm::Value *ConvertToPointer(llvm::Instruction *usage_site,
                               llvm::Value *val_to_convert,
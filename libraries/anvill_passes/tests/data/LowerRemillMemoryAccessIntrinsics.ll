@@ -0,0 +1,14 @@
+target datalayout = "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-pc-linux-gnu"
+
+%struct.Memory = type opaque
+
+declare i32 @__remill_read_memory_32(%struct.Memory*, i64)
+declare %struct.Memory* @__remill_write_memory_32(%struct.Memory*, i64, i32)
+
+define %struct.Memory* @copy_word(%struct.Memory* %mem, i64 %src, i64 %dst) {
+  %val = call i32 @__remill_read_memory_32(%struct.Memory* %mem, i64 %src)
+  %inc = add i32 %val, 1
+  %new_mem = call %struct.Memory* @__remill_write_memory_32(%struct.Memory* %mem, i64 %dst, i32 %inc)
+  ret %struct.Memory* %new_mem
+}
@@ -0,0 +1,42 @@
+target datalayout = "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-pc-linux-gnu"
+
+@data_3000 = external global i32
+
+; `sub_1000` and `sub_1010` only differ in their PC annotations.
+define i32 @sub_1010(i32 %0) {
+  %2 = load i32, i32* @data_3000, align 4, !pc !0
+  %3 = add i32 %2, %0, !pc !0
+  %4 = mul i32 %3, 3, !pc !1
+  ret i32 %4
+}
+
+define i32 @sub_1000(i32 %0) {
+  %2 = load i32, i32* @data_3000, align 4, !pc !2
+  %3 = add i32 %2, %0, !pc !2
+  %4 = mul i32 %3, 3, !pc !3
+  ret i32 %4
+}
+
+; `sub_1020` multiplies by something else.
+define i32 @sub_1020(i32 %0) {
+  %2 = load i32, i32* @data_3000, align 4, !pc !4
+  %3 = add i32 %2, %0, !pc !4
+  %4 = mul i32 %3, 5, !pc !5
+  ret i32 %4
+}
+
+; `not_lifted` isn't a lifted function.
+define i32 @not_lifted(i32 %0) {
+  %2 = load i32, i32* @data_3000, align 4
+  %3 = add i32 %2, %0
+  %4 = mul i32 %3, 3
+  ret i32 %4
+}
+
+!0 = !{i64 4112}
+!1 = !{i64 4118}
+!2 = !{i64 4096}
+!3 = !{i64 4102}
+!4 = !{i64 4128}
+!5 = !{i64 4134}
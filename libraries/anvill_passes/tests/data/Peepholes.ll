@@ -0,0 +1,55 @@
+target datalayout = "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-pc-linux-gnu"
+
+define i32 @trivial_phis_and_selects(i1 %c, i32 %x, i32 %y) {
+entry:
+  br i1 %c, label %left, label %right
+
+left:
+  br label %join
+
+right:
+  br label %join
+
+join:
+  %p = phi i32 [ %x, %left ], [ %x, %right ]
+  %s0 = select i1 %c, i32 %p, i32 %p
+  %s1 = select i1 %c, i32 %s0, i32 %s0
+  %dead = add i32 %s1, %y
+  ret i32 %s1
+}
+
+define i32 @xor_to_cmp(i32 %x, i32 %y, i32 %z) {
+entry:
+  %c = icmp eq i32 %x, %y
+  %n = xor i1 %c, true
+  %w = zext i1 %n to i32
+  %s = select i1 %c, i32 %y, i32 %z
+  %r = add i32 %w, %s
+  br i1 %c, label %taken, label %not_taken
+
+taken:
+  ret i32 %r
+
+not_taken:
+  ret i32 0
+}
+
+define i32 @xor_kept(i32 %x, i32 %y) {
+entry:
+  %c = icmp eq i32 %x, %y
+  %n = xor i1 %c, true
+  %a = zext i1 %c to i32
+  %b = zext i1 %n to i32
+  %r = add i32 %a, %b
+  ret i32 %r
+}
+
+declare i32 @__fpclassifyd(double)
+
+define i32 @unused_fp_classification(double %d) {
+entry:
+  %unused = call i32 @__fpclassifyd(double %d)
+  %used = call i32 @__fpclassifyd(double %d)
+  ret i32 %used
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <anvill/Lifters/EntityLifter.h>
+#include <anvill/Transforms.h>
+#include <doctest.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instructions.h>
+#include <remill/Arch/Arch.h>
+#include <remill/Arch/Name.h>
+#include <remill/OS/OS.h>
+
+#include "Utils.h"
+
+namespace anvill {
+
+// Returns the number of `inttoptr` instructions in `func`.
+static unsigned CountIntToPtrs(llvm::Function *func) {
+  auto num_casts = 0u;
+  for (auto &inst : llvm::instructions(func)) {
+    if (llvm::isa<llvm::IntToPtrInst>(&inst)) {
+      ++num_casts;
+    }
+  }
+  return num_casts;
+}
+
+TEST_SUITE("LowerRemillMemoryAccessIntrinsics") {
+  TEST_CASE("Accesses to unknown addresses are lowered through inttoptr") {
+    llvm::LLVMContext llvm_context;
+    auto module =
+        LoadTestData(llvm_context, "LowerRemillMemoryAccessIntrinsics.ll");
+
+    CHECK(RunModulePass(module.get(),
+                        CreateLowerRemillMemoryAccessIntrinsics()));
+
+    const auto func = module->getFunction("copy_word");
+    REQUIRE(func != nullptr);
+    CHECK(CountIntToPtrs(func) == 2u);
+    CHECK(module->getFunction("__remill_read_memory_32")->use_empty());
+    CHECK(module->getFunction("__remill_write_memory_32")->use_empty());
+  }
+
+  TEST_CASE("Typed lowering falls back on inttoptr without an entity") {
+    llvm::LLVMContext llvm_context;
+    auto module =
+        LoadTestData(llvm_context, "LowerRemillMemoryAccessIntrinsics.ll");
+
+    auto arch = remill::Arch::Build(&llvm_context, remill::GetOSName("linux"),
+                                    remill::GetArchName("amd64"));
+    REQUIRE(arch != nullptr);
+
+    anvill::LifterOptions options(arch.get(), *module.get(), nullptr);
+
+    // memory and types will not get used and create lifter with null
+    anvill::EntityLifter lifter(options, nullptr, nullptr);
+
+    CHECK(RunModulePass(module.get(),
+                        CreateLowerRemillMemoryAccessIntrinsics(lifter)));
+
+    const auto func = module->getFunction("copy_word");
+    REQUIRE(func != nullptr);
+    CHECK(CountIntToPtrs(func) == 2u);
+    CHECK(module->getFunction("__remill_read_memory_32")->use_empty());
+    CHECK(module->getFunction("__remill_write_memory_32")->use_empty());
+  }
+}
+
+}  // namespace anvill
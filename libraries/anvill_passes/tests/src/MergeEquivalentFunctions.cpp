@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <anvill/Lifters/EntityLifter.h>
+#include <anvill/Lifters/Options.h>
+#include <anvill/Transforms.h>
+#include <doctest.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+#include <remill/Arch/Arch.h>
+#include <remill/Arch/Name.h>
+#include <remill/OS/OS.h>
+
+#include "Utils.h"
+
+namespace anvill {
+
+TEST_SUITE("MergeEquivalentFunctions") {
+  TEST_CASE("Functions that only differ in annotations are merged") {
+    llvm::LLVMContext llvm_context;
+    auto module = LoadTestData(llvm_context, "MergeEquivalentFunctions.ll");
+
+    auto arch = remill::Arch::Build(&llvm_context, remill::GetOSName("linux"),
+                                    remill::GetArchName("amd64"));
+    REQUIRE(arch != nullptr);
+
+    anvill::LifterOptions options(arch.get(), *module.get(), nullptr);
+
+    // memory and types will not get used and create lifter with null
+    anvill::EntityLifter lifter(options, nullptr, nullptr);
+
+    auto sub_1000 = module->getFunction("sub_1000");
+    auto sub_1010 = module->getFunction("sub_1010");
+    auto sub_1020 = module->getFunction("sub_1020");
+    auto not_lifted = module->getFunction("not_lifted");
+    REQUIRE(sub_1000);
+    REQUIRE(sub_1010);
+    REQUIRE(sub_1020);
+    REQUIRE(not_lifted);
+
+    lifter.AddEntity(sub_1000, 0x1000u);
+    lifter.AddEntity(sub_1010, 0x1010u);
+    lifter.AddEntity(sub_1020, 0x1020u);
+
+    CHECK(MergeEquivalentFunctions(*module, lifter) == 1u);
+    CHECK(VerifyModule(module.get()));
+
+    // The function at the lower address keeps its body, even though it comes
+    // later in the module.
+    CHECK(sub_1000->getInstructionCount() == 4u);
+    CHECK(sub_1020->getInstructionCount() == 4u);
+    CHECK(not_lifted->getInstructionCount() == 4u);
+
+    REQUIRE(sub_1010->getInstructionCount() == 2u);
+    auto call =
+        llvm::dyn_cast<llvm::CallInst>(&sub_1010->getEntryBlock().front());
+    REQUIRE(call);
+    CHECK(call->getCalledFunction() == sub_1000);
+    CHECK(lifter.AddressOfEntity(sub_1010) == 0x1010u);
+  }
+}
+
+}  // namespace anvill
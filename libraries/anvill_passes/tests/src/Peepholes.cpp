@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <anvill/Transforms.h>
+#include <doctest.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instructions.h>
+
+#include "Utils.h"
+
+namespace anvill {
+
+// Returns the number of instructions in `func` with the opcode `opcode`.
+static unsigned CountOpcode(llvm::Function *func, unsigned opcode) {
+  auto count = 0u;
+  for (auto &inst : llvm::instructions(func)) {
+    if (inst.getOpcode() == opcode) {
+      ++count;
+    }
+  }
+  return count;
+}
+
+TEST_SUITE("Peepholes") {
+  TEST_CASE("All rules run together to a fixpoint") {
+    llvm::LLVMContext llvm_context;
+    auto module = LoadTestData(llvm_context, "Peepholes.ll");
+    REQUIRE(module != nullptr);
+
+    CHECK(RunFunctionPass(module.get(), CreatePeepholes()));
+
+    // A chain of trivial PHIs and selects folds down to the one value that
+    // they all pass along, and the dead user of the chain goes away.
+    auto trivial = module->getFunction("trivial_phis_and_selects");
+    REQUIRE(trivial != nullptr);
+    CHECK(CountOpcode(trivial, llvm::Instruction::PHI) == 0u);
+    CHECK(CountOpcode(trivial, llvm::Instruction::Select) == 0u);
+    CHECK(CountOpcode(trivial, llvm::Instruction::Add) == 0u);
+
+    // The negation of a comparison is folded into the comparison, with the
+    // branches and selects on the comparison inverted to match.
+    auto xor_to_cmp = module->getFunction("xor_to_cmp");
+    REQUIRE(xor_to_cmp != nullptr);
+    CHECK(CountOpcode(xor_to_cmp, llvm::Instruction::Xor) == 0u);
+    for (auto &inst : llvm::instructions(xor_to_cmp)) {
+      if (auto cmp = llvm::dyn_cast<llvm::ICmpInst>(&inst)) {
+        CHECK(cmp->getPredicate() == llvm::CmpInst::ICMP_NE);
+      } else if (auto br = llvm::dyn_cast<llvm::BranchInst>(&inst)) {
+        CHECK(br->getSuccessor(0)->getName() == "not_taken");
+      } else if (auto sel = llvm::dyn_cast<llvm::SelectInst>(&inst)) {
+        CHECK(sel->getTrueValue() == xor_to_cmp->getArg(2));
+      }
+    }
+
+    // The comparison can't be inverted if it's also used as a value.
+    auto xor_kept = module->getFunction("xor_kept");
+    REQUIRE(xor_kept != nullptr);
+    CHECK(CountOpcode(xor_kept, llvm::Instruction::Xor) == 1u);
+
+    // Only the unused classification call is removed.
+    auto fp = module->getFunction("unused_fp_classification");
+    REQUIRE(fp != nullptr);
+    CHECK(CountOpcode(fp, llvm::Instruction::Call) == 1u);
+  }
+}
+
+}  // namespace anvill
@@ -20,6 +20,7 @@
 #include <anvill/ABI.h>
 #include <anvill/Transforms.h>
 #include <doctest.h>
+#include <llvm/IR/IntrinsicInst.h>
 #include <llvm/IR/Verifier.h>
 #include <remill/Arch/Arch.h>
 #include <remill/Arch/Name.h>
@@ -28,6 +29,7 @@
 #include <array>
 #include <sstream>
 
+#include "SplitStackFrameAtReturnAddress.h"
 #include "Utils.h"
 
 namespace anvill {
@@ -39,7 +41,8 @@ TEST_SUITE("RecoverStackFrameInformation") {
             StackFrameStructureInitializationProcedure::kNone,
             StackFrameStructureInitializationProcedure::kZeroes,
             StackFrameStructureInitializationProcedure::kUndef,
-            StackFrameStructureInitializationProcedure::kSymbolic};
+            StackFrameStructureInitializationProcedure::kSymbolic,
+            StackFrameStructureInitializationProcedure::kSymbolicBlob};
 
     static const std::size_t kTestPaddingSettings[] = {0, 32, 64};
 
@@ -173,9 +176,8 @@ TEST_SUITE("RecoverStackFrameInformation") {
           auto stack_frame_type = stack_frame_type_res.TakeValue();
           REQUIRE(stack_frame_type->getNumElements() == 1U);
 
-          auto function_name = function.getName().str();
           auto expected_frame_type_name =
-              function_name + kStackFrameTypeNameSuffix;
+              SplitStackFrameAtReturnAddress::GetStackFrameTypeName(44U);
           REQUIRE(stack_frame_type->getName().str() ==
                   expected_frame_type_name);
 
@@ -193,6 +195,13 @@ TEST_SUITE("RecoverStackFrameInformation") {
           auto data_layout = module->getDataLayout();
           auto frame_type_size = data_layout.getTypeAllocSize(stack_frame_type);
           CHECK(frame_type_size == 44U);
+
+          // Stack frames of the same size share their type.
+          auto other_frame_type_res =
+              RecoverStackFrameInformation::GenerateStackFrameType(
+                  function, stack_frame_analysis, 0);
+          REQUIRE(other_frame_type_res.Succeeded());
+          CHECK(other_frame_type_res.TakeValue() == stack_frame_type);
         }
       }
 
@@ -213,9 +222,8 @@ TEST_SUITE("RecoverStackFrameInformation") {
           auto stack_frame_type = stack_frame_type_res.TakeValue();
           REQUIRE(stack_frame_type->getNumElements() == 1U);
 
-          auto function_name = function.getName().str();
           auto expected_frame_type_name =
-              function_name + kStackFrameTypeNameSuffix;
+              SplitStackFrameAtReturnAddress::GetStackFrameTypeName(172U);
           REQUIRE(stack_frame_type->getName().str() ==
                   expected_frame_type_name);
 
@@ -314,6 +322,89 @@ TEST_SUITE("RecoverStackFrameInformation") {
           CHECK(second_stack_frame_analysis.instruction_uses.empty());
         }
       }
+
+      WHEN("recovering the stack frame with a symbolic blob") {
+        auto stack_frame_analysis_res =
+            RecoverStackFrameInformation::AnalyzeStackFrame(function);
+
+        REQUIRE(stack_frame_analysis_res.Succeeded());
+
+        auto stack_frame_analysis = stack_frame_analysis_res.TakeValue();
+        auto update_res = RecoverStackFrameInformation::UpdateFunction(
+            function, stack_frame_analysis,
+            StackFrameStructureInitializationProcedure::kSymbolicBlob);
+        REQUIRE(update_res.Succeeded());
+
+        THEN("the stack frame is initialized with a single copy") {
+
+          // The stack frame spans `__anvill_sp - 28` to `__anvill_sp + 16`,
+          // so it fits into a 64 byte blob centered on `__anvill_sp`.
+          auto module = function.getParent();
+          auto blob = module->getGlobalVariable(
+              kSymbolicStackFrameValuePrefix + "blob_64");
+          REQUIRE(blob != nullptr);
+
+          std::size_t memcpy_count{0U};
+          for (const auto &instr : function.getEntryBlock()) {
+            if (llvm::isa<llvm::MemCpyInst>(instr)) {
+              ++memcpy_count;
+            }
+          }
+
+          CHECK(memcpy_count == 1U);
+          CHECK(!llvm::verifyFunction(function, &llvm::errs()));
+        }
+      }
+
+      WHEN("recovering the stack frame split at the return address") {
+        auto stack_frame_analysis_res =
+            RecoverStackFrameInformation::AnalyzeStackFrame(function);
+
+        REQUIRE(stack_frame_analysis_res.Succeeded());
+
+        // The return address is stored at `__anvill_sp`, which is 28 bytes
+        // into the stack frame.
+        auto stack_frame_analysis = stack_frame_analysis_res.TakeValue();
+        REQUIRE(stack_frame_analysis.return_address_offsets.size() == 1U);
+        CHECK(stack_frame_analysis.return_address_offsets.front() == 0);
+
+        auto update_res = RecoverStackFrameInformation::UpdateFunction(
+            function, stack_frame_analysis,
+            StackFrameStructureInitializationProcedure::kZeroes, 0U, 0U,
+            true);
+        REQUIRE(update_res.Succeeded());
+
+        THEN("the stack frame is allocated in parts around the return address") {
+          auto module = function.getParent();
+          auto data_layout = module->getDataLayout();
+
+          std::vector<std::uint64_t> part_sizes;
+          for (const auto &instr : function.getEntryBlock()) {
+            if (auto alloca_inst = llvm::dyn_cast<llvm::AllocaInst>(&instr)) {
+              part_sizes.push_back(data_layout.getTypeAllocSize(
+                  alloca_inst->getAllocatedType()));
+            }
+          }
+
+          const std::vector<std::uint64_t> expected_part_sizes = {28U, 4U, 12U};
+          CHECK(part_sizes == expected_part_sizes);
+
+          // The type of the whole stack frame is never created, so there is
+          // nothing left for `SplitStackFrameAtReturnAddress` to do.
+          CHECK(RecoverStackFrameInformation::getTypeByName(
+                    *module,
+                    SplitStackFrameAtReturnAddress::GetStackFrameTypeName(
+                        44U)) == nullptr);
+          CHECK(!SplitStackFrameAtReturnAddress::GetFunctionStackFrameType(
+                     function)
+                     .Succeeded());
+
+          stack_frame_analysis_res =
+              RecoverStackFrameInformation::AnalyzeStackFrame(function);
+          REQUIRE(stack_frame_analysis_res.Succeeded());
+          CHECK(stack_frame_analysis_res.TakeValue().instruction_uses.empty());
+        }
+      }
     }
   }
 }
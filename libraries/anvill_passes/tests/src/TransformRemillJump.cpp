@@ -134,4 +134,30 @@ TEST_SUITE("TransformRemillJump_ARM32_1") {
   }
 }
 
+TEST_SUITE("CleanUpRemillIntrinsics") {
+  TEST_CASE("Run the fused pass on function having _remill_jump as tail call") {
+    llvm::LLVMContext llvm_context;
+    auto module = LoadTestData(llvm_context, "TransformRemillJumpData0.ll");
+
+    auto arch = remill::Arch::Build(&llvm_context, remill::GetOSName("linux"),
+                                    remill::GetArchName("amd64"));
+    REQUIRE(arch != nullptr);
+
+    anvill::LifterOptions options(arch.get(), *module.get(), nullptr);
+
+    // memory and types will not get used and create lifter with null
+    anvill::EntityLifter lifter(options, nullptr, nullptr);
+
+    CHECK(RunModulePass(module.get(), CreateCleanUpRemillIntrinsics(lifter)));
+
+    // The jump to the return address is removed outright, rather than being
+    // turned into a `__remill_function_return`.
+    const auto ret_func = module->getFunction("__remill_function_return");
+    const auto jmp_func = module->getFunction("__remill_jump");
+
+    REQUIRE((!ret_func || ret_func->use_empty()));
+    REQUIRE((!jmp_func || jmp_func->use_empty()));
+  }
+}
+
 }  // namespace anvill
@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <anvill/ITransformationErrorManager.h>
+#include <doctest.h>
+
+#include <thread>
+#include <vector>
+
+namespace anvill {
+
+namespace {
+
+// Remembers every error written to it.
+class TestErrorSink final : public ITransformationErrorSink {
+ public:
+  explicit TestErrorSink(std::vector<TransformationError> &errors_)
+      : errors(errors_) {}
+
+  void Write(const TransformationError &error) override {
+    errors.push_back(error);
+  }
+
+ private:
+  std::vector<TransformationError> &errors;
+};
+
+static TransformationError MakeError(SeverityType severity) {
+  TransformationError error;
+  error.pass_name = "TestPass";
+  error.severity = severity;
+  error.func_after = "define void @f() { ret void }";
+  return error;
+}
+
+}  // namespace
+
+TEST_SUITE("TransformationErrorManager") {
+  TEST_CASE("Only the most recent errors are retained") {
+    std::vector<TransformationError> written;
+    auto error_manager = ITransformationErrorManager::Create(
+        IRSnapshotPolicy::OnError,
+        std::make_unique<TestErrorSink>(written), 2u);
+
+    for (auto i = 0; i < 3; ++i) {
+      error_manager->Insert(MakeError(SeverityType::Warning));
+    }
+
+    CHECK(written.size() == 3u);
+    CHECK(error_manager->ErrorList().size() == 2u);
+    CHECK(error_manager->NumDroppedErrors() == 1u);
+    CHECK(!error_manager->HasFatalError());
+  }
+
+  TEST_CASE("Fatal errors are always retained") {
+    auto error_manager = ITransformationErrorManager::Create(
+        IRSnapshotPolicy::OnError, nullptr, 2u);
+
+    error_manager->Insert(MakeError(SeverityType::Fatal));
+    for (auto i = 0; i < 3; ++i) {
+      error_manager->Insert(MakeError(SeverityType::Warning));
+    }
+
+    const auto &errors = error_manager->ErrorList();
+    REQUIRE(errors.size() == 2u);
+    CHECK(errors[0].severity == SeverityType::Fatal);
+    CHECK(errors[1].severity == SeverityType::Warning);
+    CHECK(error_manager->NumDroppedErrors() == 2u);
+
+    // When every retained error is fatal, new fatal errors are still kept,
+    // but other errors are dropped.
+    error_manager->Insert(MakeError(SeverityType::Fatal));
+    error_manager->Insert(MakeError(SeverityType::Warning));
+    CHECK(errors.size() == 2u);
+    error_manager->Insert(MakeError(SeverityType::Fatal));
+    CHECK(errors.size() == 3u);
+    CHECK(errors[2].severity == SeverityType::Fatal);
+    CHECK(error_manager->NumDroppedErrors() == 4u);
+
+    auto no_retained = ITransformationErrorManager::Create(
+        IRSnapshotPolicy::OnError, nullptr, 0u);
+    no_retained->Insert(MakeError(SeverityType::Warning));
+    no_retained->Insert(MakeError(SeverityType::Fatal));
+    REQUIRE(no_retained->ErrorList().size() == 1u);
+    CHECK(no_retained->ErrorList()[0].severity == SeverityType::Fatal);
+    CHECK(no_retained->NumDroppedErrors() == 1u);
+  }
+
+  TEST_CASE("Retained errors refer to IR by hash") {
+    std::vector<TransformationError> written;
+    auto error_manager = ITransformationErrorManager::Create(
+        IRSnapshotPolicy::OnError, std::make_unique<TestErrorSink>(written));
+
+    error_manager->Insert(MakeError(SeverityType::Error));
+    error_manager->Insert(MakeError(SeverityType::Fatal));
+
+    REQUIRE(written.size() == 2u);
+    CHECK(written[0].func_after.has_value());
+    REQUIRE(written[0].func_after_hash.has_value());
+    CHECK(written[0].func_after_hash == written[1].func_after_hash);
+
+    const auto &errors = error_manager->ErrorList();
+    REQUIRE(errors.size() == 2u);
+    CHECK(!errors[0].func_after.has_value());
+    CHECK(errors[0].func_after_hash == written[0].func_after_hash);
+
+    // Fatal errors keep their IR, so that it can be reported.
+    CHECK(errors[1].func_after.has_value());
+    CHECK(error_manager->HasFatalError());
+  }
+
+  TEST_CASE("Errors can be inserted from many threads") {
+    std::vector<TransformationError> written;
+    auto error_manager = ITransformationErrorManager::Create(
+        IRSnapshotPolicy::OnError,
+        std::make_unique<TestErrorSink>(written), 1000u);
+
+    std::vector<std::thread> threads;
+    for (auto i = 0; i < 4; ++i) {
+      threads.emplace_back([&, i](void) {
+        for (auto j = 0; j < 100; ++j) {
+          error_manager->Insert(MakeError(
+              i == 3 && j == 50 ? SeverityType::Fatal : SeverityType::Warning));
+        }
+      });
+    }
+
+    for (auto &thread : threads) {
+      thread.join();
+    }
+
+    CHECK(written.size() == 400u);
+    CHECK(error_manager->ErrorList().size() == 400u);
+    CHECK(error_manager->NumDroppedErrors() == 0u);
+    CHECK(error_manager->HasFatalError());
+    for (const auto &error : written) {
+      CHECK(error.func_after.has_value());
+    }
+  }
+}
+
+}  // namespace anvill
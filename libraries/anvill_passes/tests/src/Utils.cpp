@@ -95,6 +95,13 @@ bool RunFunctionPass(llvm::Module *module, llvm::FunctionPass *function_pass) {
   return VerifyModule(module);
 }
 
+bool RunModulePass(llvm::Module *module, llvm::ModulePass *module_pass) {
+  llvm::legacy::PassManager pass_manager;
+  pass_manager.add(module_pass);
+  pass_manager.run(*module);
+  return VerifyModule(module);
+}
+
 const PlatformList &GetSupportedPlatforms(void) {
   static const PlatformList kSupportedPlatforms = {{"linux", "amd64"}};
 
@@ -29,6 +29,8 @@ std::unique_ptr<llvm::Module> LoadTestData(llvm::LLVMContext &context,
 
 bool RunFunctionPass(llvm::Module *module, llvm::FunctionPass *function_pass);
 
+bool RunModulePass(llvm::Module *module, llvm::ModulePass *module_pass);
+
 struct Platform final {
   std::string os;
   std::string arch;
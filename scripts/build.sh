@@ -375,6 +375,10 @@ function Help
   echo "  --build-dir        Change the default (${BUILD_DIR}) build directory."
   echo "  --debug            Build with Debug symbols."
   echo "  --extra-cmake-args Extra CMake arguments to build with."
+  echo "  --thinlto          Build with ThinLTO."
+  echo "  --lto              Build with full link-time optimization."
+  echo "  --pgo-generate     Instrument the build to collect a PGO profile (see scripts/collect-pgo-profile.sh)."
+  echo "  --pgo-profile      Path to a merged '.profdata' profile with which to apply PGO."
   echo "  --install          Just install Rellic, do not package it."
   echo "  -h --help          Print help."
 }
@@ -444,6 +448,30 @@ function main
         shift
       ;;
 
+      # Link-time optimization.
+      --thinlto)
+        BUILD_FLAGS="${BUILD_FLAGS} -DANVILL_ENABLE_LTO=ON -DANVILL_LTO_MODE=thin"
+        echo "[+] Enabling ThinLTO"
+      ;;
+
+      --lto)
+        BUILD_FLAGS="${BUILD_FLAGS} -DANVILL_ENABLE_LTO=ON -DANVILL_LTO_MODE=full"
+        echo "[+] Enabling full link-time optimization"
+      ;;
+
+      # Profile-guided optimization.
+      --pgo-generate)
+        BUILD_FLAGS="${BUILD_FLAGS} -DANVILL_PGO_GENERATE=ON"
+        echo "[+] Instrumenting the build for PGO profile collection"
+      ;;
+
+      --pgo-profile)
+        PGO_PROFILE=$(python3 -c "import os; import sys; sys.stdout.write(os.path.abspath('${2}'))")
+        BUILD_FLAGS="${BUILD_FLAGS} -DANVILL_PGO_PROFILE=${PGO_PROFILE}"
+        echo "[+] Applying the PGO profile ${PGO_PROFILE}"
+        shift
+      ;;
+
       *)
         # unknown option
         echo "[x] Unknown option: ${key}"
@@ -0,0 +1,166 @@
+#!/bin/bash
+DIR=$( cd "$( dirname "${BASH_SOURCE[0]}" )" && pwd )
+SRC_DIR=$( cd "$( dirname "${DIR}" )" && pwd )
+
+ANVILL_PYTHON="python3 -m anvill"
+ANVILL_DECOMPILE="anvill-decompile-json-11.0"
+PROFDATA="llvm-profdata-11"
+OUTPUT="$(pwd)/anvill.profdata"
+WORK_DIR="$(pwd)/pgo-profile"
+
+function Help
+{
+  echo "Collect a profile for a profile-guided optimization (PGO) build of Anvill"
+  echo ""
+  echo "The profile is collected by running an instrumented anvill-decompile-json,"
+  echo "i.e. one built with -DANVILL_PGO_GENERATE=ON (or scripts/build.sh --pgo-generate),"
+  echo "over AnghaBench-1K and, if TOB_AMP_PASSPHRASE is set, the AMP challenge"
+  echo "binaries. The merged profile can then be given to a release build with"
+  echo "-DANVILL_PGO_PROFILE=<output> (or scripts/build.sh --pgo-profile <output>)."
+  echo ""
+  echo "Options:"
+  echo "  --python-cmd <cmd>        The anvill Python command to invoke. Default ${ANVILL_PYTHON}"
+  echo "  --decompile-cmd <cmd>     The instrumented anvill decompile command to invoke. Default ${ANVILL_DECOMPILE}"
+  echo "  --profdata-cmd <cmd>      The llvm-profdata command to merge profiles with. Default ${PROFDATA}"
+  echo "  --work-dir <dir>          Where to put binaries, results, and raw profiles. Default ${WORK_DIR}"
+  echo "  --output <file>           Where to save the merged profile. Default ${OUTPUT}"
+  echo "  -h --help                 Print help."
+}
+
+# Run anvill over the binaries in `${1}`, recording profiles for `${2}`. Failures
+# to lift are fine; it's the profiles that matter.
+function profile_dir
+{
+    local input_dir=${1}
+    local name=${2}
+    local settings=${3}
+
+    echo "[+] Profiling ${name}"
+    LLVM_PROFILE_FILE="${WORK_DIR}/raw/anvill-%p-%m.profraw" \
+        ${SRC_DIR}/libraries/lifting-tools-ci/tool_run_scripts/anvill.py \
+        --anvill-python "${ANVILL_PYTHON}" \
+        --anvill-decompile "${ANVILL_DECOMPILE}" \
+        --input-dir "${input_dir}" \
+        --output-dir "${WORK_DIR}/results/${name}" \
+        --run-name "anvill-pgo-${name}" \
+        --test-options "${settings}" \
+        || echo "[!] Some of ${name} didn't lift; keeping its profiles anyway"
+}
+
+set -euo pipefail
+
+while [[ $# -gt 0 ]] ; do
+    key="$1"
+
+    case $key in
+
+        -h)
+            Help
+            exit 0
+        ;;
+
+        --help)
+            Help
+            exit 0
+        ;;
+
+        --python-cmd)
+            ANVILL_PYTHON=${2}
+            shift # past argument
+        ;;
+
+        --decompile-cmd)
+            ANVILL_DECOMPILE=${2}
+            shift # past argument
+        ;;
+
+        --profdata-cmd)
+            PROFDATA=${2}
+            shift # past argument
+        ;;
+
+        --work-dir)
+            WORK_DIR=$(python3 -c "import os; import sys; sys.stdout.write(os.path.abspath('${2}'))")
+            shift # past argument
+        ;;
+
+        --output)
+            OUTPUT=$(python3 -c "import os; import sys; sys.stdout.write(os.path.abspath('${2}'))")
+            shift # past argument
+        ;;
+
+        *)
+            # unknown option
+            echo "[x] Unknown option: ${key}"
+            exit 1
+        ;;
+    esac
+
+    shift # past argument or value
+done
+
+if ! ${ANVILL_PYTHON} --help &>/dev/null;
+then
+    echo "[!] Could not execute anvill python cmd: ${ANVILL_PYTHON}"
+    exit 1
+fi
+
+if ! ${ANVILL_DECOMPILE} --version &>/dev/null;
+then
+    echo "[!] Could not execute anvill decompile cmd: ${ANVILL_DECOMPILE}"
+    exit 1
+fi
+
+if ! ${PROFDATA} --version &>/dev/null;
+then
+    echo "[!] Could not execute llvm-profdata cmd: ${PROFDATA}"
+    exit 1
+fi
+
+# Start from scratch, so that stale profiles don't end up in the merge.
+rm -rf "${WORK_DIR}/raw" "${WORK_DIR}/results"
+mkdir -p "${WORK_DIR}/raw"
+pushd "${WORK_DIR}"
+
+# AnghaBench-1K: 1K binaries per architecture.
+mkdir -p angha-1k
+pushd angha-1k
+${SRC_DIR}/libraries/lifting-tools-ci/datasets/fetch_anghabench.sh --run-size 1k --binaries
+for tarfile in *.tar.xz
+do
+    tar -xJf ${tarfile}
+done
+for arch in $(ls -1 binaries/)
+do
+    profile_dir "$(pwd)/binaries/${arch}" "angha-1k-${arch}" \
+        "${SRC_DIR}/ci/angha_1k_test_settings.json"
+done
+popd
+
+# AMP challenge binaries, if we can decrypt them.
+if [[ -n "${TOB_AMP_PASSPHRASE:-}" ]]
+then
+    mkdir -p amp-challenge-bins
+    pushd amp-challenge-bins
+    TOB_AMP_PASSPHRASE=${TOB_AMP_PASSPHRASE} ${SRC_DIR}/libraries/lifting-tools-ci/datasets/fetch_amp_challengebins.sh
+    for tarfile in *.tar.xz
+    do
+        tar -xJf ${tarfile}
+    done
+    profile_dir "$(pwd)/challenge-binaries" "amp-challenge-bins" \
+        "${SRC_DIR}/ci/challenge_bins_test_settings.json"
+    popd
+else
+    echo "[!] TOB_AMP_PASSPHRASE is not set; skipping the AMP challenge binaries"
+fi
+
+popd
+
+if ! ls "${WORK_DIR}"/raw/*.profraw &>/dev/null;
+then
+    echo "[x] No profiles were written; is ${ANVILL_DECOMPILE} an instrumented build?"
+    exit 1
+fi
+
+${PROFDATA} merge -o "${OUTPUT}" "${WORK_DIR}"/raw/*.profraw
+echo "[+] Saved the merged profile to ${OUTPUT}"
@@ -0,0 +1,65 @@
+#!/usr/bin/env bash
+
+#
+# Copyright (c) 2021-present, Trail of Bits, Inc.
+# All rights reserved.
+#
+# This source code is licensed in accordance with the terms specified in
+# the LICENSE file found in the root directory of this source tree.
+#
+
+# Runs one long-lived anvill-decompile-json process, so that architectures
+# and instruction semantics are loaded once and then reused by every spec.
+#
+# Which specs get decompiled depends on the environment:
+#
+#   ANVILL_BATCH_PORT        Listen on this TCP port. Every line sent to the
+#                            port is a line of the batch (see --batch).
+#   ANVILL_QUEUE_DIR         Lift partitions claimed from this queue made by
+#                            anvill-lift-coordinator (see --queue_dir).
+#
+# Otherwise, the batch is read from stdin. Any arguments are passed on to
+# anvill-decompile-json, e.g. `--batch_out_dir`.
+#
+#   ANVILL_JOBS              Number of worker threads. Defaults to the
+#                            number of CPUs.
+#   ANVILL_PRELOAD_SEMANTICS Targets whose semantics are loaded up-front
+#                            (see --preload_semantics).
+
+set -euo pipefail
+
+DECOMPILE="anvill-decompile-json-${LLVM_VERSION_NUM}.0"
+JOBS="${ANVILL_JOBS:-$(nproc)}"
+PRELOAD="${ANVILL_PRELOAD_SEMANTICS:-amd64:linux,x86:linux,aarch64:linux,sparc32:linux,sparc64:linux}"
+
+if [[ -n "${ANVILL_QUEUE_DIR:-}" ]]; then
+  exec "${DECOMPILE}" \
+    --queue_dir "${ANVILL_QUEUE_DIR}" \
+    --preload_semantics "${PRELOAD}" \
+    "$@"
+fi
+
+if [[ -n "${ANVILL_BATCH_PORT:-}" ]]; then
+  FIFO_DIR="$(mktemp -d)"
+  FIFO="${FIFO_DIR}/batch"
+  mkfifo "${FIFO}"
+
+  # Hold the FIFO open for writing, so that the batch doesn't end when the
+  # last client disconnects. The decompiler inherits this descriptor.
+  exec 3<>"${FIFO}"
+
+  socat -u "TCP-LISTEN:${ANVILL_BATCH_PORT},reuseaddr,fork" \
+    "OPEN:${FIFO},wronly,append" &
+
+  exec "${DECOMPILE}" \
+    --batch - \
+    --jobs "${JOBS}" \
+    --preload_semantics "${PRELOAD}" \
+    "$@" <"${FIFO}"
+fi
+
+exec "${DECOMPILE}" \
+  --batch - \
+  --jobs "${JOBS}" \
+  --preload_semantics "${PRELOAD}" \
+  "$@"
@@ -0,0 +1,251 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Allocator.h"
+
+#include <gflags/gflags.h>
+#ifdef __GLIBC__
+#  include <malloc.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+DEFINE_bool(release_memory, true,
+            "Return freed memory to the operating system whenever an LLVM "
+            "context is thrown away, i.e. after the shards of a spec are "
+            "linked together, and when a --batch or --queue_dir worker "
+            "replaces its context. This keeps the resident memory of "
+            "long-running workers from creeping up due to fragmentation.");
+
+static thread_local uint64_t gNumAllocations = 0u;
+
+uint64_t CountAllocations(void) {
+  return gNumAllocations;
+}
+
+const char *const kMemoryCategoryNames[kNumMemoryCategories] = {
+    "other", "parse", "semantics", "lift", "optimize", "output"};
+
+static thread_local MemoryCategory gMemoryCategory = kMemoryOther;
+
+// Live bytes of each category. Threads add into different stripes so that
+// allocating on many threads at once doesn't contend on one cache line; the
+// live bytes of a category are the sum over all stripes.
+static constexpr unsigned kNumMemoryStripes = 16u;
+
+struct alignas(64) MemoryStripe {
+  std::atomic<int64_t> live_bytes[kNumMemoryCategories];
+};
+
+static MemoryStripe gMemoryStripes[kNumMemoryStripes] = {};
+static std::atomic<unsigned> gNextMemoryStripe{0u};
+static thread_local MemoryStripe &gMemoryStripe =
+    gMemoryStripes[gNextMemoryStripe++ % kNumMemoryStripes];
+
+uint64_t LiveBytes(MemoryCategory category) {
+  int64_t live_bytes = 0;
+  for (const auto &stripe : gMemoryStripes) {
+    live_bytes += stripe.live_bytes[category].load(std::memory_order_relaxed);
+  }
+  return live_bytes > 0 ? static_cast<uint64_t>(live_bytes) : 0u;
+}
+
+MemoryScope::MemoryScope(MemoryCategory category)
+    : prev_category(gMemoryCategory) {
+  gMemoryCategory = category;
+}
+
+MemoryScope::~MemoryScope(void) {
+  gMemoryCategory = prev_category;
+}
+
+#ifdef ANVILL_ENABLE_ALLOCATION_ACCOUNTING
+
+// Precedes every allocation made by `operator new`, so that `operator delete`
+// knows how much to take away from which category, and where the underlying
+// allocation starts.
+struct alignas(16) AllocationHeader {
+  uint64_t size;
+  uint32_t offset;
+  MemoryCategory category;
+};
+
+static_assert(sizeof(AllocationHeader) == 16u);
+
+static void *Allocate(std::size_t size, std::size_t align) noexcept {
+  size = size ? size : 1u;
+  const auto offset = std::max(align, sizeof(AllocationHeader));
+
+  void *base = nullptr;
+  if (align <= alignof(std::max_align_t)) {
+    base = std::malloc(size + offset);
+  } else if (posix_memalign(&base, align, size + offset)) {
+    base = nullptr;
+  }
+  if (!base) {
+    return nullptr;
+  }
+
+  const auto ptr = static_cast<char *>(base) + offset;
+  const auto header = reinterpret_cast<AllocationHeader *>(ptr) - 1;
+  header->size = size;
+  header->offset = static_cast<uint32_t>(offset);
+  header->category = gMemoryCategory;
+  gMemoryStripe.live_bytes[header->category].fetch_add(
+      static_cast<int64_t>(size), std::memory_order_relaxed);
+  ++gNumAllocations;
+  return ptr;
+}
+
+static void Deallocate(void *ptr) noexcept {
+  if (!ptr) {
+    return;
+  }
+  const auto header = reinterpret_cast<AllocationHeader *>(ptr) - 1;
+  gMemoryStripe.live_bytes[header->category].fetch_sub(
+      static_cast<int64_t>(header->size), std::memory_order_relaxed);
+  std::free(static_cast<char *>(ptr) - header->offset);
+}
+
+static void *AllocateOrThrow(std::size_t size, std::size_t align) {
+  if (auto ptr = Allocate(size, align)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+// Every allocation carries an `AllocationHeader`, so every form of `operator
+// new` and `operator delete` is replaced, lest a default one mismatch with a
+// replaced one.
+void *operator new(std::size_t size) {
+  return AllocateOrThrow(size, alignof(std::max_align_t));
+}
+
+void *operator new[](std::size_t size) {
+  return AllocateOrThrow(size, alignof(std::max_align_t));
+}
+
+void *operator new(std::size_t size, std::align_val_t align) {
+  return AllocateOrThrow(size, static_cast<std::size_t>(align));
+}
+
+void *operator new[](std::size_t size, std::align_val_t align) {
+  return AllocateOrThrow(size, static_cast<std::size_t>(align));
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+  return Allocate(size, alignof(std::max_align_t));
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+  return Allocate(size, alignof(std::max_align_t));
+}
+
+void *operator new(std::size_t size, std::align_val_t align,
+                   const std::nothrow_t &) noexcept {
+  return Allocate(size, static_cast<std::size_t>(align));
+}
+
+void *operator new[](std::size_t size, std::align_val_t align,
+                     const std::nothrow_t &) noexcept {
+  return Allocate(size, static_cast<std::size_t>(align));
+}
+
+void operator delete(void *ptr) noexcept {
+  Deallocate(ptr);
+}
+
+void operator delete[](void *ptr) noexcept {
+  Deallocate(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept {
+  Deallocate(ptr);
+}
+
+void operator delete[](void *ptr, std::size_t) noexcept {
+  Deallocate(ptr);
+}
+
+void operator delete(void *ptr, std::align_val_t) noexcept {
+  Deallocate(ptr);
+}
+
+void operator delete[](void *ptr, std::align_val_t) noexcept {
+  Deallocate(ptr);
+}
+
+void operator delete(void *ptr, std::size_t, std::align_val_t) noexcept {
+  Deallocate(ptr);
+}
+
+void operator delete[](void *ptr, std::size_t, std::align_val_t) noexcept {
+  Deallocate(ptr);
+}
+
+void operator delete(void *ptr, const std::nothrow_t &) noexcept {
+  Deallocate(ptr);
+}
+
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept {
+  Deallocate(ptr);
+}
+
+void operator delete(void *ptr, std::align_val_t,
+                     const std::nothrow_t &) noexcept {
+  Deallocate(ptr);
+}
+
+void operator delete[](void *ptr, std::align_val_t,
+                       const std::nothrow_t &) noexcept {
+  Deallocate(ptr);
+}
+
+#endif  // ANVILL_ENABLE_ALLOCATION_ACCOUNTING
+
+// Entry points of allocators that can be linked in with
+// `ANVILL_MALLOC_LIBRARY`, for `ReleaseFreeMemory`.
+extern "C" int mallctl(const char *, void *, std::size_t *, void *,
+                       std::size_t) __attribute__((weak));
+extern "C" void mi_collect(bool) __attribute__((weak));
+
+// Return the memory freed so far to the operating system, using whichever
+// allocator is linked in.
+void ReleaseFreeMemory(void) {
+  if (!FLAGS_release_memory) {
+    return;
+  }
+
+  // jemalloc: purge the unused dirty pages of all arenas.
+  if (mallctl) {
+    mallctl("arena.4096.purge", nullptr, nullptr, nullptr, 0u);
+
+  // mimalloc: collect and release the free pages of the calling thread's
+  // heap. Other threads' heaps are only collected by those threads.
+  } else if (mi_collect) {
+    mi_collect(true);
+
+  } else {
+#ifdef __GLIBC__
+    malloc_trim(0u);
+#endif
+  }
+}
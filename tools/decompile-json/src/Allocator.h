@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+// Number of allocations made by the current thread, for `--trace_out`. This,
+// like the live bytes of each memory category, is only counted when built
+// with `ANVILL_ENABLE_ALLOCATION_ACCOUNTING`, and is otherwise zero.
+uint64_t CountAllocations(void);
+
+// What the heap memory allocated by a thread is for, for `--stats_out`.
+// Allocations are attributed to the category of the thread that made them for
+// as long as they live, even if they're freed by some other thread.
+enum MemoryCategory : uint8_t {
+  kMemoryOther,
+  kMemoryParse,
+  kMemorySemantics,
+  kMemoryLift,
+  kMemoryOptimize,
+  kMemoryOutput,
+  kNumMemoryCategories
+};
+
+extern const char *const kMemoryCategoryNames[kNumMemoryCategories];
+
+// Returns the number of live bytes allocated in `category`.
+uint64_t LiveBytes(MemoryCategory category);
+
+// Attributes the allocations of the current thread to a category, until
+// destroyed.
+class MemoryScope {
+ public:
+  explicit MemoryScope(MemoryCategory category);
+  ~MemoryScope(void);
+
+ private:
+  MemoryScope(const MemoryScope &) = delete;
+  MemoryScope &operator=(const MemoryScope &) = delete;
+
+  const MemoryCategory prev_category;
+};
+
+// Return the memory freed so far to the operating system, using whichever
+// allocator is linked in.
+void ReleaseFreeMemory(void);
@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Batch.h"
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/Path.h>
+#include <remill/BC/Compat/Error.h>
+
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Decompile.h"
+#include "Stats.h"
+
+DEFINE_string(batch, "",
+              "Path to a list of specifications to decompile, one per line, "
+              "or '-' to read the list from stdin. Each line is either the "
+              "path to a specification, or a JSON object with a 'spec' path "
+              "and optional 'ir_out' and 'bc_out' paths. The specifications "
+              "are decompiled by --jobs threads, which reuse architectures "
+              "and instruction semantics across specifications.");
+
+DEFINE_string(batch_out_dir, ".",
+              "Directory to which the bitcode of each specification in "
+              "--batch is saved, as '<spec name>.bc', when its line doesn't "
+              "say where to save its code.");
+
+DECLARE_string(ir_out);
+DECLARE_string(bc_out);
+DECLARE_string(split_out_dir);
+DECLARE_string(entity_map_out);
+DECLARE_string(binary_spec_out);
+
+// Parse one line of a batch into `job`. A line is either the path to a spec,
+// or a JSON object with a `spec` path and optional `ir_out` and `bc_out`
+// paths. Jobs that don't say where to save their code save their bitcode to
+// `--batch_out_dir`.
+static bool ParseBatchLine(llvm::StringRef line, SpecJob &job) {
+  job = SpecJob();
+
+  if (line.startswith("{")) {
+    auto maybe_json = llvm::json::parse(line);
+    if (remill::IsError(maybe_json)) {
+      LOG(ERROR) << "Unable to parse batch line '" << line.str()
+                 << "': " << remill::GetErrorString(maybe_json);
+      return false;
+    }
+
+    auto &json = remill::GetReference(maybe_json);
+    const auto obj = json.getAsObject();
+    const auto maybe_spec = obj ? obj->getString("spec") : llvm::None;
+    if (!maybe_spec) {
+      LOG(ERROR) << "Batch line '" << line.str()
+                 << "' must be an object with a 'spec' path.";
+      return false;
+    }
+
+    job.spec = maybe_spec->str();
+    if (auto maybe_ir_out = obj->getString("ir_out")) {
+      job.ir_out = maybe_ir_out->str();
+    }
+    if (auto maybe_bc_out = obj->getString("bc_out")) {
+      job.bc_out = maybe_bc_out->str();
+    }
+
+  } else {
+    job.spec = line.str();
+  }
+
+  if (job.ir_out.empty() && job.bc_out.empty()) {
+    llvm::SmallString<128> bc_out(FLAGS_batch_out_dir);
+    llvm::sys::path::append(bc_out, llvm::sys::path::stem(job.spec) + ".bc");
+    job.bc_out = bc_out.str().str();
+  }
+
+  return true;
+}
+
+// Decompile every spec listed in the batch in `is` using `num_workers`
+// threads. Returns the number of specs that failed to decompile.
+unsigned DecompileBatch(std::istream &is,
+                        const anvill::OptimizationPipeline &pipeline,
+                        anvill::Tracer *tracer, RunStats *stats,
+                        const anvill::FunctionCache *cache,
+                        unsigned num_workers) {
+  std::mutex batch_lock;
+  unsigned num_specs = 0u;
+  unsigned num_failed = 0u;
+  std::vector<std::thread> workers;
+  workers.reserve(num_workers);
+
+  // Workers read the batch one line at a time, rather than it being read
+  // up-front, so that a batch can be streamed in.
+  for (auto i = 0u; i < num_workers; ++i) {
+    workers.emplace_back([&](void) {
+      DecompileWorker worker;
+      std::string line;
+      SpecJob job;
+      for (;;) {
+        {
+          std::lock_guard<std::mutex> locker(batch_lock);
+          if (!std::getline(is, line)) {
+            return;
+          }
+        }
+
+        const auto trimmed = llvm::StringRef(line).trim();
+        if (trimmed.empty()) {
+          continue;
+        }
+
+        auto ok = ParseBatchLine(trimmed, job) &&
+                  DecompileSpec(job, pipeline, tracer, stats, cache, nullptr,
+                                worker, 1u);
+        LOG_IF(ERROR, !ok) << "Failed to decompile spec '" << trimmed.str()
+                           << "'";
+
+        if (stats) {
+          ++stats->num_specs;
+          stats->num_failed_specs += ok ? 0u : 1u;
+        }
+
+        std::lock_guard<std::mutex> locker(batch_lock);
+        ++num_specs;
+        num_failed += ok ? 0u : 1u;
+      }
+    });
+  }
+
+  for (auto &worker : workers) {
+    worker.join();
+  }
+
+  LOG(INFO) << "Decompiled " << (num_specs - num_failed) << " of "
+            << num_specs << " specs in the batch.";
+  return num_failed;
+}
+
+// Returns `false`, after logging why, if options that don't apply to
+// `--batch` are given with it.
+bool CheckBatchFlags(void) {
+  if (!FLAGS_batch.empty() &&
+      (!FLAGS_binary_spec_out.empty() || !FLAGS_ir_out.empty() ||
+       !FLAGS_bc_out.empty() || !FLAGS_split_out_dir.empty() ||
+       !FLAGS_entity_map_out.empty())) {
+    LOG(ERROR) << "The --binary_spec_out, --ir_out, --bc_out, "
+               << "--split_out_dir, and --entity_map_out options don't apply "
+               << "to --batch; each line of the batch says where to save its "
+               << "code.";
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <istream>
+
+namespace anvill {
+class FunctionCache;
+class OptimizationPipeline;
+class Tracer;
+}  // namespace anvill
+
+struct RunStats;
+
+// Decompile every spec listed in the batch in `is` using `num_workers`
+// threads. Returns the number of specs that failed to decompile.
+unsigned DecompileBatch(std::istream &is,
+                        const anvill::OptimizationPipeline &pipeline,
+                        anvill::Tracer *tracer, RunStats *stats,
+                        const anvill::FunctionCache *cache,
+                        unsigned num_workers);
+
+// Returns `false`, after logging why, if options that don't apply to
+// `--batch` are given with it.
+bool CheckBatchFlags(void);
@@ -0,0 +1,456 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Decompile.h"
+
+#include <anvill/FunctionCache.h>
+#include <anvill/Lifters/EntityLifter.h>
+#include <anvill/Lifters/Options.h>
+#include <anvill/Optimize.h>
+#include <anvill/Program.h>
+#include <anvill/Providers/IControlFlowProvider.h>
+#include <anvill/Providers/MemoryProvider.h>
+#include <anvill/Providers/TypeProvider.h>
+#include <anvill/Trace.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IRReader/IRReader.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/SourceMgr.h>
+#include <llvm/Support/raw_ostream.h>
+#include <remill/BC/Compat/Error.h>
+#include <remill/BC/Util.h>
+
+#include <iostream>
+#include <magic_enum.hpp>
+#include <optional>
+#include <unordered_set>
+
+#include "Allocator.h"
+#include "Lift.h"
+#include "Shards.h"
+#include "Spec.h"
+#include "Stats.h"
+#include "Writers.h"
+
+DEFINE_string(reoptimize_bc, "",
+              "Path to bitcode that was saved by an earlier run with "
+              "--bc_out. Rather than lifting a spec, run the optimization "
+              "pipeline over this bitcode again, using the entities in "
+              "--entity_map, and save the result like lifted code.");
+
+DEFINE_string(entity_map, "",
+              "Path to the JSON file saved by --entity_map_out alongside the "
+              "bitcode in --reoptimize_bc.");
+
+DEFINE_bool(verify_determinism, false,
+            "Lift the spec both in one go and as shards, as with --jobs, and "
+            "fail unless both produce the same bitcode. The shards are the "
+            "same as without this option, or twice --shards_per_job shards "
+            "if --jobs is one.");
+
+DECLARE_string(arch);
+DECLARE_string(os);
+DECLARE_string(binary_spec_out);
+DECLARE_string(snapshot_out);
+DECLARE_string(checkpoint_dir);
+DECLARE_uint32(evict_batch_size);
+DECLARE_uint32(jobs);
+DECLARE_string(spec);
+DECLARE_string(function_cache_dir);
+DECLARE_string(batch);
+DECLARE_string(roots);
+DECLARE_string(manifest);
+DECLARE_string(queue_dir);
+DECLARE_string(serve);
+
+// Maximum number of differing functions and variables that are reported when
+// `--verify_determinism` finds that lifts differ.
+static constexpr unsigned kMaxReportedDifferences = 8u;
+
+// Returns the printed IR of `gv`.
+static std::string PrintGlobal(const llvm::GlobalValue &gv) {
+  std::string ir;
+  llvm::raw_string_ostream os(ir);
+  gv.print(os);
+  os.flush();
+  return ir;
+}
+
+// Log the first few functions and variables that differ between `expected`
+// and `actual`, or that are in a different place in their modules.
+static void ReportDifferences(llvm::Module &expected, llvm::Module &actual) {
+  auto num_reported = 0u;
+  auto compare_lists = [&](const char *what, auto &expected_list,
+                           auto &actual_list) {
+    auto expected_it = expected_list.begin();
+    auto actual_it = actual_list.begin();
+    for (auto i = 0u; num_reported < kMaxReportedDifferences; ++i) {
+      const auto expected_end = expected_it == expected_list.end();
+      const auto actual_end = actual_it == actual_list.end();
+      if (expected_end && actual_end) {
+        return;
+
+      } else if (expected_end || actual_end ||
+                 expected_it->getName() != actual_it->getName()) {
+        LOG(ERROR) << "The " << what << " at index " << i << " is '"
+                   << (expected_end ? "" : expected_it->getName().str())
+                   << "' when lifted in one go, but '"
+                   << (actual_end ? "" : actual_it->getName().str())
+                   << "' when lifted as shards";
+        ++num_reported;
+        return;
+
+      } else if (PrintGlobal(*expected_it) != PrintGlobal(*actual_it)) {
+        LOG(ERROR) << "The " << what << " '" << expected_it->getName().str()
+                   << "' differs between lifting in one go and as shards";
+        ++num_reported;
+      }
+
+      ++expected_it;
+      ++actual_it;
+    }
+  };
+
+  compare_lists("variable", expected.getGlobalList(), actual.getGlobalList());
+  compare_lists("function", expected.getFunctionList(),
+                actual.getFunctionList());
+  compare_lists("alias", expected.getAliasList(), actual.getAliasList());
+
+  LOG_IF(ERROR, !num_reported)
+      << "The functions and variables lifted in one go and as shards are the "
+      << "same, so their types or metadata differ";
+}
+
+// Lift the spec again, in one go and on a context of its own, and check that
+// the bitcode of the result is the same as that of `module`, which was lifted
+// as shards. Both modules are cleaned up the way they are when they're saved.
+static bool VerifyDeterminism(const SpecParser &parse_spec,
+                              llvm::StringRef spec_text,
+                              const std::string &arch_str,
+                              const std::string &os_str,
+                              const anvill::OptimizationPipeline &pipeline,
+                              const anvill::FunctionCache *cache,
+                              llvm::Module &module, unsigned num_shards) {
+  ANVILL_TRACE_ZONE("VerifyDeterminism");
+
+  // The reference lift isn't traced or counted in the run stats, so that they
+  // still describe one lift of the spec.
+  llvm::LLVMContext context;
+  llvm::Module expected("lifted_code", context);
+  auto arch = BuildArch(context, arch_str, os_str);
+  if (!arch || !LiftSpec(parse_spec, spec_text, arch.get(), pipeline, nullptr,
+                         nullptr, cache, nullptr, expected, 0u, 1u, nullptr)) {
+    LOG(ERROR) << "Unable to lift the spec in one go to compare with "
+               << "lifting it as " << num_shards << " shards";
+    return false;
+  }
+
+  CleanUpLiftedModule(expected, true);
+  CleanUpLiftedModule(module, true);
+
+  llvm::SmallVector<char, 0> expected_bitcode;
+  llvm::SmallVector<char, 0> actual_bitcode;
+  llvm::raw_svector_ostream expected_os(expected_bitcode);
+  llvm::raw_svector_ostream actual_os(actual_bitcode);
+  llvm::WriteBitcodeToFile(expected, expected_os);
+  llvm::WriteBitcodeToFile(module, actual_os);
+
+  if (expected_bitcode == actual_bitcode) {
+    LOG(INFO) << "Lifting as " << num_shards << " shards produced the same "
+              << "bitcode as lifting in one go";
+    return true;
+  }
+
+  LOG(ERROR) << "Lifting as " << num_shards << " shards produced different "
+             << "bitcode than lifting in one go";
+  ReportDifferences(expected, module);
+  return false;
+}
+
+// Decompile the spec of `job`. If `num_shards` is one and the lift isn't being
+// checkpointed, then the spec is lifted on the context of `worker`, using its
+// architectures. Otherwise, the spec is lifted as `num_shards` shards by up to
+// `--jobs` threads, each shard on its own context, and linked on a context of
+// its own.
+bool DecompileSpec(const SpecJob &job,
+                   const anvill::OptimizationPipeline &pipeline,
+                   anvill::Tracer *tracer, RunStats *stats,
+                   const anvill::FunctionCache *cache,
+                   IncrementalManifest *manifest, DecompileWorker &worker,
+                   unsigned num_shards) {
+  ActiveJobScope active_job(stats);
+
+  // The declarations of the spec are parsed into the program while lifting, and
+  // that is timed as part of parsing too.
+  std::optional<PhaseTimer> parse_timer;
+  parse_timer.emplace(stats, kPhaseParse);
+
+  LoadedSpec spec;
+  if (!LoadSpec(job.spec, spec)) {
+    return false;
+  }
+
+  if (!FLAGS_binary_spec_out.empty()) {
+    return ConvertSpec(spec.json.getAsObject(), spec.arch_str, spec.os_str,
+                       spec.image ? &*spec.image : nullptr,
+                       FLAGS_binary_spec_out);
+  }
+
+  if (!FLAGS_snapshot_out.empty()) {
+    return SnapshotSpec(spec, FLAGS_snapshot_out);
+  }
+
+  const auto &arch_str = spec.arch_str;
+  const auto &os_str = spec.os_str;
+  const auto &parse_spec = spec.parse_spec;
+
+  parse_timer.reset();
+
+  if (!worker.context ||
+      worker.num_specs >= DecompileWorker::kMaxSpecsPerContext) {
+    const auto had_context = !!worker.context;
+    worker.archs.clear();
+    worker.context.reset();
+    if (had_context) {
+      ReleaseFreeMemory();
+    }
+    worker.context.reset(new llvm::LLVMContext);
+    worker.num_specs = 0u;
+  }
+  ++worker.num_specs;
+
+  // Types are named in their context, and the types of the specs that the
+  // worker lifted before would make the linker rename the types of the shards,
+  // so a lift linked from shards gets a fresh context.
+  const auto is_sharded = 1u != num_shards || !FLAGS_checkpoint_dir.empty();
+  std::unique_ptr<llvm::LLVMContext> linked_context;
+  if (is_sharded) {
+    linked_context.reset(new llvm::LLVMContext);
+  }
+
+  llvm::Module module("lifted_code",
+                      is_sharded ? *linked_context : *worker.context);
+
+  // `globals.bc` is always taken by the split module holding the variables.
+  std::unordered_set<std::string> evicted_file_names;
+  const auto evict = !!FLAGS_evict_batch_size;
+  if (evict) {
+    evicted_file_names.insert("globals.bc");
+  }
+
+  std::string checkpoint_key;
+  if (!FLAGS_checkpoint_dir.empty() &&
+      !CheckpointKey(job.spec, spec, pipeline, checkpoint_key)) {
+    return false;
+  }
+
+  const auto spec_text = spec.Text();
+  if (!is_sharded) {
+    auto &arch = worker.archs[{arch_str, os_str}];
+    if (!arch) {
+      arch = BuildArch(*worker.context, arch_str, os_str);
+    }
+    if (!arch || !LiftSpec(parse_spec, spec_text, arch.get(), pipeline, tracer,
+                           stats, cache, manifest, module, 0u, 1u,
+                           evict ? &evicted_file_names : nullptr)) {
+      return false;
+    }
+  } else if (!LiftSpecInParallel(parse_spec, spec_text, arch_str, os_str,
+                                 pipeline, tracer, stats, cache, manifest,
+                                 FLAGS_checkpoint_dir, checkpoint_key, module,
+                                 num_shards, FLAGS_jobs)) {
+    return false;
+
+  // The contexts of the shards are gone now that they're linked together.
+  } else {
+    ReleaseFreeMemory();
+  }
+
+  if (FLAGS_verify_determinism && is_sharded &&
+      !VerifyDeterminism(parse_spec, spec_text, arch_str, os_str, pipeline,
+                         cache, module, num_shards)) {
+    return false;
+  }
+
+  return SaveLiftedModule(module, job, arch_str, os_str, stats,
+                          evicted_file_names);
+}
+
+// Run the optimization pipeline over the lifted code in `--reoptimize_bc`
+// again, and save the result where `job` says to. The spec that the code was
+// lifted from isn't needed: `--entity_map` says which functions and variables
+// are the entities at which addresses, which is what the passes that need an
+// `anvill::EntityLifter` look at. The program is otherwise empty, so passes
+// can't discover entities that weren't in the entity map.
+bool ReoptimizeBitcode(const SpecJob &job,
+                       const anvill::OptimizationPipeline &pipeline,
+                       anvill::Tracer *tracer, RunStats *stats) {
+  std::optional<PhaseTimer> parse_timer;
+  parse_timer.emplace(stats, kPhaseParse);
+
+  auto maybe_buff = llvm::MemoryBuffer::getFile(FLAGS_entity_map);
+  if (remill::IsError(maybe_buff)) {
+    LOG(ERROR) << "Unable to read entity map file '" << FLAGS_entity_map
+               << "': " << remill::GetErrorString(maybe_buff);
+    return false;
+  }
+
+  auto maybe_json =
+      llvm::json::parse(remill::GetReference(maybe_buff)->getBuffer());
+  if (remill::IsError(maybe_json)) {
+    LOG(ERROR) << "Unable to parse entity map file '" << FLAGS_entity_map
+               << "': " << remill::GetErrorString(maybe_json);
+    return false;
+  }
+
+  auto &json = remill::GetReference(maybe_json);
+  const auto entity_map = json.getAsObject();
+  const auto entities =
+      entity_map ? entity_map->getArray("entities") : nullptr;
+  if (!entities) {
+    LOG(ERROR) << "Entity map file '" << FLAGS_entity_map
+               << "' must contain an object with an 'entities' array.";
+    return false;
+  }
+
+  auto arch_str = FLAGS_arch;
+  auto os_str = FLAGS_os;
+  if (auto maybe_arch = entity_map->getString("arch")) {
+    arch_str = maybe_arch->str();
+  }
+  if (auto maybe_os = entity_map->getString("os")) {
+    os_str = maybe_os->str();
+  }
+
+  llvm::LLVMContext context;
+  llvm::SMDiagnostic diag;
+  auto module = llvm::parseIRFile(FLAGS_reoptimize_bc, diag, context);
+  if (!module) {
+    LOG(ERROR) << "Unable to load bitcode file '" << FLAGS_reoptimize_bc
+               << "': " << diag.getMessage().str();
+    return false;
+  }
+
+  auto arch = BuildArch(context, arch_str, os_str);
+  if (!arch) {
+    return false;
+  }
+
+  anvill::Program program;
+  auto memory = anvill::MemoryProvider::CreateProgramMemoryProvider(program);
+  auto types =
+      anvill::TypeProvider::CreateProgramTypeProvider(context, program);
+
+  auto ctrl_flow_provider_res = anvill::IControlFlowProvider::Create(program);
+  if (!ctrl_flow_provider_res.Succeeded()) {
+    auto error = ctrl_flow_provider_res.TakeError();
+
+    std::cerr << "Failed to create the control flow provider: "
+              << magic_enum::enum_name(error) << "\n";
+
+    return false;
+  }
+
+  anvill::LifterOptions options(arch.get(), *module,
+                                ctrl_flow_provider_res.TakeValue());
+  ConfigureLifterOptions(options, tracer);
+  anvill::EntityLifter lifter(options, memory, types);
+
+  auto num_missing = 0u;
+  for (const auto &entity : *entities) {
+    const auto obj = entity.getAsObject();
+    const auto maybe_name = obj ? obj->getString("name") : llvm::None;
+    const auto maybe_addr = obj ? obj->getInteger("address") : llvm::None;
+    if (!maybe_name || !maybe_addr) {
+      LOG(ERROR) << "Entity map file '" << FLAGS_entity_map
+                 << "' has an entity without a 'name' and an 'address'.";
+      return false;
+    }
+
+    auto gv = module->getNamedValue(*maybe_name);
+    if (!gv) {
+      ++num_missing;
+      continue;
+    }
+
+    const auto addr = static_cast<uint64_t>(*maybe_addr);
+    lifter.AddEntity(gv, addr);
+    RecordEntity(*module, gv, addr);
+  }
+
+  LOG_IF(WARNING, num_missing)
+      << num_missing << " entities in '" << FLAGS_entity_map
+      << "' aren't in '" << FLAGS_reoptimize_bc << "'";
+
+  parse_timer.reset();
+
+  if (stats) {
+    stats->instructions_before_opt += CountInstructions(*module);
+  }
+  {
+    PhaseTimer timer(stats, kPhaseOptimize);
+    if (!anvill::OptimizeModule(lifter, arch.get(), program, *module,
+                                options, pipeline)) {
+      return false;
+    }
+  }
+  if (stats) {
+    stats->instructions_after_opt += CountInstructions(*module);
+  }
+
+  return SaveLiftedModule(*module, job, arch_str, os_str, stats, {});
+}
+
+// Returns `false`, after logging why, if `--reoptimize_bc`,
+// `--entity_map`, or `--verify_determinism` are given without the options
+// they need, or with options that don't apply to them.
+bool CheckDecompileFlags(void) {
+  if (FLAGS_reoptimize_bc.empty() != FLAGS_entity_map.empty()) {
+    LOG(ERROR) << "The --reoptimize_bc and --entity_map options must be "
+               << "used together.";
+    return false;
+  }
+
+  if (!FLAGS_reoptimize_bc.empty() &&
+      (!FLAGS_binary_spec_out.empty() || !FLAGS_checkpoint_dir.empty() ||
+       !FLAGS_function_cache_dir.empty())) {
+    LOG(ERROR) << "The --binary_spec_out, --checkpoint_dir, and "
+               << "--function_cache_dir options don't apply to "
+               << "--reoptimize_bc.";
+    return false;
+  }
+
+  if (FLAGS_verify_determinism &&
+      (FLAGS_spec.empty() || !FLAGS_batch.empty() || !FLAGS_serve.empty() ||
+       !FLAGS_queue_dir.empty() || !FLAGS_reoptimize_bc.empty() ||
+       !FLAGS_binary_spec_out.empty() || !FLAGS_snapshot_out.empty() ||
+       !FLAGS_roots.empty() || !FLAGS_manifest.empty() ||
+       FLAGS_evict_batch_size)) {
+    LOG(ERROR) << "The --verify_determinism option needs --spec, and doesn't "
+               << "apply to --batch, --serve, --queue_dir, --reoptimize_bc, "
+               << "--binary_spec_out, --snapshot_out, --roots, --manifest, or "
+               << "--evict_batch_size.";
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <llvm/IR/LLVMContext.h>
+#include <remill/Arch/Arch.h>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+
+namespace anvill {
+class FunctionCache;
+class OptimizationPipeline;
+class Tracer;
+}  // namespace anvill
+
+class IncrementalManifest;
+struct RunStats;
+
+// Where to find a spec, and where to save the code decompiled from it.
+struct SpecJob {
+  std::string spec;
+  std::string ir_out;
+  std::string bc_out;
+};
+
+// State that a thread reuses across the specs that it decompiles. A
+// `remill::Arch` is bound to an `llvm::LLVMContext`, so reusing architectures
+// means reusing their context too.
+struct DecompileWorker {
+
+  // A context uniques every type and constant that is ever made in it, so
+  // it's replaced after this many specs to bound its growth.
+  static constexpr unsigned kMaxSpecsPerContext = 64u;
+
+  std::unique_ptr<llvm::LLVMContext> context;
+
+  // Declared after `context` so that they're destroyed first.
+  std::map<std::pair<std::string, std::string>,
+           std::unique_ptr<const remill::Arch>>
+      archs;
+
+  unsigned num_specs{0u};
+};
+
+// Decompile the spec of `job`. If `num_shards` is one and the lift isn't being
+// checkpointed, then the spec is lifted on the context of `worker`, using its
+// architectures. Otherwise, the spec is lifted as `num_shards` shards by up to
+// `--jobs` threads, each shard on its own context, and linked on a context of
+// its own.
+bool DecompileSpec(const SpecJob &job,
+                   const anvill::OptimizationPipeline &pipeline,
+                   anvill::Tracer *tracer, RunStats *stats,
+                   const anvill::FunctionCache *cache,
+                   IncrementalManifest *manifest, DecompileWorker &worker,
+                   unsigned num_shards);
+
+// Run the optimization pipeline over the lifted code in `--reoptimize_bc`
+// again, and save the result where `job` says to. The spec that the code was
+// lifted from isn't needed: `--entity_map` says which functions and variables
+// are the entities at which addresses, which is what the passes that need an
+// `anvill::EntityLifter` look at. The program is otherwise empty, so passes
+// can't discover entities that weren't in the entity map.
+bool ReoptimizeBitcode(const SpecJob &job,
+                       const anvill::OptimizationPipeline &pipeline,
+                       anvill::Tracer *tracer, RunStats *stats);
+
+// Returns `false`, after logging why, if `--reoptimize_bc`,
+// `--entity_map`, or `--verify_determinism` are given without the options
+// they need, or with options that don't apply to them.
+bool CheckDecompileFlags(void);
@@ -0,0 +1,1009 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Lift.h"
+
+#include <anvill/CompressedFunctions.h>
+#include <anvill/Decl.h>
+#include <anvill/DuplicateFunctions.h>
+#include <anvill/FunctionCache.h>
+#include <anvill/JumpTables.h>
+#include <anvill/Lifters/EntityLifter.h>
+#include <anvill/Lifters/Options.h>
+#include <anvill/Optimize.h>
+#include <anvill/Program.h>
+#include <anvill/Providers/IControlFlowProvider.h>
+#include <anvill/Providers/MemoryProvider.h>
+#include <anvill/Providers/TypeProvider.h>
+#include <anvill/Trace.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/InstrTypes.h>
+#include <llvm/IR/Metadata.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <remill/Arch/Arch.h>
+#include <remill/Arch/Name.h>
+#include <remill/BC/Compat/Error.h>
+#include <remill/BC/Util.h>
+#include <remill/OS/OS.h>
+
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <magic_enum.hpp>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+
+#include "Allocator.h"
+#include "Manifest.h"
+#include "Shards.h"
+#include "Stats.h"
+#include "Writers.h"
+
+DEFINE_uint32(evict_batch_size, 0u,
+              "Lift and optimize the functions of a spec in batches of this "
+              "many functions, and save each optimized function into "
+              "--split_out_dir and free its body before lifting the next "
+              "batch. This bounds the memory used by function bodies by the "
+              "size of a batch, rather than by the size of the binary, but "
+              "functions are only optimized together with the functions of "
+              "their own batch. Zero keeps every function until output.");
+
+DEFINE_bool(compress_idle_functions, false,
+            "Keep lifted functions as compressed bitcode in memory from when "
+            "they're lifted until the module is optimized, rather than as "
+            "LLVM IR. This lowers the memory used while lifting the "
+            "functions of a big spec into one module, at the cost of "
+            "serializing and decompressing each function once. Functions "
+            "that refer to anything with local linkage stay as IR. This "
+            "doesn't apply to --roots or --evict_batch_size.");
+
+DEFINE_bool(add_breakpoints, false,
+            "Add breakpoint_XXXXXXXX functions to the "
+            "lifted bitcode.");
+
+DEFINE_bool(compact_breakpoints, false,
+            "With --add_breakpoints, have every lifted instruction call one "
+            "breakpoint function, passing it the instruction's address, "
+            "instead of adding a breakpoint_XXXXXXXX function per "
+            "instruction.");
+
+DEFINE_bool(discard_value_names, false,
+            "Don't name basic blocks and instructions in the lifted bitcode. "
+            "This makes lifting and optimization faster, but the bitcode "
+            "harder to read.");
+
+DEFINE_uint32(max_inlined_semantics_size, 0u,
+              "Leave instruction semantics functions with more than this many "
+              "instructions as out-of-line calls in the lifted bitcode, "
+              "rather than inlining them. Zero means always inline them.");
+
+DEFINE_uint32(max_function_instructions, 0u,
+              "Maximum number of machine instructions to lift in any one "
+              "function. The rest of a function that goes over this is "
+              "replaced with calls to __remill_error. A value of zero means "
+              "no limit.");
+
+DEFINE_uint32(max_function_blocks, 0u,
+              "Maximum number of basic blocks to lift in any one function, "
+              "with the same fallback as --max_function_instructions. A "
+              "value of zero means no limit.");
+
+DEFINE_uint32(max_function_lift_ms, 0u,
+              "Maximum number of milliseconds to spend lifting any one "
+              "function, with the same fallback as "
+              "--max_function_instructions. A value of zero means no limit.");
+
+DEFINE_uint32(max_function_ir_size, 0u,
+              "Maximum number of LLVM instructions that any one function can "
+              "have after being lifted or while being optimized. Functions "
+              "that go over this are left as declarations. A value of zero "
+              "means no limit.");
+
+DEFINE_uint32(max_function_optimize_ms, 0u,
+              "Maximum number of milliseconds to spend on any one function in "
+              "one run of the optimization passes. Functions that go over "
+              "this are left as declarations. A value of zero means no "
+              "limit.");
+
+DEFINE_bool(instruction_templates, false,
+            "Lift instructions that have the same semantics, size, and "
+            "operands as an earlier instruction in the same function by "
+            "copying the code lifted for that instruction.");
+
+DEFINE_bool(read_register_init, false,
+            "Initialize the registers of each lifted function's State "
+            "structure with llvm.read_register, rather than from "
+            "__anvill_reg_* global variables.");
+
+DEFINE_bool(live_registers_only, false,
+            "Only initialize the registers of each lifted function's State "
+            "structure that its lifted code may read, rather than all of "
+            "them.");
+
+DEFINE_bool(zero_vector_state, true,
+            "Zero the vector and floating point registers of each lifted "
+            "function's State structure, along with the rest of it.");
+
+DEFINE_bool(lift_thunks_as_tail_calls, false,
+            "Lift functions that only jump to another function with the same "
+            "prototype, e.g. PLT entries, as tail calls to that function, "
+            "rather than by lifting their instructions.");
+
+DEFINE_bool(registers_on_demand, false,
+            "Start each lifted function with only the variables of Remill's "
+            "__remill_basic_block that aren't registers, computing the "
+            "addresses of registers as they're used, rather than cloning all "
+            "of __remill_basic_block into each lifted function.");
+
+DEFINE_bool(lazy_data_initializers, false,
+            "Only lift the initializers of variables that lifted functions, "
+            "or other lifted initializers, refer to. The other variables are "
+            "left as declarations.");
+
+DEFINE_bool(lower_memory_accesses_to_entities, false,
+            "Lower memory accesses whose addresses resolve to lifted "
+            "entities into loads and stores through typed pointers into "
+            "those entities, rather than through an inttoptr of the address.");
+
+DEFINE_bool(dedup_functions, false,
+            "Lift only one of each group of functions whose position-"
+            "independent code is byte-for-byte identical and that share a "
+            "prototype. The others are lifted as tail-calling thunks to it.");
+
+DEFINE_uint32(max_data_initializer_size, 0u,
+              "Maximum size, in bytes, of a variable whose initializer is "
+              "lifted. Bigger variables are left as declarations. A value "
+              "of zero means no limit.");
+
+DEFINE_uint32(decode_threads, 1u,
+              "Number of threads with which to decode the instructions of "
+              "big functions ahead of lifting them. A value of zero means "
+              "one thread per hardware thread.");
+
+DEFINE_bool(enable_provenance, false,
+            "Annotate lifted code with the addresses of the instructions "
+            "that it came from, and track the provenance of the values "
+            "written into registers in LLVM metadata.");
+
+DEFINE_string(roots, "",
+              "Comma-separated list of the addresses of the functions from "
+              "which to start lifting. Only these functions, and the "
+              "functions that they transitively call or take the address "
+              "of, are lifted, rather than every function in the spec.");
+
+DEFINE_uint32(max_root_depth, 0u,
+              "Maximum number of references to follow away from the "
+              "functions in --roots. Functions that are further away are "
+              "only declared. Zero means that there is no limit.");
+
+DEFINE_string(lift_functions, "",
+              "Path to a file listing the addresses of the functions to "
+              "lift, one per line. The other functions in the spec are only "
+              "declared, as the lifted code references them. This is how "
+              "anvill-lift-coordinator hands a partition of a spec to each "
+              "of its workers.");
+
+DEFINE_bool(lift_variables, true,
+            "Lift all of the variables in the spec. Otherwise, variables are "
+            "only declared, as the lifted code references them.");
+
+DEFINE_string(preload_semantics, "",
+              "Comma-separated list of 'arch:os' pairs, e.g. "
+              "'amd64:linux,aarch64:linux', whose instruction semantics are "
+              "loaded before anything is lifted. This is for long-running "
+              "--batch and --queue_dir workers, so that the first spec for "
+              "each target doesn't wait on loading semantics from disk.");
+
+DECLARE_string(pass_report_out);
+DECLARE_bool(trusted_spec);
+DECLARE_bool(speculate_jump_tables);
+DECLARE_string(split_out_dir);
+DECLARE_string(spec);
+DECLARE_string(ir_out);
+DECLARE_string(bc_out);
+DECLARE_string(reoptimize_bc);
+DECLARE_string(checkpoint_dir);
+DECLARE_string(function_cache_dir);
+
+// Build a remill architecture object on `context`. The architecture object
+// knows how to deal with everything for this specific architecture, such as
+// semantics, register,  etc.
+//
+// Building an architecture may initialize global decoder state (e.g. XED's
+// tables), so we serialize construction of the architectures of concurrent
+// shards and batch workers.
+std::unique_ptr<const remill::Arch>
+BuildArch(llvm::LLVMContext &context, const std::string &arch_str,
+          const std::string &os_str) {
+  static std::mutex gArchBuildLock;
+  std::lock_guard<std::mutex> locker(gArchBuildLock);
+  return remill::Arch::Build(&context, remill::GetOSName(os_str),
+                             remill::GetArchName(arch_str));
+}
+
+// Name of the named metadata in which lifted modules remember the addresses
+// of their entities until they're saved, so that the entities can be put in
+// order of their addresses, and saved into `--entity_map_out`. Metadata
+// follows its entities through linking, renaming, and checkpointing.
+const char *const kEntitiesMetadataName = "anvill.entities";
+
+// Remember that `gv` is the entity at `address` in `module`.
+void RecordEntity(llvm::Module &module, llvm::GlobalValue *gv,
+                  uint64_t address) {
+  auto &context = module.getContext();
+  llvm::Metadata *ops[] = {
+      llvm::ValueAsMetadata::get(gv),
+      llvm::ConstantAsMetadata::get(
+          llvm::ConstantInt::get(llvm::Type::getInt64Ty(context), address))};
+  module.getOrInsertNamedMetadata(kEntitiesMetadataName)
+      ->addOperand(llvm::MDTuple::get(context, ops));
+}
+
+// Set the lifter options that come from the command-line flags.
+void ConfigureLifterOptions(anvill::LifterOptions &options,
+                            anvill::Tracer *tracer) {
+  options.tracer = tracer;
+  options.record_pass_impact = !FLAGS_pass_report_out.empty();
+
+  if (FLAGS_add_breakpoints) {
+    options.add_breakpoints = true;
+  }
+
+  if (FLAGS_compact_breakpoints) {
+    options.compact_breakpoints = true;
+  }
+
+  if (FLAGS_discard_value_names) {
+    options.discard_value_names = true;
+  }
+
+  options.max_inlined_semantics_size = FLAGS_max_inlined_semantics_size;
+  options.max_lifted_instructions = FLAGS_max_function_instructions;
+  options.max_lifted_blocks = FLAGS_max_function_blocks;
+  options.max_lift_time_ms = FLAGS_max_function_lift_ms;
+  options.max_function_ir_size = FLAGS_max_function_ir_size;
+  options.max_optimize_time_ms = FLAGS_max_function_optimize_ms;
+  options.max_data_initializer_size = FLAGS_max_data_initializer_size;
+  options.num_decode_threads = FLAGS_decode_threads;
+
+  if (FLAGS_instruction_templates) {
+    options.lift_from_instruction_templates = true;
+  }
+
+  if (FLAGS_read_register_init) {
+    options.state_struct_init_procedure =
+        anvill::StateStructureInitializationProcedure::kReadRegister;
+  }
+
+  if (FLAGS_live_registers_only) {
+    options.initialize_only_live_registers = true;
+  }
+
+  if (!FLAGS_zero_vector_state) {
+    options.zero_vector_and_float_state = false;
+  }
+
+  if (FLAGS_lift_thunks_as_tail_calls) {
+    options.lift_thunks_as_tail_calls = true;
+  }
+
+  if (FLAGS_registers_on_demand) {
+    options.declare_registers_on_demand = true;
+  }
+
+  if (FLAGS_lazy_data_initializers) {
+    options.lazy_data_initializers = true;
+  }
+
+  if (FLAGS_lower_memory_accesses_to_entities) {
+    options.lower_memory_accesses_to_entities = true;
+  }
+
+  if (FLAGS_enable_provenance) {
+    options.pc_metadata_name = "pc";
+    options.track_provenance = true;
+  }
+}
+
+// Parse the addresses in `--roots` into `roots`.
+bool ParseRoots(std::vector<uint64_t> &roots) {
+  llvm::SmallVector<llvm::StringRef, 16> parts;
+  llvm::StringRef(FLAGS_roots).split(parts, ',', -1, false);
+  for (auto part : parts) {
+    uint64_t address = 0u;
+    if (part.trim().getAsInteger(0, address)) {
+      LOG(ERROR) << "Invalid function address '" << part.trim().str()
+                 << "' in --roots";
+      return false;
+    }
+    roots.push_back(address);
+  }
+  return true;
+}
+
+// Read the addresses of the functions in `--lift_functions` into
+// `addresses`.
+static bool ReadLiftFunctions(std::unordered_set<uint64_t> &addresses) {
+  auto maybe_buff = llvm::MemoryBuffer::getFile(FLAGS_lift_functions);
+  if (remill::IsError(maybe_buff)) {
+    LOG(ERROR) << "Unable to read function list '" << FLAGS_lift_functions
+               << "': " << remill::GetErrorString(maybe_buff);
+    return false;
+  }
+
+  llvm::SmallVector<llvm::StringRef, 16> lines;
+  remill::GetReference(maybe_buff)->getBuffer().split(lines, '\n', -1, false);
+  for (auto line : lines) {
+    uint64_t address = 0u;
+    if (line = line.trim(); line.empty()) {
+      continue;
+    } else if (line.getAsInteger(0, address)) {
+      LOG(ERROR) << "Invalid function address '" << line.str() << "' in '"
+                 << FLAGS_lift_functions << "'";
+      return false;
+    }
+    addresses.insert(address);
+  }
+  return true;
+}
+
+// Number of lifted functions that `--compress_idle_functions` compresses at
+// once.
+static constexpr unsigned kCompressBatchSize = 64u;
+
+// Returns the prototype hash of the function or variable at `address` in
+// `program`, or an empty string if there is neither. Cached functions are
+// only reused if the hashes of what they refer to are unchanged.
+std::string EntityPrototypeHash(const anvill::Program &program,
+                                const llvm::DataLayout &dl, uint64_t address) {
+  if (auto func_decl = program.FindFunction(address)) {
+    return anvill::FunctionCache::PrototypeHash(*func_decl, dl);
+  } else if (auto var_decl = program.FindVariable(address)) {
+    return anvill::FunctionCache::PrototypeHash(*var_decl, program, dl);
+  } else {
+    return std::string();
+  }
+}
+
+// Lift the subset of the spec's functions that belong to shard `shard_index`
+// (out of `num_shards`) into `module`, and then optimize and name them. `arch`
+// must be bound to the context of `module`. Each shard gets its own
+// `remill::Arch`, `anvill::Program`, and `anvill::EntityLifter`, all bound to
+// the context of `module`, so that shards can be lifted concurrently.
+// Functions that are called but not lifted by this shard are left as
+// declarations, and are resolved to their definitions when the shards are
+// linked back together.
+//
+// If `evicted_file_names` is non-null, then functions are lifted and
+// optimized in batches of `--evict_batch_size`, and each optimized function
+// of a batch is saved into `--split_out_dir` and left as a declaration. The
+// names of the saved modules are added to `evicted_file_names`. Otherwise,
+// with `--compress_idle_functions`, lifted functions are compressed until
+// they're optimized.
+bool LiftSpec(const SpecParser &parse_spec, llvm::StringRef spec_text,
+              const remill::Arch *arch,
+              const anvill::OptimizationPipeline &pipeline,
+              anvill::Tracer *tracer, RunStats *stats,
+              const anvill::FunctionCache *cache, IncrementalManifest *manifest,
+              llvm::Module &module, unsigned shard_index, unsigned num_shards,
+              std::unordered_set<std::string> *evicted_file_names) {
+  auto &context = module.getContext();
+  CHECK_EQ(arch->context, &context);
+
+  anvill::Program program;
+  auto memory = anvill::MemoryProvider::CreateProgramMemoryProvider(program);
+  auto types =
+      anvill::TypeProvider::CreateProgramTypeProvider(context, program);
+
+  auto ctrl_flow_provider_res = anvill::IControlFlowProvider::Create(program);
+  if (!ctrl_flow_provider_res.Succeeded()) {
+    auto error = ctrl_flow_provider_res.TakeError();
+
+    std::cerr << "Failed to create the control flow provider: "
+              << magic_enum::enum_name(error) << "\n";
+
+    return false;
+  }
+
+  anvill::LifterOptions options(arch, module,
+                                ctrl_flow_provider_res.TakeValue());
+
+  ConfigureLifterOptions(options, tracer);
+
+  // Whether or not a variable is referenced is only known when every function
+  // is lifted into the same module as the variables, so initializers are
+  // lifted eagerly when functions are split across shards or processes.
+  if (num_shards > 1 || !FLAGS_lift_functions.empty()) {
+    options.lazy_data_initializers = false;
+  }
+
+  // NOTE(pag): Unfortunately, we need to load the semantics module first,
+  //            which happens deep inside the `EntityLifter`. Only then does
+  //            Remill properly know about register information, which
+  //            subsequently allows it to parse value decls in specs :-(
+  anvill::EntityLifter lifter = [&](void) {
+    MemoryScope scope(kMemorySemantics);
+    return anvill::EntityLifter(options, memory, types);
+  }();
+
+  // Parse the spec, which contains as much or as little details about what is
+  // being lifted as the spec generator desired and put it into an
+  // anvill::Program object, which is effectively a representation of the spec
+  {
+    PhaseTimer timer(stats, kPhaseParse);
+    program.TrustDecls(FLAGS_trusted_spec);
+    if (!parse_spec(arch, context, program, module)) {
+      return false;
+    }
+
+    // Every shard finds the same jump tables, so only count them once.
+    if (FLAGS_speculate_jump_tables) {
+      const auto num_tables = anvill::SpeculateJumpTableTargets(program, arch);
+      if (stats && !shard_index) {
+        stats->num_jump_tables_speculated += num_tables;
+      }
+    }
+
+    // Nothing adds to the program after the spec is parsed, so freeze it.
+    // This also means that lookups into the program made while lifting are
+    // read-only. The entity lifter has already given the module its data
+    // layout, so variable extents can be indexed now too.
+    program.Freeze(module.getDataLayout());
+    if (stats) {
+      RecordProgramMemory(*stats, program);
+    }
+  }
+
+  // Used to record, and then to check, the prototypes of what functions in
+  // the function cache refer to.
+  auto address_of = [&](llvm::GlobalValue &gv) {
+    return lifter.AddressOfEntity(&gv);
+  };
+  auto prototype_of = [&](uint64_t address) {
+    return EntityPrototypeHash(program, module.getDataLayout(), address);
+  };
+
+  std::optional<PhaseTimer> lift_timer;
+  lift_timer.emplace(stats, kPhaseLift);
+
+  // When lifting from a set of roots, only the functions reachable from the
+  // roots are lifted, and variables are only declared as they're referenced.
+  std::vector<uint64_t> roots;
+  if (!FLAGS_roots.empty() && !ParseRoots(roots)) {
+    return false;
+  }
+
+  if (!roots.empty()) {
+    const auto lifted =
+        lifter.LiftReachableEntities(roots, FLAGS_max_root_depth);
+    if (stats) {
+      stats->num_functions_lifted += lifted.size();
+    }
+  }
+
+  // Only the functions listed in `--lift_functions` are lifted.
+  std::unordered_set<uint64_t> lift_only;
+  if (!FLAGS_lift_functions.empty() && !ReadLiftFunctions(lift_only)) {
+    return false;
+  }
+
+  // Variables are only lifted into the first shard; the other shards will
+  // only get declarations of the variables that their functions reference.
+  if (!shard_index && roots.empty() && FLAGS_lift_variables) {
+    program.ForEachVariable([&](const anvill::GlobalVarDecl *decl) {
+      (void) lifter.LiftEntity(*decl);
+      return true;
+    });
+  }
+
+  // Duplicate functions are found up-front, the same way by every shard, so
+  // that a duplicate's thunk refers to its representative by the name that
+  // the representative's shard gives it.
+  std::optional<anvill::DuplicateFunctions> dups;
+  if (FLAGS_dedup_functions && roots.empty()) {
+    dups.emplace(anvill::DuplicateFunctions::Find(program, arch));
+  }
+
+  // The bytes of a function are bounded by the next function when computing
+  // its key in the function cache.
+  std::vector<uint64_t> func_addresses;
+  if (cache) {
+    program.ForEachFunction([&](const anvill::FunctionDecl *decl) {
+      func_addresses.push_back(decl->address);
+      return true;
+    });
+    std::sort(func_addresses.begin(), func_addresses.end());
+  }
+
+  // Functions whose optimized bodies are cached are only declared, and then
+  // their bodies are linked in after optimization. The other functions are
+  // cached after optimization.
+  std::vector<std::pair<llvm::Function *, std::unique_ptr<llvm::Module>>>
+      cache_hits;
+  std::vector<std::pair<llvm::Function *, std::string>> cache_misses;
+  llvm::GlobalVariable *pins = nullptr;
+
+  auto is_called = +[](llvm::Function &func) -> bool {
+    for (auto user : func.users()) {
+      if (llvm::isa<llvm::CallBase>(user)) {
+        return true;
+      }
+    }
+    return false;
+  };
+
+  // Index the first name of each address up-front, rather than looking up
+  // the names of every function's address.
+  std::unordered_map<uint64_t, const std::string *> addr_to_name;
+  program.ForEachNamedAddress(
+      [&](uint64_t ea, const std::string &name, const anvill::FunctionDecl *,
+          const anvill::GlobalVarDecl *) {
+        addr_to_name.emplace(ea, &name);
+        return true;
+      });
+
+  // Name the functions after the symbols at their addresses. When names
+  // collide, LLVM uniques the names given later, so declarations get first
+  // pick of the names, then functions that are called, then everything else.
+  // Saved functions refer to each other by name, so a function is only ever
+  // named once.
+  std::unordered_set<const llvm::Function *> named_funcs;
+  auto name_functions = [&](void) {
+    std::vector<std::pair<llvm::Function *, const std::string *>> ranked[3];
+    if (addr_to_name.empty()) {
+      return;
+    }
+
+    for (auto &func : module) {
+      if (named_funcs.count(&func)) {
+        continue;
+      }
+
+      auto maybe_addr = lifter.AddressOfEntity(&func);
+      if (!maybe_addr) {
+        continue;
+      }
+
+      auto it = addr_to_name.find(*maybe_addr);
+      if (it == addr_to_name.end()) {
+        continue;
+      }
+
+      const auto rank = func.isDeclaration() ? 0u : (is_called(func) ? 1u : 2u);
+      ranked[rank].emplace_back(&func, it->second);
+    }
+
+    for (const auto &funcs : ranked) {
+      for (auto [func, name] : funcs) {
+        func->setName(*name);
+        named_funcs.insert(func);
+      }
+    }
+  };
+
+  // Optimize the lifted functions in `batch`, then save each of them into
+  // `--split_out_dir` and free its body. Everything in the module is pinned
+  // while a batch is optimized, so that the declarations and variables that
+  // the saved functions refer to outlive the functions that still refer to
+  // them in the module. Saved functions are written out by `split_writer`
+  // while the next batch is lifted and optimized.
+  std::vector<llvm::Function *> batch;
+  SplitModuleWriter split_writer;
+  auto evict_batch = [&](void) -> bool {
+    if (options.lazy_data_initializers) {
+      lifter.LiftReferencedData();
+    }
+
+    if (pins) {
+      pins->eraseFromParent();
+    }
+    pins = PinDeclarations(module, true);
+
+    if (!remill::VerifyModule(&module)) {
+      std::cerr << "Couldn't verify module produced from spec:\n"
+                << spec_text.str() << '\n';
+      return false;
+    }
+
+    lift_timer.reset();
+    if (stats) {
+      stats->instructions_before_opt += CountInstructions(module);
+    }
+    {
+      PhaseTimer timer(stats, kPhaseOptimize);
+      if (!anvill::OptimizeModule(lifter, arch, program, module, options,
+                                  pipeline)) {
+        return false;
+      }
+    }
+    if (stats) {
+      stats->instructions_after_opt += CountInstructions(module);
+    }
+
+    for (auto &[func, key] : cache_misses) {
+      if (auto err = cache->Store(key, *func, address_of, prototype_of);
+          remill::IsError(err)) {
+        LOG(WARNING) << "Unable to cache function " << func->getName().str()
+                     << ": " << remill::GetErrorString(err);
+      }
+    }
+    cache_misses.clear();
+
+    // Optimization can resolve integers into references to variables. The
+    // saved functions won't refer to those variables from inside the module
+    // anymore, so their initializers are lifted now.
+    if (options.lazy_data_initializers) {
+      lifter.LiftReferencedData();
+    }
+
+    name_functions();
+
+    auto ret = true;
+    {
+      PhaseTimer timer(stats, kPhaseOutput);
+      for (auto func : batch) {
+        if (!func->isDeclaration() &&
+            !SaveSplitFunction(*func, FLAGS_split_out_dir,
+                               *evicted_file_names, split_writer)) {
+          ret = false;
+        }
+      }
+    }
+    batch.clear();
+
+    lift_timer.emplace(stats, kPhaseLift);
+    if (ret) {
+      ReleaseFreeMemory();
+    }
+    return ret;
+  };
+
+  // Functions are compressed in batches, so that the initializers of the
+  // variables that they refer to can be lifted beforehand, all at once.
+  // Whether or not lifted code refers to a variable decides if its
+  // initializer is lifted, and compressed functions refer to nothing.
+  std::optional<anvill::CompressedFunctions> compressed;
+  if (FLAGS_compress_idle_functions && !evicted_file_names && roots.empty()) {
+    compressed.emplace(module);
+  }
+  std::vector<llvm::Function *> idle_funcs;
+  auto compress_idle_funcs = [&](void) {
+    if (options.lazy_data_initializers) {
+      lifter.LiftReferencedData();
+    }
+    for (auto func : idle_funcs) {
+      if (compressed->Compress(*func) && stats) {
+        ++stats->num_functions_compressed;
+      }
+    }
+    idle_funcs.clear();
+    if (stats) {
+      UpdateMax(stats->peak_compressed_function_bytes,
+                compressed->NumCompressedBytes());
+      UpdateMax(stats->peak_compressed_function_bitcode_bytes,
+                compressed->NumBitcodeBytes());
+    }
+  };
+
+  // Returns `false` if the function `func` was just lifted, and evicting its
+  // batch failed.
+  auto maybe_evict = [&](llvm::Function *func) -> bool {
+    if (!func || func->isDeclaration()) {
+      return true;
+    } else if (!evicted_file_names) {
+      if (compressed) {
+        idle_funcs.push_back(func);
+        if (idle_funcs.size() >= kCompressBatchSize) {
+          compress_idle_funcs();
+        }
+      }
+      return true;
+    }
+    batch.push_back(func);
+    return batch.size() < FLAGS_evict_batch_size || evict_batch();
+  };
+
+  // Lift functions. Functions are dealt out to the shards by their estimated
+  // costs, but are lifted in order of their addresses. Functions reachable
+  // from the roots have already been lifted.
+  std::vector<unsigned> func_shards;
+  if (num_shards > 1 && roots.empty()) {
+    func_shards =
+        AssignShards(program, num_shards, NumShardNodes(num_shards));
+  }
+  auto func_index = 0u;
+  auto batches_ok = true;
+  program.ForEachFunction([&](const anvill::FunctionDecl *decl) {
+    if (!roots.empty() ||
+        (!func_shards.empty() && func_shards[func_index++] != shard_index)) {
+      return true;
+    }
+
+    if (!FLAGS_lift_functions.empty() && !lift_only.count(decl->address)) {
+      return true;
+    }
+
+    // The representative of a duplicate has a lower address, and so it has
+    // already been lifted if it belongs to this shard. Otherwise, the thunk
+    // calls its declaration.
+    if (auto rep_ea = dups ? dups->RepresentativeOf(decl->address)
+                           : std::nullopt) {
+      auto rep_decl = program.FindFunction(*rep_ea);
+      auto rep_func = rep_decl ? lifter.DeclareEntity(*rep_decl) : nullptr;
+      auto func = rep_func ? lifter.DeclareEntity(*decl) : nullptr;
+      if (func &&
+          anvill::DuplicateFunctions::DefineAsThunk(*func, *rep_func)) {
+        if (stats) {
+          ++stats->num_functions_deduplicated;
+        }
+        batches_ok = maybe_evict(func);
+        return batches_ok;
+      }
+    }
+
+    if (!cache) {
+      auto func = lifter.LiftEntity(*decl);
+      if (stats && func && !func->isDeclaration()) {
+        ++stats->num_functions_lifted;
+      }
+      batches_ok = maybe_evict(func);
+      return batches_ok;
+    }
+
+    auto next_addr = std::upper_bound(func_addresses.begin(),
+                                      func_addresses.end(), decl->address);
+    auto key = anvill::FunctionCache::Key(
+        program, *decl,
+        next_addr == func_addresses.end()
+            ? std::numeric_limits<uint64_t>::max()
+            : *next_addr,
+        options, pipeline);
+
+    // When lifting incrementally, a cached function is only reused if nothing
+    // that its lifted code depends on has changed since the last run.
+    const IncrementalManifest::Entry *prev_entry = nullptr;
+    if (manifest) {
+      prev_entry = manifest->FindReusable(
+          decl->address, key, [&](uint64_t address) -> std::string {
+            if (auto ref_decl = program.FindFunction(address)) {
+              return anvill::FunctionCache::PrototypeHash(
+                  *ref_decl, module.getDataLayout());
+            }
+            return std::string();
+          });
+    }
+
+    IncrementalManifest::Entry entry;
+    if (manifest) {
+      entry.key = key;
+      entry.prototype = anvill::FunctionCache::PrototypeHash(
+          *decl, module.getDataLayout());
+    }
+
+    if (!manifest || prev_entry) {
+      auto maybe_cached = cache->Load(key, context, prototype_of);
+      if (remill::IsError(maybe_cached)) {
+        LOG(WARNING) << remill::GetErrorString(maybe_cached);
+
+      } else if (auto &cached = remill::GetReference(maybe_cached); cached) {
+        if (auto func = lifter.DeclareEntity(*decl)) {
+          cache_hits.emplace_back(func, std::move(cached));
+          if (stats) {
+            ++stats->num_functions_cached;
+          }
+          if (manifest) {
+            entry.references = prev_entry->references;
+            manifest->Record(decl->address, std::move(entry));
+          }
+          return true;
+        }
+      }
+    }
+
+    auto func = lifter.LiftEntity(*decl, entry.references);
+    if (func && !func->isDeclaration()) {
+      cache_misses.emplace_back(func, std::move(key));
+      if (stats) {
+        ++stats->num_functions_lifted;
+      }
+    }
+    if (manifest) {
+      manifest->Record(decl->address, std::move(entry));
+    }
+    batches_ok = maybe_evict(func);
+    return batches_ok;
+  });
+
+  if (!batches_ok) {
+    return false;
+  }
+
+  // The compressed functions are needed again from here on.
+  if (compressed) {
+    if (auto err = compressed->MaterializeAll(); remill::IsError(err)) {
+      LOG(ERROR) << "Unable to decompress lifted functions: "
+                 << remill::GetErrorString(err);
+      return false;
+    }
+    compressed.reset();
+  }
+
+  // Lift the initializers of the variables that lifted functions refer to.
+  if (options.lazy_data_initializers) {
+    lifter.LiftReferencedData();
+  }
+
+  // Cached functions refer to other functions and variables by the names that
+  // the lifter gives them, so declare everything that they might refer to.
+  // Optimization deletes unused declarations, so pin the declarations, which
+  // the lifter's entity maps also refer to, until the cached bodies are
+  // linked in. If functions were saved, then everything that they refer to
+  // stays pinned too.
+  if (!cache_hits.empty()) {
+    program.ForEachFunction([&](const anvill::FunctionDecl *decl) {
+      (void) lifter.DeclareEntity(*decl);
+      return true;
+    });
+    program.ForEachVariable([&](const anvill::GlobalVarDecl *decl) {
+      (void) lifter.DeclareEntity(*decl);
+      return true;
+    });
+  }
+  if (!cache_hits.empty() || pins) {
+    const auto pin_definitions = !!pins;
+    if (pins) {
+      pins->eraseFromParent();
+    }
+    pins = PinDeclarations(module, pin_definitions);
+  }
+
+  // Verify the module
+  if (!remill::VerifyModule(&module)) {
+    std::cerr << "Couldn't verify module produced from spec:\n"
+              << spec_text.str() << '\n';
+    return false;
+  }
+
+  lift_timer.reset();
+
+  // OLD: Apply optimizations.
+  if (stats) {
+    stats->instructions_before_opt += CountInstructions(module);
+  }
+  {
+    PhaseTimer timer(stats, kPhaseOptimize);
+    if (!anvill::OptimizeModule(lifter, arch, program, module, options,
+                                pipeline)) {
+      return false;
+    }
+  }
+  if (stats) {
+    stats->instructions_after_opt += CountInstructions(module);
+  }
+
+  if (pins) {
+    pins->eraseFromParent();
+  }
+
+  for (auto &[func, key] : cache_misses) {
+    if (auto err = cache->Store(key, *func, address_of, prototype_of);
+        remill::IsError(err)) {
+      LOG(WARNING) << "Unable to cache function " << func->getName().str()
+                   << ": " << remill::GetErrorString(err);
+    }
+  }
+
+  for (auto &[func, cached] : cache_hits) {
+    if (auto err = anvill::FunctionCache::Link(std::move(cached), *func);
+        remill::IsError(err)) {
+      LOG(ERROR) << remill::GetErrorString(err);
+      return false;
+    }
+  }
+
+  // Optimization can resolve integers into references to variables whose
+  // initializers haven't been lifted yet, and so can the cached functions.
+  if (options.lazy_data_initializers) {
+    lifter.LiftReferencedData();
+  }
+
+  name_functions();
+
+  for (auto &gv : module.global_values()) {
+    if (auto maybe_addr = lifter.AddressOfEntity(&gv)) {
+      RecordEntity(module, &gv, *maybe_addr);
+    }
+  }
+
+  // Wait for the functions saved by `evict_batch` to be written out.
+  return split_writer.Finish();
+}
+
+// Load the instruction semantics of each target in `--preload_semantics`.
+//
+// Semantics are cached process-wide, independent of any context, so the
+// architectures used to load them are thrown away.
+bool PreloadSemantics(void) {
+  MemoryScope scope(kMemorySemantics);
+  llvm::SmallVector<llvm::StringRef, 8> targets;
+  llvm::StringRef(FLAGS_preload_semantics).split(targets, ',', -1, false);
+  for (auto target : targets) {
+    auto [arch_str, os_str] = target.trim().split(':');
+    if (arch_str.empty() || os_str.empty()) {
+      LOG(ERROR) << "Invalid target '" << target.trim().str()
+                 << "' in --preload_semantics; expected 'arch:os'";
+      return false;
+    }
+
+    llvm::LLVMContext context;
+    auto arch = BuildArch(context, arch_str.str(), os_str.str());
+    if (!arch) {
+      LOG(ERROR) << "Unable to build the architecture for '"
+                 << target.trim().str() << "' in --preload_semantics";
+      return false;
+    }
+    anvill::EntityLifter::PreloadSemantics(arch.get());
+  }
+
+  ReleaseFreeMemory();
+  return true;
+}
+
+// Returns `false`, after logging why, if `--roots`, `--lift_functions`, or
+// `--evict_batch_size` are invalid, or are given with options that don't
+// apply to them.
+bool CheckLiftFlags(void) {
+  if (!FLAGS_roots.empty()) {
+    std::vector<uint64_t> roots;
+    if (!ParseRoots(roots)) {
+      return false;
+    }
+
+    if (FLAGS_spec.empty() || !FLAGS_checkpoint_dir.empty() ||
+        !FLAGS_function_cache_dir.empty()) {
+      LOG(ERROR) << "The --roots option only applies to --spec, and not "
+                 << "with --checkpoint_dir or --function_cache_dir.";
+      return false;
+    }
+  }
+
+  if (!FLAGS_lift_functions.empty() &&
+      (FLAGS_spec.empty() || !FLAGS_roots.empty())) {
+    LOG(ERROR) << "The --lift_functions option only applies to --spec, and "
+               << "not with --roots.";
+    return false;
+  }
+
+  if (FLAGS_evict_batch_size &&
+      (FLAGS_split_out_dir.empty() || !FLAGS_ir_out.empty() ||
+       !FLAGS_bc_out.empty() || !FLAGS_checkpoint_dir.empty() ||
+       !FLAGS_reoptimize_bc.empty())) {
+    LOG(ERROR) << "The --evict_batch_size option needs --split_out_dir, and "
+               << "doesn't apply to --ir_out, --bc_out, --checkpoint_dir, or "
+               << "--reoptimize_bc; the bodies of evicted functions are only "
+               << "saved into --split_out_dir.";
+    return false;
+  }
+
+  return true;
+}
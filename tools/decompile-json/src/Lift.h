@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <llvm/ADT/StringRef.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "Spec.h"
+
+namespace anvill {
+class FunctionCache;
+class LifterOptions;
+class OptimizationPipeline;
+class Program;
+class Tracer;
+}  // namespace anvill
+namespace llvm {
+class DataLayout;
+class GlobalValue;
+class LLVMContext;
+class Module;
+}  // namespace llvm
+namespace remill {
+class Arch;
+}  // namespace remill
+
+class IncrementalManifest;
+struct RunStats;
+
+// Build a remill architecture object on `context`. The architecture object
+// knows how to deal with everything for this specific architecture, such as
+// semantics, register,  etc.
+//
+// Building an architecture may initialize global decoder state (e.g. XED's
+// tables), so we serialize construction of the architectures of concurrent
+// shards and batch workers.
+std::unique_ptr<const remill::Arch>
+BuildArch(llvm::LLVMContext &context, const std::string &arch_str,
+          const std::string &os_str);
+
+// Name of the named metadata in which lifted modules remember the addresses
+// of their entities until they're saved, so that the entities can be put in
+// order of their addresses, and saved into `--entity_map_out`. Metadata
+// follows its entities through linking, renaming, and checkpointing.
+extern const char *const kEntitiesMetadataName;
+
+// Remember that `gv` is the entity at `address` in `module`.
+void RecordEntity(llvm::Module &module, llvm::GlobalValue *gv,
+                  uint64_t address);
+
+// Set the lifter options that come from the command-line flags.
+void ConfigureLifterOptions(anvill::LifterOptions &options,
+                            anvill::Tracer *tracer);
+
+// Parse the addresses in `--roots` into `roots`.
+bool ParseRoots(std::vector<uint64_t> &roots);
+
+// Returns the prototype hash of the function or variable at `address` in
+// `program`, or an empty string if there is neither. Cached functions are
+// only reused if the hashes of what they refer to are unchanged.
+std::string EntityPrototypeHash(const anvill::Program &program,
+                                const llvm::DataLayout &dl, uint64_t address);
+
+// Lift the subset of the spec's functions that belong to shard `shard_index`
+// (out of `num_shards`) into `module`, and then optimize and name them. `arch`
+// must be bound to the context of `module`. Each shard gets its own
+// `remill::Arch`, `anvill::Program`, and `anvill::EntityLifter`, all bound to
+// the context of `module`, so that shards can be lifted concurrently.
+// Functions that are called but not lifted by this shard are left as
+// declarations, and are resolved to their definitions when the shards are
+// linked back together.
+//
+// If `evicted_file_names` is non-null, then functions are lifted and
+// optimized in batches of `--evict_batch_size`, and each optimized function
+// of a batch is saved into `--split_out_dir` and left as a declaration. The
+// names of the saved modules are added to `evicted_file_names`. Otherwise,
+// with `--compress_idle_functions`, lifted functions are compressed until
+// they're optimized.
+bool LiftSpec(const SpecParser &parse_spec, llvm::StringRef spec_text,
+              const remill::Arch *arch,
+              const anvill::OptimizationPipeline &pipeline,
+              anvill::Tracer *tracer, RunStats *stats,
+              const anvill::FunctionCache *cache, IncrementalManifest *manifest,
+              llvm::Module &module, unsigned shard_index, unsigned num_shards,
+              std::unordered_set<std::string> *evicted_file_names);
+
+// Load the instruction semantics of each target in `--preload_semantics`.
+//
+// Semantics are cached process-wide, independent of any context, so the
+// architectures used to load them are thrown away.
+bool PreloadSemantics(void);
+
+// Returns `false`, after logging why, if `--roots`, `--lift_functions`, or
+// `--evict_batch_size` are invalid, or are given with options that don't
+// apply to them.
+bool CheckLiftFlags(void);
@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Manifest.h"
+
+#include <glog/logging.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+#include <remill/BC/Compat/Error.h>
+
+#include <utility>
+
+DEFINE_string(manifest, "",
+              "Path to a manifest of the functions lifted by the previous "
+              "run on this spec, for incremental lifting. Only functions "
+              "whose declarations, bytes, or control-flow information have "
+              "changed, and callers of functions whose prototypes have "
+              "changed, are lifted again; everything else is reused from "
+              "--function_cache_dir. The manifest is then updated, or "
+              "created if it doesn't exist.");
+
+DECLARE_string(spec);
+DECLARE_string(checkpoint_dir);
+DECLARE_string(function_cache_dir);
+DECLARE_string(roots);
+
+// Read the manifest of the previous run from `path`. A missing manifest is
+// treated as an empty one.
+bool IncrementalManifest::Read(const std::string &path) {
+  if (!llvm::sys::fs::exists(path)) {
+    return true;
+  }
+
+  auto maybe_buff = llvm::MemoryBuffer::getFile(path);
+  if (remill::IsError(maybe_buff)) {
+    LOG(ERROR) << "Unable to read manifest file '" << path
+               << "': " << remill::GetErrorString(maybe_buff);
+    return false;
+  }
+
+  auto maybe_json =
+      llvm::json::parse(remill::GetReference(maybe_buff)->getBuffer());
+  if (remill::IsError(maybe_json)) {
+    LOG(ERROR) << "Unable to parse manifest file '" << path
+               << "': " << remill::GetErrorString(maybe_json);
+    return false;
+  }
+
+  auto &json = remill::GetReference(maybe_json);
+  const auto manifest = json.getAsObject();
+  const auto funcs = manifest ? manifest->getArray("functions") : nullptr;
+  if (!funcs) {
+    LOG(ERROR) << "Manifest file '" << path
+               << "' must contain an object with a 'functions' array.";
+    return false;
+  }
+
+  for (auto &func : *funcs) {
+    const auto obj = func.getAsObject();
+    const auto address = obj ? obj->getInteger("address") : llvm::None;
+    const auto key = obj ? obj->getString("key") : llvm::None;
+    const auto prototype = obj ? obj->getString("prototype") : llvm::None;
+    const auto refs = obj ? obj->getArray("references") : nullptr;
+    if (!address || !key || !prototype || !refs) {
+      LOG(ERROR) << "Malformed function entry in manifest file '" << path
+                 << "'";
+      return false;
+    }
+
+    auto &entry = previous[static_cast<uint64_t>(*address)];
+    entry.key = key->str();
+    entry.prototype = prototype->str();
+    for (auto &ref : *refs) {
+      if (auto ref_address = ref.getAsInteger()) {
+        entry.references.push_back(static_cast<uint64_t>(*ref_address));
+      }
+    }
+  }
+  return true;
+}
+
+// Write the manifest of this run to `path`.
+bool IncrementalManifest::Write(const std::string &path) const {
+  const auto temp_path = path + ".tmp";
+  {
+    std::error_code ec;
+    llvm::raw_fd_ostream os(temp_path, ec, llvm::sys::fs::OF_Text);
+    if (ec) {
+      LOG(ERROR) << "Unable to open manifest file '" << temp_path
+                 << "': " << ec.message();
+      return false;
+    }
+
+    llvm::json::OStream json(os, 2);
+    json.object([&] {
+      json.attributeArray("functions", [&] {
+        for (const auto &[address, entry] : next) {
+          json.object([&] {
+            json.attribute("address", static_cast<int64_t>(address));
+            json.attribute("key", entry.key);
+            json.attribute("prototype", entry.prototype);
+            json.attributeArray("references", [&] {
+              for (auto ref : entry.references) {
+                json.value(static_cast<int64_t>(ref));
+              }
+            });
+          });
+        }
+      });
+    });
+  }
+
+  if (auto ec = llvm::sys::fs::rename(temp_path, path)) {
+    LOG(ERROR) << "Unable to save manifest file '" << path
+               << "': " << ec.message();
+    return false;
+  }
+  return true;
+}
+
+// Returns the previous entry of the function at `address` if its lifted
+// code can be reused, i.e. if its key is unchanged, and if the prototypes
+// of the functions that it references are unchanged. `prototype_of` returns
+// the current prototype hash of a function, or an empty string if there is
+// no function at an address.
+const IncrementalManifest::Entry *IncrementalManifest::FindReusable(
+    uint64_t address, const std::string &key,
+    const std::function<std::string(uint64_t)> &prototype_of) {
+  auto it = previous.find(address);
+  if (it == previous.end() || it->second.key != key) {
+    ++num_changed;
+    return nullptr;
+  }
+
+  for (auto ref : it->second.references) {
+    auto ref_it = previous.find(ref);
+    const auto old_prototype =
+        ref_it == previous.end() ? std::string() : ref_it->second.prototype;
+    if (prototype_of(ref) != old_prototype) {
+      ++num_stale_callers;
+      return nullptr;
+    }
+  }
+
+  ++num_reused;
+  return &(it->second);
+}
+
+// Record what the lifted code of the function at `address` depends on.
+void IncrementalManifest::Record(uint64_t address, Entry entry) {
+  std::lock_guard<std::mutex> locker(lock);
+  next[address] = std::move(entry);
+}
+
+// Returns `false`, after logging why, if `--manifest` is given without the
+// options it needs, or with options that don't apply to it.
+bool CheckManifestFlags(void) {
+  if (!FLAGS_manifest.empty() &&
+      (FLAGS_spec.empty() || FLAGS_function_cache_dir.empty() ||
+       !FLAGS_checkpoint_dir.empty() || !FLAGS_roots.empty())) {
+    LOG(ERROR) << "The --manifest option only applies to --spec, needs "
+               << "--function_cache_dir to hold the reused functions, and "
+               << "doesn't apply with --checkpoint_dir or --roots.";
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// What the lifted code of each function depended on, recorded so that a later
+// run on an edited spec can tell which functions need to be lifted again.
+// The function cache key of a function covers its declaration, its bytes, and
+// the control-flow information about its bytes; the prototypes of the
+// functions that it references are recorded separately, because the
+// marshaling of calls to them is baked into its lifted code.
+class IncrementalManifest {
+ public:
+  struct Entry {
+    std::string key;
+    std::string prototype;
+    std::vector<uint64_t> references;
+  };
+
+  // Read the manifest of the previous run from `path`. A missing manifest is
+  // treated as an empty one.
+  bool Read(const std::string &path);
+
+  // Write the manifest of this run to `path`.
+  bool Write(const std::string &path) const;
+
+  // Returns the previous entry of the function at `address` if its lifted
+  // code can be reused, i.e. if its key is unchanged, and if the prototypes
+  // of the functions that it references are unchanged. `prototype_of` returns
+  // the current prototype hash of a function, or an empty string if there is
+  // no function at an address.
+  const Entry *
+  FindReusable(uint64_t address, const std::string &key,
+               const std::function<std::string(uint64_t)> &prototype_of);
+
+  // Record what the lifted code of the function at `address` depends on.
+  void Record(uint64_t address, Entry entry);
+
+  std::atomic<uint64_t> num_changed{0u};
+  std::atomic<uint64_t> num_stale_callers{0u};
+  std::atomic<uint64_t> num_reused{0u};
+
+ private:
+  std::unordered_map<uint64_t, Entry> previous;
+
+  std::mutex lock;
+  std::map<uint64_t, Entry> next;
+};
+
+// Returns `false`, after logging why, if `--manifest` is given without the
+// options it needs, or with options that don't apply to it.
+bool CheckManifestFlags(void);
@@ -0,0 +1,473 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Metrics.h"
+
+#include <anvill/Counters.h>
+#include <anvill/Lifters/EntityLifter.h>
+#include <anvill/Trace.h>
+#include <glog/logging.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/raw_ostream.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+
+#include "Allocator.h"
+#include "Stats.h"
+
+DEFINE_string(metrics_addr, "",
+              "Address, as 'host:port' or ':port', on which to serve live "
+              "metrics over HTTP at '/metrics', in the Prometheus text "
+              "format, e.g. for alerting and autoscaling on the throughput "
+              "of long-running --serve, --batch, and --queue_dir workers. "
+              "The metrics include the functions lifted, the jobs in "
+              "progress and in --queue_dir, latency histograms of each "
+              "optimization pass, the hits and misses of the lifter's "
+              "caches, the live memory of each part of the lifter, and the "
+              "functions that went over their budgets.");
+
+static const double kLatencyBuckets[kNumLatencyBuckets] = {
+    0.0001, 0.001, 0.01, 0.1, 1.0, 10.0, 100.0};
+
+static const char *const kLatencyBucketNames[kNumLatencyBuckets + 1u] = {
+    "0.0001", "0.001", "0.01", "0.1", "1", "10", "100", "+Inf"};
+
+namespace {
+
+// The trace events whose latencies are served by `--metrics_addr`: the name
+// of the category of the events, the name of the histogram metric, the name
+// of the label holding the event name, and the help text of the metric.
+struct LatencyMetric {
+  const char *category;
+  const char *name;
+  const char *label;
+  const char *help;
+};
+
+}  // namespace
+
+static const LatencyMetric kLatencyMetrics[] = {
+    {"pass", "anvill_pass_duration_seconds", "pass",
+     "Time spent running one optimization pass over one function."},
+    {"lift", "anvill_lift_step_duration_seconds", "step",
+     "Time spent in one step of lifting one function."}};
+
+// Add `event` into the histogram of its category and name.
+void LatencyHistograms::Observe(const anvill::TraceEvent &event) {
+  std::lock_guard<std::mutex> locker(lock);
+  auto category_it = histograms.find(event.category);
+  if (category_it == histograms.end()) {
+    category_it = histograms.emplace(event.category, HistogramMap()).first;
+  }
+  auto &by_name = category_it->second;
+  auto it = by_name.find(event.name);
+  if (it == by_name.end()) {
+    it = by_name.emplace(event.name, Histogram()).first;
+  }
+
+  auto &histogram = it->second;
+  const auto seconds = static_cast<double>(event.duration_us) / 1e6;
+  auto bucket = 0u;
+  while (bucket < kNumLatencyBuckets && seconds > kLatencyBuckets[bucket]) {
+    ++bucket;
+  }
+  histogram.counts[bucket] += 1u;
+  histogram.sum_us += event.duration_us;
+}
+
+// Print `value` as a Prometheus label value, escaping what needs escaping.
+static void PrintLabelValue(llvm::raw_ostream &os, llvm::StringRef value) {
+  os << '"';
+  for (auto ch : value) {
+    switch (ch) {
+      case '\\': os << "\\\\"; break;
+      case '"': os << "\\\""; break;
+      case '\n': os << "\\n"; break;
+      default: os << ch; break;
+    }
+  }
+  os << '"';
+}
+
+// Print `us` microseconds as a number of seconds.
+static void PrintSeconds(llvm::raw_ostream &os, uint64_t us) {
+  const auto frac = std::to_string(us % 1000000u);
+  os << (us / 1000000u) << '.' << std::string(6u - frac.size(), '0') << frac;
+}
+
+// Print the `HELP` and `TYPE` lines that precede the samples of a metric.
+static void PrintMetricHeader(llvm::raw_ostream &os, const char *name,
+                              const char *type, const char *help) {
+  os << "# HELP " << name << ' ' << help << '\n'
+     << "# TYPE " << name << ' ' << type << '\n';
+}
+
+// Print the histograms in the Prometheus text format.
+void LatencyHistograms::Print(llvm::raw_ostream &os) const {
+  std::lock_guard<std::mutex> locker(lock);
+  for (const auto &metric : kLatencyMetrics) {
+    PrintMetricHeader(os, metric.name, "histogram", metric.help);
+    auto category_it = histograms.find(metric.category);
+    if (category_it == histograms.end()) {
+      continue;
+    }
+
+    for (const auto &[event_name, histogram] : category_it->second) {
+      auto print_labels = [&, &event_name = event_name](const char *le) {
+        os << '{' << metric.label << '=';
+        PrintLabelValue(os, event_name);
+        if (le) {
+          os << ",le=\"" << le << '"';
+        }
+        os << '}';
+      };
+
+      // Prometheus buckets are cumulative.
+      uint64_t count = 0u;
+      for (auto i = 0u; i <= kNumLatencyBuckets; ++i) {
+        count += histogram.counts[i];
+        os << metric.name << "_bucket";
+        print_labels(kLatencyBucketNames[i]);
+        os << ' ' << count << '\n';
+      }
+      os << metric.name << "_sum";
+      print_labels(nullptr);
+      os << ' ';
+      PrintSeconds(os, histogram.sum_us);
+      os << '\n';
+      os << metric.name << "_count";
+      print_labels(nullptr);
+      os << ' ' << count << '\n';
+    }
+  }
+}
+
+namespace {
+
+// The caches whose hits and misses are served by `--metrics_addr`.
+struct CacheMetric {
+  const char *cache;
+  anvill::Counter hits;
+  anvill::Counter misses;
+};
+
+}  // namespace
+
+static const CacheMetric kCacheMetrics[] = {
+    {"semantics", anvill::Counter::kSemanticsCacheHits,
+     anvill::Counter::kSemanticsCacheMisses},
+    {"decode", anvill::Counter::kDecodeCacheHits,
+     anvill::Counter::kDecodeCacheMisses},
+    {"type", anvill::Counter::kTypeCacheHits,
+     anvill::Counter::kTypeCacheMisses},
+    {"function", anvill::Counter::kFunctionCacheHits,
+     anvill::Counter::kFunctionCacheMisses},
+    {"memory_page", anvill::Counter::kMemoryPageCacheHits,
+     anvill::Counter::kMemoryPageCacheMisses}};
+
+// Print the metrics of this process, from `stats` and `latencies`, in the
+// Prometheus text format.
+static void PrintMetrics(llvm::raw_ostream &os, const RunStats &stats,
+                         const LatencyHistograms &latencies) {
+  auto print_counter = [&](const char *name, const char *help,
+                           const std::atomic<uint64_t> &val) {
+    PrintMetricHeader(os, name, "counter", help);
+    os << name << ' ' << val.load() << '\n';
+  };
+
+  auto print_gauge = [&](const char *name, const char *help, uint64_t val) {
+    PrintMetricHeader(os, name, "gauge", help);
+    os << name << ' ' << val << '\n';
+  };
+
+  print_counter("anvill_specs_total", "Specs decompiled.", stats.num_specs);
+  print_counter("anvill_failed_specs_total", "Specs that failed to decompile.",
+                stats.num_failed_specs);
+  print_gauge("anvill_active_jobs",
+              "Specs or served requests being worked on right now.",
+              stats.active_jobs.load());
+  print_gauge("anvill_queued_jobs",
+              "Jobs left in --queue_dir when it was last looked at.",
+              stats.queued_jobs.load());
+  print_counter("anvill_functions_lifted_total", "Functions lifted.",
+                stats.num_functions_lifted);
+  print_counter("anvill_functions_cached_total",
+                "Functions reused from a cache instead of being lifted.",
+                stats.num_functions_cached);
+  print_counter("anvill_functions_deduplicated_total",
+                "Functions merged into an identical function.",
+                stats.num_functions_deduplicated);
+
+  PrintMetricHeader(os, "anvill_phase_seconds_total", "counter",
+                    "Wall time spent in each phase, summed across threads.");
+  for (auto i = 0u; i < kNumPhases; ++i) {
+    os << "anvill_phase_seconds_total{phase=\"" << kPhaseNames[i] << "\"} ";
+    PrintSeconds(os, stats.wall_us[i].load());
+    os << '\n';
+  }
+
+  latencies.Print(os);
+
+  PrintMetricHeader(os, "anvill_cache_hits_total", "counter",
+                    "Lookups that were found in each of the lifter's caches.");
+  for (const auto &metric : kCacheMetrics) {
+    os << "anvill_cache_hits_total{cache=\"" << metric.cache << "\"} "
+       << anvill::ReadCounter(metric.hits) << '\n';
+  }
+  PrintMetricHeader(os, "anvill_cache_misses_total", "counter",
+                    "Lookups that missed each of the lifter's caches.");
+  for (const auto &metric : kCacheMetrics) {
+    os << "anvill_cache_misses_total{cache=\"" << metric.cache << "\"} "
+       << anvill::ReadCounter(metric.misses) << '\n';
+  }
+
+  PrintMetricHeader(os, "anvill_budget_exceeded_total", "counter",
+                    "Functions that went over a lifting or optimization "
+                    "budget.");
+  os << "anvill_budget_exceeded_total{stage=\"lift\"} "
+     << anvill::ReadCounter(anvill::Counter::kLiftBudgetExceeded) << '\n'
+     << "anvill_budget_exceeded_total{stage=\"optimize\"} "
+     << anvill::ReadCounter(anvill::Counter::kOptimizeBudgetExceeded) << '\n';
+
+  PrintMetricHeader(os, "anvill_idle_functions_total", "counter",
+                    "Lifted functions that were compressed while idle, and "
+                    "that were decompressed again.");
+  os << "anvill_idle_functions_total{action=\"compress\"} "
+     << anvill::ReadCounter(anvill::Counter::kFunctionsCompressed) << '\n'
+     << "anvill_idle_functions_total{action=\"decompress\"} "
+     << anvill::ReadCounter(anvill::Counter::kFunctionsDecompressed) << '\n';
+
+  // Only allocations made with `operator new` are attributed to categories; see
+  // `WriteRunStats`.
+  PrintMetricHeader(os, "anvill_live_bytes", "gauge",
+                    "Live heap bytes allocated by each part of the lifter.");
+  for (auto i = 0u; i < kNumMemoryCategories; ++i) {
+    os << "anvill_live_bytes{category=\"" << kMemoryCategoryNames[i] << "\"} "
+       << LiveBytes(static_cast<MemoryCategory>(i)) << '\n';
+  }
+  print_gauge("anvill_semantics_cache_bytes",
+              "Bytes of cached instruction semantics.",
+              anvill::EntityLifter::SemanticsCacheBytes());
+
+  struct rusage usage = {};
+  getrusage(RUSAGE_SELF, &usage);
+  PrintMetricHeader(os, "process_cpu_seconds_total", "counter",
+                    "User and system CPU time spent, in seconds.");
+  os << "process_cpu_seconds_total ";
+  PrintSeconds(
+      os, static_cast<uint64_t>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) *
+                  1000000u +
+              static_cast<uint64_t>(usage.ru_utime.tv_usec +
+                                    usage.ru_stime.tv_usec));
+  os << '\n';
+
+  // The current resident set size is only known on Linux; the peak is known
+  // everywhere, but in different units.
+#ifdef __linux__
+  uint64_t size_pages = 0u;
+  uint64_t resident_pages = 0u;
+  if (std::ifstream statm("/proc/self/statm");
+      statm >> size_pages >> resident_pages) {
+    print_gauge("process_resident_memory_bytes",
+                "Resident memory size, in bytes.",
+                resident_pages * static_cast<uint64_t>(::sysconf(_SC_PAGESIZE)));
+  }
+#endif
+#ifdef __APPLE__
+  const auto peak_rss = static_cast<uint64_t>(usage.ru_maxrss);
+#else
+  const auto peak_rss = static_cast<uint64_t>(usage.ru_maxrss) * 1024u;
+#endif
+  print_gauge("anvill_peak_resident_memory_bytes",
+              "Peak resident memory size, in bytes.", peak_rss);
+}
+
+MetricsServer::~MetricsServer(void) {
+  stopping = true;
+  if (thread.joinable()) {
+    thread.join();
+  }
+  if (listen_fd >= 0) {
+    ::close(listen_fd);
+  }
+}
+
+// Start listening on `addr`, and serving the metrics.
+bool MetricsServer::Start(const std::string &addr) {
+  const auto colon = addr.rfind(':');
+  if (colon == std::string::npos) {
+    LOG(ERROR) << "Expected '--metrics_addr' to be 'host:port' or ':port', "
+               << "but got '" << addr << "'";
+    return false;
+  }
+
+  // IPv6 hosts are bracketed, e.g. `[::1]:9464`.
+  auto host = addr.substr(0, colon);
+  const auto port = addr.substr(colon + 1u);
+  if (host.size() >= 2u && host.front() == '[' && host.back() == ']') {
+    host = host.substr(1u, host.size() - 2u);
+  }
+
+  struct addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+  struct addrinfo *infos = nullptr;
+  if (auto err = ::getaddrinfo(host.empty() ? nullptr : host.c_str(),
+                               port.c_str(), &hints, &infos)) {
+    LOG(ERROR) << "Unable to resolve --metrics_addr '" << addr
+               << "': " << ::gai_strerror(err);
+    return false;
+  }
+
+  for (auto info = infos; info && listen_fd < 0; info = info->ai_next) {
+    listen_fd = ::socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+    if (listen_fd < 0) {
+      continue;
+    }
+    const int yes = 1;
+    (void) ::setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    if (::bind(listen_fd, info->ai_addr, info->ai_addrlen) ||
+        ::listen(listen_fd, 16)) {
+      ::close(listen_fd);
+      listen_fd = -1;
+    }
+  }
+  ::freeaddrinfo(infos);
+
+  if (listen_fd < 0) {
+    LOG(ERROR) << "Unable to listen on --metrics_addr '" << addr
+               << "': " << std::strerror(errno);
+    return false;
+  }
+
+  LOG(INFO) << "Serving metrics on 'http://" << addr << "/metrics'";
+  thread = std::thread([this](void) { Serve(); });
+  return true;
+}
+
+// Accept connections, and respond to each of them, until stopped.
+//
+// Scrapes are rare and quick, so they're answered one at a time. Polling with a
+// timeout lets the destructor stop the thread without having to wake up a
+// blocked `accept`.
+void MetricsServer::Serve(void) {
+  while (!stopping) {
+    struct pollfd pfd = {};
+    pfd.fd = listen_fd;
+    pfd.events = POLLIN;
+    if (::poll(&pfd, 1, 100) <= 0) {
+      continue;
+    }
+
+    const auto fd = ::accept(listen_fd, nullptr, nullptr);
+    if (fd < 0) {
+      continue;
+    }
+
+    // A client that doesn't send its request mustn't hold up the next scrape
+    // forever.
+    struct timeval timeout = {};
+    timeout.tv_sec = 5;
+    (void) ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                        sizeof(timeout));
+    (void) ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout,
+                        sizeof(timeout));
+    Respond(fd);
+    ::close(fd);
+  }
+}
+
+// Read an HTTP request from `fd`, and respond to it with the metrics if it
+// asks for them.
+void MetricsServer::Respond(int fd) {
+  std::string request;
+  char buf[1024];
+  while (request.find("\r\n\r\n") == std::string::npos &&
+         request.size() < 8192u) {
+    const auto num_read = ::read(fd, buf, sizeof(buf));
+    if (num_read < 0 && errno == EINTR) {
+      continue;
+    } else if (num_read <= 0) {
+      break;
+    }
+    request.append(buf, static_cast<size_t>(num_read));
+  }
+
+  // The request line looks like `GET /metrics HTTP/1.1`.
+  llvm::StringRef line(request);
+  line = line.take_until([](char ch) { return ch == '\r' || ch == '\n'; });
+  llvm::SmallVector<llvm::StringRef, 3> parts;
+  line.split(parts, ' ', 2, false);
+  const auto path =
+      parts.size() >= 2u ? parts[1].take_until([](char ch) { return ch == '?'; })
+                         : llvm::StringRef();
+
+  std::string body;
+  llvm::raw_string_ostream body_os(body);
+  const char *status = "200 OK";
+  const char *content_type = "text/plain; version=0.0.4; charset=utf-8";
+  if (parts.empty() || (parts[0] != "GET" && parts[0] != "HEAD")) {
+    status = "405 Method Not Allowed";
+    content_type = "text/plain; charset=utf-8";
+    body_os << "Only GET is supported\n";
+  } else if (path != "/metrics") {
+    status = "404 Not Found";
+    content_type = "text/plain; charset=utf-8";
+    body_os << "Metrics are served at /metrics\n";
+  } else {
+    PrintMetrics(body_os, stats, latencies);
+  }
+  body_os.flush();
+
+  std::string response;
+  llvm::raw_string_ostream os(response);
+  os << "HTTP/1.1 " << status << "\r\n"
+     << "Content-Type: " << content_type << "\r\n"
+     << "Content-Length: " << body.size() << "\r\n"
+     << "Connection: close\r\n\r\n";
+  if (parts.empty() || parts[0] != "HEAD") {
+    os << body;
+  }
+  os.flush();
+
+  // A scraper may hang up early, which mustn't kill the process with a
+  // `SIGPIPE`.
+  llvm::StringRef data(response);
+  while (!data.empty()) {
+#ifdef MSG_NOSIGNAL
+    const auto written = ::send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+#else
+    const auto written = ::send(fd, data.data(), data.size(), 0);
+#endif
+    if (written < 0 && errno == EINTR) {
+      continue;
+    } else if (written <= 0) {
+      return;
+    }
+    data = data.drop_front(static_cast<size_t>(written));
+  }
+}
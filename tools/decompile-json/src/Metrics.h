@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace anvill {
+struct TraceEvent;
+}  // namespace anvill
+namespace llvm {
+class raw_ostream;
+}  // namespace llvm
+
+struct RunStats;
+
+// Upper bounds, in seconds, of the buckets of the latency histograms served
+// by `--metrics_addr`. There is an implicit last bucket of `+Inf`.
+static constexpr unsigned kNumLatencyBuckets = 7u;
+
+// Latency histograms of trace events, for `--metrics_addr`. These observe the
+// events of a tracer, so that the latency of each pass is aggregated as the
+// events happen, rather than being kept event by event.
+class LatencyHistograms {
+ public:
+  // Add `event` into the histogram of its category and name.
+  void Observe(const anvill::TraceEvent &event);
+
+  // Print the histograms in the Prometheus text format.
+  void Print(llvm::raw_ostream &os) const;
+
+ private:
+  struct Histogram {
+    uint64_t counts[kNumLatencyBuckets + 1u] = {};
+    uint64_t sum_us{0u};
+  };
+
+  // The maps are transparent, so that looking up the name of an event doesn't
+  // copy it.
+  using HistogramMap = std::map<std::string, Histogram, std::less<>>;
+
+  mutable std::mutex lock;
+  std::map<std::string, HistogramMap, std::less<>> histograms;
+};
+
+// Serves the metrics of this process over HTTP, on `--metrics_addr`, from a
+// thread of its own, until destroyed.
+class MetricsServer {
+ public:
+  MetricsServer(const RunStats &stats_, const LatencyHistograms &latencies_)
+      : stats(stats_),
+        latencies(latencies_) {}
+
+  ~MetricsServer(void);
+
+  // Start listening on `addr`, which is `host:port` or `:port`, and serving
+  // the metrics. Returns `false` if the address can't be listened on.
+  bool Start(const std::string &addr);
+
+ private:
+  MetricsServer(const MetricsServer &) = delete;
+  MetricsServer &operator=(const MetricsServer &) = delete;
+
+  void Serve(void);
+  void Respond(int fd);
+
+  const RunStats &stats;
+  const LatencyHistograms &latencies;
+  int listen_fd{-1};
+  std::atomic<bool> stopping{false};
+  std::thread thread;
+};
@@ -0,0 +1,279 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Queue.h"
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/ADT/Twine.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <remill/BC/Compat/Error.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "Decompile.h"
+#include "Stats.h"
+
+DEFINE_string(queue_dir, "",
+              "Path to a job queue made by anvill-lift-coordinator with "
+              "--queue_dir, usually on storage shared by several machines. "
+              "Partitions of the queued spec are claimed from the queue and "
+              "lifted one at a time, and their bitcode is saved back into "
+              "the queue, until no partitions are left.");
+
+DEFINE_uint32(queue_poll_ms, 0u,
+              "Number of milliseconds to wait between looks at --queue_dir "
+              "when no partitions are left to claim. Zero means to stop as "
+              "soon as no partitions are left; otherwise, this stops once "
+              "the coordinator closes the queue.");
+
+DECLARE_string(lift_functions);
+DECLARE_bool(lift_variables);
+DECLARE_uint32(jobs);
+DECLARE_string(ir_out);
+DECLARE_string(bc_out);
+DECLARE_string(split_out_dir);
+DECLARE_string(entity_map_out);
+DECLARE_string(spec_format);
+DECLARE_string(binary_spec_out);
+DECLARE_string(checkpoint_dir);
+
+// Returns the path of `name` within the directory `dir` of `--queue_dir`.
+//
+// A queue made by anvill-lift-coordinator is laid out as follows:
+//
+//              spec.bin      The binary spec whose functions are partitioned
+//              partitions/   The function list of each partition
+//              pending/      A JSON job for each unclaimed partition
+//              claimed/      Jobs being lifted by some worker
+//              done/         Jobs whose bitcode is in `shards/`
+//              failed/       Jobs that failed to lift
+//              shards/       The bitcode of each lifted partition
+//              closed        Made once every job is done or has failed
+static std::string QueuePath(llvm::StringRef dir,
+                             const llvm::Twine &name = "") {
+  llvm::SmallString<128> path(FLAGS_queue_dir);
+  llvm::sys::path::append(path, dir, name);
+  return path.str().str();
+}
+
+// Try to claim the job `name` in the queue. Renaming is atomic, so only one
+// of the workers sharing the queue can claim any given job.
+static bool ClaimQueuedJob(const std::string &name) {
+  const auto claimed = QueuePath("claimed", name);
+  if (llvm::sys::fs::rename(QueuePath("pending", name), claimed)) {
+    return false;
+  }
+
+  // The coordinator puts back jobs that have been claimed for too long, so
+  // the time of the claim is recorded on the job.
+  int fd = -1;
+  if (!llvm::sys::fs::openFileForWrite(claimed, fd,
+                                       llvm::sys::fs::CD_OpenExisting,
+                                       llvm::sys::fs::OF_Append)) {
+    (void) llvm::sys::fs::setLastAccessAndModificationTime(
+        fd, std::chrono::time_point_cast<std::chrono::nanoseconds>(
+                std::chrono::system_clock::now()));
+    ::close(fd);
+  }
+  return true;
+}
+
+// Lift the partition of the job `name` that was claimed from the queue, and
+// save its bitcode into the queue's shards.
+static bool LiftQueuedJob(const std::string &name,
+                          const anvill::OptimizationPipeline &pipeline,
+                          anvill::Tracer *tracer, RunStats *stats,
+                          const anvill::FunctionCache *cache,
+                          DecompileWorker &worker) {
+  const auto claimed = QueuePath("claimed", name);
+  auto maybe_buff = llvm::MemoryBuffer::getFile(claimed);
+  if (remill::IsError(maybe_buff)) {
+    LOG(ERROR) << "Unable to read queued job '" << claimed
+               << "': " << remill::GetErrorString(maybe_buff);
+    return false;
+  }
+
+  auto maybe_json =
+      llvm::json::parse(remill::GetReference(maybe_buff)->getBuffer());
+  if (remill::IsError(maybe_json)) {
+    LOG(ERROR) << "Unable to parse queued job '" << claimed
+               << "': " << remill::GetErrorString(maybe_json);
+    return false;
+  }
+
+  auto &json = remill::GetReference(maybe_json);
+  const auto obj = json.getAsObject();
+  const auto maybe_functions = obj ? obj->getString("functions") : llvm::None;
+  if (!maybe_functions) {
+    LOG(ERROR) << "Queued job '" << claimed
+               << "' must be an object with a 'functions' path.";
+    return false;
+  }
+
+  // Jobs are lifted one at a time, so the options that select what to lift can
+  // be set per job.
+  FLAGS_lift_functions = QueuePath(*maybe_functions);
+  FLAGS_lift_variables = obj->getBoolean("lift_variables").getValueOr(false);
+
+  // The bitcode is saved under a unique name, and then renamed, so that the
+  // coordinator never sees a partially written shard, even if a job that
+  // took too long is also handed to another worker.
+  const auto stem = llvm::sys::path::stem(name);
+  const auto shard = QueuePath("shards", stem + ".bc");
+  llvm::SmallString<128> tmp_shard;
+  llvm::sys::fs::createUniquePath(shard + ".%%%%%%%%.tmp", tmp_shard, false);
+
+  SpecJob job;
+  job.spec = QueuePath("spec.bin");
+  job.bc_out = tmp_shard.str().str();
+
+  if (!DecompileSpec(job, pipeline, tracer, stats, cache, nullptr, worker,
+                     FLAGS_jobs)) {
+    llvm::sys::fs::remove(job.bc_out);
+    return false;
+  }
+
+  if (auto ec = llvm::sys::fs::rename(job.bc_out, shard)) {
+    LOG(ERROR) << "Unable to rename '" << job.bc_out << "' to '" << shard
+               << "': " << ec.message();
+    llvm::sys::fs::remove(job.bc_out);
+    return false;
+  }
+  return true;
+}
+
+// Claim and lift the jobs in `--queue_dir`, until none are left, or until
+// the queue is closed if `--queue_poll_ms` is non-zero. Returns the number
+// of jobs that failed to lift.
+unsigned DecompileQueue(const anvill::OptimizationPipeline &pipeline,
+                        anvill::Tracer *tracer, RunStats *stats,
+                        const anvill::FunctionCache *cache) {
+  DecompileWorker worker;
+  unsigned num_jobs = 0u;
+  unsigned num_failed = 0u;
+  std::vector<std::string> names;
+
+  for (;;) {
+    names.clear();
+    std::error_code ec;
+    for (llvm::sys::fs::directory_iterator it(QueuePath("pending"), ec), end;
+         !ec && it != end; it.increment(ec)) {
+      names.push_back(llvm::sys::path::filename(it->path()).str());
+    }
+
+    // A polling worker may be started before the coordinator has made the
+    // queue.
+    if (ec && (!FLAGS_queue_poll_ms ||
+               ec != std::errc::no_such_file_or_directory)) {
+      LOG(ERROR) << "Unable to list the jobs in '" << QueuePath("pending")
+                 << "': " << ec.message();
+      return num_failed + 1u;
+    }
+
+    // Other workers claim jobs from the same queue, so this is only an upper
+    // bound on the number of jobs left.
+    if (stats) {
+      stats->queued_jobs = static_cast<uint64_t>(
+          std::count_if(names.begin(), names.end(), [](const std::string &n) {
+            return llvm::StringRef(n).endswith(".json");
+          }));
+    }
+
+    auto claimed_any = false;
+    for (const auto &name : names) {
+      if (!llvm::StringRef(name).endswith(".json") || !ClaimQueuedJob(name)) {
+        continue;
+      }
+
+      if (stats && stats->queued_jobs) {
+        --stats->queued_jobs;
+      }
+
+      claimed_any = true;
+      ++num_jobs;
+      const auto ok =
+          LiftQueuedJob(name, pipeline, tracer, stats, cache, worker);
+      LOG_IF(ERROR, !ok) << "Failed to lift queued job '" << name << "'";
+      num_failed += ok ? 0u : 1u;
+
+      if (stats) {
+        ++stats->num_specs;
+        stats->num_failed_specs += ok ? 0u : 1u;
+      }
+
+      // If the job took too long and was put back, then it may have been
+      // renamed already by another worker.
+      if (auto rename_ec = llvm::sys::fs::rename(
+              QueuePath("claimed", name),
+              QueuePath(ok ? "done" : "failed", name))) {
+        LOG(WARNING) << "Unable to finish queued job '" << name
+                     << "': " << rename_ec.message();
+      }
+    }
+
+    if (claimed_any) {
+      continue;
+    } else if (!FLAGS_queue_poll_ms || llvm::sys::fs::exists(
+                                           QueuePath("closed"))) {
+      break;
+    }
+
+    std::this_thread::sleep_for(
+        std::chrono::milliseconds(FLAGS_queue_poll_ms));
+  }
+
+  LOG(INFO) << "Lifted " << (num_jobs - num_failed) << " of " << num_jobs
+            << " jobs claimed from the queue.";
+  return num_failed;
+}
+
+// Returns `false`, after logging why, if options that don't apply to
+// `--queue_dir` are given with it. Otherwise, specs are read as the binary
+// specs that the queue holds.
+bool CheckQueueFlags(void) {
+  if (FLAGS_queue_dir.empty()) {
+    return true;
+  }
+
+  if (!FLAGS_binary_spec_out.empty() || !FLAGS_ir_out.empty() ||
+      !FLAGS_bc_out.empty() || !FLAGS_split_out_dir.empty() ||
+      !FLAGS_entity_map_out.empty() || !FLAGS_checkpoint_dir.empty() ||
+      !FLAGS_lift_functions.empty()) {
+    LOG(ERROR) << "The --binary_spec_out, --ir_out, --bc_out, "
+               << "--split_out_dir, --entity_map_out, --checkpoint_dir, "
+               << "and --lift_functions options don't apply to "
+               << "--queue_dir; the queue says what to lift and where to "
+               << "save it.";
+    return false;
+  }
+
+  // The coordinator always queues a binary spec.
+  FLAGS_spec_format = "binary";
+  return true;
+}
@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+namespace anvill {
+class FunctionCache;
+class OptimizationPipeline;
+class Tracer;
+}  // namespace anvill
+
+struct RunStats;
+
+// Claim and lift the jobs in `--queue_dir`, until none are left, or until
+// the queue is closed if `--queue_poll_ms` is non-zero. Returns the number
+// of jobs that failed to lift.
+unsigned DecompileQueue(const anvill::OptimizationPipeline &pipeline,
+                        anvill::Tracer *tracer, RunStats *stats,
+                        const anvill::FunctionCache *cache);
+
+// Returns `false`, after logging why, if options that don't apply to
+// `--queue_dir` are given with it. Otherwise, specs are read as the binary
+// specs that the queue holds.
+bool CheckQueueFlags(void);
@@ -0,0 +1,584 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Serve.h"
+
+#include <anvill/BinarySpec.h>
+#include <anvill/Decl.h>
+#include <anvill/FunctionCache.h>
+#include <anvill/JumpTables.h>
+#include <anvill/Lifters/EntityLifter.h>
+#include <anvill/Lifters/Options.h>
+#include <anvill/Optimize.h>
+#include <anvill/Program.h>
+#include <anvill/Providers/IControlFlowProvider.h>
+#include <anvill/Providers/MemoryProvider.h>
+#include <anvill/Providers/TypeProvider.h>
+#include <anvill/Trace.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+#include <remill/Arch/Arch.h>
+#include <remill/BC/Compat/Error.h>
+#include <remill/BC/Util.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <magic_enum.hpp>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+
+#include "Allocator.h"
+#include "Lift.h"
+#include "Spec.h"
+#include "Stats.h"
+
+DEFINE_string(serve, "",
+              "Path of a Unix domain socket on which to serve requests to "
+              "lift single functions of --spec. The spec is parsed, and the "
+              "instruction semantics are loaded, only once. Clients send "
+              "JSON-RPC 2.0 requests, one per line, and get one response per "
+              "line. The 'lift_function' method takes the 'address' of a "
+              "function in the spec, or a 'function' declaration to use "
+              "instead, and an optional 'format' of 'bitcode' or 'ir', and "
+              "returns a module holding just that optimized function. The "
+              "'shutdown' method stops the server.");
+
+DECLARE_string(spec);
+DECLARE_bool(trusted_spec);
+DECLARE_bool(speculate_jump_tables);
+DECLARE_string(ir_out);
+DECLARE_string(bc_out);
+DECLARE_string(split_out_dir);
+DECLARE_string(entity_map_out);
+DECLARE_string(binary_spec_out);
+DECLARE_string(checkpoint_dir);
+
+// JSON-RPC 2.0 error codes reported by `--serve`.
+static constexpr int64_t kRPCParseError = -32700;
+static constexpr int64_t kRPCInvalidRequest = -32600;
+static constexpr int64_t kRPCMethodNotFound = -32601;
+static constexpr int64_t kRPCInvalidParams = -32602;
+static constexpr int64_t kRPCLiftError = -32000;
+
+namespace {
+
+// An error to report back to a client of `--serve`.
+struct ServeError {
+  int64_t code{0};
+  std::string message;
+};
+
+// The state that `--serve` keeps resident across requests: the parsed spec,
+// the architecture and instruction semantics that it was parsed with, and
+// the code of the functions lifted by earlier requests.
+//
+// The declarations of the program refer to types in `context`, so unlike a
+// `DecompileWorker`, the context is never replaced.
+struct SpecServer {
+  inline SpecServer(const anvill::OptimizationPipeline &pipeline_,
+                    anvill::Tracer *tracer_, RunStats *stats_,
+                    const anvill::FunctionCache *cache_)
+      : pipeline(pipeline_),
+        tracer(tracer_),
+        stats(stats_),
+        cache(cache_) {}
+
+  const anvill::OptimizationPipeline &pipeline;
+  anvill::Tracer *const tracer;
+  RunStats *const stats;
+  const anvill::FunctionCache *const cache;
+
+  llvm::LLVMContext context;
+  std::unique_ptr<const remill::Arch> arch;
+
+  // The module into which the spec is parsed, and into which functions are
+  // lifted before they're moved into modules of their own.
+  std::unique_ptr<llvm::Module> spec_module;
+
+  anvill::Program program;
+  std::shared_ptr<anvill::MemoryProvider> memory;
+  std::shared_ptr<anvill::TypeProvider> types;
+
+  // The lifter refers to its options, so they're declared first.
+  std::unique_ptr<anvill::LifterOptions> options;
+  std::optional<anvill::EntityLifter> lifter;
+
+  // Sorted addresses of the functions in `program`, to bound the bytes of a
+  // function when computing its key in the function cache.
+  std::vector<uint64_t> func_addresses;
+
+  // The bitcode of every function lifted so far, by function cache key.
+  std::unordered_map<std::string, std::string> bitcode;
+};
+
+}  // namespace
+
+// Parse the spec of `--spec` into `server`.
+static bool LoadServedSpec(SpecServer &server, const LoadedSpec &spec) {
+  auto &context = server.context;
+  server.arch = BuildArch(context, spec.arch_str, spec.os_str);
+  if (!server.arch) {
+    return false;
+  }
+
+  server.spec_module.reset(new llvm::Module("spec", context));
+  server.memory =
+      anvill::MemoryProvider::CreateProgramMemoryProvider(server.program);
+  server.types =
+      anvill::TypeProvider::CreateProgramTypeProvider(context, server.program);
+
+  auto ctrl_flow_provider_res =
+      anvill::IControlFlowProvider::Create(server.program);
+  if (!ctrl_flow_provider_res.Succeeded()) {
+    std::cerr << "Failed to create the control flow provider: "
+              << magic_enum::enum_name(ctrl_flow_provider_res.TakeError())
+              << "\n";
+    return false;
+  }
+
+  server.options.reset(new anvill::LifterOptions(
+      server.arch.get(), *server.spec_module,
+      ctrl_flow_provider_res.TakeValue()));
+  ConfigureLifterOptions(*server.options, server.tracer);
+
+  // As in `LiftSpec`, the semantics have to be loaded before the spec can be
+  // parsed.
+  {
+    MemoryScope scope(kMemorySemantics);
+    server.lifter.emplace(*server.options, server.memory, server.types);
+  }
+
+  server.program.TrustDecls(FLAGS_trusted_spec);
+  if (!spec.parse_spec(server.arch.get(), context, server.program,
+                       *server.spec_module)) {
+    return false;
+  }
+
+  if (FLAGS_speculate_jump_tables) {
+    (void) anvill::SpeculateJumpTableTargets(server.program,
+                                             server.arch.get());
+  }
+
+  server.program.Freeze(server.spec_module->getDataLayout());
+  server.program.ForEachFunction([&](const anvill::FunctionDecl *decl) {
+    server.func_addresses.push_back(decl->address);
+    return true;
+  });
+  std::sort(server.func_addresses.begin(), server.func_addresses.end());
+  return true;
+}
+
+// Lift and optimize a single function into its own module, and return the
+// module's bitcode. The function is described by `decl`, which may differ
+// from the declaration in the spec. `cached` is set if the code comes from
+// an earlier request or from the function cache.
+static bool LiftServedFunction(SpecServer &server,
+                               const anvill::FunctionDecl &decl,
+                               std::string &bitcode, bool &cached,
+                               ServeError &error) {
+  auto &context = server.context;
+  auto next_addr =
+      std::upper_bound(server.func_addresses.begin(),
+                       server.func_addresses.end(), decl.address);
+  const auto key = anvill::FunctionCache::Key(
+      server.program, decl,
+      next_addr == server.func_addresses.end()
+          ? std::numeric_limits<uint64_t>::max()
+          : *next_addr,
+      *server.options, server.pipeline);
+
+  if (auto it = server.bitcode.find(key); it != server.bitcode.end()) {
+    bitcode = it->second;
+    cached = true;
+    if (server.stats) {
+      ++server.stats->num_functions_cached;
+    }
+    return true;
+  }
+
+  cached = false;
+  std::unique_ptr<llvm::Module> module;
+  if (server.cache) {
+    auto maybe_cached = server.cache->Load(
+        key, context, [&](uint64_t address) {
+          return EntityPrototypeHash(server.program,
+                                     server.spec_module->getDataLayout(),
+                                     address);
+        });
+    if (remill::IsError(maybe_cached)) {
+      LOG(WARNING) << remill::GetErrorString(maybe_cached);
+
+    } else if (auto &cached_module = remill::GetReference(maybe_cached);
+               cached_module) {
+      module = std::move(cached_module);
+      cached = true;
+    }
+  }
+
+  if (module) {
+    if (server.stats) {
+      ++server.stats->num_functions_cached;
+    }
+
+  } else {
+    PhaseTimer timer(server.stats, kPhaseLift);
+    module = server.lifter->LiftAndOptimizeFunction(decl, server.pipeline);
+    if (server.stats) {
+      ++server.stats->num_functions_lifted;
+    }
+    if (!module) {
+      std::stringstream es;
+      es << "Unable to lift function at address " << std::hex
+         << decl.address;
+      error.code = kRPCLiftError;
+      error.message = es.str();
+      return false;
+    }
+  }
+
+  // The lifted function is the first one defined in its module.
+  llvm::Function *func = nullptr;
+  for (auto &module_func : *module) {
+    if (!module_func.isDeclaration()) {
+      func = &module_func;
+      break;
+    }
+  }
+
+  if (!cached && func && server.cache) {
+    // The lifted function's module has copies of what it refers to, so those
+    // are mapped back to the lifter's entities by name.
+    auto address_of = [&](llvm::GlobalValue &gv) -> std::optional<uint64_t> {
+      if (auto entity = server.spec_module->getNamedValue(gv.getName())) {
+        return server.lifter->AddressOfEntity(entity);
+      }
+      return std::nullopt;
+    };
+    auto prototype_of = [&](uint64_t address) {
+      return EntityPrototypeHash(
+          server.program, server.spec_module->getDataLayout(), address);
+    };
+    if (auto err = server.cache->Store(key, *func, address_of, prototype_of);
+        remill::IsError(err)) {
+      LOG(WARNING) << "Unable to cache function " << func->getName().str()
+                   << ": " << remill::GetErrorString(err);
+    }
+  }
+
+  if (func) {
+    server.program.ForEachNameOfAddress(
+        decl.address,
+        [=](const std::string &name, const anvill::FunctionDecl *,
+            const anvill::GlobalVarDecl *) {
+          func->setName(name);
+          return false;
+        });
+  }
+
+  if (!remill::VerifyModule(module.get())) {
+    error.code = kRPCLiftError;
+    error.message = "Lifted module failed to verify";
+    return false;
+  }
+
+  bitcode.clear();
+  llvm::raw_string_ostream os(bitcode);
+  llvm::WriteBitcodeToFile(*module, os);
+  os.flush();
+  server.bitcode.emplace(key, bitcode);
+  return true;
+}
+
+// Handle a `lift_function` request. Its parameters are either the `address`
+// of a function in the spec, or a `function` declaration in the format of
+// the spec's `functions` to lift instead, and the `format` of the result:
+// hex-encoded `bitcode` (the default), or textual `ir`.
+static bool ServeLiftFunction(SpecServer &server,
+                              const llvm::json::Object &params,
+                              llvm::json::Object &result, ServeError &error) {
+  anvill::FunctionDecl decl;
+  if (auto func_obj = params.getObject("function")) {
+    anvill::BinarySpec::Function func;
+    auto func_copy = *func_obj;
+    if (!ParseFunction(&func_copy, func, {}) ||
+        !MakeFunctionDecl(server.arch.get(), server.context, func,
+                          *server.spec_module, decl)) {
+      error.code = kRPCInvalidParams;
+      error.message = "Invalid 'function' declaration";
+      return false;
+    }
+
+  } else if (auto maybe_ea = params.getInteger("address")) {
+    auto found = server.program.FindFunction(static_cast<uint64_t>(*maybe_ea));
+    if (!found) {
+      error.code = kRPCInvalidParams;
+      error.message = "No function is declared at 'address'";
+      return false;
+    }
+    decl = *found;
+
+  } else {
+    error.code = kRPCInvalidParams;
+    error.message = "Expected an 'address' or a 'function' parameter";
+    return false;
+  }
+
+  const auto format = params.getString("format").getValueOr("bitcode");
+  if (format != "bitcode" && format != "ir") {
+    error.code = kRPCInvalidParams;
+    error.message = "The 'format' parameter must be 'bitcode' or 'ir'";
+    return false;
+  }
+
+  std::string bitcode;
+  auto cached = false;
+  ActiveJobScope active_job(server.stats);
+  if (!LiftServedFunction(server, decl, bitcode, cached, error)) {
+    return false;
+  }
+
+  result["address"] = static_cast<int64_t>(decl.address);
+  result["cached"] = cached;
+  if (format == "bitcode") {
+    result["bitcode"] = llvm::toHex(bitcode, true);
+    return true;
+  }
+
+  auto maybe_module = llvm::parseBitcodeFile(
+      llvm::MemoryBufferRef(bitcode, "lifted_code"), server.context);
+  if (remill::IsError(maybe_module)) {
+    error.code = kRPCLiftError;
+    error.message = remill::GetErrorString(maybe_module);
+    return false;
+  }
+
+  std::string ir;
+  llvm::raw_string_ostream os(ir);
+  remill::GetReference(maybe_module)->print(os, nullptr);
+  os.flush();
+  result["ir"] = std::move(ir);
+  return true;
+}
+
+// Handle the JSON-RPC request on `line`, and return the response to send
+// back, if any. `shutdown` is set by a `shutdown` request.
+static std::string HandleServeRequest(SpecServer &server, llvm::StringRef line,
+                                      bool &shutdown) {
+  llvm::json::Object response{{"jsonrpc", "2.0"}, {"id", nullptr}};
+  ServeError error;
+  auto has_id = true;
+
+  auto maybe_request = llvm::json::parse(line);
+  if (remill::IsError(maybe_request)) {
+    error.code = kRPCParseError;
+    error.message = remill::GetErrorString(maybe_request);
+
+  } else if (auto request = remill::GetReference(maybe_request).getAsObject();
+             !request) {
+    error.code = kRPCInvalidRequest;
+    error.message = "Expected a request object";
+
+  } else {
+    if (auto id = request->get("id")) {
+      response["id"] = *id;
+    } else {
+      has_id = false;
+    }
+
+    static const llvm::json::Object kNoParams;
+    auto params = request->getObject("params");
+    if (!params) {
+      params = &kNoParams;
+    }
+
+    llvm::json::Object result;
+    const auto method = request->getString("method");
+    if (!method) {
+      error.code = kRPCInvalidRequest;
+      error.message = "Expected a 'method' string";
+
+    } else if (*method == "lift_function") {
+      if (ServeLiftFunction(server, *params, result, error)) {
+        response["result"] = std::move(result);
+      }
+
+    } else if (*method == "shutdown") {
+      shutdown = true;
+      response["result"] = nullptr;
+
+    } else {
+      error.code = kRPCMethodNotFound;
+      error.message = "Unknown method '" + method->str() + "'";
+    }
+  }
+
+  // Requests without an `id` are notifications, which don't get responses.
+  if (!has_id) {
+    return {};
+  }
+
+  if (error.code) {
+    response["error"] = llvm::json::Object{{"code", error.code},
+                                           {"message", error.message}};
+  }
+
+  std::string out;
+  llvm::raw_string_ostream os(out);
+  os << llvm::json::Value(std::move(response)) << '\n';
+  os.flush();
+  return out;
+}
+
+// Write all of `data` to `fd`.
+static bool WriteAll(int fd, llvm::StringRef data) {
+  while (!data.empty()) {
+    const auto written = ::write(fd, data.data(), data.size());
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    data = data.drop_front(static_cast<size_t>(written));
+  }
+  return true;
+}
+
+// Serve the requests of the client connected on `fd`, one request per line,
+// until the client disconnects or asks the server to shut down.
+static void ServeConnection(SpecServer &server, int fd, bool &shutdown) {
+  std::string pending;
+  char buf[4096];
+  while (!shutdown) {
+    const auto num_read = ::read(fd, buf, sizeof(buf));
+    if (num_read < 0 && errno == EINTR) {
+      continue;
+    } else if (num_read <= 0) {
+      return;
+    }
+
+    pending.append(buf, static_cast<size_t>(num_read));
+    for (auto eol = pending.find('\n'); eol != std::string::npos && !shutdown;
+         eol = pending.find('\n')) {
+      const auto line = llvm::StringRef(pending).take_front(eol).trim();
+      if (!line.empty()) {
+        const auto response = HandleServeRequest(server, line, shutdown);
+        if (!WriteAll(fd, response)) {
+          return;
+        }
+      }
+      pending.erase(0, eol + 1u);
+    }
+  }
+}
+
+// Parse `--spec` once, and then serve requests to lift single functions of it
+// on the Unix domain socket at `--serve`, one client at a time.
+bool ServeSpec(const anvill::OptimizationPipeline &pipeline,
+               anvill::Tracer *tracer, RunStats *stats,
+               const anvill::FunctionCache *cache) {
+  LoadedSpec spec;
+  if (!LoadSpec(FLAGS_spec, spec)) {
+    return false;
+  }
+
+  SpecServer server(pipeline, tracer, stats, cache);
+  if (!LoadServedSpec(server, spec)) {
+    return false;
+  }
+
+  sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  if (FLAGS_serve.size() >= sizeof(addr.sun_path)) {
+    LOG(ERROR) << "The --serve socket path '" << FLAGS_serve
+               << "' is too long";
+    return false;
+  }
+  std::strncpy(addr.sun_path, FLAGS_serve.c_str(), sizeof(addr.sun_path) - 1);
+
+  const auto listen_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listen_fd < 0) {
+    LOG(ERROR) << "Unable to create socket: " << std::strerror(errno);
+    return false;
+  }
+
+  (void) ::unlink(FLAGS_serve.c_str());
+  if (::bind(listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) ||
+      ::listen(listen_fd, 16)) {
+    LOG(ERROR) << "Unable to listen on socket '" << FLAGS_serve
+               << "': " << std::strerror(errno);
+    ::close(listen_fd);
+    return false;
+  }
+
+  LOG(INFO) << "Serving lifts of '" << FLAGS_spec << "' on '" << FLAGS_serve
+            << "'";
+
+  auto ret = true;
+  for (auto shutdown = false; !shutdown;) {
+    const auto fd = ::accept(listen_fd, nullptr, nullptr);
+    if (fd < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      LOG(ERROR) << "Unable to accept a connection on socket '" << FLAGS_serve
+                 << "': " << std::strerror(errno);
+      ret = false;
+      break;
+    }
+    ServeConnection(server, fd, shutdown);
+    ::close(fd);
+  }
+
+  ::close(listen_fd);
+  (void) ::unlink(FLAGS_serve.c_str());
+  return ret;
+}
+
+// Returns `false`, after logging why, if `--serve` is given without the
+// options it needs, or with options that don't apply to it.
+bool CheckServeFlags(void) {
+  if (!FLAGS_serve.empty() &&
+      (FLAGS_spec.empty() || !FLAGS_ir_out.empty() || !FLAGS_bc_out.empty() ||
+       !FLAGS_split_out_dir.empty() || !FLAGS_entity_map_out.empty() ||
+       !FLAGS_binary_spec_out.empty() || !FLAGS_checkpoint_dir.empty())) {
+    LOG(ERROR) << "The --serve option needs --spec, and doesn't apply to "
+               << "--ir_out, --bc_out, --split_out_dir, --entity_map_out, "
+               << "--binary_spec_out, or --checkpoint_dir; lifted functions "
+               << "are sent back to the clients.";
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+namespace anvill {
+class FunctionCache;
+class OptimizationPipeline;
+class Tracer;
+}  // namespace anvill
+
+struct RunStats;
+
+// Parse `--spec` once, and then serve requests to lift single functions of it
+// on the Unix domain socket at `--serve`, one client at a time.
+bool ServeSpec(const anvill::OptimizationPipeline &pipeline,
+               anvill::Tracer *tracer, RunStats *stats,
+               const anvill::FunctionCache *cache);
+
+// Returns `false`, after logging why, if `--serve` is given without the
+// options it needs, or with options that don't apply to it.
+bool CheckServeFlags(void);
@@ -0,0 +1,660 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Shards.h"
+
+#include <anvill/Decl.h>
+#include <anvill/Optimize.h>
+#include <anvill/Program.h>
+#include <anvill/Trace.h>
+#include <anvill/Version.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/SHA1.h>
+#include <llvm/Support/raw_ostream.h>
+#include <remill/Arch/Arch.h>
+#include <remill/BC/Compat/Error.h>
+#ifdef __linux__
+#  include <sched.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <utility>
+
+#include "Lift.h"
+
+DEFINE_uint32(shards_per_job, 4u,
+              "Number of shards per --jobs thread into which the functions of "
+              "a spec are split. Functions are dealt out to shards by their "
+              "estimated cost, largest first, so that the largest functions "
+              "are lifted first, and threads that finish early pick up the "
+              "remaining shards. More shards balance the threads better, but "
+              "each shard parses the spec again.");
+
+DEFINE_uint32(numa_nodes, 1u,
+              "Number of NUMA nodes over which to spread the --jobs threads. "
+              "The functions of a spec are first split by address into one "
+              "run per node, and the shards of each run are lifted by threads "
+              "pinned to that node, if the machine has it, so that the bytes "
+              "and the copy of the spec that each shard reads are local to "
+              "its node. Threads only take shards of other nodes once their "
+              "own node's shards run out. A value of zero uses the NUMA nodes "
+              "of this machine.");
+
+DEFINE_string(checkpoint_dir, "",
+              "Path to a directory in which to checkpoint a long-running "
+              "lift. The spec is split into --checkpoint_shards shards, "
+              "which are lifted by --jobs threads, and each shard is saved "
+              "as bitcode as soon as it has been lifted and optimized. If "
+              "the directory already has checkpoints from an earlier, "
+              "interrupted run on the same spec with the same options, then "
+              "those shards are loaded rather than lifted again. Checkpoints "
+              "are named by a hash of the spec, its image, and the options "
+              "that change the lifted code, so those of other specs, or of "
+              "other options, are ignored.");
+
+DEFINE_uint32(checkpoint_shards, 16u,
+              "Number of shards into which the spec is split when "
+              "checkpointing with --checkpoint_dir. Resuming requires the "
+              "same number of shards.");
+
+DECLARE_uint32(evict_batch_size);
+DECLARE_uint32(jobs);
+DECLARE_bool(verify_determinism);
+DECLARE_string(batch);
+DECLARE_string(roots);
+DECLARE_string(lift_functions);
+
+// Returns a rough estimate of the cost of lifting and optimizing each function
+// of `program`, in order of their addresses. The bytes of a function are
+// bounded by the next function, or by the end of the bytes mapped around it,
+// and each target of an indirect jump inside of those bytes counts as a
+// block of its own.
+static std::vector<uint64_t> EstimateFunctionCosts(
+    const anvill::Program &program) {
+  static constexpr uint64_t kBytesPerBlock = 16u;
+
+  std::vector<uint64_t> func_addresses;
+  program.ForEachFunction([&](const anvill::FunctionDecl *decl) {
+    func_addresses.push_back(decl->address);
+    return true;
+  });
+
+  std::vector<uint64_t> costs(func_addresses.size(), 1u);
+  for (auto i = 0u; i < func_addresses.size(); ++i) {
+    const auto ea = func_addresses[i];
+    const auto bytes = program.FindBytesContaining(ea);
+    auto end_ea = bytes ? bytes.Address() + bytes.Size() : ea;
+    if (i + 1u < func_addresses.size()) {
+      end_ea = std::min(end_ea, func_addresses[i + 1u]);
+    }
+    costs[i] += end_ea > ea ? end_ea - ea : 0u;
+  }
+
+  program.ForEachControlFlowTargets(
+      [&](const anvill::ControlFlowTargetList &targets) {
+        auto it = std::upper_bound(func_addresses.begin(),
+                                   func_addresses.end(), targets.source);
+        if (it != func_addresses.begin()) {
+          const auto i = static_cast<size_t>(it - func_addresses.begin()) - 1u;
+          costs[i] += kBytesPerBlock * targets.destination_list.size();
+        }
+        return true;
+      });
+
+  return costs;
+}
+
+// Returns the CPUs of each NUMA node of this machine, in order of the nodes'
+// numbers. Machines that don't say have no nodes.
+static const std::vector<std::vector<unsigned>> &NumaNodeCPUs(void) {
+  static const auto node_cpus = [](void) {
+    std::vector<std::vector<unsigned>> nodes;
+#ifdef __linux__
+    for (auto node = 0u;; ++node) {
+      std::ifstream cpulist("/sys/devices/system/node/node" +
+                            std::to_string(node) + "/cpulist");
+      std::string list;
+      if (!std::getline(cpulist, list)) {
+        break;
+      }
+
+      // E.g. `0-15,32-47`. Nodes with memory but no CPUs have empty lists.
+      auto &cpus = nodes.emplace_back();
+      llvm::SmallVector<llvm::StringRef, 4> parts;
+      llvm::StringRef(list).trim().split(parts, ',', -1, false);
+      for (auto part : parts) {
+        auto [first_str, last_str] = part.split('-');
+        unsigned first = 0u;
+        unsigned last = 0u;
+        if (first_str.getAsInteger(10, first)) {
+          continue;
+        } else if (last_str.empty()) {
+          last = first;
+        } else if (last_str.getAsInteger(10, last)) {
+          continue;
+        }
+        for (auto cpu = first; cpu <= last; ++cpu) {
+          cpus.push_back(cpu);
+        }
+      }
+    }
+#endif
+    return nodes;
+  }();
+  return node_cpus;
+}
+
+// Returns the number of NUMA nodes over which to spread `num_shards` shards.
+// Shard `i` belongs to node `i % NumShardNodes(num_shards)`.
+unsigned NumShardNodes(unsigned num_shards) {
+  auto num_nodes = FLAGS_numa_nodes;
+  if (!num_nodes) {
+    num_nodes = static_cast<unsigned>(NumaNodeCPUs().size());
+  }
+  return std::max(1u, std::min(num_nodes, num_shards));
+}
+
+// Pin the calling thread to the CPUs of NUMA node `node`, if this machine has
+// more than one node. Memory that the thread then allocates and touches
+// first, e.g. its shard's copy of the program, its LLVM context, and the
+// pages of memory-mapped files that it reads, is then placed on that node.
+// Threads that it starts inherit the pinning.
+static void PinThreadToNumaNode(unsigned node) {
+#ifdef __linux__
+  const auto &nodes = NumaNodeCPUs();
+  if (nodes.size() < 2u || node >= nodes.size() || nodes[node].empty()) {
+    return;
+  }
+
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  for (auto cpu : nodes[node]) {
+    if (cpu < CPU_SETSIZE) {
+      CPU_SET(cpu, &cpus);
+    }
+  }
+  if (::sched_setaffinity(0, sizeof(cpus), &cpus)) {
+    LOG(WARNING) << "Unable to pin thread to NUMA node " << node << ": "
+                 << std::strerror(errno);
+  }
+#else
+  (void) node;
+#endif
+}
+
+// Deal out the functions of `program` to `num_shards` shards, returning the
+// shard of each function, in order of their addresses. Functions are dealt
+// out largest first, each to the shard with the least work so far, or the
+// lowest-numbered one if there's a tie (longest-processing-time-first). The
+// largest functions thus land in the lowest-numbered shards, which are the
+// ones that are started first. Every shard computes the same assignment.
+//
+// If the shards are spread over `num_nodes` NUMA nodes, then the functions,
+// in order of their addresses, are first split into `num_nodes` runs of about
+// the same cost, and each run is dealt out only to the shards of its node.
+// The bytes of neighbouring functions then tend to be read on one node.
+std::vector<unsigned> AssignShards(const anvill::Program &program,
+                                   unsigned num_shards, unsigned num_nodes) {
+  const auto costs = EstimateFunctionCosts(program);
+
+  std::vector<unsigned> nodes(costs.size(), 0u);
+  if (num_nodes > 1u) {
+    uint64_t total_cost = 0u;
+    for (auto cost : costs) {
+      total_cost += cost;
+    }
+
+    // Each function goes to the node that its midpoint falls into.
+    uint64_t cost_so_far = 0u;
+    for (auto i = 0u; i < costs.size(); ++i) {
+      const auto mid = cost_so_far + costs[i] / 2u;
+      nodes[i] = static_cast<unsigned>(
+          std::min<uint64_t>(num_nodes - 1u, (mid * num_nodes) / total_cost));
+      cost_so_far += costs[i];
+    }
+  }
+
+  std::vector<unsigned> order(costs.size());
+  for (auto i = 0u; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [&](unsigned a, unsigned b) {
+    return costs[a] > costs[b];
+  });
+
+  using ShardLoad = std::pair<uint64_t, unsigned>;
+  using ShardLoads = std::priority_queue<ShardLoad, std::vector<ShardLoad>,
+                                         std::greater<ShardLoad>>;
+  std::vector<ShardLoads> loads(num_nodes);
+  for (auto i = 0u; i < num_shards; ++i) {
+    loads[i % num_nodes].emplace(0u, i);
+  }
+
+  std::vector<unsigned> shards(costs.size(), 0u);
+  for (auto i : order) {
+    auto &node_loads = loads[nodes[i]];
+    auto [load, shard] = node_loads.top();
+    node_loads.pop();
+    shards[i] = shard;
+    node_loads.emplace(load + costs[i], shard);
+  }
+  return shards;
+}
+
+// Lift one shard of the spec on its own `llvm::LLVMContext`, and serialize
+// the resulting module into `bitcode`. Bitcode is the only way to move a
+// module between contexts.
+static bool LiftShard(const SpecParser &parse_spec, llvm::StringRef spec_text,
+                      const std::string &arch_str, const std::string &os_str,
+                      const anvill::OptimizationPipeline &pipeline,
+                      anvill::Tracer *tracer, RunStats *stats,
+                      const anvill::FunctionCache *cache,
+                      IncrementalManifest *manifest, unsigned shard_index,
+                      unsigned num_shards,
+                      llvm::SmallVectorImpl<char> &bitcode) {
+  llvm::LLVMContext context;
+  llvm::Module module("lifted_code", context);
+  auto arch = BuildArch(context, arch_str, os_str);
+  if (!arch ||
+      !LiftSpec(parse_spec, spec_text, arch.get(), pipeline, tracer, stats,
+                cache, manifest, module, shard_index, num_shards, nullptr)) {
+    return false;
+  }
+
+  llvm::raw_svector_ostream os(bitcode);
+  llvm::WriteBitcodeToFile(module, os);
+  return true;
+}
+
+// Options that change the lifted code of a shard, besides the spec itself.
+// `--roots` and `--manifest` don't apply with `--checkpoint_dir`, and the
+// function cache only holds functions that would be lifted the same way.
+static const char *const kCheckpointKeyFlags[] = {
+    "arch",
+    "os",
+    "spec_format",
+    "trusted_spec",
+    "speculate_jump_tables",
+    "add_breakpoints",
+    "compact_breakpoints",
+    "discard_value_names",
+    "max_inlined_semantics_size",
+    "max_function_instructions",
+    "max_function_blocks",
+    "max_function_lift_ms",
+    "max_function_ir_size",
+    "max_function_optimize_ms",
+    "instruction_templates",
+    "read_register_init",
+    "live_registers_only",
+    "zero_vector_state",
+    "lift_thunks_as_tail_calls",
+    "registers_on_demand",
+    "lazy_data_initializers",
+    "lower_memory_accesses_to_entities",
+    "dedup_functions",
+    "max_data_initializer_size",
+    "enable_provenance",
+    "lift_variables",
+    "pruned_semantics_dir",
+    "pointer_brighten_gas",
+};
+
+// Hash the contents of the file at `path` into `sha`.
+static bool HashFile(const std::string &path, llvm::SHA1 &sha) {
+  auto maybe_buff = llvm::MemoryBuffer::getFile(path);
+  if (remill::IsError(maybe_buff)) {
+    LOG(ERROR) << "Unable to read '" << path << "' to key its checkpoints: "
+               << remill::GetErrorString(maybe_buff);
+    return false;
+  }
+
+  sha.update(remill::GetReference(maybe_buff)->getBuffer());
+  return true;
+}
+
+// Compute the key of the checkpoints of `spec`, which was read from
+// `spec_path`, into `key`. This is a hash of the bytes of the spec, of its
+// image, and of `--lift_functions`, of the versions of anvill and LLVM, of
+// `pipeline`, and of the options that change the lifted code.
+bool CheckpointKey(const std::string &spec_path, const LoadedSpec &spec,
+                   const anvill::OptimizationPipeline &pipeline,
+                   std::string &key) {
+  llvm::SHA1 sha;
+
+  // A binary spec isn't kept in memory as it was read, so it's read again.
+  if (const auto spec_text = spec.Text(); !spec_text.empty()) {
+    sha.update(spec_text);
+  } else if (!HashFile(spec_path, sha)) {
+    return false;
+  }
+
+  if (!spec.image_path.empty() && !HashFile(spec.image_path, sha)) {
+    return false;
+  }
+
+  if (!FLAGS_lift_functions.empty() && !HashFile(FLAGS_lift_functions, sha)) {
+    return false;
+  }
+
+  const auto commit = anvill::version::GetCommitHash();
+  std::string desc;
+  llvm::raw_string_ostream os(desc);
+  os << "anvill=" << llvm::StringRef(commit.data(), commit.size())
+     << "\nllvm=" << LLVM_VERSION_STRING
+     << "\narch=" << spec.arch_str << "\nos=" << spec.os_str
+     << "\npipeline=" << pipeline.ToString()
+     << "\nmax_iterations=" << pipeline.MaxIterations() << '\n';
+  for (auto name : kCheckpointKeyFlags) {
+    std::string value;
+    if (google::GetCommandLineOption(name, &value)) {
+      os << name << '=' << value << '\n';
+    }
+  }
+
+  sha.update(os.str());
+  key = llvm::toHex(sha.final(), true);
+  return true;
+}
+
+// Returns the path of the checkpoint of shard `shard_index` of `num_shards`
+// in `checkpoint_dir`. Shards spread over NUMA nodes hold different functions
+// than shards that aren't, so the number of nodes is part of the name. So is
+// `checkpoint_key`, so that a run on a different spec, or with different
+// options, never loads the checkpoints of another run.
+static std::string CheckpointPath(const std::string &checkpoint_dir,
+                                  const std::string &checkpoint_key,
+                                  unsigned shard_index, unsigned num_shards) {
+  std::string name = "shard-" + std::to_string(shard_index) + "-of-" +
+                     std::to_string(num_shards);
+  if (const auto num_nodes = NumShardNodes(num_shards); num_nodes > 1u) {
+    name += "-on-" + std::to_string(num_nodes) + "-nodes";
+  }
+  name += "-" + checkpoint_key;
+
+  llvm::SmallString<128> path(checkpoint_dir);
+  llvm::sys::path::append(path, name + ".bc");
+  return path.str().str();
+}
+
+// Load the checkpointed bitcode of a shard from `path` into `bitcode`, if
+// there is one.
+static bool LoadCheckpoint(const std::string &path,
+                           llvm::SmallVectorImpl<char> &bitcode) {
+  auto maybe_buff = llvm::MemoryBuffer::getFile(path);
+  if (remill::IsError(maybe_buff)) {
+    return false;
+  }
+
+  auto &buff = remill::GetReference(maybe_buff);
+  bitcode.assign(buff->getBufferStart(), buff->getBufferEnd());
+  return true;
+}
+
+// Save the bitcode of a shard to `path`. The bitcode is written to a temporary
+// file that is then renamed, so that a run that is killed part way through
+// writing a checkpoint doesn't leave a truncated checkpoint behind.
+static bool SaveCheckpoint(const std::string &path,
+                           const llvm::SmallVectorImpl<char> &bitcode) {
+  ANVILL_TRACE_ZONE("SaveCheckpoint");
+  const auto temp_path = path + ".tmp";
+  {
+    std::error_code ec;
+    llvm::raw_fd_ostream os(temp_path, ec, llvm::sys::fs::OF_None);
+    if (ec) {
+      LOG(ERROR) << "Unable to open checkpoint file '" << temp_path
+                 << "': " << ec.message();
+      return false;
+    }
+    os.write(bitcode.data(), bitcode.size());
+  }
+
+  if (auto ec = llvm::sys::fs::rename(temp_path, path)) {
+    LOG(ERROR) << "Unable to save checkpoint file '" << path
+               << "': " << ec.message();
+    return false;
+  }
+
+  return true;
+}
+
+// Lift the spec as `num_shards` shards using up to `num_threads` threads, then
+// link the shards together into `module`. If `checkpoint_dir` isn't empty,
+// then each shard is saved there as soon as it is lifted and optimized, and
+// shards that were saved by an earlier run with the same `checkpoint_key` are
+// loaded rather than lifted again. If the shards are spread over NUMA nodes, then thread `t` is pinned
+// to node `t % num_nodes`, and lifts that node's shards before helping out
+// with those of the other nodes.
+bool LiftSpecInParallel(const SpecParser &parse_spec, llvm::StringRef spec_text,
+                        const std::string &arch_str, const std::string &os_str,
+                        const anvill::OptimizationPipeline &pipeline,
+                        anvill::Tracer *tracer, RunStats *stats,
+                        const anvill::FunctionCache *cache,
+                        IncrementalManifest *manifest,
+                        const std::string &checkpoint_dir,
+                        const std::string &checkpoint_key,
+                        llvm::Module &module, unsigned num_shards,
+                        unsigned num_threads) {
+  std::vector<llvm::SmallVector<char, 0>> shard_bitcodes(num_shards);
+  std::unique_ptr<bool[]> shard_succeeded(new bool[num_shards]());
+  std::unique_ptr<bool[]> shard_done(new bool[num_shards]());
+  std::mutex shard_done_lock;
+  std::condition_variable shard_done_cv;
+  std::atomic<unsigned> num_resumed{0u};
+  std::vector<std::thread> threads;
+
+  // The shards of node `n` are `n`, `n + num_nodes`, `n + 2 * num_nodes`, etc.
+  // and `next_shards[n]` is the next of them to be lifted.
+  const auto num_nodes = NumShardNodes(num_shards);
+  std::unique_ptr<std::atomic<unsigned>[]> next_shards(
+      new std::atomic<unsigned>[num_nodes]);
+  for (auto n = 0u; n < num_nodes; ++n) {
+    next_shards[n] = n;
+  }
+
+  // Marks shard `i` as lifted (or loaded), so that it can be linked in.
+  auto finish_shard = [&](unsigned i) {
+    std::lock_guard<std::mutex> locker(shard_done_lock);
+    shard_done[i] = true;
+    shard_done_cv.notify_all();
+  };
+
+  num_threads = std::min(num_threads, num_shards);
+  threads.reserve(num_threads);
+
+  for (auto t = 0u; t < num_threads; ++t) {
+    threads.emplace_back([&, t](void) {
+      const auto home_node = t % num_nodes;
+      if (num_nodes > 1u) {
+        PinThreadToNumaNode(home_node);
+      }
+
+      // Returns the next shard to lift, preferring those of `home_node`, or
+      // `num_shards` if there are none left.
+      auto next_shard = [&](void) {
+        for (auto n = 0u; n < num_nodes; ++n) {
+          auto &next = next_shards[(home_node + n) % num_nodes];
+          if (auto i = next.fetch_add(num_nodes); i < num_shards) {
+            return i;
+          }
+        }
+        return num_shards;
+      };
+
+      for (auto i = next_shard(); i < num_shards; i = next_shard()) {
+        std::string checkpoint_path;
+        if (!checkpoint_dir.empty()) {
+          checkpoint_path =
+              CheckpointPath(checkpoint_dir, checkpoint_key, i, num_shards);
+          if (LoadCheckpoint(checkpoint_path, shard_bitcodes[i])) {
+            shard_succeeded[i] = true;
+            ++num_resumed;
+            finish_shard(i);
+            continue;
+          }
+        }
+
+        shard_succeeded[i] = LiftShard(parse_spec, spec_text, arch_str, os_str,
+                                       pipeline, tracer, stats, cache,
+                                       manifest, i, num_shards,
+                                       shard_bitcodes[i]);
+
+        // A shard that can't be checkpointed is still linked in; it'll just be
+        // lifted again if this run is resumed.
+        if (shard_succeeded[i] && !checkpoint_path.empty()) {
+          (void) SaveCheckpoint(checkpoint_path, shard_bitcodes[i]);
+        }
+        finish_shard(i);
+      }
+    });
+  }
+
+  // Shards are linked on this thread, in order, as soon as they are lifted,
+  // which overlaps linking with the lifting of later shards, and frees the
+  // bitcode of each shard early. Shards may each contain identical definitions
+  // of things that aren't functions in the spec, e.g. data aliases or
+  // breakpoint functions, so we let later shards override earlier ones.
+  llvm::Linker linker(module);
+  auto link_shard = [&](unsigned i) -> bool {
+    {
+      std::unique_lock<std::mutex> locker(shard_done_lock);
+      shard_done_cv.wait(locker, [&] { return shard_done[i]; });
+    }
+
+    if (!shard_succeeded[i]) {
+      LOG(ERROR) << "Failed to lift shard " << i << " of " << num_shards;
+      return false;
+    }
+
+    llvm::MemoryBufferRef shard_buff(
+        llvm::StringRef(shard_bitcodes[i].data(), shard_bitcodes[i].size()),
+        "lifted_code");
+
+    auto maybe_shard_module = llvm::parseBitcodeFile(shard_buff,
+                                                     module.getContext());
+    if (remill::IsError(maybe_shard_module)) {
+      LOG(ERROR) << "Unable to parse bitcode of shard " << i << ": "
+                 << remill::GetErrorString(maybe_shard_module);
+      return false;
+    }
+
+    if (linker.linkInModule(std::move(remill::GetReference(maybe_shard_module)),
+                            llvm::Linker::OverrideFromSrc)) {
+      LOG(ERROR) << "Unable to link shard " << i << " into lifted module";
+      return false;
+    }
+
+    llvm::SmallVector<char, 0>().swap(shard_bitcodes[i]);
+    return true;
+  };
+
+  auto ret = true;
+  for (auto i = 0u; ret && i < num_shards; ++i) {
+    ret = link_shard(i);
+  }
+
+  // Don't start on any more shards if one of them failed.
+  if (!ret) {
+    for (auto n = 0u; n < num_nodes; ++n) {
+      next_shards[n] = num_shards;
+    }
+  }
+
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  LOG_IF(INFO, num_resumed.load())
+      << "Resumed " << num_resumed.load() << " of " << num_shards
+      << " shards from checkpoints in '" << checkpoint_dir << "'";
+
+  return ret;
+}
+
+// Returns `false`, after logging why, if `--checkpoint_dir` is given with
+// options that don't apply to it, or if its directory can't be created.
+bool CheckShardFlags(void) {
+  if (FLAGS_checkpoint_dir.empty()) {
+    return true;
+  }
+
+  if (!FLAGS_batch.empty()) {
+    LOG(ERROR) << "The --checkpoint_dir option doesn't apply to --batch.";
+    return false;
+  }
+
+  if (!FLAGS_checkpoint_shards) {
+    LOG(ERROR) << "The --checkpoint_shards option must be at least one.";
+    return false;
+  }
+
+  if (auto ec = llvm::sys::fs::create_directories(FLAGS_checkpoint_dir)) {
+    LOG(ERROR) << "Unable to create checkpoint directory '"
+               << FLAGS_checkpoint_dir << "': " << ec.message();
+    return false;
+  }
+
+  return true;
+}
+
+// Returns the number of shards into which the functions of `--spec` are
+// split, which is one if the spec is lifted in one go.
+unsigned NumSpecShards(void) {
+
+  // Functions reachable from `--roots` are discovered while lifting, so they
+  // can't be dealt out to shards up-front. Functions are only evicted from a
+  // single module.
+  auto num_shards = FLAGS_checkpoint_shards;
+  if (FLAGS_checkpoint_dir.empty()) {
+    num_shards = 1u;
+    if (FLAGS_jobs > 1u) {
+      num_shards = FLAGS_jobs * std::max(1u, FLAGS_shards_per_job);
+    }
+  }
+  if (!FLAGS_roots.empty() || FLAGS_evict_batch_size) {
+    num_shards = 1u;
+  }
+
+  // There must be shards to compare with lifting in one go.
+  if (FLAGS_verify_determinism && 1u == num_shards) {
+    num_shards = 2u * std::max(1u, FLAGS_shards_per_job);
+  }
+
+  return num_shards;
+}
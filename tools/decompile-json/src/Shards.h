@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <llvm/ADT/StringRef.h>
+
+#include <string>
+#include <vector>
+
+#include "Spec.h"
+
+namespace anvill {
+class FunctionCache;
+class OptimizationPipeline;
+class Program;
+class Tracer;
+}  // namespace anvill
+namespace llvm {
+class Module;
+}  // namespace llvm
+
+class IncrementalManifest;
+struct RunStats;
+
+// Returns the number of NUMA nodes over which to spread `num_shards` shards.
+// Shard `i` belongs to node `i % NumShardNodes(num_shards)`.
+unsigned NumShardNodes(unsigned num_shards);
+
+// Deal out the functions of `program` to `num_shards` shards, returning the
+// shard of each function, in order of their addresses. Functions are dealt
+// out largest first, each to the shard with the least work so far, or the
+// lowest-numbered one if there's a tie (longest-processing-time-first). The
+// largest functions thus land in the lowest-numbered shards, which are the
+// ones that are started first. Every shard computes the same assignment.
+//
+// If the shards are spread over `num_nodes` NUMA nodes, then the functions,
+// in order of their addresses, are first split into `num_nodes` runs of about
+// the same cost, and each run is dealt out only to the shards of its node.
+// The bytes of neighbouring functions then tend to be read on one node.
+std::vector<unsigned> AssignShards(const anvill::Program &program,
+                                   unsigned num_shards, unsigned num_nodes);
+
+// Compute the key of the checkpoints of `spec`, which was read from
+// `spec_path`, into `key`. This is a hash of the bytes of the spec, of its
+// image, and of `--lift_functions`, of the versions of anvill and LLVM, of
+// `pipeline`, and of the options that change the lifted code.
+bool CheckpointKey(const std::string &spec_path, const LoadedSpec &spec,
+                   const anvill::OptimizationPipeline &pipeline,
+                   std::string &key);
+
+// Lift the spec as `num_shards` shards using up to `num_threads` threads, then
+// link the shards together into `module`. If `checkpoint_dir` isn't empty,
+// then each shard is saved there as soon as it is lifted and optimized, and
+// shards that were saved by an earlier run with the same `checkpoint_key` are
+// loaded rather than lifted again. If the shards are spread over NUMA nodes, then thread `t` is pinned
+// to node `t % num_nodes`, and lifts that node's shards before helping out
+// with those of the other nodes.
+bool LiftSpecInParallel(const SpecParser &parse_spec, llvm::StringRef spec_text,
+                        const std::string &arch_str, const std::string &os_str,
+                        const anvill::OptimizationPipeline &pipeline,
+                        anvill::Tracer *tracer, RunStats *stats,
+                        const anvill::FunctionCache *cache,
+                        IncrementalManifest *manifest,
+                        const std::string &checkpoint_dir,
+                        const std::string &checkpoint_key,
+                        llvm::Module &module, unsigned num_shards,
+                        unsigned num_threads);
+
+// Returns `false`, after logging why, if `--checkpoint_dir` is given with
+// options that don't apply to it, or if its directory can't be created.
+bool CheckShardFlags(void);
+
+// Returns the number of shards into which the functions of `--spec` are
+// split, which is one if the spec is lifted in one go.
+unsigned NumSpecShards(void);
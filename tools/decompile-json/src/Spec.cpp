@@ -0,0 +1,2415 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Spec.h"
+
+#include <anvill/BinaryImage.h>
+#include <anvill/BinarySpec.h>
+#include <anvill/Decl.h>
+#include <anvill/ITypeSpecification.h>
+#include <anvill/JumpTables.h>
+#include <anvill/Lifters/Options.h>
+#include <anvill/Lifters/EntityLifter.h>
+#include <anvill/Program.h>
+#include <anvill/Providers/IControlFlowProvider.h>
+#include <anvill/Providers/MemoryProvider.h>
+#include <anvill/Providers/TypeProvider.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/Endian.h>
+#include <remill/Arch/Arch.h>
+#include <remill/BC/Compat/Error.h>
+#include <remill/BC/Util.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <iostream>
+#include <magic_enum.hpp>
+#include <sstream>
+#include <thread>
+#include <utility>
+
+#include "Lift.h"
+
+DEFINE_bool(trusted_spec, false,
+            "Trust that the function declarations in the spec are "
+            "well-formed, e.g. because the spec was produced by a pipeline "
+            "that already validated it, and skip checking them.");
+
+DEFINE_bool(speculate_jump_tables, false,
+            "Before lifting, look for jump tables at the indirect jumps that "
+            "have no targets in the spec, and treat the table entries as "
+            "possible targets. Jumps still go through __remill_jump for "
+            "targets that aren't found.");
+
+DEFINE_uint32(parse_threads, 1u,
+              "Number of threads with which to parse the spec. Memory ranges "
+              "are decoded, and the spec's JSON is parsed, in parallel, and "
+              "the results are then declared in spec order. With --jobs, "
+              "every shard parses the spec with this many threads. A value "
+              "of zero means one thread per hardware thread.");
+
+DEFINE_string(spec_format, "json",
+              "Format of the specification file in --spec. This is either "
+              "'json' or 'binary'.");
+
+DEFINE_string(blob_dir, "",
+              "Directory holding the blobs referred to by the 'blob' fields "
+              "of memory ranges in --spec. Each blob is a file named by the "
+              "SHA-256 hash of its contents.");
+
+DEFINE_string(binary_spec_out, "",
+              "Path to which the JSON specification in --spec should be "
+              "written as a binary specification. Nothing is decompiled "
+              "when this option is given.");
+
+DEFINE_string(snapshot_out, "",
+              "Path to which a snapshot of the program built from --spec "
+              "should be written, as a binary specification. The snapshot "
+              "holds everything parsed from the spec and its image, and the "
+              "jump tables found by --speculate_jump_tables, so that later "
+              "runs with --spec_format=binary and --trusted_spec can skip "
+              "building the program again. Nothing is decompiled when this "
+              "option is given.");
+
+DEFINE_bool(stream_spec, false,
+            "Parse the JSON specification incrementally, one declaration "
+            "at a time, instead of parsing the whole specification into "
+            "memory up-front. This reduces peak memory usage on large "
+            "specifications.");
+
+DECLARE_string(arch);
+DECLARE_string(os);
+DECLARE_string(spec);
+DECLARE_string(reoptimize_bc);
+DECLARE_string(batch);
+DECLARE_string(queue_dir);
+DECLARE_string(serve);
+
+// Parse the location of a value. This applies to both parameters and
+// return values.
+static void ParseValue(llvm::json::Object *obj,
+                       anvill::BinarySpec::Value &val) {
+  if (auto maybe_reg = obj->getString("register")) {
+    val.reg = *maybe_reg;
+  }
+
+  if (auto mem_obj = obj->getObject("memory")) {
+    if (auto maybe_reg = mem_obj->getString("register")) {
+      val.mem_reg = *maybe_reg;
+    }
+
+    if (auto maybe_offset = mem_obj->getInteger("offset")) {
+      val.mem_offset = *maybe_offset;
+    }
+  }
+}
+
+// Resolve the location of a value. This applies to both parameters and
+// return values.
+static bool DeclareValue(const remill::Arch *arch,
+                         const anvill::BinarySpec::Value &val,
+                         anvill::ValueDecl &decl, const char *desc) {
+
+  if (!val.reg.empty()) {
+    decl.reg = arch->RegisterByName(val.reg.str());
+    if (!decl.reg) {
+      LOG(ERROR) << "Unable to locate register '" << val.reg.str()
+                 << "' used for storing " << desc << ".";
+      return false;
+    }
+  }
+
+  if (!val.mem_reg.empty()) {
+    decl.mem_reg = arch->RegisterByName(val.mem_reg.str());
+    if (!decl.mem_reg) {
+      LOG(ERROR) << "Unable to locate memory base register '"
+                 << val.mem_reg.str() << "' used for storing " << desc << ".";
+      return false;
+    }
+  }
+
+  decl.mem_offset = val.mem_offset;
+
+  if (decl.reg && decl.mem_reg) {
+    LOG(ERROR) << "A " << desc << " cannot be resident in both a register "
+               << "and a memory location.";
+    return false;
+  } else if (!decl.reg && !decl.mem_reg) {
+    LOG(ERROR)
+        << "A " << desc << " must be resident in either a register or "
+        << "a memory location (defined in terms of a register and offset).";
+    return false;
+  }
+
+  return true;
+}
+
+// Parse the type specification `spec` into a sized LLVM type, returning
+// `nullptr` on failure.
+static llvm::Type *DeclareSizedType(llvm::LLVMContext &context,
+                                    llvm::StringRef spec) {
+  auto type_spec_res = anvill::ITypeSpecification::Create(context, spec);
+  if (!type_spec_res.Succeeded()) {
+    auto error = type_spec_res.TakeError();
+
+    LOG(ERROR) << error.message << " in spec " << error.spec;
+    return nullptr;
+  }
+
+  auto type_spec = type_spec_res.TakeValue();
+  if (!type_spec->Sized()) {
+    LOG(ERROR) << "The following type is not sized: " << type_spec->Spec()
+               << " -> " << type_spec->Description();
+    return nullptr;
+  }
+
+  return type_spec->Type();
+}
+
+// Parse the `types` table of a JSON spec into `types`.
+static bool ParseTypeTable(llvm::json::Array &type_list,
+                           SpecTypeTable &types) {
+  types.reserve(type_list.size());
+  for (llvm::json::Value &maybe_type : type_list) {
+    if (auto type = maybe_type.getAsString()) {
+      types.push_back(*type);
+    } else {
+      LOG(ERROR) << "Non-string value at index " << types.size()
+                 << " of 'types' array in spec file '" << FLAGS_spec << "'";
+      return false;
+    }
+  }
+  return true;
+}
+
+// Get the type specification of the declaration `obj`. The `type` field of a
+// declaration is either a type specification, or the index of a type
+// specification in `types`.
+static llvm::Optional<llvm::StringRef>
+GetTypeSpec(llvm::json::Object *obj, const SpecTypeTable &types) {
+  if (auto maybe_type_str = obj->getString("type")) {
+    return maybe_type_str;
+
+  } else if (auto maybe_type_id = obj->getInteger("type")) {
+    if (0 <= *maybe_type_id &&
+        static_cast<uint64_t>(*maybe_type_id) < types.size()) {
+      return types[static_cast<size_t>(*maybe_type_id)];
+    }
+    LOG(ERROR) << "Type ID " << *maybe_type_id << " is not in the 'types' "
+               << "table of spec file '" << FLAGS_spec << "'";
+  }
+  return llvm::None;
+}
+
+// Parse a parameter from the JSON spec. Parameters should have names,
+// as that makes the bitcode slightly easier to read, but names are
+// not required. They must have types, and these types should be mostly
+// reflective of what you would see if you compiled C/C++ source code to
+// LLVM bitcode, and inspected the type of the corresponding parameter in
+// the bitcode.
+static bool ParseParameter(llvm::json::Object *obj,
+                           anvill::BinarySpec::Parameter &param,
+                           const SpecTypeTable &types) {
+
+  auto maybe_name = obj->getString("name");
+  if (maybe_name) {
+    param.name = *maybe_name;
+  } else {
+    LOG(WARNING) << "Missing function parameter name.";
+  }
+
+  auto maybe_type_str = GetTypeSpec(obj, types);
+  if (!maybe_type_str) {
+    LOG(ERROR) << "Missing 'type' field in function parameter.";
+    return false;
+  }
+
+  param.type = *maybe_type_str;
+  ParseValue(obj, param);
+  return true;
+}
+
+static bool DeclareParameter(const remill::Arch *arch,
+                             llvm::LLVMContext &context,
+                             const anvill::BinarySpec::Parameter &param,
+                             anvill::ParameterDecl &decl) {
+  decl.name = param.name.str();
+  decl.type = DeclareSizedType(context, param.type);
+  if (!decl.type) {
+    return false;
+  }
+  return DeclareValue(arch, param, decl, "function parameter");
+}
+
+//
+static bool ParseTypedRegister(llvm::json::Object *obj,
+                               anvill::BinarySpec::TypedRegister &reg,
+                               const SpecTypeTable &types) {
+
+  auto maybe_address = obj->getInteger("address");
+  if (!maybe_address) {
+    LOG(ERROR) << "Missing 'address' field in typed register.";
+    return false;
+  }
+  reg.address = static_cast<uint64_t>(*maybe_address);
+
+  auto maybe_value = obj->getInteger("value");
+  if (maybe_value) {
+    reg.has_value = true;
+    reg.value = static_cast<uint64_t>(*maybe_value);
+  }
+
+  auto maybe_type_str = GetTypeSpec(obj, types);
+  if (!maybe_type_str) {
+    LOG(ERROR) << "Missing 'type' field in typed register.";
+    return false;
+  }
+  reg.type = *maybe_type_str;
+
+  auto register_name = obj->getString("register");
+  if (!register_name) {
+    LOG(ERROR) << "Missing 'register' field in typed register";
+    return false;
+  }
+  reg.reg = *register_name;
+  return true;
+}
+
+static bool DeclareTypedRegister(
+    const remill::Arch *arch, llvm::LLVMContext &context,
+    std::vector<anvill::TypedRegisterDecl> &reg_info,
+    const anvill::BinarySpec::TypedRegister &reg) {
+
+  anvill::TypedRegisterDecl decl;
+  decl.address = reg.address;
+  if (reg.has_value) {
+    decl.value = reg.value;
+  }
+
+  decl.type = DeclareSizedType(context, reg.type);
+  if (!decl.type) {
+    return false;
+  }
+
+  auto maybe_reg = arch->RegisterByName(reg.reg.str());
+  if (!maybe_reg) {
+    LOG(ERROR) << "Unable to locate register '" << reg.reg.str()
+               << "' for typed register information:"
+               << " at '" << std::hex << reg.address << std::dec << "'";
+    return false;
+  }
+
+  decl.reg = maybe_reg;
+  reg_info.emplace_back(std::move(decl));
+  return true;
+}
+
+// Parse a return value from the JSON spec.
+static bool ParseReturnValue(llvm::json::Object *obj,
+                             anvill::BinarySpec::Value &ret,
+                             const SpecTypeTable &types) {
+
+  auto maybe_type_str = GetTypeSpec(obj, types);
+  if (!maybe_type_str) {
+    LOG(ERROR) << "Missing 'type' field in function return value.";
+    return false;
+  }
+
+  ret.type = *maybe_type_str;
+  ParseValue(obj, ret);
+  return true;
+}
+
+static bool DeclareReturnValue(const remill::Arch *arch,
+                               llvm::LLVMContext &context,
+                               const anvill::BinarySpec::Value &ret,
+                               anvill::ValueDecl &decl) {
+  decl.type = DeclareSizedType(context, ret.type);
+  if (!decl.type) {
+    return false;
+  }
+  return DeclareValue(arch, ret, decl, "function return value");
+}
+
+// Try to unserialize function info from a JSON specification. These
+// are really function prototypes / declarations, and not any isntruction
+// data (that is separate, if present).
+bool ParseFunction(llvm::json::Object *obj, anvill::BinarySpec::Function &func,
+                   const SpecTypeTable &types) {
+
+  auto maybe_ea = obj->getInteger("address");
+  if (!maybe_ea) {
+    LOG(ERROR) << "Missing function address in specification";
+    return false;
+  }
+
+  func.address = static_cast<uint64_t>(*maybe_ea);
+
+  // NOTE (akshayk): An external function can have function type in the spec. If
+  //                 the function type is available, it will have precedence over
+  //                 the parameter variables and return values. If the function
+  //                 type is not available it will fallback to processing params
+  //                 and return values
+
+  if (auto maybe_type = GetTypeSpec(obj, types)) {
+    func.type = *maybe_type;
+
+  } else {
+    if (auto params = obj->getArray("parameters")) {
+      for (llvm::json::Value &maybe_param : *params) {
+        if (auto param_obj = maybe_param.getAsObject()) {
+          auto &pv = func.params.emplace_back();
+          if (!ParseParameter(param_obj, pv, types)) {
+            return false;
+          }
+        } else {
+          LOG(ERROR) << "Non-object value in 'parameters' array of "
+                     << "function at address '" << std::hex << func.address
+                     << std::dec << "'";
+          return false;
+        }
+      }
+    }
+
+    // Get the return address location.
+    if (auto ret_addr = obj->getObject("return_address")) {
+      ParseValue(ret_addr, func.return_address);
+    } else {
+      LOG(ERROR) << "Non-present or non-object 'return_address' in function "
+                 << "specification at '" << std::hex << func.address
+                 << std::dec << "'";
+      return false;
+    }
+
+    // Parse the value of the stack pointer on exit from the function, which is
+    // defined in terms of `reg + offset` for a value of a register `reg`
+    // on entry to the function.
+    if (auto ret_sp = obj->getObject("return_stack_pointer")) {
+      auto maybe_reg = ret_sp->getString("register");
+      if (maybe_reg) {
+        func.return_stack_pointer = *maybe_reg;
+      } else {
+        LOG(ERROR)
+            << "Non-present or non-string 'register' in 'return_stack_pointer' "
+            << "object of function specification at '" << std::hex
+            << func.address << std::dec << "'";
+        return false;
+      }
+
+      auto maybe_offset = ret_sp->getInteger("offset");
+      if (maybe_offset) {
+        func.return_stack_pointer_offset = *maybe_offset;
+      }
+    } else {
+      LOG(ERROR)
+          << "Non-present or non-object 'return_stack_pointer' in function "
+          << "specification at '" << std::hex << func.address << std::dec
+          << "'";
+      return false;
+    }
+
+    if (auto returns = obj->getArray("return_values")) {
+      for (llvm::json::Value &maybe_ret : *returns) {
+        if (auto ret_obj = maybe_ret.getAsObject()) {
+          auto &rv = func.returns.emplace_back();
+          if (!ParseReturnValue(ret_obj, rv, types)) {
+            return false;
+          }
+        } else {
+          LOG(ERROR) << "Non-object value in 'return_values' array of "
+                     << "function at address '" << std::hex << func.address
+                     << std::dec << "'";
+          return false;
+        }
+      }
+    }
+
+    if (auto maybe_is_noreturn = obj->getBoolean("is_noreturn")) {
+      func.is_noreturn = *maybe_is_noreturn;
+    }
+
+    if (auto maybe_is_variadic = obj->getBoolean("is_variadic")) {
+      func.is_variadic = *maybe_is_variadic;
+    }
+
+    if (auto maybe_cc = obj->getInteger("calling_convention")) {
+      func.calling_convention = static_cast<uint32_t>(*maybe_cc);
+    }
+  }
+
+  if (auto register_info = obj->getArray("register_info")) {
+    for (llvm::json::Value &maybe_reg : *register_info) {
+      if (auto reg_obj = maybe_reg.getAsObject()) {
+
+        // Parse the register info!
+        auto &reg = func.register_info.emplace_back();
+        if (!ParseTypedRegister(reg_obj, reg, types)) {
+          return false;
+        }
+      } else {
+        LOG(ERROR) << "Non-object value in 'register_info' array of "
+                   << "function at address '" << func.address << std::dec
+                   << "'";
+      }
+    }
+  }
+
+  return true;
+}
+
+// Make the declaration `decl` of a function, given its spec.
+bool MakeFunctionDecl(const remill::Arch *arch, llvm::LLVMContext &context,
+                      const anvill::BinarySpec::Function &func,
+                      llvm::Module &module, anvill::FunctionDecl &decl) {
+
+  const auto address = func.address;
+
+  if (!func.type.empty()) {
+    auto type_spec_result =
+        anvill::ITypeSpecification::Create(context, func.type);
+    if (!type_spec_result.Succeeded()) {
+      auto error = type_spec_result.TakeError();
+      LOG(ERROR) << error.message << " in spec " << error.spec;
+      return false;
+    }
+
+    auto type_spec = type_spec_result.TakeValue();
+    auto func_type = llvm::dyn_cast<llvm::FunctionType>(type_spec->Type());
+    if (!func_type) {
+      LOG(ERROR) << "Type associated with function at address " << std::hex
+                 << address << std::dec << " is incorrect! "
+                 << remill::LLVMThingToString(type_spec->Type());
+      return false;
+    }
+
+    std::stringstream ss;
+    ss << "dummy_" << std::hex << address;
+    auto dummy_function = llvm::Function::Create(
+        func_type, llvm::Function::ExternalLinkage, ss.str().c_str(), module);
+
+    // Create a FunctionDecl object from the dummy function. This will set
+    // the correct function types, bind the parameters & return values
+    // with the architectural registers, and set the calling convention
+
+    auto maybe_decl = anvill::FunctionDecl::Create(*dummy_function, arch);
+    dummy_function->eraseFromParent();
+
+    if (remill::IsError(maybe_decl)) {
+      LOG(ERROR) << "Failed to create FunctionDecl of type "
+                 << remill::LLVMThingToString(func_type)
+                 << " defined at address " << std::hex << address;
+      return false;
+    }
+
+    decl = std::move(remill::GetReference(maybe_decl));
+    decl.address = address;
+
+  } else {
+
+    // The function is not external and does not have associated type
+    // in the spec. Fallback to processing parameters and return values
+    decl.arch = arch;
+    decl.address = address;
+
+    for (const auto &param : func.params) {
+      auto &pv = decl.params.emplace_back();
+      if (!DeclareParameter(arch, context, param, pv)) {
+        return false;
+      }
+    }
+
+    if (!DeclareValue(arch, func.return_address, decl.return_address,
+                      "return address")) {
+      return false;
+    }
+
+    decl.return_stack_pointer =
+        arch->RegisterByName(func.return_stack_pointer.str());
+    if (!decl.return_stack_pointer) {
+      LOG(ERROR) << "Unable to locate register '"
+                 << func.return_stack_pointer.str()
+                 << "' used computing the exit value of the "
+                 << "stack pointer in function specification at '" << std::hex
+                 << decl.address << std::dec << "'";
+      return false;
+    }
+
+    decl.return_stack_pointer_offset = func.return_stack_pointer_offset;
+
+    for (const auto &ret : func.returns) {
+      auto &rv = decl.returns.emplace_back();
+      if (!DeclareReturnValue(arch, context, ret, rv)) {
+        return false;
+      }
+    }
+
+    decl.is_noreturn = func.is_noreturn;
+    decl.is_variadic = func.is_variadic;
+
+    decl.calling_convention =
+        static_cast<llvm::CallingConv::ID>(func.calling_convention);
+  }
+
+  for (const auto &reg : func.register_info) {
+    if (!DeclareTypedRegister(arch, context, decl.reg_info, reg)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// Declare a function in `program`, given its spec.
+static bool DeclareFunction(const remill::Arch *arch,
+                            llvm::LLVMContext &context,
+                            anvill::Program &program,
+                            const anvill::BinarySpec::Function &func,
+                            llvm::Module &module) {
+  anvill::FunctionDecl decl;
+  if (!MakeFunctionDecl(arch, context, func, module, decl)) {
+    return false;
+  }
+
+  auto err = program.DeclareFunction(decl);
+  if (remill::IsError(err)) {
+    LOG(ERROR) << remill::GetErrorString(err);
+    return false;
+  }
+
+  return true;
+}
+
+// Parse a function out of a JSON spec, and declare it in `program`.
+static bool ParseFunction(const remill::Arch *arch, llvm::LLVMContext &context,
+                          anvill::Program &program, llvm::json::Object *obj,
+                          const SpecTypeTable &types, llvm::Module &module) {
+  anvill::BinarySpec::Function func;
+  return ParseFunction(obj, func, types) &&
+         DeclareFunction(arch, context, program, func, module);
+}
+
+// Try to unserialize variable information.
+static bool ParseVariable(llvm::json::Object *obj,
+                          anvill::BinarySpec::Variable &var,
+                          const SpecTypeTable &types) {
+
+  auto maybe_ea = obj->getInteger("address");
+  if (!maybe_ea) {
+    LOG(ERROR) << "Missing global variable address in specification";
+    return false;
+  }
+
+  var.address = static_cast<uint64_t>(*maybe_ea);
+
+  auto maybe_type_str = GetTypeSpec(obj, types);
+  if (!maybe_type_str) {
+    LOG(ERROR) << "Missing 'type' field in global variable.";
+    return false;
+  }
+
+  var.type = *maybe_type_str;
+  return true;
+}
+
+// Declare a variable in `program`, given its spec.
+static bool DeclareVariable(const remill::Arch *arch,
+                            llvm::LLVMContext &context,
+                            anvill::Program &program,
+                            const anvill::BinarySpec::Variable &var,
+                            llvm::Module &module) {
+
+  const auto address = var.address;
+
+  auto type_spec_res = anvill::ITypeSpecification::Create(context, var.type);
+  if (!type_spec_res.Succeeded()) {
+    auto error = type_spec_res.TakeError();
+
+    LOG(ERROR) << error.message << " in spec " << error.spec;
+    return false;
+  }
+
+  auto type_spec = type_spec_res.TakeValue();
+  auto type = type_spec->Type();
+
+  if (type->isFunctionTy()) {
+    auto type_as_func_ty = llvm::dyn_cast<llvm::FunctionType>(type);
+    if (type_as_func_ty == nullptr) {
+      LOG(ERROR) << "Failed to cast the function type ptr";
+      return false;
+    }
+
+    if (auto func_decl = program.FindFunction(address); !func_decl) {
+      std::stringstream buffer;
+      buffer << "function_variable_" << std::hex << address;
+
+      auto dummy_function = llvm::Function::Create(
+          type_as_func_ty, llvm::Function::ExternalLinkage,
+          buffer.str().c_str(), module);
+
+      auto maybe_decl = anvill::FunctionDecl::Create(*dummy_function, arch);
+      dummy_function->eraseFromParent();
+
+      if (remill::IsError(maybe_decl)) {
+        LOG(ERROR) << "Unable to create FunctionDecl for variable of type "
+                   << remill::LLVMThingToString(type) << " defined at "
+                   << std::hex << address;
+        return false;
+      }
+
+      auto function_decl = std::move(remill::GetReference(maybe_decl));
+      function_decl.address = address;
+
+      auto err = program.DeclareFunction(function_decl);
+      if (remill::IsError(err)) {
+        LOG(ERROR) << remill::GetErrorString(err);
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  if (!type_spec->Sized()) {
+    LOG(ERROR) << "The following type is not sized: " << type_spec->Spec()
+               << " -> " << type_spec->Description();
+    return false;
+  }
+
+  anvill::GlobalVarDecl decl;
+  decl.type = type;
+  decl.address = address;
+
+  auto err = program.DeclareVariable(decl);
+  if (remill::IsError(err)) {
+    LOG(ERROR) << remill::GetErrorString(err);
+    return false;
+  }
+
+  return true;
+}
+
+// Parse a variable out of a JSON spec, and declare it in `program`.
+static bool ParseVariable(const remill::Arch *arch, llvm::LLVMContext &context,
+                          anvill::Program &program, llvm::json::Object *obj,
+                          const SpecTypeTable &types, llvm::Module &module) {
+  anvill::BinarySpec::Variable var;
+  return ParseVariable(obj, var, types) &&
+         DeclareVariable(arch, context, program, var, module);
+}
+
+// Broadcast `byte` into every byte of a 64-bit word.
+static constexpr uint64_t Splat(uint8_t byte) {
+  return 0x0101010101010101ull * byte;
+}
+
+// Returns a word whose bytes have their high bit set where the corresponding
+// byte of `word` is in the range `[lo, hi]`. The bytes of `word` must all be
+// below `0x80`, so that the additions can't carry from one byte into the
+// next.
+static constexpr uint64_t BytesInRange(uint64_t word, uint8_t lo, uint8_t hi) {
+  return (word + Splat(0x80u - lo)) & ~(word + Splat(0x7Fu - hi)) &
+         Splat(0x80u);
+}
+
+// Decode the eight hex characters in `chars` into four bytes in `out`,
+// working on all eight characters at once. Returns `false` without writing
+// anything if any character isn't a hex digit.
+static bool DecodeEightHexChars(const char *chars, uint8_t *out) {
+  const auto word = llvm::support::endian::read64le(chars);
+  if (word & Splat(0x80u)) {
+    return false;
+  }
+
+  // Setting `0x20` turns upper case letters into lower case, and only `A-F` and
+  // `a-f` end up in `a-f`. Digits can't be folded the same way, as e.g. `0x10`
+  // would become `'0'`.
+  const auto digits = BytesInRange(word, '0', '9');
+  const auto letters = BytesInRange(word | Splat(0x20u), 'a', 'f');
+  if ((digits | letters) != Splat(0x80u)) {
+    return false;
+  }
+
+  // Both `'0'` and `'a'` have a low nibble one less than their value, save
+  // for the offset of nine between letters and digits.
+  const auto nibbles = (word & Splat(0x0Fu)) + (letters >> 7u) * 9u;
+
+  // The first character of each pair is the low byte of a 16-bit lane, and
+  // is the high nibble of the decoded byte. Pack the lanes' bytes together.
+  auto bytes = ((nibbles & 0x000F000F000F000Full) << 4u) |
+               ((nibbles >> 8u) & 0x000F000F000F000Full);
+  bytes = (bytes | (bytes >> 8u)) & 0x0000FFFF0000FFFFull;
+  bytes = (bytes | (bytes >> 16u)) & 0x00000000FFFFFFFFull;
+  llvm::support::endian::write32le(out, static_cast<uint32_t>(bytes));
+  return true;
+}
+
+// Decode the hex-encoded byte string `bytes` of the memory range at `address`.
+// Errors are only logged if `log_errors` is `true`.
+static bool DecodeHexBytes(llvm::StringRef bytes, uint64_t address,
+                           std::vector<uint8_t> &decoded_bytes,
+                           bool log_errors = true) {
+  if (bytes.size() % 2) {
+    LOG_IF(ERROR, log_errors)
+        << "Length of byte string in memory range specification "
+        << "at address '" << std::hex << address << std::dec
+        << "' must have an even number of characters.";
+    return false;
+  }
+
+  // Ranges can be hundreds of megabytes, so the bytes are decoded in place
+  // rather than pushed back one at a time.
+  decoded_bytes.resize(bytes.size() / 2);
+  const auto chars = bytes.data();
+  const auto out = decoded_bytes.data();
+
+  auto i = 0ul;
+  for (; (i + 8u) <= bytes.size(); i += 8u) {
+    if (!DecodeEightHexChars(&(chars[i]), &(out[i / 2u]))) {
+      break;
+    }
+  }
+
+  // Decode the tail, and find the bad byte if the loop above stopped early.
+  for (; i < bytes.size(); i += 2) {
+    const auto hi = llvm::hexDigitValue(chars[i]);
+    const auto lo = llvm::hexDigitValue(chars[i + 1]);
+    if (hi == ~0u || lo == ~0u) {
+      char nibbles[3] = {chars[i], chars[i + 1], '\0'};
+      LOG_IF(ERROR, log_errors)
+          << "Invalid hex byte value '" << nibbles << "' in memory "
+          << "range specification at address '" << std::hex << address
+          << std::dec << "'.";
+      decoded_bytes.clear();
+      return false;
+    }
+    out[i / 2u] = static_cast<uint8_t>((hi << 4u) | lo);
+  }
+
+  return true;
+}
+
+// Get the size of a zero-fill or blob-backed memory range.
+static bool GetRangeSize(llvm::json::Object *obj, uint64_t address,
+                         const char *kind, uint64_t &size) {
+  auto maybe_size = obj->getInteger("size");
+  if (!maybe_size || *maybe_size <= 0) {
+    LOG(ERROR) << "Missing or invalid size in " << kind << " memory range "
+               << "specification at address '" << std::hex << address
+               << std::dec << "'.";
+    return false;
+  }
+  size = static_cast<uint64_t>(*maybe_size);
+  return true;
+}
+
+// Get the path of the blob named by `hash` in `--blob_dir`.
+static bool GetBlobPath(llvm::StringRef hash, uint64_t address,
+                        std::string &path) {
+  if (FLAGS_blob_dir.empty()) {
+    LOG(ERROR) << "Memory range at address '" << std::hex << address
+               << std::dec << "' refers to blob '" << hash.str()
+               << "', but no --blob_dir was given.";
+    return false;
+  }
+
+  // Only hex digits are accepted, so that a blob name can't escape from
+  // `--blob_dir`.
+  if (hash.empty() ||
+      !std::all_of(hash.begin(), hash.end(),
+                   [](char c) { return std::isxdigit(c); })) {
+    LOG(ERROR) << "Invalid blob hash '" << hash.str() << "' in memory range "
+               << "specification at address '" << std::hex << address
+               << std::dec << "'.";
+    return false;
+  }
+
+  path = FLAGS_blob_dir + "/" + hash.str();
+  return true;
+}
+
+// Parse a memory range. The hex-encoded data of the range, if any, is in
+// `maybe_bytes`, which need not be a part of `obj`. If `predecoded_bytes`
+// is non-null, then it holds `maybe_bytes`, already decoded.
+static bool ParseRange(anvill::Program &program, llvm::json::Object *obj,
+                       llvm::Optional<llvm::StringRef> maybe_bytes,
+                       std::vector<uint8_t> *predecoded_bytes = nullptr) {
+
+  auto maybe_ea = obj->getInteger("address");
+  if (!maybe_ea) {
+    LOG(ERROR) << "Missing address in memory range specification";
+    return false;
+  }
+
+  anvill::ByteRange range;
+  range.address = static_cast<uint64_t>(*maybe_ea);
+
+  auto perm = obj->getBoolean("is_writeable");
+  if (perm) {
+    range.is_writeable = *perm;
+  }
+
+  perm = obj->getBoolean("is_executable");
+  if (perm) {
+    range.is_executable = *perm;
+  }
+
+  // The bytes of the range can instead come from a slice of a file, in which
+  // case they are memory-mapped rather than decoded and copied.
+  if (auto maybe_file = obj->getString("file")) {
+    auto maybe_size = obj->getInteger("size");
+    if (!maybe_size || *maybe_size <= 0) {
+      LOG(ERROR) << "Missing or invalid size in file-backed memory range "
+                 << "specification at address '" << std::hex << range.address
+                 << std::dec << "'.";
+      return false;
+    }
+
+    auto file_offset = obj->getInteger("file_offset").getValueOr(0);
+    if (file_offset < 0) {
+      LOG(ERROR) << "Invalid file offset in file-backed memory range "
+                 << "specification at address '" << std::hex << range.address
+                 << std::dec << "'.";
+      return false;
+    }
+
+    auto err = program.MapFile(
+        maybe_file->str(), static_cast<uint64_t>(file_offset), range.address,
+        static_cast<uint64_t>(*maybe_size), range.is_writeable,
+        range.is_executable);
+    if (remill::IsError(err)) {
+      LOG(ERROR) << remill::GetErrorString(err);
+      return false;
+    }
+
+    return true;
+  }
+
+  // A zero-fill range has only a size, and no storage is allocated for it.
+  if (obj->getBoolean("zero_fill").getValueOr(false)) {
+    uint64_t size = 0;
+    if (!GetRangeSize(obj, range.address, "zero-fill", size)) {
+      return false;
+    }
+
+    auto err = program.MapZeroRange(range.address, size, range.is_writeable,
+                                    range.is_executable);
+    if (remill::IsError(err)) {
+      LOG(ERROR) << remill::GetErrorString(err);
+      return false;
+    }
+
+    return true;
+  }
+
+  // The bytes of the range can be a blob in `--blob_dir`, which is shared
+  // by the specs of many binaries, and memory-mapped like a file.
+  if (auto maybe_blob = obj->getString("blob")) {
+    uint64_t size = 0;
+    std::string path;
+    if (!GetRangeSize(obj, range.address, "blob-backed", size) ||
+        !GetBlobPath(*maybe_blob, range.address, path)) {
+      return false;
+    }
+
+    auto err = program.MapFile(path, 0, range.address, size,
+                               range.is_writeable, range.is_executable);
+    if (remill::IsError(err)) {
+      LOG(ERROR) << remill::GetErrorString(err);
+      return false;
+    }
+
+    return true;
+  }
+
+  if (!maybe_bytes) {
+    LOG(ERROR) << "Missing byte string in memory range specification "
+               << "at address '" << std::hex << range.address << std::dec
+               << '.';
+    return false;
+  }
+
+  // The program takes ownership of the decoded bytes, rather than copying them.
+  std::vector<uint8_t> decoded_bytes;
+  if (predecoded_bytes) {
+    decoded_bytes = std::move(*predecoded_bytes);
+  } else if (!DecodeHexBytes(*maybe_bytes, range.address, decoded_bytes)) {
+    return false;
+  }
+
+  auto err = program.MapRange(range.address, std::move(decoded_bytes),
+                              range.is_writeable, range.is_executable);
+  if (remill::IsError(err)) {
+    LOG(ERROR) << remill::GetErrorString(err);
+    return false;
+  }
+
+  return true;
+}
+
+static bool ParseControlFlowRedirection(
+    llvm::json::Array &redirection_list,
+    std::vector<std::pair<uint64_t, uint64_t>> &redirections) {
+
+  auto index{0U};
+
+  for (const llvm::json::Value &list_entry : redirection_list) {
+    auto address_pair = list_entry.getAsArray();
+    if (address_pair == nullptr) {
+      LOG(ERROR)
+          << "Non-JSON list entry in 'control_flow_redirections' array of spec file '"
+          << FLAGS_spec << "'";
+
+      return false;
+    }
+
+    if (address_pair->size() != 2U) {
+      LOG(ERROR)
+          << "Non-integer pair value in the control_flow_redirections entry #"
+          << index << " of the the following spec file: '" << FLAGS_spec << "'";
+
+      return false;
+    }
+
+    const auto &source_address_obj = address_pair->operator[](0);
+    auto opt_source_address = source_address_obj.getAsInteger();
+    if (!opt_source_address) {
+      LOG(ERROR)
+          << "Invalid integer value in source address for the #" << index
+          << " of the control_flow_redirections in the following spec file: '"
+          << FLAGS_spec << "'";
+
+      return false;
+    }
+
+    const auto &dest_address_obj = address_pair->operator[](1);
+    auto opt_dest_address = dest_address_obj.getAsInteger();
+    if (!opt_dest_address) {
+      LOG(ERROR)
+          << "Invalid integer value in destination address for the #" << index
+          << " of the control_flow_redirections in the following spec file: '"
+          << FLAGS_spec << "'";
+
+      return false;
+    }
+
+    redirections.emplace_back(
+        static_cast<uint64_t>(opt_source_address.getValue()),
+        static_cast<uint64_t>(opt_dest_address.getValue()));
+
+    ++index;
+  }
+
+  return true;
+}
+
+static void DeclareControlFlowRedirections(
+    anvill::Program &program,
+    const std::vector<std::pair<uint64_t, uint64_t>> &redirections) {
+
+  std::stringstream buffer;
+
+  for (auto [source_address, dest_address] : redirections) {
+    buffer << "  " << std::hex << source_address << " -> " << dest_address
+           << "\n";
+
+    program.AddControlFlowRedirection(source_address, dest_address);
+  }
+
+  auto redirection_output = buffer.str();
+  if (!redirection_output.empty()) {
+    std::cout << "Control flow redirections:\n" << redirection_output;
+  }
+  std::cout << "\n";
+}
+
+static bool ParseControlFlowRedirection(anvill::Program &program,
+                                        llvm::json::Array &redirection_list) {
+  std::vector<std::pair<uint64_t, uint64_t>> redirections;
+  if (!ParseControlFlowRedirection(redirection_list, redirections)) {
+    return false;
+  }
+
+  DeclareControlFlowRedirections(program, redirections);
+  return true;
+}
+
+static bool ParseControlFlowTargets(
+    llvm::json::Array &ctrl_flow_target_list,
+    std::vector<anvill::BinarySpec::ControlFlowTargets> &targets) {
+
+  auto index{0U};
+
+  for (const llvm::json::Value &list_entry : ctrl_flow_target_list) {
+    auto entry_as_obj = list_entry.getAsObject();
+    if (entry_as_obj == nullptr) {
+      LOG(ERROR)
+          << "Non-object list entry in 'control_flow_targets' array of spec file '"
+          << FLAGS_spec << "' at index " << index;
+
+      return false;
+    }
+
+    auto &entry = targets.emplace_back();
+
+    auto maybe_source = entry_as_obj->getInteger("source");
+    if (!maybe_source.hasValue()) {
+      LOG(ERROR)
+          << "Invalid 'source' value in 'control_flow_targets' array of spec file '"
+          << FLAGS_spec << "' at index " << index;
+
+      return false;
+    }
+
+    entry.source = static_cast<uint64_t>(maybe_source.getValue());
+
+    auto maybe_complete = entry_as_obj->getBoolean("complete");
+    if (!maybe_complete.hasValue()) {
+      LOG(ERROR)
+          << "Invalid 'complete' value in 'control_flow_targets' array of spec file '"
+          << FLAGS_spec << "' at index " << index;
+
+      return false;
+    }
+
+    entry.complete = maybe_complete.getValue();
+
+    auto destination_list = entry_as_obj->getArray("destination_list");
+    if (destination_list == nullptr) {
+      LOG(ERROR)
+          << "Non-array 'destination_list' node in 'control_flow_targets' array of spec file '"
+          << FLAGS_spec << "' at index " << index;
+
+      return false;
+    }
+
+    for (const auto &destination_list_entry : *destination_list) {
+      auto maybe_destination = destination_list_entry.getAsInteger();
+      if (!maybe_destination.hasValue()) {
+        LOG(ERROR)
+            << "Non-integer 'destination_list' entry value in 'control_flow_targets' array of spec file '"
+            << FLAGS_spec << "' at index " << index;
+
+        return false;
+      }
+
+      entry.destinations.push_back(
+          static_cast<uint64_t>(maybe_destination.getValue()));
+    }
+
+    ++index;
+  }
+
+  return true;
+}
+
+static bool DeclareControlFlowTargets(
+    anvill::Program &program,
+    const std::vector<anvill::BinarySpec::ControlFlowTargets> &targets) {
+
+  std::stringstream buffer;
+
+  for (const auto &entry : targets) {
+    anvill::ControlFlowTargetList ctrl_flow_target_list = {};
+    ctrl_flow_target_list.source = entry.source;
+    ctrl_flow_target_list.complete = entry.complete;
+    ctrl_flow_target_list.destination_list.insert(
+        ctrl_flow_target_list.destination_list.end(),
+        entry.destinations.begin(), entry.destinations.end());
+
+    std::sort(ctrl_flow_target_list.destination_list.begin(),
+              ctrl_flow_target_list.destination_list.end());
+
+    auto erase_it = std::unique(ctrl_flow_target_list.destination_list.begin(),
+                                ctrl_flow_target_list.destination_list.end());
+
+    ctrl_flow_target_list.destination_list.erase(
+        erase_it, ctrl_flow_target_list.destination_list.end());
+
+    buffer << "  " << std::hex << ctrl_flow_target_list.source << " -> [ ";
+
+    for (auto dest_it = ctrl_flow_target_list.destination_list.begin();
+         dest_it != ctrl_flow_target_list.destination_list.end(); ++dest_it) {
+
+      buffer << (*dest_it);
+      if (std::next(dest_it, 1) !=
+          ctrl_flow_target_list.destination_list.end()) {
+        buffer << ", ";
+      }
+    }
+
+    buffer << " ] ("
+           << (ctrl_flow_target_list.complete ? "complete" : "incomplete")
+           << ")\n";
+
+    if (!program.TrySetControlFlowTargets(ctrl_flow_target_list)) {
+      LOG(ERROR)
+          << "The 'control_flow_targets' entry in the array of spec file '"
+          << FLAGS_spec << "' contains duplicates";
+
+      return false;
+    }
+  }
+
+  auto redirection_output = buffer.str();
+  if (!redirection_output.empty()) {
+    std::cout << "Control flow targets:\n" << redirection_output;
+  }
+  std::cout << "\n";
+
+  return true;
+}
+
+static bool ParseControlFlowTargets(anvill::Program &program,
+                                    llvm::json::Array &ctrl_flow_target_list) {
+  std::vector<anvill::BinarySpec::ControlFlowTargets> targets;
+  return ParseControlFlowTargets(ctrl_flow_target_list, targets) &&
+         DeclareControlFlowTargets(program, targets);
+}
+
+// Parse a symbol, which is an `[address, name]` pair.
+static bool ParseSymbol(llvm::json::Value &maybe_ea_name,
+                        anvill::BinarySpec::Symbol &sym) {
+  if (auto ea_name = maybe_ea_name.getAsArray(); ea_name) {
+    if (ea_name->size() != 2) {
+      LOG(ERROR) << "Symbol entry doesn't have two values in spec file '"
+                 << FLAGS_spec << "'";
+      return false;
+    }
+    auto &maybe_ea = ea_name->operator[](0);
+    auto &maybe_name = ea_name->operator[](1);
+
+    if (auto ea = maybe_ea.getAsInteger(); ea) {
+      if (auto name = maybe_name.getAsString(); name) {
+        sym.address = static_cast<uint64_t>(ea.getValue());
+        sym.name = *name;
+      } else {
+        LOG(ERROR)
+            << "Second value in symbol entry must be a string in spec file '"
+            << FLAGS_spec << "'";
+        return false;
+      }
+    } else {
+      LOG(ERROR)
+          << "First value in symbol entry must be an integer in spec file '"
+          << FLAGS_spec << "'";
+      return false;
+    }
+  } else {
+    LOG(ERROR)
+        << "Expected array entries inside of 'symbols' array in spec file '"
+        << FLAGS_spec << "'";
+    return false;
+  }
+
+  return true;
+}
+
+// Parse a symbol, and add it to `program`.
+static bool ParseSymbol(anvill::Program &program,
+                        llvm::json::Value &maybe_ea_name) {
+  anvill::BinarySpec::Symbol sym;
+  if (!ParseSymbol(maybe_ea_name, sym)) {
+    return false;
+  }
+  program.AddNameToAddress(sym.name.str(), sym.address);
+  return true;
+}
+
+// Returns the number of threads with which to parse the spec.
+static unsigned NumParseThreads(void) {
+  if (!FLAGS_parse_threads) {
+    return std::max(1u, std::thread::hardware_concurrency());
+  }
+  return FLAGS_parse_threads;
+}
+
+// Invoke `cb(i)` for each `i` in `[0, num_items)`, on up to `num_threads`
+// threads, including this one. The order of the calls is unspecified.
+template <typename CB>
+static void ParallelFor(size_t num_items, unsigned num_threads, CB cb) {
+  num_threads = static_cast<unsigned>(
+      std::min<size_t>(num_threads, num_items));
+  if (num_threads <= 1u) {
+    for (auto i = 0ul; i < num_items; ++i) {
+      cb(i);
+    }
+    return;
+  }
+
+  std::atomic<size_t> next_item{0u};
+  auto work = [&](void) {
+    for (auto i = next_item++; i < num_items; i = next_item++) {
+      cb(i);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  threads.reserve(num_threads - 1u);
+  for (auto t = 1u; t < num_threads; ++t) {
+    threads.emplace_back(work);
+  }
+  work();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+
+// Parse the memory ranges in `ranges`. The hex-encoded data of the ranges,
+// which dominates the time it takes to parse big specs, is decoded on
+// `--parse_threads` threads, and the ranges are then mapped in order.
+static bool ParseRanges(anvill::Program &program, llvm::json::Array &ranges) {
+  std::vector<std::vector<uint8_t>> decoded(ranges.size());
+  std::unique_ptr<bool[]> is_decoded(new bool[ranges.size()]());
+
+  // Errors aren't logged here, so that they're reported in order by
+  // `ParseRange`, which re-decodes the ranges that failed.
+  ParallelFor(ranges.size(), NumParseThreads(), [&](size_t i) {
+    if (auto range_obj = ranges[i].getAsObject()) {
+      if (auto maybe_bytes = range_obj->getString("data")) {
+        is_decoded[i] = DecodeHexBytes(*maybe_bytes, 0, decoded[i], false);
+      }
+    }
+  });
+
+  for (auto i = 0ul; i < ranges.size(); ++i) {
+    auto range_obj = ranges[i].getAsObject();
+    if (!range_obj) {
+      LOG(ERROR) << "Non-JSON object in 'bytes' array of spec file '"
+                 << FLAGS_spec << "'";
+      return false;
+    }
+
+    if (!ParseRange(program, range_obj, range_obj->getString("data"),
+                    is_decoded[i] ? &(decoded[i]) : nullptr)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// Parse the core data out of a JSON specification, and do a small
+// amount of validation. A JSON spec contains the following:
+//
+//  - For each function:
+//    - Function name (if any)
+//    - Address.
+//    - For each argument:
+//    - - Argument name
+//    - - Location specifier, which is a register name or a stack pointer displacement.
+//    - - Type.
+//    - For each return value
+//    - - Location specifier
+//    - - Type.
+//
+//  - For each global variable:
+//    - Variable name (if any)
+//    - Type.
+//    - Address.
+//
+//  - For each memory range:
+//    - Starting address. No alignment restrictions apply.
+//    - Permissions (is_readable, is_writeable, is_executable).
+//    - Data (hex-encoded byte string).
+static bool ParseSpec(const remill::Arch *arch, llvm::LLVMContext &context,
+                      anvill::Program &program, llvm::json::Object *spec,
+                      llvm::Module &module) {
+
+  SpecTypeTable types;
+  if (auto type_list = spec->getArray("types")) {
+    if (!ParseTypeTable(*type_list, types)) {
+      return false;
+    }
+  } else if (spec->find("types") != spec->end()) {
+    LOG(ERROR) << "Non-JSON array value for 'types' in spec file '"
+               << FLAGS_spec << "'";
+    return false;
+  }
+
+  auto num_funcs = 0;
+  if (auto funcs = spec->getArray("functions")) {
+    for (llvm::json::Value &func : *funcs) {
+      if (auto func_obj = func.getAsObject()) {
+        if (!ParseFunction(arch, context, program, func_obj, types, module)) {
+          return false;
+        } else {
+          ++num_funcs;
+        }
+      } else {
+        LOG(ERROR) << "Non-JSON object in 'functions' array of spec file '"
+                   << FLAGS_spec << "'";
+        return false;
+      }
+    }
+  } else if (spec->find("functions") != spec->end()) {
+    LOG(ERROR) << "Non-JSON array value for 'functions' in spec file '"
+               << FLAGS_spec << "'";
+    return false;
+  }
+
+  if (auto redirection_list = spec->getArray("control_flow_redirections")) {
+    if (!ParseControlFlowRedirection(program, *redirection_list)) {
+      LOG(ERROR)
+          << "Failed to parse the 'control_flow_redirections' section in spec file '"
+          << FLAGS_spec << "'";
+
+      return false;
+    }
+
+  } else if (spec->find("control_flow_redirections") != spec->end()) {
+    LOG(ERROR)
+        << "Non-JSON array value for 'control_flow_redirections' in spec file '"
+        << FLAGS_spec << "'";
+    return false;
+  }
+
+  if (auto ctrl_flow_targets = spec->getArray("control_flow_targets")) {
+    if (!ParseControlFlowTargets(program, *ctrl_flow_targets)) {
+      LOG(ERROR)
+          << "Failed to parse the 'control_flow_targets' section in spec file '"
+          << FLAGS_spec << "'";
+
+      return false;
+    }
+
+  } else if (spec->find("control_flow_targets") != spec->end()) {
+    LOG(ERROR)
+        << "Non-JSON array value for 'control_flow_targets' in spec file '"
+        << FLAGS_spec << "'";
+    return false;
+  }
+
+  if (auto vars = spec->getArray("variables")) {
+    for (llvm::json::Value &var : *vars) {
+      if (auto var_obj = var.getAsObject()) {
+        if (!ParseVariable(arch, context, program, var_obj, types, module)) {
+          return false;
+        }
+      } else {
+        LOG(ERROR) << "Non-JSON object in 'variables' array of spec file '"
+                   << FLAGS_spec << "'";
+        return false;
+      }
+    }
+  } else if (spec->find("variables") != spec->end()) {
+    LOG(ERROR) << "Non-JSON array value for 'variables' in spec file '"
+               << FLAGS_spec << "'";
+    return false;
+  }
+
+  if (auto ranges = spec->getArray("memory")) {
+    if (!ParseRanges(program, *ranges)) {
+      return false;
+    }
+  } else if (spec->find("memory") != spec->end()) {
+    LOG(ERROR) << "Non-JSON array value for 'memory' in spec file '"
+               << FLAGS_spec << "'";
+    return false;
+  }
+
+  if (auto symbols = spec->getArray("symbols")) {
+    for (llvm::json::Value &maybe_ea_name : *symbols) {
+      if (!ParseSymbol(program, maybe_ea_name)) {
+        return false;
+      }
+    }
+  } else if (spec->find("symbols") != spec->end()) {
+    LOG(ERROR) << "Non-JSON array value for 'symbols' in spec file '"
+               << FLAGS_spec << "'";
+    return false;
+  }
+
+  return true;
+}
+
+namespace {
+
+// A minimal, non-allocating scanner over JSON text. It finds the extents of
+// JSON values without building them, so that a large spec can be parsed one
+// declaration at a time, rather than all at once into an in-memory DOM. The
+// values it finds are still parsed, and thus validated, by `llvm::json`.
+class JSONScanner {
+ public:
+  explicit JSONScanner(llvm::StringRef text_) : text(text_) {}
+
+  // Scan a string, returning its raw (still-escaped) contents in `raw`.
+  bool ScanString(llvm::StringRef &raw) {
+    if (!Consume('"')) {
+      return false;
+    }
+    const auto begin = pos;
+    for (; pos < text.size(); ++pos) {
+      if (text[pos] == '\\') {
+        ++pos;
+      } else if (text[pos] == '"') {
+        raw = text.slice(begin, pos++);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Scan a value of any kind, returning its text.
+  bool ScanValue(llvm::StringRef &value) {
+    SkipWhitespace();
+    const auto begin = pos;
+    if (pos >= text.size()) {
+      return false;
+    }
+
+    llvm::StringRef ignored;
+    switch (text[pos]) {
+      case '"':
+        if (!ScanString(ignored)) {
+          return false;
+        }
+        break;
+
+      case '{':
+      case '[': {
+        auto depth = 0u;
+        do {
+          switch (text[pos]) {
+            case '"':
+              if (!ScanString(ignored)) {
+                return false;
+              }
+              continue;
+            case '{':
+            case '[': ++depth; break;
+            case '}':
+            case ']': --depth; break;
+            default: break;
+          }
+          ++pos;
+        } while (depth && pos < text.size());
+
+        if (depth) {
+          return false;
+        }
+        break;
+      }
+
+      default:
+        while (pos < text.size() && !IsDelimiter(text[pos])) {
+          ++pos;
+        }
+        break;
+    }
+
+    value = text.slice(begin, pos);
+    return !value.empty();
+  }
+
+  // Scan an object, invoking `cb` with the raw key of each member. `cb` must
+  // scan the member's value, and return `false` to stop scanning.
+  template <typename CB>
+  bool ForEachMember(CB cb) {
+    if (!Consume('{')) {
+      return false;
+    }
+    if (Consume('}')) {
+      return true;
+    }
+    do {
+      llvm::StringRef key;
+      if (!ScanString(key) || !Consume(':') || !cb(key)) {
+        return false;
+      }
+    } while (Consume(','));
+    return Consume('}');
+  }
+
+  // Scan an array, invoking `cb` for each element. `cb` must scan the
+  // element, and return `false` to stop scanning.
+  template <typename CB>
+  bool ForEachElement(CB cb) {
+    if (!Consume('[')) {
+      return false;
+    }
+    if (Consume(']')) {
+      return true;
+    }
+    do {
+      if (!cb()) {
+        return false;
+      }
+    } while (Consume(','));
+    return Consume(']');
+  }
+
+  // Returns `true` if there is nothing left to scan.
+  bool AtEnd(void) {
+    SkipWhitespace();
+    return pos >= text.size();
+  }
+
+ private:
+  static bool IsDelimiter(char ch) {
+    switch (ch) {
+      case ',':
+      case ':':
+      case '}':
+      case ']':
+      case ' ':
+      case '\t':
+      case '\r':
+      case '\n': return true;
+      default: return false;
+    }
+  }
+
+  void SkipWhitespace(void) {
+    while (pos < text.size()) {
+      switch (text[pos]) {
+        case ' ':
+        case '\t':
+        case '\r':
+        case '\n': ++pos; break;
+        default: return;
+      }
+    }
+  }
+
+  bool Consume(char ch) {
+    SkipWhitespace();
+    if (pos < text.size() && text[pos] == ch) {
+      ++pos;
+      return true;
+    }
+    return false;
+  }
+
+  const llvm::StringRef text;
+  size_t pos{0};
+};
+
+}  // namespace
+
+// Find the top-level members of the JSON spec in `text`, without parsing
+// their values.
+static bool ScanSpecSections(llvm::StringRef text, SpecSections &sections) {
+  JSONScanner scanner(text);
+  auto ok = scanner.ForEachMember([&](llvm::StringRef key) {
+    llvm::StringRef value;
+    if (!scanner.ScanValue(value)) {
+      return false;
+    }
+    sections[key.str()] = value;
+    return true;
+  });
+
+  if (!ok || !scanner.AtEnd()) {
+    LOG(ERROR) << "JSON spec file '" << FLAGS_spec
+               << "' must contain a single object.";
+    return false;
+  }
+
+  return true;
+}
+
+// Parse a small JSON value out of a spec section. Errors are only logged if
+// `log_errors` is `true`.
+static bool ParseJSONValue(llvm::StringRef text, llvm::json::Value &value,
+                           bool log_errors = true) {
+  auto maybe_value = llvm::json::parse(text);
+  if (remill::IsError(maybe_value)) {
+    const auto error = remill::GetErrorString(maybe_value);
+    LOG_IF(ERROR, log_errors)
+        << "Unable to parse JSON spec file '" << FLAGS_spec << "': " << error;
+    return false;
+  }
+  value = std::move(remill::GetReference(maybe_value));
+  return true;
+}
+
+// Invoke `cb` on each element of the array-valued spec section `name`, one
+// element at a time, so that the whole array is never in memory at once.
+template <typename CB>
+static bool ForEachSectionElement(const SpecSections &sections,
+                                  const char *name, CB cb) {
+  auto it = sections.find(name);
+  if (it == sections.end()) {
+    return true;
+  }
+
+  JSONScanner scanner(it->second);
+  auto element_ok = true;
+  auto ok = scanner.ForEachElement([&](void) {
+    llvm::StringRef text;
+    element_ok = scanner.ScanValue(text);
+    if (element_ok) {
+      element_ok = cb(text);
+    }
+    return element_ok;
+  });
+
+  if (!ok && element_ok) {
+    LOG(ERROR) << "Non-JSON array value for '" << name << "' in spec file '"
+               << FLAGS_spec << "'";
+  }
+  return ok;
+}
+
+// Number of elements of a spec section to prepare per parse thread at once.
+static constexpr unsigned kElementsPerParseThread = 64u;
+
+// Like `ForEachSectionElement`, except that each element is first prepared by
+// `prepare(text, item)`, into a default-constructed `T`. Batches of elements
+// are prepared on `--parse_threads` threads, and then `cb(text, item)` is
+// invoked on each of them, in order, on this thread. `prepare` shouldn't log
+// errors, as they'd be out of order; it should leave that to `cb`.
+template <typename T, typename Prepare, typename CB>
+static bool ForEachPreparedSectionElement(const SpecSections &sections,
+                                          const char *name, Prepare prepare,
+                                          CB cb) {
+  const auto num_threads = NumParseThreads();
+  const auto batch_size = num_threads * kElementsPerParseThread;
+  std::vector<llvm::StringRef> batch;
+  std::vector<T> items;
+
+  auto flush = [&](void) {
+    items.clear();
+    items.resize(batch.size());
+    ParallelFor(batch.size(), num_threads,
+                [&](size_t i) { prepare(batch[i], items[i]); });
+
+    for (auto i = 0ul; i < batch.size(); ++i) {
+      if (!cb(batch[i], items[i])) {
+        return false;
+      }
+    }
+    batch.clear();
+    return true;
+  };
+
+  return ForEachSectionElement(sections, name,
+                               [&](llvm::StringRef text) {
+                                 batch.push_back(text);
+                                 return batch.size() < batch_size || flush();
+                               }) &&
+         flush();
+}
+
+namespace {
+
+// A JSON value parsed ahead of time. This is null if it didn't parse.
+struct ParsedValue {
+  llvm::json::Value value{nullptr};
+};
+
+}  // namespace
+
+// Invoke `cb` on each value in the array-valued spec section `name`. The
+// values are parsed in parallel, but `cb` is invoked on them in order.
+template <typename CB>
+static bool ForEachSectionValue(const SpecSections &sections,
+                                const char *name, CB cb) {
+  return ForEachPreparedSectionElement<ParsedValue>(
+      sections, name,
+      [](llvm::StringRef text, ParsedValue &parsed) {
+        ParseJSONValue(text, parsed.value, false);
+      },
+      [&](llvm::StringRef text, ParsedValue &parsed) {
+
+        // Values that failed to parse are parsed again, so that their errors
+        // are reported in order.
+        if (parsed.value.kind() == llvm::json::Value::Null &&
+            !ParseJSONValue(text, parsed.value)) {
+          return false;
+        }
+        return cb(parsed.value);
+      });
+}
+
+// Invoke `cb` on each object in the array-valued spec section `name`.
+template <typename CB>
+static bool ForEachSectionObject(const SpecSections &sections,
+                                 const char *name, CB cb) {
+  return ForEachSectionValue(sections, name, [&](llvm::json::Value &value) {
+    if (auto obj = value.getAsObject()) {
+      return cb(obj);
+    }
+    LOG(ERROR) << "Non-JSON object in '" << name << "' array of spec file '"
+               << FLAGS_spec << "'";
+    return false;
+  });
+}
+
+// Parse an array-valued spec section `name` in one go.
+static bool ParseSectionArray(const SpecSections &sections, const char *name,
+                              llvm::json::Value &value) {
+  auto it = sections.find(name);
+  if (it == sections.end()) {
+    return true;
+  }
+  if (!ParseJSONValue(it->second, value)) {
+    return false;
+  }
+  if (!value.getAsArray()) {
+    LOG(ERROR) << "Non-JSON array value for '" << name << "' in spec file '"
+               << FLAGS_spec << "'";
+    return false;
+  }
+  return true;
+}
+
+// Scan the memory range in `text` into `obj`, except for its hex-encoded
+// data, which is left in `maybe_bytes`, so that it can be decoded straight out
+// of the spec text. Errors are only logged if `log_errors` is `true`.
+static bool ScanRange(llvm::StringRef text, llvm::json::Object &obj,
+                      llvm::Optional<llvm::StringRef> &maybe_bytes,
+                      bool log_errors = true) {
+  JSONScanner scanner(text);
+  auto ok = scanner.ForEachMember([&](llvm::StringRef key) {
+    if (key == "data") {
+      llvm::StringRef bytes;
+      if (!scanner.ScanString(bytes)) {
+        return false;
+      }
+      maybe_bytes = bytes;
+      return true;
+    }
+
+    llvm::StringRef value_text;
+    llvm::json::Value value(nullptr);
+    if (!scanner.ScanValue(value_text) ||
+        !ParseJSONValue(value_text, value, log_errors)) {
+      return false;
+    }
+    obj[key.str()] = std::move(value);
+    return true;
+  });
+
+  LOG_IF(ERROR, !ok && log_errors)
+      << "Non-JSON object in 'memory' array of spec file '" << FLAGS_spec
+      << "'";
+  return ok;
+}
+
+// Stream the memory range in `text` into `program`. The hex-encoded data of
+// the range is decoded straight out of the spec text, and then moved into
+// the program, so that it is never copied as a string.
+static bool StreamRange(anvill::Program &program, llvm::StringRef text) {
+  llvm::json::Object obj;
+  llvm::Optional<llvm::StringRef> maybe_bytes;
+  return ScanRange(text, obj, maybe_bytes) &&
+         ParseRange(program, &obj, maybe_bytes);
+}
+
+namespace {
+
+// A memory range scanned, and decoded, ahead of time by `StreamRanges`.
+struct PreparedRange {
+  llvm::json::Object obj;
+  llvm::Optional<llvm::StringRef> maybe_bytes;
+  std::vector<uint8_t> decoded_bytes;
+  bool is_scanned{false};
+  bool is_decoded{false};
+};
+
+}  // namespace
+
+// Stream the memory ranges of the spec into `program`. The ranges are scanned
+// and decoded in parallel, and then mapped in order.
+static bool StreamRanges(anvill::Program &program,
+                         const SpecSections &sections) {
+  return ForEachPreparedSectionElement<PreparedRange>(
+      sections, "memory",
+      [](llvm::StringRef text, PreparedRange &range) {
+        range.is_scanned =
+            ScanRange(text, range.obj, range.maybe_bytes, false);
+        if (range.is_scanned && range.maybe_bytes) {
+          range.is_decoded = DecodeHexBytes(*range.maybe_bytes, 0,
+                                            range.decoded_bytes, false);
+        }
+      },
+      [&](llvm::StringRef text, PreparedRange &range) {
+
+        // Ranges that failed to scan or decode are streamed again, so that
+        // their errors are reported in order.
+        if (!range.is_scanned) {
+          return StreamRange(program, text);
+        }
+        return ParseRange(program, &(range.obj), range.maybe_bytes,
+                          range.is_decoded ? &(range.decoded_bytes) : nullptr);
+      });
+}
+
+// Parse the core data out of a JSON specification incrementally. This parses
+// the same things as `ParseSpec`, in the same order, but it parses each
+// function, variable, memory range, and symbol on its own, or in small
+// batches with `--parse_threads`.
+static bool StreamSpec(const remill::Arch *arch, llvm::LLVMContext &context,
+                       anvill::Program &program, const SpecSections &sections,
+                       llvm::Module &module) {
+
+  // The type table is small relative to the rest of the spec, and all
+  // declarations refer into it, so it's parsed in one go, and kept alive for
+  // the whole parse.
+  llvm::json::Value type_list(nullptr);
+  SpecTypeTable types;
+  if (!ParseSectionArray(sections, "types", type_list)) {
+    return false;
+  } else if (auto type_array = type_list.getAsArray();
+             type_array && !ParseTypeTable(*type_array, types)) {
+    return false;
+  }
+
+  if (!ForEachSectionObject(sections, "functions",
+                            [&](llvm::json::Object *func_obj) {
+                              return ParseFunction(arch, context, program,
+                                                   func_obj, types, module);
+                            })) {
+    return false;
+  }
+
+  llvm::json::Value redirections(nullptr);
+  if (!ParseSectionArray(sections, "control_flow_redirections",
+                         redirections)) {
+    return false;
+  } else if (auto redirection_list = redirections.getAsArray();
+             redirection_list &&
+             !ParseControlFlowRedirection(program, *redirection_list)) {
+    LOG(ERROR)
+        << "Failed to parse the 'control_flow_redirections' section in spec file '"
+        << FLAGS_spec << "'";
+    return false;
+  }
+
+  llvm::json::Value targets(nullptr);
+  if (!ParseSectionArray(sections, "control_flow_targets", targets)) {
+    return false;
+  } else if (auto ctrl_flow_targets = targets.getAsArray();
+             ctrl_flow_targets &&
+             !ParseControlFlowTargets(program, *ctrl_flow_targets)) {
+    LOG(ERROR)
+        << "Failed to parse the 'control_flow_targets' section in spec file '"
+        << FLAGS_spec << "'";
+    return false;
+  }
+
+  if (!ForEachSectionObject(sections, "variables",
+                            [&](llvm::json::Object *var_obj) {
+                              return ParseVariable(arch, context, program,
+                                                   var_obj, types, module);
+                            })) {
+    return false;
+  }
+
+  if (!StreamRanges(program, sections)) {
+    return false;
+  }
+
+  return ForEachSectionValue(
+      sections, "symbols",
+      [&](llvm::json::Value &value) { return ParseSymbol(program, value); });
+}
+
+// Convert a JSON memory range into a binary spec memory range, reading in
+// its bytes.
+static bool ConvertRange(llvm::json::Object *obj,
+                         anvill::BinarySpec::Range &range) {
+
+  auto maybe_ea = obj->getInteger("address");
+  if (!maybe_ea) {
+    LOG(ERROR) << "Missing address in memory range specification";
+    return false;
+  }
+
+  range.address = static_cast<uint64_t>(*maybe_ea);
+  range.is_writeable = obj->getBoolean("is_writeable").getValueOr(false);
+  range.is_executable = obj->getBoolean("is_executable").getValueOr(false);
+
+  // Zero-fill ranges stay zero-fill ranges in the binary spec.
+  if (obj->getBoolean("zero_fill").getValueOr(false)) {
+    range.is_zero_fill = true;
+    return GetRangeSize(obj, range.address, "zero-fill", range.size);
+  }
+
+  // Blobs are read in just like slices of files.
+  std::string blob_path;
+  llvm::Optional<llvm::StringRef> maybe_file = obj->getString("file");
+  if (auto maybe_blob = obj->getString("blob")) {
+    uint64_t size = 0;
+    if (!GetRangeSize(obj, range.address, "blob-backed", size) ||
+        !GetBlobPath(*maybe_blob, range.address, blob_path)) {
+      return false;
+    }
+    maybe_file = llvm::StringRef(blob_path);
+  }
+
+  if (maybe_file) {
+    auto maybe_size = obj->getInteger("size");
+    auto file_offset = obj->getInteger("file_offset").getValueOr(0);
+    if (!maybe_size || *maybe_size <= 0 || file_offset < 0) {
+      LOG(ERROR) << "Missing or invalid size or file offset in file-backed "
+                 << "memory range specification at address '" << std::hex
+                 << range.address << std::dec << "'.";
+      return false;
+    }
+
+    auto maybe_buff = llvm::MemoryBuffer::getFileSlice(
+        *maybe_file, static_cast<uint64_t>(*maybe_size),
+        static_cast<uint64_t>(file_offset));
+    if (remill::IsError(maybe_buff)) {
+      LOG(ERROR) << "Unable to read file '" << maybe_file->str()
+                 << "' of memory range at address '" << std::hex
+                 << range.address << std::dec
+                 << "': " << remill::GetErrorString(maybe_buff);
+      return false;
+    }
+
+    auto bytes = remill::GetReference(maybe_buff)->getBuffer();
+    range.data.assign(bytes.bytes_begin(), bytes.bytes_end());
+
+  } else if (auto maybe_bytes = obj->getString("data")) {
+    if (!DecodeHexBytes(*maybe_bytes, range.address, range.data)) {
+      return false;
+    }
+
+  } else {
+    LOG(ERROR) << "Missing byte string in memory range specification "
+               << "at address '" << std::hex << range.address << std::dec
+               << '.';
+    return false;
+  }
+
+  range.size = range.data.size();
+  return true;
+}
+
+// Convert the segments of `image` into binary spec memory ranges, reading in
+// their bytes.
+static bool ConvertImage(const anvill::BinaryImage &image,
+                         std::vector<anvill::BinarySpec::Range> &memory) {
+  for (const auto &seg : image.segments) {
+    if (seg.file_size) {
+      auto maybe_buff = llvm::MemoryBuffer::getFileSlice(
+          image.Path(), seg.file_size, seg.file_offset);
+      if (remill::IsError(maybe_buff)) {
+        LOG(ERROR) << "Unable to read segment at address '" << std::hex
+                   << seg.address << std::dec << "' of image '" << image.Path()
+                   << "': " << remill::GetErrorString(maybe_buff);
+        return false;
+      }
+
+      auto &range = memory.emplace_back();
+      auto bytes = remill::GetReference(maybe_buff)->getBuffer();
+      range.address = seg.address;
+      range.is_writeable = seg.is_writeable;
+      range.is_executable = seg.is_executable;
+      range.data.assign(bytes.bytes_begin(), bytes.bytes_end());
+      range.size = range.data.size();
+    }
+
+    if (seg.size > seg.file_size) {
+      auto &range = memory.emplace_back();
+      range.address = seg.address + seg.file_size;
+      range.size = seg.size - seg.file_size;
+      range.is_writeable = seg.is_writeable;
+      range.is_executable = seg.is_executable;
+      range.is_zero_fill = true;
+    }
+  }
+  return true;
+}
+
+// Convert the JSON spec `spec` into a binary spec, and write it to `path`. If
+// the spec names an image, then the segments of `image` become memory ranges
+// of the binary spec.
+bool ConvertSpec(llvm::json::Object *spec, const std::string &arch_str,
+                 const std::string &os_str, const anvill::BinaryImage *image,
+                 const std::string &path) {
+  anvill::BinarySpec binary_spec;
+  binary_spec.arch = arch_str;
+  binary_spec.os = os_str;
+
+  // Invoke `cb` on each element of the array-valued member `name` of `spec`.
+  auto for_each = [=](const char *name, auto cb) {
+    if (auto elems = spec->getArray(name)) {
+      for (llvm::json::Value &elem : *elems) {
+        if (!cb(elem)) {
+          return false;
+        }
+      }
+    } else if (spec->find(name) != spec->end()) {
+      LOG(ERROR) << "Non-JSON array value for '" << name << "' in spec file '"
+                 << FLAGS_spec << "'";
+      return false;
+    }
+    return true;
+  };
+
+  // Invoke `cb` on each object in the array-valued member `name` of `spec`.
+  auto for_each_object = [=](const char *name, auto cb) {
+    return for_each(name, [=](llvm::json::Value &elem) {
+      if (auto obj = elem.getAsObject()) {
+        return cb(obj);
+      }
+      LOG(ERROR) << "Non-JSON object in '" << name << "' array of spec file '"
+                 << FLAGS_spec << "'";
+      return false;
+    });
+  };
+
+  // Binary specs intern all of their strings, so types from the type table
+  // end up being stored once anyway.
+  SpecTypeTable types;
+  auto ok =
+      for_each("types",
+               [&](llvm::json::Value &elem) {
+                 if (auto type = elem.getAsString()) {
+                   types.push_back(*type);
+                   return true;
+                 }
+                 LOG(ERROR) << "Non-string value in 'types' array of spec "
+                            << "file '" << FLAGS_spec << "'";
+                 return false;
+               }) &&
+      for_each_object("functions",
+                      [&](llvm::json::Object *obj) {
+                        return ParseFunction(
+                            obj, binary_spec.functions.emplace_back(), types);
+                      }) &&
+      for_each_object("variables",
+                      [&](llvm::json::Object *obj) {
+                        return ParseVariable(
+                            obj, binary_spec.variables.emplace_back(), types);
+                      }) &&
+      (!image || ConvertImage(*image, binary_spec.memory)) &&
+      for_each_object("memory",
+                      [&](llvm::json::Object *obj) {
+                        return ConvertRange(obj,
+                                            binary_spec.memory.emplace_back());
+                      }) &&
+      for_each("symbols",
+               [&](llvm::json::Value &elem) {
+                 return ParseSymbol(elem, binary_spec.symbols.emplace_back());
+               });
+
+  if (!ok) {
+    return false;
+  }
+
+  if (auto redirection_list = spec->getArray("control_flow_redirections");
+      redirection_list &&
+      !ParseControlFlowRedirection(*redirection_list,
+                                   binary_spec.control_flow_redirections)) {
+    return false;
+  }
+
+  if (auto ctrl_flow_targets = spec->getArray("control_flow_targets");
+      ctrl_flow_targets &&
+      !ParseControlFlowTargets(*ctrl_flow_targets,
+                               binary_spec.control_flow_targets)) {
+    return false;
+  }
+
+  auto err = binary_spec.Write(path);
+  if (remill::IsError(err)) {
+    LOG(ERROR) << remill::GetErrorString(err);
+    return false;
+  }
+
+  return true;
+}
+
+// Declare the contents of a binary spec in `program`. This declares things
+// in the same order as `ParseSpec`.
+static bool DeclareSpec(const remill::Arch *arch, llvm::LLVMContext &context,
+                        anvill::Program &program,
+                        const anvill::BinarySpec &spec, llvm::Module &module) {
+  for (const auto &func : spec.functions) {
+    if (!DeclareFunction(arch, context, program, func, module)) {
+      return false;
+    }
+  }
+
+  DeclareControlFlowRedirections(program, spec.control_flow_redirections);
+  if (!DeclareControlFlowTargets(program, spec.control_flow_targets)) {
+    return false;
+  }
+
+  for (const auto &var : spec.variables) {
+    if (!DeclareVariable(arch, context, program, var, module)) {
+      return false;
+    }
+  }
+
+  auto err = spec.MapMemory(program);
+  if (remill::IsError(err)) {
+    LOG(ERROR) << remill::GetErrorString(err);
+    return false;
+  }
+
+  for (const auto &sym : spec.symbols) {
+    program.AddNameToAddress(sym.name.str(), sym.address);
+  }
+
+  return true;
+}
+
+// Keep every declaration in `module` alive, by referring to it from a new
+// variable, until the returned variable is erased. If `pin_definitions` is
+// `true`, then every definition is kept alive too.
+llvm::GlobalVariable *PinDeclarations(llvm::Module &module,
+                                      bool pin_definitions) {
+  auto i8_ptr_type = llvm::Type::getInt8PtrTy(module.getContext());
+  std::vector<llvm::Constant *> decls;
+  for (auto &gv : module.global_values()) {
+    if ((pin_definitions || gv.isDeclaration()) &&
+        !(llvm::isa<llvm::Function>(gv) &&
+          llvm::cast<llvm::Function>(gv).isIntrinsic())) {
+      decls.push_back(
+          llvm::ConstantExpr::getPointerBitCastOrAddrSpaceCast(&gv,
+                                                                i8_ptr_type));
+    }
+  }
+
+  auto pins_type = llvm::ArrayType::get(i8_ptr_type, decls.size());
+  return new llvm::GlobalVariable(
+      module, pins_type, true, llvm::GlobalValue::ExternalLinkage,
+      llvm::ConstantArray::get(pins_type, decls), "anvill.pinned_decls");
+}
+
+// Read in the spec at `path`, in the format of `--spec_format`, into `spec`.
+bool LoadSpec(const std::string &path, LoadedSpec &spec) {
+  const auto is_binary_spec = FLAGS_spec_format == "binary";
+
+  // Take the architecture and OS names out of the spec, and
+  // fall back on the command-line flags if those are missing.
+  spec.arch_str = FLAGS_arch;
+  spec.os_str = FLAGS_os;
+
+  if (!is_binary_spec) {
+    auto maybe_buff = llvm::MemoryBuffer::getFileOrSTDIN(path);
+    if (remill::IsError(maybe_buff)) {
+      LOG(ERROR) << "Unable to read JSON spec file '" << path
+                 << "': " << remill::GetErrorString(maybe_buff);
+      return false;
+    }
+
+    spec.buff = std::move(remill::GetReference(maybe_buff));
+  }
+
+  if (is_binary_spec) {
+    auto maybe_spec = anvill::BinarySpec::Read(path);
+    if (remill::IsError(maybe_spec)) {
+      LOG(ERROR) << "Unable to read binary spec file '" << path
+                 << "': " << remill::GetErrorString(maybe_spec);
+      return false;
+    }
+
+    spec.binary_spec = std::move(remill::GetReference(maybe_spec));
+
+    if (!spec.binary_spec.arch.empty()) {
+      spec.arch_str = spec.binary_spec.arch;
+    }
+
+    if (!spec.binary_spec.os.empty()) {
+      spec.os_str = spec.binary_spec.os;
+    }
+
+    spec.parse_spec = [&spec](const remill::Arch *arch,
+                              llvm::LLVMContext &context,
+                              anvill::Program &program, llvm::Module &module) {
+      return DeclareSpec(arch, context, program, spec.binary_spec, module);
+    };
+
+  } else if (FLAGS_stream_spec) {
+    if (!ScanSpecSections(spec.buff->getBuffer(), spec.sections)) {
+      return false;
+    }
+
+    for (auto [name, str] : {std::make_pair("arch", &spec.arch_str),
+                             std::make_pair("os", &spec.os_str),
+                             std::make_pair("image", &spec.image_path)}) {
+      llvm::json::Value value(nullptr);
+      if (auto it = spec.sections.find(name); it == spec.sections.end()) {
+        continue;
+      } else if (!ParseJSONValue(it->second, value)) {
+        return false;
+      } else if (auto maybe_str = value.getAsString()) {
+        *str = maybe_str->str();
+      }
+    }
+
+    spec.parse_spec = [&spec](const remill::Arch *arch,
+                              llvm::LLVMContext &context,
+                              anvill::Program &program, llvm::Module &module) {
+      return StreamSpec(arch, context, program, spec.sections, module);
+    };
+
+  } else {
+    auto maybe_json = llvm::json::parse(spec.buff->getBuffer());
+    if (remill::IsError(maybe_json)) {
+      LOG(ERROR) << "Unable to parse JSON spec file '" << path
+                 << "': " << remill::GetErrorString(maybe_json);
+      return false;
+    }
+
+    spec.json = std::move(remill::GetReference(maybe_json));
+    const auto json_spec = spec.json.getAsObject();
+    if (!json_spec) {
+      LOG(ERROR) << "JSON spec file '" << path
+                 << "' must contain a single object.";
+      return false;
+    }
+
+    if (auto maybe_arch = json_spec->getString("arch")) {
+      spec.arch_str = maybe_arch->str();
+    }
+
+    if (auto maybe_os = json_spec->getString("os")) {
+      spec.os_str = maybe_os->str();
+    }
+
+    if (auto maybe_image = json_spec->getString("image")) {
+      spec.image_path = maybe_image->str();
+    }
+
+    spec.parse_spec = [=](const remill::Arch *arch, llvm::LLVMContext &context,
+                          anvill::Program &program, llvm::Module &module) {
+      return ParseSpec(arch, context, program, json_spec, module);
+    };
+  }
+
+  if (spec.image_path.empty()) {
+    return true;
+  }
+
+  auto maybe_image = anvill::BinaryImage::Read(spec.image_path);
+  if (remill::IsError(maybe_image)) {
+    LOG(ERROR) << "Unable to read image of spec file '" << path
+               << "': " << remill::GetErrorString(maybe_image);
+    return false;
+  }
+
+  spec.image.emplace(std::move(remill::GetReference(maybe_image)));
+
+  // The segments of the image are mapped before anything else in the spec, so
+  // that the spec's own memory ranges, if any, can't silently shadow them;
+  // overlaps are reported as errors instead.
+  spec.parse_spec = [&spec, parse_spec = std::move(spec.parse_spec)](
+                        const remill::Arch *arch, llvm::LLVMContext &context,
+                        anvill::Program &program, llvm::Module &module) {
+    auto err = spec.image->MapMemory(program);
+    if (remill::IsError(err)) {
+      LOG(ERROR) << "Unable to map image '" << spec.image_path
+                 << "': " << remill::GetErrorString(err);
+      return false;
+    }
+    return parse_spec(arch, context, program, module);
+  };
+
+  return true;
+}
+
+// Build the program described by `spec`, as lifting it would, and write a
+// snapshot of it to `path` as a binary spec.
+bool SnapshotSpec(const LoadedSpec &spec, const std::string &path) {
+  llvm::LLVMContext context;
+  llvm::Module module("spec", context);
+  auto arch = BuildArch(context, spec.arch_str, spec.os_str);
+  if (!arch) {
+    return false;
+  }
+
+  anvill::Program program;
+  auto memory = anvill::MemoryProvider::CreateProgramMemoryProvider(program);
+  auto types =
+      anvill::TypeProvider::CreateProgramTypeProvider(context, program);
+
+  auto ctrl_flow_provider_res = anvill::IControlFlowProvider::Create(program);
+  if (!ctrl_flow_provider_res.Succeeded()) {
+    std::cerr << "Failed to create the control flow provider: "
+              << magic_enum::enum_name(ctrl_flow_provider_res.TakeError())
+              << "\n";
+    return false;
+  }
+
+  anvill::LifterOptions options(arch.get(), module,
+                                ctrl_flow_provider_res.TakeValue());
+  ConfigureLifterOptions(options, nullptr);
+
+  // As in `LiftSpec`, the semantics have to be loaded before the spec can be
+  // parsed.
+  anvill::EntityLifter lifter(options, memory, types);
+
+  program.TrustDecls(FLAGS_trusted_spec);
+  if (!spec.parse_spec(arch.get(), context, program, module)) {
+    return false;
+  }
+
+  if (FLAGS_speculate_jump_tables) {
+    (void) anvill::SpeculateJumpTableTargets(program, arch.get());
+  }
+
+  program.Freeze(module.getDataLayout());
+
+  auto snapshot =
+      anvill::BinarySpec::Snapshot(program, module.getDataLayout());
+  snapshot.arch = spec.arch_str;
+  snapshot.os = spec.os_str;
+
+  auto err = snapshot.Write(path);
+  if (remill::IsError(err)) {
+    LOG(ERROR) << remill::GetErrorString(err);
+    return false;
+  }
+
+  return true;
+}
+
+// Returns `false`, after logging why, if `--spec_format` is invalid, or if
+// options that only apply to some specs, e.g. `--stream_spec`, are given
+// with specs that they don't apply to.
+bool CheckSpecFlags(void) {
+  if (FLAGS_spec_format != "json" && FLAGS_spec_format != "binary") {
+    LOG(ERROR) << "Unsupported spec format '" << FLAGS_spec_format
+               << "' in --spec_format; expected 'json' or 'binary'.";
+    return false;
+  }
+
+  const auto is_binary_spec = FLAGS_spec_format == "binary";
+  if (is_binary_spec && (FLAGS_stream_spec || !FLAGS_binary_spec_out.empty())) {
+    LOG(ERROR) << "The --stream_spec and --binary_spec_out options only "
+               << "apply to JSON specs.";
+    return false;
+  }
+
+  if (!FLAGS_snapshot_out.empty() &&
+      (FLAGS_spec.empty() || !FLAGS_binary_spec_out.empty() ||
+       !FLAGS_batch.empty() || !FLAGS_serve.empty() ||
+       !FLAGS_queue_dir.empty() || !FLAGS_reoptimize_bc.empty())) {
+    LOG(ERROR) << "The --snapshot_out option needs --spec, and doesn't apply "
+               << "to --binary_spec_out, --batch, --serve, --queue_dir, or "
+               << "--reoptimize_bc.";
+    return false;
+  }
+
+  return true;
+}
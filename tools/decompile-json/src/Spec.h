@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <anvill/BinaryImage.h>
+#include <anvill/BinarySpec.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace anvill {
+struct FunctionDecl;
+class Program;
+}  // namespace anvill
+namespace llvm {
+class GlobalVariable;
+class LLVMContext;
+class Module;
+}  // namespace llvm
+namespace remill {
+class Arch;
+}  // namespace remill
+
+// The type specifications in the `types` table of a JSON spec. Declarations
+// can refer to a type in the table by its index, rather than repeating the
+// type's specification.
+using SpecTypeTable = std::vector<llvm::StringRef>;
+
+// Try to unserialize function info from a JSON specification. These
+// are really function prototypes / declarations, and not any isntruction
+// data (that is separate, if present).
+bool ParseFunction(llvm::json::Object *obj, anvill::BinarySpec::Function &func,
+                   const SpecTypeTable &types);
+
+// Make the declaration `decl` of a function, given its spec.
+bool MakeFunctionDecl(const remill::Arch *arch, llvm::LLVMContext &context,
+                      const anvill::BinarySpec::Function &func,
+                      llvm::Module &module, anvill::FunctionDecl &decl);
+
+// Convert the JSON spec `spec` into a binary spec, and write it to `path`. If
+// the spec names an image, then the segments of `image` become memory ranges
+// of the binary spec.
+bool ConvertSpec(llvm::json::Object *spec, const std::string &arch_str,
+                 const std::string &os_str, const anvill::BinaryImage *image,
+                 const std::string &path);
+
+// Keep every declaration in `module` alive, by referring to it from a new
+// variable, until the returned variable is erased. If `pin_definitions` is
+// `true`, then every definition is kept alive too.
+llvm::GlobalVariable *PinDeclarations(llvm::Module &module,
+                                      bool pin_definitions = false);
+
+// The text of each top-level member of a JSON spec, keyed by member name.
+using SpecSections = std::unordered_map<std::string, llvm::StringRef>;
+
+// Parses a spec into an `anvill::Program`. This is either `ParseSpec` applied
+// to an already-parsed JSON spec, `StreamSpec` applied to the spec's text, or
+// `DeclareSpec` applied to a binary spec.
+using SpecParser =
+    std::function<bool(const remill::Arch *, llvm::LLVMContext &,
+                       anvill::Program &, llvm::Module &)>;
+
+// A spec that has been read in, and that is ready to be parsed into a
+// `anvill::Program` by `parse_spec`.
+//
+// `parse_spec` refers to the other fields, so a loaded spec must stay where it
+// was loaded.
+struct LoadedSpec {
+  std::string arch_str;
+  std::string os_str;
+  std::string image_path;
+  std::optional<anvill::BinaryImage> image;
+  std::unique_ptr<llvm::MemoryBuffer> buff;
+  llvm::json::Value json{nullptr};
+  SpecSections sections;
+  anvill::BinarySpec binary_spec;
+  SpecParser parse_spec;
+
+  // The text of a JSON spec, or empty for a binary spec.
+  inline llvm::StringRef Text(void) const {
+    return buff ? buff->getBuffer() : llvm::StringRef();
+  }
+};
+
+// Read in the spec at `path`, in the format of `--spec_format`, into `spec`.
+bool LoadSpec(const std::string &path, LoadedSpec &spec);
+
+// Build the program described by `spec`, as lifting it would, and write a
+// snapshot of it to `path` as a binary spec.
+bool SnapshotSpec(const LoadedSpec &spec, const std::string &path);
+
+// Returns `false`, after logging why, if `--spec_format` is invalid, or if
+// options that only apply to some specs, e.g. `--stream_spec`, are given
+// with specs that they don't apply to.
+bool CheckSpecFlags(void);
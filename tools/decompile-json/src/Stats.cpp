@@ -0,0 +1,352 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Stats.h"
+
+#include <anvill/Lifters/EntityLifter.h>
+#include <anvill/Program.h>
+#include <anvill/Trace.h>
+#include <glog/logging.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/raw_ostream.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+DEFINE_string(pass_report_out, "",
+              "Path to which a JSON report of what each optimization pass "
+              "did should be written. For each pass, and each function that "
+              "it ran on, the report has the time spent, how often the pass "
+              "changed anything, and the number of instructions, blocks, and "
+              "memory operations that it removed, summed over every spec of "
+              "the run. Passes that appear more than once in the pipeline "
+              "are reported separately, by occurrence. Counting slows down "
+              "optimization.");
+
+const char *const kPhaseNames[kNumPhases] = {"parse", "lift", "optimize",
+                                             "output"};
+
+// Raise `max` to `val`, if `val` is bigger.
+void UpdateMax(std::atomic<uint64_t> &max, uint64_t val) {
+  for (auto curr = max.load(); curr < val;) {
+    if (max.compare_exchange_weak(curr, val)) {
+      break;
+    }
+  }
+}
+
+// Record how much memory is live in each category into `stats`.
+static void RecordLiveBytes(RunStats &stats) {
+  uint64_t total_live_bytes = 0u;
+  for (auto i = 0u; i < kNumMemoryCategories; ++i) {
+    const auto live_bytes = LiveBytes(static_cast<MemoryCategory>(i));
+    UpdateMax(stats.peak_live_bytes[i], live_bytes);
+    total_live_bytes += live_bytes;
+  }
+  UpdateMax(stats.peak_total_live_bytes, total_live_bytes);
+}
+
+// Record the memory usage of `program` into `stats`.
+void RecordProgramMemory(RunStats &stats, const anvill::Program &program) {
+  const auto usage = program.GetMemoryUsage();
+  UpdateMax(stats.program_owned_data_bytes, usage.owned_data_bytes);
+  UpdateMax(stats.program_mapped_data_bytes, usage.mapped_data_bytes);
+  UpdateMax(stats.program_zero_fill_bytes, usage.zero_fill_bytes);
+  UpdateMax(stats.program_metadata_bytes, usage.metadata_bytes);
+  UpdateMax(stats.program_decl_bytes, usage.decl_bytes);
+  UpdateMax(stats.program_name_bytes, usage.name_bytes);
+  UpdateMax(stats.program_index_bytes, usage.index_bytes);
+}
+
+// Returns the CPU time used so far by the calling thread, in microseconds.
+static uint64_t ThreadCPUTime(void) {
+  struct timespec ts = {};
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000u +
+         static_cast<uint64_t>(ts.tv_nsec) / 1000u;
+}
+
+// Returns the wall time since some fixed point, in microseconds.
+uint64_t WallTime(void) {
+  return static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count());
+}
+
+// The memory category of the allocations made during each phase.
+static const MemoryCategory kPhaseMemoryCategories[kNumPhases] = {
+    kMemoryParse, kMemoryLift, kMemoryOptimize, kMemoryOutput};
+
+PhaseTimer::PhaseTimer(RunStats *stats_, RunPhase phase_)
+    : stats(stats_),
+      phase(phase_),
+      wall_start(stats ? WallTime() : 0u),
+      cpu_start(stats ? ThreadCPUTime() : 0u),
+      memory_scope(kPhaseMemoryCategories[phase_]) {}
+
+PhaseTimer::~PhaseTimer(void) {
+  if (stats) {
+    stats->wall_us[phase] += WallTime() - wall_start;
+    stats->cpu_us[phase] += ThreadCPUTime() - cpu_start;
+    RecordLiveBytes(*stats);
+  }
+}
+
+// Add the impact of the pass run recorded by `event`.
+void PassImpactReport::Observe(const anvill::TraceEvent &event) {
+  if (event.category != "pass") {
+    return;
+  }
+
+  std::optional<uint64_t> occurrence;
+  std::optional<uint64_t> changed;
+  int64_t blocks_removed = 0;
+  int64_t memory_ops_removed = 0;
+  for (const auto &[name, value] : event.counters) {
+    if (name == "occurrence") {
+      occurrence = value;
+    } else if (name == "changed") {
+      changed = value;
+    } else if (name == "blocks_before") {
+      blocks_removed += static_cast<int64_t>(value);
+    } else if (name == "blocks_after") {
+      blocks_removed -= static_cast<int64_t>(value);
+    } else if (name == "memory_ops_before") {
+      memory_ops_removed += static_cast<int64_t>(value);
+    } else if (name == "memory_ops_after") {
+      memory_ops_removed -= static_cast<int64_t>(value);
+    }
+  }
+
+  // Events without an occurrence, e.g. the one covering all of the module
+  // passes, aren't the run of any one pass.
+  if (!occurrence) {
+    return;
+  }
+
+  PassImpact run;
+  run.runs = 1u;
+  run.time_us = event.duration_us;
+  if (changed) {
+    run.changed_runs = *changed ? 1u : 0u;
+    run.unchanged_time_us = *changed ? 0u : event.duration_us;
+  }
+  run.instructions_removed =
+      static_cast<int64_t>(event.instructions_before) -
+      static_cast<int64_t>(event.instructions_after);
+  run.blocks_removed = blocks_removed;
+  run.memory_ops_removed = memory_ops_removed;
+
+  const PassKey key(event.name, *occurrence);
+  std::lock_guard<std::mutex> locker(lock);
+  passes[key].Add(run);
+
+  // Call site passes run over the whole module at once, so their impact isn't
+  // attributed to any function.
+  if (!event.function.empty()) {
+    auto &function = functions[event.function];
+    if (event.address) {
+      function.address = event.address;
+    }
+    function.passes[key].Add(run);
+  }
+}
+
+// Write the report to `path` as a JSON object.
+bool PassImpactReport::Write(const std::string &path) const {
+  std::error_code ec;
+  llvm::raw_fd_ostream os(path, ec, llvm::sys::fs::OF_Text);
+  if (ec) {
+    LOG(ERROR) << "Unable to open pass report file '" << path
+               << "': " << ec.message();
+    return false;
+  }
+
+  std::lock_guard<std::mutex> locker(lock);
+
+  auto write_passes = [](llvm::json::OStream &json,
+                         const PassImpactMap &impacts) {
+    std::vector<const PassImpactMap::value_type *> sorted;
+    for (const auto &entry : impacts) {
+      sorted.push_back(&entry);
+    }
+    std::stable_sort(sorted.begin(), sorted.end(),
+                     [](const auto *a, const auto *b) {
+                       return a->second.time_us > b->second.time_us;
+                     });
+
+    json.array([&] {
+      for (const auto *entry : sorted) {
+        const auto &[key, impact] = *entry;
+        json.object([&, &key = key, &impact = impact] {
+          json.attribute("pass", key.first);
+          json.attribute("occurrence", static_cast<int64_t>(key.second));
+          json.attribute("runs", static_cast<int64_t>(impact.runs));
+          json.attribute("changed_runs",
+                         static_cast<int64_t>(impact.changed_runs));
+          json.attribute("time_us", static_cast<int64_t>(impact.time_us));
+          json.attribute("unchanged_time_us",
+                         static_cast<int64_t>(impact.unchanged_time_us));
+          json.attribute("instructions_removed", impact.instructions_removed);
+          json.attribute("blocks_removed", impact.blocks_removed);
+          json.attribute("memory_ops_removed", impact.memory_ops_removed);
+        });
+      }
+    });
+  };
+
+  llvm::json::OStream json(os, 2);
+  json.object([&] {
+    json.attributeBegin("passes");
+    write_passes(json, passes);
+    json.attributeEnd();
+
+    json.attributeArray("functions", [&] {
+      for (const auto &[name, function] : functions) {
+        json.object([&, &name = name, &function = function] {
+          json.attribute("function", name);
+          if (function.address) {
+            json.attribute("address", llvm::utohexstr(*function.address));
+          }
+          json.attributeBegin("passes");
+          write_passes(json, function.passes);
+          json.attributeEnd();
+        });
+      }
+    });
+  });
+  os << '\n';
+  return true;
+}
+
+// Returns the number of instructions in the function definitions of `module`.
+uint64_t CountInstructions(const llvm::Module &module) {
+  uint64_t num_insts = 0u;
+  for (const auto &func : module) {
+    num_insts += func.getInstructionCount();
+  }
+  return num_insts;
+}
+
+// Write `stats` to `path` as a JSON object. `wall_us` is the wall time of the
+// whole run.
+bool WriteRunStats(const RunStats &stats, uint64_t wall_us,
+                   const std::string &path) {
+  std::error_code ec;
+  llvm::raw_fd_ostream os(path, ec, llvm::sys::fs::OF_Text);
+  if (ec) {
+    LOG(ERROR) << "Unable to open stats file '" << path
+               << "': " << ec.message();
+    return false;
+  }
+
+  struct rusage usage = {};
+  getrusage(RUSAGE_SELF, &usage);
+  const auto cpu_us =
+      static_cast<uint64_t>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) *
+          1000000u +
+      static_cast<uint64_t>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+
+  // `ru_maxrss` is in bytes on macOS, and in kilobytes elsewhere.
+#ifdef __APPLE__
+  const auto peak_rss_kb = static_cast<uint64_t>(usage.ru_maxrss) / 1024u;
+#else
+  const auto peak_rss_kb = static_cast<uint64_t>(usage.ru_maxrss);
+#endif
+
+  auto as_int = [](const std::atomic<uint64_t> &val) {
+    return static_cast<int64_t>(val.load());
+  };
+
+  llvm::json::OStream json(os, 2);
+  json.object([&] {
+    json.attribute("specs", as_int(stats.num_specs));
+    json.attribute("failed_specs", as_int(stats.num_failed_specs));
+    json.attribute("wall_us", static_cast<int64_t>(wall_us));
+    json.attribute("cpu_us", static_cast<int64_t>(cpu_us));
+    json.attribute("peak_rss_kb", static_cast<int64_t>(peak_rss_kb));
+    json.attribute("functions_lifted", as_int(stats.num_functions_lifted));
+    json.attribute("functions_cached", as_int(stats.num_functions_cached));
+    json.attribute("functions_deduplicated",
+                   as_int(stats.num_functions_deduplicated));
+    json.attribute("functions_compressed",
+                   as_int(stats.num_functions_compressed));
+    json.attribute("jump_tables_speculated",
+                   as_int(stats.num_jump_tables_speculated));
+    json.attribute("instructions_before_opt",
+                   as_int(stats.instructions_before_opt));
+    json.attribute("instructions_after_opt",
+                   as_int(stats.instructions_after_opt));
+    json.attribute("provenance_records", as_int(stats.provenance_records));
+    json.attribute("surviving_provenance_records",
+                   as_int(stats.surviving_provenance_records));
+    json.attributeObject("phases", [&] {
+      for (auto i = 0u; i < kNumPhases; ++i) {
+        json.attributeObject(kPhaseNames[i], [&] {
+          json.attribute("wall_us", as_int(stats.wall_us[i]));
+          json.attribute("cpu_us", as_int(stats.cpu_us[i]));
+        });
+      }
+    });
+
+    // Only allocations made with `operator new` are attributed to categories,
+    // and only when built with `ANVILL_ENABLE_ALLOCATION_ACCOUNTING`; memory
+    // that LLVM gets from `malloc` directly, e.g. for `SmallVector`s, isn't.
+    json.attributeObject("memory", [&] {
+      json.attribute("peak_live_bytes", as_int(stats.peak_total_live_bytes));
+      json.attributeObject("categories", [&] {
+        for (auto i = 0u; i < kNumMemoryCategories; ++i) {
+          json.attributeObject(kMemoryCategoryNames[i], [&] {
+            json.attribute("peak_live_bytes", as_int(stats.peak_live_bytes[i]));
+            json.attribute("live_bytes",
+                           static_cast<int64_t>(
+                               LiveBytes(static_cast<MemoryCategory>(i))));
+          });
+        }
+      });
+      json.attribute("semantics_cache_bytes",
+                     static_cast<int64_t>(
+                         anvill::EntityLifter::SemanticsCacheBytes()));
+      json.attribute("peak_compressed_function_bytes",
+                     as_int(stats.peak_compressed_function_bytes));
+      json.attribute("peak_compressed_function_bitcode_bytes",
+                     as_int(stats.peak_compressed_function_bitcode_bytes));
+      json.attributeObject("program", [&] {
+        json.attribute("owned_data_bytes",
+                       as_int(stats.program_owned_data_bytes));
+        json.attribute("mapped_data_bytes",
+                       as_int(stats.program_mapped_data_bytes));
+        json.attribute("zero_fill_bytes",
+                       as_int(stats.program_zero_fill_bytes));
+        json.attribute("metadata_bytes", as_int(stats.program_metadata_bytes));
+        json.attribute("decl_bytes", as_int(stats.program_decl_bytes));
+        json.attribute("name_bytes", as_int(stats.program_name_bytes));
+        json.attribute("index_bytes", as_int(stats.program_index_bytes));
+      });
+    });
+  });
+  os << '\n';
+  return true;
+}
@@ -0,0 +1,202 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <utility>
+
+#include "Allocator.h"
+
+namespace anvill {
+class Program;
+struct TraceEvent;
+}  // namespace anvill
+namespace llvm {
+class Module;
+}  // namespace llvm
+
+// The phases of decompiling a spec that are summarized by `--stats_out`.
+enum RunPhase : unsigned {
+  kPhaseParse,
+  kPhaseLift,
+  kPhaseOptimize,
+  kPhaseOutput,
+  kNumPhases
+};
+
+extern const char *const kPhaseNames[kNumPhases];
+
+// Summary of a whole run, for `--stats_out`. Shards and batch workers all add
+// into the same summary, so the time of a phase is summed across threads.
+struct RunStats {
+  std::atomic<uint64_t> wall_us[kNumPhases] = {};
+  std::atomic<uint64_t> cpu_us[kNumPhases] = {};
+  std::atomic<uint64_t> num_specs{0u};
+  std::atomic<uint64_t> num_failed_specs{0u};
+  std::atomic<uint64_t> num_functions_lifted{0u};
+  std::atomic<uint64_t> num_functions_cached{0u};
+  std::atomic<uint64_t> num_functions_deduplicated{0u};
+  std::atomic<uint64_t> num_functions_compressed{0u};
+  std::atomic<uint64_t> num_jump_tables_speculated{0u};
+  std::atomic<uint64_t> instructions_before_opt{0u};
+  std::atomic<uint64_t> instructions_after_opt{0u};
+
+  // How many data provenance records were made, and how many of them
+  // survived optimization, with `--enable_provenance`.
+  std::atomic<uint64_t> provenance_records{0u};
+  std::atomic<uint64_t> surviving_provenance_records{0u};
+
+  // The most live bytes seen in each memory category at the end of a phase,
+  // and in all categories together.
+  std::atomic<uint64_t> peak_live_bytes[kNumMemoryCategories] = {};
+  std::atomic<uint64_t> peak_total_live_bytes{0u};
+
+  // The most bytes of compressed bitcode, and of the bitcode before it was
+  // compressed, held by `--compress_idle_functions` at any one time.
+  std::atomic<uint64_t> peak_compressed_function_bytes{0u};
+  std::atomic<uint64_t> peak_compressed_function_bitcode_bytes{0u};
+
+  // The largest memory usage of any one program, as of when it was frozen.
+  std::atomic<uint64_t> program_owned_data_bytes{0u};
+  std::atomic<uint64_t> program_mapped_data_bytes{0u};
+  std::atomic<uint64_t> program_zero_fill_bytes{0u};
+  std::atomic<uint64_t> program_metadata_bytes{0u};
+  std::atomic<uint64_t> program_decl_bytes{0u};
+  std::atomic<uint64_t> program_name_bytes{0u};
+  std::atomic<uint64_t> program_index_bytes{0u};
+
+  // Specs or served requests being worked on right now, and the number of
+  // jobs that were left in `--queue_dir` when it was last looked at, for
+  // `--metrics_addr`.
+  std::atomic<uint64_t> active_jobs{0u};
+  std::atomic<uint64_t> queued_jobs{0u};
+};
+
+// Raise `max` to `val`, if `val` is bigger.
+void UpdateMax(std::atomic<uint64_t> &max, uint64_t val);
+
+// Record the memory usage of `program` into `stats`.
+void RecordProgramMemory(RunStats &stats, const anvill::Program &program);
+
+// Returns the wall time since some fixed point, in microseconds.
+uint64_t WallTime(void);
+
+// Adds the time spent in a region of code to a phase of a `RunStats`, and
+// attributes the memory allocated in that region to the phase. A timer with
+// null stats only does the latter.
+class PhaseTimer {
+ public:
+  PhaseTimer(RunStats *stats_, RunPhase phase_);
+  ~PhaseTimer(void);
+
+ private:
+  PhaseTimer(const PhaseTimer &) = delete;
+  PhaseTimer &operator=(const PhaseTimer &) = delete;
+
+  RunStats *const stats;
+  const RunPhase phase;
+  const uint64_t wall_start;
+  const uint64_t cpu_start;
+  MemoryScope memory_scope;
+};
+
+// Counts a spec or served request as being worked on in a `RunStats`, until
+// destroyed. A scope with null stats does nothing.
+class ActiveJobScope {
+ public:
+  explicit ActiveJobScope(RunStats *stats_) : stats(stats_) {
+    if (stats) {
+      ++stats->active_jobs;
+    }
+  }
+
+  ~ActiveJobScope(void) {
+    if (stats) {
+      --stats->active_jobs;
+    }
+  }
+
+ private:
+  ActiveJobScope(const ActiveJobScope &) = delete;
+  ActiveJobScope &operator=(const ActiveJobScope &) = delete;
+
+  RunStats *const stats;
+};
+
+// Aggregates what each optimization pass did, for `--pass_report_out`, from
+// the pass events of a tracer. The pipeline records the impact of each pass
+// into its events when `LifterOptions::record_pass_impact` is set.
+class PassImpactReport {
+ public:
+  // Add the impact of the pass run recorded by `event`.
+  void Observe(const anvill::TraceEvent &event);
+
+  // Write the report to `path` as a JSON object. Passes are listed from the
+  // one that took the most time to the one that took the least.
+  bool Write(const std::string &path) const;
+
+ private:
+  // What the runs of a pass did, summed up.
+  struct PassImpact {
+    uint64_t runs{0u};
+    uint64_t changed_runs{0u};
+    uint64_t time_us{0u};
+    uint64_t unchanged_time_us{0u};
+    int64_t instructions_removed{0};
+    int64_t blocks_removed{0};
+    int64_t memory_ops_removed{0};
+
+    void Add(const PassImpact &that) {
+      runs += that.runs;
+      changed_runs += that.changed_runs;
+      time_us += that.time_us;
+      unchanged_time_us += that.unchanged_time_us;
+      instructions_removed += that.instructions_removed;
+      blocks_removed += that.blocks_removed;
+      memory_ops_removed += that.memory_ops_removed;
+    }
+  };
+
+  // Name of a pass, and which of its occurrences in the pipeline it is.
+  using PassKey = std::pair<std::string, uint64_t>;
+  using PassImpactMap = std::map<PassKey, PassImpact>;
+
+  // Functions are only known by name, so the functions of different specs of a
+  // batch that share a name are reported together.
+  struct FunctionImpact {
+    std::optional<uint64_t> address;
+    PassImpactMap passes;
+  };
+
+  mutable std::mutex lock;
+  PassImpactMap passes;
+  std::map<std::string, FunctionImpact> functions;
+};
+
+// Returns the number of instructions in the function definitions of `module`.
+uint64_t CountInstructions(const llvm::Module &module);
+
+// Write `stats` to `path` as a JSON object. `wall_us` is the wall time of the
+// whole run.
+bool WriteRunStats(const RunStats &stats, uint64_t wall_us,
+                   const std::string &path);
@@ -0,0 +1,667 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Writers.h"
+
+#include <anvill/ABI.h>
+#include <anvill/Provenance.h>
+#include <anvill/Trace.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/Metadata.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Pass.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/IPO.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/ValueMapper.h>
+#include <remill/BC/Compat/Error.h>
+#include <remill/BC/Util.h>
+
+#include <algorithm>
+#include <cctype>
+#include <iostream>
+#include <set>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#ifdef ANVILL_ENABLE_ZSTD
+#  include <zstd.h>
+#endif
+
+#include "Decompile.h"
+#include "Lift.h"
+#include "Stats.h"
+
+DEFINE_int32(zstd_level, 3,
+             "zstd compression level to use for --ir_out and --bc_out paths "
+             "that end in '.zst'. Compression uses up to --jobs threads.");
+
+DEFINE_string(split_out_dir, "",
+              "Path to a directory in which to save the lifted code as many "
+              "small bitcode modules instead of one big one. Each defined "
+              "function is saved into its own '<function name>.bc', along "
+              "with declarations of whatever it references, and the global "
+              "variables are saved into 'globals.bc'. Function bodies are "
+              "freed as they are saved.");
+
+DEFINE_uint32(write_queue_depth, 8u,
+              "Number of serialized split modules that may wait to be written "
+              "into --split_out_dir by a background writer thread, while "
+              "lifting and optimizing carry on. Lifting blocks when the queue "
+              "is full, so this also bounds the memory held by pending "
+              "writes. Zero writes each module before carrying on.");
+
+DEFINE_string(entity_map_out, "",
+              "Path to a JSON file in which to save the names and addresses "
+              "of the lifted functions and variables. Together with --bc_out, "
+              "this lets --reoptimize_bc optimize the lifted code again "
+              "without the spec.");
+
+DECLARE_bool(enable_provenance);
+DECLARE_uint32(jobs);
+DECLARE_string(ir_out);
+DECLARE_string(bc_out);
+
+// Returns a file name for the module holding `func` that isn't already in
+// `file_names`.
+static std::string
+SplitModuleFileName(const llvm::Function &func,
+                    std::unordered_set<std::string> &file_names) {
+  std::string base;
+  for (auto ch : func.getName()) {
+    base.push_back(std::isalnum(static_cast<unsigned char>(ch)) ||
+                           ch == '_' || ch == '.' || ch == '-'
+                       ? ch
+                       : '_');
+  }
+
+  auto file_name = base + ".bc";
+  for (auto i = 1u; !file_names.insert(file_name).second; ++i) {
+    file_name = base + "." + std::to_string(i) + ".bc";
+  }
+  return file_name;
+}
+
+SplitModuleWriter::SplitModuleWriter(void) {
+  if (FLAGS_write_queue_depth) {
+    queue.emplace(FLAGS_write_queue_depth);
+    writer = std::thread([this] { WritePending(); });
+  }
+}
+
+SplitModuleWriter::~SplitModuleWriter(void) {
+  (void) Finish();
+}
+
+// Verify and serialize `split_module`, then write it into `dir` as
+// `file_name`, maybe later. Failed writes are reported by `Finish`.
+bool SplitModuleWriter::Save(llvm::Module &split_module,
+                             const std::string &dir,
+                             const std::string &file_name) {
+  ANVILL_TRACE_ZONE("SaveSplitModule");
+  PendingWrite pending;
+  llvm::SmallString<128> path(dir);
+  llvm::sys::path::append(path, file_name);
+  pending.path = path.str().str();
+
+  if (!remill::VerifyModule(&split_module)) {
+    std::cerr << "Could not save LLVM bitcode to " << pending.path << '\n';
+    return false;
+  }
+
+  llvm::raw_svector_ostream os(pending.bitcode);
+  llvm::WriteBitcodeToFile(split_module, os);
+
+  if (queue) {
+    queue->Push(std::move(pending));
+    return true;
+  }
+  return Write(pending);
+}
+
+// Wait for the pending writes, and return `true` if they all succeeded.
+bool SplitModuleWriter::Finish(void) {
+  if (writer.joinable()) {
+    queue->Close();
+    writer.join();
+  }
+  return ok;
+}
+
+bool SplitModuleWriter::Write(const PendingWrite &pending) {
+  std::error_code ec;
+  llvm::raw_fd_ostream os(pending.path, ec, llvm::sys::fs::OF_None);
+  if (!ec) {
+    os.write(pending.bitcode.data(), pending.bitcode.size());
+    os.close();
+    ec = os.error();
+  }
+  if (ec) {
+    std::cerr << "Could not save LLVM bitcode to " << pending.path << ": "
+              << ec.message() << '\n';
+    ok = false;
+  }
+  return !ec;
+}
+
+void SplitModuleWriter::WritePending(void) {
+  PendingWrite pending;
+  while (queue->Pop(pending)) {
+    (void) Write(pending);
+  }
+}
+
+// Save the defined function `func` into `dir` as its own module, holding that
+// function and declarations of what it references, and then free its body.
+// This leaves `func` as a declaration with external linkage, which is how the
+// modules of other functions refer to it.
+bool SaveSplitFunction(llvm::Function &func, const std::string &dir,
+                       std::unordered_set<std::string> &file_names,
+                       SplitModuleWriter &writer) {
+  const auto &module = *func.getParent();
+  llvm::Module func_module(func.getName(), module.getContext());
+  func_module.setDataLayout(module.getDataLayout());
+  func_module.setTargetTriple(module.getTargetTriple());
+
+  // Other split modules can only refer to this function if it has external
+  // linkage.
+  auto split_func = llvm::Function::Create(
+      func.getFunctionType(),
+      func.hasLocalLinkage() ? llvm::GlobalValue::ExternalLinkage
+                             : func.getLinkage(),
+      func.getName(), &func_module);
+  remill::CloneFunctionInto(&func, split_func);
+
+  const auto ret =
+      writer.Save(func_module, dir, SplitModuleFileName(func, file_names));
+  func.deleteBody();
+  return ret;
+}
+
+// Returns `true` if the output file at `path` should be compressed with zstd.
+bool IsZstdPath(llvm::StringRef path) {
+  return path.endswith(".zst");
+}
+
+#ifdef ANVILL_ENABLE_ZSTD
+
+namespace {
+
+// An output stream that compresses everything written to it with zstd, and
+// writes the compressed frame to another stream.
+class ZstdOStream final : public llvm::raw_ostream {
+ public:
+  ZstdOStream(llvm::raw_ostream &os_, int level, unsigned num_threads)
+      : os(os_),
+        cctx(ZSTD_createCCtx()),
+        out_buf(ZSTD_CStreamOutSize()) {
+    CHECK(cctx != nullptr);
+    ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level);
+
+    // This fails if libzstd was built without threading support, in which case
+    // compression happens on the writing thread.
+    if (1u < num_threads) {
+      (void) ZSTD_CCtx_setParameter(cctx, ZSTD_c_nbWorkers,
+                                    static_cast<int>(num_threads));
+    }
+
+    SetBufferSize(ZSTD_CStreamInSize());
+  }
+
+  ~ZstdOStream(void) override {
+    flush();
+    ZSTD_freeCCtx(cctx);
+  }
+
+  // Flush and end the compressed frame. Returns `false` if compression failed
+  // at any point.
+  bool Finish(void) {
+    flush();
+    Compress(nullptr, 0, ZSTD_e_end);
+    return !error;
+  }
+
+  // The error from zstd, if compression failed.
+  const char *Error(void) const {
+    return error;
+  }
+
+ private:
+  void write_impl(const char *ptr, size_t size) final {
+    pos += size;
+    Compress(ptr, size, ZSTD_e_continue);
+  }
+
+  uint64_t current_pos(void) const final {
+    return pos;
+  }
+
+  void Compress(const char *ptr, size_t size, ZSTD_EndDirective mode) {
+    if (error) {
+      return;
+    }
+
+    ZSTD_inBuffer in = {ptr, size, 0};
+    for (;;) {
+      ZSTD_outBuffer out = {out_buf.data(), out_buf.size(), 0};
+      const auto remaining = ZSTD_compressStream2(cctx, &out, &in, mode);
+      if (ZSTD_isError(remaining)) {
+        error = ZSTD_getErrorName(remaining);
+        return;
+      }
+
+      os.write(out_buf.data(), out.pos);
+
+      // When continuing, zstd only needs the input to be consumed; when
+      // ending, it needs to have flushed everything it has buffered.
+      if (mode == ZSTD_e_continue ? in.pos == in.size : !remaining) {
+        return;
+      }
+    }
+  }
+
+  llvm::raw_ostream &os;
+  ZSTD_CCtx *const cctx;
+  std::vector<char> out_buf;
+  uint64_t pos{0};
+  const char *error{nullptr};
+};
+
+}  // namespace
+
+#endif  // ANVILL_ENABLE_ZSTD
+
+// Save `module` to `path`, as textual IR if `as_ir` is `true`, and as bitcode
+// otherwise. If `path` ends in `.zst` then the output is compressed with zstd,
+// using up to `num_threads` threads. The output is written to a temporary
+// file that is renamed to `path` once complete, so that a failed write never
+// leaves behind a truncated file.
+static bool SaveModule(const llvm::Module &module, const std::string &path,
+                       bool as_ir, unsigned num_threads) {
+  ANVILL_TRACE_ZONE("SaveModule");
+  auto write = [&](llvm::raw_ostream &os) {
+    if (as_ir) {
+      module.print(os, nullptr);
+    } else {
+      llvm::WriteBitcodeToFile(module, os);
+    }
+  };
+
+#ifndef ANVILL_ENABLE_ZSTD
+  if (IsZstdPath(path)) {
+    LOG(ERROR) << "Unable to save '" << path
+               << "': anvill was built without zstd support";
+    return false;
+  }
+#endif
+
+  const auto temp_path = path + ".tmp";
+  auto ret = true;
+  {
+    std::error_code ec;
+    llvm::raw_fd_ostream os(temp_path, ec, llvm::sys::fs::OF_None);
+    if (ec) {
+      LOG(ERROR) << "Unable to open output file '" << temp_path
+                 << "': " << ec.message();
+      return false;
+    }
+
+#ifdef ANVILL_ENABLE_ZSTD
+    if (IsZstdPath(path)) {
+      ZstdOStream zstd_os(os, FLAGS_zstd_level, num_threads);
+      write(zstd_os);
+      if (!zstd_os.Finish()) {
+        LOG(ERROR) << "Unable to compress output file '" << path
+                   << "': " << zstd_os.Error();
+        ret = false;
+      }
+    } else {
+      write(os);
+    }
+#else
+    write(os);
+#endif
+
+    os.close();
+    if (os.has_error()) {
+      LOG(ERROR) << "Unable to write output file '" << temp_path
+                 << "': " << os.error().message();
+      os.clear_error();
+      ret = false;
+    }
+  }
+
+  if (!ret) {
+    llvm::sys::fs::remove(temp_path);
+  } else if (auto ec = llvm::sys::fs::rename(temp_path, path)) {
+    LOG(ERROR) << "Unable to save output file '" << path
+               << "': " << ec.message();
+    ret = false;
+  }
+
+  return ret;
+}
+
+// Save the entities recorded in `md` by `RecordEntity` to `path`, as a JSON
+// object with the target's `arch` and `os`, and an `entities` array of
+// objects with the `name` and `address` of each entity.
+static bool SaveEntityMap(const llvm::NamedMDNode &md,
+                          const std::string &arch_str,
+                          const std::string &os_str, const std::string &path) {
+  ANVILL_TRACE_ZONE("SaveEntityMap");
+  std::error_code ec;
+  llvm::raw_fd_ostream os(path, ec, llvm::sys::fs::OF_Text);
+  if (ec) {
+    LOG(ERROR) << "Unable to open entity map file '" << path
+               << "': " << ec.message();
+    return false;
+  }
+
+  // Every shard that declares an entity records it, so entities appear once per
+  // shard after linking.
+  std::set<std::pair<llvm::GlobalValue *, uint64_t>> seen;
+  llvm::json::OStream json(os, 2);
+  json.object([&] {
+    json.attribute("arch", arch_str);
+    json.attribute("os", os_str);
+    json.attributeArray("entities", [&] {
+      for (auto node : md.operands()) {
+        if (node->getNumOperands() != 2u) {
+          continue;
+        }
+
+        auto gv = llvm::mdconst::dyn_extract_or_null<llvm::GlobalValue>(
+            node->getOperand(0));
+        auto addr = llvm::mdconst::dyn_extract_or_null<llvm::ConstantInt>(
+            node->getOperand(1));
+        if (!gv || !addr || !gv->hasName() ||
+            !seen.emplace(gv, addr->getZExtValue()).second) {
+          continue;
+        }
+
+        json.object([&] {
+          json.attribute("name", gv->getName());
+          json.attribute("address",
+                         static_cast<int64_t>(addr->getZExtValue()));
+        });
+      }
+    });
+  });
+
+  os.close();
+  if (os.has_error()) {
+    LOG(ERROR) << "Unable to write entity map file '" << path
+               << "': " << os.error().message();
+    os.clear_error();
+    return false;
+  }
+  return true;
+}
+
+// Save the code in `module` into `dir` as a `globals.bc` module, holding the
+// global variables, and one module per defined function, holding that
+// function and declarations of what it references. The body of each function
+// is freed once its module is saved. `file_names` holds the names of the
+// modules of functions that were already saved into `dir`, e.g. by
+// `--evict_batch_size`.
+static bool SaveSplitModules(llvm::Module &module, const std::string &dir,
+                             std::unordered_set<std::string> file_names) {
+  ANVILL_TRACE_ZONE("SaveSplitModules");
+  if (auto ec = llvm::sys::fs::create_directories(dir)) {
+    LOG(ERROR) << "Unable to create output directory '" << dir
+               << "': " << ec.message();
+    return false;
+  }
+
+  SplitModuleWriter writer;
+  auto ret = true;
+  {
+    llvm::ValueToValueMapTy vmap;
+    auto globals = llvm::CloneModule(
+        module, vmap, [](const llvm::GlobalValue *gv) {
+          return !llvm::isa<llvm::Function>(gv);
+        });
+    ret = writer.Save(*globals, dir, "globals.bc");
+  }
+
+  file_names.insert("globals.bc");
+  for (auto &func : module) {
+    if (!func.isDeclaration() &&
+        !SaveSplitFunction(func, dir, file_names, writer)) {
+      ret = false;
+    }
+  }
+
+  return writer.Finish() && ret;
+}
+
+// Returns the key by which `gv` is ordered by `SortModuleByAddress`.
+static std::tuple<bool, uint64_t, llvm::StringRef>
+AddressOrderKey(const llvm::GlobalValue &gv,
+                const std::unordered_map<const llvm::GlobalValue *, uint64_t>
+                    &addrs) {
+  if (auto it = addrs.find(&gv); it != addrs.end()) {
+    return {false, it->second, gv.getName()};
+  } else {
+    return {true, 0u, gv.getName()};
+  }
+}
+
+// Put the entities of `module` in order of their addresses, as recorded by
+// `RecordEntity`, followed by everything else in order of their names. The
+// functions, variables, and aliases of a module are otherwise in the order in
+// which they were made or linked in, which differs between a spec lifted in
+// one go and one lifted as shards, and between different numbers of shards.
+// The recorded entities are deduplicated and put in the same order, as every
+// shard records the entities that it declares.
+static void SortModuleByAddress(llvm::Module &module) {
+  ANVILL_TRACE_ZONE("SortModuleByAddress");
+  std::unordered_map<const llvm::GlobalValue *, uint64_t> addrs;
+  std::vector<std::pair<uint64_t, llvm::GlobalValue *>> entities;
+  if (auto md = module.getNamedMetadata(kEntitiesMetadataName)) {
+    for (auto node : md->operands()) {
+      if (node->getNumOperands() != 2u) {
+        continue;
+      }
+      auto gv = llvm::mdconst::dyn_extract_or_null<llvm::GlobalValue>(
+          node->getOperand(0));
+      auto addr = llvm::mdconst::dyn_extract_or_null<llvm::ConstantInt>(
+          node->getOperand(1));
+      if (!gv || !addr || !gv->hasName()) {
+        continue;
+      }
+
+      // An entity at many addresses, e.g. a merged function, is ordered by its
+      // lowest address.
+      const auto ea = addr->getZExtValue();
+      entities.emplace_back(ea, gv);
+      if (auto [it, added] = addrs.emplace(gv, ea); !added) {
+        it->second = std::min(it->second, ea);
+      }
+    }
+
+    std::sort(entities.begin(), entities.end(),
+              [&](const auto &a, const auto &b) {
+                return std::make_tuple(a.first, a.second->getName()) <
+                       std::make_tuple(b.first, b.second->getName());
+              });
+    entities.erase(std::unique(entities.begin(), entities.end()),
+                   entities.end());
+
+    md->clearOperands();
+    for (auto [ea, gv] : entities) {
+      RecordEntity(module, gv, ea);
+    }
+  }
+
+  auto sort_list = [&](auto &list) {
+    using GlobalType = std::remove_reference_t<decltype(*list.begin())>;
+    std::vector<GlobalType *> gvs;
+    for (auto &gv : list) {
+      gvs.push_back(&gv);
+    }
+    std::stable_sort(gvs.begin(), gvs.end(),
+                     [&](GlobalType *a, GlobalType *b) {
+                       return AddressOrderKey(*a, addrs) <
+                              AddressOrderKey(*b, addrs);
+                     });
+    for (auto gv : gvs) {
+      list.splice(list.end(), list, gv->getIterator());
+    }
+  };
+
+  sort_list(module.getFunctionList());
+  sort_list(module.getGlobalList());
+  sort_list(module.getAliasList());
+}
+
+// Clean out any unneeded things from the lifted and optimized code in
+// `module` prior to output, and put what's left in a canonical order. If
+// `strip_dead_prototypes` is `false`, then unused function declarations are
+// kept, e.g. because the entity map refers to the declarations of functions
+// that were already saved.
+void CleanUpLiftedModule(llvm::Module &module, bool strip_dead_prototypes) {
+  if (strip_dead_prototypes) {
+    std::unique_ptr<llvm::ModulePass> pass(
+        llvm::createStripDeadPrototypesPass());
+    pass->doInitialization(module);
+    pass->runOnModule(module);
+    pass->doFinalization(module);
+  }
+
+  // Clean up by initializing variables.
+  for (auto &var : module.globals()) {
+    if (!var.isDeclaration()) {
+      continue;
+    }
+    const auto name = var.getName();
+    if (name.startswith(anvill::kAnvillNamePrefix)) {
+      var.setInitializer(llvm::Constant::getNullValue(var.getValueType()));
+      var.setLinkage(llvm::GlobalValue::InternalLinkage);
+    }
+  }
+
+  SortModuleByAddress(module);
+}
+
+// Clean up the lifted and optimized code in `module`, and then save it where
+// `job` and the command-line flags say to. `evicted_file_names` holds the
+// names of the modules of functions that were already saved into
+// `--split_out_dir` while lifting.
+bool SaveLiftedModule(
+    llvm::Module &module, const SpecJob &job, const std::string &arch_str,
+    const std::string &os_str, RunStats *stats,
+    const std::unordered_set<std::string> &evicted_file_names) {
+  PhaseTimer output_timer(stats, kPhaseOutput);
+  CleanUpLiftedModule(module, evicted_file_names.empty());
+
+  auto ret = true;
+
+  // The entity map is always taken out of the module, so that it isn't saved
+  // into the bitcode.
+  if (auto md = module.getNamedMetadata(kEntitiesMetadataName)) {
+    if (!FLAGS_entity_map_out.empty() &&
+        !SaveEntityMap(*md, arch_str, os_str, FLAGS_entity_map_out)) {
+      ret = false;
+    }
+    module.eraseNamedMetadata(md);
+  }
+
+  // Check that the data provenance that survived optimization is intact.
+  if (FLAGS_enable_provenance) {
+    auto maybe_provenance = anvill::VerifyProvenance(module);
+    if (remill::IsError(maybe_provenance)) {
+      LOG(ERROR) << "Invalid data provenance in lifted code: "
+                 << remill::GetErrorString(maybe_provenance);
+      ret = false;
+
+    } else if (stats) {
+      const auto &provenance = remill::GetReference(maybe_provenance);
+      stats->provenance_records += provenance.num_records;
+      stats->surviving_provenance_records += provenance.num_surviving_records;
+    }
+  }
+
+  // The module is only verified once, and the IR and the bitcode are then
+  // written out concurrently; both writers only read from the module. Printing
+  // textual IR is the slower of the two, so it gets its own thread.
+  if (!job.ir_out.empty() || !job.bc_out.empty()) {
+    auto saved_ir = true;
+    auto saved_bc = true;
+    if (!remill::VerifyModule(&module)) {
+      saved_ir = false;
+      saved_bc = false;
+
+    } else {
+      std::thread ir_thread;
+      if (!job.ir_out.empty()) {
+        ir_thread = std::thread([&] {
+          saved_ir = SaveModule(module, job.ir_out, true, FLAGS_jobs);
+        });
+      }
+      if (!job.bc_out.empty()) {
+        saved_bc = SaveModule(module, job.bc_out, false, FLAGS_jobs);
+      }
+      if (ir_thread.joinable()) {
+        ir_thread.join();
+      }
+    }
+
+    if (!job.ir_out.empty() && !saved_ir) {
+      std::cerr << "Could not save LLVM IR to " << job.ir_out << '\n';
+      ret = false;
+    }
+    if (!job.bc_out.empty() && !saved_bc) {
+      std::cerr << "Could not save LLVM bitcode to " << job.bc_out << '\n';
+      ret = false;
+    }
+  }
+
+  // This frees the bodies of the functions in `module`, so it must come last.
+  if (!FLAGS_split_out_dir.empty() &&
+      !SaveSplitModules(module, FLAGS_split_out_dir, evicted_file_names)) {
+    ret = false;
+  }
+
+  return ret;
+}
+
+// Returns `false`, after logging why, if `--ir_out` or `--bc_out` ask for
+// compressed output that this build can't write.
+bool CheckWriterFlags(void) {
+#ifndef ANVILL_ENABLE_ZSTD
+  if (IsZstdPath(FLAGS_ir_out) || IsZstdPath(FLAGS_bc_out)) {
+    LOG(ERROR) << "Compressed '.zst' outputs need anvill to be built with "
+               << "-DANVILL_ENABLE_ZSTD=ON.";
+    return false;
+  }
+#endif
+
+  return true;
+}
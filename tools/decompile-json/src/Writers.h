@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringRef.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_set>
+
+namespace llvm {
+class Function;
+class Module;
+}  // namespace llvm
+
+struct RunStats;
+struct SpecJob;
+
+// A queue of at most `capacity` items, connecting a producer thread to a
+// consumer thread. `Push` blocks while the queue is full, which holds back the
+// producer until the consumer catches up.
+template <typename T>
+class BoundedQueue {
+ public:
+  explicit BoundedQueue(size_t capacity_) : capacity(capacity_) {}
+
+  // Add `item` to the queue, waiting for room if the queue is full.
+  void Push(T item) {
+    std::unique_lock<std::mutex> locker(lock);
+    not_full.wait(locker, [this] { return items.size() < capacity; });
+    items.push_back(std::move(item));
+    not_empty.notify_one();
+  }
+
+  // Take the oldest item out of the queue, waiting for one if the queue is
+  // empty. Returns `false` once the queue is closed and empty.
+  bool Pop(T &item) {
+    std::unique_lock<std::mutex> locker(lock);
+    not_empty.wait(locker, [this] { return !items.empty() || closed; });
+    if (items.empty()) {
+      return false;
+    }
+    item = std::move(items.front());
+    items.pop_front();
+    not_full.notify_one();
+    return true;
+  }
+
+  // Close the queue; `Pop` returns `false` once the queue is drained.
+  void Close(void) {
+    std::lock_guard<std::mutex> locker(lock);
+    closed = true;
+    not_empty.notify_all();
+  }
+
+ private:
+  const size_t capacity;
+  std::mutex lock;
+  std::condition_variable not_full;
+  std::condition_variable not_empty;
+  std::deque<T> items;
+  bool closed{false};
+};
+
+// Writes split modules into their files on a background thread, so that
+// lifting and optimizing don't wait on the disk. Modules are serialized on the
+// calling thread, as they belong to its context, and only their bitcode is
+// handed off, through a queue of `--write_queue_depth` modules.
+class SplitModuleWriter {
+ public:
+  SplitModuleWriter(void);
+  ~SplitModuleWriter(void);
+
+  // Verify and serialize `split_module`, then write it into `dir` as
+  // `file_name`, maybe later. Failed writes are reported by `Finish`.
+  bool Save(llvm::Module &split_module, const std::string &dir,
+            const std::string &file_name);
+
+  // Wait for the pending writes, and return `true` if they all succeeded.
+  bool Finish(void);
+
+ private:
+  struct PendingWrite {
+    std::string path;
+    llvm::SmallVector<char, 0> bitcode;
+  };
+
+  bool Write(const PendingWrite &pending);
+  void WritePending(void);
+
+  std::optional<BoundedQueue<PendingWrite>> queue;
+  std::thread writer;
+  std::atomic<bool> ok{true};
+};
+
+// Save the defined function `func` into `dir` as its own module, holding that
+// function and declarations of what it references, and then free its body.
+// This leaves `func` as a declaration with external linkage, which is how the
+// modules of other functions refer to it.
+bool SaveSplitFunction(llvm::Function &func, const std::string &dir,
+                       std::unordered_set<std::string> &file_names,
+                       SplitModuleWriter &writer);
+
+// Returns `true` if the output file at `path` should be compressed with zstd.
+bool IsZstdPath(llvm::StringRef path);
+
+// Clean out any unneeded things from the lifted and optimized code in
+// `module` prior to output, and put what's left in a canonical order. If
+// `strip_dead_prototypes` is `false`, then unused function declarations are
+// kept, e.g. because the entity map refers to the declarations of functions
+// that were already saved.
+void CleanUpLiftedModule(llvm::Module &module, bool strip_dead_prototypes);
+
+// Clean up the lifted and optimized code in `module`, and then save it where
+// `job` and the command-line flags say to. `evicted_file_names` holds the
+// names of the modules of functions that were already saved into
+// `--split_out_dir` while lifting.
+bool SaveLiftedModule(
+    llvm::Module &module, const SpecJob &job, const std::string &arch_str,
+    const std::string &os_str, RunStats *stats,
+    const std::unordered_set<std::string> &evicted_file_names);
+
+// Returns `false`, after logging why, if `--ir_out` or `--bc_out` ask for
+// compressed output that this build can't write.
+bool CheckWriterFlags(void);
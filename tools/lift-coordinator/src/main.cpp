@@ -0,0 +1,738 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <anvill/BinarySpec.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <llvm/ADT/Optional.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/Program.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+DEFINE_string(spec, "", "Path to the specification of the code to lift.");
+DEFINE_string(spec_format, "json",
+              "Format of --spec: 'json', or 'binary' for a spec saved by "
+              "anvill-decompile-json with --binary_spec_out. JSON specs are "
+              "converted to binary specs before they're handed to workers.");
+DEFINE_string(ir_out, "", "Path to file where the LLVM IR should be saved.");
+DEFINE_string(bc_out, "",
+              "Path to file where the LLVM bitcode should be saved.");
+DEFINE_string(stats_out, "",
+              "Path to a JSON file in which to save the sums of the "
+              "statistics of the workers. With --queue_dir, workers keep "
+              "their own statistics, and only the wall time of the whole "
+              "run is saved.");
+DEFINE_uint32(workers, 0u,
+              "Number of worker processes to run at once. A value of zero "
+              "runs one worker per hardware thread.");
+DEFINE_uint32(partitions, 0u,
+              "Number of partitions into which to divide the spec's "
+              "functions. A value of zero uses one partition per worker. "
+              "With --queue_dir, this should be several times the number of "
+              "workers across all machines, so that faster workers can claim "
+              "more of the jobs.");
+DEFINE_string(decompile_json, "",
+              "Path to the anvill-decompile-json executable to run as the "
+              "workers. By default, it's looked for next to this "
+              "executable.");
+DEFINE_string(worker_args, "",
+              "Extra command-line arguments to pass to every worker, "
+              "separated by spaces, e.g. '--opt_level=fast "
+              "--function_cache_dir=/tmp/cache'.");
+DEFINE_string(work_dir, "",
+              "Directory in which to keep the binary spec, partitions, "
+              "logs, and bitcode of the workers. By default, a temporary "
+              "directory is used, and removed afterwards.");
+DEFINE_string(queue_dir, "",
+              "Directory, usually on storage shared by several machines, in "
+              "which to queue the partitions as jobs, instead of running "
+              "workers here. Workers are started on any machine that sees "
+              "the directory with 'anvill-decompile-json --queue_dir', and "
+              "save the bitcode of the jobs they claim back into the queue. "
+              "Once every job is done, the bitcode is linked here.");
+DEFINE_uint32(queue_poll_ms, 1000u,
+              "Number of milliseconds to wait between looks at --queue_dir "
+              "for finished jobs.");
+DEFINE_uint32(claim_timeout_s, 0u,
+              "Number of seconds after which a job in --queue_dir that has "
+              "been claimed, but not finished, is put back in the queue, as "
+              "its worker is assumed to have died. This must be longer than "
+              "the longest time that a partition takes to lift. Zero means "
+              "that jobs are never put back.");
+
+namespace {
+
+// Most bytes that a function is assumed to span when weighing partitions.
+static constexpr uint64_t kMaxFunctionWeight = 1u << 16;
+
+// Returns the path of the file named `name` in `dir`.
+static std::string PathIn(const std::string &dir, const llvm::Twine &name) {
+  llvm::SmallString<128> path(dir);
+  llvm::sys::path::append(path, name);
+  return path.str().str();
+}
+
+// Returns the path of the decompile-json executable. Both executables are
+// given the same version suffix, so it's this executable's path with the
+// tool name swapped.
+static std::string FindDecompileJSON(const char *argv0) {
+  if (!FLAGS_decompile_json.empty()) {
+    return FLAGS_decompile_json;
+  }
+
+  static int kAddressOfMain = 0;
+  auto self = llvm::sys::fs::getMainExecutable(argv0, &kAddressOfMain);
+  auto dir = llvm::sys::path::parent_path(self);
+  auto name = llvm::sys::path::filename(self).str();
+  if (auto pos = name.find("lift-coordinator"); pos != std::string::npos) {
+    name.replace(pos, std::string("lift-coordinator").size(),
+                 "decompile-json");
+    auto path = PathIn(dir.str(), name);
+    if (llvm::sys::fs::can_execute(path)) {
+      return path;
+    }
+  }
+
+  if (auto maybe_path = llvm::sys::findProgramByName("anvill-decompile-json")) {
+    return *maybe_path;
+  }
+  return {};
+}
+
+// Run `program` with `args`, sending its output to the file at `log_path`.
+static bool Run(const std::string &program,
+                const std::vector<std::string> &args,
+                const std::string &log_path) {
+  std::vector<llvm::StringRef> arg_refs;
+  arg_refs.push_back(program);
+  for (const auto &arg : args) {
+    arg_refs.push_back(arg);
+  }
+
+  const llvm::Optional<llvm::StringRef> redirects[] = {
+      llvm::StringRef(""), llvm::StringRef(log_path),
+      llvm::StringRef(log_path)};
+
+  std::string error;
+  bool failed = false;
+  const auto ret = llvm::sys::ExecuteAndWait(program, arg_refs, llvm::None,
+                                             redirects, 0, 0, &error, &failed);
+  if (failed) {
+    LOG(ERROR) << "Unable to run '" << program << "': " << error;
+    return false;
+  } else if (ret) {
+    LOG(ERROR) << "Worker failed with exit code " << ret << "; see '"
+               << log_path << "'";
+    return false;
+  }
+  return true;
+}
+
+// Divide the functions of `spec` into `num_partitions` partitions of
+// consecutive functions, with about the same number of bytes in each.
+//
+// The call graph isn't known until the code is lifted, so nearness in the
+// address space stands in for call-graph locality: the functions of a
+// compilation unit are laid out together, and tend to call each other. Keeping
+// them together keeps most calls within a partition. A thunk goes with the
+// function that it redirects to, if that function is in the spec.
+static std::vector<std::vector<uint64_t>>
+PartitionFunctions(const anvill::BinarySpec &spec, unsigned num_partitions) {
+  std::vector<uint64_t> addresses;
+  addresses.reserve(spec.functions.size());
+  for (const auto &func : spec.functions) {
+    addresses.push_back(func.address);
+  }
+  std::sort(addresses.begin(), addresses.end());
+  addresses.erase(std::unique(addresses.begin(), addresses.end()),
+                  addresses.end());
+
+  // A function is weighed by its distance to the next function, bounded by
+  // the end of its memory range.
+  std::vector<uint64_t> weights(addresses.size(), 0u);
+  uint64_t total_weight = 0u;
+  for (auto i = 0u; i < addresses.size(); ++i) {
+    auto end = i + 1u < addresses.size()
+                   ? addresses[i + 1u]
+                   : std::numeric_limits<uint64_t>::max();
+    for (const auto &range : spec.memory) {
+      if (range.address <= addresses[i] &&
+          addresses[i] < range.address + range.size) {
+        end = std::min(end, range.address + range.size);
+        break;
+      }
+    }
+    weights[i] = std::max<uint64_t>(
+        1u, std::min(end - addresses[i], kMaxFunctionWeight));
+    total_weight += weights[i];
+  }
+
+  num_partitions = std::max(1u, num_partitions);
+  std::vector<std::vector<uint64_t>> partitions(num_partitions);
+  uint64_t seen_weight = 0u;
+  for (auto i = 0u; i < addresses.size(); ++i) {
+    const auto index = std::min<uint64_t>(
+        num_partitions - 1u, (seen_weight * num_partitions) / total_weight);
+    partitions[index].push_back(addresses[i]);
+    seen_weight += weights[i];
+  }
+
+  // Move thunks into the partitions of the functions that they redirect to.
+  if (!spec.control_flow_redirections.empty()) {
+    std::vector<unsigned> partition_of(addresses.size(), 0u);
+    for (auto p = 0u; p < num_partitions; ++p) {
+      for (auto ea : partitions[p]) {
+        partition_of[std::lower_bound(addresses.begin(), addresses.end(), ea) -
+                     addresses.begin()] = p;
+      }
+    }
+
+    auto index_of = [&](uint64_t ea) -> int64_t {
+      auto it = std::lower_bound(addresses.begin(), addresses.end(), ea);
+      if (it == addresses.end() || *it != ea) {
+        return -1;
+      }
+      return it - addresses.begin();
+    };
+
+    for (const auto &[from, to] : spec.control_flow_redirections) {
+      const auto from_index = index_of(from);
+      const auto to_index = index_of(to);
+      if (from_index != -1 && to_index != -1) {
+        partition_of[from_index] = partition_of[to_index];
+      }
+    }
+
+    for (auto &partition : partitions) {
+      partition.clear();
+    }
+    for (auto i = 0u; i < addresses.size(); ++i) {
+      partitions[partition_of[i]].push_back(addresses[i]);
+    }
+  }
+
+  return partitions;
+}
+
+// Returns the path of `name` within the directory `dir` of `--queue_dir`.
+// The layout of a queue is described along with the worker side of the queue,
+// in anvill-decompile-json.
+static std::string QueuePath(llvm::StringRef dir,
+                             const llvm::Twine &name = "") {
+  llvm::SmallString<128> path(FLAGS_queue_dir);
+  llvm::sys::path::append(path, dir, name);
+  return path.str().str();
+}
+
+// Returns the names of the jobs in the directory `dir` of `--queue_dir`.
+static std::vector<std::string> ListQueuedJobs(llvm::StringRef dir) {
+  std::vector<std::string> names;
+  std::error_code ec;
+  for (llvm::sys::fs::directory_iterator it(QueuePath(dir), ec), end;
+       !ec && it != end; it.increment(ec)) {
+    const auto name = llvm::sys::path::filename(it->path());
+    if (name.endswith(".json")) {
+      names.push_back(name.str());
+    }
+  }
+  return names;
+}
+
+// Save the addresses in `partition` to `path`, one per line.
+static bool SavePartition(const std::vector<uint64_t> &partition,
+                          const std::string &path) {
+  std::error_code ec;
+  llvm::raw_fd_ostream os(path, ec, llvm::sys::fs::OF_Text);
+  if (ec) {
+    LOG(ERROR) << "Unable to open partition file '" << path
+               << "': " << ec.message();
+    return false;
+  }
+  for (auto ea : partition) {
+    os << llvm::format_hex(ea, 0) << '\n';
+  }
+  return true;
+}
+
+// Queue a job in `--queue_dir` for each of `partitions`.
+static bool QueuePartitions(
+    const std::vector<std::vector<uint64_t>> &partitions) {
+  for (auto dir : {"partitions", "pending", "claimed", "done", "failed",
+                   "shards"}) {
+    if (auto ec = llvm::sys::fs::create_directories(QueuePath(dir))) {
+      LOG(ERROR) << "Unable to create queue directory '" << QueuePath(dir)
+                 << "': " << ec.message();
+      return false;
+    }
+  }
+
+  for (auto i = 0u; i < partitions.size(); ++i) {
+    const auto name = "partition-" + std::to_string(i);
+    if (!SavePartition(partitions[i], QueuePath("partitions", name + ".txt"))) {
+      return false;
+    }
+
+    // Jobs are written outside of `pending`, and then renamed into it, so
+    // that workers never claim a partially written job. Variables are only
+    // lifted by the first job.
+    const auto job_path = QueuePath("partitions", name + ".json");
+    {
+      std::error_code ec;
+      llvm::raw_fd_ostream os(job_path, ec, llvm::sys::fs::OF_Text);
+      if (ec) {
+        LOG(ERROR) << "Unable to open job file '" << job_path
+                   << "': " << ec.message();
+        return false;
+      }
+
+      llvm::json::OStream json(os, 2);
+      json.object([&] {
+        json.attribute("functions", "partitions/" + name + ".txt");
+        json.attribute("lift_variables", !i);
+      });
+      os << '\n';
+    }
+
+    if (auto ec = llvm::sys::fs::rename(job_path,
+                                        QueuePath("pending", name + ".json"))) {
+      LOG(ERROR) << "Unable to queue job '" << job_path
+                 << "': " << ec.message();
+      return false;
+    }
+  }
+
+  LOG(INFO) << "Queued " << partitions.size() << " jobs in '"
+            << FLAGS_queue_dir << "'";
+  return true;
+}
+
+// Wait for all `num_jobs` jobs in `--queue_dir` to be done or to fail, and
+// then close the queue. Jobs that have been claimed for longer than
+// `--claim_timeout_s` are put back, so that other workers can claim them.
+static bool WaitForQueue(size_t num_jobs) {
+  const std::chrono::seconds claim_timeout(FLAGS_claim_timeout_s);
+  for (;;) {
+    const auto num_done = ListQueuedJobs("done").size();
+    const auto num_failed = ListQueuedJobs("failed").size();
+    if ((num_done + num_failed) >= num_jobs) {
+      std::error_code ec;
+      llvm::raw_fd_ostream closed(QueuePath("closed"), ec);
+      LOG_IF(WARNING, ec) << "Unable to close the queue in '"
+                          << FLAGS_queue_dir << "': " << ec.message();
+
+      if (num_failed) {
+        LOG(ERROR) << num_failed << " of " << num_jobs << " queued jobs "
+                   << "failed; they're in '" << QueuePath("failed") << "'";
+        return false;
+      }
+      return true;
+    }
+
+    if (FLAGS_claim_timeout_s) {
+      const auto now = std::chrono::system_clock::now();
+      for (const auto &name : ListQueuedJobs("claimed")) {
+        const auto claimed = QueuePath("claimed", name);
+        llvm::sys::fs::file_status status;
+        if (llvm::sys::fs::status(claimed, status) ||
+            (now - status.getLastModificationTime()) < claim_timeout) {
+          continue;
+        }
+
+        if (!llvm::sys::fs::rename(claimed, QueuePath("pending", name))) {
+          LOG(WARNING) << "Put back job '" << name << "', which was claimed "
+                       << "more than " << FLAGS_claim_timeout_s
+                       << " seconds ago.";
+        }
+      }
+    }
+
+    std::this_thread::sleep_for(
+        std::chrono::milliseconds(FLAGS_queue_poll_ms));
+  }
+}
+
+// Add the statistics in `from` into `into`. Numbers are summed, except for
+// peak memory usage, which is the largest of the workers'.
+static void MergeStats(llvm::json::Object &into,
+                       const llvm::json::Object &from) {
+  for (const auto &[key, val] : from) {
+    if (auto obj = val.getAsObject()) {
+      if (!into.getObject(key)) {
+        into[key] = llvm::json::Object();
+      }
+      MergeStats(*into.getObject(key), *obj);
+
+    } else if (auto num = val.getAsInteger()) {
+      const auto old = into.getInteger(key).getValueOr(0);
+      into[key] = key == "peak_rss_kb" ? std::max(old, *num) : old + *num;
+    }
+  }
+}
+
+// Sum up the statistics saved by the workers into `--stats_out`.
+static bool SaveStats(const std::vector<std::string> &paths,
+                      unsigned num_partitions, int64_t wall_us) {
+  llvm::json::Object stats;
+  for (const auto &path : paths) {
+    auto maybe_buff = llvm::MemoryBuffer::getFile(path);
+    if (!maybe_buff) {
+      LOG(WARNING) << "Unable to read worker stats file '" << path << "'";
+      continue;
+    }
+
+    auto maybe_json = llvm::json::parse(maybe_buff.get()->getBuffer());
+    if (!maybe_json) {
+      LOG(WARNING) << "Unable to parse worker stats file '" << path
+                   << "': " << llvm::toString(maybe_json.takeError());
+      continue;
+    }
+
+    if (auto obj = maybe_json->getAsObject()) {
+      MergeStats(stats, *obj);
+    }
+  }
+
+  // The workers ran concurrently, so their wall times don't add up.
+  stats["specs"] = 1;
+  stats["partitions"] = static_cast<int64_t>(num_partitions);
+  stats["wall_us"] = wall_us;
+
+  std::error_code ec;
+  llvm::raw_fd_ostream os(FLAGS_stats_out, ec, llvm::sys::fs::OF_Text);
+  if (ec) {
+    LOG(ERROR) << "Unable to open stats file '" << FLAGS_stats_out
+               << "': " << ec.message();
+    return false;
+  }
+  llvm::json::OStream json(os, 2);
+  json.value(llvm::json::Value(std::move(stats)));
+  os << '\n';
+  return true;
+}
+
+// Link the bitcode saved by each worker into `module`. Calls across
+// partitions are declarations in the caller's module, and are resolved to
+// their definitions by linking.
+static bool LinkPartitions(const std::vector<std::string> &paths,
+                           llvm::Module &module) {
+  llvm::Linker linker(module);
+  for (const auto &path : paths) {
+    auto maybe_buff = llvm::MemoryBuffer::getFile(path);
+    if (!maybe_buff) {
+      LOG(ERROR) << "Unable to read worker bitcode '" << path
+                 << "': " << maybe_buff.getError().message();
+      return false;
+    }
+
+    auto maybe_module =
+        llvm::parseBitcodeFile(maybe_buff.get()->getMemBufferRef(),
+                               module.getContext());
+    if (!maybe_module) {
+      LOG(ERROR) << "Unable to parse worker bitcode '" << path
+                 << "': " << llvm::toString(maybe_module.takeError());
+      return false;
+    }
+
+    // Partitions may each contain identical definitions of things that aren't
+    // functions in the spec, e.g. data aliases, so we let later partitions
+    // override earlier ones.
+    if (linker.linkInModule(std::move(*maybe_module),
+                            llvm::Linker::OverrideFromSrc)) {
+      LOG(ERROR) << "Unable to link worker bitcode '" << path << "'";
+      return false;
+    }
+  }
+  return true;
+}
+
+// Save `module` to `path`, as textual IR or as bitcode.
+static bool SaveModule(const llvm::Module &module, const std::string &path,
+                       bool as_ir) {
+  std::error_code ec;
+  llvm::raw_fd_ostream os(path, ec,
+                          as_ir ? llvm::sys::fs::OF_Text
+                                : llvm::sys::fs::OF_None);
+  if (ec) {
+    LOG(ERROR) << "Unable to open output file '" << path
+               << "': " << ec.message();
+    return false;
+  }
+
+  if (as_ir) {
+    module.print(os, nullptr);
+  } else {
+    llvm::WriteBitcodeToFile(module, os);
+  }
+
+  os.close();
+  if (os.has_error()) {
+    LOG(ERROR) << "Unable to write output file '" << path
+               << "': " << os.error().message();
+    os.clear_error();
+    return false;
+  }
+  return true;
+}
+
+// Lift each of `partitions` with its own run of `decompile_json`, running up
+// to `num_workers` at once. The worker outputs are saved in `work_dir`.
+static bool RunWorkers(const std::string &decompile_json,
+                       const std::string &spec_path,
+                       const std::string &work_dir,
+                       const std::vector<std::vector<uint64_t>> &partitions,
+                       unsigned num_workers, std::vector<std::string> &bc_paths,
+                       std::vector<std::string> &stats_paths) {
+  llvm::SmallVector<llvm::StringRef, 8> extra_args;
+  llvm::StringRef(FLAGS_worker_args).split(extra_args, ' ', -1, false);
+
+  std::vector<std::vector<std::string>> worker_args;
+  for (auto i = 0u; i < partitions.size(); ++i) {
+    const auto name = "partition-" + std::to_string(i);
+    const auto addrs_path = PathIn(work_dir, name + ".txt");
+    if (!SavePartition(partitions[i], addrs_path)) {
+      return false;
+    }
+
+    bc_paths.push_back(PathIn(work_dir, name + ".bc"));
+    stats_paths.push_back(PathIn(work_dir, name + ".stats.json"));
+
+    // Variables are only lifted by the first worker; the others only declare
+    // the variables that their functions reference.
+    auto &args = worker_args.emplace_back();
+    args = {"--spec",           spec_path,
+            "--spec_format",    "binary",
+            "--lift_functions", addrs_path,
+            "--bc_out",         bc_paths.back(),
+            "--jobs",           "1"};
+    if (i) {
+      args.push_back("--lift_variables=false");
+    }
+    if (!FLAGS_stats_out.empty()) {
+      args.push_back("--stats_out");
+      args.push_back(stats_paths.back());
+    }
+    for (auto arg : extra_args) {
+      args.push_back(arg.str());
+    }
+  }
+
+  std::atomic<unsigned> next_partition{0u};
+  std::atomic<unsigned> num_failed{0u};
+  std::vector<std::thread> threads;
+  for (auto t = 0u; t < std::min<size_t>(num_workers, partitions.size());
+       ++t) {
+    threads.emplace_back([&](void) {
+      for (auto i = next_partition++; i < partitions.size();
+           i = next_partition++) {
+        const auto log_path =
+            PathIn(work_dir, "partition-" + std::to_string(i) + ".log");
+        if (!Run(decompile_json, worker_args[i], log_path)) {
+          ++num_failed;
+        }
+      }
+    });
+  }
+
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  if (num_failed.load()) {
+    LOG(ERROR) << num_failed.load() << " of " << partitions.size()
+               << " workers failed; their logs are in '" << work_dir << "'";
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+
+  if (FLAGS_spec.empty()) {
+    LOG(ERROR) << "Please specify a path to a specification in --spec.";
+    return EXIT_FAILURE;
+  }
+
+  if (FLAGS_spec_format != "json" && FLAGS_spec_format != "binary") {
+    LOG(ERROR) << "Unsupported spec format '" << FLAGS_spec_format
+               << "' in --spec_format; expected 'json' or 'binary'.";
+    return EXIT_FAILURE;
+  }
+
+  if (FLAGS_ir_out.empty() && FLAGS_bc_out.empty()) {
+    LOG(ERROR) << "Please specify where to save the lifted code in --ir_out "
+               << "or --bc_out.";
+    return EXIT_FAILURE;
+  }
+
+  if (!FLAGS_queue_dir.empty() && !FLAGS_work_dir.empty()) {
+    LOG(ERROR) << "The --work_dir option doesn't apply to --queue_dir; the "
+               << "queue directory holds the outputs of the workers.";
+    return EXIT_FAILURE;
+  }
+
+  // With a queue, decompile-json is only run here to convert a JSON spec.
+  const auto decompile_json = FindDecompileJSON(argv[0]);
+  if (decompile_json.empty() &&
+      (FLAGS_queue_dir.empty() || FLAGS_spec_format == "json")) {
+    LOG(ERROR) << "Unable to find anvill-decompile-json; please specify its "
+               << "path in --decompile_json.";
+    return EXIT_FAILURE;
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+
+  auto num_workers = FLAGS_workers;
+  if (!num_workers) {
+    num_workers = std::max(1u, std::thread::hardware_concurrency());
+  }
+  const auto num_partitions = FLAGS_partitions ? FLAGS_partitions : num_workers;
+
+  std::string work_dir =
+      FLAGS_queue_dir.empty() ? FLAGS_work_dir : FLAGS_queue_dir;
+  if (work_dir.empty()) {
+    llvm::SmallString<128> temp_dir;
+    if (auto ec = llvm::sys::fs::createUniqueDirectory("anvill-lift",
+                                                       temp_dir)) {
+      LOG(ERROR) << "Unable to create work directory: " << ec.message();
+      return EXIT_FAILURE;
+    }
+    work_dir = temp_dir.str().str();
+
+  } else if (auto ec = llvm::sys::fs::create_directories(work_dir)) {
+    LOG(ERROR) << "Unable to create work directory '" << work_dir
+               << "': " << ec.message();
+    return EXIT_FAILURE;
+
+  } else if (!FLAGS_queue_dir.empty() &&
+             llvm::sys::fs::exists(QueuePath("pending"))) {
+    LOG(ERROR) << "The queue directory '" << FLAGS_queue_dir
+               << "' already has a queue in it.";
+    return EXIT_FAILURE;
+  }
+
+  // The workers all read the same binary spec. Its memory is mapped, rather
+  // than read, by each worker, so the bytes of the binary are shared.
+  auto spec_path = FLAGS_spec;
+  if (FLAGS_spec_format == "json") {
+    spec_path = PathIn(work_dir, "spec.bin");
+    if (!Run(decompile_json,
+             {"--spec", FLAGS_spec, "--binary_spec_out", spec_path},
+             PathIn(work_dir, "convert.log"))) {
+      return EXIT_FAILURE;
+    }
+
+  } else if (!FLAGS_queue_dir.empty()) {
+
+    // Workers on other machines can't be assumed to see `--spec`, so the
+    // spec is copied into the queue.
+    spec_path = QueuePath("spec.bin");
+    if (auto ec = llvm::sys::fs::copy_file(FLAGS_spec, spec_path)) {
+      LOG(ERROR) << "Unable to copy '" << FLAGS_spec << "' to '" << spec_path
+                 << "': " << ec.message();
+      return EXIT_FAILURE;
+    }
+  }
+
+  auto maybe_spec = anvill::BinarySpec::Read(spec_path);
+  if (!maybe_spec) {
+    LOG(ERROR) << llvm::toString(maybe_spec.takeError());
+    return EXIT_FAILURE;
+  }
+
+  const auto partitions = PartitionFunctions(*maybe_spec, num_partitions);
+
+  std::vector<std::string> bc_paths;
+  std::vector<std::string> stats_paths;
+  if (!FLAGS_queue_dir.empty()) {
+    if (!QueuePartitions(partitions) || !WaitForQueue(partitions.size())) {
+      return EXIT_FAILURE;
+    }
+    for (auto i = 0u; i < partitions.size(); ++i) {
+      bc_paths.push_back(
+          QueuePath("shards", "partition-" + std::to_string(i) + ".bc"));
+    }
+
+  } else if (!RunWorkers(decompile_json, spec_path, work_dir, partitions,
+                         num_workers, bc_paths, stats_paths)) {
+    return EXIT_FAILURE;
+  }
+
+  llvm::LLVMContext context;
+  llvm::Module module("lifted_code", context);
+  if (!LinkPartitions(bc_paths, module)) {
+    return EXIT_FAILURE;
+  }
+
+  std::string error;
+  llvm::raw_string_ostream error_os(error);
+  if (llvm::verifyModule(module, &error_os)) {
+    LOG(ERROR) << "Linked module is invalid: " << error_os.str();
+    return EXIT_FAILURE;
+  }
+
+  int ret = EXIT_SUCCESS;
+  if (!FLAGS_ir_out.empty() && !SaveModule(module, FLAGS_ir_out, true)) {
+    ret = EXIT_FAILURE;
+  }
+  if (!FLAGS_bc_out.empty() && !SaveModule(module, FLAGS_bc_out, false)) {
+    ret = EXIT_FAILURE;
+  }
+
+  const auto wall_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                           std::chrono::steady_clock::now() - start)
+                           .count();
+  if (!FLAGS_stats_out.empty() &&
+      !SaveStats(stats_paths, static_cast<unsigned>(partitions.size()),
+                 static_cast<int64_t>(wall_us))) {
+    ret = EXIT_FAILURE;
+  }
+
+  if (FLAGS_work_dir.empty() && FLAGS_queue_dir.empty()) {
+    llvm::sys::fs::remove_directories(work_dir);
+  }
+
+  return ret;
+}
@@ -1,24 +1,279 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <anvill/Transforms.h>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IRReader/IRReader.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
 #include <llvm/Support/SourceMgr.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+DEFINE_string(input, "", "Path to INPUT IR or bitcode file");
+DEFINE_string(output, "",
+              "Path to OUTPUT bitcode file. If the path ends in '.ll' then "
+              "textual IR is written instead.");
+DEFINE_string(function, "",
+              "Name of the one function to brighten. By default, every "
+              "defined function is brightened.");
+DEFINE_uint32(max_gas, 250u,
+              "Maximum number of rounds of pointer brightening to run on any "
+              "one function.");
+DEFINE_uint32(jobs, 1u,
+              "Number of threads to use for brightening functions. Each "
+              "thread brightens functions in its own copy of the module, on "
+              "its own LLVM context, and the copies are then linked back "
+              "together. A value of zero uses one thread per hardware "
+              "thread.");
+DEFINE_string(report_out, "",
+              "Path to a CSV file in which to save, for each brightened "
+              "function, its instruction counts before and after "
+              "brightening, the number of rounds of brightening, and the "
+              "time taken.");
+
+namespace {
+
+// What happened when brightening one function.
+struct FunctionReport {
+  std::string name;
+  uint64_t num_insts_before{0};
+  uint64_t num_insts_after{0};
+  unsigned num_rounds{0};
+  uint64_t num_micros{0};
+};
+
+// Returns the functions of `module` to brighten, in module order. Every copy
+// of the module returns the same functions in the same order.
+static std::vector<llvm::Function *> FunctionsToBrighten(llvm::Module &module) {
+  std::vector<llvm::Function *> funcs;
+  for (auto &func : module) {
+    if (!func.isDeclaration() &&
+        (FLAGS_function.empty() || func.getName() == FLAGS_function)) {
+      funcs.push_back(&func);
+    }
+  }
+  return funcs;
+}
+
+static uint64_t CountInstructions(const llvm::Function &func) {
+  uint64_t num_insts = 0u;
+  for (auto &block : func) {
+    num_insts += block.size();
+  }
+  return num_insts;
+}
+
+// Brighten the pointer operations of `func`, and fill in `report`.
+static void BrightenFunction(llvm::Function &func, FunctionReport &report) {
+  report.name = func.getName().str();
+  report.num_insts_before = CountInstructions(func);
 
-#include <fstream>
-#include <iostream>
+  const auto start = std::chrono::steady_clock::now();
+  report.num_rounds = anvill::BrightenPointerOperations(func, FLAGS_max_gas);
+  report.num_micros = static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - start)
+          .count());
 
-#include "anvill/PointerLifter.h"
+  report.num_insts_after = CountInstructions(func);
+}
 
-DEFINE_string(input, "", "Path to INPUT IR file");
-DEFINE_string(output, "", "Path to OUTPUT IR file");
+// Brighten the functions of the module in `buffer` that are handed out by
+// `next_func`, in a copy of the module on its own context, then serialize
+// the copy into `bitcode`. Only the functions brightened by this worker keep
+// their bodies in `bitcode`, unless `keep_other_bodies` is `true`, in which
+// case so do all functions that aren't brightened at all. Local linkage is
+// promoted to external linkage, so that each function's declarations in the
+// copies of other workers resolve to its definition when the copies are
+// linked. Names that had local linkage are saved into `local_linkages`.
+static bool
+BrightenInCopy(llvm::MemoryBufferRef buffer, std::atomic<unsigned> &next_func,
+               std::vector<FunctionReport> &reports, bool keep_other_bodies,
+               llvm::SmallVectorImpl<char> &bitcode,
+               std::unordered_map<std::string, llvm::GlobalValue::LinkageTypes>
+                   *local_linkages) {
+  llvm::LLVMContext context;
+  llvm::SMDiagnostic error;
+  auto module = llvm::parseIR(buffer, error, context);
+  if (!module) {
+    LOG(ERROR) << "Could not parse " << FLAGS_input << ": "
+               << error.getMessage().str();
+    return false;
+  }
+
+  const auto funcs = FunctionsToBrighten(*module);
+  CHECK_EQ(funcs.size(), reports.size());
+
+  std::vector<bool> is_mine(funcs.size(), false);
+  for (auto i = next_func++; i < funcs.size(); i = next_func++) {
+    is_mine[i] = true;
+    BrightenFunction(*funcs[i], reports[i]);
+  }
+
+  if (!keep_other_bodies) {
+    const std::unordered_set<llvm::Function *> brightened(funcs.begin(),
+                                                         funcs.end());
+    for (auto &func : *module) {
+      if (!func.isDeclaration() && !brightened.count(&func)) {
+        func.deleteBody();
+      }
+    }
+  }
+
+  for (auto i = 0u; i < funcs.size(); ++i) {
+    if (!is_mine[i]) {
+      funcs[i]->deleteBody();
+    }
+  }
+
+  for (auto &gv : module->global_values()) {
+    if (gv.hasLocalLinkage()) {
+      if (local_linkages && gv.hasName()) {
+        local_linkages->emplace(gv.getName().str(), gv.getLinkage());
+      }
+      gv.setLinkage(llvm::GlobalValue::ExternalLinkage);
+    }
+  }
+
+  llvm::raw_svector_ostream os(bitcode);
+  llvm::WriteBitcodeToFile(*module, os);
+  return true;
+}
+
+// Brighten the functions of the module in `buffer` using `num_threads`
+// threads, and link the results into `module`.
+static bool BrightenInParallel(llvm::MemoryBufferRef buffer,
+                               llvm::Module &module, unsigned num_threads,
+                               std::vector<FunctionReport> &reports) {
+  {
+    llvm::SMDiagnostic error;
+    auto counting_module =
+        llvm::parseIR(buffer, error, module.getContext());
+    if (!counting_module) {
+      LOG(ERROR) << "Could not parse " << FLAGS_input << ": "
+                 << error.getMessage().str();
+      return false;
+    }
+    reports.resize(FunctionsToBrighten(*counting_module).size());
+  }
+
+  std::atomic<unsigned> next_func{0u};
+  std::vector<llvm::SmallVector<char, 0>> bitcodes(num_threads);
+  std::unique_ptr<bool[]> succeeded(new bool[num_threads]());
+  std::unordered_map<std::string, llvm::GlobalValue::LinkageTypes>
+      local_linkages;
+
+  std::vector<std::thread> threads;
+  threads.reserve(num_threads);
+  for (auto i = 0u; i < num_threads; ++i) {
+    threads.emplace_back([&, i](void) {
+      succeeded[i] = BrightenInCopy(buffer, next_func, reports, !i,
+                                    bitcodes[i], i ? nullptr : &local_linkages);
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  // Every copy has the same global variables, so we let later copies override
+  // the definitions of earlier ones.
+  llvm::Linker linker(module);
+  for (auto i = 0u; i < num_threads; ++i) {
+    if (!succeeded[i]) {
+      return false;
+    }
+
+    llvm::MemoryBufferRef copy_buff(
+        llvm::StringRef(bitcodes[i].data(), bitcodes[i].size()),
+        FLAGS_input);
+    auto maybe_copy = llvm::parseBitcodeFile(copy_buff, module.getContext());
+    if (!maybe_copy) {
+      LOG(ERROR) << "Unable to parse brightened copy " << i << ": "
+                 << llvm::toString(maybe_copy.takeError());
+      return false;
+    }
+
+    if (linker.linkInModule(std::move(*maybe_copy),
+                            llvm::Linker::OverrideFromSrc)) {
+      LOG(ERROR) << "Unable to link brightened copy " << i;
+      return false;
+    }
+
+    llvm::SmallVector<char, 0>().swap(bitcodes[i]);
+  }
+
+  for (auto &gv : module.global_values()) {
+    if (gv.hasName()) {
+      if (auto it = local_linkages.find(gv.getName().str());
+          it != local_linkages.end()) {
+        gv.setLinkage(it->second);
+      }
+    }
+  }
+
+  return true;
+}
+
+// Save the per-function reports as CSV to `path`.
+static bool SaveReport(const std::vector<FunctionReport> &reports,
+                       const std::string &path) {
+  std::error_code ec;
+  llvm::raw_fd_ostream os(path, ec, llvm::sys::fs::OF_Text);
+  if (ec) {
+    LOG(ERROR) << "Could not open report file " << path << ": "
+               << ec.message();
+    return false;
+  }
+
+  os << "function,instructions_before,instructions_after,rounds,"
+     << "microseconds\n";
+  for (const auto &report : reports) {
+    os << '"' << report.name << "\"," << report.num_insts_before << ','
+       << report.num_insts_after << ',' << report.num_rounds << ','
+       << report.num_micros << '\n';
+  }
+  return true;
+}
+
+}  // namespace
 
 int main(int argc, char *argv[]) {
   google::ParseCommandLineFlags(&argc, &argv, true);
   google::InitGoogleLogging(argv[0]);
 
-  llvm::LLVMContext context;
-  llvm::SMDiagnostic error;
   if (FLAGS_input.empty()) {
     LOG(ERROR) << "Please specify a path to a input IR file with --input.";
     return EXIT_FAILURE;
@@ -27,22 +282,85 @@ int main(int argc, char *argv[]) {
     LOG(ERROR) << "Please specify a path to an output IR file with --output";
     return EXIT_FAILURE;
   }
-  LOG(WARNING) << "Input file: " << FLAGS_input << std::endl;
-  LOG(WARNING) << "Output file: " << FLAGS_output << std::endl;
-  std::string file = std::string(FLAGS_input);
-  auto mod = llvm::parseIRFile(file, error, context);
-  if (!mod) {
-    LOG(ERROR) << "Error! Could not get module\n";
+
+  if (!FLAGS_jobs) {
+    FLAGS_jobs = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  auto maybe_buffer = llvm::MemoryBuffer::getFile(FLAGS_input);
+  if (!maybe_buffer) {
+    LOG(ERROR) << "Could not read " << FLAGS_input << ": "
+               << maybe_buffer.getError().message();
     return EXIT_FAILURE;
   }
 
-  anvill::PointerLifter pointer_lifter(*mod);
-  for (auto &func : *mod) {
-    if (func.hasName() && func.getName() == "main") {
-      LOG(WARNING) << "Lifting main!\n";
-      pointer_lifter.LiftFunction(&func);
+  const auto buffer = (*maybe_buffer)->getMemBufferRef();
+  const auto start = std::chrono::steady_clock::now();
+
+  llvm::LLVMContext context;
+  std::unique_ptr<llvm::Module> mod;
+  std::vector<FunctionReport> reports;
+
+  if (1u == FLAGS_jobs) {
+    llvm::SMDiagnostic error;
+    mod = llvm::parseIR(buffer, error, context);
+    if (!mod) {
+      LOG(ERROR) << "Could not parse " << FLAGS_input << ": "
+                 << error.getMessage().str();
+      return EXIT_FAILURE;
+    }
+
+    for (auto func : FunctionsToBrighten(*mod)) {
+      BrightenFunction(*func, reports.emplace_back());
     }
+
+  } else {
+    mod.reset(new llvm::Module(FLAGS_input, context));
+    if (!BrightenInParallel(buffer, *mod, FLAGS_jobs, reports)) {
+      return EXIT_FAILURE;
+    }
+  }
+
+  const auto num_millis =
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::steady_clock::now() - start)
+          .count();
+
+  if (!FLAGS_function.empty() && reports.empty()) {
+    LOG(ERROR) << "No defined function named " << FLAGS_function << " in "
+               << FLAGS_input;
+    return EXIT_FAILURE;
+  }
+
+  uint64_t num_rounds = 0u;
+  uint64_t num_micros = 0u;
+  for (const auto &report : reports) {
+    num_rounds += report.num_rounds;
+    num_micros += report.num_micros;
   }
-  mod->print(llvm::errs(), nullptr);
-  return 0;
+
+  LOG(INFO) << "Brightened " << reports.size() << " functions with "
+            << num_rounds << " rounds in " << (num_micros / 1000u)
+            << "ms of brightening, and " << num_millis
+            << "ms in total on " << FLAGS_jobs << " threads";
+
+  if (!FLAGS_report_out.empty() && !SaveReport(reports, FLAGS_report_out)) {
+    return EXIT_FAILURE;
+  }
+
+  std::error_code ec;
+  llvm::raw_fd_ostream os(FLAGS_output, ec, llvm::sys::fs::OF_None);
+  if (ec) {
+    LOG(ERROR) << "Could not open output file " << FLAGS_output << ": "
+               << ec.message();
+    return EXIT_FAILURE;
+  }
+
+  if (llvm::StringRef(FLAGS_output).endswith(".ll")) {
+    mod->print(os, nullptr);
+  } else {
+    llvm::WriteBitcodeToFile(*mod, os);
+  }
+
+  return EXIT_SUCCESS;
 }
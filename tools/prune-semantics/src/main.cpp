@@ -0,0 +1,205 @@
+/*
+ * Copyright (c) 2021 Trail of Bits, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/DebugInfo.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/PassManager.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Regex.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/IPO/GlobalDCE.h>
+#include <llvm/Transforms/Utils/ModuleUtils.h>
+#include <remill/Arch/Arch.h>
+#include <remill/Arch/Name.h>
+#include <remill/BC/Util.h>
+#include <remill/OS/OS.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+DECLARE_string(arch);
+DECLARE_string(os);
+DEFINE_string(output, "",
+              "Path of the pruned semantics bitcode file to write. The lifter "
+              "looks for it as '<arch>.bc' in the directory given to "
+              "anvill-decompile-json's --pruned_semantics_dir.");
+DEFINE_string(drop_isels, "",
+              "Regular expression of instruction selectors, e.g. "
+              "'^(FLD|FST|FXCH)', whose semantics are dropped. Instructions "
+              "using a dropped selector lift as unsupported instructions.");
+
+namespace {
+
+// Prefix of the names of the variables that map instruction selectors to
+// their semantics functions.
+static const char kIselPrefix[] = "ISEL_";
+
+// Remove the variables in `dropped` from `llvm.used` or `llvm.compiler.used`,
+// which is where remill's `DEF_ISEL` puts them.
+static void
+RemoveFromUsedList(llvm::Module &module, bool compiler_used,
+                   const std::vector<llvm::GlobalVariable *> &dropped) {
+  llvm::SmallVector<llvm::GlobalValue *, 8> used;
+  auto list = llvm::collectUsedGlobalVariables(module, used, compiler_used);
+  if (!list) {
+    return;
+  }
+
+  llvm::SmallVector<llvm::GlobalValue *, 8> kept;
+  for (auto gv : used) {
+    if (std::find(dropped.begin(), dropped.end(), gv) == dropped.end()) {
+      kept.push_back(gv);
+    }
+  }
+
+  list->eraseFromParent();
+  if (compiler_used) {
+    llvm::appendToCompilerUsed(module, kept);
+  } else {
+    llvm::appendToUsed(module, kept);
+  }
+}
+
+// Drop the instruction selectors matching `--drop_isels`, and return how many
+// were dropped.
+static unsigned DropIsels(llvm::Module &module) {
+  if (FLAGS_drop_isels.empty()) {
+    return 0u;
+  }
+
+  llvm::Regex pattern(FLAGS_drop_isels);
+  std::string error;
+  CHECK(pattern.isValid(error))
+      << "Invalid --drop_isels pattern '" << FLAGS_drop_isels
+      << "': " << error;
+
+  std::vector<llvm::GlobalVariable *> dropped;
+  for (auto &gv : module.globals()) {
+    auto name = gv.getName();
+    if (name.consume_front(kIselPrefix) && pattern.match(name)) {
+      dropped.push_back(&gv);
+    }
+  }
+
+  RemoveFromUsedList(module, false, dropped);
+  RemoveFromUsedList(module, true, dropped);
+  for (auto gv : dropped) {
+    if (gv->use_empty()) {
+      gv->eraseFromParent();
+    } else {
+      gv->setLinkage(llvm::GlobalValue::InternalLinkage);
+    }
+  }
+  return static_cast<unsigned>(dropped.size());
+}
+
+// Returns the number of instruction selectors in `module`.
+static unsigned CountIsels(const llvm::Module &module) {
+  auto num_isels = 0u;
+  for (const auto &gv : module.globals()) {
+    if (gv.getName().startswith(kIselPrefix)) {
+      ++num_isels;
+    }
+  }
+  return num_isels;
+}
+
+// Remove everything that isn't reachable from the remaining instruction
+// selectors, or from remill's intrinsics.
+static void RemoveDeadGlobals(llvm::Module &module) {
+  llvm::PassBuilder pb;
+  llvm::LoopAnalysisManager lam;
+  llvm::FunctionAnalysisManager fam;
+  llvm::CGSCCAnalysisManager cam;
+  llvm::ModuleAnalysisManager mam;
+  pb.registerModuleAnalyses(mam);
+  pb.registerCGSCCAnalyses(cam);
+  pb.registerFunctionAnalyses(fam);
+  pb.registerLoopAnalyses(lam);
+  pb.crossRegisterProxies(lam, fam, cam, mam);
+
+  llvm::ModulePassManager mpm;
+  mpm.addPass(llvm::GlobalDCEPass());
+  mpm.run(module, mam);
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+
+  if (FLAGS_arch.empty() || FLAGS_os.empty()) {
+    LOG(ERROR) << "Please specify the target with --arch and --os";
+    return EXIT_FAILURE;
+  }
+
+  if (FLAGS_output.empty()) {
+    LOG(ERROR) << "Please specify a path to the output file in --output";
+    return EXIT_FAILURE;
+  }
+
+  llvm::LLVMContext context;
+  auto arch = remill::Arch::Build(&context, remill::GetOSName(FLAGS_os),
+                                  remill::GetArchName(FLAGS_arch));
+  if (!arch) {
+    LOG(ERROR) << "Unable to build the architecture for --arch=" << FLAGS_arch
+               << " and --os=" << FLAGS_os;
+    return EXIT_FAILURE;
+  }
+
+  auto module = remill::LoadArchSemantics(arch.get());
+  if (!module) {
+    LOG(ERROR) << "Unable to load the semantics for --arch=" << FLAGS_arch;
+    return EXIT_FAILURE;
+  }
+
+  const auto num_isels = CountIsels(*module);
+  const auto num_funcs = module->size();
+
+  // The lifter strips debug information from the semantics as it loads them
+  // anyway, so doing it here is free, and it's the bulk of what makes the
+  // pruned modules smaller.
+  llvm::StripDebugInfo(*module);
+  const auto num_dropped = DropIsels(*module);
+  RemoveDeadGlobals(*module);
+
+  std::error_code ec;
+  llvm::raw_fd_ostream os(FLAGS_output, ec, llvm::sys::fs::OF_None);
+  if (ec) {
+    LOG(ERROR) << "Unable to open '" << FLAGS_output
+               << "' for writing: " << ec.message();
+    return EXIT_FAILURE;
+  }
+  llvm::WriteBitcodeToFile(*module, os);
+
+  LOG(INFO) << "Pruned semantics of " << FLAGS_arch << ": dropped "
+            << num_dropped << " of " << num_isels
+            << " instruction selectors, and kept " << module->size()
+            << " of " << num_funcs << " functions";
+  return EXIT_SUCCESS;
+}
@@ -18,13 +18,16 @@
 #include <anvill/Decl.h>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <llvm/Bitcode/BitcodeReader.h>
 #include <llvm/IR/DebugInfoMetadata.h>
 #include <llvm/IR/Function.h>
 #include <llvm/IR/Instructions.h>
 #include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Metadata.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Type.h>
+#include <llvm/Support/MemoryBuffer.h>
 #include <llvm/Support/raw_ostream.h>
 #include <remill/Arch/Arch.h>
 #include <remill/Arch/Name.h>
@@ -32,10 +35,17 @@
 #include <remill/OS/OS.h>
 
 #include <algorithm>
+#include <atomic>
 #include <bitset>
+#include <condition_variable>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <vector>
 
 #ifdef _WIN32
 #  define STDOUT_FILENO 1
@@ -49,6 +59,119 @@ DECLARE_string(arch);
 DECLARE_string(os);
 DEFINE_string(bc_file, "",
               "Path to BITcode file containing data to be specified");
+DEFINE_uint32(jobs, 1u,
+              "Number of threads to use for specifying functions. Each "
+              "thread lazily loads its own copy of the bitcode, and only "
+              "materializes the functions that it specifies. A value of zero "
+              "uses one thread per hardware thread.");
+
+namespace {
+
+// The specification of one function, in the order that it appears in the
+// module.
+struct SpecifiedFunction {
+  bool done{false};
+  std::optional<llvm::json::Value> json;
+};
+
+// Specifications of all functions, filled in by workers in any order, and
+// written out in module order.
+struct SpecifiedFunctions {
+  std::mutex lock;
+  std::condition_variable ready;
+  std::vector<SpecifiedFunction> funcs;
+  std::atomic<unsigned> next_func{0u};
+};
+
+// Returns the functions of `module` that should be specified, in order.
+static std::vector<llvm::Function *> FunctionsToSpecify(llvm::Module &module) {
+  std::vector<llvm::Function *> funcs;
+  for (auto &function : module) {
+
+    // Skip llvm debug intrinsics
+    if (!function.getIntrinsicID()) {
+      funcs.push_back(&function);
+    }
+  }
+  return funcs;
+}
+
+// Lazily load the bitcode in `buffer` into `context`.
+static std::unique_ptr<llvm::Module>
+LoadLazyModule(llvm::MemoryBufferRef buffer, llvm::LLVMContext &context) {
+  auto maybe_module = llvm::getLazyBitcodeModule(buffer, context);
+  if (!maybe_module) {
+    LOG(ERROR) << "Unable to load bitcode file '" << FLAGS_bc_file
+               << "': " << llvm::toString(maybe_module.takeError());
+    return nullptr;
+  }
+  return std::move(*maybe_module);
+}
+
+// Build the architecture of `module`.
+//
+// Building an architecture may initialize global decoder state (e.g. XED's
+// tables), so we serialize construction of the architectures of concurrent
+// workers.
+static remill::Arch::ArchPtr BuildModuleArch(llvm::Module &module) {
+  static std::mutex gArchBuildLock;
+  std::lock_guard<std::mutex> locker(gArchBuildLock);
+  return remill::Arch::GetModuleArch(module);
+}
+
+// Specify the functions of the bitcode in `buffer` that are handed out by
+// `specs`. Each worker has its own context, module, and architecture, as
+// allocating a signature may create types in the architecture's context.
+static void SpecifyFunctions(llvm::MemoryBufferRef buffer,
+                             SpecifiedFunctions &specs) {
+  llvm::LLVMContext context;
+  auto module = LoadLazyModule(buffer, context);
+  CHECK(module != nullptr);
+
+  auto funcs = FunctionsToSpecify(*module);
+  CHECK_EQ(funcs.size(), specs.funcs.size());
+
+  // Calling conventions look up registers by name, and remill only knows about
+  // registers once it has loaded the semantics. We only need them for the
+  // register information, so they're freed right away.
+  remill::Arch::ArchPtr arch = BuildModuleArch(*module);
+  CHECK(arch != nullptr);
+  arch->PrepareModule(remill::LoadArchSemantics(arch.get()));
+
+  const auto &dl = module->getDataLayout();
+  anvill::SignatureAllocationCache allocations;
+
+  for (auto i = specs.next_func++; i < funcs.size(); i = specs.next_func++) {
+    auto &function = *funcs[i];
+    std::optional<llvm::json::Value> json;
+
+    // Parameter names are recovered from debug intrinsics in the body of the
+    // function, so it needs to be materialized, but it's freed as soon as the
+    // function is specified.
+    if (auto err = function.materialize()) {
+      LOG(ERROR) << "Unable to load function '" << function.getName().str()
+                 << "': " << llvm::toString(std::move(err));
+
+    } else {
+      auto maybe_func =
+          anvill::FunctionDecl::Create(function, arch.get(), allocations);
+      if (remill::IsError(maybe_func)) {
+        LOG(ERROR) << remill::GetErrorString(maybe_func);
+      } else {
+        auto &func = remill::GetReference(maybe_func);
+        json.emplace(func.SerializeToJSON(dl));
+      }
+      function.deleteBody();
+    }
+
+    std::lock_guard<std::mutex> locker(specs.lock);
+    specs.funcs[i].json = std::move(json);
+    specs.funcs[i].done = true;
+    specs.ready.notify_all();
+  }
+}
+
+}  // namespace
 
 int main(int argc, char *argv[]) {
   google::ParseCommandLineFlags(&argc, &argv, true);
@@ -59,6 +182,10 @@ int main(int argc, char *argv[]) {
     return EXIT_FAILURE;
   }
 
+  if (!FLAGS_jobs) {
+    FLAGS_jobs = std::max(1u, std::thread::hardware_concurrency());
+  }
+
   // Overwrite the inherited architecture and os flags if they are not
   // already empty.
   if (!FLAGS_arch.empty() || !FLAGS_os.empty()) {
@@ -66,46 +193,72 @@ int main(int argc, char *argv[]) {
     FLAGS_os = "";
   }
 
-  auto context = new llvm::LLVMContext;
-  auto module = remill::LoadModuleFromFile(context, FLAGS_bc_file);
-  remill::Arch::ArchPtr arch = remill::Arch::GetModuleArch(*module);
-  arch->PrepareModule(remill::LoadArchSemantics(arch.get()));
-
-  auto arch_name = remill::GetArchName(arch->arch_name);
-  auto os_name = remill::GetOSName(arch->os_name);
-
-  llvm::json::Object json;
-  json.insert(
-      llvm::json::Object::KV{llvm::json::ObjectKey("arch"), arch_name.data()});
-  json.insert(
-      llvm::json::Object::KV{llvm::json::ObjectKey("os"), os_name.data()});
-
-  llvm::json::Array funcs_json;
+  auto maybe_buffer = llvm::MemoryBuffer::getFile(FLAGS_bc_file);
+  if (!maybe_buffer) {
+    LOG(ERROR) << "Unable to read bitcode file '" << FLAGS_bc_file
+               << "': " << maybe_buffer.getError().message();
+    return EXIT_FAILURE;
+  }
 
-  const auto &dl = module->getDataLayout();
-  for (auto &function : *module) {
+  const auto buffer = (*maybe_buffer)->getMemBufferRef();
 
-    // Skip llvm debug intrinsics
-    if (function.getIntrinsicID()) {
-      continue;
+  // The architecture and OS names only need the module's target triple, so
+  // this copy of the module never has its semantics or functions loaded.
+  std::string arch_name;
+  std::string os_name;
+  SpecifiedFunctions specs;
+  {
+    llvm::LLVMContext context;
+    auto module = LoadLazyModule(buffer, context);
+    if (!module) {
+      return EXIT_FAILURE;
     }
 
-    auto maybe_func = anvill::FunctionDecl::Create(function, arch);
-    if (remill::IsError(maybe_func)) {
-      LOG(ERROR) << remill::GetErrorString(maybe_func);
-    } else {
-      auto &func = remill::GetReference(maybe_func);
-      funcs_json.push_back(func.SerializeToJSON(dl));
+    remill::Arch::ArchPtr arch = BuildModuleArch(*module);
+    if (!arch) {
+      LOG(ERROR) << "Unable to find the architecture of bitcode file '"
+                 << FLAGS_bc_file << "'";
+      return EXIT_FAILURE;
     }
+
+    arch_name = remill::GetArchName(arch->arch_name);
+    os_name = remill::GetOSName(arch->os_name);
+    specs.funcs.resize(FunctionsToSpecify(*module).size());
   }
 
-  // Insert functions array into top level JSON
-  json.insert(llvm::json::Object::KV{llvm::json::ObjectKey("functions"),
-                                     llvm::json::Value(std::move(funcs_json))});
+  const auto num_workers = std::min<unsigned>(
+      FLAGS_jobs, std::max<size_t>(1u, specs.funcs.size()));
+  std::vector<std::thread> workers;
+  workers.reserve(num_workers);
+  for (auto i = 0u; i < num_workers && !specs.funcs.empty(); ++i) {
+    workers.emplace_back(SpecifyFunctions, buffer, std::ref(specs));
+  }
 
-  // Print JSON
+  // Stream the JSON out as the functions are specified, in module order. The
+  // keys of the top-level object are written in sorted order, which is the
+  // order that they'd be printed in from an `llvm::json::Object`.
   llvm::raw_fd_ostream S(STDOUT_FILENO, false);
-  S << llvm::formatv("{0:4}", llvm::json::Value(std::move(json)));
+  llvm::json::OStream json(S, 4);
+  json.object([&] {
+    json.attribute("arch", arch_name);
+    json.attributeArray("functions", [&] {
+      for (auto &func : specs.funcs) {
+        std::unique_lock<std::mutex> locker(specs.lock);
+        specs.ready.wait(locker, [&] { return func.done; });
+        auto func_json = std::move(func.json);
+        locker.unlock();
+
+        if (func_json) {
+          json.value(std::move(*func_json));
+        }
+      }
+    });
+    json.attribute("os", os_name);
+  });
+
+  for (auto &worker : workers) {
+    worker.join();
+  }
 
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,239 @@
+#!/usr/bin/env python3
+
+#
+# Copyright (c) 2021-present, Trail of Bits, Inc.
+# All rights reserved.
+#
+# This source code is licensed in accordance with the terms specified in
+# the LICENSE file found in the root directory of this source tree.
+#
+
+"""Generates synthetic amd64 specs that stress one scalability dimension of
+`anvill-decompile-json` at a time. Each spec comes with the machine code and
+data that it describes, so that it can be lifted as is.
+
+Usage: generate.py <kind> --size N [-o spec.json]
+
+Kinds:
+  switch    One function with an N-way switch, dispatched through a jump
+            table.
+  thunks    A chain of N thunks, each jumping to the next, ending in a
+            function that returns.
+  blocks    One function with about 2*N basic blocks.
+  symbols   N named addresses, of which `--functions` are declared functions.
+  data      A variable whose initializer is N pointers into code and data.
+"""
+
+import argparse
+import json
+import struct
+import sys
+
+CODE_BASE = 0x1000
+DATA_BASE = 0x40000000
+
+KINDS = ("switch", "thunks", "blocks", "symbols", "data")
+
+
+def _function(address, params=(), returns=()):
+    """Returns the spec of a function at `address` using the System V ABI."""
+    func = {
+        "address": address,
+        "return_address": {
+            "memory": {
+                "register": "RSP",
+                "offset": 0
+            },
+            "type": "L"
+        },
+        "return_stack_pointer": {
+            "register": "RSP",
+            "offset": 8,
+            "type": "L"
+        }
+    }
+    if params:
+        func["parameters"] = [{"register": r, "type": t} for r, t in params]
+    if returns:
+        func["return_values"] = [{"register": r, "type": t}
+                                 for r, t in returns]
+    return func
+
+
+def _memory(address, data, executable):
+    return {
+        "address": address,
+        "data": bytes(data).hex(),
+        "is_executable": executable,
+        "is_writeable": False
+    }
+
+
+def _spec(functions, memory, symbols=(), variables=(), targets=()):
+    return {
+        "arch": "amd64",
+        "os": "linux",
+        "functions": functions,
+        "variables": list(variables),
+        "symbols": [[ea, name] for ea, name in symbols],
+        "memory": memory,
+        "control_flow_redirections": [],
+        "control_flow_targets": list(targets),
+        "stack": {
+            "address": 0x500000000000,
+            "size": 0x6000,
+            "start_offset": 0x1000
+        }
+    }
+
+
+def _rel32(next_pc, target):
+    return struct.pack("<i", target - next_pc)
+
+
+def generate_switch(size, **_):
+    """`int f(unsigned x) { switch (x) { case 0: return 0; ... } return -1; }`,
+    with the cases dispatched through a table of 32-bit offsets in read-only
+    data. The targets of the indirect jump are listed in the spec."""
+    table = DATA_BASE
+    code = bytearray()
+    code += b"\x89\xff"                                 # mov edi, edi
+    code += b"\x81\xff" + struct.pack("<I", size - 1)   # cmp edi, size - 1
+    ja_offset = len(code)
+    code += b"\x0f\x87\x00\x00\x00\x00"                 # ja default
+    next_pc = CODE_BASE + len(code) + 7
+    code += b"\x48\x8d\x05" + _rel32(next_pc, table)    # lea rax, [table]
+    code += b"\x48\x63\x0c\xb8"                         # movsxd rcx, [rax+rdi*4]
+    code += b"\x48\x01\xc1"                             # add rcx, rax
+    jmp_ea = CODE_BASE + len(code)
+    code += b"\xff\xe1"                                 # jmp rcx
+
+    cases = []
+    for i in range(size):
+        cases.append(CODE_BASE + len(code))
+        code += b"\xb8" + struct.pack("<I", i) + b"\xc3"  # mov eax, i; ret
+
+    default = CODE_BASE + len(code)
+    code += b"\xb8\xff\xff\xff\xff\xc3"                 # mov eax, -1; ret
+    code[ja_offset + 2:ja_offset + 6] = _rel32(
+        CODE_BASE + ja_offset + 6, default)
+
+    data = b"".join(struct.pack("<i", case - table) for case in cases)
+    return _spec(
+        functions=[_function(CODE_BASE, [("RDI", "I")], [("RAX", "i")])],
+        memory=[_memory(CODE_BASE, code, True), _memory(table, data, False)],
+        symbols=[(CODE_BASE, "switch_{}".format(size))],
+        targets=[{
+            "source": jmp_ea,
+            "complete": True,
+            "destination_list": cases
+        }])
+
+
+def generate_thunks(size, **_):
+    """`size` thunks, each a `jmp` to the next, and then `return 1`."""
+    code = bytearray()
+    functions = []
+    symbols = []
+    for i in range(size):
+        ea = CODE_BASE + len(code)
+        functions.append(_function(ea, returns=[("RAX", "i")]))
+        symbols.append((ea, "thunk_{}".format(i)))
+        code += b"\xe9" + _rel32(ea + 5, ea + 5)        # jmp next
+
+    ea = CODE_BASE + len(code)
+    functions.append(_function(ea, returns=[("RAX", "i")]))
+    symbols.append((ea, "target"))
+    code += b"\xb8\x01\x00\x00\x00\xc3"                 # mov eax, 1; ret
+    return _spec(functions=functions, memory=[_memory(CODE_BASE, code, True)],
+                 symbols=symbols)
+
+
+def generate_blocks(size, **_):
+    """One function that counts down its argument through `size` conditional
+    branches, so that it has about `2 * size` basic blocks."""
+    code = bytearray(b"\x31\xc0")                       # xor eax, eax
+    for _ in range(size):
+        code += b"\x83\xef\x01"                         # sub edi, 1
+        code += b"\x74\x02"                             # je +2
+        code += b"\x01\xf8"                             # add eax, edi
+    code += b"\xc3"                                     # ret
+    return _spec(
+        functions=[_function(CODE_BASE, [("RDI", "i")], [("RAX", "i")])],
+        memory=[_memory(CODE_BASE, code, True)],
+        symbols=[(CODE_BASE, "blocks_{}".format(size))])
+
+
+def generate_symbols(size, functions=16, **_):
+    """`size` one-byte `ret` functions, all of them named, of which the first
+    `functions` are declared."""
+    code = b"\xc3" * size
+    symbols = [(CODE_BASE + i, "symbol_{:08x}".format(i))
+               for i in range(size)]
+    return _spec(
+        functions=[_function(CODE_BASE + i)
+                   for i in range(min(size, functions))],
+        memory=[_memory(CODE_BASE, code, True)],
+        symbols=symbols)
+
+
+def generate_data(size, **_):
+    """A function returning the address of a `size`-entry pointer table, whose
+    entries alternate between pointing at the function, and into the table
+    itself."""
+    table = DATA_BASE
+    code = b"\x48\x8d\x05" + _rel32(CODE_BASE + 7, table) + b"\xc3"
+    entries = []
+    for i in range(size):
+        if i % 2:
+            entries.append(table + 8 * ((i * 7) % size))
+        else:
+            entries.append(CODE_BASE)
+    data = b"".join(struct.pack("<Q", entry) for entry in entries)
+    return _spec(
+        functions=[_function(CODE_BASE, returns=[("RAX", "*v")])],
+        variables=[{"address": table, "type": "[*vx{}]".format(size)}],
+        memory=[_memory(CODE_BASE, code, True), _memory(table, data, False)],
+        symbols=[(CODE_BASE, "get_table"), (table, "table_{}".format(size))])
+
+
+GENERATORS = {
+    "switch": generate_switch,
+    "thunks": generate_thunks,
+    "blocks": generate_blocks,
+    "symbols": generate_symbols,
+    "data": generate_data,
+}
+
+
+def generate(kind, size, **kwargs):
+    """Returns the spec of `kind` and `size` as a JSON-compatible object."""
+    if size < 1:
+        raise ValueError("Size must be at least 1")
+    return GENERATORS[kind](size, **kwargs)
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(
+        description="Generate synthetic specs for scalability benchmarks")
+    parser.add_argument("kind", choices=KINDS)
+    parser.add_argument("--size", type=int, required=True,
+                        help="Size of the stressed dimension")
+    parser.add_argument("--functions", type=int, default=16,
+                        help="Number of declared functions for 'symbols'")
+    parser.add_argument("-o", "--output", default="-",
+                        help="Output spec file, or '-' for stdout")
+    args = parser.parse_args(argv[1:])
+
+    spec = generate(args.kind, args.size, functions=args.functions)
+    if args.output == "-":
+        json.dump(spec, sys.stdout)
+        sys.stdout.write("\n")
+    else:
+        with open(args.output, "w") as out:
+            json.dump(spec, out)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
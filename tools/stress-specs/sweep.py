@@ -0,0 +1,226 @@
+#!/usr/bin/env python3
+
+#
+# Copyright (c) 2021-present, Trail of Bits, Inc.
+# All rights reserved.
+#
+# This source code is licensed in accordance with the terms specified in
+# the LICENSE file found in the root directory of this source tree.
+#
+
+"""Sweeps the sizes of the synthetic specs made by `generate.py`, runs
+`anvill-decompile-json` on each, and reports how its wall time and peak memory
+scale. For each kind of spec, the scaling exponent `k` of `time ~ size^k` is
+fitted over the biggest sizes, so that accidentally quadratic behavior shows
+up as `k` near 2.
+
+Usage: sweep.py path/to/anvill-decompile-json [--kinds switch,blocks]
+                [--max-size N] [--csv out.csv] [--plot out_dir]
+                [-- extra decompile-json flags]
+"""
+
+import argparse
+import csv
+import math
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+import generate
+
+GENERATE_PY = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                           "generate.py")
+
+# The sizes swept for each kind of spec, unless `--sizes` is given. They're
+# geometric so that the scaling exponents can be fitted on a log-log scale.
+DEFAULT_SIZES = {
+    "switch": [64, 256, 1024, 4096, 16384],
+    "thunks": [16, 64, 256, 1024, 4096],
+    "blocks": [256, 1024, 4096, 16384, 50000],
+    "symbols": [4096, 16384, 65536, 262144, 1048576],
+    "data": [4096, 16384, 65536, 262144, 1048576],
+}
+
+SMOKE_SIZES = [1, 4]
+
+
+def run_one(decompile_json, spec_path, ir_path, extra_args, timeout):
+    """Runs `decompile_json` on `spec_path`. Returns the wall time in
+    seconds, the peak RSS in KiB, and the exit code."""
+    args = [decompile_json, "-spec", spec_path, "-ir_out", ir_path]
+    args.extend(extra_args)
+    start = time.monotonic()
+    proc = subprocess.Popen(args, stdout=subprocess.DEVNULL,
+                            stderr=subprocess.DEVNULL)
+    deadline = start + timeout if timeout else None
+    while True:
+        pid, status, usage = os.wait4(proc.pid, os.WNOHANG)
+        if pid:
+            break
+        if deadline and time.monotonic() > deadline:
+            proc.kill()
+            pid, status, usage = os.wait4(proc.pid, 0)
+            break
+        time.sleep(0.01)
+
+    wall = time.monotonic() - start
+    code = os.waitstatus_to_exitcode(status) \
+        if hasattr(os, "waitstatus_to_exitcode") else status
+    return wall, usage.ru_maxrss, code
+
+
+def generate_spec(kind, size, spec_path):
+    """Generates the spec of `kind` and `size` into `spec_path`.
+
+    NOTE: This is done in another process, as the peak RSS of a child
+          process counts the memory of this one from before it exec'd, and
+          big specs would otherwise inflate the measured memory use of the
+          runs that follow them."""
+    subprocess.check_call([sys.executable, GENERATE_PY, kind, "--size",
+                           str(size), "-o", spec_path])
+
+
+def fit_exponent(points):
+    """Least-squares slope of `log(y)` over `log(x)`, or `None` if there
+    aren't enough usable points."""
+    points = [(math.log(x), math.log(y)) for x, y in points if x > 0 and y > 0]
+    if len(points) < 2:
+        return None
+    mean_x = sum(x for x, _ in points) / len(points)
+    mean_y = sum(y for _, y in points) / len(points)
+    num = sum((x - mean_x) * (y - mean_y) for x, y in points)
+    den = sum((x - mean_x) ** 2 for x, _ in points)
+    return num / den if den else None
+
+
+def plot(rows, kinds, out_dir):
+    """Plots time and memory against size for each kind, on log-log scales,
+    into `out_dir/<kind>.png`."""
+    try:
+        import matplotlib
+        matplotlib.use("Agg")
+        import matplotlib.pyplot as plt
+    except ImportError:
+        print("matplotlib is not installed; not plotting", file=sys.stderr)
+        return
+
+    os.makedirs(out_dir, exist_ok=True)
+    for kind in kinds:
+        kind_rows = [r for r in rows if r["kind"] == kind and r["exit"] == 0]
+        if not kind_rows:
+            continue
+        sizes = [r["size"] for r in kind_rows]
+        fig, (time_ax, mem_ax) = plt.subplots(1, 2, figsize=(10, 4))
+        time_ax.loglog(sizes, [r["wall_s"] for r in kind_rows], "o-")
+        time_ax.set_xlabel("size")
+        time_ax.set_ylabel("wall time (s)")
+        mem_ax.loglog(sizes, [r["max_rss_kb"] / 1024.0 for r in kind_rows],
+                      "o-")
+        mem_ax.set_xlabel("size")
+        mem_ax.set_ylabel("peak RSS (MiB)")
+        fig.suptitle("anvill-decompile-json: {}".format(kind))
+        fig.tight_layout()
+        fig.savefig(os.path.join(out_dir, "{}.png".format(kind)))
+        plt.close(fig)
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(
+        description="Measure how anvill-decompile-json scales")
+    parser.add_argument("decompile_json",
+                        help="Path to the anvill-decompile-json executable")
+    parser.add_argument("--kinds", default=",".join(generate.KINDS),
+                        help="Comma-separated kinds of specs to sweep")
+    parser.add_argument("--sizes", default=None,
+                        help="Comma-separated sizes, overriding the defaults")
+    parser.add_argument("--max-size", type=int, default=0,
+                        help="Skip default sizes bigger than this")
+    parser.add_argument("--repeat", type=int, default=1,
+                        help="Runs per size; the fastest one is kept")
+    parser.add_argument("--timeout", type=float, default=0,
+                        help="Seconds after which a run is killed")
+    parser.add_argument("--csv", default=None, help="Write results as CSV")
+    parser.add_argument("--plot", default=None,
+                        help="Directory into which to write plots")
+    parser.add_argument("--smoke", action="store_true",
+                        help="Only run tiny sizes, and fail on any error")
+
+    # Everything after `--` is passed to anvill-decompile-json.
+    argv = argv[1:]
+    extra = []
+    if "--" in argv:
+        extra = argv[argv.index("--") + 1:]
+        argv = argv[:argv.index("--")]
+    args = parser.parse_args(argv)
+
+    kinds = [k for k in args.kinds.split(",") if k]
+    for kind in kinds:
+        if kind not in generate.KINDS:
+            parser.error("Unknown kind '{}'".format(kind))
+
+    rows = []
+    failed = False
+    with tempfile.TemporaryDirectory() as work_dir:
+        for kind in kinds:
+            if args.smoke:
+                sizes = SMOKE_SIZES
+            elif args.sizes:
+                sizes = [int(s) for s in args.sizes.split(",")]
+            else:
+                sizes = [s for s in DEFAULT_SIZES[kind]
+                         if not args.max_size or s <= args.max_size]
+
+            for size in sizes:
+                spec_path = os.path.join(work_dir, "{}_{}.json".format(
+                    kind, size))
+                ir_path = os.path.join(work_dir, "{}_{}.ll".format(kind, size))
+                generate_spec(kind, size, spec_path)
+
+                best = None
+                for _ in range(max(1, args.repeat)):
+                    result = run_one(args.decompile_json, spec_path, ir_path,
+                                     extra, args.timeout)
+                    if best is None or result[0] < best[0]:
+                        best = result
+
+                wall, rss, code = best
+                rows.append({"kind": kind, "size": size, "wall_s": wall,
+                             "max_rss_kb": rss, "exit": code})
+                print("{:8} {:>9} {:>10.3f}s {:>10} KiB{}".format(
+                    kind, size, wall, rss,
+                    "" if code == 0 else "  (exit {})".format(code)))
+                sys.stdout.flush()
+                failed = failed or code != 0
+
+    if args.csv:
+        with open(args.csv, "w", newline="") as out:
+            writer = csv.DictWriter(
+                out, fieldnames=["kind", "size", "wall_s", "max_rss_kb",
+                                 "exit"])
+            writer.writeheader()
+            writer.writerows(rows)
+
+    # The smallest sizes are dominated by start-up costs, e.g. loading the
+    # semantics, so only the biggest three sizes are used for fitting.
+    print("\nScaling exponents (time ~ size^k, memory ~ size^k):")
+    for kind in kinds:
+        kind_rows = [r for r in rows if r["kind"] == kind and r["exit"] == 0]
+        kind_rows = kind_rows[-3:]
+        time_k = fit_exponent([(r["size"], r["wall_s"]) for r in kind_rows])
+        mem_k = fit_exponent([(r["size"], r["max_rss_kb"])
+                              for r in kind_rows])
+        print("{:8} time k={} memory k={}".format(
+            kind,
+            "?" if time_k is None else "{:.2f}".format(time_k),
+            "?" if mem_k is None else "{:.2f}".format(mem_k)))
+
+    if args.plot:
+        plot(rows, kinds, args.plot)
+
+    return 1 if failed and args.smoke else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))